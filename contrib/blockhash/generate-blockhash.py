@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The LBTC developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+'''
+Script to generate the block hash table checked by DPoS::FastCheckBlockHash.
+
+This script expects a text file with lines in the format
+
+    <height> <blockhash>
+
+where blockhash is the hex string printed by getblockhash. With --cli it
+fetches the hashes of a block range from a running node instead:
+
+    generate-blockhash.py --cli <start> <end> <step>
+
+The output is a table sorted by height with the hashes as raw bytes in
+uint256 order, so the node compares them without hex encoding:
+
+    static constexpr CBlockHashCheckpoint vBlockHashCheckpoint[] = {
+    ...
+    };
+
+It should be written to `src/blockhash.h`.
+'''
+
+import subprocess
+import sys
+
+def read_list(f):
+    entries = {}
+    for line in f:
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        height, blockhash = line.split()
+        if len(blockhash) != 64:
+            raise ValueError('Invalid block hash %s' % blockhash)
+        entries[int(height)] = blockhash
+    return entries
+
+def fetch_range(start, end, step):
+    entries = {}
+    for height in range(start, end + 1, step):
+        blockhash = subprocess.check_output(['bitcoin-cli', 'getblockhash', str(height)])
+        entries[height] = blockhash.decode().strip()
+    return entries
+
+def format_entry(height, blockhash):
+    # uint256 stores the bytes in reverse order of its hex string
+    data = bytearray.fromhex(blockhash)[::-1]
+    return '{%d, {%s}}' % (height, ','.join('0x%02x' % b for b in data))
+
+def main():
+    if len(sys.argv) == 5 and sys.argv[1] == '--cli':
+        entries = fetch_range(int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]))
+    elif len(sys.argv) == 2:
+        with open(sys.argv[1], 'r') as f:
+            entries = read_list(f)
+    else:
+        sys.stderr.write('Usage: %s <list.txt> | --cli <start> <end> <step>\n' % sys.argv[0])
+        exit(1)
+
+    g = sys.stdout
+    g.write('#ifndef _LBTC_BLOCK_HASH_H_\n')
+    g.write('#define _LBTC_BLOCK_HASH_H_\n')
+    g.write('/**\n')
+    g.write(' * Generated by contrib/blockhash/generate-blockhash.py, do not edit.\n')
+    g.write(' */\n\n')
+    g.write('#include <stdint.h>\n\n')
+    g.write('struct CBlockHashCheckpoint {\n')
+    g.write('    uint64_t nHeight;\n')
+    g.write('    unsigned char hash[32]; // In uint256 byte order\n')
+    g.write('};\n\n')
+    g.write('// Sorted by height\n')
+    g.write('static constexpr CBlockHashCheckpoint vBlockHashCheckpoint[] = {\n')
+    g.write(',\n'.join(format_entry(height, entries[height]) for height in sorted(entries)))
+    g.write('\n};\n\n')
+    g.write('#endif\n')
+
+if __name__ == '__main__':
+    main()
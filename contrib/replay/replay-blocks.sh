@@ -0,0 +1,34 @@
+#!/bin/bash
+# Copyright (c) 2018 The LBTC developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+# Connect a recorded range of blocks on top of a saved data directory and
+# print the time spent per phase. See README.md.
+
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 <snapshot datadir> <bootstrap file> <stop height> [bitcoind options]" >&2
+  exit 1
+fi
+
+SNAPSHOT="$1"
+BLOCKS="$2"
+STOPHEIGHT="$3"
+shift 3
+BITCOIND=${BITCOIND:-bitcoind}
+
+if [ ! -d "$SNAPSHOT/chainstate" -o ! -d "$SNAPSHOT/dpos" ]; then
+  echo "Error: $SNAPSHOT has no chainstate or dpos directory" >&2
+  exit 1
+fi
+
+# Replays change the data directory, so every run starts from a fresh copy
+DATADIR=$(mktemp -d)
+trap 'rm -rf "$DATADIR"' EXIT
+cp -a "$SNAPSHOT/." "$DATADIR/"
+rm -f "$DATADIR/debug.log" "$DATADIR/peers.dat" "$DATADIR/mempool.dat"
+
+"$BITCOIND" -datadir="$DATADIR" -loadblock="$BLOCKS" -stopatheight="$STOPHEIGHT" \
+  -connect=0 -listen=0 -dnsseed=0 -server=0 -debug=bench -printtoconsole=0 "$@" || exit 1
+
+grep -E "Stopping at height|Connected [0-9]+ blocks in|Shutdown: done" "$DATADIR/debug.log"
@@ -153,6 +153,7 @@ testScripts = [
     'import-rescan.py',
     'bumpfee.py',
     'rpcnamedargs.py',
+    'rpcparking.py',
     'listsinceblock.py',
     'p2p-leaktests.py',
 ]
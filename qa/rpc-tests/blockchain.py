@@ -27,6 +27,7 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - getblock
         - verifychain
 
     """
@@ -44,7 +45,9 @@ class BlockchainTest(BitcoinTestFramework):
 
     def run_test(self):
         self._test_gettxoutsetinfo()
+        self._test_gettxoutsetinfo_muhash()
         self._test_getblockheader()
+        self._test_getblock()
         self.nodes[0].verifychain(4, 0)
 
     def _test_gettxoutsetinfo(self):
@@ -55,9 +58,28 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['transactions'], 200)
         assert_equal(res['height'], 200)
         assert_equal(res['txouts'], 200)
-        assert_equal(res['bytes_serialized'], 13924),
+        assert_equal(res['bogosize'], 17000),
         assert_equal(len(res['bestblock']), 64)
-        assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['hash_serialized_2']), 64)
+
+    def _test_gettxoutsetinfo_muhash(self):
+        node = self.nodes[0]
+        res = node.gettxoutsetinfo('hash_serialized_2')
+
+        # The running statistics agree with the scan
+        running = node.gettxoutsetinfo('muhash')
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock']:
+            assert_equal(running[key], res[key])
+        assert_equal(len(running['muhash']), 64)
+        assert('transactions' not in running)
+
+        # and come back to the same hash after a block is invalidated and reconsidered
+        besthash = node.getbestblockhash()
+        node.invalidateblock(besthash)
+        assert_equal(node.gettxoutsetinfo('muhash')['height'], 199)
+        node.reconsiderblock(besthash)
+        assert_equal(node.gettxoutsetinfo('muhash')['muhash'], running['muhash'])
+        assert_raises(JSONRPCException, node.gettxoutsetinfo, 'sha256')
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -85,5 +107,20 @@ class BlockchainTest(BitcoinTestFramework):
         assert isinstance(int(header['versionHex'], 16), int)
         assert isinstance(header['difficulty'], Decimal)
 
+    def _test_getblock(self):
+        node = self.nodes[0]
+        besthash = node.getbestblockhash()
+
+        # Booleans still select the hex data or the object
+        assert_equal(node.getblock(besthash, False), node.getblock(besthash, 0))
+        block = node.getblock(besthash, 1)
+        assert_equal(node.getblock(besthash, True), block)
+
+        # Verbosity 2 has each transaction in full, the coinbase without a fee
+        fullblock = node.getblock(besthash, 2)
+        assert_equal([tx['txid'] for tx in fullblock['tx']], block['tx'])
+        assert('coinbase' in fullblock['tx'][0]['vin'][0])
+        assert('fee' not in fullblock['tx'][0])
+
 if __name__ == '__main__':
     BlockchainTest().main()
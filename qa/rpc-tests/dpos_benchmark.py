@@ -0,0 +1,397 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The LBTC developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark a regtest DPoS network: some nodes forge for the delegates of a
+# round while they are sent vote, register, bill and payment transactions,
+# and the slot misses, block propagation, mempool acceptance and ConnectBlock
+# timings are written to a JSON report that runs of two builds compare by.
+#
+# It takes some minutes and is not run by rpc-tests.py. Save a report with
+# one build and compare the other with it:
+#
+#   qa/rpc-tests/dpos_benchmark.py --scenario=votes --report=base.json
+#   qa/rpc-tests/dpos_benchmark.py --scenario=votes --baseline=base.json
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import (
+    connect_nodes_bi,
+    initialize_chain_clean,
+    log_filename,
+    set_node_times,
+    start_nodes,
+    sync_blocks,
+)
+
+from collections import Counter
+from datetime import datetime, timezone
+from decimal import Decimal
+import json
+import os
+import random
+import re
+import time
+
+# The DPoS parameters of regtest, as DPoS::Init sets them
+DPOS_START_HEIGHT = 7000
+MAX_DELEGATES = 10
+BLOCK_INTERVAL = 3
+MIN_HOLD_BALANCE = 5000
+COINBASE_MATURITY = 100
+
+# Transactions sent each slot over the whole network
+SCENARIOS = {
+    "idle":     {"votes": 0,  "registers": 0, "bills": 0, "payments": 0},
+    "payments": {"votes": 0,  "registers": 0, "bills": 0, "payments": 20},
+    "votes":    {"votes": 20, "registers": 1, "bills": 0, "payments": 2},
+    "mixed":    {"votes": 8,  "registers": 1, "bills": 2, "payments": 8},
+}
+TRAFFIC = ["votes", "registers", "bills", "payments"]
+
+# Metrics a larger value of is better, by suffix, all others are better smaller
+HIGHER_IS_BETTER = ("blocks", "accept_rate", "confirm_rate", "tx_per_second", "tx_per_block")
+# Counts of the scenario rather than measures of the build
+NOT_COMPARED = {"submitted"}
+
+UPDATETIP_RE = re.compile(r'^(\S+ \S+) UpdateTip: new best=([0-9a-f]{64}) height=(\d+)')
+BENCH_RE = re.compile(r'^(\S+ \S+) +- (Connect total|Connect block|DPoS checks|Voting|Verify \d+ txins): ([0-9.]+)ms')
+BENCH_METRICS = {"Connect total": "connectblock", "Connect block": "connecttip", "DPoS checks": "dposchecks", "Voting": "voting"}
+
+def log_time(s):
+    return datetime.strptime(s, "%Y-%m-%d %H:%M:%S.%f").replace(tzinfo=timezone.utc).timestamp()
+
+def percentiles(name, values, scale=1):
+    """The median, 90th and 99th percentile and maximum of values, by nearest rank, as metrics"""
+    values = sorted(values)
+    if not values:
+        return {}
+    result = {}
+    for p in (50, 90, 99):
+        result["%s_p%d" % (name, p)] = round(values[min(len(values) - 1, len(values) * p // 100)] * scale, 3)
+    result["%s_max" % name] = round(values[-1] * scale, 3)
+    return result
+
+def compare(metrics, baseline, maxregression):
+    """Print the change of each metric in both reports, return those worse than maxregression percent.
+    Rates are compared in percentage points, anything else relative to the baseline."""
+    regressions = []
+    for key in sorted(baseline):
+        if key not in metrics or key in NOT_COMPARED:
+            continue
+        value, base = metrics[key], baseline[key]
+        if key.endswith("_rate"):
+            change = (value - base) * 100
+        elif base != 0:
+            change = (value / base - 1) * 100
+        else:
+            continue
+        if key.endswith(HIGHER_IS_BETTER):
+            change = -change
+        regressed = change > maxregression
+        print("  %-28s %12s against %12s %+8.1f%% %s" % (key, value, base, change, "worse, a regression" if regressed else ""))
+        if regressed:
+            regressions.append(key)
+    return regressions
+
+class Traffic(object):
+    """Sends the transactions of a scenario, and counts those accepted and rejected"""
+
+    def __init__(self, test, rates):
+        self.test = test
+        self.rates = rates
+        self.submitted = Counter()
+        self.accepted = Counter()
+        self.errors = Counter()
+        self.txids = set()
+        self.nregistered = 0
+        self.bills = []
+
+    def send(self, kind, node, method, *args):
+        self.submitted[kind] += 1
+        try:
+            result = getattr(node, method)(*args)
+        except JSONRPCException as e:
+            self.errors["%s: %s" % (method, e.error['message'])] += 1
+            return None
+        self.accepted[kind] += 1
+        txid = result["txid"] if isinstance(result, dict) else result
+        self.txids.add(txid)
+        return result
+
+    def slot(self):
+        t = self.test
+        # A voter acts again once its last transaction is in a block
+        pending = set()
+        for node in t.nodes:
+            pending.update(node.getrawmempool())
+
+        voters = [v for v in t.voters if v["txid"] not in pending]
+        random.shuffle(voters)
+        for voter in voters[:self.rates["votes"]]:
+            node = t.nodes[voter["node"]]
+            if voter["voted"] is None:
+                name = random.choice(t.delegate_names)
+                voter["txid"] = self.send("votes", node, "vote", voter["address"], name)
+                if voter["txid"]:
+                    voter["voted"] = name
+            else:
+                voter["txid"] = self.send("votes", node, "cancelvote", voter["address"], voter["voted"])
+                if voter["txid"]:
+                    voter["voted"] = None
+
+        for _ in range(self.rates["registers"]):
+            if not t.registrants:
+                self.submitted["registers"] += 1
+                self.errors["register: out of funded addresses"] += 1
+                continue
+            n, address = t.registrants.pop()
+            self.send("registers", t.nodes[n], "register", address, "benchnode%d" % self.nregistered)
+            self.nregistered += 1
+
+        # Each bill voter votes the last bill once it is in a block, then the next is submitted
+        for _ in range(self.rates["bills"]):
+            billid, txid = self.bills[-1] if self.bills else (None, None)
+            if billid is None or all(v["bill"] == billid for v in t.billvoters):
+                n, address = t.proposer
+                result = self.send("bills", t.nodes[n], "submitbill", address, "bill%d" % len(self.bills),
+                                   "benchmark bill", "http://localhost/bill", "1", "yes", "no")
+                if result:
+                    self.bills.append((result["billid"], result["txid"]))
+                continue
+            voters = [v for v in t.billvoters if v["bill"] != billid and v["txid"] not in pending]
+            if txid in pending or not voters:
+                continue
+            voter = voters[0]
+            voter["txid"] = self.send("bills", t.nodes[voter["node"]], "votebill", voter["address"], billid, str(random.randint(0, 1)))
+            if voter["txid"]:
+                voter["bill"] = billid
+
+        for k in range(self.rates["payments"]):
+            n = random.randrange(t.num_nodes)
+            to = random.choice(t.payees[(n + 1 + k) % t.num_nodes])
+            self.send("payments", t.nodes[n], "sendtoaddress", to, Decimal("0.1"))
+
+class DPoSBenchmark(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+
+    def add_options(self, parser):
+        parser.add_option("--nodes", dest="nodes", default=4, type='int',
+                          help="Number of nodes, the delegates are spread over them (default: %default)")
+        parser.add_option("--delegates", dest="delegates", default=MAX_DELEGATES - 1, type='int',
+                          help="Number of delegates forging, at most %d as the super forger has a slot of its own (default: %%default)" % (MAX_DELEGATES - 1))
+        parser.add_option("--rounds", dest="rounds", default=5, type='int',
+                          help="Number of DPoS rounds to measure (default: %default)")
+        parser.add_option("--scenario", dest="scenario", default="mixed", choices=sorted(SCENARIOS),
+                          help="Traffic sent, one of %s (default: %%default)" % ", ".join(sorted(SCENARIOS)))
+        for kind in TRAFFIC:
+            parser.add_option("--" + kind, dest=kind, default=None, type='int',
+                              help="Override the %s the scenario sends each slot" % kind)
+        parser.add_option("--report", dest="report", default=None,
+                          help="Write the JSON report there (default: dpos_benchmark.json in the test directory)")
+        parser.add_option("--baseline", dest="baseline", default=None,
+                          help="Compare with the report of an earlier run, and fail on a regression")
+        parser.add_option("--maxregression", dest="maxregression", default=10.0, type='float',
+                          help="How much worse than the baseline a metric may be, in percent or percentage points for rates (default: %default)")
+
+    def setup_chain(self):
+        assert 0 < self.options.delegates < MAX_DELEGATES
+        self.num_nodes = self.options.nodes
+        self.rates = dict(SCENARIOS[self.options.scenario])
+        for kind in TRAFFIC:
+            if getattr(self.options, kind) is not None:
+                self.rates[kind] = getattr(self.options, kind)
+        print("Initializing test directory " + self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, self.num_nodes)
+
+    def setup_network(self):
+        args = ["-debug=bench", "-logtimemicros", "-keypool=100"]
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [args] * self.num_nodes)
+        for a in range(self.num_nodes):
+            for b in range(a + 1, self.num_nodes):
+                connect_nodes_bi(self.nodes, a, b)
+        self.is_network_split = False
+
+    def fund(self, amounts):
+        """Send from node 0 to the (node, address) keys of amounts, in one transaction per node"""
+        for n in range(self.num_nodes):
+            outputs = {address: amount for (m, address), amount in amounts.items() if m == n}
+            if outputs:
+                self.nodes[0].sendmany("", outputs)
+
+    def generate_to(self, height):
+        while self.nodes[0].getblockcount() < height:
+            self.nodes[0].generate(min(500, height - self.nodes[0].getblockcount()))
+            sync_blocks(self.nodes, timeout=300)
+
+    def setup_delegates(self):
+        """Mine the blocks until DPoS starts, with the delegates registered, voted, and funded
+        along with the addresses that send the traffic"""
+        # Blocks come faster than a second apart, so their times run ahead of the clock. Starting
+        # back in time keeps the last block before DPoS in the past, or no slot could be forged
+        set_node_times(self.nodes, int(time.time()) - DPOS_START_HEIGHT // 4)
+        self.generate_to(COINBASE_MATURITY + 1)
+
+        n, slots = self.num_nodes, self.options.rounds * MAX_DELEGATES
+        new = lambda i: (i % n, self.nodes[i % n].getnewaddress())
+        self.delegates = [new(i) for i in range(self.options.delegates)]
+        self.delegate_names = ["benchdelegate%d" % i for i in range(self.options.delegates)]
+        self.voters = [{"node": m, "address": a, "voted": None, "txid": None}
+                       for m, a in (new(i) for i in range(2 * self.rates["votes"]))]
+        self.billvoters = [{"node": m, "address": a, "bill": None, "txid": None}
+                           for m, a in (new(i) for i in range(2 * self.rates["bills"]))]
+        self.registrants = [new(i) for i in range(self.rates["registers"] * slots)]
+        self.proposer = new(0)
+        self.payees = [[self.nodes[m].getnewaddress() for _ in range(10)] for m in range(n)]
+        wallets = [(m, self.nodes[m].getnewaddress()) for m in range(n) for _ in range(50)]
+        voter = (0, self.nodes[0].getnewaddress())
+
+        amounts = {d: 2 * MIN_HOLD_BALANCE for d in self.delegates}
+        amounts.update({(v["node"], v["address"]): 100 for v in self.voters + self.billvoters})
+        amounts.update({r: 10 for r in self.registrants})
+        amounts.update({w: 1000 for w in wallets})
+        amounts[self.proposer] = 100
+        amounts[voter] = 100000
+        self.fund(amounts)
+        self.generate_to(self.nodes[0].getblockcount() + 1)
+
+        for (m, address), name in zip(self.delegates, self.delegate_names):
+            self.nodes[m].register(address, name)
+        self.generate_to(self.nodes[0].getblockcount() + 1)
+        self.nodes[0].vote(voter[1], *self.delegate_names)
+        self.generate_to(DPOS_START_HEIGHT - 1)
+        set_node_times(self.nodes, 0)
+
+    def wait_for_height(self, height, timeout):
+        deadline = time.time() + timeout
+        while min(node.getblockcount() for node in self.nodes) < height:
+            assert time.time() < deadline, "the network did not reach height %d" % height
+            time.sleep(0.5)
+
+    def run_test(self):
+        print("Mining until the DPoS start with %d delegates on %d nodes" % (self.options.delegates, self.num_nodes))
+        self.setup_delegates()
+        for m, address in self.delegates:
+            assert self.nodes[m].startforging(address) == "true"
+        self.wait_for_height(DPOS_START_HEIGHT + 1, 3 * MAX_DELEGATES * BLOCK_INTERVAL)
+
+        print("Sending %s for %d rounds" % (", ".join("%d %s" % (self.rates[k], k) for k in TRAFFIC), self.options.rounds))
+        traffic = Traffic(self, self.rates)
+        start_height = self.nodes[0].getblockcount()
+        start_time = time.time()
+        end_time = start_time + self.options.rounds * MAX_DELEGATES * BLOCK_INTERVAL
+        next_slot = start_time
+        while next_slot < end_time:
+            traffic.slot()
+            next_slot += BLOCK_INTERVAL
+            time.sleep(max(0, next_slot - time.time()))
+        end_height = self.nodes[0].getblockcount()
+        # What was sent last is in a block or left in the mempool for good by then
+        self.wait_for_height(end_height + 2, 3 * MAX_DELEGATES * BLOCK_INTERVAL)
+        sync_blocks(self.nodes)
+        time.sleep(1)
+
+        metrics = self.collect(traffic, start_height, end_height, start_time, end_time)
+        report = {
+            "version": self.nodes[0].getnetworkinfo()["subversion"],
+            "scenario": self.options.scenario,
+            "params": dict(self.rates, nodes=self.num_nodes, delegates=self.options.delegates, rounds=self.options.rounds),
+            "metrics": metrics,
+            "errors": dict(traffic.errors.most_common(10)),
+        }
+        path = self.options.report or os.path.join(self.options.tmpdir, "dpos_benchmark.json")
+        with open(path, "w", encoding="utf8") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+        print("Report written to %s" % path)
+        for key in sorted(metrics):
+            print("  %-28s %s" % (key, metrics[key]))
+        for error, count in traffic.errors.most_common(10):
+            print("  rejected %d times: %s" % (count, error))
+
+        if self.options.baseline:
+            with open(self.options.baseline, encoding="utf8") as f:
+                baseline = json.load(f)
+            if baseline.get("params") != report["params"]:
+                print("Warning: the baseline was run with %s" % baseline.get("params"))
+            print("Compared with %s:" % self.options.baseline)
+            regressions = compare(metrics, baseline["metrics"], self.options.maxregression)
+            assert not regressions, "%d metrics regressed by more than %.1f%%: %s" % (len(regressions), self.options.maxregression, ", ".join(regressions))
+
+    def collect(self, traffic, start_height, end_height, start_time, end_time):
+        metrics = {"blocks": end_height - start_height}
+
+        # Slots of the delegates forged for, each node reports its own
+        produced = missed = orphaned = 0
+        slot_times = {"processtime": [], "broadcastdelay": [], "relaydelay": []}
+        for node in self.nodes:
+            stats = node.getforgingstats(max(1, node.getblockcount() - start_height))
+            for delegate in stats["delegates"]:
+                produced += delegate["produced"]
+                missed += delegate["missed"]
+                orphaned += delegate["orphaned"]
+            for slot in stats["slots"]:
+                if start_time <= slot["time"] < end_time:
+                    for key in slot_times:
+                        if key in slot:
+                            slot_times[key].append(slot[key])
+        metrics["slot_miss_rate"] = round(missed / max(1, produced + missed), 4)
+        metrics["orphaned"] = orphaned
+        for key, values in slot_times.items():
+            metrics.update(percentiles(key + "_ms", values, 0.001))
+
+        # Transactions of the blocks forged meanwhile
+        hashes, ntx, confirmed = [], 0, 0
+        for height in range(start_height + 1, end_height + 3):
+            block = self.nodes[0].getblock(self.nodes[0].getblockhash(height))
+            if height <= end_height:
+                hashes.append(block["hash"])
+                ntx += len(block["tx"]) - 1
+            confirmed += len(traffic.txids.intersection(block["tx"]))
+        submitted = sum(traffic.submitted.values())
+        metrics["tx_per_block"] = round(ntx / max(1, len(hashes)), 2)
+        metrics["tx_per_second"] = round(ntx / (end_time - start_time), 2)
+        metrics["submitted"] = submitted
+        metrics["accept_rate"] = round(sum(traffic.accepted.values()) / max(1, submitted), 4)
+        metrics["confirm_rate"] = round(confirmed / max(1, len(traffic.txids)), 4)
+        for kind in TRAFFIC:
+            if traffic.submitted[kind]:
+                metrics[kind + "_accept_rate"] = round(traffic.accepted[kind] / traffic.submitted[kind], 4)
+
+        # Block arrival at each node and the bench timings, from the debug logs
+        arrivals = {h: [] for h in hashes}
+        timings = {name: [] for name in BENCH_METRICS.values()}
+        timings["verify"] = []
+        for n in range(self.num_nodes):
+            with open(log_filename(self.options.tmpdir, n, "debug.log"), encoding="utf8", errors="replace") as f:
+                for line in f:
+                    m = UPDATETIP_RE.match(line)
+                    if m:
+                        if m.group(2) in arrivals:
+                            arrivals[m.group(2)].append(log_time(m.group(1)))
+                        continue
+                    m = BENCH_RE.match(line)
+                    if m and log_time(m.group(1)) >= start_time:
+                        name = "verify" if m.group(2).startswith("Verify") else BENCH_METRICS[m.group(2)]
+                        timings[name].append(float(m.group(3)))
+        delays, spreads = [], []
+        for times in arrivals.values():
+            if len(times) < 2:
+                continue
+            first = min(times)
+            delays.extend(t - first for t in times if t != first)
+            spreads.append(max(times) - first)
+        # From the forger to each other node, and until the last one has the block
+        metrics.update(percentiles("propagation_ms", delays, 1000))
+        metrics.update(percentiles("propagation_all_ms", spreads, 1000))
+        for name, values in timings.items():
+            metrics.update(percentiles(name + "_ms", values))
+        return metrics
+
+if __name__ == '__main__':
+    DPoSBenchmark().main()
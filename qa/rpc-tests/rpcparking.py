@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The LBTC developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the calls that wait for the tip, which the HTTP server parks instead
+# of keeping a worker thread waiting: they must wake on a new tip, time out,
+# not hold the threads while parked, and be answered when the node shuts down.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import threading
+
+class WaitingCall(threading.Thread):
+    def __init__(self, node, method, *args):
+        threading.Thread.__init__(self)
+        # a connection of its own, we can't use the same one from two threads
+        self.node = get_rpc_proxy(node.url, 0, timeout=600)
+        self.method = method
+        self.args = args
+        self.result = None
+        self.error = None
+        self.elapsed = None
+
+    def run(self):
+        start = time.time()
+        try:
+            self.result = getattr(self.node, self.method)(*self.args)
+        except JSONRPCException as e:
+            self.error = e.error
+        self.elapsed = time.time() - start
+
+class RPCParkingTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = False
+        # fewer threads than the calls parked at once
+        self.extra_args = [["-rpcthreads=2"], []]
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, self.extra_args)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def start_calls(self, count):
+        calls = []
+        for i in range(count):
+            calls.append(WaitingCall(self.nodes[0], "waitfornewblock"))
+        longpollid = self.nodes[0].getblocktemplate()['longpollid']
+        calls.append(WaitingCall(self.nodes[0], "getblocktemplate", {'longpollid': longpollid}))
+        for call in calls:
+            call.start()
+        # let them run once and park
+        time.sleep(2)
+        for call in calls:
+            assert(call.is_alive())
+        return calls
+
+    def run_test(self):
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        print("Parked calls wake on a new tip, and don't hold the RPC threads meanwhile")
+        calls = self.start_calls(4)
+        assert_equal(self.nodes[0].getblockcount(), self.nodes[1].getblockcount())
+        tip = self.nodes[1].generate(1)[0]
+        for call in calls:
+            call.join(10)
+            assert(not call.is_alive())
+            assert_equal(call.error, None)
+        for call in calls[:-1]:
+            assert_equal(call.result['hash'], tip)
+        assert_equal(calls[-1].result['previousblockhash'], tip)
+
+        print("A parked call with a timeout returns the same tip when it expires")
+        call = WaitingCall(self.nodes[0], "waitfornewblock", 3000)
+        call.start()
+        call.join(10)
+        assert(not call.is_alive())
+        assert_equal(call.error, None)
+        assert_equal(call.result['hash'], tip)
+        assert(call.elapsed >= 3)
+        call = WaitingCall(self.nodes[0], "waitforblockheight", self.nodes[0].getblockcount() + 1, 1000)
+        call.start()
+        call.join(10)
+        assert(not call.is_alive())
+        assert_equal(call.result['hash'], tip)
+
+        print("Parked calls are answered when the node shuts down")
+        calls = self.start_calls(3)
+        stop_node(self.nodes[0], 0)
+        for call in calls:
+            call.join(10)
+            assert(not call.is_alive())
+            assert_equal(call.result, None)
+            assert_equal(call.error['code'], -9)
+
+        self.nodes[0] = start_node(0, self.options.tmpdir, self.extra_args[0])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.sync_all()
+
+if __name__ == '__main__':
+    RPCParkingTest().main()
@@ -3,6 +3,8 @@
 #define _ADDRESS_INDEX_H_
 
 #include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
 
 #include <algorithm>
 #include <exception>
@@ -165,4 +167,144 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/**
+ * Prefix of the history rows of one transaction of an address. The rows of
+ * earlier transactions sort before it, those of the transaction and later
+ * ones after it.
+ */
+struct CAddressIndexIteratorPositionKey {
+    unsigned int type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+
+    size_t GetSerializeSize() const {
+        return 29;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+    }
+
+    CAddressIndexIteratorPositionKey(unsigned int addressType, uint160 addressHash, int height, unsigned int blockindex) {
+        type = addressType;
+        hashBytes = addressHash;
+        blockHeight = height;
+        txindex = blockindex;
+    }
+
+    CAddressIndexIteratorPositionKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        type = 0;
+        hashBytes.SetNull();
+        blockHeight = 0;
+        txindex = 0;
+    }
+};
+
+/** Key of an unspent output in the address index, grouped by address */
+struct CAddressUnspentKey {
+    unsigned int type;
+    uint160 hashBytes;
+    uint256 txhash;
+    size_t index;
+
+    size_t GetSerializeSize() const {
+        return 57;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        txhash.Serialize(s);
+        ser_writedata32be(s, index);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32be(s);
+    }
+
+    CAddressUnspentKey(unsigned int addressType, uint160 addressHash, uint256 txid, size_t indexValue) {
+        type = addressType;
+        hashBytes = addressHash;
+        txhash = txid;
+        index = indexValue;
+    }
+
+    CAddressUnspentKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        type = 0;
+        hashBytes.SetNull();
+        txhash.SetNull();
+        index = 0;
+    }
+};
+
+/** Amount and height of an unspent output; a null value erases the entry */
+struct CAddressUnspentValue {
+    CAmount satoshis;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(satoshis);
+        READWRITE(blockHeight);
+    }
+
+    CAddressUnspentValue(CAmount sats, int height) {
+        satoshis = sats;
+        blockHeight = height;
+    }
+
+    CAddressUnspentValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        satoshis = -1;
+        blockHeight = 0;
+    }
+
+    bool IsNull() const {
+        return satoshis == -1;
+    }
+};
+
+/** Running totals of an address, keyed by CAddressIndexIteratorKey */
+struct CAddressBalance {
+    CAmount nBalance;
+    CAmount nReceived;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nBalance);
+        READWRITE(nReceived);
+    }
+
+    CAddressBalance() : nBalance(0), nReceived(0) {}
+};
+
 #endif
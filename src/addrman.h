@@ -13,11 +13,14 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <stdint.h>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 /**
  * Extended statistics about a CAddress
  */
@@ -48,7 +51,7 @@ private:
     //! in tried set? (memory only)
     bool fInTried;
 
-    //! position in vRandom
+    //! position in vRandom, -1 for a deleted entry
     int nRandomPos;
 
     friend class CAddrMan;
@@ -171,20 +174,66 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+/**
+ * The filled positions of a bucket table, each bucket * ADDRMAN_BUCKET_SIZE + position,
+ * so that one can be drawn directly rather than found by probing random empty ones.
+ */
+class CAddrTablePositions
+{
+private:
+    //! the filled positions, in no particular order
+    std::vector<int> vPos;
+
+    //! index in vPos of each position, -1 when it is empty
+    std::vector<int> vIndex;
+
+public:
+    explicit CAddrTablePositions(int nPositions) : vIndex(nPositions, -1) {}
+
+    void Insert(int nPos)
+    {
+        if (vIndex[nPos] != -1)
+            return;
+        vIndex[nPos] = vPos.size();
+        vPos.push_back(nPos);
+    }
+
+    void Erase(int nPos)
+    {
+        int nIndex = vIndex[nPos];
+        if (nIndex == -1)
+            return;
+        vPos[nIndex] = vPos.back();
+        vIndex[vPos[nIndex]] = nIndex;
+        vPos.pop_back();
+        vIndex[nPos] = -1;
+    }
+
+    void Clear()
+    {
+        vPos.clear();
+        std::fill(vIndex.begin(), vIndex.end(), -1);
+    }
+
+    size_t size() const { return vPos.size(); }
+    int operator[](size_t n) const { return vPos[n]; }
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
 class CAddrMan
 {
 private:
-    //! critical section to protect the inner data structures
-    mutable CCriticalSection cs;
+    //! protects the inner data structures; GetAddr, Select, size and Serialize,
+    //! which change none of them, only take it shared and may run together
+    mutable boost::shared_mutex cs;
 
-    //! last used nId
-    int nIdCount;
+    //! table with information about all nIds, indexed by nId
+    std::vector<CAddrInfo> vInfo;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! nIds of deleted entries, which Create hands out again
+    std::vector<int> vFreeIds;
 
     //! find an nId based on its network address
     std::map<CNetAddr, int> mapAddr;
@@ -198,12 +247,18 @@ private:
     //! list of "tried" buckets
     int vvTried[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! filled positions of vvTried
+    CAddrTablePositions posTried;
+
     //! number of (unique) "new" entries
     int nNew;
 
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! filled positions of vvNew
+    CAddrTablePositions posNew;
+
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
@@ -224,6 +279,10 @@ protected:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    //! Set a position in the "new" or "tried" table to nId, or to -1 to empty it. All writes to vvNew and vvTried go here.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
     //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
@@ -253,7 +312,7 @@ protected:
     int Check_();
 #endif
 
-    //! Select several addresses at once.
+    //! Select several addresses at once. This changes nothing, so that it may run under the shared lock.
     void GetAddr_(std::vector<CAddress> &vAddr);
 
     //! Mark an entry as currently-connected-to.
@@ -295,7 +354,7 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        boost::shared_lock<boost::shared_mutex> lock(cs);
 
         unsigned char nVersion = 1;
         s << nVersion;
@@ -306,11 +365,11 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            vUnkIds[n] = nIds;
+            const CAddrInfo &info = vInfo[n];
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
                 s << info;
@@ -318,8 +377,8 @@ public:
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
                 s << info;
@@ -335,7 +394,7 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
@@ -345,7 +404,7 @@ public:
     template<typename Stream>
     void Unserialize(Stream& s)
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
 
         Clear();
 
@@ -372,8 +431,11 @@ public:
         }
 
         // Deserialize entries from the new table.
+        vInfo.reserve(nNew + nTried);
+        vInfo.resize(nNew);
+        vRandom.reserve(nNew + nTried);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = vInfo[n];
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
@@ -384,12 +446,11 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -399,13 +460,13 @@ public:
             int nKBucket = info.GetTriedBucket(nKey);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                vInfo.push_back(info);
+                mapAddr[info] = nId;
+                SetTried(nKBucket, nKBucketPos, nId);
             } else {
                 nLost++;
             }
@@ -420,11 +481,11 @@ public:
                 int nIndex = 0;
                 s >> nIndex;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
+                    CAddrInfo &info = vInfo[nIndex];
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -432,25 +493,25 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            if (vInfo[n].nRandomPos != -1 && vInfo[n].fInTried == false && vInfo[n].nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
             LogPrint("addrman", "addrman lost %i new and %i tried addresses due to collisions\n", nLostUnk, nLost);
         }
 
-        Check();
+        CheckLocked();
     }
 
     void Clear()
     {
+        std::vector<CAddrInfo>().swap(vInfo);
+        std::vector<int>().swap(vFreeIds);
         std::vector<int>().swap(vRandom);
+        mapAddr.clear();
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
@@ -462,14 +523,15 @@ public:
                 vvTried[bucket][entry] = -1;
             }
         }
+        posNew.Clear();
+        posTried.Clear();
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
     }
 
-    CAddrMan()
+    CAddrMan() : posTried(ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE), posNew(ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE)
     {
         Clear();
     }
@@ -482,20 +544,26 @@ public:
     //! Return the number of (unique) addresses in all tables.
     size_t size() const
     {
-        LOCK(cs); // TODO: Cache this in an atomic to avoid this overhead
+        boost::shared_lock<boost::shared_mutex> lock(cs);
         return vRandom.size();
     }
 
+    //! Consistency check, with cs held
+    void CheckLocked()
+    {
+#ifdef DEBUG_ADDRMAN
+        int err;
+        if ((err=Check_()))
+            LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
+#endif
+    }
+
     //! Consistency check
     void Check()
     {
 #ifdef DEBUG_ADDRMAN
-        {
-            LOCK(cs);
-            int err;
-            if ((err=Check_()))
-                LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
-        }
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        CheckLocked();
 #endif
     }
 
@@ -506,11 +574,11 @@ public:
             return false;    
         }
 
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         bool fRet = false;
-        Check();
+        CheckLocked();
         fRet |= Add_(addr, source, nTimePenalty);
-        Check();
+        CheckLocked();
         if (fRet)
             LogPrint("addrman", "Added %s from %s: %i tried, %i new\n", addr.ToStringIPPort(), source.ToString(), nTried, nNew);
         return fRet;
@@ -519,12 +587,12 @@ public:
     //! Add multiple addresses.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         int nAdd = 0;
-        Check();
+        CheckLocked();
         for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
             nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
-        Check();
+        CheckLocked();
         if (nAdd)
             LogPrint("addrman", "Added %i addresses from %s: %i tried, %i new\n", nAdd, source.ToString(), nTried, nNew);
         return nAdd > 0;
@@ -533,19 +601,19 @@ public:
     //! Mark an entry as accessible.
     void Good(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
-        Check();
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        CheckLocked();
         Good_(addr, nTime);
-        Check();
+        CheckLocked();
     }
 
     //! Mark an entry as connection attempted to.
     void Attempt(const CService &addr, bool fCountFailure, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
-        Check();
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        CheckLocked();
         Attempt_(addr, fCountFailure, nTime);
-        Check();
+        CheckLocked();
     }
 
     /**
@@ -553,13 +621,13 @@ public:
      */
     CAddrInfo Select(bool newOnly = false)
     {
+        Check();
         CAddrInfo addrRet;
         {
-            LOCK(cs);
-            Check();
+            boost::shared_lock<boost::shared_mutex> lock(cs);
             addrRet = Select_(newOnly);
-            Check();
         }
+        Check();
         return addrRet;
     }
 
@@ -569,7 +637,7 @@ public:
         Check();
         std::vector<CAddress> vAddr;
         {
-            LOCK(cs);
+            boost::shared_lock<boost::shared_mutex> lock(cs);
             GetAddr_(vAddr);
         }
         Check();
@@ -579,18 +647,18 @@ public:
     //! Mark an entry as currently-connected-to.
     void Connected(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
-        Check();
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        CheckLocked();
         Connected_(addr, nTime);
-        Check();
+        CheckLocked();
     }
 
     void SetServices(const CService &addr, ServiceFlags nServices)
     {
-        LOCK(cs);
-        Check();
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        CheckLocked();
         SetServices_(addr, nServices);
-        Check();
+        CheckLocked();
     }
 
 };
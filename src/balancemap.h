@@ -0,0 +1,200 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BALANCEMAP_H
+#define BITCOIN_BALANCEMAP_H
+
+#include "hash.h"
+#include "memusage.h"
+#include "random.h"
+#include "txdb.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/**
+ * Cached address balance, modeled on CCoinsCacheEntry. It is also the slot
+ * of CBalanceMap and carries its address unpadded, 32 bytes in all.
+ */
+struct CBalanceCacheEntry {
+    uint64_t nBalance;
+    uint160 id;
+    uint8_t type;
+    unsigned char flags;
+    bool fUsed; // The CBalanceMap slot holds an entry.
+
+    enum Flags {
+        DIRTY = (1 << 0), // This cache entry is potentially different from the version in the vote database.
+        FRESH = (1 << 1), // The vote database does not have this entry.
+    };
+
+    CBalanceCacheEntry() : nBalance(0), type(0), flags(0), fUsed(false) {}
+
+    CMyAddress GetAddress() const { return CMyAddress(id, type); }
+};
+
+class SaltedAddressHasher
+{
+private:
+    /** Salt */
+    uint64_t k0, k1;
+
+public:
+    SaltedAddressHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CMyAddress& address) const {
+        return CSipHasher(k0, k1).Write(address.first.begin(), address.first.size()).Write(&address.second, 1).Finalize();
+    }
+};
+
+/**
+ * Open addressing hash table of address balances with linear probing. The
+ * entries live in one flat array instead of a 64 byte heap node and a bucket
+ * pointer each, so probes stay within cache lines and no allocation is made
+ * per address. Inserting or erasing invalidates iterators.
+ */
+class CBalanceMap
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(CBalanceCacheEntry* p, CBalanceCacheEntry* pend) : p(p), pend(pend) { Skip(); }
+
+        CBalanceCacheEntry& operator*() const { return *p; }
+        CBalanceCacheEntry* operator->() const { return p; }
+        iterator& operator++() { ++p; Skip(); return *this; }
+        bool operator==(const iterator& other) const { return p == other.p; }
+        bool operator!=(const iterator& other) const { return p != other.p; }
+
+    private:
+        friend class CBalanceMap;
+
+        void Skip() { while (p != pend && !p->fUsed) ++p; }
+
+        CBalanceCacheEntry* p;
+        CBalanceCacheEntry* pend;
+    };
+
+    CBalanceMap() : nSize(0) {}
+
+    iterator begin() { return iterator(vSlot.data(), vSlot.data() + vSlot.size()); }
+    iterator end() { return iterator(vSlot.data() + vSlot.size(), vSlot.data() + vSlot.size()); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const CMyAddress& address)
+    {
+        if (vSlot.empty())
+            return end();
+
+        for (size_t i = GetSlot(address); vSlot[i].fUsed; i = (i + 1) & (vSlot.size() - 1)) {
+            if (vSlot[i].type == address.second && vSlot[i].id == address.first)
+                return MakeIterator(i);
+        }
+        return end();
+    }
+
+    /** Add the balance of an address that is not in the map yet */
+    iterator insert(const CMyAddress& address, uint64_t nBalance, unsigned char flags)
+    {
+        if ((nSize + 1) * 4 > vSlot.size() * 3)
+            Rehash(std::max<size_t>(MIN_SLOTS, vSlot.size() * 2));
+
+        size_t i = GetSlot(address);
+        while (vSlot[i].fUsed)
+            i = (i + 1) & (vSlot.size() - 1);
+
+        CBalanceCacheEntry& entry = vSlot[i];
+        entry.nBalance = nBalance;
+        entry.id = address.first;
+        entry.type = address.second;
+        entry.flags = flags;
+        entry.fUsed = true;
+        ++nSize;
+        return MakeIterator(i);
+    }
+
+    void erase(iterator it)
+    {
+        // Backward shift deletion: move up every later entry of the probe run
+        // that would become unreachable, so no tombstones are needed.
+        size_t mask = vSlot.size() - 1;
+        size_t i = it.p - vSlot.data();
+        size_t j = i;
+        vSlot[i].fUsed = false;
+        --nSize;
+        while (true) {
+            j = (j + 1) & mask;
+            if (!vSlot[j].fUsed)
+                break;
+
+            size_t k = GetSlot(vSlot[j].GetAddress());
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+                continue;
+
+            vSlot[i] = vSlot[j];
+            vSlot[j].fUsed = false;
+            i = j;
+        }
+    }
+
+    void reserve(size_t n)
+    {
+        size_t nSlots = MIN_SLOTS;
+        while (n * 4 > nSlots * 3)
+            nSlots *= 2;
+        if (nSlots > vSlot.size())
+            Rehash(nSlots);
+    }
+
+    void swap(CBalanceMap& other)
+    {
+        vSlot.swap(other.vSlot);
+        std::swap(nSize, other.nSize);
+        std::swap(hasher, other.hasher);
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::MallocUsage(vSlot.capacity() * sizeof(CBalanceCacheEntry));
+    }
+
+private:
+    static const size_t MIN_SLOTS = 16;
+
+    size_t GetSlot(const CMyAddress& address) const
+    {
+        return hasher(address) & (vSlot.size() - 1);
+    }
+
+    iterator MakeIterator(size_t i)
+    {
+        return iterator(vSlot.data() + i, vSlot.data() + vSlot.size());
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<CBalanceCacheEntry> vOld(nSlots);
+        vOld.swap(vSlot);
+        for (auto& entry : vOld) {
+            if (!entry.fUsed)
+                continue;
+
+            size_t i = GetSlot(entry.GetAddress());
+            while (vSlot[i].fUsed)
+                i = (i + 1) & (nSlots - 1);
+            vSlot[i] = entry;
+        }
+    }
+
+    std::vector<CBalanceCacheEntry> vSlot;
+    size_t nSize;
+    SaltedAddressHasher hasher;
+};
+
+#endif // BITCOIN_BALANCEMAP_H
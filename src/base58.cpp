@@ -18,6 +18,35 @@
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
+/** Digits of base58 decoded, -1 for characters outside the alphabet */
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+/**
+ * The big numbers are kept in 32-bit limbs, least significant first, and
+ * worked on several digits at a time: 58^5 and 2^32 both fit a limb, so
+ * each step multiplies by 58^5 or 2^32 in 64-bit arithmetic instead of
+ * by 58 or 256.
+ */
+static const uint32_t BASE58_LIMB = 58 * 58 * 58 * 58 * 58;
+static const int BASE58_LIMB_DIGITS = 5;
+
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
 {
     // Skip leading spaces.
@@ -25,46 +54,51 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
         psz++;
     // Skip and count leading '1's.
     int zeroes = 0;
-    int length = 0;
     while (*psz == '1') {
         zeroes++;
         psz++;
     }
-    // Allocate enough space in big-endian base256 representation.
-    int size = strlen(psz) * 733 /1000 + 1; // log(58) / log(256), rounded up.
-    std::vector<unsigned char> b256(size);
-    // Process the characters.
+    // Process the characters, in groups of up to five digits.
+    std::vector<uint32_t> b256;
+    b256.reserve(strlen(psz) * 733 / 4000 + 1); // log(58) / log(2^32), rounded up.
     while (*psz && !isspace(*psz)) {
-        // Decode base58 character
-        const char* ch = strchr(pszBase58, *psz);
-        if (ch == NULL)
-            return false;
-        // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        int i = 0;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); (carry != 0 || i < length) && (it != b256.rend()); ++it, ++i) {
-            carry += 58 * (*it);
-            *it = carry % 256;
-            carry /= 256;
+        uint64_t carry = 0;
+        uint64_t multiplier = 1;
+        for (int n = 0; n < BASE58_LIMB_DIGITS && *psz && !isspace(*psz); n++, psz++) {
+            int digit = mapBase58[(uint8_t)*psz];
+            if (digit == -1)
+                return false;
+            carry = carry * 58 + digit;
+            multiplier *= 58;
         }
-        assert(carry == 0);
-        length = i;
-        psz++;
+        // Apply "b256 = b256 * 58^n + digits".
+        for (uint32_t& limb : b256) {
+            carry += limb * multiplier;
+            limb = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0)
+            b256.push_back((uint32_t)carry);
     }
     // Skip trailing spaces.
     while (isspace(*psz))
         psz++;
     if (*psz != 0)
         return false;
-    // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin() + (size - length);
-    while (it != b256.end() && *it == 0)
-        it++;
-    // Copy result into output vector.
-    vch.reserve(zeroes + (b256.end() - it));
+    // Copy result into output vector, skipping the leading zero bytes of the
+    // most significant limb.
     vch.assign(zeroes, 0x00);
-    while (it != b256.end())
-        vch.push_back(*(it++));
+    vch.reserve(zeroes + b256.size() * 4);
+    bool fLeading = true;
+    for (std::vector<uint32_t>::reverse_iterator it = b256.rbegin(); it != b256.rend(); ++it) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            unsigned char c = *it >> shift;
+            if (fLeading && c == 0)
+                continue;
+            fLeading = false;
+            vch.push_back(c);
+        }
+    }
     return true;
 }
 
@@ -72,39 +106,51 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
 {
     // Skip & count leading zeroes.
     int zeroes = 0;
-    int length = 0;
     while (pbegin != pend && *pbegin == 0) {
         pbegin++;
         zeroes++;
     }
-    // Allocate enough space in big-endian base58 representation.
-    int size = (pend - pbegin) * 138 / 100 + 1; // log(256) / log(58), rounded up.
-    std::vector<unsigned char> b58(size);
-    // Process the bytes.
+    // Process the bytes, in groups of four, starting with the remainder.
+    std::vector<uint32_t> b58;
+    b58.reserve((pend - pbegin) * 138 / 500 + 1); // log(256) / log(58^5), rounded up.
+    size_t nGroup = (pend - pbegin) % 4 ? (pend - pbegin) % 4 : 4;
     while (pbegin != pend) {
-        int carry = *pbegin;
-        int i = 0;
-        // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); (carry != 0 || i < length) && (it != b58.rend()); it++, i++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+        uint64_t carry = 0;
+        uint64_t multiplier = (uint64_t)1 << (8 * nGroup);
+        for (; nGroup > 0; nGroup--)
+            carry = (carry << 8) | *(pbegin++);
+        // Apply "b58 = b58 * 256^n + bytes".
+        for (uint32_t& limb : b58) {
+            carry += limb * multiplier;
+            limb = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
         }
-
-        assert(carry == 0);
-        length = i;
-        pbegin++;
+        while (carry != 0) {
+            b58.push_back(carry % BASE58_LIMB);
+            carry /= BASE58_LIMB;
+        }
+        nGroup = 4;
     }
-    // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin() + (size - length);
-    while (it != b58.end() && *it == 0)
-        it++;
-    // Translate the result into a string.
+    // Translate the result into a string, skipping the leading zero digits
+    // of the most significant limb.
     std::string str;
-    str.reserve(zeroes + (b58.end() - it));
+    str.reserve(zeroes + b58.size() * BASE58_LIMB_DIGITS);
     str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    char digits[BASE58_LIMB_DIGITS];
+    bool fLeading = true;
+    for (std::vector<uint32_t>::reverse_iterator it = b58.rbegin(); it != b58.rend(); ++it) {
+        uint32_t limb = *it;
+        for (int n = BASE58_LIMB_DIGITS - 1; n >= 0; n--) {
+            digits[n] = limb % 58;
+            limb /= 58;
+        }
+        for (int n = 0; n < BASE58_LIMB_DIGITS; n++) {
+            if (fLeading && digits[n] == 0)
+                continue;
+            fLeading = false;
+            str += pszBase58[(int)digits[n]];
+        }
+    }
     return str;
 }
 
@@ -6,6 +6,7 @@
 
 #include "validation.h"
 #include "base58.h"
+#include "hash.h"
 
 #include <vector>
 #include <string>
@@ -51,6 +52,34 @@ static void Base58Decode(benchmark::State& state)
 }
 
 
+// The addresses of an RPC listing, formatted at the JSON boundary
+static void Base58AddressEncode(benchmark::State& state)
+{
+    std::vector<CKeyID> keys;
+    for (uint64_t i = 0; i < 1000; i++)
+        keys.push_back(CKeyID(Hash160((const unsigned char*)&i, (const unsigned char*)(&i + 1))));
+    while (state.KeepRunning()) {
+        for (const CKeyID& key : keys)
+            CBitcoinAddress(key).ToString();
+    }
+}
+
+
+static void Base58AddressDecode(benchmark::State& state)
+{
+    std::vector<std::string> addresses;
+    for (uint64_t i = 0; i < 1000; i++)
+        addresses.push_back(CBitcoinAddress(CKeyID(Hash160((const unsigned char*)&i, (const unsigned char*)(&i + 1)))).ToString());
+    CKeyID key;
+    while (state.KeepRunning()) {
+        for (const std::string& address : addresses)
+            CBitcoinAddress(address).GetKeyID(key);
+    }
+}
+
+
 BENCHMARK(Base58Encode);
 BENCHMARK(Base58CheckEncode);
 BENCHMARK(Base58Decode);
+BENCHMARK(Base58AddressEncode);
+BENCHMARK(Base58AddressDecode);
@@ -5,9 +5,17 @@
 #include "bench.h"
 #include "perf.h"
 
+#include <univalue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
-#include <sys/time.h>
+#include <limits>
+#include <regex>
+#include <sstream>
 
 benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks() {
     static std::map<std::string, benchmark::BenchFunction> benchmarks_map;
@@ -15,9 +23,8 @@ benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks() {
 }
 
 static double gettimedouble(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_usec * 0.000001 + tv.tv_sec;
+    // gettimeofday has microseconds, too coarse for the fastest benchmarks
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction func)
@@ -25,18 +32,179 @@ benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction f
     benchmarks().insert(std::make_pair(name, func));
 }
 
+/** The value below which a fraction q of the sorted values lie */
+static double Percentile(const std::vector<double>& sorted, double q)
+{
+    size_t n = std::min(sorted.size() - 1, (size_t)std::ceil(q * sorted.size() - 1));
+    return sorted[n];
+}
+
+benchmark::Result::Result(const std::string& _name, const std::vector<Sample>& samples)
+    : name(_name), count(0), min(0), max(0), average(0), median(0), p90(0), p99(0), stddev(0),
+    minCycles(0), maxCycles(0), averageCycles(0)
+{
+    if (samples.empty())
+        return;
+
+    // Each batch counts once, whatever its number of iterations
+    std::vector<double> times;
+    double elapsed = 0;
+    uint64_t cycles = 0;
+    minCycles = std::numeric_limits<uint64_t>::max();
+    for (const Sample& sample : samples) {
+        times.push_back(sample.elapsed / sample.iterations);
+        elapsed += sample.elapsed;
+        cycles += sample.cycles;
+        count += sample.iterations;
+        minCycles = std::min(minCycles, sample.cycles / sample.iterations);
+        maxCycles = std::max(maxCycles, sample.cycles / sample.iterations);
+    }
+    std::sort(times.begin(), times.end());
+
+    min = times.front();
+    max = times.back();
+    average = elapsed / count;
+    averageCycles = cycles / count;
+    median = Percentile(times, 0.5);
+    p90 = Percentile(times, 0.9);
+    p99 = Percentile(times, 0.99);
+
+    double mean = 0;
+    for (double t : times)
+        mean += t;
+    mean /= times.size();
+    double variance = 0;
+    for (double t : times)
+        variance += (t - mean) * (t - mean);
+    stddev = std::sqrt(variance / times.size());
+}
+
+static const char* CSV_HEADER = "#Benchmark,count,min,max,average,min_cycles,max_cycles,average_cycles,median,p90,p99,stddev";
+
+static void PrintCSV(const benchmark::Result& result)
+{
+    std::cout << std::fixed << std::setprecision(15) << result.name << "," << result.count << "," << result.min << "," << result.max << "," << result.average << ","
+              << result.minCycles << "," << result.maxCycles << "," << result.averageCycles << ","
+              << result.median << "," << result.p90 << "," << result.p99 << "," << result.stddev << "\n" << std::flush;
+}
+
+static UniValue ResultToJSON(const benchmark::Result& result)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("name", result.name));
+    obj.push_back(Pair("count", result.count));
+    obj.push_back(Pair("min", result.min));
+    obj.push_back(Pair("max", result.max));
+    obj.push_back(Pair("average", result.average));
+    obj.push_back(Pair("median", result.median));
+    obj.push_back(Pair("p90", result.p90));
+    obj.push_back(Pair("p99", result.p99));
+    obj.push_back(Pair("stddev", result.stddev));
+    obj.push_back(Pair("min_cycles", result.minCycles));
+    obj.push_back(Pair("max_cycles", result.maxCycles));
+    obj.push_back(Pair("average_cycles", result.averageCycles));
+    return obj;
+}
+
+/** Read the medians of an earlier run, printed either as CSV or as JSON */
+static bool ReadBaseline(const std::string& filename, std::map<std::string, double>& mapMedian)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string data = buffer.str();
+
+    size_t nFirst = data.find_first_not_of(" \t\r\n");
+    if (nFirst != std::string::npos && data[nFirst] == '[') {
+        UniValue results;
+        if (!results.read(data) || !results.isArray())
+            return false;
+        for (size_t i = 0; i < results.size(); i++) {
+            const UniValue& name = find_value(results[i], "name");
+            const UniValue& median = find_value(results[i], "median");
+            if (!name.isStr() || !median.isNum())
+                return false;
+            mapMedian[name.get_str()] = median.get_real();
+        }
+        return true;
+    }
+
+    // CSV, the median being the ninth column. Older output without it has nothing to compare
+    std::string line;
+    while (std::getline(buffer, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ','))
+            fields.push_back(field);
+        if (fields.size() >= 9)
+            mapMedian[fields[0]] = strtod(fields[8].c_str(), NULL);
+    }
+    return true;
+}
+
 void
-benchmark::BenchRunner::RunAll(double elapsedTimeForOne)
+benchmark::BenchRunner::List()
 {
+    for (const auto &p: benchmarks())
+        std::cout << p.first << "\n";
+}
+
+bool
+benchmark::BenchRunner::RunAll(const Options& options)
+{
+    std::map<std::string, double> mapBaseline;
+    if (!options.baseline.empty() && !ReadBaseline(options.baseline, mapBaseline)) {
+        std::cerr << "Error: cannot read the baseline " << options.baseline << "\n";
+        return false;
+    }
+
+    std::regex reFilter;
+    try {
+        reFilter = std::regex(options.filter);
+    } catch (const std::regex_error& e) {
+        std::cerr << "Error: invalid filter " << options.filter << ": " << e.what() << "\n";
+        return false;
+    }
+    bool fJSON = options.printer == "json";
+    UniValue results(UniValue::VARR);
+    bool fRegression = false;
+
     perf_init();
-    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << ","
-              << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+    if (!fJSON)
+        std::cout << CSV_HEADER << "\n";
 
     for (const auto &p: benchmarks()) {
-        State state(p.first, elapsedTimeForOne);
-        p.second(state);
+        if (!std::regex_match(p.first, reFilter))
+            continue;
+
+        std::vector<Sample> samples;
+        for (int i = 0; i < options.runs; i++) {
+            State state(p.first, options.elapsedTimeForOne, options.warmupTime, samples);
+            p.second(state);
+        }
+        Result result(p.first, samples);
+        if (fJSON)
+            results.push_back(ResultToJSON(result));
+        else
+            PrintCSV(result);
+
+        auto it = mapBaseline.find(p.first);
+        if (it != mapBaseline.end() && it->second > 0 && result.median > it->second * (1 + options.maxRegression / 100)) {
+            std::cerr << std::fixed << "Regression: " << p.first << " median " << std::setprecision(9) << result.median
+                      << " against " << it->second << " in the baseline, " << std::setprecision(1) << (result.median / it->second - 1) * 100 << "% slower\n";
+            fRegression = true;
+        }
     }
     perf_fini();
+
+    if (fJSON)
+        std::cout << results.write(2) << "\n";
+    return !fRegression;
 }
 
 bool benchmark::State::KeepRunning()
@@ -49,38 +217,35 @@ bool benchmark::State::KeepRunning()
     uint64_t nowCycles;
     if (count == 0) {
         lastTime = beginTime = now = gettimedouble();
-        lastCycles = beginCycles = nowCycles = perf_cpucycles();
+        lastCycles = nowCycles = perf_cpucycles();
     }
     else {
         now = gettimedouble();
         double elapsed = now - lastTime;
-        double elapsedOne = elapsed * countMaskInv;
-        if (elapsedOne < minTime) minTime = elapsedOne;
-        if (elapsedOne > maxTime) maxTime = elapsedOne;
 
         // We only use relative values, so don't have to handle 64-bit wrap-around specially
         nowCycles = perf_cpucycles();
-        uint64_t elapsedOneCycles = (nowCycles - lastCycles) * countMaskInv;
-        if (elapsedOneCycles < minCycles) minCycles = elapsedOneCycles;
-        if (elapsedOneCycles > maxCycles) maxCycles = elapsedOneCycles;
 
         if (elapsed*128 < maxElapsed) {
           // If the execution was much too fast (1/128th of maxElapsed), increase the count mask by 8x and restart timing.
           // The restart avoids including the overhead of this code in the measurement.
           countMask = ((countMask<<3)|7) & ((1LL<<60)-1);
-          countMaskInv = 1./(countMask+1);
           count = 0;
-          minTime = std::numeric_limits<double>::max();
-          maxTime = std::numeric_limits<double>::min();
-          minCycles = std::numeric_limits<uint64_t>::max();
-          maxCycles = std::numeric_limits<uint64_t>::min();
+          samples.resize(firstSample);
           return true;
         }
+        // The batches of the warm-up only tune the count mask
+        if (now - beginTime >= warmupTime) {
+            Sample sample;
+            sample.elapsed = elapsed;
+            sample.cycles = nowCycles - lastCycles;
+            sample.iterations = countMask + 1;
+            samples.push_back(sample);
+        }
         if (elapsed*16 < maxElapsed) {
           uint64_t newCountMask = ((countMask<<1)|1) & ((1LL<<60)-1);
           if ((count & newCountMask)==0) {
               countMask = newCountMask;
-              countMaskInv = 1./(countMask+1);
           }
         }
     }
@@ -88,15 +253,7 @@ bool benchmark::State::KeepRunning()
     lastCycles = nowCycles;
     ++count;
 
-    if (now - beginTime < maxElapsed) return true; // Keep going
-
-    --count;
-
-    // Output results
-    double average = (now-beginTime)/count;
-    int64_t averageCycles = (nowCycles-beginCycles)/count;
-    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << ","
-              << minCycles << "," << maxCycles << "," << averageCycles << "\n";
+    if (now - beginTime < warmupTime + maxElapsed) return true; // Keep going
 
     return false;
 }
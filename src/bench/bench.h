@@ -6,7 +6,9 @@
 #define BITCOIN_BENCH_BENCH_H
 
 #include <map>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <boost/function.hpp>
 #include <boost/preprocessor/cat.hpp>
@@ -36,31 +38,66 @@ BENCHMARK(CODE_TO_TIME);
  
 namespace benchmark {
 
+    /** One timed batch of iterations */
+    struct Sample {
+        double elapsed;
+        uint64_t cycles;
+        uint64_t iterations;
+    };
+
+    /** Timings of a benchmark per iteration, in seconds and cycles, over all its runs */
+    struct Result {
+        std::string name;
+        uint64_t count;
+        double min, max, average, median, p90, p99, stddev;
+        uint64_t minCycles, maxCycles, averageCycles;
+
+        Result() : count(0), min(0), max(0), average(0), median(0), p90(0), p99(0), stddev(0),
+            minCycles(0), maxCycles(0), averageCycles(0) {}
+        Result(const std::string& _name, const std::vector<Sample>& samples);
+    };
+
     class State {
         std::string name;
         double maxElapsed;
+        double warmupTime;
         double beginTime;
-        double lastTime, minTime, maxTime, countMaskInv;
+        double lastTime;
         uint64_t count;
         uint64_t countMask;
-        uint64_t beginCycles;
         uint64_t lastCycles;
-        uint64_t minCycles;
-        uint64_t maxCycles;
+        std::vector<Sample>& samples;
+        size_t firstSample;
     public:
-        State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0) {
-            minTime = std::numeric_limits<double>::max();
-            maxTime = std::numeric_limits<double>::min();
-            minCycles = std::numeric_limits<uint64_t>::max();
-            maxCycles = std::numeric_limits<uint64_t>::min();
+        /** Time for warmupTime + maxElapsed seconds, adding the batches after the warm-up to samples */
+        State(std::string _name, double _maxElapsed, double _warmupTime, std::vector<Sample>& _samples) :
+            name(_name), maxElapsed(_maxElapsed), warmupTime(_warmupTime), count(0), samples(_samples), firstSample(_samples.size()) {
             countMask = 1;
-            countMaskInv = 1./(countMask + 1);
         }
         bool KeepRunning();
     };
 
     typedef boost::function<void(State&)> BenchFunction;
 
+    struct Options {
+        //! Run the benchmarks whose whole name matches this regular expression
+        std::string filter;
+        //! Times each benchmark runs, with its setup, into the same statistics
+        int runs;
+        //! Seconds each run is timed for, after the warm-up
+        double elapsedTimeForOne;
+        //! Seconds each run goes on before it is timed
+        double warmupTime;
+        //! "csv" or "json"
+        std::string printer;
+        //! Output of an earlier run, in either format, to compare the medians with
+        std::string baseline;
+        //! Percentage a median may exceed the baseline by before it is reported as a regression
+        double maxRegression;
+
+        Options() : filter(".*"), runs(1), elapsedTimeForOne(1.0), warmupTime(0.1), printer("csv"), maxRegression(10) {}
+    };
+
     class BenchRunner
     {
         typedef std::map<std::string, BenchFunction> BenchmarkMap;
@@ -69,7 +106,9 @@ namespace benchmark {
     public:
         BenchRunner(std::string name, BenchFunction func);
 
-        static void RunAll(double elapsedTimeForOne=1.0);
+        static void List();
+        /** Run and print the benchmarks. Returns false if one is slower than the baseline allows */
+        static bool RunAll(const Options& options = Options());
     };
 }
 
@@ -4,18 +4,77 @@
 
 #include "bench.h"
 
+#include "chainparams.h"
+#include "crypto/sha256.h"
 #include "key.h"
+#include "random.h"
 #include "validation.h"
 #include "util.h"
 
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+static std::string HelpMessage()
+{
+    benchmark::Options defaults;
+    std::string strUsage = "Usage: bench_bitcoin [options]\n";
+    strUsage += HelpMessageGroup("Options:");
+    strUsage += HelpMessageOpt("-?", "Print this help message and exit");
+    strUsage += HelpMessageOpt("-list", "List the benchmarks and exit");
+    strUsage += HelpMessageOpt("-filter=<regex>", strprintf("Run the benchmarks whose whole name matches the regular expression (default: %s)", defaults.filter));
+    strUsage += HelpMessageOpt("-runs=<n>", strprintf("Run each benchmark n times, with its setup, into the same statistics (default: %d)", defaults.runs));
+    strUsage += HelpMessageOpt("-time=<seconds>", strprintf("Seconds each run is timed for (default: %.1f)", defaults.elapsedTimeForOne));
+    strUsage += HelpMessageOpt("-warmup=<seconds>", strprintf("Seconds each run goes on before it is timed (default: %.1f)", defaults.warmupTime));
+    strUsage += HelpMessageOpt("-printer=<csv|json>", strprintf("Output format (default: %s)", defaults.printer));
+    strUsage += HelpMessageOpt("-baseline=<file>", "Compare the medians with the output of an earlier run, in either format, and exit with 1 on a regression");
+    strUsage += HelpMessageOpt("-maxregression=<percent>", strprintf("How much slower than the baseline a median may be (default: %.0f)", defaults.maxRegression));
+    return strUsage;
+}
+
 int
 main(int argc, char** argv)
 {
+    ParseParameters(argc, argv);
+    if (IsArgSet("-?") || IsArgSet("-h") || IsArgSet("-help")) {
+        std::cout << HelpMessage();
+        return 0;
+    }
+    if (IsArgSet("-list")) {
+        benchmark::BenchRunner::List();
+        return 0;
+    }
+
+    benchmark::Options options;
+    options.filter = GetArg("-filter", options.filter);
+    options.runs = std::max(1, (int)GetArg("-runs", options.runs));
+    if (IsArgSet("-time"))
+        options.elapsedTimeForOne = atof(GetArg("-time", "").c_str());
+    if (IsArgSet("-warmup"))
+        options.warmupTime = atof(GetArg("-warmup", "").c_str());
+    options.printer = GetArg("-printer", options.printer);
+    options.baseline = GetArg("-baseline", "");
+    if (IsArgSet("-maxregression"))
+        options.maxRegression = atof(GetArg("-maxregression", "").c_str());
+    if (options.printer != "csv" && options.printer != "json") {
+        std::cerr << "Error: unknown printer " << options.printer << "\n";
+        return 1;
+    }
+
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
-    benchmark::BenchRunner::RunAll();
+    // The DPoS benches use the main network and keep their vote database in a scratch data directory
+    SelectParams(CBaseChainParams::MAIN);
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    ForceSetArg("-datadir", pathTemp.string());
+
+    bool fPassed = benchmark::BenchRunner::RunAll(options);
 
+    boost::filesystem::remove_all(pathTemp);
     ECC_Stop();
+    return fPassed ? 0 : 1;
 }
@@ -52,5 +52,25 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Copying every transaction of the block touches the same allocations as
+// deserializing it, without the stream.
+static void CopyBlockTransactionsTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : block.vtx) {
+            CMutableTransaction mtx(*tx);
+            CTransaction txCopy(std::move(mtx));
+            assert(txCopy.vout.size() == tx->vout.size());
+        }
+    }
+}
+
 BENCHMARK(DeserializeBlockTest);
 BENCHMARK(DeserializeAndCheckBlockTest);
+BENCHMARK(CopyBlockTransactionsTest);
@@ -6,6 +6,8 @@
 #include "util.h"
 #include "validation.h"
 #include "checkqueue.h"
+#include "crypto/sha256.h"
+#include "uint256.h"
 #include "prevector.h"
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -99,5 +101,55 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// This Benchmark shows how the CheckQueue scales with the number of worker
+// threads, with checks that take about as long as a signature check.
+template <int nThreads>
+static void CCheckQueueScaling(benchmark::State& state)
+{
+    struct HashJob {
+        uint256 hash;
+        bool operator()()
+        {
+            for (int i = 0; i < 200; i++)
+                CSHA256().Write(hash.begin(), 32).Finalize(hash.begin());
+            return true;
+        }
+        void swap(HashJob& x){std::swap(hash, x.hash);};
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The master thread joins the workers when waiting
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        std::vector<std::vector<HashJob>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling_1(benchmark::State& state) { CCheckQueueScaling<1>(state); }
+static void CCheckQueueScaling_2(benchmark::State& state) { CCheckQueueScaling<2>(state); }
+static void CCheckQueueScaling_4(benchmark::State& state) { CCheckQueueScaling<4>(state); }
+static void CCheckQueueScaling_8(benchmark::State& state) { CCheckQueueScaling<8>(state); }
+static void CCheckQueueScaling_16(benchmark::State& state) { CCheckQueueScaling<16>(state); }
+static void CCheckQueueScaling_32(benchmark::State& state) { CCheckQueueScaling<32>(state); }
+static void CCheckQueueScaling_64(benchmark::State& state) { CCheckQueueScaling<64>(state); }
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueScaling_1);
+BENCHMARK(CCheckQueueScaling_2);
+BENCHMARK(CCheckQueueScaling_4);
+BENCHMARK(CCheckQueueScaling_8);
+BENCHMARK(CCheckQueueScaling_16);
+BENCHMARK(CCheckQueueScaling_32);
+BENCHMARK(CCheckQueueScaling_64);
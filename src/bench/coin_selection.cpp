@@ -57,4 +57,28 @@ static void CoinSelection(benchmark::State& state)
     }
 }
 
+// An exchange hot wallet of one address, with tens of thousands of deposits
+// of uneven amounts, paying out an amount that is not a round number.
+static void CoinSelectionHotWallet(benchmark::State& state)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    for (int i = 0; i < 20000; i++)
+        addCoin((i % 997 + 1) * CENT + i % 13, wallet, vCoins);
+
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(25 * COIN + 7, 1, 6, 0, vCoins, setCoinsRet, nValueRet);
+        assert(success);
+        assert(nValueRet >= 25 * COIN + 7);
+    }
+
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+}
+
 BENCHMARK(CoinSelection);
+BENCHMARK(CoinSelectionHotWallet);
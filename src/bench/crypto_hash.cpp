@@ -41,6 +41,72 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(in.data(), in.size()).Finalize(hash);
 }
 
+// Each backend is benchmarked on its own, SHA256AutoDetect falls back to the
+// standard implementation where the CPU lacks the instructions.
+static void SHA256Using(benchmark::State& state, sha256_implementation::UseImplementation use)
+{
+    SHA256AutoDetect(use);
+    SHA256(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_STANDARD(benchmark::State& state) { SHA256Using(state, sha256_implementation::STANDARD); }
+static void SHA256_SHANI(benchmark::State& state) { SHA256Using(state, sha256_implementation::USE_SHANI); }
+static void SHA256_ARMV8(benchmark::State& state) { SHA256Using(state, sha256_implementation::USE_ARMV8); }
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+static void SHA256D64_1024Using(benchmark::State& state, sha256_implementation::UseImplementation use)
+{
+    SHA256AutoDetect(use);
+    SHA256D64_1024(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256D64_1024_STANDARD(benchmark::State& state) { SHA256D64_1024Using(state, sha256_implementation::STANDARD); }
+static void SHA256D64_1024_SSE4(benchmark::State& state) { SHA256D64_1024Using(state, sha256_implementation::USE_SSE4); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { SHA256D64_1024Using(state, sha256_implementation::USE_AVX2); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { SHA256D64_1024Using(state, sha256_implementation::USE_SHANI); }
+static void SHA256D64_1024_ARMV8(benchmark::State& state) { SHA256D64_1024Using(state, sha256_implementation::USE_ARMV8); }
+
+static void Hash160_33b_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(33 * 1024, 2);
+    uint160 out;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1024; i++)
+            out = Hash160(in.begin() + 33 * i, in.begin() + 33 * (i + 1));
+    }
+}
+
+static void Hash160Multi_33b_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(33 * 1024, 2);
+    std::vector<const unsigned char*> vPtr;
+    std::vector<size_t> vLen(1024, 33);
+    for (int i = 0; i < 1024; i++)
+        vPtr.push_back(in.data() + 33 * i);
+    std::vector<uint160> vOut(1024);
+    while (state.KeepRunning())
+        Hash160Multi(vOut.data(), vPtr.data(), vLen.data(), 1024);
+}
+
+static void Hash160Multi_33b_1024Using(benchmark::State& state, sha256_implementation::UseImplementation use)
+{
+    SHA256AutoDetect(use);
+    Hash160Multi_33b_1024(state);
+    SHA256AutoDetect();
+}
+
+static void Hash160Multi_33b_1024_STANDARD(benchmark::State& state) { Hash160Multi_33b_1024Using(state, sha256_implementation::STANDARD); }
+static void Hash160Multi_33b_1024_SSE4(benchmark::State& state) { Hash160Multi_33b_1024Using(state, sha256_implementation::USE_SSE4); }
+static void Hash160Multi_33b_1024_AVX2(benchmark::State& state) { Hash160Multi_33b_1024Using(state, sha256_implementation::USE_AVX2); }
+
 static void SHA256_32b(benchmark::State& state)
 {
     std::vector<uint8_t> in(32,0);
@@ -72,7 +138,23 @@ static void SipHash_32b(benchmark::State& state)
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
+BENCHMARK(SHA256_STANDARD);
+BENCHMARK(SHA256_SHANI);
+BENCHMARK(SHA256_ARMV8);
 BENCHMARK(SHA512);
 
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256D64_1024_STANDARD);
+BENCHMARK(SHA256D64_1024_SSE4);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D64_1024_SHANI);
+BENCHMARK(SHA256D64_1024_ARMV8);
+
+BENCHMARK(Hash160_33b_1024);
+BENCHMARK(Hash160Multi_33b_1024);
+BENCHMARK(Hash160Multi_33b_1024_STANDARD);
+BENCHMARK(Hash160Multi_33b_1024_SSE4);
+BENCHMARK(Hash160Multi_33b_1024_AVX2);
+
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
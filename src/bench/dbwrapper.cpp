@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "address_index.h"
+#include "amount.h"
+#include "dbwrapper.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <assert.h>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+// Same key prefixes as txdb.cpp
+static const char DB_COIN = 'C';
+static const char DB_ADDRESSINDEX = 'a';
+
+static const int NUM_ADDRESSES = 1000;
+static const int NUM_ADDRESS_ENTRIES = 100;
+static const int NUM_COINS = 100000;
+// Small enough that most reads have to go to the table files.
+static const size_t DB_CACHE_SIZE = 2 << 20;
+
+/** Open the database at path with the options of the given profile */
+static std::unique_ptr<CDBWrapper> OpenDB(const boost::filesystem::path& path, const std::string& strProfile)
+{
+    CDBOptions options;
+    CDBOptions::FromProfile(strProfile, options);
+    return std::unique_ptr<CDBWrapper>(new CDBWrapper(path, DB_CACHE_SIZE, false, false, false, options));
+}
+
+// Scan the entries of random addresses, like CBlockTreeDB::ReadAddressIndex.
+static void ReadAddressIndex(benchmark::State& state, const std::string& strProfile)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::vector<uint160> vAddress;
+    {
+        std::unique_ptr<CDBWrapper> db = OpenDB(path, strProfile);
+        for (int i = 0; i < NUM_ADDRESSES; i++) {
+            uint256 hash = GetRandHash();
+            vAddress.push_back(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+            CDBBatch batch(*db);
+            for (int j = 0; j < NUM_ADDRESS_ENTRIES; j++) {
+                batch.Write(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(1, vAddress.back(), j, 0, GetRandHash(), 0, false)), CAmount(j));
+            }
+            db->WriteBatch(batch);
+        }
+    }
+    // Reopen so the data comes from the table files, not the memtable.
+    std::unique_ptr<CDBWrapper> db = OpenDB(path, strProfile);
+
+    FastRandomContext rng(true);
+    uint64_t nEntries = 0;
+    while (state.KeepRunning()) {
+        const uint160& address = vAddress[rng.rand32() % vAddress.size()];
+        std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(1, address)));
+        for (; pcursor->Valid(); pcursor->Next()) {
+            std::pair<char, CAddressIndexKey> key;
+            CAmount nValue;
+            if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.hashBytes != address || !pcursor->GetValue(nValue))
+                break;
+            nEntries++;
+        }
+    }
+    assert(nEntries > 0);
+
+    db.reset();
+    boost::filesystem::remove_all(path);
+}
+
+// Look up coins, half of which do not exist.
+static void ReadCoins(benchmark::State& state, const std::string& strProfile)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::vector<uint256> vTxid;
+    {
+        std::unique_ptr<CDBWrapper> db = OpenDB(path, strProfile);
+        CDBBatch batch(*db);
+        std::vector<unsigned char> vCoin(40, 0x55);
+        for (int i = 0; i < NUM_COINS; i++) {
+            vTxid.push_back(GetRandHash());
+            batch.Write(std::make_pair(DB_COIN, std::make_pair(vTxid.back(), uint32_t(0))), vCoin);
+        }
+        db->WriteBatch(batch);
+    }
+    std::unique_ptr<CDBWrapper> db = OpenDB(path, strProfile);
+
+    FastRandomContext rng(true);
+    uint64_t nFound = 0;
+    while (state.KeepRunning()) {
+        uint32_t r = rng.rand32();
+        std::vector<unsigned char> vCoin;
+        nFound += db->Read(std::make_pair(DB_COIN, std::make_pair(vTxid[r % vTxid.size()], uint32_t(r & 1))), vCoin);
+    }
+    assert(nFound > 0);
+
+    db.reset();
+    boost::filesystem::remove_all(path);
+}
+
+static void DBReadAddressIndexDefault(benchmark::State& state) { ReadAddressIndex(state, "default"); }
+static void DBReadAddressIndexIndex(benchmark::State& state) { ReadAddressIndex(state, "index"); }
+static void DBReadCoinsDefault(benchmark::State& state) { ReadCoins(state, "default"); }
+static void DBReadCoinsIndex(benchmark::State& state) { ReadCoins(state, "index"); }
+
+BENCHMARK(DBReadAddressIndexDefault);
+BENCHMARK(DBReadAddressIndexIndex);
+BENCHMARK(DBReadCoinsDefault);
+BENCHMARK(DBReadCoinsIndex);
@@ -0,0 +1,329 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "miner.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "util.h"
+#include "validation.h"
+#include "vote.h"
+#include "votedb.h"
+
+#include <assert.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Sizes of the vote state, scaled down where filling it would go through
+// the per-vote logging of the public Vote interface.
+static const int NUM_ADDRESSES = 1000000;
+static const int NUM_DELEGATES = 10000;
+static const int NUM_VOTERS = 100000;
+static const int NUM_VOTES_PER_VOTER = 3;
+static const int NUM_BALANCE_CHANGES = 2000;
+static const int NUM_BLOCK_VOTES = 2000;
+static const int NUM_BILLS = 1000;
+static const int NUM_BILL_VOTERS = 100;
+// Delegates hold enough to be picked by DPoS::GetNextDelegates
+static const int64_t DELEGATE_BALANCE = 10000 * COIN;
+
+static CKeyID BenchKeyID(uint64_t n)
+{
+    return CKeyID(Hash160((const unsigned char*)&n, (const unsigned char*)(&n + 1)));
+}
+
+static CKeyID DelegateKeyID(int n)
+{
+    return BenchKeyID(((uint64_t)1 << 48) + n);
+}
+
+static CKeyID VoterKeyID(int n)
+{
+    return BenchKeyID(n);
+}
+
+static CMyAddress PubKeyAddress(const CKeyID& id)
+{
+    return CMyAddress(id, CChainParams::PUBKEY_ADDRESS);
+}
+
+static CDPoSKeys VoterDelegates(int n)
+{
+    CDPoSKeys delegates;
+    for (int i = 0; i < NUM_VOTES_PER_VOTER; i++)
+        delegates.Insert(DelegateKeyID((n * 7919 + i * 104729) % NUM_DELEGATES));
+    return delegates;
+}
+
+/** Register the delegates, give every address a balance and let the first voters vote */
+static void FillVote(Vote& vote, int nAddresses, int nVoters)
+{
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    for (int i = 0; i < NUM_DELEGATES; i++) {
+        assert(vote.ProcessRegister(DelegateKeyID(i), strprintf("bench%d", i), uint256(), 1, false));
+        vBalance.push_back(std::make_pair(PubKeyAddress(DelegateKeyID(i)), DELEGATE_BALANCE));
+    }
+    for (int i = 0; i < nAddresses; i++)
+        vBalance.push_back(std::make_pair(PubKeyAddress(VoterKeyID(i)), (int64_t)(i % 1000 + 100) * COIN));
+    vote.UpdateAddressBalance(vBalance);
+
+    for (int i = 0; i < nVoters; i++)
+        assert(vote.ProcessVote(VoterKeyID(i), VoterDelegates(i), uint256(), 2, false));
+}
+
+/** The vote state singleton, which DoVoting and DPoS work on, filled once */
+static Vote& GetFilledVote()
+{
+    static bool fFilled = false;
+    Vote& vote = Vote::GetInstance();
+    if (!fFilled) {
+        vote.Init(0, std::string());
+        FillVote(vote, NUM_VOTERS + NUM_BLOCK_VOTES, NUM_VOTERS);
+        vote.PublishView();
+        fFilled = true;
+    }
+    return vote;
+}
+
+/** The balance changes of a block, paid to the same addresses and spent back every other time */
+static void BlockBalanceChanges(std::vector<std::pair<CMyAddress, int64_t>>& vBalance, int nAddresses, int64_t nHeight)
+{
+    vBalance.clear();
+    for (int i = 0; i < NUM_BALANCE_CHANGES; i++) {
+        // Odd changes go to voters and move the totals of the delegates they voted for
+        int n = i % 2 ? (i * 49999) % NUM_VOTERS : (i * 499) % nAddresses;
+        vBalance.push_back(std::make_pair(PubKeyAddress(VoterKeyID(n)), nHeight % 2 ? COIN : -COIN));
+    }
+}
+
+// A block's balance changes against a million known addresses.
+static void VoteUpdateAddressBalance(benchmark::State& state)
+{
+    std::unique_ptr<Vote> vote(new Vote());
+    FillVote(*vote, NUM_ADDRESSES, NUM_VOTERS);
+
+    int64_t nHeight = 3;
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    while (state.KeepRunning()) {
+        BlockBalanceChanges(vBalance, NUM_ADDRESSES, nHeight++);
+        vote->UpdateAddressBalance(vBalance);
+    }
+}
+
+static void VoteGetTopDelegateInfo(benchmark::State& state)
+{
+    Vote& vote = GetFilledVote();
+    while (state.KeepRunning()) {
+        std::vector<Delegate> delegates = vote.GetTopDelegateInfo(5000 * COIN, 100);
+        assert(delegates.size() == 100);
+    }
+}
+
+static void VoteProcessVoteUndo(benchmark::State& state)
+{
+    Vote& vote = GetFilledVote();
+    CKeyID voter = VoterKeyID(NUM_VOTERS);
+    CDPoSKeys delegates = VoterDelegates(NUM_VOTERS);
+    uint256 hash = GetRandHash();
+    while (state.KeepRunning()) {
+        assert(vote.ProcessVote(voter, delegates, hash, 3, false));
+        assert(vote.ProcessVote(voter, delegates, hash, 3, true));
+    }
+}
+
+static std::vector<uint64_t> BillVoterBalances()
+{
+    std::vector<uint64_t> vBalance(NUM_BILLS * NUM_BILL_VOTERS);
+    for (size_t i = 0; i < vBalance.size(); i++)
+        vBalance[i] = (i % 1000 + 1) * COIN;
+    return vBalance;
+}
+
+static uint64_t BillVoterBalance(const std::vector<uint64_t>& vBalance, const CKeyID& id)
+{
+    return vBalance[ReadLE64(id.begin()) % vBalance.size()];
+}
+
+/** The balances of BillVoterBalances as a functor type, the way Vote binds its own */
+struct CBenchBalanceSource
+{
+    const std::vector<uint64_t>* pvBalance;
+    uint64_t operator()(const CKeyID& id) const { return BillVoterBalance(*pvBalance, id); }
+};
+
+template<typename BillDB>
+static void FillBills(BillDB& db)
+{
+    for (int i = 0; i < NUM_BILLS; i++) {
+        CSubmitBillData bill;
+        bill.committee = DelegateKeyID(i % 10);
+        bill.endtime = 100;
+        bill.options = {"yes", "no", "abstain"};
+        uint160 billid;
+        WriteLE64(billid.begin(), i);
+        assert(db.Register(billid, bill, GetRandHash(), 1, false));
+        for (int j = 0; j < NUM_BILL_VOTERS; j++) {
+            uint160 voter;
+            WriteLE64(voter.begin(), i * NUM_BILL_VOTERS + j);
+            assert(db.Vote(CKeyID(voter), billid, j % 3, GetRandHash(), 2, false));
+        }
+    }
+}
+
+// Bills expiring with a block and reopened when it is undone, which counts
+// their votes again from the balances.
+template<typename BalanceSource>
+static void RunBillFinishVote(benchmark::State& state, const BalanceSource& getBalance)
+{
+    CVoteDBK2<uint160, CSubmitBillData, CKeyID, BalanceSource> db(0, COIN, getBalance);
+    FillBills(db);
+
+    while (state.KeepRunning()) {
+        db.NewBlockHeight(3, 101, false);
+        db.NewBlockHeight(3, 101, true);
+    }
+}
+
+// The balances through a closure in a std::function, the default
+static void BillFinishVote(benchmark::State& state)
+{
+    std::vector<uint64_t> vBalance = BillVoterBalances();
+    RunBillFinishVote<std::function<uint64_t(const CKeyID&)>>(state, [&vBalance](const CKeyID& id) { return BillVoterBalance(vBalance, id); });
+}
+
+// The balances through a functor type bound to the bills
+static void BillFinishVoteFunctor(benchmark::State& state)
+{
+    std::vector<uint64_t> vBalance = BillVoterBalances();
+    RunBillFinishVote(state, CBenchBalanceSource{&vBalance});
+}
+
+// Scanning the votes of every bill, as the tallies of the RPCs do
+static void BillFindVote(benchmark::State& state)
+{
+    std::vector<uint64_t> vBalance = BillVoterBalances();
+    CVoteDBK2<uint160, CSubmitBillData, CKeyID, CBenchBalanceSource> db(0, COIN, CBenchBalanceSource{&vBalance});
+    FillBills(db);
+
+    while (state.KeepRunning()) {
+        uint64_t nTotal = 0;
+        db.FindVote([&nTotal](const uint160&, const CBillVoteMap<CKeyID>& votes) {
+            votes.ForEach([&nTotal](const CBillVote<CKeyID>& vote) { nTotal += vote.nBalance; });
+            return false;
+        });
+        assert(nTotal > 0);
+    }
+}
+
+// Writing the vote state of a block to the vote database, after the balance
+// changes of the block.
+static void VoteFlush(benchmark::State& state)
+{
+    std::unique_ptr<Vote> vote(new Vote());
+    vote->Init(0, std::string());
+    vote->OpenDB(8 << 20, true);
+    FillVote(*vote, NUM_VOTERS, NUM_VOTERS);
+
+    int64_t nHeight = 3;
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    while (state.KeepRunning()) {
+        BlockBalanceChanges(vBalance, NUM_VOTERS, nHeight);
+        vote->UpdateAddressBalance(vBalance);
+        assert(vote->Flush(nHeight, ArithToUint256(arith_uint256(nHeight)), false));
+        nHeight++;
+    }
+    vote->CloseDB();
+}
+
+// Reading the vote state back at startup. Balances stay in the database
+// until they are used.
+static void VoteLoad(benchmark::State& state)
+{
+    {
+        std::unique_ptr<Vote> vote(new Vote());
+        vote->Init(0, std::string());
+        vote->OpenDB(8 << 20, true);
+        FillVote(*vote, NUM_VOTERS, NUM_VOTERS);
+        assert(vote->Flush(2, ArithToUint256(arith_uint256(2))));
+        vote->CloseDB();
+    }
+
+    std::unique_ptr<Vote> vote(new Vote());
+    vote->Init(0, std::string());
+    vote->OpenDB(8 << 20, false);
+    while (state.KeepRunning()) {
+        assert(vote->Load(0, std::string()));
+    }
+    vote->CloseDB();
+}
+
+static CTransactionRef VotingTransaction(const CDPoSKeys& delegates)
+{
+    CVoteForgerData data;
+    data.opcode = OP_VOTE;
+    data.forgers.insert(delegates.begin(), delegates.end());
+    std::vector<unsigned char> push(4, 0);
+    std::vector<unsigned char> payload = StructToData(data);
+    push.insert(push.end(), payload.begin(), payload.end());
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 0;
+    mtx.vout[0].scriptPubKey = CScript() << OP_RETURN << push;
+    return MakeTransactionRef(mtx);
+}
+
+// A block full of votes applied and undone, as in a reorganization.
+static void DoVotingBlock(benchmark::State& state)
+{
+    GetFilledVote();
+
+    CBlock block;
+    block.nTime = 1;
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    CDPoSBlockDelta delta;
+    delta.vTxFee.push_back(0);
+    delta.vSender.push_back(CKeyID());
+    for (int i = 0; i < NUM_BLOCK_VOTES; i++) {
+        block.vtx.push_back(VotingTransaction(VoterDelegates(NUM_VOTERS + i)));
+        delta.vTxFee.push_back(COIN);
+        delta.vSender.push_back(VoterKeyID(NUM_VOTERS + i));
+    }
+
+    while (state.KeepRunning()) {
+        assert(DoVoting(block, 4, delta, false));
+        assert(DoVoting(block, 4, delta, true));
+    }
+}
+
+// The schedule of the next round: the top delegates, shuffled by the time.
+static void DPoSGetNextDelegates(benchmark::State& state)
+{
+    GetFilledVote();
+    DPoS& dpos = DPoS::GetInstance();
+
+    int64_t t = 1539181795;
+    while (state.KeepRunning()) {
+        DelegateInfo cDelegateInfo = dpos.GetNextDelegates(t++);
+        assert(!cDelegateInfo.delegates.empty());
+    }
+}
+
+BENCHMARK(VoteUpdateAddressBalance);
+BENCHMARK(VoteGetTopDelegateInfo);
+BENCHMARK(VoteProcessVoteUndo);
+BENCHMARK(BillFinishVote);
+BENCHMARK(BillFinishVoteFunctor);
+BENCHMARK(BillFindVote);
+BENCHMARK(VoteFlush);
+BENCHMARK(VoteLoad);
+BENCHMARK(DoVotingBlock);
+BENCHMARK(DPoSGetNextDelegates);
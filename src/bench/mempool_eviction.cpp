@@ -112,4 +112,44 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+/** A transaction spending the output of the previous one, except every fourth, which starts a new chain */
+static CMutableTransaction MakeTx(uint32_t n, const uint256& hashPrev)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    if (n % 4 != 0)
+        tx.vin[0].prevout = COutPoint(hashPrev, 0);
+    tx.vin[0].scriptSig = CScript() << (int64_t)n << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    return tx;
+}
+
+// Admission and eviction in a mempool kept at its default size of 300 MB,
+// where the walks over ancestors and descendants and the allocation of
+// entries and links dominate.
+static void MempoolAdmissionEviction(benchmark::State& state)
+{
+    const size_t nLimit = DEFAULT_MAX_MEMPOOL_SIZE * 1000000;
+    CTxMemPool pool(CFeeRate(1000));
+    uint32_t n = 0;
+    uint256 hashPrev;
+    while (pool.DynamicMemoryUsage() < nLimit) {
+        CMutableTransaction tx = MakeTx(n, hashPrev);
+        AddTx(tx, 1000 + (n * 7919) % 100000, pool);
+        hashPrev = tx.GetHash();
+        n++;
+    }
+
+    while (state.KeepRunning()) {
+        CMutableTransaction tx = MakeTx(n, hashPrev);
+        AddTx(tx, 1000 + (n * 7919) % 100000, pool);
+        hashPrev = tx.GetHash();
+        n++;
+        pool.TrimToSize(nLimit);
+    }
+}
+
 BENCHMARK(MempoolEviction);
+BENCHMARK(MempoolAdmissionEviction);
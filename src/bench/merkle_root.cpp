@@ -0,0 +1,45 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+namespace block_bench {
+#include "bench/data/block413567.raw.h"
+}
+
+// The merkle roots CheckBlock and ContextualCheckBlock compute for every block.
+
+static CBlock ReadBenchBlock()
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+static void MerkleRootUsing(benchmark::State& state, sha256_implementation::UseImplementation use)
+{
+    CBlock block = ReadBenchBlock();
+    SHA256AutoDetect(use);
+    while (state.KeepRunning()) {
+        bool mutated;
+        BlockMerkleRoot(block, &mutated);
+        BlockWitnessMerkleRoot(block, &mutated);
+    }
+    SHA256AutoDetect();
+}
+
+static void MerkleRoot(benchmark::State& state) { MerkleRootUsing(state, sha256_implementation::USE_ALL); }
+static void MerkleRoot_STANDARD(benchmark::State& state) { MerkleRootUsing(state, sha256_implementation::STANDARD); }
+
+BENCHMARK(MerkleRoot);
+BENCHMARK(MerkleRoot_STANDARD);
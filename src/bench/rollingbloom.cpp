@@ -6,6 +6,9 @@
 
 #include "bench.h"
 #include "bloom.h"
+#include "hash.h"
+#include "limitedmap.h"
+#include "uint256.h"
 #include "utiltime.h"
 
 static void RollingBloom(benchmark::State& state)
@@ -40,4 +43,69 @@ static void RollingBloom(benchmark::State& state)
     }
 }
 
+/** The relay path: transaction hashes checked against, then added to, the inventory known to a peer */
+static void RollingBloomHash(benchmark::State& state)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    uint256 hash;
+    uint32_t count = 0;
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        count++;
+        WriteLE32(hash.begin(), count);
+        match += filter.contains(hash);
+        filter.insert(hash);
+    }
+}
+
+struct BenchInvHasher {
+    size_t operator()(const uint256& hash) const { return SipHashUint256(1, 2, hash); }
+};
+
+/**
+ * mapAlreadyAskedFor as CNode::AskFor and the receipt of transactions use it:
+ * a lookup and a set per hash announced, and an erase once most arrive, with
+ * the map full of those that never do.
+ */
+template <typename Map, typename Set>
+static void AlreadyAskedFor(benchmark::State& state, Map& map, Set set)
+{
+    uint256 hash;
+    uint32_t count = 0;
+    int64_t nFound = 0;
+    while (state.KeepRunning()) {
+        count++;
+        WriteLE32(hash.begin(), count);
+        nFound += map.count(hash);
+        set(map, hash, count);
+        if (count > 1000 && count % 8 != 0) {
+            WriteLE32(hash.begin(), count - 1000);
+            map.erase(hash);
+        }
+    }
+}
+
+static void AlreadyAskedForLimitedMap(benchmark::State& state)
+{
+    limitedmap<uint256, int64_t> map(50000);
+    AlreadyAskedFor(state, map, [](limitedmap<uint256, int64_t>& m, const uint256& hash, int64_t nTime) {
+        limitedmap<uint256, int64_t>::const_iterator it = m.find(hash);
+        if (it != m.end())
+            m.update(it, nTime);
+        else
+            m.insert(std::make_pair(hash, nTime));
+    });
+}
+
+static void AlreadyAskedForFlatMap(benchmark::State& state)
+{
+    flatlimitedmap<uint256, int64_t, BenchInvHasher> map(50000);
+    AlreadyAskedFor(state, map, [](flatlimitedmap<uint256, int64_t, BenchInvHasher>& m, const uint256& hash, int64_t nTime) {
+        m.set(hash, nTime);
+    });
+}
+
 BENCHMARK(RollingBloom);
+BENCHMARK(RollingBloomHash);
+BENCHMARK(AlreadyAskedForLimitedMap);
+BENCHMARK(AlreadyAskedForFlatMap);
@@ -0,0 +1,48 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "rpc/protocol.h"
+#include "utilstrencodings.h"
+
+#include <univalue.h>
+
+#include <string>
+
+// The JSON work of every RPC call: an explorer batch of 100 requests read in
+// place from the request buffer, and a reply of the size of a verbose getblock
+static void RPCParseBatch(benchmark::State& state)
+{
+    std::string strBatch = "[";
+    for (int i = 0; i < 100; i++) {
+        if (i)
+            strBatch += ",";
+        strBatch += "{\"jsonrpc\":\"1.0\",\"id\":" + itostr(i) + ",\"method\":\"gettransactionnew\",\"params\":[\"" + std::string(64, 'a') + "\",true]}";
+    }
+    strBatch += "]";
+
+    while (state.KeepRunning()) {
+        UniValue batch;
+        batch.read(strBatch.c_str());
+    }
+}
+
+static void RPCWriteReply(benchmark::State& state)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue txs(UniValue::VARR);
+    for (int i = 0; i < 2000; i++)
+        txs.push_back(std::string(64, 'b'));
+    result.push_back(Pair("hash", std::string(64, 'c')));
+    result.push_back(Pair("height", 1234567));
+    result.push_back(Pair("tx", txs));
+
+    while (state.KeepRunning()) {
+        std::string strReply = JSONRPCReply(result, NullUniValue, UniValue(1));
+    }
+}
+
+BENCHMARK(RPCParseBatch);
+BENCHMARK(RPCWriteReply);
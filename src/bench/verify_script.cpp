@@ -4,6 +4,7 @@
 
 #include "bench.h"
 #include "key.h"
+#include "random.h"
 #if defined(HAVE_CONSENSUS_LIB)
 #include "script/bitcoinconsensus.h"
 #endif
@@ -11,6 +12,8 @@
 #include "script/sign.h"
 #include "streams.h"
 
+#include <memory>
+
 // FIXME: Dedup with BuildCreditingTransaction in test/script_tests.cpp.
 static CMutableTransaction BuildCreditingTransaction(const CScript& scriptPubKey)
 {
@@ -99,4 +102,51 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+// The legacy signature hashes of every input of a transaction spending many
+// P2PKH outputs, which each hash the whole transaction.
+static CTransaction BuildManyInputsTransaction(int nInputs)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.nLockTime = 0;
+    tx.vin.resize(nInputs);
+    for (int i = 0; i < nInputs; i++) {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), i % 4);
+        // A signature and a compressed public key
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    }
+    tx.vout.resize(2);
+    for (CTxOut& txout : tx.vout) {
+        txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+        txout.nValue = COIN;
+    }
+    return tx;
+}
+
+static void SignatureHashInputs(benchmark::State& state, int nInputs, bool fPrecompute)
+{
+    CTransaction tx = BuildManyInputsTransaction(nInputs);
+    CScript scriptCode = tx.vout[0].scriptPubKey;
+    while (state.KeepRunning()) {
+        std::unique_ptr<PrecomputedTransactionData> txdata;
+        if (fPrecompute)
+            txdata.reset(new PrecomputedTransactionData(tx));
+        for (int i = 0; i < nInputs; i++)
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL, 0, SIGVERSION_BASE, txdata.get());
+    }
+}
+
+static void SignatureHash10Inputs(benchmark::State& state) { SignatureHashInputs(state, 10, false); }
+static void SignatureHash10InputsPrecomputed(benchmark::State& state) { SignatureHashInputs(state, 10, true); }
+static void SignatureHash100Inputs(benchmark::State& state) { SignatureHashInputs(state, 100, false); }
+static void SignatureHash100InputsPrecomputed(benchmark::State& state) { SignatureHashInputs(state, 100, true); }
+static void SignatureHash1000Inputs(benchmark::State& state) { SignatureHashInputs(state, 1000, false); }
+static void SignatureHash1000InputsPrecomputed(benchmark::State& state) { SignatureHashInputs(state, 1000, true); }
+
 BENCHMARK(VerifyScriptBench);
+BENCHMARK(SignatureHash10Inputs);
+BENCHMARK(SignatureHash10InputsPrecomputed);
+BENCHMARK(SignatureHash100Inputs);
+BENCHMARK(SignatureHash100InputsPrecomputed);
+BENCHMARK(SignatureHash1000Inputs);
+BENCHMARK(SignatureHash1000InputsPrecomputed);
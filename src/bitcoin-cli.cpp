@@ -14,6 +14,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <stdio.h>
 
@@ -26,6 +27,7 @@
 static const char DEFAULT_RPCCONNECT[] = "127.0.0.1";
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
 static const bool DEFAULT_NAMED=false;
+static const int DEFAULT_BATCH_SIZE=100;
 static const int CONTINUE_EXECUTION=-1;
 
 std::string HelpMessageCli()
@@ -44,6 +46,9 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout during HTTP requests (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases)"));
+    strUsage += HelpMessageOpt("-stdin-batch", _("Read commands from standard input, one per line until EOF/Ctrl-D, either as a command and its arguments separated by spaces or as a JSON array of strings. "
+                                                 "They are sent as JSON-RPC batches over one connection, and the reply to each is written as a line of JSON as soon as its batch comes back, its id being the number of the input line"));
+    strUsage += HelpMessageOpt("-batchsize=<n>", strprintf(_("Commands sent in each JSON-RPC batch with -stdin-batch (default: %d)"), DEFAULT_BATCH_SIZE));
 
     return strUsage;
 }
@@ -85,7 +90,8 @@ static int AppInitRPC(int argc, char* argv[])
                   "  bitcoin-cli [options] <command> [params]  " + strprintf(_("Send command to %s"), _(PACKAGE_NAME)) + "\n" +
                   "  bitcoin-cli [options] -named <command> [name=value] ... " + strprintf(_("Send command to %s (with named arguments)"), _(PACKAGE_NAME)) + "\n" +
                   "  bitcoin-cli [options] help                " + _("List commands") + "\n" +
-                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n";
+                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n" +
+                  "  bitcoin-cli [options] -stdin-batch        " + _("Send the commands read from standard input") + "\n";
 
             strUsage += "\n" + HelpMessageCli();
         }
@@ -126,11 +132,13 @@ static int AppInitRPC(int argc, char* argv[])
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
-    HTTPReply(): status(0), error(-1) {}
+    HTTPReply(): status(0), error(-1), base(NULL) {}
 
     int status;
     int error;
     std::string body;
+    //! Loop to stop when the reply is in, which a kept alive connection would otherwise keep running
+    struct event_base* base;
 };
 
 const char *http_errorstring(int code)
@@ -178,6 +186,9 @@ static void http_request_done(struct evhttp_request *req, void *ctx)
             reply->body = std::string(data, size);
         evbuffer_drain(buf, size);
     }
+
+    if (reply->base)
+        event_base_loopbreak(reply->base);
 }
 
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
@@ -188,73 +199,96 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+/**
+ * A connection to the RPC server, kept open across requests when asked to,
+ * so that a batch of commands pays for a single connection and lookup.
+ */
+class CRPCConnection
 {
-    std::string host = GetArg("-rpcconnect", DEFAULT_RPCCONNECT);
-    int port = GetArg("-rpcport", BaseParams().RPCPort());
+public:
+    explicit CRPCConnection(bool fKeepAliveIn) :
+        host(GetArg("-rpcconnect", DEFAULT_RPCCONNECT)),
+        fKeepAlive(fKeepAliveIn),
+        base(obtain_event_base()),
+        // Synchronously look up hostname
+        evcon(obtain_evhttp_connection_base(base.get(), host, GetArg("-rpcport", BaseParams().RPCPort())))
+    {
+        evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
 
-    // Obtain event base
-    raii_event_base base = obtain_event_base();
+        // Get credentials
+        if (GetArg("-rpcpassword", "") == "") {
+            // Try fall back to cookie-based authentication if no password is provided
+            if (!GetAuthCookie(&strRPCUserColonPass)) {
+                throw std::runtime_error(strprintf(
+                    _("Could not locate RPC credentials. No authentication cookie could be found, and no rpcpassword is set in the configuration file (%s)"),
+                        GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
 
-    // Synchronously look up hostname
-    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-    evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+            }
+        } else {
+            strRPCUserColonPass = GetArg("-rpcuser", "") + ":" + GetArg("-rpcpassword", "");
+        }
+    }
 
-    HTTPReply response;
-    raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
-    if (req == NULL)
-        throw std::runtime_error("create http request failed");
+    /** Post a JSON-RPC request, or a batch of them, and return the parsed reply */
+    UniValue Post(const std::string& strRequest)
+    {
+        HTTPReply response;
+        if (fKeepAlive)
+            response.base = base.get();
+        raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
+        if (req == NULL)
+            throw std::runtime_error("create http request failed");
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
-    evhttp_request_set_error_cb(req.get(), http_error_cb);
+        evhttp_request_set_error_cb(req.get(), http_error_cb);
 #endif
 
-    // Get credentials
-    std::string strRPCUserColonPass;
-    if (GetArg("-rpcpassword", "") == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw std::runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found, and no rpcpassword is set in the configuration file (%s)"),
-                    GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
-
+        struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+        assert(output_headers);
+        evhttp_add_header(output_headers, "Host", host.c_str());
+        evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
+        evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
+
+        // Attach request data
+        struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+        assert(output_buffer);
+        evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+        int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
+        req.release(); // ownership moved to evcon in above call
+        if (r != 0) {
+            throw CConnectionFailed("send http request failed");
         }
-    } else {
-        strRPCUserColonPass = GetArg("-rpcuser", "") + ":" + GetArg("-rpcpassword", "");
-    }
 
-    struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
-    assert(output_headers);
-    evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
-    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
-
-    // Attach request data
-    std::string strRequest = JSONRPCRequestObj(strMethod, params, 1).write() + "\n";
-    struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
-    assert(output_buffer);
-    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
-
-    int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
-    req.release(); // ownership moved to evcon in above call
-    if (r != 0) {
-        throw CConnectionFailed("send http request failed");
+        event_base_dispatch(base.get());
+
+        if (response.status == 0)
+            throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+        else if (response.status == HTTP_UNAUTHORIZED)
+            throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
+        else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
+            throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
+        else if (response.body.empty())
+            throw std::runtime_error("no response from server");
+
+        // Parse reply
+        UniValue valReply(UniValue::VSTR);
+        if (!valReply.read(response.body))
+            throw std::runtime_error("couldn't parse reply from server");
+        return valReply;
     }
 
-    event_base_dispatch(base.get());
-
-    if (response.status == 0)
-        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
-    else if (response.status == HTTP_UNAUTHORIZED)
-        throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
-    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
-        throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
-    else if (response.body.empty())
-        throw std::runtime_error("no response from server");
-
-    // Parse reply
-    UniValue valReply(UniValue::VSTR);
-    if (!valReply.read(response.body))
-        throw std::runtime_error("couldn't parse reply from server");
+private:
+    const std::string host;
+    const bool fKeepAlive;
+    std::string strRPCUserColonPass;
+    raii_event_base base;
+    raii_evhttp_connection evcon;
+};
+
+UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+{
+    CRPCConnection connection(false);
+    UniValue valReply = connection.Post(JSONRPCRequestObj(strMethod, params, 1).write() + "\n");
     const UniValue& reply = valReply.get_obj();
     if (reply.empty())
         throw std::runtime_error("expected reply to have result, error and id properties");
@@ -262,6 +296,111 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
     return reply;
 }
 
+/** Split a line of -stdin-batch into the command and its arguments */
+static std::vector<std::string> ParseBatchLine(const std::string& strLine)
+{
+    std::vector<std::string> args;
+    if (strLine[0] == '[') {
+        UniValue valArgs;
+        if (!valArgs.read(strLine) || !valArgs.isArray())
+            throw std::runtime_error("line is not a JSON array");
+        for (unsigned int i = 0; i < valArgs.size(); i++)
+            args.push_back(valArgs[i].isStr() ? valArgs[i].get_str() : valArgs[i].write());
+    } else {
+        boost::split(args, strLine, boost::is_any_of(" \t"), boost::token_compress_on);
+    }
+    if (args.empty() || args[0].empty())
+        throw std::runtime_error("too few parameters (need at least command)");
+    return args;
+}
+
+/**
+ * Send a batch of requests, retrying it while the server is not up with
+ * -rpcwait, and write the replies in the order of the requests.
+ */
+static bool SendBatch(CRPCConnection& connection, const std::vector<UniValue>& vReply, const UniValue& batch)
+{
+    const bool fWait = GetBoolArg("-rpcwait", false);
+    std::map<int64_t, UniValue> mapReply;
+    while (batch.size() > 0) {
+        try {
+            UniValue valReply = connection.Post(batch.write() + "\n");
+            if (!valReply.isArray())
+                throw std::runtime_error("expected the reply to a batch to be an array");
+            bool fWarmup = false;
+            for (unsigned int i = 0; i < valReply.size(); i++) {
+                const UniValue& error = find_value(valReply[i], "error");
+                fWarmup |= error.isObject() && find_value(error, "code").isNum() && find_value(error, "code").get_int() == RPC_IN_WARMUP;
+                const UniValue& id = find_value(valReply[i], "id");
+                if (id.isNum())
+                    mapReply[id.get_int64()] = valReply[i];
+            }
+            if (fWait && fWarmup)
+                throw CConnectionFailed("server in warmup");
+            break;
+        }
+        catch (const CConnectionFailed&) {
+            if (!fWait)
+                throw;
+            mapReply.clear();
+            MilliSleep(1000);
+        }
+    }
+
+    // Commands that could not be converted come with their reply already
+    bool fSuccess = true;
+    for (const UniValue& reply : vReply) {
+        const UniValue& id = find_value(reply, "id");
+        std::map<int64_t, UniValue>::const_iterator it = mapReply.find(id.get_int64());
+        const UniValue& out = !reply["error"].isNull() ? reply : it != mapReply.end() ? it->second :
+            JSONRPCReplyObj(NullUniValue, JSONRPCError(RPC_MISC_ERROR, "no reply from server"), id);
+        fSuccess &= find_value(out, "error").isNull();
+        fprintf(stdout, "%s\n", out.write().c_str());
+    }
+    fflush(stdout);
+    return fSuccess;
+}
+
+/** Run the commands of standard input, -batchsize of them per request */
+static int CommandLineBatch()
+{
+    const int nBatchSize = std::max(1, (int)GetArg("-batchsize", DEFAULT_BATCH_SIZE));
+    CRPCConnection connection(true);
+
+    bool fSuccess = true;
+    UniValue batch(UniValue::VARR);
+    std::vector<UniValue> vReply;
+    std::string strLine;
+    for (int64_t nLine = 1; std::getline(std::cin, strLine); nLine++) {
+        boost::algorithm::trim(strLine);
+        if (strLine.empty())
+            continue;
+
+        // A line that fails here gets its error reply in place, the others a
+        // placeholder filled in from the reply of the batch
+        try {
+            std::vector<std::string> args = ParseBatchLine(strLine);
+            std::string strMethod = args[0];
+            args.erase(args.begin());
+            UniValue params = GetBoolArg("-named", DEFAULT_NAMED) ? RPCConvertNamedValues(strMethod, args) : RPCConvertValues(strMethod, args);
+            batch.push_back(JSONRPCRequestObj(strMethod, params, nLine));
+            vReply.push_back(JSONRPCReplyObj(NullUniValue, NullUniValue, nLine));
+        } catch (const std::exception& e) {
+            vReply.push_back(JSONRPCReplyObj(NullUniValue, JSONRPCError(RPC_INVALID_PARAMETER, e.what()), nLine));
+        }
+
+        if ((int)vReply.size() >= nBatchSize) {
+            fSuccess &= SendBatch(connection, vReply, batch);
+            batch = UniValue(UniValue::VARR);
+            vReply.clear();
+        }
+    }
+    if (!vReply.empty())
+        fSuccess &= SendBatch(connection, vReply, batch);
+
+    return fSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int CommandLineRPC(int argc, char *argv[])
 {
     std::string strPrint;
@@ -272,6 +411,11 @@ int CommandLineRPC(int argc, char *argv[])
             argc--;
             argv++;
         }
+        if (GetBoolArg("-stdin-batch", false)) {
+            if (argc > 1)
+                throw std::runtime_error("commands are read from standard input with -stdin-batch");
+            return CommandLineBatch();
+        }
         std::vector<std::string> args = std::vector<std::string>(&argv[1], &argv[argc]);
         if (GetBoolArg("-stdin", false)) {
             // Read one arg per line from stdin and append
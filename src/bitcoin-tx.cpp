@@ -11,6 +11,7 @@
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "core_io.h"
+#include "dposdata.h"
 #include "keystore.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
@@ -21,6 +22,8 @@
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 
+#include <fstream>
+#include <iostream>
 #include <stdio.h>
 
 #include <boost/algorithm/string.hpp>
@@ -58,12 +61,16 @@ static int AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  bitcoin-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded bitcoin transaction") + "\n" +
               "  bitcoin-tx [options] -create [commands]   " + _("Create hex-encoded bitcoin transaction") + "\n" +
+              "  bitcoin-tx [options] -batch=<file> [register commands]   " + _("Create a transaction from each line of <file>") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
 
         strUsage = HelpMessageGroup(_("Options:"));
         strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-batch=<file>", _("Read a JSON object per line of <file> (\"-\" for standard input) and output the transaction of each line") + ". " +
+            _("The object may hold a \"hex\" TX to start from, \"registers\" to set for that line and the \"commands\" to apply, such as [\"in=TXID:VOUT\", \"vote=ADDRESS\", \"sign=ALL\"]") + ". " +
+            _("Registers set on the command line are shared by all the lines. Output stops at the first line that fails."));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
@@ -95,6 +102,20 @@ static int AppInitRawTx(int argc, char* argv[])
             _("See signrawtransaction docs for format of sighash flags, JSON objects."));
         fprintf(stdout, "%s", strUsage.c_str());
 
+        strUsage = HelpMessageGroup(_("DPoS Commands:"));
+        strUsage += "  " + FormatParagraph(_("The operation output is added first, where nodes look for it") + ". " +
+            _("All the inputs must spend from the address of the sender and leave at least the fee of the operation."), 77, 2) + "\n\n";
+        strUsage += HelpMessageOpt("register=NAME", _("Add an output registering the sender as delegate NAME"));
+        strUsage += HelpMessageOpt("vote=ADDRESS1:ADDRESS2:...", _("Add an output voting for the delegates"));
+        strUsage += HelpMessageOpt("cancelvote=ADDRESS1:ADDRESS2:...", _("Add an output revoking the votes for the delegates"));
+        strUsage += HelpMessageOpt("registercommittee=NAME:URL", _("Add an output registering the sender as committee NAME"));
+        strUsage += HelpMessageOpt("votecommittee=ADDRESS", _("Add an output voting for the committee"));
+        strUsage += HelpMessageOpt("cancelvotecommittee=ADDRESS", _("Add an output revoking the vote for the committee"));
+        strUsage += HelpMessageOpt("submitbill=JSON-OBJECT", _("Add an output submitting a bill") + ". " +
+            _("The object holds its \"title\", \"detail\", \"url\", \"endtime\" as a UNIX time and \"options\" array"));
+        strUsage += HelpMessageOpt("votebill=BILLID:INDEX", _("Add an output voting for option INDEX of the bill"));
+        fprintf(stdout, "%s", strUsage.c_str());
+
         strUsage = HelpMessageGroup(_("Register Commands:"));
         strUsage += HelpMessageOpt("load=NAME:FILENAME", _("Load JSON file FILENAME into register NAME"));
         strUsage += HelpMessageOpt("set=NAME:JSON-STRING", _("Set register NAME to given JSON-STRING"));
@@ -462,6 +483,154 @@ static void MutateTxDelOutput(CMutableTransaction& tx, const std::string& strOut
     tx.vout.erase(tx.vout.begin() + outIdx);
 }
 
+static CKeyID ExtractAndValidateKeyID(const std::string& strAddr)
+{
+    CBitcoinAddress addr(strAddr);
+    CKeyID keyid;
+    if (!addr.IsValid() || !addr.GetKeyID(keyid))
+        throw std::runtime_error("invalid DPoS address '" + strAddr + "'");
+    return keyid;
+}
+
+// The node reads a DPoS operation from a zero valued OP_RETURN first output,
+// its push starting with four zero bytes
+static void MutateTxAddDPoSOp(CMutableTransaction& tx, const std::vector<unsigned char>& payload)
+{
+    if (!tx.vout.empty() && tx.vout[0].nValue == 0 &&
+        !tx.vout[0].scriptPubKey.empty() && tx.vout[0].scriptPubKey[0] == OP_RETURN)
+        throw std::runtime_error("TX already has an OP_RETURN first output");
+
+    std::vector<unsigned char> data(4, 0);
+    data.insert(data.end(), payload.begin(), payload.end());
+
+    CTxOut txout(0, CScript() << OP_RETURN << data);
+    tx.vout.insert(tx.vout.begin(), txout);
+}
+
+template<typename T>
+static void MutateTxAddDPoSOpData(CMutableTransaction& tx, const T& data)
+{
+    std::string strErr = CheckStruct(data);
+    if (!strErr.empty())
+        throw std::runtime_error(strErr);
+
+    MutateTxAddDPoSOp(tx, StructToData(data));
+}
+
+static void MutateTxRegister(CMutableTransaction& tx, const std::string& strName)
+{
+    CRegisterForgerData data;
+    data.opcode = OP_REGISTE;
+    data.name = strName;
+    MutateTxAddDPoSOpData(tx, data);
+}
+
+static void MutateTxVote(CMutableTransaction& tx, const std::string& strInput, bool fVote)
+{
+    // Separate into ADDRESS1:ADDRESS2:...
+    std::vector<std::string> vStrInputParts;
+    boost::split(vStrInputParts, strInput, boost::is_any_of(":"));
+
+    std::set<CKeyID> forgers;
+    for (const std::string& strAddr : vStrInputParts) {
+        if (!forgers.insert(ExtractAndValidateKeyID(strAddr)).second)
+            throw std::runtime_error("duplicate DPoS address '" + strAddr + "'");
+    }
+    if (forgers.size() > MAX_DPOS_OP_KEYS)
+        throw std::runtime_error("too many DPoS addresses");
+
+    if (fVote) {
+        CVoteForgerData data;
+        data.opcode = OP_VOTE;
+        data.forgers = forgers;
+        MutateTxAddDPoSOpData(tx, data);
+    } else {
+        CCancelVoteForgerData data;
+        data.opcode = OP_REVOKE;
+        data.forgers = forgers;
+        MutateTxAddDPoSOpData(tx, data);
+    }
+}
+
+static void MutateTxRegisterCommittee(CMutableTransaction& tx, const std::string& strInput)
+{
+    // Separate into NAME:URL, the URL keeping any further separators
+    size_t pos = strInput.find(':');
+    if (pos == std::string::npos)
+        throw std::runtime_error("committee registration requires NAME:URL");
+
+    CRegisterCommitteeData data;
+    data.opcode = OP_REGISTE_COMMITTEE;
+    data.name = strInput.substr(0, pos);
+    data.url = strInput.substr(pos + 1);
+    MutateTxAddDPoSOpData(tx, data);
+}
+
+static void MutateTxVoteCommittee(CMutableTransaction& tx, const std::string& strAddr, bool fVote)
+{
+    if (fVote) {
+        CVoteCommitteeData data;
+        data.opcode = OP_VOTE_COMMITTEE;
+        data.committee = ExtractAndValidateKeyID(strAddr);
+        MutateTxAddDPoSOpData(tx, data);
+    } else {
+        CCancelVoteCommitteeData data;
+        data.opcode = OP_REVOKE_COMMITTEE;
+        data.committee = ExtractAndValidateKeyID(strAddr);
+        MutateTxAddDPoSOpData(tx, data);
+    }
+}
+
+static void MutateTxSubmitBill(CMutableTransaction& tx, const std::string& strJson)
+{
+    UniValue billObj;
+    if (!billObj.read(strJson) || !billObj.isObject())
+        throw std::runtime_error("bill is not a JSON object");
+
+    std::map<std::string,UniValue::VType> types = boost::assign::map_list_of("title", UniValue::VSTR)("detail", UniValue::VSTR)("url", UniValue::VSTR)("endtime", UniValue::VNUM)("options", UniValue::VARR);
+    if (!billObj.checkObject(types))
+        throw std::runtime_error("bill object typecheck fail");
+
+    CSubmitBillData data;
+    data.opcode = OP_SUBMIT_BILL;
+    data.title = billObj["title"].get_str();
+    data.detail = billObj["detail"].get_str();
+    data.url = billObj["url"].get_str();
+    int64_t nEndTime = billObj["endtime"].get_int64();
+    if (nEndTime <= 0)
+        throw std::runtime_error("invalid bill endtime");
+    data.endtime = nEndTime;
+    const UniValue& options = billObj["options"];
+    for (unsigned int i = 0; i < options.size(); i++) {
+        if (!options[i].isStr())
+            throw std::runtime_error("bill option not a string");
+        data.options.push_back(options[i].get_str());
+    }
+    MutateTxAddDPoSOpData(tx, data);
+}
+
+static void MutateTxVoteBill(CMutableTransaction& tx, const std::string& strInput)
+{
+    // Separate into BILLID:INDEX
+    std::vector<std::string> vStrInputParts;
+    boost::split(vStrInputParts, strInput, boost::is_any_of(":"));
+    if (vStrInputParts.size() != 2)
+        throw std::runtime_error("bill vote requires BILLID:INDEX");
+
+    const std::string& strId = vStrInputParts[0];
+    if (strId.size() != 40 || !IsHex(strId))
+        throw std::runtime_error("invalid bill id");
+    int nIndex = atoi(vStrInputParts[1]);
+    if (nIndex < 0 || nIndex > 255)
+        throw std::runtime_error("invalid bill option index");
+
+    CVoteBillData data;
+    data.opcode = OP_VOTE_BILL;
+    data.id.SetHex(strId);
+    data.index = nIndex;
+    MutateTxAddDPoSOpData(tx, data);
+}
+
 static const unsigned int N_SIGHASH_OPTS = 6;
 static const struct {
     const char *flagStr;
@@ -576,20 +745,22 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& flagStr)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     std::string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw std::runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(prevOut["amount"]);
+                    newcoin.out.nValue = AmountFromValue(prevOut["amount"]);
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and private keys given,
@@ -611,13 +782,13 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& flagStr)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             fComplete = false;
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -655,10 +826,8 @@ public:
 };
 
 static void MutateTx(CMutableTransaction& tx, const std::string& command,
-                     const std::string& commandVal)
+                     const std::string& commandVal, std::unique_ptr<Secp256k1Init>& ecc)
 {
-    std::unique_ptr<Secp256k1Init> ecc;
-
     if (command == "nversion")
         MutateTxVersion(tx, commandVal);
     else if (command == "locktime")
@@ -682,6 +851,23 @@ static void MutateTx(CMutableTransaction& tx, const std::string& command,
     else if (command == "outdata")
         MutateTxAddOutData(tx, commandVal);
 
+    else if (command == "register")
+        MutateTxRegister(tx, commandVal);
+    else if (command == "vote")
+        MutateTxVote(tx, commandVal, true);
+    else if (command == "cancelvote")
+        MutateTxVote(tx, commandVal, false);
+    else if (command == "registercommittee")
+        MutateTxRegisterCommittee(tx, commandVal);
+    else if (command == "votecommittee")
+        MutateTxVoteCommittee(tx, commandVal, true);
+    else if (command == "cancelvotecommittee")
+        MutateTxVoteCommittee(tx, commandVal, false);
+    else if (command == "submitbill")
+        MutateTxSubmitBill(tx, commandVal);
+    else if (command == "votebill")
+        MutateTxVoteBill(tx, commandVal);
+
     else if (command == "sign") {
         if (!ecc) { ecc.reset(new Secp256k1Init()); }
         MutateTxSign(tx, commandVal);
@@ -702,7 +888,8 @@ static void OutputTxJSON(const CTransaction& tx)
     UniValue entry(UniValue::VOBJ);
     TxToUniv(tx, uint256(), entry);
 
-    std::string jsonOutput = entry.write(4);
+    // A batch writes one transaction per line
+    std::string jsonOutput = entry.write(IsArgSet("-batch") ? 0 : 4);
     fprintf(stdout, "%s\n", jsonOutput.c_str());
 }
 
@@ -750,6 +937,88 @@ static std::string readStdin()
     return ret;
 }
 
+static void MutateTxCommand(CMutableTransaction& tx, const std::string& arg, std::unique_ptr<Secp256k1Init>& ecc)
+{
+    std::string key, value;
+    size_t eqpos = arg.find('=');
+    if (eqpos == std::string::npos)
+        key = arg;
+    else {
+        key = arg.substr(0, eqpos);
+        value = arg.substr(eqpos + 1);
+    }
+
+    MutateTx(tx, key, value, ecc);
+}
+
+/**
+ * Build the transaction of one line of a batch: a JSON object with an
+ * optional "hex" transaction to start from instead of a blank one, an
+ * optional "registers" object set for this line only, and the "commands"
+ * to apply, written as on the command line.
+ */
+static void MutateTxBatchLine(const std::string& strLine, const std::map<std::string,UniValue>& sharedRegisters,
+                              std::unique_ptr<Secp256k1Init>& ecc)
+{
+    UniValue lineObj;
+    if (!lineObj.read(strLine) || !lineObj.isObject())
+        throw std::runtime_error("not a JSON object");
+
+    CMutableTransaction tx;
+    if (lineObj.exists("hex")) {
+        if (!lineObj["hex"].isStr() || !DecodeHexTx(tx, lineObj["hex"].get_str(), true))
+            throw std::runtime_error("invalid transaction encoding");
+    }
+
+    registers = sharedRegisters;
+    if (lineObj.exists("registers")) {
+        const UniValue& registersObj = lineObj["registers"];
+        if (!registersObj.isObject())
+            throw std::runtime_error("registers not a JSON object");
+        const std::vector<std::string>& keys = registersObj.getKeys();
+        for (unsigned int i = 0; i < keys.size(); i++)
+            registers[keys[i]] = registersObj[keys[i]];
+    }
+
+    const UniValue& commands = lineObj["commands"];
+    if (!commands.isNull() && !commands.isArray())
+        throw std::runtime_error("commands not a JSON array");
+    for (unsigned int i = 0; i < commands.size(); i++) {
+        if (!commands[i].isStr())
+            throw std::runtime_error("command not a string");
+        MutateTxCommand(tx, commands[i].get_str(), ecc);
+    }
+
+    OutputTx(tx);
+}
+
+/**
+ * Build one transaction per line of a JSON lines stream, in one process so
+ * that thousands of DPoS operations cost a single startup. The registers set
+ * on the command line are shared by every line. Output stops at the first
+ * line that fails.
+ */
+static void CommandLineBatch(std::istream& stream, std::unique_ptr<Secp256k1Init>& ecc)
+{
+    const std::map<std::string,UniValue> sharedRegisters(registers);
+
+    std::string strLine;
+    for (unsigned int nLine = 1; std::getline(stream, strLine); nLine++) {
+        boost::algorithm::trim(strLine);
+        if (strLine.empty())
+            continue;
+
+        try {
+            MutateTxBatchLine(strLine, sharedRegisters, ecc);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(strprintf("line %u: %s", nLine, e.what()));
+        }
+    }
+
+    if (stream.bad())
+        throw std::runtime_error("error reading batch file");
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     std::string strPrint;
@@ -762,9 +1031,32 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        // Signing contexts are set up once, however many transactions get signed
+        std::unique_ptr<Secp256k1Init> ecc;
         CMutableTransaction tx;
         int startArg;
 
+        if (IsArgSet("-batch")) {
+            // Only registers can be set for all the transactions of a batch
+            for (int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg.compare(0, 5, "load=") != 0 && arg.compare(0, 4, "set=") != 0)
+                    throw std::runtime_error("only register commands can be given with -batch");
+                MutateTxCommand(tx, arg, ecc);
+            }
+
+            std::string strFile = GetArg("-batch", "");
+            if (strFile == "-") {
+                CommandLineBatch(std::cin, ecc);
+            } else {
+                std::ifstream file(strFile.c_str());
+                if (!file.is_open())
+                    throw std::runtime_error("Cannot open file " + strFile);
+                CommandLineBatch(file, ecc);
+            }
+            return nRet;
+        }
+
         if (!fCreateBlank) {
             // require at least one param
             if (argc < 2)
@@ -782,19 +1074,8 @@ static int CommandLineRawTx(int argc, char* argv[])
         } else
             startArg = 1;
 
-        for (int i = startArg; i < argc; i++) {
-            std::string arg = argv[i];
-            std::string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == std::string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
-
-            MutateTx(tx, key, value);
-        }
+        for (int i = startArg; i < argc; i++)
+            MutateTxCommand(tx, argv[i], ecc);
 
         OutputTx(tx);
     }
@@ -18,14 +18,27 @@
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
+        CBlockHeaderAndShortTxIDs(block, fUseWTXID, std::vector<size_t>()) {}
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const std::vector<size_t>& vPrefillIndexes) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
+        header(block) {
     FillShortTxIDSelector();
-    //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
+    shorttxids.reserve(block.vtx.size() - 1 - vPrefillIndexes.size());
+    prefilledtxn.reserve(1 + vPrefillIndexes.size());
+    prefilledtxn.push_back({0, block.vtx[0]});
+    // Indexes of prefilled transactions are sent as the offset since the previous one
+    size_t nLastPrefilled = 0;
+    std::vector<size_t>::const_iterator itPrefill = vPrefillIndexes.begin();
     for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        if (itPrefill != vPrefillIndexes.end() && *itPrefill == i) {
+            prefilledtxn.push_back({(uint16_t)(i - nLastPrefilled - 1), block.vtx[i]});
+            nLastPrefilled = i;
+            ++itPrefill;
+        } else {
+            shorttxids.push_back(GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash()));
+        }
     }
 }
 
@@ -149,10 +149,13 @@ public:
     CBlockHeaderAndShortTxIDs() {}
 
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    /** Also send the transactions at vPrefillIndexes, ascending and past the coinbase, in full */
+    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const std::vector<size_t>& vPrefillIndexes);
 
     uint64_t GetShortID(const uint256& txhash) const;
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+    size_t PrefilledTxCount() const { return prefilledtxn.size(); }
 
     ADD_SERIALIZE_METHODS;
 
@@ -206,4 +209,116 @@ public:
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing);
 };
 
+/**
+ * A run of consecutive headers, as a "cheaders" message has them, without
+ * the fields a DPoS chain makes redundant. Each header after the first
+ * follows the one before it, so its hashPrevBlock is left out. nVersion and
+ * nBits are sent only when they change, nNonce only when it is not zero,
+ * and nTime as a count of slots of nSlotInterval seconds after the time of
+ * the header before when it lies on that grid. A flags byte per header
+ * tells which fields follow it.
+ */
+class CCompressedHeaders {
+private:
+    static const uint8_t HEADER_PREV = 1;
+    static const uint8_t HEADER_VERSION = 2;
+    static const uint8_t HEADER_BITS = 4;
+    static const uint8_t HEADER_NONCE = 8;
+    static const uint8_t HEADER_SLOTS = 16;
+
+public:
+    uint32_t nSlotInterval;
+    std::vector<CBlockHeader> vHeaders;
+
+    // Dummy for deserialization
+    CCompressedHeaders() : nSlotInterval(0) {}
+
+    CCompressedHeaders(uint32_t nSlotIntervalIn, const std::vector<CBlockHeader>& vHeadersIn) :
+        nSlotInterval(nSlotIntervalIn), vHeaders(vHeadersIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nSlotInterval));
+        uint64_t headers_size = (uint64_t)vHeaders.size();
+        READWRITE(COMPACTSIZE(headers_size));
+        if (ser_action.ForRead()) {
+            vHeaders.clear();
+            while (vHeaders.size() < headers_size) {
+                size_t i = vHeaders.size();
+                vHeaders.resize(std::min((uint64_t)(1000 + vHeaders.size()), headers_size));
+                for (; i < vHeaders.size(); i++) {
+                    const CBlockHeader* pprev = i == 0 ? NULL : &vHeaders[i - 1];
+                    CBlockHeader& header = vHeaders[i];
+                    uint8_t nFlags = 0;
+                    READWRITE(nFlags);
+                    if (!pprev && (nFlags & (HEADER_PREV | HEADER_VERSION | HEADER_BITS)) != (HEADER_PREV | HEADER_VERSION | HEADER_BITS))
+                        throw std::ios_base::failure("first compressed header incomplete");
+                    if (nFlags & HEADER_PREV)
+                        READWRITE(header.hashPrevBlock);
+                    else
+                        header.hashPrevBlock = pprev->GetHash();
+                    if (nFlags & HEADER_VERSION)
+                        READWRITE(header.nVersion);
+                    else
+                        header.nVersion = pprev->nVersion;
+                    READWRITE(header.hashMerkleRoot);
+                    if (nFlags & HEADER_SLOTS) {
+                        uint32_t nSlots = 0;
+                        READWRITE(VARINT(nSlots));
+                        uint64_t nTime = pprev ? pprev->nTime + (uint64_t)nSlots * nSlotInterval : 0;
+                        if (!pprev || nTime > std::numeric_limits<uint32_t>::max())
+                            throw std::ios_base::failure("compressed header time overflowed 32 bits");
+                        header.nTime = nTime;
+                    } else {
+                        READWRITE(header.nTime);
+                    }
+                    if (nFlags & HEADER_BITS)
+                        READWRITE(header.nBits);
+                    else
+                        header.nBits = pprev->nBits;
+                    if (nFlags & HEADER_NONCE)
+                        READWRITE(header.nNonce);
+                    else
+                        header.nNonce = 0;
+                }
+            }
+        } else {
+            for (size_t i = 0; i < vHeaders.size(); i++) {
+                const CBlockHeader* pprev = i == 0 ? NULL : &vHeaders[i - 1];
+                CBlockHeader header = vHeaders[i];
+                uint8_t nFlags = 0;
+                if (!pprev || header.hashPrevBlock != pprev->GetHash())
+                    nFlags |= HEADER_PREV;
+                if (!pprev || header.nVersion != pprev->nVersion)
+                    nFlags |= HEADER_VERSION;
+                if (!pprev || header.nBits != pprev->nBits)
+                    nFlags |= HEADER_BITS;
+                if (header.nNonce != 0)
+                    nFlags |= HEADER_NONCE;
+                uint32_t nSlots = 0;
+                if (pprev && nSlotInterval > 0 && header.nTime >= pprev->nTime && (header.nTime - pprev->nTime) % nSlotInterval == 0) {
+                    nFlags |= HEADER_SLOTS;
+                    nSlots = (header.nTime - pprev->nTime) / nSlotInterval;
+                }
+                READWRITE(nFlags);
+                if (nFlags & HEADER_PREV)
+                    READWRITE(header.hashPrevBlock);
+                if (nFlags & HEADER_VERSION)
+                    READWRITE(header.nVersion);
+                READWRITE(header.hashMerkleRoot);
+                if (nFlags & HEADER_SLOTS)
+                    READWRITE(VARINT(nSlots));
+                else
+                    READWRITE(header.nTime);
+                if (nFlags & HEADER_BITS)
+                    READWRITE(header.nBits);
+                if (nFlags & HEADER_NONCE)
+                    READWRITE(header.nNonce);
+            }
+        }
+    }
+};
+
 #endif
@@ -0,0 +1,276 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "serialize.h"
+#include "streams.h"
+#include "undo.h"
+#include "vote.h"
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+
+/** Writes bits to a byte vector, the first bit in the high bit of a byte */
+class CBitWriter
+{
+public:
+    explicit CBitWriter(std::vector<unsigned char>& vDataIn) : vData(vDataIn), nBuffer(0), nOffset(0) {}
+
+    /** Write the low nBits bits of nValue, up to 64 */
+    void Write(uint64_t nValue, int nBits)
+    {
+        while (nBits > 0) {
+            int nCount = std::min(8 - nOffset, nBits);
+            nBuffer |= ((nValue >> (nBits - nCount)) & ((1 << nCount) - 1)) << (8 - nOffset - nCount);
+            nOffset += nCount;
+            nBits -= nCount;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out the last partial byte, padded with zero bits */
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vData.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+
+private:
+    std::vector<unsigned char>& vData;
+    uint8_t nBuffer;
+    int nOffset;
+};
+
+class CBitReader
+{
+public:
+    CBitReader(const unsigned char* pbeginIn, const unsigned char* pendIn) : pc(pbeginIn), pend(pendIn), nBuffer(0), nOffset(8) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t nValue = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (pc == pend)
+                    throw std::ios_base::failure("CBitReader::Read(): end of data");
+                nBuffer = *pc++;
+                nOffset = 0;
+            }
+            int nCount = std::min(8 - nOffset, nBits);
+            nValue = (nValue << nCount) | ((uint8_t)(nBuffer << nOffset) >> (8 - nCount));
+            nOffset += nCount;
+            nBits -= nCount;
+        }
+        return nValue;
+    }
+
+    /** Whether every byte was read, the last one possibly in part */
+    bool AtEnd() const { return pc == pend; }
+
+private:
+    const unsigned char* pc;
+    const unsigned char* pend;
+    uint8_t nBuffer;
+    int nOffset;
+};
+
+static void GolombRiceEncode(CBitWriter& writer, uint8_t nP, uint64_t nValue)
+{
+    // The quotient in unary, ones ended by a zero
+    for (uint64_t q = nValue >> nP; q > 0; q -= std::min<uint64_t>(q, 64))
+        writer.Write(~(uint64_t)0, std::min<uint64_t>(q, 64));
+    writer.Write(0, 1);
+    writer.Write(nValue, nP);
+}
+
+static uint64_t GolombRiceDecode(CBitReader& reader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    return (q << nP) + reader.Read(nP);
+}
+
+/** (x * n) >> 64, which maps a uniform 64 bit hash into [0, n) */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return ((unsigned __int128)x * (unsigned __int128)n) >> 64;
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xffffffff;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xffffffff;
+    uint64_t ac = x_hi * n_hi, ad = x_hi * n_lo, bc = x_lo * n_hi, bd = x_lo * n_lo;
+    uint64_t mid = (bd >> 32) + (bc & 0xffffffff) + (ad & 0xffffffff);
+    return ac + (bc >> 32) + (ad >> 32) + (mid >> 32);
+#endif
+}
+
+
+CGCSFilter::CGCSFilter(uint64_t nK0In, uint64_t nK1In, uint8_t nPIn, uint32_t nMIn) :
+    nK0(nK0In), nK1(nK1In), nP(nPIn), nM(nMIn), nN(0), nF(0), vEncoded(1, 0)
+{
+}
+
+CGCSFilter::CGCSFilter(uint64_t nK0In, uint64_t nK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements) :
+    nK0(nK0In), nK1(nK1In), nP(nPIn), nM(nMIn), nN(elements.size()), nF((uint64_t)nN * nMIn)
+{
+    std::vector<uint64_t> vHash;
+    vHash.reserve(elements.size());
+    for (const Element& element : elements)
+        vHash.push_back(HashToRange(element));
+    std::sort(vHash.begin(), vHash.end());
+
+    CVectorWriter stream(SER_NETWORK, 0, vEncoded, 0);
+    WriteCompactSize(stream, nN);
+    CBitWriter writer(vEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : vHash) {
+        GolombRiceEncode(writer, nP, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+CGCSFilter::CGCSFilter(uint64_t nK0In, uint64_t nK1In, uint8_t nPIn, uint32_t nMIn, std::vector<unsigned char> vEncodedIn) :
+    nK0(nK0In), nK1(nK1In), nP(nPIn), nM(nMIn), vEncoded(std::move(vEncodedIn))
+{
+    CDataStream stream(vEncoded, SER_NETWORK, 0);
+    uint64_t nSize = ReadCompactSize(stream);
+    if (nSize > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("CGCSFilter: too many elements");
+    nN = nSize;
+    nF = (uint64_t)nN * nM;
+
+    // Decode the whole set once, so that a truncated or padded filter is refused here
+    CBitReader reader(vEncoded.data() + vEncoded.size() - stream.size(), vEncoded.data() + vEncoded.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, nP);
+    if (!reader.AtEnd())
+        throw std::ios_base::failure("CGCSFilter: data after the set");
+}
+
+uint64_t CGCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(nK0, nK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+bool CGCSFilter::MatchSorted(const std::vector<uint64_t>& vQuery) const
+{
+    if (nN == 0 || vQuery.empty())
+        return false;
+
+    // The count is canonically encoded, ReadCompactSize refusing anything else
+    CBitReader reader(vEncoded.data() + GetSizeOfCompactSize(nN), vEncoded.data() + vEncoded.size());
+
+    // Walk the set and the query together, both being sorted
+    uint64_t nValue = 0;
+    std::vector<uint64_t>::const_iterator it = vQuery.begin();
+    for (uint32_t i = 0; i < nN; i++) {
+        nValue += GolombRiceDecode(reader, nP);
+        while (*it < nValue) {
+            if (++it == vQuery.end())
+                return false;
+        }
+        if (*it == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool CGCSFilter::Match(const Element& element) const
+{
+    return MatchSorted(std::vector<uint64_t>(1, HashToRange(element)));
+}
+
+bool CGCSFilter::MatchAny(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vQuery;
+    vQuery.reserve(elements.size());
+    for (const Element& element : elements)
+        vQuery.push_back(HashToRange(element));
+    std::sort(vQuery.begin(), vQuery.end());
+    return MatchSorted(vQuery);
+}
+
+/** The pay-to-pubkey-hash scripts of the keys a DPoS vote, revocation or committee vote names */
+static void AddDPoSElements(CGCSFilter::ElementSet& elements, const CTransaction& tx)
+{
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    if (!tx.GetDPoSPayload(pbegin, pend) || pbegin == pend)
+        return;
+
+    std::vector<CKeyID> vKeys;
+    if (*pbegin == OP_VOTE || *pbegin == OP_REVOKE) {
+        CDPoSKeys keys;
+        if (ParseDPoSKeys(keys, pbegin, pend))
+            vKeys.assign(keys.begin(), keys.end());
+    } else if (*pbegin == OP_VOTE_COMMITTEE || *pbegin == OP_REVOKE_COMMITTEE) {
+        CVoteCommitteeData data;
+        if (DataToStruct(data, CScript(pbegin, pend)))
+            vKeys.push_back(data.committee);
+    }
+    for (const CKeyID& keyid : vKeys) {
+        CScript script = GetScriptForDestination(keyid);
+        elements.insert(CGCSFilter::Element(script.begin(), script.end()));
+    }
+}
+
+CGCSFilter::ElementSet CBlockFilter::GetElements(const CBlock& block, const CBlockUndo& blockundo)
+{
+    CGCSFilter::ElementSet elements;
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& out : tx->vout) {
+            const CScript& script = out.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(CGCSFilter::Element(script.begin(), script.end()));
+        }
+        AddDPoSElements(elements, *tx);
+    }
+
+    for (const CTxUndo& txundo : blockundo.vtxundo) {
+        for (const Coin& coin : txundo.vprevout) {
+            const CScript& script = coin.out.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(CGCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    return elements;
+}
+
+CBlockFilter::CBlockFilter(const uint256& hashBlockIn, const CBlock& block, const CBlockUndo& blockundo) :
+    hashBlock(hashBlockIn),
+    filter(hashBlockIn.GetUint64(0), hashBlockIn.GetUint64(1), BASIC_FILTER_P, BASIC_FILTER_M, GetElements(block, blockundo))
+{
+}
+
+CBlockFilter::CBlockFilter(const uint256& hashBlockIn, std::vector<unsigned char> vEncoded) :
+    hashBlock(hashBlockIn),
+    filter(hashBlockIn.GetUint64(0), hashBlockIn.GetUint64(1), BASIC_FILTER_P, BASIC_FILTER_M, std::move(vEncoded))
+{
+}
+
+uint256 CBlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vEncoded = GetEncoded();
+    return Hash(vEncoded.begin(), vEncoded.end());
+}
+
+uint256 CBlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
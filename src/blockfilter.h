@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/** Bits of the remainder of each Golomb-Rice coded element of a basic filter, as in BIP 158 */
+static const uint8_t BASIC_FILTER_P = 19;
+/** Inverse false positive rate of a basic filter, as in BIP 158 */
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/**
+ * A Golomb-coded set: the elements are hashed into [0, N * M), sorted, and the
+ * differences between consecutive hashes are written Golomb-Rice coded with P
+ * bits of remainder. Matching an element decodes the set up to its hash. An
+ * element that was not added matches with probability about 1 / M.
+ */
+class CGCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    /** An empty filter */
+    CGCSFilter(uint64_t nK0In = 0, uint64_t nK1In = 0, uint8_t nPIn = BASIC_FILTER_P, uint32_t nMIn = BASIC_FILTER_M);
+    /** Build the filter of a set of elements, under the SipHash key (nK0In, nK1In) */
+    CGCSFilter(uint64_t nK0In, uint64_t nK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements);
+    /** Read an encoded filter, throwing std::ios_base::failure when it is malformed */
+    CGCSFilter(uint64_t nK0In, uint64_t nK1In, uint8_t nPIn, uint32_t nMIn, std::vector<unsigned char> vEncodedIn);
+
+    uint32_t GetN() const { return nN; }
+    /** The number of elements followed by the coded set */
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    bool Match(const Element& element) const;
+    /** Whether any of the elements matches, in a single pass over the set */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    uint64_t nK0;
+    uint64_t nK1;
+    uint8_t nP;
+    uint32_t nM;
+    uint32_t nN;
+    //! N * M, the range the elements are hashed into
+    uint64_t nF;
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    /** Whether the sorted hashes and the set share one */
+    bool MatchSorted(const std::vector<uint64_t>& vQuery) const;
+};
+
+enum BlockFilterType : uint8_t
+{
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/**
+ * The basic filter of a block: the output scripts it creates, except OP_RETURN
+ * ones, the output scripts it spends, and the pay-to-pubkey-hash scripts of
+ * the delegates and committees its DPoS votes and revocations name. A wallet
+ * watching its scripts thus finds the blocks that pay or spend them, and a
+ * delegate the blocks that vote for it. The SipHash key comes from the block
+ * hash.
+ */
+class CBlockFilter
+{
+public:
+    CBlockFilter() {}
+    /** The filter of a block with the outputs it spends; the genesis block comes without transactions */
+    CBlockFilter(const uint256& hashBlockIn, const CBlock& block, const CBlockUndo& blockundo);
+    /** Read an encoded filter, throwing std::ios_base::failure when it is malformed */
+    CBlockFilter(const uint256& hashBlockIn, std::vector<unsigned char> vEncoded);
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const CGCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncoded() const { return filter.GetEncoded(); }
+
+    /** Double SHA-256 of the encoded filter */
+    uint256 GetHash() const;
+    /** The filter header, which commits to the filter and to the header of the block before */
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+
+    /** The elements a block would add to its filter */
+    static CGCSFilter::ElementSet GetElements(const CBlock& block, const CBlockUndo& blockundo);
+
+private:
+    uint256 hashBlock;
+    CGCSFilter filter;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,186 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+
+#include <algorithm>
+#include <string.h>
+
+CBlockFileImporter::CBlockFileImporter(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStartIn, int nWorkers) :
+    file(fileIn), nQueuedBytes(0), nRestartPos(0), fRestart(false), fReaderDone(false), fStop(false)
+{
+    memcpy(messageStart, messageStartIn, CMessageHeader::MESSAGE_START_SIZE);
+    threadRead = std::thread(&CBlockFileImporter::ThreadRead, this);
+    for (int i = 0; i < std::max(nWorkers, 1); i++)
+        vThreadWork.push_back(std::thread(&CBlockFileImporter::ThreadWork, this));
+}
+
+CBlockFileImporter::~CBlockFileImporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    condJobs.notify_all();
+    condReader.notify_all();
+    threadRead.join();
+    for (std::thread& thread : vThreadWork)
+        thread.join();
+}
+
+void CBlockFileImporter::ThreadRead()
+{
+    RenameThread("bitcoin-loadblk-read");
+
+    // This takes over file and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(file, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fStop)
+                break;
+            if (fRestart) {
+                fRestart = false;
+                fReaderDone = false;
+                if (blkdat.Seek(nRestartPos))
+                    nRewind = nRestartPos;
+            }
+        }
+
+        // Read up to the end of the file, then wait for a restart or the end of the import
+        if (fReaderDone || blkdat.eof()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            fReaderDone = true;
+            condJobs.notify_all();
+            condReader.wait(lock, [this] { return fStop || fRestart; });
+            continue;
+        }
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        uint64_t nHeaderPos;
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(messageStart[0]);
+            nHeaderPos = blkdat.GetPos();
+            nRewind = nHeaderPos + 1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            std::lock_guard<std::mutex> lock(mutex);
+            fReaderDone = true;
+            continue;
+        }
+
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->nHeaderPos = nHeaderPos;
+        job->nSize = nSize;
+        job->fDone = false;
+        try {
+            // read block
+            job->nPos = blkdat.GetPos();
+            job->vData.resize(nSize);
+            blkdat.read(job->vData.data(), nSize);
+            nRewind = blkdat.GetPos();
+        } catch (const std::exception& e) {
+            LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", e.what());
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condReader.wait(lock, [this] { return fStop || fRestart || (queueJobs.size() < MAX_IMPORT_QUEUE_BLOCKS && nQueuedBytes < MAX_IMPORT_QUEUE_BYTES); });
+        if (fStop || fRestart)
+            continue;
+        queueJobs.push_back(job);
+        queueTodo.push_back(job);
+        nQueuedBytes += nSize;
+        condJobs.notify_all();
+    }
+}
+
+void CBlockFileImporter::ThreadWork()
+{
+    RenameThread("bitcoin-loadblk-hash");
+
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condJobs.wait(lock, [this] { return fStop || !queueTodo.empty(); });
+            if (fStop)
+                break;
+            job = queueTodo.front();
+            queueTodo.pop_front();
+        }
+
+        // Deserializing computes the hashes of the transactions, which the
+        // merkle root check of the block is built from.
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        try {
+            CSpanReader blkdat(SER_DISK, CLIENT_VERSION, job->vData.data(), job->vData.data() + job->vData.size());
+            blkdat >> *pblock;
+            job->hash = pblock->GetHash();
+            job->pblock = pblock;
+        } catch (const std::exception& e) {
+            job->strError = e.what();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job->fDone = true;
+            std::vector<char>().swap(job->vData);
+        }
+        condJobs.notify_all();
+    }
+}
+
+bool CBlockFileImporter::Next(std::shared_ptr<CBlock>& pblock, uint256& hash, uint64_t& nPos)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condJobs.wait(lock, [this] {
+            return (!queueJobs.empty() && queueJobs.front()->fDone) || (queueJobs.empty() && fReaderDone && !fRestart);
+        });
+        if (queueJobs.empty())
+            return false;
+
+        std::shared_ptr<Job> job = queueJobs.front();
+        queueJobs.pop_front();
+        nQueuedBytes -= job->nSize;
+        condReader.notify_one();
+
+        if (job->pblock) {
+            pblock = job->pblock;
+            hash = job->hash;
+            nPos = job->nPos;
+            return true;
+        }
+
+        // The reader went past the bytes of the failed block; drop what it
+        // read since and have it scan again from one byte after the header.
+        LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", job->strError);
+        queueJobs.clear();
+        queueTodo.clear();
+        nQueuedBytes = 0;
+        nRestartPos = job->nHeaderPos + 1;
+        fRestart = true;
+        condReader.notify_one();
+    }
+}
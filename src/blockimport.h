@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include "protocol.h"
+#include "uint256.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CBlock;
+
+/** Blocks read ahead of the one being validated */
+static const size_t MAX_IMPORT_QUEUE_BLOCKS = 1000;
+/** Bytes of serialized blocks read ahead of the one being validated */
+static const size_t MAX_IMPORT_QUEUE_BYTES = 32 << 20;
+
+/**
+ * Reads the blocks of a block file for LoadExternalBlockFile in a pipeline.
+ * A reader thread goes through the file sequentially and picks out the
+ * serialized blocks, a few workers deserialize them, which hashes all their
+ * transactions, and compute the block hashes, while the caller takes the
+ * blocks in file order and validates them. That way disk reads, hashing and
+ * validation overlap during -reindex and -loadblock.
+ *
+ * The file is scanned as before: anything between blocks is skipped and a
+ * block that fails to deserialize is searched for another one starting one
+ * byte after its header.
+ */
+class CBlockFileImporter
+{
+public:
+    /** Takes over fileIn and closes it when done */
+    CBlockFileImporter(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStartIn, int nWorkers);
+    ~CBlockFileImporter();
+
+    /**
+     * Wait for the next block of the file. Sets the block, its hash and the
+     * position of its data in the file. Returns false at the end of the file.
+     */
+    bool Next(std::shared_ptr<CBlock>& pblock, uint256& hash, uint64_t& nPos);
+
+private:
+    struct Job {
+        uint64_t nHeaderPos;
+        uint64_t nPos;
+        size_t nSize;
+        std::vector<char> vData;
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        std::string strError;
+        bool fDone;
+    };
+
+    void ThreadRead();
+    void ThreadWork();
+
+    FILE* file;
+    CMessageHeader::MessageStartChars messageStart;
+
+    //! Guards everything below
+    std::mutex mutex;
+    //! Signalled when a job is queued or done, and when the reader stops
+    std::condition_variable condJobs;
+    //! Signalled when the queue has room again or the reader has to restart
+    std::condition_variable condReader;
+    //! Jobs in file order, waiting for the caller
+    std::deque<std::shared_ptr<Job> > queueJobs;
+    //! Jobs not yet taken by a worker
+    std::deque<std::shared_ptr<Job> > queueTodo;
+    size_t nQueuedBytes;
+    //! Where the reader has to continue after a failed block, if fRestart
+    uint64_t nRestartPos;
+    bool fRestart;
+    bool fReaderDone;
+    bool fStop;
+
+    std::thread threadRead;
+    std::vector<std::thread> vThreadWork;
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
@@ -214,39 +214,108 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
+/** Positions in a block, each holding the 2 bits of a position in its 4 pairs of integers */
+static const int ROLLING_BLOOM_BLOCK_BITS = 256;
+
+/**
+ * The false positive rate of the blocked rolling filter with fLoad items in
+ * each block on average, where they set nHashFuncs bits. The load of a block
+ * is Poisson distributed, and an item must be matched in both its blocks.
+ */
+static double RollingBloomFPRate(double fLoad, int nHashFuncs)
+{
+    double fRate = 0, fSpread = 10 * sqrt(fLoad) + 10;
+    for (int i = std::max(0, (int)(fLoad - fSpread)); i < fLoad + fSpread; i++) {
+        double fProbability = exp(i * log(fLoad) - fLoad - lgamma(i + 1.0));
+        fRate += fProbability * pow(1.0 - pow(1.0 - 1.0 / ROLLING_BLOOM_BLOCK_BITS, nHashFuncs * i), nHashFuncs);
+    }
+    return fRate * fRate;
+}
+
 CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
 {
-    double logFpRate = log(fpRate);
-    /* The optimal number of hash functions is log(fpRate) / log(0.5), but
-     * restrict it to the range 1-50. */
-    nHashFuncs = std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
     /* In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries. */
     nEntriesPerGeneration = (nElements + 1) / 2;
     uint32_t nMaxElements = nEntriesPerGeneration * 3;
-    /* The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
-     * =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits)
-     * =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs * nMaxElements / nFilterBits)
-     * =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs * nMaxElements / nFilterBits
-     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - pow(fpRate, 1.0 / nHashFuncs))
-     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
-     */
-    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
-    data.clear();
+    /* Take the fewest blocks that keep the false positive rate at fpRate when the filter is full,
+     * with the number of bits per block that allows it. Each of the items is in two blocks, so
+     * that is near half the optimal number of hash functions of a standard filter, and no fewer
+     * blocks than the bits of a standard filter take, which the search starts from. */
+    int nStandardFuncs = std::max(1, (int)round(log(fpRate) / log(0.5)));
+    uint32_t nMinBlocks = std::max(1, (int)(-1 / LN2SQUARED * nMaxElements * log(fpRate) / ROLLING_BLOOM_BLOCK_BITS));
+    nBlocks = 0;
+    nHashFuncs = 1;
+    for (int nFuncs = std::max(1, nStandardFuncs / 2 - 3); nFuncs <= std::min(25, nStandardFuncs / 2 + 3); nFuncs++) {
+        uint32_t nLow = nMinBlocks - 1, nHigh = nMinBlocks;
+        while (nHigh < (1U << 28) && RollingBloomFPRate(2.0 * nMaxElements / nHigh, nFuncs) > fpRate) {
+            nLow = nHigh;
+            nHigh *= 2;
+        }
+        while (nHigh - nLow > 1) {
+            uint32_t nMid = nLow + (nHigh - nLow) / 2;
+            if (RollingBloomFPRate(2.0 * nMaxElements / nMid, nFuncs) > fpRate)
+                nLow = nMid;
+            else
+                nHigh = nMid;
+        }
+        if (nBlocks == 0 || nHigh < nBlocks) {
+            nBlocks = nHigh;
+            nHashFuncs = nFuncs;
+        }
+    }
     /* For each data element we need to store 2 bits. If both bits are 0, the
      * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
      * treated as set in generation 1, 2, or 3 respectively.
-     * These bits are stored in separate integers: position P corresponds to bit
-     * (P & 63) of the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1]. */
-    data.resize(((nFilterBits + 63) / 64) << 1);
+     * These bits are stored in separate integers: position P of a block corresponds to
+     * bit (P & 63) of the integers block[(P >> 6) * 2] and block[(P >> 6) * 2 + 1]. */
+    data.resize((size_t)nBlocks * ROLLING_BLOOM_BLOCK_BITS / 32);
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const std::vector<unsigned char>& vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+/** The block of an item from the high bits of its hash */
+static inline uint32_t RollingBloomBlock(uint64_t nHash, uint32_t nBlocks)
+{
+    return ((nHash >> 32) * nBlocks) >> 32;
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+/** Odd multipliers of the hash, one per bit of an item in a block */
+static const uint64_t ROLLING_BLOOM_MULTIPLIERS[25] = {
+    0xf2a74de452e6b439ULL, 0x6513270e269e0d37ULL, 0x0c5c7fd0a6a3a451ULL,
+    0xd23f0824128b2f33ULL, 0x1818e811892f902bULL, 0x9531985d5d9dc9f9ULL,
+    0xe8e25d940ed90475ULL, 0x36f675cc81e74ef5ULL, 0x1600a35a099950d9ULL,
+    0x6b0d549b6f03675bULL, 0x3d9c172411e20b8fULL, 0x8d116ece1738f7d9ULL,
+    0x0f21ddb66cad4a27ULL, 0x90c192cfd3ac94afULL, 0xf28c105d1fb17c23ULL,
+    0xa170b33839263059ULL, 0x953f48f1a09f76b5ULL, 0x0fd630f1f29d0da9ULL,
+    0x95e60af593bd04cfULL, 0x0cb1e29c658cda15ULL, 0x3898d190f9ebdacdULL,
+    0x8e81973e0becd7b1ULL, 0x2217beaddbc496cbULL, 0x6b4cb2424a23d597ULL,
+    0x8a6a63ec24ede6a5ULL,
+};
+
+/**
+ * The bits of an item in its block, from the top byte of its hash times the
+ * multiplier of each. The products do not depend on each other, so the
+ * compiler can compute them in vector registers, unlike a hash per bit.
+ */
+static inline void RollingBloomMasks(uint64_t nHash, int nHashFuncs, uint64_t mask[4])
+{
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t nPos = (nHash * ROLLING_BLOOM_MULTIPLIERS[n]) >> 56;
+        mask[nPos >> 6] |= ((uint64_t)1) << (nPos & 63);
+    }
+}
+
+/** The hash of the second block of an item, mixed from that of the first (the finalizer of MurmurHash3) */
+static inline uint64_t RollingBloomRehash(uint64_t nHash)
+{
+    nHash ^= nHash >> 33;
+    nHash *= 0xff51afd7ed558ccdULL;
+    nHash ^= nHash >> 33;
+    nHash *= 0xc4ceb9fe1a85ec53ULL;
+    nHash ^= nHash >> 33;
+    return nHash;
+}
+
+void CRollingBloomFilter::Insert(uint64_t nHash)
 {
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
@@ -266,45 +335,62 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
     }
     nEntriesThisGeneration++;
 
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    uint64_t nGenerationMask1 = -(uint64_t)(nGeneration & 1);
+    uint64_t nGenerationMask2 = -(uint64_t)(nGeneration >> 1);
+    for (int nBlock = 0; nBlock < 2; nBlock++) {
+        uint64_t mask[4] = {0, 0, 0, 0};
+        RollingBloomMasks(nHash, nHashFuncs, mask);
+        uint64_t* block = &data[(size_t)RollingBloomBlock(nHash, nBlocks) * 8];
+        for (int w = 0; w < 4; w++) {
+            block[2 * w] = (block[2 * w] & ~mask[w]) | (mask[w] & nGenerationMask1);
+            block[2 * w + 1] = (block[2 * w + 1] & ~mask[w]) | (mask[w] & nGenerationMask2);
+        }
+        nHash = RollingBloomRehash(nHash);
     }
 }
 
+bool CRollingBloomFilter::Contains(uint64_t nHash) const
+{
+    for (int nBlock = 0; nBlock < 2; nBlock++) {
+        uint64_t mask[4] = {0, 0, 0, 0};
+        RollingBloomMasks(nHash, nHashFuncs, mask);
+        const uint64_t* block = &data[(size_t)RollingBloomBlock(nHash, nBlocks) * 8];
+        /* A bit unset in both integers of its pair means the filter does not contain the item */
+        for (int w = 0; w < 4; w++) {
+            if (((block[2 * w] | block[2 * w + 1]) & mask[w]) != mask[w]) {
+                return false;
+            }
+        }
+        nHash = RollingBloomRehash(nHash);
+    }
+    return true;
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    Insert(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    insert(vData);
+    // The same hash as of its bytes in a vector, without making one
+    Insert(SipHashUint256(k0, k1, hash));
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
-            return false;
-        }
-    }
-    return true;
+    return Contains(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    return contains(vData);
+    return Contains(SipHashUint256(k0, k1, hash));
 }
 
 void CRollingBloomFilter::reset()
 {
-    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
     nEntriesThisGeneration = 0;
     nGeneration = 1;
     for (std::vector<uint64_t>::iterator it = data.begin(); it != data.end(); it++) {
@@ -115,6 +115,11 @@ public:
  *
  * It needs around 1.8 bytes per element per factor 0.1 of false positive rate.
  * (More accurately: 3/(log(256)*log(2)) * log(1/fpRate) * nElements bytes)
+ *
+ * The filter is blocked: an item sets its bits in two blocks of 256, 64 bytes
+ * each, rather than in a cache line per hash function, and the positions all
+ * come from one SipHash of the item. That takes up to a sixth more memory for
+ * the same false positive rate, which the constructor sizes the blocks for.
  */
 class CRollingBloomFilter
 {
@@ -132,11 +137,17 @@ public:
     void reset();
 
 private:
+    void Insert(uint64_t nHash);
+    bool Contains(uint64_t nHash) const;
+
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
     int nGeneration;
+    //! Blocks of 4 pairs of the integers holding the 2 bits of each position
     std::vector<uint64_t> data;
-    unsigned int nTweak;
+    uint32_t nBlocks;
+    uint64_t k0, k1;
+    //! Bits set in each of the two blocks of an item
     int nHashFuncs;
 };
 
@@ -5,6 +5,7 @@
 
 #include "chain.h"
 #include "miner.h"
+#include "support/arena.h"
 
 /**
  * CChain implementation
@@ -118,6 +119,38 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+CBlockIndex* CBlockIndexArena::New()
+{
+    if (vChunks.empty() || nUsed == nEntriesPerChunk) {
+        if (vChunks.empty()) {
+            nChunkBytes = BlockIndexArena().ChunkSize(ENTRIES_PER_CHUNK * sizeof(CBlockIndex));
+            nEntriesPerChunk = nChunkBytes / sizeof(CBlockIndex);
+        }
+        vChunks.push_back(static_cast<CBlockIndex*>(BlockIndexArena().AllocateChunk(nChunkBytes)));
+        nUsed = 0;
+    }
+    return new (&vChunks.back()[nUsed++]) CBlockIndex();
+}
+
+CBlockIndex* CBlockIndexArena::New(const CBlockHeader& block)
+{
+    CBlockIndex* pindex = New();
+    *pindex = CBlockIndex(block);
+    return pindex;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nEntries = i + 1 == vChunks.size() ? nUsed : nEntriesPerChunk;
+        for (size_t j = 0; j < nEntries; j++)
+            vChunks[i][j].~CBlockIndex();
+        BlockIndexArena().FreeChunk(vChunks[i], nChunkBytes);
+    }
+    vChunks.clear();
+    nUsed = 0;
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     return 1;
@@ -6,12 +6,14 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
@@ -25,12 +27,33 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * The queued checks are spread over a number of shards, each with its own
+  * lock, so workers rarely contend with each other or with the master. A
+  * worker takes work from its own shard first and steals from the others
+  * when that runs dry. Only as many idle workers are woken as the added
+  * checks can keep busy, so small blocks do not wake every thread.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! One deque of queued checks
+    struct Shard {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
+
+    //! The shards the checks are spread over
+    std::vector<Shard> vShard;
+
+    //! Shard the next Add starts filling
+    std::atomic<unsigned int> nNextShard;
+
+    //! Shard the next worker calls home
+    std::atomic<unsigned int> nNextWorker;
+
+    //! Mutex to protect sleeping and waking up, the queued work is guarded by the shards
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,90 +62,102 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
+    //! The number of workers that are idle, guarded by mutex.
     int nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
-
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The number of checks in the shards that no worker took yet.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /** Move up to nBatchSize checks out of a shard, half of it at most so others can steal the rest. */
+    bool Take(Shard& shard, std::vector<T>& vChecks, bool fOwn)
+    {
+        boost::unique_lock<boost::mutex> lock(shard.mutex);
+        if (shard.queue.empty())
+            return false;
+        unsigned int nNow = std::max<unsigned int>(1, std::min<size_t>(nBatchSize, (shard.queue.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // The owner works from the back, thieves from the front of the shard.
+            T& check = fOwn ? shard.queue.back() : shard.queue.front();
+            vChecks[i].swap(check);
+            if (fOwn)
+                shard.queue.pop_back();
+            else
+                shard.queue.pop_front();
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
+    /** Take a batch from the home shard, or steal one from the other shards. */
+    bool Steal(unsigned int nHome, std::vector<T>& vChecks)
+    {
+        for (unsigned int i = 0; i < vShard.size(); i++) {
+            if (Take(vShard[(nHome + i) % vShard.size()], vChecks, i == 0))
+                return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        unsigned int nHome = fMaster ? 0 : nNextWorker++ % vShard.size();
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            if (nQueued == 0 || !Steal(nHome, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
+                if (fMaster) {
+                    // Wait until the workers finished the batches they took
+                    while (nQueued == 0 && nTodo != 0)
+                        condMaster.wait(lock);
+                    if (nQueued == 0) {
                         bool fRet = fAllOk;
                         // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
+                        fAllOk = true;
                         // return the current status
                         return fRet;
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                } else {
+                    while (nQueued == 0) {
+                        nIdle++;
+                        condWorker.wait(lock); // wait
+                        nIdle--;
+                    }
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
+
+            // Check whether we need to do work at all
+            bool fOk = fAllOk;
             // execute work
-            BOOST_FOREACH (T& check, vChecks)
+            for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            size_t nNow = vChecks.size();
+            // Destroy the checks before they count as done, their cleanup belongs to this verification.
             vChecks.clear();
+            if (!fOk)
+                fAllOk = false;
+            if ((nTodo -= nNow) == 0) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
@@ -131,7 +166,8 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : vShard(std::max(1U, std::min(64U, boost::thread::hardware_concurrency()))),
+        nNextShard(0), nNextWorker(1), nIdle(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -148,16 +184,32 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+
+        // Count the checks before they show up in the shards, so they can't complete early.
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        nQueued += vChecks.size();
+
+        // Deal the checks out in batch sized runs, one shard after the other.
+        size_t nRuns = (vChecks.size() + nBatchSize - 1) / nBatchSize;
+        unsigned int nShard = nNextShard.fetch_add(nRuns);
+        for (size_t nRun = 0; nRun < nRuns; nRun++) {
+            Shard& shard = vShard[(nShard + nRun) % vShard.size()];
+            boost::unique_lock<boost::mutex> lock(shard.mutex);
+            for (size_t i = nRun * nBatchSize; i < std::min(vChecks.size(), (nRun + 1) * nBatchSize); i++) {
+                shard.queue.push_back(T());
+                vChecks[i].swap(shard.queue.back());
+            }
+        }
+
+        // Wake one idle worker for every run of checks, the added work can't keep more busy.
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if ((int)nRuns >= nIdle)
             condWorker.notify_all();
+        else
+            for (size_t i = 0; i < nRuns; i++)
+                condWorker.notify_one();
     }
 
     ~CCheckQueue()
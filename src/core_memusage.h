@@ -8,6 +8,7 @@
 #include "primitives/transaction.h"
 #include "primitives/block.h"
 #include "memusage.h"
+#include "script/interpreter.h"
 
 static inline size_t RecursiveDynamicUsage(const CScript& script) {
     return memusage::DynamicUsage(*static_cast<const CScriptBase*>(&script));
@@ -34,7 +35,7 @@ static inline size_t RecursiveDynamicUsage(const CTransaction& tx) {
     for (std::vector<CTxIn>::const_iterator it = tx.vin.begin(); it != tx.vin.end(); it++) {
         mem += RecursiveDynamicUsage(*it);
     }
-    for (std::vector<CTxOut>::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++) {
+    for (CTxOutVector::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++) {
         mem += RecursiveDynamicUsage(*it);
     }
     return mem;
@@ -45,7 +46,7 @@ static inline size_t RecursiveDynamicUsage(const CMutableTransaction& tx) {
     for (std::vector<CTxIn>::const_iterator it = tx.vin.begin(); it != tx.vin.end(); it++) {
         mem += RecursiveDynamicUsage(*it);
     }
-    for (std::vector<CTxOut>::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++) {
+    for (CTxOutVector::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++) {
         mem += RecursiveDynamicUsage(*it);
     }
     return mem;
@@ -63,4 +64,8 @@ static inline size_t RecursiveDynamicUsage(const CBlockLocator& locator) {
     return memusage::DynamicUsage(locator.vHave);
 }
 
+static inline size_t RecursiveDynamicUsage(const PrecomputedTransactionData& txdata) {
+    return memusage::DynamicUsage(txdata.vLegacyPrefix) + memusage::DynamicUsage(txdata.vchLegacySuffix);
+}
+
 #endif // BITCOIN_CORE_MEMUSAGE_H
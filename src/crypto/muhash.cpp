@@ -0,0 +1,277 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <assert.h>
+#include <limits>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+const int LIMB_SIZE = Num3072::LIMB_SIZE;
+/** 2^3072 minus the prime */
+const limb_t MAX_PRIME_DIFF = 1103717;
+
+/** Extract the lowest limb of [c0,c1,c2] into n, and shift the number right by one limb */
+inline void extract3(limb_t& c0, limb_t& c1, limb_t& c2, limb_t& n)
+{
+    n = c0;
+    c0 = c1;
+    c1 = c2;
+    c2 = 0;
+}
+
+/** [c0,c1] = a * b */
+inline void mul(limb_t& c0, limb_t& c1, const limb_t& a, const limb_t& b)
+{
+    double_limb_t t = (double_limb_t)a * b;
+    c1 = t >> LIMB_SIZE;
+    c0 = t;
+}
+
+/** [c0,c1,c2] += n * [d0,d1,d2], c2 being 0 on entry */
+inline void mulnadd3(limb_t& c0, limb_t& c1, limb_t& c2, const limb_t& d0, const limb_t& d1, const limb_t& d2, const limb_t& n)
+{
+    double_limb_t t = (double_limb_t)d0 * n + c0;
+    c0 = t;
+    t >>= LIMB_SIZE;
+    t += (double_limb_t)d1 * n + c1;
+    c1 = t;
+    t >>= LIMB_SIZE;
+    c2 = t + d2 * n;
+}
+
+/** [c0,c1] *= n */
+inline void muln2(limb_t& c0, limb_t& c1, const limb_t& n)
+{
+    double_limb_t t = (double_limb_t)c0 * n;
+    c0 = t;
+    t >>= LIMB_SIZE;
+    t += (double_limb_t)c1 * n;
+    c1 = t;
+}
+
+/** [c0,c1,c2] += a * b */
+inline void muladd3(limb_t& c0, limb_t& c1, limb_t& c2, const limb_t& a, const limb_t& b)
+{
+    double_limb_t t = (double_limb_t)a * b;
+    limb_t th = t >> LIMB_SIZE;
+    limb_t tl = t;
+    c0 += tl;
+    th += (c0 < tl) ? 1 : 0;
+    c1 += th;
+    c2 += (c1 < th) ? 1 : 0;
+}
+
+/** [c0,c1] += a, then extract the lowest limb into n and shift the number right by one limb */
+inline void addnextract2(limb_t& c0, limb_t& c1, const limb_t& a, limb_t& n)
+{
+    limb_t c2 = 0;
+    c0 += a;
+    if (c0 < a) {
+        c1 += 1;
+        if (c1 == 0)
+            c2 = 1;
+    }
+    n = c0;
+    c0 = c1;
+    c1 = c2;
+}
+
+/** a^(2^k - 1), building the run of ones of the exponent from the leading bits of k */
+Num3072 PowOnes(const Num3072& a, int k)
+{
+    int nBit = 30;
+    while (!((k >> nBit) & 1))
+        nBit--;
+    Num3072 x = a;
+    int n = 1;
+    while (--nBit >= 0) {
+        Num3072 y = x;
+        for (int i = 0; i < n; i++)
+            y.Multiply(y);
+        y.Multiply(x);
+        x = y;
+        n *= 2;
+        if ((k >> nBit) & 1) {
+            x.Multiply(x);
+            x.Multiply(a);
+            n++;
+        }
+    }
+    return x;
+}
+
+/** The number of an element: its SHA-256 expanded to 3072 bits with SHA-512 in counter mode */
+Num3072 ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(hash, sizeof(hash)).Write(&i, 1).Finalize(expanded + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(expanded);
+}
+
+} // namespace
+
+Num3072::Num3072()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++) {
+#ifdef __SIZEOF_INT128__
+        limbs[i] = ReadLE64(data + 8 * i);
+#else
+        limbs[i] = ReadLE32(data + 4 * i);
+#endif
+    }
+}
+
+/** Whether the value is the prime or above, which only the top 1103717 values of 3072 bits are */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != std::numeric_limits<limb_t>::max())
+            return false;
+    }
+    return true;
+}
+
+/** Subtract the prime, as adding 2^3072 minus the prime and dropping the carry */
+void Num3072::FullReduce()
+{
+    limb_t c0 = MAX_PRIME_DIFF;
+    limb_t c1 = 0;
+    for (int i = 0; i < LIMBS; i++)
+        addnextract2(c0, c1, limbs[i], limbs[i]);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    limb_t c0 = 0, c1 = 0, c2 = 0;
+    Num3072 tmp;
+
+    // Limbs 0 to N-2 of the product, each with limb N+j of it folded in:
+    // 2^3072 is MAX_PRIME_DIFF modulo the prime
+    for (int j = 0; j < LIMBS - 1; j++) {
+        limb_t d0 = 0, d1 = 0, d2 = 0;
+        mul(d0, d1, limbs[1 + j], a.limbs[LIMBS + j - (1 + j)]);
+        for (int i = 2 + j; i < LIMBS; i++)
+            muladd3(d0, d1, d2, limbs[i], a.limbs[LIMBS + j - i]);
+        mulnadd3(c0, c1, c2, d0, d1, d2, MAX_PRIME_DIFF);
+        for (int i = 0; i < j + 1; i++)
+            muladd3(c0, c1, c2, limbs[i], a.limbs[j - i]);
+        extract3(c0, c1, c2, tmp.limbs[j]);
+    }
+
+    // Limb N-1, which has nothing to fold
+    assert(c2 == 0);
+    for (int i = 0; i < LIMBS; i++)
+        muladd3(c0, c1, c2, limbs[i], a.limbs[LIMBS - 1 - i]);
+    extract3(c0, c1, c2, tmp.limbs[LIMBS - 1]);
+
+    // Fold what is left above 3072 bits back in
+    muln2(c0, c1, MAX_PRIME_DIFF);
+    for (int j = 0; j < LIMBS; j++)
+        addnextract2(c0, c1, tmp.limbs[j], limbs[j]);
+
+    assert(c1 == 0);
+    assert(c0 == 0 || c0 == 1);
+
+    // At most two more subtractions of the prime: one for a carry out of
+    // 3072 bits, one for a value between the prime and 2^3072
+    if (IsOverflow())
+        FullReduce();
+    if (c0)
+        FullReduce();
+}
+
+/** a^(p - 2), where p - 2 is 3051 one bits followed by the 21 bits of 993433 */
+Num3072 Num3072::GetInverse() const
+{
+    Num3072 x = PowOnes(*this, 3051);
+    for (int i = 0; i < 21; i++)
+        x.Multiply(x);
+
+    Num3072 low;
+    for (int nBit = 20; nBit >= 0; nBit--) {
+        low.Multiply(low);
+        if ((993433 >> nBit) & 1)
+            low.Multiply(*this);
+    }
+    x.Multiply(low);
+    return x;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    Num3072 x = *this;
+    if (x.IsOverflow())
+        x.FullReduce();
+    for (int i = 0; i < LIMBS; i++) {
+#ifdef __SIZEOF_INT128__
+        WriteLE64(out + 8 * i, x.limbs[i]);
+#else
+        WriteLE32(out + 4 * i, x.limbs[i]);
+#endif
+    }
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : numerator(ToNum3072(data, len))
+{
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& other)
+{
+    numerator.Multiply(other.numerator);
+    denominator.Multiply(other.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& other)
+{
+    numerator.Multiply(other.denominator);
+    denominator.Multiply(other.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[OUTPUT_SIZE]) const
+{
+    Num3072 num = numerator;
+    num.Divide(denominator);
+    unsigned char data[Num3072::BYTE_SIZE];
+    num.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
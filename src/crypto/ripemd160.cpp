@@ -2,12 +2,30 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "crypto/ripemd160.h"
 
 #include "crypto/common.h"
 
 #include <string.h>
 
+#if defined(ENABLE_SSE41)
+namespace ripemd160_sse41
+{
+void Transform32_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace ripemd160_avx2
+{
+void Transform32_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -235,8 +253,43 @@ void Transform(uint32_t* s, const unsigned char* chunk)
 
 } // namespace ripemd160
 
+typedef void (*Transform32Type)(unsigned char*, const unsigned char*);
+
+Transform32Type Transform32_4way = nullptr;
+Transform32Type Transform32_8way = nullptr;
+
 } // namespace
 
+void RIPEMD160SetMultiWay(bool f4way, bool f8way)
+{
+    Transform32_4way = nullptr;
+    Transform32_8way = nullptr;
+#if defined(ENABLE_SSE41)
+    if (f4way)
+        Transform32_4way = ripemd160_sse41::Transform32_4way;
+#endif
+#if defined(ENABLE_AVX2)
+    if (f8way)
+        Transform32_8way = ripemd160_avx2::Transform32_8way;
+#endif
+    (void)f4way;
+    (void)f8way;
+}
+
+void RIPEMD160_32(unsigned char* out, const unsigned char* in, size_t count)
+{
+    if (Transform32_8way) {
+        for (; count >= 8; count -= 8, in += 256, out += 160)
+            Transform32_8way(out, in);
+    }
+    if (Transform32_4way) {
+        for (; count >= 4; count -= 4, in += 128, out += 80)
+            Transform32_4way(out, in);
+    }
+    for (; count; --count, in += 32, out += 20)
+        CRIPEMD160().Write(in, 32).Finalize(out);
+}
+
 ////// RIPEMD160
 
 CRIPEMD160::CRIPEMD160() : bytes(0)
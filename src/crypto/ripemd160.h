@@ -25,4 +25,15 @@ public:
     CRIPEMD160& Reset();
 };
 
+/** Compute the RIPEMD-160's of count 32-byte blobs, the second step of Hash160.
+ *  output:  pointer to a count*20 byte output buffer
+ *  input:   pointer to a count*32 byte input buffer
+ *  The blobs are hashed 8 or 4 at a time by the multi-way implementations.
+ */
+void RIPEMD160_32(unsigned char* output, const unsigned char* input, size_t count);
+
+/** Enable the 4-way and 8-way implementations of RIPEMD160_32. Called by
+ *  SHA256AutoDetect, which checks that the CPU has the instructions. */
+void RIPEMD160SetMultiWay(bool f4way, bool f8way);
+
 #endif // BITCOIN_CRYPTO_RIPEMD160_H
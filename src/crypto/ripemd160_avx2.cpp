@@ -0,0 +1,133 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation unit for the 8-way AVX2 RIPEMD-160 of 32-byte
+// blobs, the second step of Hash160, compiled with -mavx -mavx2 and only called
+// after a CPUID check.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace ripemd160_avx2 {
+namespace {
+
+const int RL[80] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8,
+    3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12,
+    1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2,
+    4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13,
+};
+const int RR[80] = {
+    5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12,
+    6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2,
+    15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13,
+    8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14,
+    12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11,
+};
+const int SL[80] = {
+    11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8,
+    7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12,
+    11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5,
+    11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12,
+    9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6,
+};
+const int SR[80] = {
+    8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6,
+    9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11,
+    9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5,
+    15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8,
+    8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11,
+};
+const uint32_t KL[5] = {0, 0x5A827999ul, 0x6ED9EBA1ul, 0x8F1BBCDCul, 0xA953FD4Eul};
+const uint32_t KR[5] = {0x50A28BE6ul, 0x5C4DD124ul, 0x6D703EF3ul, 0x7A6D76E9ul, 0};
+const uint32_t INIT[5] = {0x67452301ul, 0xEFCDAB89ul, 0x98BADCFEul, 0x10325476ul, 0xC3D2E1F0ul};
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+//! ~x & y
+__m256i inline AndNot(__m256i x, __m256i y) { return _mm256_andnot_si256(x, y); }
+__m256i inline Not(__m256i x) { return Xor(x, _mm256_set1_epi32(-1)); }
+__m256i inline Rol(__m256i x, int n) { return Or(_mm256_sll_epi32(x, _mm_cvtsi32_si128(n)), _mm256_srl_epi32(x, _mm_cvtsi32_si128(32 - n))); }
+
+__m256i inline f1(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline f2(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), AndNot(x, z)); }
+__m256i inline f3(__m256i x, __m256i y, __m256i z) { return Xor(Or(x, Not(y)), z); }
+__m256i inline f4(__m256i x, __m256i y, __m256i z) { return Or(And(x, z), AndNot(z, y)); }
+__m256i inline f5(__m256i x, __m256i y, __m256i z) { return Xor(x, Or(y, Not(z))); }
+
+/** The function of round j of the left line; the right line takes them in the reverse order. */
+__m256i inline F(int j, __m256i x, __m256i y, __m256i z)
+{
+    switch (j >> 4) {
+    case 0: return f1(x, y, z);
+    case 1: return f2(x, y, z);
+    case 2: return f3(x, y, z);
+    case 3: return f4(x, y, z);
+    default: return f5(x, y, z);
+    }
+}
+
+/** Run one RIPEMD-160 transformation on 8 independent states, w holds the 16 message words. */
+void inline Transform(__m256i* s, const __m256i* w)
+{
+    __m256i a1 = s[0], b1 = s[1], c1 = s[2], d1 = s[3], e1 = s[4];
+    __m256i a2 = a1, b2 = b1, c2 = c1, d2 = d1, e2 = e1;
+    for (int j = 0; j < 80; j++) {
+        __m256i t = Add(Rol(Add(Add(a1, F(j, b1, c1, d1)), Add(w[RL[j]], _mm256_set1_epi32(KL[j >> 4]))), SL[j]), e1);
+        a1 = e1;
+        e1 = d1;
+        d1 = Rol(c1, 10);
+        c1 = b1;
+        b1 = t;
+        t = Add(Rol(Add(Add(a2, F(79 - j, b2, c2, d2)), Add(w[RR[j]], _mm256_set1_epi32(KR[j >> 4]))), SR[j]), e2);
+        a2 = e2;
+        e2 = d2;
+        d2 = Rol(c2, 10);
+        c2 = b2;
+        b2 = t;
+    }
+    __m256i t = s[0];
+    s[0] = Add(Add(s[1], c1), d2);
+    s[1] = Add(Add(s[2], d1), e2);
+    s[2] = Add(Add(s[3], e1), a2);
+    s[3] = Add(Add(s[4], a1), b2);
+    s[4] = Add(Add(t, b1), c2);
+}
+
+} // namespace
+
+void Transform32_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[5], w[16];
+
+    // A single block: the 32-byte blobs with the padding of a 32-byte message.
+    for (int i = 0; i < 5; i++)
+        s[i] = _mm256_set1_epi32(INIT[i]);
+    for (int i = 0; i < 8; i++)
+        w[i] = _mm256_set_epi32(ReadLE32(in + 224 + 4 * i), ReadLE32(in + 192 + 4 * i), ReadLE32(in + 160 + 4 * i), ReadLE32(in + 128 + 4 * i),
+                                ReadLE32(in + 96 + 4 * i), ReadLE32(in + 64 + 4 * i), ReadLE32(in + 32 + 4 * i), ReadLE32(in + 4 * i));
+    w[8] = _mm256_set1_epi32(0x80);
+    for (int i = 9; i < 16; i++)
+        w[i] = _mm256_setzero_si256();
+    w[14] = _mm256_set1_epi32(0x100);
+    Transform(s, w);
+
+    for (int i = 0; i < 5; i++) {
+        uint32_t v[8];
+        _mm256_storeu_si256((__m256i*)v, s[i]);
+        for (int j = 0; j < 8; j++)
+            WriteLE32(out + 20 * j + 4 * i, v[j]);
+    }
+}
+
+} // namespace ripemd160_avx2
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,37 @@ public:
     CSHA256& Reset();
 };
 
+namespace sha256_implementation {
+enum UseImplementation : uint8_t {
+    STANDARD = 0,
+    USE_SSE4 = 1 << 0,
+    USE_AVX2 = 1 << 1,
+    USE_SHANI = 1 << 2,
+    USE_ARMV8 = 1 << 3,
+    USE_ALL = USE_SSE4 | USE_AVX2 | USE_SHANI | USE_ARMV8,
+};
+}
+
+/** Autodetect the best available SHA256 implementation, restricted to the
+ *  ones enabled in use_implementation. Returns the name of the implementation.
+ *  The multi-way RIPEMD-160 of Hash160, which needs the same instructions as
+ *  the multi-way SHA256, is enabled along with it.
+ */
+std::string SHA256AutoDetect(sha256_implementation::UseImplementation use_implementation = sha256_implementation::USE_ALL);
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ *  The output may overlap the input as long as it does not start after it.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute the SHA256's of count messages of the same length, such as public keys.
+ *  output:  pointer to a count*32 byte output buffer
+ *  inputs:  pointers to the count messages of len bytes each
+ *  The messages are hashed 8 or 4 at a time by the multi-way implementations.
+ */
+void SHA256Multi(unsigned char* output, const unsigned char* const* inputs, size_t len, size_t count);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation unit for the 4-way SSE4.1 double SHA-256 of 64-byte
+// blobs and SHA-256 of four messages of the same length, compiled with
+// -msse4.1 and only called after a CPUID check.
+
+#ifdef ENABLE_SSE41
+
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256d64_sse41 {
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul,
+};
+
+__m128i inline Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+__m128i inline Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+__m128i inline Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+__m128i inline And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+__m128i inline Ror(__m128i x, int n) { return Or(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n)); }
+
+__m128i inline Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+__m128i inline Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m128i inline Sigma0(__m128i x) { return Xor(Xor(Ror(x, 2), Ror(x, 13)), Ror(x, 22)); }
+__m128i inline Sigma1(__m128i x) { return Xor(Xor(Ror(x, 6), Ror(x, 11)), Ror(x, 25)); }
+__m128i inline sigma0(__m128i x) { return Xor(Xor(Ror(x, 7), Ror(x, 18)), _mm_srli_epi32(x, 3)); }
+__m128i inline sigma1(__m128i x) { return Xor(Xor(Ror(x, 17), Ror(x, 19)), _mm_srli_epi32(x, 10)); }
+
+/** Run one SHA-256 transformation on four independent states, w holds the 16 message words. */
+void inline Transform(__m128i* s, __m128i* w)
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = Add(Add(w[i & 15], sigma1(w[(i + 14) & 15])), Add(w[(i + 9) & 15], sigma0(w[(i + 1) & 15])));
+        __m128i t1 = Add(Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), _mm_set1_epi32(K[i]))), w[i & 15]);
+        __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], w[16];
+
+    // First transform, the 64-byte blobs themselves.
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm_set1_epi32(INIT[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+    Transform(s, w);
+
+    // Second transform, the padding of a 64-byte message.
+    w[0] = _mm_set1_epi32(0x80000000ul);
+    for (int i = 1; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(0x200);
+    Transform(s, w);
+
+    // Third transform, the 32-byte intermediate hashes with their padding.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = _mm_set1_epi32(INIT[i]);
+    }
+    w[8] = _mm_set1_epi32(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(0x100);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, _mm_extract_epi32(s[i], 0));
+        WriteBE32(out + 32 + 4 * i, _mm_extract_epi32(s[i], 1));
+        WriteBE32(out + 64 + 4 * i, _mm_extract_epi32(s[i], 2));
+        WriteBE32(out + 96 + 4 * i, _mm_extract_epi32(s[i], 3));
+    }
+}
+
+void TransformMulti_4way(uint32_t* s, const unsigned char* const* chunks, size_t blocks)
+{
+    __m128i v[8], w[16];
+
+    // The state of lane j is s[8 * j] to s[8 * j + 7]
+    for (int i = 0; i < 8; i++)
+        v[i] = _mm_set_epi32(s[24 + i], s[16 + i], s[8 + i], s[i]);
+    for (size_t o = 0; o < 64 * blocks; o += 64) {
+        for (int i = 0; i < 16; i++)
+            w[i] = _mm_set_epi32(ReadBE32(chunks[3] + o + 4 * i), ReadBE32(chunks[2] + o + 4 * i), ReadBE32(chunks[1] + o + 4 * i), ReadBE32(chunks[0] + o + 4 * i));
+        Transform(v, w);
+    }
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm_extract_epi32(v[i], 0);
+        s[8 + i] = _mm_extract_epi32(v[i], 1);
+        s[16 + i] = _mm_extract_epi32(v[i], 2);
+        s[24 + i] = _mm_extract_epi32(v[i], 3);
+    }
+}
+
+} // namespace sha256d64_sse41
+
+#endif
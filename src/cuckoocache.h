@@ -203,6 +203,11 @@ private:
      * Should be set to log2(n)*/
     uint8_t depth_limit;
 
+    /** evicted counts the elements dropped before being erased, either aged
+     * out by epoch_check or pushed out by an insert that ran out of depth.
+     */
+    uint64_t evicted;
+
     /** hash_function is a const instance of the hash function. It cannot be
      * static or initialized at call time as it may have internal state (such as
      * a nonce).
@@ -281,8 +286,10 @@ private:
             for (uint32_t i = 0; i < size; ++i)
                 if (epoch_flags[i])
                     epoch_flags[i] = false;
-                else
+                else {
+                    evicted += !collection_flags.bit_is_set(i);
                     allow_erase(i);
+                }
             epoch_heuristic_counter = epoch_size;
         } else
             // reset the epoch_heuristic_counter to next do a scan when worst
@@ -300,7 +307,7 @@ public:
      * call to setup or setup_bytes, otherwise operations may segfault.
      */
     cache() : table(), size(), collection_flags(0), epoch_flags(),
-    epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    epoch_heuristic_counter(), epoch_size(), depth_limit(0), evicted(0), hash_function()
     {
     }
 
@@ -413,6 +420,16 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        ++evicted;
+    }
+
+    /** evictions returns the number of elements dropped from the cache
+     * without having been erased, which hints at an undersized cache.
+     * Threadsafe without any concurrent insert.
+     */
+    inline uint64_t evictions() const
+    {
+        return evicted;
     }
 
     /* contains iterates through the hash locations for a given element
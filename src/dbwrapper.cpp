@@ -6,23 +6,85 @@
 
 #include "util.h"
 #include "random.h"
+#include "utilstrencodings.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
+#include <limits>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool CDBOptions::FromProfile(const std::string& strProfile, CDBOptions& options)
+{
+    options = CDBOptions();
+    if (strProfile == "default") {
+        return true;
+    }
+    if (strProfile == "index") {
+        options.fCompression = true;
+        options.nMaxOpenFiles = 256;
+        options.nBlockSize = 16 * 1024;
+        return true;
+    }
+    return false;
+}
+
+bool CDBOptions::ParseOptions(const std::string& strOptions, CDBOptions& options, std::string& strError)
+{
+    std::vector<std::string> vOptions;
+    boost::split(vOptions, strOptions, boost::is_any_of(";"));
+    for (const std::string& strOption : vOptions) {
+        if (strOption.empty())
+            continue;
+        size_t nPos = strOption.find('=');
+        std::string strName = strOption.substr(0, nPos);
+        std::string strValue = nPos == std::string::npos ? "" : strOption.substr(nPos + 1);
+        if (strName == "compression") {
+            if (strValue == "kNoCompression") {
+                options.fCompression = false;
+            } else if (strValue == "kSnappyCompression") {
+                options.fCompression = true;
+            } else {
+                strError = strprintf("unknown compression '%s'", strValue);
+                return false;
+            }
+            continue;
+        }
+
+        int64_t nValue;
+        if (strName != "max_open_files" && strName != "block_size" && strName != "bloom_bits" && strName != "write_buffer_size") {
+            strError = strprintf("unknown or unsupported option '%s'", strName);
+            return false;
+        }
+        if (!ParseInt64(strValue, &nValue) || nValue < (strName == "bloom_bits" ? 0 : 1) || nValue > std::numeric_limits<int32_t>::max()) {
+            strError = strprintf("invalid value '%s' for %s", strValue, strName);
+            return false;
+        }
+        if (strName == "max_open_files")
+            options.nMaxOpenFiles = nValue;
+        else if (strName == "block_size")
+            options.nBlockSize = nValue;
+        else if (strName == "bloom_bits")
+            options.nBloomBits = nValue;
+        else
+            options.nWriteBufferSize = nValue;
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbOptions)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.write_buffer_size = dbOptions.nWriteBufferSize > 0 ? dbOptions.nWriteBufferSize : nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : NULL;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
+    options.block_size = dbOptions.nBlockSize;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -31,14 +93,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dbOptions)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -115,6 +177,11 @@ std::vector<unsigned char> CDBWrapper::CreateObfuscateKey() const
 
 }
 
+void CDBWrapper::CompactFull() const
+{
+    pdb->CompactRange(NULL, NULL);
+}
+
 bool CDBWrapper::IsEmpty()
 {
     std::unique_ptr<CDBIterator> it(NewIterator());
@@ -125,7 +192,9 @@ bool CDBWrapper::IsEmpty()
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
+void CDBIterator::SeekToLast() { piter->SeekToLast(); }
 void CDBIterator::Next() { piter->Next(); }
+void CDBIterator::Prev() { piter->Prev(); }
 
 namespace dbwrapper_private {
 
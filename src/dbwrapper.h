@@ -26,6 +26,41 @@ public:
     dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/** LevelDB tuning of a single database, see CDBWrapper */
+struct CDBOptions
+{
+    //! Compress table blocks with snappy. Without snappy support LevelDB stores them uncompressed.
+    bool fCompression;
+    //! Number of table files LevelDB keeps open
+    int nMaxOpenFiles;
+    //! Approximate size of the uncompressed data in a table block
+    size_t nBlockSize;
+    //! Bits per key of the bloom filter, 0 for none. It only speeds up point reads, never seeks.
+    int nBloomBits;
+    //! Size of the memtable, 0 for a quarter of the cache. Larger ones flush fewer, larger level-0 files, which stalls writes less often.
+    size_t nWriteBufferSize;
+
+    CDBOptions() : fCompression(false), nMaxOpenFiles(64), nBlockSize(4096), nBloomBits(10), nWriteBufferSize(0) {}
+
+    /**
+     * Look up a named profile:
+     * - "default": small blocks and few open files, for the chainstate's point reads.
+     * - "index": compressed 16 KiB blocks and more open files, for large
+     *   databases that are mostly scanned, like the block index with the
+     *   transaction and address indexes.
+     */
+    static bool FromProfile(const std::string& strProfile, CDBOptions& options);
+
+    /**
+     * Apply an option string on top of the options, in the name=value;name=value
+     * form RocksDB reads. The names LevelDB has an equivalent for are taken:
+     * compression (kNoCompression or kSnappyCompression), max_open_files,
+     * block_size, bloom_bits and write_buffer_size. Anything else, like
+     * RocksDB's compaction threading, is refused with strError set.
+     */
+    static bool ParseOptions(const std::string& strOptions, CDBOptions& options, std::string& strError);
+};
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -56,11 +91,19 @@ private:
     CDataStream ssKey;
     CDataStream ssValue;
 
+    size_t size_estimate;
+
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), size_estimate(0) { };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -75,6 +118,14 @@ public:
         leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
         ssKey.clear();
         ssValue.clear();
     }
@@ -87,8 +138,16 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
         ssKey.clear();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
@@ -110,6 +169,7 @@ public:
     bool Valid();
 
     void SeekToFirst();
+    void SeekToLast();
 
     template<typename K> void Seek(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -120,6 +180,7 @@ public:
     }
 
     void Next();
+    void Prev();
 
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
@@ -198,8 +259,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbOptions   LevelDB tuning of this database.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -286,6 +348,27 @@ public:
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    /** Compact the range of keys from key_begin to key_end, e.g. after erasing it */
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(ssKey1.data(), ssKey1.size());
+        leveldb::Slice slKey2(ssKey2.data(), ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
+
+    /**
+     * Compact the whole database. Every table is written anew, with the
+     * compression and block size it is now opened with, so this also carries
+     * an existing database over to changed options.
+     */
+    void CompactFull() const;
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -0,0 +1,427 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dposdata.h"
+
+#include "crypto/common.h"
+#include "script/script.h"
+
+#include <algorithm>
+#include <string.h>
+
+std::vector<unsigned char> StructToData(const CRegisterForgerData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.name);
+  
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CVoteForgerData& data)
+{
+    CScript script(data.opcode);
+    script << (uint8_t)data.forgers.size();
+    for(auto& i : data.forgers) {
+        script << ToByteVector(i);
+    }
+  
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CCancelVoteForgerData& data)
+{
+    CScript script(data.opcode);
+    script << (uint8_t)data.forgers.size();
+    for(auto& i : data.forgers) {
+        script << ToByteVector(i);
+    }
+  
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CRegisterCommitteeData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.name) << ToByteVector(data.url);
+  
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CVoteCommitteeData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.committee);
+
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CCancelVoteCommitteeData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.committee);
+
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CSubmitBillData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.title) << ToByteVector(data.detail) << ToByteVector(data.url) << ToByteVector(std::to_string(data.endtime)) << (uint8_t)data.options.size();
+    for(auto& it : data.options) {
+        script << ToByteVector(it);
+    }
+
+    return ToByteVector(script);
+}
+
+std::vector<unsigned char> StructToData(const CVoteBillData& data)
+{
+    CScript script(data.opcode);
+    script << ToByteVector(data.id.GetHex()) << (uint8_t)data.index;
+
+    return ToByteVector(script);
+}
+
+std::string CheckStruct(const CRegisterForgerData& data)
+{
+    std::string ret;
+    if(data.name.size() == 0) {
+        ret = "name is empty";
+    } else if(data.name.length() > 128) {
+        ret = "name length greater than 32 bytes";
+    }
+    return ret;
+}
+
+std::string CheckStruct(const CVoteForgerData& data)
+{
+    std::string ret;
+    if(data.forgers.empty()) {
+        ret = "forger is empty";
+    }
+
+    return ret;
+}
+
+std::string CheckStruct(const CCancelVoteForgerData& data)
+{
+    std::string ret;
+    if(data.forgers.empty()) {
+        ret = "forger is empty";
+    }
+
+    return ret;
+}
+
+std::string CheckStruct(const CSubmitBillData& data)
+{
+    std::string ret;
+    if(data.title.empty()) {
+        ret = "bill title is empty";
+    } else if(data.title.length() > 128) {
+        ret = "bill title length greater than 128 bytes";
+    } else if(data.detail.length() > 256) {
+        ret = "bill detail length greater than 256 bytes";
+    } else if(data.url.empty()) {
+        ret = "bill url is empty";
+    } else if(data.url.length() > 256) {
+        ret = "bill url length greater than 256 bytes";
+    } else if(data.options.size() < 2) {
+        ret = "bill options number less than 2";
+    } else if(data.options.size() > 16) {
+        ret = "bill options number greater than 16";
+    } else {
+        for(auto& i : data.options) {
+            if(i.size() == 0) {
+                ret = "bill option content is empty";
+                break;
+            } else if(i.size() > 256) {
+                ret = "bill option content length greater than 256 bytes";
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+std::string CheckStruct(const CVoteBillData& data)
+{
+    std::string ret;
+    return ret;
+}
+
+std::string CheckStruct(const CRegisterCommitteeData& data)
+{
+    std::string ret;
+    if(data.name.length() == 0) {
+        ret = "Register Committee name is empty";
+    } else if(data.name.length() > 32) {
+        ret = "Register Committee name length larger than 32 bytes";
+    } else if(data.url.length() > 256) {
+        ret = "Register Committee url length larger than 32 bytes";
+    }
+
+    return ret;
+}
+
+std::string CheckStruct(const CVoteCommitteeData& data)
+{
+    std::string ret;
+    return ret;
+}
+
+std::string CheckStruct(const CCancelVoteCommitteeData& data)
+{
+    std::string ret;
+    return ret;
+}
+
+bool DataToStruct(CRegisterForgerData& data, const CScript& script)
+{
+    bool ret = false;
+
+    auto iter = script.begin();
+    data.opcode = *iter++;
+
+    opcodetype opcode;
+    std::vector<unsigned char> vchRet;
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.name = std::string(vchRet.begin(), vchRet.end());
+
+    if(CheckStruct(data).empty()) {
+        ret = true;
+    }
+    return ret;
+}
+
+CDPoSKeys::CDPoSKeys(std::initializer_list<CKeyID> keys) : nKeys(0)
+{
+    for(const CKeyID& key : keys)
+        Insert(key);
+}
+
+CDPoSKeys::CDPoSKeys(const std::set<CKeyID>& keys) : nKeys(0)
+{
+    for(const CKeyID& key : keys)
+        Insert(key);
+}
+
+bool CDPoSKeys::Insert(const CKeyID& key)
+{
+    CKeyID* it = std::lower_bound(vKeys, vKeys + nKeys, key);
+    if((it != vKeys + nKeys && *it == key) || nKeys == MAX_DPOS_OP_KEYS)
+        return false;
+    std::copy_backward(it, vKeys + nKeys, vKeys + nKeys + 1);
+    *it = key;
+    nKeys++;
+    return true;
+}
+
+bool CDPoSOpReader::ReadByte(uint8_t& n)
+{
+    if(pc >= pend)
+        return false;
+    n = *pc++;
+    return true;
+}
+
+bool CDPoSOpReader::ReadPush(const unsigned char*& pdata, size_t& nSize)
+{
+    nSize = 0;
+    if(pc >= pend)
+        return false;
+
+    unsigned int opcode = *pc++;
+    if(opcode <= OP_PUSHDATA4) {
+        if(opcode < OP_PUSHDATA1) {
+            nSize = opcode;
+        } else if(opcode == OP_PUSHDATA1) {
+            if(pend - pc < 1)
+                return false;
+            nSize = *pc++;
+        } else if(opcode == OP_PUSHDATA2) {
+            if(pend - pc < 2)
+                return false;
+            nSize = ReadLE16(pc);
+            pc += 2;
+        } else {
+            if(pend - pc < 4)
+                return false;
+            nSize = ReadLE32(pc);
+            pc += 4;
+        }
+        if((size_t)(pend - pc) < nSize)
+            return false;
+    }
+    pdata = pc;
+    pc += nSize;
+    return true;
+}
+
+bool ParseDPoSKeys(CDPoSKeys& keys, const unsigned char* pbegin, const unsigned char* pend)
+{
+    CDPoSOpReader reader(pbegin, pend);
+    uint8_t opcode;
+    uint8_t nNumForger;
+    if(!reader.ReadByte(opcode) || !reader.ReadByte(nNumForger))
+        return false;
+
+    const unsigned char* pdata;
+    size_t nSize;
+    for(auto i = 0; i < nNumForger; ++i) {
+        if(!reader.ReadPush(pdata, nSize) || nSize != 20)
+            return false;
+
+        CKeyID key;
+        memcpy(key.begin(), pdata, 20);
+        if(!keys.Insert(key))
+            return false;
+    }
+
+    // CheckStruct of vote and cancelvote
+    return !keys.empty();
+}
+
+bool DataToStruct(CVoteForgerData& data, const CScript& script)
+{
+    CDPoSKeys keys;
+    if(script.empty() || !ParseDPoSKeys(keys, &script[0], &script[0] + script.size()))
+        return false;
+
+    data.opcode = script[0];
+    data.forgers.insert(keys.begin(), keys.end());
+    return true;
+}
+
+bool DataToStruct(CCancelVoteForgerData& data, const CScript& script)
+{
+    CDPoSKeys keys;
+    if(script.empty() || !ParseDPoSKeys(keys, &script[0], &script[0] + script.size()))
+        return false;
+
+    data.opcode = script[0];
+    data.forgers.insert(keys.begin(), keys.end());
+    return true;
+}
+
+bool DataToStruct(CSubmitBillData& data, const CScript& script)
+{
+    bool ret = false;
+
+    auto iter = script.begin();
+    data.opcode = *iter++;
+
+    opcodetype opcode;
+    std::vector<unsigned char> vchRet;
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.title = std::string(vchRet.begin(), vchRet.end());
+
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.detail = std::string(vchRet.begin(), vchRet.end());
+
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.url = std::string(vchRet.begin(), vchRet.end());
+
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.endtime = std::stoll(std::string(vchRet.begin(), vchRet.end()));
+
+    uint8_t num = *iter++;
+    for(int i =0; i < num; ++i) {
+        if (!script.GetOp2(iter, opcode, &vchRet)) {
+            return false;
+        }
+
+        data.options.push_back(std::string(vchRet.begin(), vchRet.end()));
+    }
+
+    if(CheckStruct(data).empty()) {
+        ret = true;
+    }
+    return ret;
+}
+
+bool DataToStruct(CVoteBillData& data, const CScript& script)
+{
+    bool ret = false;
+
+    auto iter = script.begin();
+    data.opcode = *iter++;
+
+    opcodetype opcode;
+    std::vector<unsigned char> vchRet;
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+
+    if(vchRet.size() != 40) {
+        return false;
+    }
+    data.id.SetHex(std::string(vchRet.begin(), vchRet.end()));
+    data.index = *iter++;
+
+    if(CheckStruct(data).empty()) {
+        ret = true;
+    }
+    return ret;
+}
+
+bool DataToStruct(CRegisterCommitteeData& data, const CScript& script)
+{
+    auto iter = script.begin();
+    data.opcode = *iter++;
+
+    opcodetype opcode;
+    std::vector<unsigned char> vchRet;
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.name = std::string(vchRet.begin(), vchRet.end());
+
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+    data.url = std::string(vchRet.begin(), vchRet.end());
+
+    bool ret = false;
+    if(CheckStruct(data).empty()) {
+        ret = true;
+    }
+    return ret;
+}
+
+bool DataToStruct(CVoteCommitteeData& data, const CScript& script)
+{
+    bool ret = false;
+
+    auto iter = script.begin();
+    data.opcode = *iter++;
+
+    opcodetype opcode;
+    std::vector<unsigned char> vchRet;
+    if (!script.GetOp2(iter, opcode, &vchRet)) {
+        return false;
+    }
+
+    if(vchRet.size() != 20) {
+        return false;
+    }
+
+    data.committee = CKeyID(uint160(vchRet));
+
+    if(CheckStruct(data).empty()) {
+        ret = true;
+    }
+    return ret;
+}
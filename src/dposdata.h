@@ -0,0 +1,224 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_DPOSDATA_H
+#define BITCOIN_DPOSDATA_H
+
+#include "pubkey.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <initializer_list>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CScript;
+
+/**
+ * The payloads of the DPoS operations, as carried by the OP_RETURN output of
+ * a transaction, and their encoding. They need no chain state, so that
+ * bitcoin-tx can build the operations as well as the node.
+ */
+
+//! The most keys an OP_VOTE or OP_REVOKE can list, its count being one byte
+static const unsigned int MAX_DPOS_OP_KEYS = 255;
+
+/**
+ * The distinct keys of an OP_VOTE or OP_REVOKE in key order, like the
+ * std::set they used to be parsed into but without allocating. Lists longer
+ * than Vote::MaxNumberOfVotes are kept too, so that Vote records them as
+ * invalid votes as it always has.
+ */
+class CDPoSKeys
+{
+public:
+    typedef const CKeyID* const_iterator;
+
+    CDPoSKeys() : nKeys(0) {}
+    CDPoSKeys(std::initializer_list<CKeyID> keys);
+    explicit CDPoSKeys(const std::set<CKeyID>& keys);
+
+    /** Add a key in order. False if it is listed already or there is no room. */
+    bool Insert(const CKeyID& key);
+
+    const_iterator begin() const { return vKeys; }
+    const_iterator end() const { return vKeys + nKeys; }
+    size_t size() const { return nKeys; }
+    bool empty() const { return nKeys == 0; }
+
+private:
+    unsigned int nKeys;
+    CKeyID vKeys[MAX_DPOS_OP_KEYS];
+};
+
+/** Reads the payload of a DPoS operation in place, the way CScript::GetOp2 reads it */
+class CDPoSOpReader
+{
+public:
+    CDPoSOpReader(const unsigned char* pbeginIn, const unsigned char* pendIn) : pc(pbeginIn), pend(pendIn) {}
+
+    bool ReadByte(uint8_t& n);
+    /** Read the data of a push, or the empty data of any other opcode */
+    bool ReadPush(const unsigned char*& pdata, size_t& nSize);
+
+private:
+    const unsigned char* pc;
+    const unsigned char* pend;
+};
+
+/** Parse the keys of the payload of an OP_VOTE or OP_REVOKE, which starts with its opcode */
+bool ParseDPoSKeys(CDPoSKeys& keys, const unsigned char* pbegin, const unsigned char* pend);
+
+struct COpData{
+    uint8_t opcode;
+};
+
+struct CRegisterForgerData : public COpData {
+    std::string name;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & name;
+    }
+};
+
+struct CVoteForgerData : public COpData {
+	std::set<CKeyID> forgers;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & forgers;
+    }
+};
+
+struct CCancelVoteForgerData : public COpData {
+	std::set<CKeyID> forgers;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & forgers;
+    }
+};
+
+struct CRegisterCommitteeData : public COpData {
+    std::string name;
+    std::string url;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & name;
+        ar & url;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(name);
+        READWRITE(url);
+    }
+};
+
+struct CVoteCommitteeData : public COpData {
+    CKeyID committee;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & committee;
+    }
+};
+
+struct CCancelVoteCommitteeData : public COpData {
+    CKeyID committee;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & committee;
+    }
+};
+
+struct CSubmitBillData : public COpData {
+    CKeyID committee;
+    std::string title;
+    std::string detail;
+    std::string url;
+    std::vector<std::string> options;
+    uint64_t starttime;
+    uint64_t endtime;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & committee;
+        ar & title;
+        ar & detail;
+        ar & url;
+        ar & starttime;
+        ar & endtime;
+        ar & options;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(committee);
+        READWRITE(title);
+        READWRITE(detail);
+        READWRITE(url);
+        READWRITE(starttime);
+        READWRITE(endtime);
+        READWRITE(options);
+    }
+};
+
+struct CVoteBillData : public COpData {
+    uint160 id;
+    uint8_t index;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & id;
+        ar & index;
+    }
+};
+
+std::vector<unsigned char> StructToData(const CRegisterForgerData& data);
+std::vector<unsigned char> StructToData(const CVoteForgerData& data);
+std::vector<unsigned char> StructToData(const CCancelVoteForgerData& data);
+std::vector<unsigned char> StructToData(const CRegisterCommitteeData& data);
+std::vector<unsigned char> StructToData(const CVoteCommitteeData& data);
+std::vector<unsigned char> StructToData(const CCancelVoteCommitteeData& data);
+std::vector<unsigned char> StructToData(const CSubmitBillData& data);
+std::vector<unsigned char> StructToData(const CVoteBillData& data);
+std::string CheckStruct(const CRegisterForgerData& data);
+std::string CheckStruct(const CVoteForgerData& data);
+std::string CheckStruct(const CCancelVoteForgerData& data);
+std::string CheckStruct(const CRegisterCommitteeData& data);
+std::string CheckStruct(const CVoteCommitteeData& data);
+std::string CheckStruct(const CCancelVoteCommitteeData& data);
+std::string CheckStruct(const CSubmitBillData& data);
+std::string CheckStruct(const CVoteBillData& data);
+
+
+bool DataToStruct(CRegisterForgerData& data, const CScript& script);
+bool DataToStruct(CVoteForgerData& data, const CScript& script);
+bool DataToStruct(CCancelVoteForgerData& data, const CScript& script);
+
+bool DataToStruct(CRegisterCommitteeData& data, const CScript& script);
+bool DataToStruct(CVoteCommitteeData& data, const CScript& script);
+bool DataToStruct(CCancelVoteCommitteeData& data, const CScript& script);
+bool DataToStruct(CSubmitBillData& data, const CScript& script);
+bool DataToStruct(CVoteBillData& data, const CScript& script);
+
+#endif // BITCOIN_DPOSDATA_H
@@ -0,0 +1,106 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATSET_H
+#define BITCOIN_FLATSET_H
+
+#include "serialize.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Set kept as a sorted vector. Lookups are binary searches and iteration
+ * walks contiguous memory, at the cost of inserts and erases moving the
+ * elements after them. Each element takes its own size only, where a
+ * std::set node adds three pointers and a color to it.
+ *
+ * Serializes like a std::set of the same elements, so the two can be read
+ * back as each other.
+ */
+template <typename K>
+class CFlatSet
+{
+private:
+    typedef std::vector<K> base;
+    base v;
+
+public:
+    typedef typename base::const_iterator iterator;
+    typedef typename base::const_iterator const_iterator;
+    typedef typename base::size_type size_type;
+    typedef K value_type;
+
+    CFlatSet() {}
+
+    template <typename InputIt>
+    CFlatSet(InputIt first, InputIt last) : v(first, last)
+    {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    const_iterator find(const K& key) const
+    {
+        const_iterator it = std::lower_bound(v.begin(), v.end(), key);
+        return it != v.end() && !(key < *it) ? it : v.end();
+    }
+
+    size_type count(const K& key) const { return find(key) != v.end(); }
+
+    std::pair<iterator, bool> insert(const K& key)
+    {
+        typename base::iterator it = std::lower_bound(v.begin(), v.end(), key);
+        if (it != v.end() && !(key < *it))
+            return std::make_pair(iterator(it), false);
+        return std::make_pair(iterator(v.insert(it, key)), true);
+    }
+
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+
+    size_type erase(const K& key)
+    {
+        typename base::iterator it = std::lower_bound(v.begin(), v.end(), key);
+        if (it == v.end() || key < *it)
+            return 0;
+        v.erase(it);
+        return 1;
+    }
+
+    bool empty() const              { return v.empty(); }
+    size_type size() const          { return v.size(); }
+    void clear()                    { v.clear(); }
+    void reserve(size_type n)       { v.reserve(n); }
+    void shrink_to_fit()            { v.shrink_to_fit(); }
+    const_iterator begin() const    { return v.begin(); }
+    const_iterator end() const      { return v.end(); }
+    size_t DynamicMemoryUsage() const { return v.capacity() * sizeof(K); }
+
+    friend bool operator==(const CFlatSet& a, const CFlatSet& b) { return a.v == b.v; }
+    friend bool operator!=(const CFlatSet& a, const CFlatSet& b) { return a.v != b.v; }
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ::Serialize(s, v);
+    }
+
+    /** Accepts the elements in any order, as long as there are no duplicates */
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        ::Unserialize(s, v);
+        if (!std::is_sorted(v.begin(), v.end()))
+            std::sort(v.begin(), v.end());
+        if (std::adjacent_find(v.begin(), v.end()) != v.end())
+            throw std::ios_base::failure("CFlatSet::Unserialize: duplicate element");
+    }
+};
+
+#endif // BITCOIN_FLATSET_H
@@ -7,6 +7,8 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <map>
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -72,6 +74,29 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
     return h1;
 }
 
+void Hash160Multi(uint160* output, const unsigned char* const* inputs, const size_t* lens, size_t count)
+{
+    // The messages of each length, in their order
+    std::map<size_t, std::vector<size_t> > mapLengths;
+    for (size_t n = 0; n < count; n++)
+        mapLengths[lens[n]].push_back(n);
+
+    std::vector<const unsigned char*> vInputs;
+    std::vector<unsigned char> vSHA256, vRIPEMD160;
+    for (const auto& length : mapLengths) {
+        const std::vector<size_t>& vIndexes = length.second;
+        vInputs.clear();
+        for (size_t n : vIndexes)
+            vInputs.push_back(inputs[n]);
+        vSHA256.resize(CSHA256::OUTPUT_SIZE * vIndexes.size());
+        vRIPEMD160.resize(CRIPEMD160::OUTPUT_SIZE * vIndexes.size());
+        SHA256Multi(vSHA256.data(), vInputs.data(), length.first, vIndexes.size());
+        RIPEMD160_32(vRIPEMD160.data(), vSHA256.data(), vIndexes.size());
+        for (size_t i = 0; i < vIndexes.size(); i++)
+            memcpy(output[vIndexes[i]].begin(), &vRIPEMD160[CRIPEMD160::OUTPUT_SIZE * i], CRIPEMD160::OUTPUT_SIZE);
+    }
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
 {
     unsigned char num[4];
@@ -208,3 +233,44 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra)
+{
+    /* Specialized implementation for efficiency */
+    uint64_t d = val.GetUint64(0);
+
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1 ^ d;
+
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(1);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(2);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(3);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = (((uint64_t)36) << 56) | extra;
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -13,6 +13,7 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <string.h>
 #include <vector>
 
 typedef uint256 ChainCode;
@@ -126,29 +127,54 @@ inline uint160 Hash160(const prevector<N, unsigned char>& vch)
     return Hash160(vch.begin(), vch.end());
 }
 
+/** Compute the 160-bit hashes of count messages, the n-th of lens[n] bytes at
+ *  inputs[n], into output[n]. Messages of the same length, such as public keys,
+ *  are hashed several at a time by the multi-way SHA-256 and RIPEMD-160. */
+void Hash160Multi(uint160* output, const unsigned char* const* inputs, const size_t* lens, size_t count);
+
 /** A writer stream (for serialization) that computes a 256-bit hash. */
 class CHashWriter
 {
 private:
     CHash256 ctx;
 
+    /** Serialization writes a few bytes at a time. They are gathered here into
+     * whole SHA-256 blocks, so that the hasher is only called once a block. */
+    unsigned char buf[64];
+    size_t nBuf;
+
     const int nType;
     const int nVersion;
 public:
 
-    CHashWriter(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn) {}
+    CHashWriter(int nTypeIn, int nVersionIn) : nBuf(0), nType(nTypeIn), nVersion(nVersionIn) {}
 
     int GetType() const { return nType; }
     int GetVersion() const { return nVersion; }
 
     void write(const char *pch, size_t size) {
-        ctx.Write((const unsigned char*)pch, size);
+        if (nBuf + size < sizeof(buf)) {
+            memcpy(buf + nBuf, pch, size);
+            nBuf += size;
+            return;
+        }
+        // Complete the buffered block, then hash whole blocks straight from the source
+        size_t nFill = sizeof(buf) - nBuf;
+        memcpy(buf + nBuf, pch, nFill);
+        ctx.Write(buf, sizeof(buf));
+        pch += nFill;
+        size -= nFill;
+        size_t nWhole = size - size % sizeof(buf);
+        if (nWhole)
+            ctx.Write((const unsigned char*)pch, nWhole);
+        nBuf = size - nWhole;
+        memcpy(buf, pch + nWhole, nBuf);
     }
 
     // invalidates the object
     uint256 GetHash() {
         uint256 result;
-        ctx.Finalize((unsigned char*)&result);
+        ctx.Write(buf, nBuf).Finalize((unsigned char*)&result);
         return result;
     }
 
@@ -206,5 +232,11 @@ public:
  *      .Finalize()
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+/** Optimized SipHash-2-4 implementation for uint256 followed by 4 bytes, as in an outpoint.
+ *
+ *  It is identical to hashing the 32 bytes of val and the 4 little-endian bytes
+ *  of extra with CSipHasher(k0, k1).
+ */
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
 #endif // BITCOIN_HASH_H
@@ -15,9 +15,13 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 #include "crypto/hmac_sha256.h"
+#include "crypto/sha256.h"
 #include <stdio.h>
 #include "utilstrencodings.h"
 
+#include <list>
+#include <mutex>
+
 #include <boost/algorithm/string.hpp> // boost::trim
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
@@ -147,6 +151,239 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
+//! Authorization headers that were accepted, by their SHA256 so that looking one up tells nothing about the credentials
+static std::map<uint256, std::string> mapAuthorizedHeaders;
+static CCriticalSection cs_authorizedHeaders;
+//! The cache only holds the headers of a few clients, it starts over when full
+static const size_t MAX_AUTHORIZED_HEADERS = 64;
+
+/**
+ * RPCAuthorized, remembering the headers that passed. A client on a kept-alive
+ * connection sends the same header each call, so it only pays for base64 and
+ * the rpcauth HMACs once. Failures are never cached.
+ */
+static bool RPCAuthorizedCached(const std::string& strAuth, std::string& strAuthUsernameOut)
+{
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)strAuth.data(), strAuth.size()).Finalize(hash.begin());
+    {
+        LOCK(cs_authorizedHeaders);
+        std::map<uint256, std::string>::const_iterator it = mapAuthorizedHeaders.find(hash);
+        if (it != mapAuthorizedHeaders.end()) {
+            strAuthUsernameOut = it->second;
+            return true;
+        }
+    }
+
+    if (!RPCAuthorized(strAuth, strAuthUsernameOut))
+        return false;
+
+    LOCK(cs_authorizedHeaders);
+    if (mapAuthorizedHeaders.size() >= MAX_AUTHORIZED_HEADERS)
+        mapAuthorizedHeaders.clear();
+    mapAuthorizedHeaders[hash] = strAuthUsernameOut;
+    return true;
+}
+
+/**
+ * Streams the array result of a single JSON-RPC request as a chunked reply.
+ * The reply is only started by the first element, so results that are
+ * empty or never pushed go out the usual way.
+ */
+class HTTPRPCArrayWriter : public CRPCArrayWriter
+{
+public:
+    HTTPRPCArrayWriter(HTTPRequest* _req, const UniValue& _id) : req(_req), id(_id), fStarted(false) {}
+
+    bool IsStarted() const { return fStarted; }
+
+    void Push(const UniValue& value) override
+    {
+        if (!fStarted) {
+            req->WriteHeader("Content-Type", "application/json");
+            req->StartChunkedReply(HTTP_OK);
+            strBuffer = "{\"result\":[";
+            fStarted = true;
+        } else {
+            strBuffer += ",";
+        }
+
+        strBuffer += value.write();
+        if (strBuffer.size() >= CHUNK_SIZE) {
+            req->WriteReplyChunk(strBuffer);
+            strBuffer.clear();
+        }
+    }
+
+    /** Close the array, an error raised after the reply started goes next to the partial result */
+    void Finish(const UniValue& error)
+    {
+        strBuffer += "],\"error\":" + error.write() + ",\"id\":" + id.write() + "}\n";
+        req->WriteReplyChunk(strBuffer);
+        req->EndChunkedReply();
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    HTTPRequest* req;
+    UniValue id;
+    bool fStarted;
+    std::string strBuffer;
+};
+
+/** A request waiting for the tip without a thread, see RPCParkRequest */
+struct ParkedRPCRequest
+{
+    HTTPRequest* req;
+    JSONRPCRequest jreq;
+    int64_t nWakeTime;
+};
+
+static std::mutex cs_parked;
+//! Guarded by cs_parked
+static std::list<ParkedRPCRequest> listParked;
+static uint64_t nParkedTipChanges = 0;
+static bool fParkedShutdown = false;
+static HTTPEvent* eventParkedTimer = NULL;
+static int64_t nParkedTimerWake = 0;
+
+static bool ExecuteRPCRequest(HTTPRequest* req, const JSONRPCRequest& jreq);
+
+/** Run a parked request again on a worker thread */
+static void ResumeRPCRequest(HTTPRequest* req, const JSONRPCRequest& jreq)
+{
+    if (!QueueHTTPWork(req, [jreq](HTTPRequest* r) { ExecuteRPCRequest(r, jreq); })) {
+        LogPrintf("WARNING: parked request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+        req->WriteReply(HTTP_INTERNAL_SERVER_ERROR, "Work queue depth exceeded");
+        delete req;
+    }
+}
+
+/** Have the timer go off at nWakeTime, unless it already goes off before. cs_parked must be held. */
+static void ArmParkedTimer(int64_t nWakeTime)
+{
+    if (!eventParkedTimer || (nParkedTimerWake && nParkedTimerWake <= nWakeTime))
+        return;
+    nParkedTimerWake = nWakeTime;
+    int64_t nDelay = std::max(nWakeTime - GetTimeMillis(), (int64_t)0);
+    struct timeval tv;
+    tv.tv_sec = nDelay / 1000;
+    tv.tv_usec = (nDelay % 1000) * 1000;
+    eventParkedTimer->trigger(&tv);
+}
+
+/** Resume the parked requests due, on the event thread */
+static void ParkedTimerFired()
+{
+    std::vector<ParkedRPCRequest> vDue;
+    {
+        std::lock_guard<std::mutex> lock(cs_parked);
+        nParkedTimerWake = 0;
+        int64_t nNow = GetTimeMillis();
+        int64_t nNext = 0;
+        for (std::list<ParkedRPCRequest>::iterator it = listParked.begin(); it != listParked.end();) {
+            if (it->nWakeTime && it->nWakeTime <= nNow) {
+                vDue.push_back(*it);
+                it = listParked.erase(it);
+                continue;
+            }
+            if (it->nWakeTime && (!nNext || it->nWakeTime < nNext))
+                nNext = it->nWakeTime;
+            ++it;
+        }
+        if (nNext)
+            ArmParkedTimer(nNext);
+    }
+    for (const ParkedRPCRequest& parked : vDue)
+        ResumeRPCRequest(parked.req, parked.jreq);
+}
+
+/** Resume all the parked requests, as the tip they wait for changed */
+static void ParkedNotifyBlockTip(bool fInitialDownload, const CBlockIndex* pindex)
+{
+    std::list<ParkedRPCRequest> listWoken;
+    {
+        std::lock_guard<std::mutex> lock(cs_parked);
+        nParkedTipChanges++;
+        if (fParkedShutdown)
+            return;
+        listWoken.swap(listParked);
+    }
+    for (const ParkedRPCRequest& parked : listWoken)
+        ResumeRPCRequest(parked.req, parked.jreq);
+}
+
+/**
+ * Execute a singleton request and reply to it. A call that waits for the tip
+ * parks the request, and its worker thread goes back to the queue.
+ */
+static bool ExecuteRPCRequest(HTTPRequest* req, const JSONRPCRequest& jreqIn)
+{
+    JSONRPCRequest jreq = jreqIn;
+    while (true) {
+        uint64_t nTipChanges;
+        {
+            std::lock_guard<std::mutex> lock(cs_parked);
+            nTipChanges = nParkedTipChanges;
+        }
+        int64_t nStart = GetTimeMillis();
+        HTTPRPCArrayWriter writer(req, jreq.id);
+        jreq.pArrayWriter = &writer;
+        try {
+            UniValue result = tableRPC.execute(jreq);
+            if (writer.IsStarted()) {
+                writer.Finish(NullUniValue);
+                return true;
+            }
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, JSONRPCReply(result, NullUniValue, jreq.id));
+            return true;
+        } catch (const RPCParkRequest& park) {
+            jreq.pArrayWriter = NULL;
+            if (!jreq.nParkedSince)
+                jreq.nParkedSince = nStart;
+            jreq.strParkState = park.strState;
+            {
+                std::lock_guard<std::mutex> lock(cs_parked);
+                if (fParkedShutdown) {
+                    JSONErrorReply(req, JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down"), jreq.id);
+                    return false;
+                }
+                // The tip changed while the call ran, it may be what the call waits for
+                if (nTipChanges != nParkedTipChanges)
+                    continue;
+            }
+            int64_t nWakeTime = park.nWakeTime;
+            req->Detach([jreq, nTipChanges, nWakeTime](HTTPRequest* r) {
+                {
+                    std::lock_guard<std::mutex> lock(cs_parked);
+                    if (nTipChanges == nParkedTipChanges && !fParkedShutdown) {
+                        listParked.push_back(ParkedRPCRequest{r, jreq, nWakeTime});
+                        if (nWakeTime)
+                            ArmParkedTimer(nWakeTime);
+                        return;
+                    }
+                }
+                ResumeRPCRequest(r, jreq);
+            });
+            return true;
+        } catch (const UniValue& objError) {
+            if (writer.IsStarted())
+                writer.Finish(objError);
+            else
+                JSONErrorReply(req, objError, jreq.id);
+            return false;
+        } catch (const std::exception& e) {
+            if (writer.IsStarted())
+                writer.Finish(JSONRPCError(RPC_PARSE_ERROR, e.what()));
+            else
+                JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+            return false;
+        }
+    }
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -163,7 +400,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     }
 
     JSONRPCRequest jreq;
-    if (!RPCAuthorized(authHeader.second, jreq.authUser)) {
+    if (!RPCAuthorizedCached(authHeader.second, jreq.authUser)) {
         LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", req->GetPeer().ToString());
 
         /* Deter brute-forcing
@@ -179,7 +416,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     try {
         // Parse request
         UniValue valRequest;
-        if (!valRequest.read(req->ReadBody()))
+        if (!valRequest.read(req->ReadBodyInPlace()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
         // Set the URI
@@ -189,20 +426,16 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
-
-            UniValue result = tableRPC.execute(jreq);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            jreq.fParkable = true;
 
         // array of requests
-        } else if (valRequest.isArray())
+        } else if (valRequest.isArray()) {
             strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, std::move(strReply));
+            return true;
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
         JSONErrorReply(req, objError, jreq.id);
         return false;
@@ -210,11 +443,15 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
         return false;
     }
-    return true;
+    return ExecuteRPCRequest(req, jreq);
 }
 
 static bool InitRPCAuthentication()
 {
+    {
+        LOCK(cs_authorizedHeaders);
+        mapAuthorizedHeaders.clear();
+    }
     if (GetArg("-rpcpassword", "") == "")
     {
         LogPrintf("No rpcpassword set - using random cookie authentication\n");
@@ -242,18 +479,41 @@ bool StartHTTPRPC()
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCSetTimerInterface(httpRPCTimerInterface);
+
+    {
+        std::lock_guard<std::mutex> lock(cs_parked);
+        fParkedShutdown = false;
+        eventParkedTimer = new HTTPEvent(EventBase(), false, ParkedTimerFired);
+    }
+    uiInterface.NotifyBlockTip.connect(&ParkedNotifyBlockTip);
     return true;
 }
 
 void InterruptHTTPRPC()
 {
     LogPrint("rpc", "Interrupting HTTP RPC server\n");
+    std::list<ParkedRPCRequest> listStopped;
+    {
+        std::lock_guard<std::mutex> lock(cs_parked);
+        fParkedShutdown = true;
+        listStopped.swap(listParked);
+    }
+    for (const ParkedRPCRequest& parked : listStopped) {
+        JSONErrorReply(parked.req, JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down"), parked.jreq.id);
+        delete parked.req;
+    }
 }
 
 void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    uiInterface.NotifyBlockTip.disconnect(&ParkedNotifyBlockTip);
+    {
+        std::lock_guard<std::mutex> lock(cs_parked);
+        delete eventParkedTimer;
+        eventParkedTimer = NULL;
+    }
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
@@ -49,6 +49,11 @@ public:
     void operator()()
     {
         func(req.get(), path);
+        if (req->detached) {
+            std::function<void(HTTPRequest*)> fn;
+            fn.swap(req->detached);
+            fn(req.release());
+        }
     }
 
     std::unique_ptr<HTTPRequest> req;
@@ -297,6 +302,18 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     }
 }
 
+bool QueueHTTPWork(HTTPRequest* req, const std::function<void(HTTPRequest*)>& func)
+{
+    std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::unique_ptr<HTTPRequest>(req), "", [func](HTTPRequest* r, const std::string&) { func(r); return true; }));
+    assert(workQueue);
+    if (workQueue->Enqueue(item.get())) {
+        item.release();
+        return true;
+    }
+    item->req.release();
+    return false;
+}
+
 /** Callback to reject HTTP requests after shutdown. */
 static void http_reject_request_cb(struct evhttp_request* req, void*)
 {
@@ -545,7 +562,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunked) {
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -584,6 +604,17 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+const char* HTTPRequest::ReadBodyInPlace()
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    // The terminator makes the body a C string for the parsers, in the one contiguous block pullup makes anyway
+    evbuffer_add(buf, "", 1);
+    const char* data = (const char*)evbuffer_pullup(buf, -1);
+    return data ? data : "";
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -599,10 +630,29 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
+    SendReply(nStatus);
+}
+
+void HTTPRequest::WriteReply(int nStatus, std::string&& strReply)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    // The buffer refers to the string and frees it once the reply has been written out
+    std::string* pReply = new std::string(std::move(strReply));
+    if (evbuffer_add_reference(evb, pReply->data(), pReply->size(), [](const void*, size_t, void* arg) { delete (std::string*)arg; }, pReply) != 0) {
+        evbuffer_add(evb, pReply->data(), pReply->size());
+        delete pReply;
+    }
+    SendReply(nStatus);
+}
+
+void HTTPRequest::SendReply(int nStatus)
+{
+    // Send event to main http thread to send reply message
     HTTPEvent* ev = new HTTPEvent(eventBase, true,
         std::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
@@ -610,6 +660,66 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** State of a chunked reply shared by the closures sent to the main thread */
+struct HTTPChunkedReply {
+    struct evhttp_request* req;
+    bool fClosed; // The connection went away, req must not be touched anymore
+
+    HTTPChunkedReply(struct evhttp_request* _req) : req(_req), fClosed(false) {}
+};
+
+static void http_chunked_close_cb(struct evhttp_connection*, void* arg)
+{
+    ((HTTPChunkedReply*)arg)->fClosed = true;
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !chunked && req);
+    chunked = std::make_shared<HTTPChunkedReply>(req);
+    std::shared_ptr<HTTPChunkedReply> state = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [state, nStatus]() {
+        // Requests on a closed connection are freed by evhttp, so learn about it before that happens
+        evhttp_connection_set_closecb(evhttp_request_get_connection(state->req), http_chunked_close_cb, state.get());
+        evhttp_send_reply_start(state->req, nStatus, NULL);
+    });
+    ev->trigger(0);
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && chunked);
+    if (strChunk.empty())
+        return;
+
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    std::shared_ptr<HTTPChunkedReply> state = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [state, evb]() {
+        if (!state->fClosed)
+            evhttp_send_reply_chunk(state->req, evb);
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(!replySent && chunked);
+    std::shared_ptr<HTTPChunkedReply> state = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [state]() {
+        if (state->fClosed)
+            return;
+        evhttp_connection_set_closecb(evhttp_request_get_connection(state->req), NULL, NULL);
+        evhttp_send_reply_end(state->req);
+    });
+    ev->trigger(0);
+    chunked.reset();
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +18,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -55,6 +57,14 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    std::shared_ptr<HTTPChunkedReply> chunked;
+    //! Takes the request over once its handler returned, set by Detach
+    std::function<void(HTTPRequest*)> detached;
+
+    friend class HTTPWorkItem;
+
+    //! Give the request with its output buffer back to the main thread
+    void SendReply(int nStatus);
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -94,6 +104,14 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Read request body in place, without copying it out of the buffer.
+     *
+     * @note The body is NUL-terminated and stays valid until the reply is
+     * sent. Like ReadBody, call this only once.
+     */
+    const char* ReadBodyInPlace();
+
     /**
      * Write output header.
      *
@@ -110,8 +128,44 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+    /** Write HTTP reply, handing the body over to the reply buffer instead of copying it */
+    void WriteReply(int nStatus, std::string&& strReply);
+
+    /**
+     * Start a chunked HTTP reply, for bodies that are produced piece by piece.
+     * nStatus is the HTTP status code to send.
+     *
+     * @note Call this instead of WriteReply, then WriteReplyChunk for every
+     * piece of the body and EndChunkedReply once. Chunks written after the
+     * client went away are dropped.
+     */
+    void StartChunkedReply(int nStatus);
+    void WriteReplyChunk(const std::string& strChunk);
+    /**
+     * Finish a chunked HTTP reply.
+     *
+     * @note Gives the request back to the main thread like WriteReply.
+     */
+    void EndChunkedReply();
+
+    /**
+     * Keep the request open after its handler returns, for a reply written
+     * later. Once the handler is done, fn is called with the request, which
+     * it then owns, instead of the request being deleted.
+     *
+     * @note Only for a request given to a handler, which must not touch it
+     * after detaching it.
+     */
+    void Detach(const std::function<void(HTTPRequest*)>& fn) { detached = fn; }
 };
 
+/**
+ * Run func with a request taken over by Detach on a worker thread. The
+ * request is deleted once func returns, unless func detaches it again.
+ * Returns false when the work queue is full, and the caller keeps req.
+ */
+bool QueueHTTPWork(HTTPRequest* req, const std::function<void(HTTPRequest*)>& func);
+
 /** Event handler closure.
  */
 class HTTPClosure
@@ -0,0 +1,374 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexer.h"
+
+#include "address_index.h"
+#include "blockfilter.h"
+#include "chainparams.h"
+#include "init.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "warnings.h"
+
+CTxIndexer* ptxindexer = NULL;
+CAddressIndexer* paddressindexer = NULL;
+CBlockFilterIndexer* pblockfilterindexer = NULL;
+
+/** Seconds between two progress messages while an index catches up */
+static const int64_t INDEXER_LOG_INTERVAL = 30;
+/** Transactions the transaction index collects while catching up before writing them out */
+static const size_t TXINDEX_BATCH_TXS = 200000;
+
+static bool FatalError(const std::string& strMessage)
+{
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+    return false;
+}
+
+CIndexer::CIndexer() : pindexBest(NULL), fTipChanged(false), fInterrupted(false), fRunning(false), fSynced(false)
+{
+}
+
+CIndexer::~CIndexer()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CIndexer::Start()
+{
+    uint256 hashBest = GetBestBlock();
+    {
+        LOCK(cs_main);
+        if (!hashBest.IsNull()) {
+            BlockMap::iterator it = mapBlockIndex.find(hashBest);
+            if (it == mapBlockIndex.end())
+                return error("%s: best block %s of %s is unknown", __func__, hashBest.ToString(), GetName());
+            pindexBest = it->second;
+        }
+    }
+
+    LogPrintf("%s: %s is at height %d\n", __func__, GetName(), pindexBest ? pindexBest->nHeight : -1);
+    RegisterValidationInterface(this);
+    fRunning = true;
+    threadSync = std::thread(&TraceThread<std::function<void()> >, GetName(), std::function<void()>(std::bind(&CIndexer::ThreadSync, this)));
+    return true;
+}
+
+void CIndexer::Interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fInterrupted = true;
+    }
+    cond.notify_all();
+}
+
+void CIndexer::Stop()
+{
+    if (!threadSync.joinable())
+        return;
+
+    UnregisterValidationInterface(this);
+    threadSync.join();
+    Commit();
+}
+
+void CIndexer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fTipChanged = true;
+    }
+    cond.notify_all();
+}
+
+bool CIndexer::BlockUntilSyncedToCurrentChain()
+{
+    if (!fSynced)
+        return false;
+
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this, pindexTip] {
+        return fInterrupted || !fRunning || (pindexBest && pindexBest->GetAncestor(pindexTip->nHeight) == pindexTip);
+    });
+    return fRunning && !fInterrupted;
+}
+
+const CBlockIndex* CIndexer::GetBestBlockIndex()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pindexBest;
+}
+
+bool CIndexer::ProcessBlock(const CBlockIndex* pindex, bool fRevert)
+{
+    // The outputs of the genesis block are not spendable and not indexed, as in ConnectBlock.
+    CBlock block;
+    CBlockUndo blockundo;
+    if (pindex->pprev) {
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            return error("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+
+        if (NeedsUndo()) {
+            CDiskBlockPos pos;
+            {
+                LOCK(cs_main);
+                pos = pindex->GetUndoPos();
+            }
+            if (pos.IsNull() || !UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash()))
+                return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+            if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+                return error("%s: block %s and undo data inconsistent", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+
+    return fRevert ? RevertBlock(block, blockundo, pindex) : WriteBlock(block, blockundo, pindex);
+}
+
+void CIndexer::ThreadSync()
+{
+    if (!Upgrade()) {
+        if (!ShutdownRequested())
+            FatalError(strprintf("Failed to upgrade %s", GetName()));
+        fRunning = false;
+        cond.notify_all();
+        return;
+    }
+
+    int64_t nLastLog = 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fInterrupted)
+                break;
+            fTipChanged = false;
+        }
+
+        // Follow the active chain from the best block, going back first when
+        // the best block was disconnected. When the index is ahead of the tip
+        // on the same branch, as after -reindex-chainstate, wait for the chain.
+        const CBlockIndex* pindex = NULL;
+        bool fRevert = false;
+        int nTipHeight;
+        {
+            LOCK(cs_main);
+            nTipHeight = chainActive.Height();
+            if (!pindexBest) {
+                pindex = chainActive.Genesis();
+            } else {
+                const CBlockIndex* pindexFork = chainActive.FindFork(pindexBest);
+                if (pindexFork == pindexBest) {
+                    pindex = chainActive.Next(pindexBest);
+                } else if (pindexFork != chainActive.Tip()) {
+                    pindex = pindexBest;
+                    fRevert = true;
+                }
+            }
+        }
+
+        if (!pindex) {
+            if (!fSynced && nTipHeight >= 0) {
+                if (!Commit()) {
+                    FatalError(strprintf("Failed to write %s", GetName()));
+                    break;
+                }
+                fSynced = true;
+                LogPrintf("%s: %s is synced at height %d\n", __func__, GetName(), pindexBest ? pindexBest->nHeight : -1);
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.notify_all();
+            cond.wait(lock, [this] { return fInterrupted || fTipChanged; });
+            continue;
+        }
+
+        if (!ProcessBlock(pindex, fRevert)) {
+            FatalError(strprintf("Failed to %s block %s in %s", fRevert ? "revert" : "write", pindex->GetBlockHash().ToString(), GetName()));
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pindexBest = fRevert ? pindex->pprev : pindex;
+        }
+        cond.notify_all();
+
+        if (!fSynced && GetTime() - nLastLog >= INDEXER_LOG_INTERVAL) {
+            LogPrintf("Syncing %s with the block chain at height %d of %d\n", GetName(), pindexBest->nHeight, nTipHeight);
+            nLastLog = GetTime();
+        }
+    }
+
+    fRunning = false;
+    cond.notify_all();
+}
+
+uint256 CTxIndexer::GetBestBlock() const
+{
+    uint256 hashBlock;
+    pdb->ReadTxIndexBestBlock(hashBlock);
+    return hashBlock;
+}
+
+static void GetTxPositions(const CBlock& block, const CBlockIndex* pindex, std::vector<std::pair<uint256, CDiskTxPos> >& vPos)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    for (const CTransactionRef& tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx->GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+bool CTxIndexer::WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    GetTxPositions(block, pindex, vPending);
+    hashPendingBest = pindex->GetBlockHash();
+    if (IsSynced() || vPending.size() >= TXINDEX_BATCH_TXS)
+        return Commit();
+    return true;
+}
+
+bool CTxIndexer::RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    // The entries are keyed by position, so those of a disconnected block
+    // would stay next to the ones of its transactions confirmed again.
+    if (!Commit())
+        return false;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    GetTxPositions(block, pindex, vPos);
+    return pdb->EraseTxIndex(vPos, pindex->pprev->GetBlockHash());
+}
+
+bool CTxIndexer::Commit()
+{
+    if (hashPendingBest.IsNull())
+        return true;
+    if (!pdb->WriteTxIndex(vPending, hashPendingBest))
+        return false;
+    vPending.clear();
+    hashPendingBest.SetNull();
+    return true;
+}
+
+bool CTxIndexer::Upgrade()
+{
+    return pdb->EraseLegacyTxIndex();
+}
+
+uint256 CAddressIndexer::GetBestBlock() const
+{
+    return pdb->GetBestBlock();
+}
+
+bool CAddressIndexer::WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    return UpdateBlock(block, blockundo, pindex, false);
+}
+
+bool CAddressIndexer::RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    return UpdateBlock(block, blockundo, pindex, true);
+}
+
+bool CAddressIndexer::Commit()
+{
+    return pdb->Sync();
+}
+
+bool CAddressIndexer::UpdateBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fDisconnect)
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+
+    // A block may spend its own outputs, so the unspent entries of a
+    // disconnected block are undone in reverse order.
+    for (size_t n = 0; n < block.vtx.size(); n++) {
+        const size_t i = fDisconnect ? block.vtx.size() - 1 - n : n;
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                // Undo data written by older versions only has the height of
+                // the last output spent of a transaction, the others show 0.
+                const Coin& spent = txundo.vprevout[j];
+                CMyAddress address;
+                if (!ExtractAddress(spent.out.scriptPubKey, address))
+                    continue;
+                unsigned int type = address.second == CChainParams::SCRIPT_ADDRESS ? 2 : 1;
+                vHistory.push_back(std::make_pair(CAddressIndexKey(type, address.first, pindex->nHeight, i, txhash, j, true), -spent.out.nValue));
+                vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, address.first, tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                                                  fDisconnect ? CAddressUnspentValue(spent.out.nValue, spent.nHeight) : CAddressUnspentValue()));
+            }
+        }
+
+        for (size_t k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            CMyAddress address;
+            if (!ExtractAddress(out.scriptPubKey, address))
+                continue;
+            unsigned int type = address.second == CChainParams::SCRIPT_ADDRESS ? 2 : 1;
+            vHistory.push_back(std::make_pair(CAddressIndexKey(type, address.first, pindex->nHeight, i, txhash, k, false), out.nValue));
+            vUnspent.push_back(std::make_pair(CAddressUnspentKey(type, address.first, txhash, k),
+                                              fDisconnect ? CAddressUnspentValue() : CAddressUnspentValue(out.nValue, pindex->nHeight)));
+        }
+    }
+
+    return pdb->UpdateBlock(vHistory, vUnspent, fDisconnect ? pindex->pprev->GetBlockHash() : pindex->GetBlockHash(), fDisconnect);
+}
+
+uint256 CBlockFilterIndexer::GetBestBlock() const
+{
+    return pdb->GetBestBlock();
+}
+
+bool CBlockFilterIndexer::WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    uint256 hashPrevFilter, hashPrevHeader;
+    if (pindex->pprev && !pdb->ReadFilterHashes(pindex->pprev->GetBlockHash(), hashPrevFilter, hashPrevHeader))
+        return error("%s: no filter header for block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+
+    CBlockFilter filter(pindex->GetBlockHash(), block, blockundo);
+    return pdb->WriteFilter(filter, filter.ComputeHeader(hashPrevHeader));
+}
+
+bool CBlockFilterIndexer::RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    // The filter of a block depends on the block alone, and its header on the
+    // blocks below it, so the entries of a disconnected block are kept.
+    return pdb->WriteBestBlock(pindex->pprev->GetBlockHash());
+}
+
+bool CBlockFilterIndexer::Commit()
+{
+    return pdb->Sync();
+}
+
+bool CBlockFilterIndexer::LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter) const
+{
+    return pdb->ReadFilter(pindex->GetBlockHash(), filter);
+}
+
+bool CBlockFilterIndexer::LookupFilterHashes(const CBlockIndex* pindex, uint256& hashFilter, uint256& hashHeader) const
+{
+    return pdb->ReadFilterHashes(pindex->GetBlockHash(), hashFilter, hashHeader);
+}
@@ -0,0 +1,179 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXER_H
+#define BITCOIN_INDEXER_H
+
+#include "txdb.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockFilter;
+class CBlockIndex;
+class CBlockUndo;
+
+/**
+ * An optional index that is built from the blocks of the active chain by a
+ * thread of its own, so block validation never waits for it. The index keeps
+ * its own best block: when started behind the chain tip, or for the first
+ * time, it catches up by reading the blocks from disk, then it follows the tip
+ * and reverts the blocks that a reorganization disconnects. An index can be
+ * enabled on a running node at any time without reindexing the chain.
+ */
+class CIndexer : public CValidationInterface
+{
+public:
+    CIndexer();
+    virtual ~CIndexer();
+
+    /** Look up the best block of the index and start the sync thread */
+    bool Start();
+    void Interrupt();
+    void Stop();
+
+    /** Whether the index has caught up with the chain tip after being started */
+    bool IsSynced() const { return fSynced; }
+
+    /** The block the index is written up to, NULL if it is empty */
+    const CBlockIndex* GetBestBlockIndex();
+
+    /**
+     * Wait until the index includes the current chain tip, so a lookup sees
+     * the blocks connected so far. Returns false right away while the index
+     * is still catching up. Must not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+    /** Name of the index in log messages */
+    virtual const char* GetName() const = 0;
+
+    /** Whether WriteBlock and RevertBlock need the undo data of the block */
+    virtual bool NeedsUndo() const { return false; }
+
+    /** The block the index was written up to, null if it is empty */
+    virtual uint256 GetBestBlock() const = 0;
+
+    /**
+     * Add a block of the active chain, whose parent is the best block, and
+     * make it the best block. The genesis block comes without transactions.
+     */
+    virtual bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) = 0;
+
+    /** Remove the best block after it was disconnected, making its parent the best block */
+    virtual bool RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) = 0;
+
+    /** Make the writes so far durable */
+    virtual bool Commit() { return true; }
+
+    /**
+     * Bring what an older version wrote up to date, run by the sync thread
+     * before it processes a block. Returns false on error or when shutting down.
+     */
+    virtual bool Upgrade() { return true; }
+
+private:
+    void ThreadSync();
+    bool ProcessBlock(const CBlockIndex* pindex, bool fRevert);
+
+    //! Guards pindexBest, fTipChanged and fInterrupted
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Block the index is at, only changed by the sync thread
+    const CBlockIndex* pindexBest;
+    //! The chain tip moved since the sync thread last looked at it
+    bool fTipChanged;
+    bool fInterrupted;
+    //! The sync thread is running; it stops early after a write error
+    std::atomic<bool> fRunning;
+    std::atomic<bool> fSynced;
+    std::thread threadSync;
+};
+
+/**
+ * Keeps the positions of transactions on disk in the block tree database
+ * (-txindex). While catching up the positions of many blocks are written out
+ * together, once synced those of every block as it comes.
+ */
+class CTxIndexer : public CIndexer
+{
+public:
+    explicit CTxIndexer(CBlockTreeDB* pdbIn) : pdb(pdbIn) {}
+
+protected:
+    const char* GetName() const override { return "txindex"; }
+    uint256 GetBestBlock() const override;
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool Commit() override;
+    bool Upgrade() override;
+
+private:
+    CBlockTreeDB* pdb;
+    //! Positions not written yet, and the best block they lead up to; used by the sync thread only
+    std::vector<std::pair<uint256, CDiskTxPos> > vPending;
+    uint256 hashPendingBest;
+};
+
+/** Keeps the history, unspent outputs and balance of every address (-addressindex) */
+class CAddressIndexer : public CIndexer
+{
+public:
+    explicit CAddressIndexer(CAddressIndexDB* pdbIn) : pdb(pdbIn) {}
+
+protected:
+    const char* GetName() const override { return "addressindex"; }
+    bool NeedsUndo() const override { return true; }
+    uint256 GetBestBlock() const override;
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool Commit() override;
+
+private:
+    bool UpdateBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fDisconnect);
+
+    CAddressIndexDB* pdb;
+};
+
+/**
+ * Keeps the basic filter of every block and its filter header (-blockfilterindex),
+ * served to light clients instead of matching their bloom filters
+ */
+class CBlockFilterIndexer : public CIndexer
+{
+public:
+    explicit CBlockFilterIndexer(CBlockFilterDB* pdbIn) : pdb(pdbIn) {}
+
+    /** The filter of a block the index has written, whether on the active chain or not */
+    bool LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter) const;
+    bool LookupFilterHashes(const CBlockIndex* pindex, uint256& hashFilter, uint256& hashHeader) const;
+
+protected:
+    const char* GetName() const override { return "blockfilterindex"; }
+    bool NeedsUndo() const override { return true; }
+    uint256 GetBestBlock() const override;
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool RevertBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override;
+    bool Commit() override;
+
+private:
+    CBlockFilterDB* pdb;
+};
+
+/** The running indexes, NULL when disabled */
+extern CTxIndexer* ptxindexer;
+extern CAddressIndexer* paddressindexer;
+extern CBlockFilterIndexer* pblockfilterindexer;
+
+#endif // BITCOIN_INDEXER_H
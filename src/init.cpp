@@ -16,23 +16,30 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "indexer.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
 #include "netbase.h"
 #include "net.h"
 #include "net_processing.h"
+#include "notifier.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "support/arena.h"
+#include "threadinfo.h"
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txprevalidator.h"
+#include "txreconciliation.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -73,6 +80,7 @@ static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
 std::unique_ptr<CConnman> g_connman;
+CScheduler* g_scheduler = NULL;
 std::unique_ptr<PeerLogicValidation> peerLogic;
 
 #if ENABLE_ZMQ
@@ -149,9 +157,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -176,6 +184,12 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    if (ptxindexer)
+        ptxindexer->Interrupt();
+    if (paddressindexer)
+        paddressindexer->Interrupt();
+    if (pblockfilterindexer)
+        pblockfilterindexer->Interrupt();
     if (g_connman)
         g_connman->Interrupt();
     threadGroup.interrupt_all();
@@ -200,17 +214,43 @@ void Shutdown()
     StopREST();
     StopRPC();
     StopHTTPServer();
+    g_scheduler = NULL;
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
 #endif
     MapPort(false);
     UnregisterValidationInterface(peerLogic.get());
+    if (g_connman) {
+        // The message handler hands transactions to the prevalidation, and peers are removed from it
+        g_connman->Interrupt();
+        g_connman->Stop();
+    }
+    delete ptxprevalidator;
+    ptxprevalidator = NULL;
     peerLogic.reset();
     g_connman.reset();
 
     StopTorControl();
+    if (ptxindexer) {
+        ptxindexer->Stop();
+        delete ptxindexer;
+        ptxindexer = NULL;
+    }
+    if (paddressindexer) {
+        paddressindexer->Stop();
+        delete paddressindexer;
+        paddressindexer = NULL;
+    }
+    if (pblockfilterindexer) {
+        pblockfilterindexer->Stop();
+        delete pblockfilterindexer;
+        pblockfilterindexer = NULL;
+    }
     UnregisterNodeSignals(GetNodeSignals());
+    GetMainSignals().UnregisterWithMempoolSignals(mempool);
+    // The scheduler thread is gone, so what is left for the background listeners runs here, while the chain state is still there
+    SyncWithValidationInterfaceQueue();
     if (fDumpMempoolLater)
         DumpMempool();
 
@@ -238,6 +278,13 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete paddressindex;
+        paddressindex = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
+        delete pdposhistory;
+        pdposhistory = NULL;
+        Vote::GetInstance().CloseDB();
 
         //sleep(5);
     }
@@ -266,10 +313,12 @@ void Shutdown()
     delete pwalletMain;
     pwalletMain = NULL;
 #endif
+    delete pnotifier;
+    pnotifier = NULL;
     globalVerifyHandle.reset();
     ECC_Stop();
-    Vote::GetInstance().Store(nOldBlockHeight, strOldBlockHash);
     LogPrintf("%s: done\n", __func__);
+    StopDebugLogWriter();
 }
 
 /**
@@ -329,9 +378,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-notifypipe=<path>", _("Write the block, wallet and alert events as lines to this named pipe or file instead of running the -blocknotify, -walletnotify and -alertnotify commands"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-notifythreads=<n>", strprintf("Number of threads running the notification commands (1 to %d, default: %d)", MAX_NOTIFY_THREADS, DEFAULT_NOTIFY_THREADS));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-checkpointsync", strprintf(_("Skip script verification for ancestors of blocks in the built-in DPoS block hash table (default: %u)"), DEFAULT_CHECKPOINT_SYNC));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -341,16 +394,36 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-hugepages", strprintf(_("Back the UTXO cache and the block index with transparent huge pages, where the system has them (default: %u)"), DEFAULT_HUGE_PAGES));
+    strUsage += HelpMessageOpt("-mallocarenas=<n>", _("Let the C library keep at most <n> heaps, fewer heaps fragment less for some speed in allocation (glibc only, default: its own)"));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-blockindexdbprofile=<profile>", strprintf("LevelDB settings of the block index, transaction index and address index database: default or index (default: %s)", DEFAULT_BLOCKINDEX_DB_PROFILE));
+        strUsage += HelpMessageOpt("-blockindexdboptions=<options>", "LevelDB settings applied on top of -blockindexdbprofile, as name=value;... with the names compression (kNoCompression or kSnappyCompression), max_open_files, block_size, bloom_bits and write_buffer_size");
+        strUsage += HelpMessageOpt("-chainstatedbprofile=<profile>", strprintf("LevelDB settings of the chain state database: default or index (default: %s)", DEFAULT_CHAINSTATE_DB_PROFILE));
+        strUsage += HelpMessageOpt("-chainstatedboptions=<options>", "LevelDB settings applied on top of -chainstatedbprofile, see -blockindexdboptions");
+        strUsage += HelpMessageOpt("-compactdb", "Rewrite the block index, chain state and address index databases at startup, so that existing data picks up changed compression and block size settings");
+        strUsage += HelpMessageOpt("-blockfilechunksize=<n>", strprintf("Pre-allocate the blk*.dat files <n> MiB at a time (1 to %u, default: %u)", MAX_BLOCKFILE_SIZE / 1024 / 1024, BLOCKFILE_CHUNK_SIZE / 1024 / 1024));
+        strUsage += HelpMessageOpt("-undofilechunksize=<n>", strprintf("Pre-allocate the rev*.dat files <n> MiB at a time (1 to %u, default: %u)", MAX_BLOCKFILE_SIZE / 1024 / 1024, UNDOFILE_CHUNK_SIZE / 1024 / 1024));
+        strUsage += HelpMessageOpt("-irreversiblesyncwindow=<n>", strprintf("Sync the irreversible block journal to disk at most once in <n> milliseconds, so that a crash can lose the blocks of the last <n> milliseconds from it (default: %u)", DEFAULT_IRREVERSIBLE_SYNC_WINDOW));
+    }
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Start an empty data directory from a state snapshot written by dumpstatesnapshot, as a pruned node (requires -prune)"));
+    strUsage += HelpMessageOpt("-loadsnapshothash=<hex>", _("The hash the -loadsnapshot file must have, as reported by dumpstatesnapshot (required with -loadsnapshot)"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphanmem=<n>", strprintf(_("Keep the unconnectable transactions below <n> megabytes of memory (default: %u)"), DEFAULT_MAX_ORPHAN_MEMORY));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
-    strUsage += HelpMessageOpt("-maxmemory=<n>", strprintf(_("System can used memory <n> Gigabyte (default: %u)"), DEFAULT_MAX_MEMORY_SIZE));
+    strUsage += HelpMessageOpt("-maxmempooldpos=<n>", strprintf(_("Keep the DPoS operation transactions of the memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_DPOS_SIZE));
+    strUsage += HelpMessageOpt("-maxmemory=<n>", strprintf(_("Keep the UTXO and vote caches, the mempool, the block index and the signature and block caches below <n> GiB together, flushing the caches and trimming the mempool as needed, 0 for no bound (default: %u)"), DEFAULT_MAX_MEMORY_SIZE));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-scriptcheckcpus=<cpus>", _("Pin the script verification threads to a list of CPUs like 0-3,8, ideally those of one NUMA node (Linux only, default: not pinned)"));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads to run background tasks, one of them kept for time-critical ones (1 to %d, default: %d)"),
+        MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -359,9 +432,12 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-reindex-dpos", _("Rebuild the DPoS vote state from the currently indexed blocks"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain a compact filter of every block, served to light clients (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-dposhistory", strprintf(_("Keep the DPoS balances and votes of every height from the one it is enabled at, for the height argument of getaddressbalance, getdelegatevotes and listreceivedvotes (default: %u)"), DEFAULT_DPOSHISTORY));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -370,21 +446,28 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), DEFAULT_MISBEHAVING_BANTIME));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s); -noconnect or -connect=0 alone to disable automatic connections"));
+    strUsage += HelpMessageOpt("-delegatepeer=<address>@<ip>", _("Keep a connection open to the node of a delegate and push new blocks to it first when it forges next (can be specified multiple times)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
+    strUsage += HelpMessageOpt("-latencypeers=<n>", strprintf(_("Keep the <n> outbound peers relaying new blocks fastest, and every %d minutes replace the slowest of the others, for forging nodes (default: %d)"), LATENCY_ROTATION_INTERVAL / 60, DEFAULT_LATENCY_PEERS));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-netcpus=<cpus>", _("Pin the network threads to a list of CPUs like 0-3,8 (Linux only, default: not pinned)"));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-msghandlers=<n>", strprintf(_("Set the number of threads processing peer messages (1 to %d, default: %d)"), MAX_MESSAGE_HANDLERS, DEFAULT_MESSAGE_HANDLERS));
+    strUsage += HelpMessageOpt("-netstatsinterval=<n>", strprintf(_("Log the message processing and block relay times every <n> seconds, 0 to disable (default: %d)"), DEFAULT_NETSTATS_INTERVAL));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers, which needs -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
+    strUsage += HelpMessageOpt("-peercompressedheaders", strprintf(_("Exchange headers without their redundant DPoS fields with peers that support it (default: %u)"), DEFAULT_PEERCOMPRESSEDHEADERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
@@ -393,6 +476,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Experimental: reconcile transaction announcements with peers that support it instead of announcing each transaction (default: %u)"), DEFAULT_TX_RECONCILIATION));
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += HelpMessageOpt("-upnp", _("Use UPnP to map the listening port (default: 1 when listening and no -proxy)"));
@@ -417,6 +501,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubforgingslot=<address>", _("Enable publish forging slot statistics in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubdposround=<address>", _("Enable publish the delegates of each new DPoS round in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubirreversible=<address>", _("Enable publish irreversible block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubvote=<address>", _("Enable publish the votes of each block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubbalance=<address>", _("Enable publish the address balance changes of each block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhwm=<n>", strprintf(_("Set the outbound message high water mark of the ZMQ sockets (default: %d)"), DEFAULT_ZMQ_SNDHWM));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -425,6 +515,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
         strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+        strUsage += HelpMessageOpt("-checkblocksbackground", strprintf(_("Verify the -checkblocks after startup while the node runs, warning instead of stopping if they are corrupt (default: %u)"), DEFAULT_CHECKBLOCKS_BACKGROUND));
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
@@ -433,13 +524,14 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
+        strUsage += HelpMessageOpt("-stopatheight", strprintf("Stop running after reaching the given height in the main chain, logging the time spent per phase of connecting blocks with -debug=bench (default: %u)", DEFAULT_STOPATHEIGHT));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified BIP9 deployment (regtest-only)");
     }
-    std::string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
+    std::string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, DPoS, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -447,6 +539,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-nodebug", "Turn off debugging messages, same as -debug=0");
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-logasync", strprintf(_("Write debug.log from a background thread; the last messages before a crash may be lost (default: %u)"), DEFAULT_LOGASYNC));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
@@ -456,7 +549,9 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxscriptcachesize=<n>", strprintf("Limit size of the cache of transactions whose scripts passed to <n> MiB (default: %u)", DEFAULT_MAX_SCRIPT_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
+        strUsage += HelpMessageOpt("-lockstatssample=<n>", strprintf("Time every contended lock and one in <n> of the others for getlockstats, 0 to disable (default: %u)", DEFAULT_LOCKSTATS_SAMPLE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -489,6 +584,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-forgingstandby=<n>", strprintf(_("Back up another node forging for the same delegates: forge in a slot only if no block for it is known <n> milliseconds after the slot start, at most %d (default: %d)"), MAX_FORGING_STANDBY, DEFAULT_FORGING_STANDBY));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -500,7 +596,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. The client then connects normally using the rpcuser=<USERNAME>/rpcpassword=<PASSWORD> pair of arguments. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
-    strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls and to run the read-only calls of a batch (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpccpus=<cpus>", _("Pin the HTTP server and RPC threads to a list of CPUs like 0-3,8 (Linux only, default: not pinned)"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
@@ -536,13 +633,12 @@ static void BlockNotifyCallback(bool initialSync, const CBlockIndex *pBlockIndex
     if (initialSync || !pBlockIndex)
         return;
 
-    std::string strCmd = GetArg("-blocknotify", "");
-
-    boost::replace_all(strCmd, "%s", pBlockIndex->GetBlockHash().GetHex());
-    boost::thread t(runCommand, strCmd); // thread runs free
+    // Only the latest tip matters to a command not started yet
+    QueueNotify("block", GetArg("-blocknotify", ""), pBlockIndex->GetBlockHash().GetHex(), true);
 }
 
 static bool fHaveGenesis = false;
+static bool fReindexDPoS = false;
 static boost::mutex cs_GenesisWait;
 static CConditionVariable condvar_GenesisWait;
 
@@ -670,15 +766,33 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         if(Vote::GetInstance().Init(0, std::string()) == false) {
             return;
         }
+    } else if(fReindexDPoS) {
+        if(Vote::GetInstance().Init(0, std::string()) == false) {
+            return;
+        }
+
+        if(ReindexDPoSData() == false) {
+            LogPrintf("Failed to rebuild the DPoS state");
+            StartShutdown();
+            return;
+        }
     } else {
         if(Vote::GetInstance().Init(chainActive.Height(), chainActive.Tip()->GetBlockHash().ToString()) == false) {
             return;
         }
 
         if(RepairDPoSData(Vote::GetInstance().GetOldBlockHeight(), Vote::GetInstance().GetOldBlockHash()) == false) {
+            LogPrintf("Failed to repair the DPoS state");
+            StartShutdown();
             return;
         }
     }
+
+    if(pdposhistory && InitDPoSHistory() == false) {
+        LogPrintf("Failed to start the DPoS history");
+        StartShutdown();
+        return;
+    }
     
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
     CValidationState state;
@@ -692,8 +806,13 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         StartShutdown();
     }
     } // End scope of CImportingNow
-    LoadMempool();
-    fDumpMempoolLater = !fRequestShutdown;
+    if (GetBoolArg("-checkblocksbackground", DEFAULT_CHECKBLOCKS_BACKGROUND) && !ShutdownRequested()) {
+        BackgroundVerifyDB(chainparams, GetArg("-checklevel", DEFAULT_CHECKLEVEL), GetArg("-checkblocks", DEFAULT_CHECKBLOCKS));
+    }
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !fRequestShutdown;
+    }
 }
 
 /** Sanity checks
@@ -817,6 +936,8 @@ int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
 ServiceFlags nLocalServices = NODE_NETWORK;
+CDBOptions chainStateDBOptions;
+CDBOptions blockIndexDBOptions;
 
 }
 
@@ -902,24 +1023,50 @@ bool AppInitParameterInteraction()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
-    }
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+    }
+
+    std::string strChainStateDBProfile = GetArg("-chainstatedbprofile", DEFAULT_CHAINSTATE_DB_PROFILE);
+    if (!CDBOptions::FromProfile(strChainStateDBProfile, chainStateDBOptions))
+        return InitError(strprintf(_("Unknown database profile '%s' for -%s"), strChainStateDBProfile, "chainstatedbprofile"));
+    std::string strBlockIndexDBProfile = GetArg("-blockindexdbprofile", DEFAULT_BLOCKINDEX_DB_PROFILE);
+    if (!CDBOptions::FromProfile(strBlockIndexDBProfile, blockIndexDBOptions))
+        return InitError(strprintf(_("Unknown database profile '%s' for -%s"), strBlockIndexDBProfile, "blockindexdbprofile"));
+    std::string strDBOptionsError;
+    if (!CDBOptions::ParseOptions(GetArg("-chainstatedboptions", ""), chainStateDBOptions, strDBOptionsError))
+        return InitError(strprintf(_("Invalid -%s: %s"), "chainstatedboptions", strDBOptionsError));
+    if (!CDBOptions::ParseOptions(GetArg("-blockindexdboptions", ""), blockIndexDBOptions, strDBOptionsError))
+        return InitError(strprintf(_("Invalid -%s: %s"), "blockindexdboptions", strDBOptionsError));
 
     // Make sure enough file descriptors are available
+    // MIN_CORE_FILEDESCRIPTORS allows for the open files of the default database profile.
+    int nDBFiles = std::max(chainStateDBOptions.nMaxOpenFiles + blockIndexDBOptions.nMaxOpenFiles - 2 * CDBOptions().nMaxOpenFiles, 0);
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+        nDBFiles += std::max(blockIndexDBOptions.nMaxOpenFiles - CDBOptions().nMaxOpenFiles, 0);
     int nBind = std::max(
                 (mapMultiArgs.count("-bind") ? mapMultiArgs.at("-bind").size() : 0) +
                 (mapMultiArgs.count("-whitebind") ? mapMultiArgs.at("-whitebind").size() : 0), size_t(1));
     nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    fDPoSHistory = GetBoolArg("-dposhistory", DEFAULT_DPOSHISTORY);
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS) && !fBlockFilterIndex)
+        return InitError(_("-peerblockfilters requires -blockfilterindex."));
     fUseIrreversibleBlock = GetBoolArg("-useirreversibleblock", DEFAULT_USEIRREVERSIBLEBLOCK);
+    nIrreversibleSyncWindow = std::max(GetArg("-irreversiblesyncwindow", DEFAULT_IRREVERSIBLE_SYNC_WINDOW), (int64_t)0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - nDBFiles - MAX_ADDNODE_CONNECTIONS)), 0);
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + nDBFiles + MAX_ADDNODE_CONNECTIONS);
+    if (nFD < MIN_CORE_FILEDESCRIPTORS + nDBFiles)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
+    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - nDBFiles - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -960,6 +1107,7 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCheckpointSync = GetBoolArg("-checkpointsync", DEFAULT_CHECKPOINT_SYNC);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -972,6 +1120,10 @@ bool AppInitParameterInteraction()
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
     if (nMempoolSizeMax < 0 || nMempoolSizeMax < nMempoolSizeMin)
         return InitError(strprintf(_("-maxmempool must be at least %d MB"), std::ceil(nMempoolSizeMin / 1000000.0)));
+    int64_t nMaxMemoryGiB = GetArg("-maxmemory", DEFAULT_MAX_MEMORY_SIZE);
+    if (nMaxMemoryGiB < 0 || nMaxMemoryGiB > (int64_t)(std::numeric_limits<size_t>::max() >> 30))
+        return InitError(strprintf(_("Invalid -maxmemory: %d"), nMaxMemoryGiB));
+    nMaxMemoryUsage = (size_t)nMaxMemoryGiB << 30;
     // incremental relay fee sets the minimimum feerate increase necessary for BIP 125 replacement in the mempool
     // and the amount the mempool min fee increases above the feerate of txs evicted due to mempool limiting.
     if (IsArgSet("-incrementalrelayfee"))
@@ -982,6 +1134,16 @@ bool AppInitParameterInteraction()
         incrementalRelayFee = CFeeRate(n);
     }
 
+    nLockStatsSample = std::max(0, (int)GetArg("-lockstatssample", DEFAULT_LOCKSTATS_SAMPLE));
+
+    // Before the UTXO cache and the block index take their first chunks
+    if (GetBoolArg("-hugepages", DEFAULT_HUGE_PAGES)) {
+        CoinsCacheArena().SetHugePages(true);
+        BlockIndexArena().SetHugePages(true);
+    }
+    if (IsArgSet("-mallocarenas") && !SetMallocArenas(std::max(1, (int)GetArg("-mallocarenas", 0))))
+        InitWarning(_("-mallocarenas is not supported by the heap allocator and is ignored"));
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -991,6 +1153,19 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // Before the threads of each group start, they are pinned as they register
+    const std::pair<const char*, ThreadGroup> vThreadCpuArgs[] = {
+        {"-scriptcheckcpus", THREADGROUP_SCRIPTCHECK}, {"-rpccpus", THREADGROUP_HTTP}, {"-netcpus", THREADGROUP_NET}};
+    for (const auto& arg : vThreadCpuArgs) {
+        if (!IsArgSet(arg.first))
+            continue;
+        std::vector<int> vCpus;
+        if (!ParseCpuList(GetArg(arg.first, ""), vCpus))
+            return InitError(strprintf(_("Invalid list of CPUs for %s: '%s'"), arg.first, GetArg(arg.first, "")));
+        if (!SetThreadGroupCpus(arg.second, vCpus))
+            InitWarning(strprintf(_("%s is not supported on this system and is ignored"), arg.first));
+    }
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1009,6 +1184,11 @@ bool AppInitParameterInteraction()
         fPruneMode = true;
     }
 
+    // pre-allocation of the block and undo files, in MiB; larger chunks mean fewer, longer allocations
+    const int64_t nMaxChunkArg = MAX_BLOCKFILE_SIZE / 1024 / 1024;
+    nBlockFileChunkSize = std::min(std::max(GetArg("-blockfilechunksize", BLOCKFILE_CHUNK_SIZE / 1024 / 1024), (int64_t)1), nMaxChunkArg) * 1024 * 1024;
+    nUndoFileChunkSize = std::min(std::max(GetArg("-undofilechunksize", UNDOFILE_CHUNK_SIZE / 1024 / 1024), (int64_t)1), nMaxChunkArg) * 1024 * 1024;
+
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
     RegisterWalletRPCCommands(tableRPC);
@@ -1075,6 +1255,10 @@ bool AppInitParameterInteraction()
 
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    if (GetBoolArg("-peercompressedheaders", DEFAULT_PEERCOMPRESSEDHEADERS))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPRESSED_HEADERS);
 
     if (GetArg("-rpcserialversion", DEFAULT_RPC_SERIALIZE_VERSION) < 0)
         return InitError("rpcserialversion must be non-negative.");
@@ -1157,6 +1341,10 @@ bool AppInitSanityChecks()
 {
     // ********************************************************* Step 4: sanity checks
 
+    // Select the fastest SHA256 implementation the CPU supports
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1190,8 +1378,11 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         ShrinkDebugFile();
     }
 
-    if (fPrintToDebugLog)
+    if (fPrintToDebugLog) {
         OpenDebugLog();
+        if (GetBoolArg("-logasync", DEFAULT_LOGASYNC))
+            StartDebugLogWriter();
+    }
 
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
@@ -1201,16 +1392,29 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
     InitSignatureCache();
+    InitScriptExecutionCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadForgerCheck);
+            threadGroup.create_thread(&ThreadTxInputsCheck);
+            threadGroup.create_thread(&ThreadCoinFetch);
+        }
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads
+    int nSchedulerThreads = std::max(1, std::min((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), MAX_SCHEDULER_THREADS));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    g_scheduler = &scheduler;
+
+    // Notifications are queued from the wallet load on
+    int nNotifyThreads = std::max(1, std::min((int)GetArg("-notifythreads", DEFAULT_NOTIFY_THREADS), MAX_NOTIFY_THREADS));
+    pnotifier = new CNotifier(nNotifyThreads, GetArg("-notifypipe", ""));
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1243,7 +1447,17 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     peerLogic.reset(new PeerLogicValidation(&connman));
     RegisterValidationInterface(peerLogic.get());
+    int64_t nNetStatsInterval = GetArg("-netstatsinterval", DEFAULT_NETSTATS_INTERVAL);
+    if (nNetStatsInterval > 0)
+        scheduler.scheduleEvery(LogNetTimeStats, nNetStatsInterval, SCHEDULER_PRIORITY_LOW, "netstats");
+    // Verify the scripts of transactions from peers on as many threads as those of blocks, ahead of cs_main
+    if (nScriptCheckThreads) {
+        ptxprevalidator = new CTxPreValidator(nScriptCheckThreads,
+            PreCheckTransactions,
+            [&connman]() { connman.WakeMessageHandler(); });
+    }
     RegisterNodeSignals(GetNodeSignals());
+    GetMainSignals().RegisterWithMempoolSignals(mempool);
 
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
@@ -1376,7 +1590,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     pzmqNotificationInterface = CZMQNotificationInterface::Create();
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        // Publishing must not hold up block connection
+        RegisterValidationInterface(pzmqNotificationInterface, true);
     }
 #endif
     uint64_t nMaxOutboundLimit = 0; //unlimited unless -maxuploadtarget is set
@@ -1390,6 +1605,26 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
+    // A full or chainstate reindex replays the DPoS state along with the blocks
+    fReindexDPoS = GetBoolArg("-reindex-dpos", false) && !fReindex && !fReindexChainState;
+    if (fReindexDPoS && fPruneMode)
+        return InitError(_("-reindex-dpos needs the undo data of every block and is incompatible with pruning"));
+    // A snapshot leaves out the blocks before its last ones
+    std::string strLoadSnapshot = GetArg("-loadsnapshot", "");
+    uint256 hashLoadSnapshot;
+    if (!strLoadSnapshot.empty()) {
+        if (!fPruneMode)
+            return InitError(_("-loadsnapshot requires -prune"));
+        if (fReindex || fReindexChainState || fReindexDPoS)
+            return InitError(_("-loadsnapshot is incompatible with reindexing"));
+        // Nothing in a snapshot can be checked against the chain, so it is only trusted by its hash
+        std::string strHash = GetArg("-loadsnapshothash", "");
+        if (strHash.empty())
+            return InitError(_("-loadsnapshot requires -loadsnapshothash"));
+        if (!IsHex(strHash) || strHash.size() != 64)
+            return InitError(strprintf(_("Invalid -loadsnapshothash '%s'"), strHash));
+        hashLoadSnapshot = uint256S(strHash);
+    }
 
     // Upgrading to 0.8; hard-link the old blknnnn.dat files into /blocks/
     boost::filesystem::path blocksDir = GetDataDir() / "blocks";
@@ -1428,12 +1663,29 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
+    int64_t nVoteDBCache = std::min(nTotalCache / 8, nMaxVoteDBCache << 20);
+    nTotalCache -= nVoteDBCache;
+    int64_t nAddressIndexDBCache = fAddressIndex ? std::min(nTotalCache / 8, nMaxAddressIndexDBCache << 20) : 0;
+    nTotalCache -= nAddressIndexDBCache;
+    int64_t nBlockFilterDBCache = fBlockFilterIndex ? std::min(nTotalCache / 8, nMaxBlockFilterDBCache << 20) : 0;
+    nTotalCache -= nBlockFilterDBCache;
+    int64_t nDPoSHistoryDBCache = fDPoSHistory ? std::min(nTotalCache / 8, nMaxDPoSHistoryDBCache << 20) : 0;
+    nTotalCache -= nDPoSHistoryDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for vote database\n", nVoteDBCache * (1.0 / 1024 / 1024));
+    if (fAddressIndex)
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexDBCache * (1.0 / 1024 / 1024));
+    if (fBlockFilterIndex)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterDBCache * (1.0 / 1024 / 1024));
+    if (fDPoSHistory)
+        LogPrintf("* Using %.1fMiB for DPoS history database\n", nDPoSHistoryDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
+    if (nMaxMemoryUsage > 0)
+        LogPrintf("* Bounding the caches, mempool and block index to %.1fMiB together\n", nMaxMemoryUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1450,11 +1702,50 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete paddressindex;
+                delete pblockfilterdb;
+
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, blockIndexDBOptions);
+                paddressindex = fAddressIndex ? new CAddressIndexDB(nAddressIndexDBCache, false, fReindex || fReindexChainState, blockIndexDBOptions) : NULL;
+                pblockfilterdb = fBlockFilterIndex ? new CBlockFilterDB(nBlockFilterDBCache, false, fReindex) : NULL;
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState, chainStateDBOptions);
+
+                // Convert a per-transaction chainstate to the per-output one.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                if (GetBoolArg("-compactdb", false)) {
+                    uiInterface.InitMessage(_("Compacting databases..."));
+                    LogPrintf("Compacting the block index, chainstate and address index databases\n");
+                    int64_t nStart = GetTimeMillis();
+                    pblocktree->CompactFull();
+                    pcoinsdbview->CompactFull();
+                    if (paddressindex)
+                        paddressindex->CompactFull();
+                    LogPrintf("Compacted the databases in %dms\n", GetTimeMillis() - nStart);
+                }
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinscatcher, true);
+                Vote::GetInstance().OpenDB(nVoteDBCache, fReindex || fReindexChainState || fReindexDPoS);
+                delete pdposhistory;
+                pdposhistory = fDPoSHistory ? new CDPoSHistoryDB(nDPoSHistoryDBCache, false, fReindex || fReindexChainState || fReindexDPoS) : NULL;
+
+                if (!strLoadSnapshot.empty()) {
+                    int nLastBlockFile = 0;
+                    if (!pcoinsTip->GetBestBlock().IsNull() || pblocktree->ReadLastBlockFile(nLastBlockFile)) {
+                        LogPrintf("Ignoring -loadsnapshot, the data directory already has a chain\n");
+                    } else {
+                        uiInterface.InitMessage(_("Loading state snapshot..."));
+                        CStateSnapshotStats stats;
+                        std::string strError;
+                        if (!LoadStateSnapshot(chainparams, boost::filesystem::absolute(strLoadSnapshot, GetDataDir()), hashLoadSnapshot, stats, strError))
+                            return InitError(strprintf(_("Cannot load the state snapshot: %s. Remove the blocks, chainstate and dpos directories before trying again"), strError));
+                    }
+                    strLoadSnapshot.clear();
+                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1481,12 +1772,6 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 }
 
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1502,6 +1787,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
+                // Once, when the chainstate has no statistics of its best block yet
+                uiInterface.InitMessage(_("Loading the UTXO set statistics..."));
+                LoadUTXOStats();
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; only checking available blocks",
@@ -1521,7 +1810,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                if (!GetBoolArg("-checkblocksbackground", DEFAULT_CHECKBLOCKS_BACKGROUND) &&
+                    !CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
@@ -1621,7 +1911,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
 
-    if (IsArgSet("-blocknotify"))
+    if (IsArgSet("-blocknotify") || IsArgSet("-notifypipe"))
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
     std::vector<boost::filesystem::path> vImportFiles;
@@ -1631,6 +1921,24 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    // The indexes catch up with the chain in the background, and follow it
+    // while the blocks are imported.
+    if (fTxIndex) {
+        ptxindexer = new CTxIndexer(pblocktree);
+        if (!ptxindexer->Start())
+            return InitError(_("Error loading the transaction index, rebuild it using -reindex"));
+    }
+    if (fAddressIndex) {
+        paddressindexer = new CAddressIndexer(paddressindex);
+        if (!paddressindexer->Start())
+            return InitError(_("Error loading the address index, rebuild it using -reindex-chainstate"));
+    }
+    if (fBlockFilterIndex) {
+        pblockfilterindexer = new CBlockFilterIndexer(pblockfilterdb);
+        if (!pblockfilterindexer->Start())
+            return InitError(_("Error loading the block filter index, rebuild it using -reindex"));
+    }
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // Wait for genesis block to be processed
@@ -1667,10 +1975,24 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.nMessageHandlers = GetArg("-msghandlers", DEFAULT_MESSAGE_HANDLERS);
+    connOptions.nLatencyPeers = GetArg("-latencypeers", DEFAULT_LATENCY_PEERS);
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
 
+    if (mapMultiArgs.count("-delegatepeer")) {
+        for (const std::string& strPeer : mapMultiArgs.at("-delegatepeer")) {
+            size_t nPos = strPeer.find('@');
+            CKeyID keyid;
+            if (nPos == std::string::npos || nPos + 1 == strPeer.size() || !CBitcoinAddress(strPeer.substr(0, nPos)).GetKeyID(keyid))
+                return InitError(strprintf(_("Invalid -delegatepeer '%s', expected <address>@<ip>"), strPeer));
+            std::string strHost = strPeer.substr(nPos + 1);
+            AddDelegatePeer(keyid, strHost);
+            connman.AddNode(strHost);
+        }
+    }
+
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
 
@@ -17,6 +17,9 @@ namespace boost
 class thread_group;
 } // namespace boost
 
+/** The scheduler of the background tasks, set by AppInitMain until shutdown */
+extern CScheduler* g_scheduler;
+
 void StartShutdown();
 bool ShutdownRequested();
 /** Interrupt threads */
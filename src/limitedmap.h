@@ -7,6 +7,10 @@
 
 #include <assert.h>
 #include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
 
 /** STL-like map container that only keeps the N elements with the highest value. */
 template <typename K, typename V>
@@ -97,4 +101,156 @@ public:
     }
 };
 
+/**
+ * Map of at most N elements in one open addressing table, which drops the
+ * element set the longest ago to make room. For values that grow each time
+ * they are set, such as request times, that is the element of the lowest
+ * value limitedmap drops, without two tree nodes allocated per element and
+ * the pointer chasing of a lookup in them.
+ *
+ * Hasher must be salted where keys come from peers, as the probe sequences
+ * of colliding keys grow long.
+ */
+template <typename K, typename V, typename Hasher>
+class flatlimitedmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef size_t size_type;
+
+private:
+    struct Slot {
+        K key;
+        V value;
+        //! When the element was last set, 0 for an empty slot
+        uint64_t nSeq;
+
+        Slot() : nSeq(0) {}
+    };
+
+    //! A power of two in size, kept at most half full
+    std::vector<Slot> vSlots;
+    //! The elements in the order they were set, with those updated or erased since left in until compacted
+    std::vector<std::pair<K, uint64_t> > vOrder;
+    size_t nOrderBegin;
+    size_type nSize;
+    size_type nMaxSize;
+    uint64_t nNextSeq;
+    Hasher hasher;
+
+    size_t Mask() const { return vSlots.size() - 1; }
+
+    /** The slot of k, or the empty one its probe sequence ends at */
+    size_t FindSlot(const K& k) const
+    {
+        size_t i = hasher(k) & Mask();
+        while (vSlots[i].nSeq != 0 && !(vSlots[i].key == k))
+            i = (i + 1) & Mask();
+        return i;
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<Slot> vOld(nSlots);
+        vOld.swap(vSlots);
+        for (const Slot& slot : vOld)
+            if (slot.nSeq != 0)
+                vSlots[FindSlot(slot.key)] = slot;
+    }
+
+    /** Empty slot i, shifting back the elements after it that probed past it */
+    void EraseSlot(size_t i)
+    {
+        for (size_t j = (i + 1) & Mask(); vSlots[j].nSeq != 0; j = (j + 1) & Mask()) {
+            size_t nHome = hasher(vSlots[j].key) & Mask();
+            if (((j - nHome) & Mask()) >= ((j - i) & Mask())) {
+                vSlots[i] = vSlots[j];
+                i = j;
+            }
+        }
+        vSlots[i].nSeq = 0;
+        nSize--;
+    }
+
+    void EraseOldest()
+    {
+        while (nOrderBegin < vOrder.size()) {
+            const std::pair<K, uint64_t>& entry = vOrder[nOrderBegin++];
+            size_t i = FindSlot(entry.first);
+            if (vSlots[i].nSeq == entry.second) {
+                EraseSlot(i);
+                return;
+            }
+        }
+        // Shouldn't ever get here
+        assert(0);
+    }
+
+    /** Drop the order entries of elements updated or erased since, at most nMaxSize are left */
+    void CompactOrder()
+    {
+        std::vector<std::pair<K, uint64_t> > vLive;
+        vLive.reserve(nSize);
+        for (size_t n = nOrderBegin; n < vOrder.size(); n++)
+            if (vSlots[FindSlot(vOrder[n].first)].nSeq == vOrder[n].second)
+                vLive.push_back(vOrder[n]);
+        vOrder.swap(vLive);
+        nOrderBegin = 0;
+    }
+
+public:
+    flatlimitedmap(size_type nMaxSizeIn, const Hasher& hasherIn = Hasher()) : vSlots(16), nOrderBegin(0), nSize(0), nNextSeq(0), hasher(hasherIn)
+    {
+        assert(nMaxSizeIn > 0);
+        nMaxSize = nMaxSizeIn;
+    }
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    size_type max_size() const { return nMaxSize; }
+
+    /** The value of k, or nullptr */
+    const mapped_type* find(const key_type& k) const
+    {
+        const Slot& slot = vSlots[FindSlot(k)];
+        return slot.nSeq != 0 ? &slot.value : nullptr;
+    }
+    size_type count(const key_type& k) const { return find(k) != nullptr; }
+
+    /** Insert or update k, the element set the longest ago is dropped if the map was full */
+    void set(const key_type& k, const mapped_type& v)
+    {
+        size_t i = FindSlot(k);
+        if (vSlots[i].nSeq == 0) {
+            if (nSize == nMaxSize)
+                EraseOldest();
+            if ((nSize + 1) * 2 > vSlots.size())
+                Rehash(vSlots.size() * 2);
+            i = FindSlot(k);
+            vSlots[i].key = k;
+            nSize++;
+        }
+        vSlots[i].value = v;
+        vSlots[i].nSeq = ++nNextSeq;
+        vOrder.push_back(std::make_pair(k, nNextSeq));
+        if (vOrder.size() >= 2 * nMaxSize)
+            CompactOrder();
+    }
+
+    void erase(const key_type& k)
+    {
+        size_t i = FindSlot(k);
+        if (vSlots[i].nSeq != 0)
+            EraseSlot(i);
+    }
+
+    void clear()
+    {
+        std::vector<Slot>(16).swap(vSlots);
+        vOrder.clear();
+        nOrderBegin = 0;
+        nSize = 0;
+    }
+};
+
 #endif // BITCOIN_LIMITEDMAP_H
@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The map keeps its own reference to the file.
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const char*>(p), st.st_size));
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFileCache::Get(const boost::filesystem::path& path, size_t nMinSize)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, Entry>::iterator it = mapFiles.find(path.string());
+    if (it != mapFiles.end() && it->second.file->size() >= nMinSize) {
+        it->second.nLastUse = ++nUseCounter;
+        return it->second.file;
+    }
+
+    std::shared_ptr<const CMappedFile> file = CMappedFile::Open(path);
+    if (!file)
+        return nullptr;
+
+    if (it == mapFiles.end()) {
+        if (mapFiles.size() >= nMaxFiles) {
+            std::map<std::string, Entry>::iterator itOldest = mapFiles.begin();
+            for (std::map<std::string, Entry>::iterator itEntry = mapFiles.begin(); itEntry != mapFiles.end(); ++itEntry) {
+                if (itEntry->second.nLastUse < itOldest->second.nLastUse)
+                    itOldest = itEntry;
+            }
+            mapFiles.erase(itOldest);
+        }
+        it = mapFiles.insert(std::make_pair(path.string(), Entry())).first;
+    }
+    it->second.file = file;
+    it->second.nLastUse = ++nUseCounter;
+
+    if (file->size() < nMinSize)
+        return nullptr;
+    return file;
+}
+
+void CMappedFileCache::Erase(const boost::filesystem::path& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    mapFiles.erase(path.string());
+}
+
+size_t CMappedFileCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return mapFiles.size();
+}
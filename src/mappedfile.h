@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * A read-only memory map of a whole file. Reading from it is a copy out of
+ * the page cache, without the open, seek and stdio buffer of a CAutoFile.
+ * Data appended to the file later is only visible up to the size the file
+ * had when it was mapped.
+ */
+class CMappedFile
+{
+public:
+    ~CMappedFile();
+
+    /** Map the file at path. NULL if it is missing or empty, or where mapping is not supported. */
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+
+private:
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    const char* pdata;
+    size_t nSize;
+};
+
+/**
+ * The maps of the most recently read files, so most reads only cost a lookup.
+ * A file that grew since it was mapped is mapped again when a read needs more
+ * of it. Readers hold a reference to the map, so one that is dropped from the
+ * cache stays valid until the last of them is done.
+ */
+class CMappedFileCache
+{
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn), nUseCounter(0) {}
+
+    /** Map of the file at path covering at least its first nMinSize bytes, NULL if there is none */
+    std::shared_ptr<const CMappedFile> Get(const boost::filesystem::path& path, size_t nMinSize);
+
+    /** Drop the map of a file, before the file is deleted */
+    void Erase(const boost::filesystem::path& path);
+
+    /** Number of files mapped */
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const CMappedFile> file;
+        uint64_t nLastUse;
+    };
+
+    mutable std::mutex mutex;
+    const size_t nMaxFiles;
+    uint64_t nUseCounter;
+    std::map<std::string, Entry> mapFiles;
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
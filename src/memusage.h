@@ -6,6 +6,8 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "prevector.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -93,26 +95,29 @@ static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
     return MallocUsage(v.allocated_memory());
 }
 
-template<typename X, typename Y>
-static inline size_t DynamicUsage(const std::set<X, Y>& s)
+// Sets and maps whose nodes come from a PoolResource (see the mempool) are
+// counted per node like the others, so their usage drops as nodes are erased.
+
+template<typename X, typename Y, typename A>
+static inline size_t DynamicUsage(const std::set<X, Y, A>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
 }
 
-template<typename X, typename Y>
-static inline size_t IncrementalDynamicUsage(const std::set<X, Y>& s)
+template<typename X, typename Y, typename A>
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y, A>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>));
 }
 
-template<typename X, typename Y, typename Z>
-static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
+template<typename X, typename Y, typename Z, typename A>
+static inline size_t DynamicUsage(const std::map<X, Y, Z, A>& m)
 {
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
-template<typename X, typename Y, typename Z>
-static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
+template<typename X, typename Y, typename Z, typename A>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z, A>& m)
 {
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
@@ -167,6 +172,20 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/**
+ * The nodes of a map on a PoolResource live in the chunks of the resource, so
+ * count those chunks (and their bookkeeping) instead of estimating per node.
+ * Freed nodes stay in the chunks and are therefore still counted.
+ */
+template<typename X, typename Y, typename Z, typename P, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* resource = m.get_allocator().resource();
+    size_t usage_chunks = MallocUsage(resource->ChunkSizeBytes()) * resource->NumAllocatedChunks();
+    size_t usage_bookkeeping = MallocUsage(sizeof(void*) * resource->NumAllocatedChunks());
+    return usage_chunks + usage_bookkeeping + MallocUsage(sizeof(void*) * (m.bucket_count() + 1));
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
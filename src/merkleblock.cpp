@@ -179,3 +179,32 @@ uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::ve
         return uint256();
     return hashMerkleRoot;
 }
+
+CCoinbaseProof::CCoinbaseProof(const CBlock& block)
+{
+    header = block.GetBlockHeader();
+    coinbase = block.vtx[0];
+
+    std::vector<bool> vMatch(block.vtx.size(), false);
+    std::vector<uint256> vHashes;
+    vHashes.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx)
+        vHashes.push_back(tx->GetHash());
+    vMatch[0] = true;
+
+    txn = CPartialMerkleTree(vHashes, vMatch);
+}
+
+bool CCoinbaseProof::Verify() const
+{
+    if (!coinbase || !coinbase->IsCoinBase())
+        return false;
+
+    // ExtractMatches is not const
+    CPartialMerkleTree tree(txn);
+    std::vector<uint256> vMatch;
+    std::vector<unsigned int> vIndex;
+    if (tree.ExtractMatches(vMatch, vIndex) != header.hashMerkleRoot)
+        return false;
+    return vMatch.size() == 1 && vIndex[0] == 0 && vMatch[0] == coinbase->GetHash();
+}
@@ -154,4 +154,34 @@ public:
     }
 };
 
+/**
+ * The coinbase of a block with the partial merkle tree proving it is the
+ * first transaction of the block. A DPoS coinbase carries the signature of
+ * the block's forger, and the one of the first block of a round also lists
+ * the delegates of the round, which is all a light client needs to check
+ * the forgers of its headers.
+ */
+class CCoinbaseProof
+{
+public:
+    CBlockHeader header;
+    CTransactionRef coinbase;
+    CPartialMerkleTree txn;
+
+    explicit CCoinbaseProof(const CBlock& block);
+    CCoinbaseProof() {}
+
+    /** Whether txn proves coinbase to be the first transaction under the merkle root of header */
+    bool Verify() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(coinbase);
+        READWRITE(txn);
+    }
+};
+
 #endif // BITCOIN_MERKLEBLOCK_H
@@ -14,7 +14,9 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
 #include "hash.h"
+#include "merkleblock.h"
 #include "validation.h"
 #include "net.h"
 #include "policy/policy.h"
@@ -22,6 +24,8 @@
 #include "primitives/transaction.h"
 #include "script/standard.h"
 #include "timedata.h"
+#include "trace.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -35,11 +39,10 @@
 #include <algorithm>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <functional>
 #include <queue>
 #include <utility>
 
-typedef boost::shared_lock<boost::shared_mutex> read_lock;
-typedef boost::unique_lock<boost::shared_mutex> write_lock;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -660,30 +663,33 @@ void BlockAssembler::addPriorityTxs()
     bool fSizeAccounting = fNeedSizeAccounting;
     fNeedSizeAccounting = true;
 
-    // This vector will be sorted into a priority queue:
+    // Transactions come out of the mempool's priority index in order; only the
+    // children of transactions added meanwhile wait in this priority queue
     std::vector<TxCoinAgePriority> vecPriority;
     TxCoinAgePriorityCompare pricomparer;
     std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
     double actualPriority = -1;
 
-    vecPriority.reserve(mempool.mapTx.size());
-    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-         mi != mempool.mapTx.end(); ++mi)
-    {
-        double dPriority = mi->GetPriority(nHeight);
-        CAmount dummy;
-        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-    }
-    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+    mempool.UpdateMiningPriorities(nHeight);
+    typedef CTxMemPool::indexed_transaction_set::index<mining_priority>::type::iterator priorityIter;
+    priorityIter mi = mempool.mapTx.get<mining_priority>().begin();
+    priorityIter miEnd = mempool.mapTx.get<mining_priority>().end();
 
     CTxMemPool::txiter iter;
-    while (!vecPriority.empty() && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
-        iter = vecPriority.front().second;
-        actualPriority = vecPriority.front().first;
-        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-        vecPriority.pop_back();
+    while (!blockFinished) { // add a tx in priority order to fill the blockprioritysize
+        if (!vecPriority.empty() && (mi == miEnd || vecPriority.front().first >= mi->GetMiningPriority())) {
+            iter = vecPriority.front().second;
+            actualPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+        } else if (mi != miEnd) {
+            iter = mempool.mapTx.project<0>(mi);
+            actualPriority = mi->GetMiningPriority();
+            ++mi;
+        } else {
+            break;
+        }
 
         // If tx already in block, skip
         if (inBlock.count(iter)) {
@@ -728,6 +734,335 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+/** Milliseconds the candidate waits to batch the changes of the mempool */
+static const int64_t CANDIDATE_UPDATE_INTERVAL_MS = 100;
+/** Minimum milliseconds between two rebuilds of the candidate that are not for a new tip */
+static const int64_t CANDIDATE_REBUILD_INTERVAL_MS = 5000;
+/** Minimum milliseconds between two checks of the candidate */
+static const int64_t CANDIDATE_VALIDATE_INTERVAL_MS = 1000;
+
+CBlockCandidate::CBlockCandidate(const CChainParams& chainparamsIn)
+    : CBlockCandidate(chainparamsIn, BlockAssembler(chainparamsIn))
+{
+}
+
+CBlockCandidate::CBlockCandidate(const CChainParams& chainparamsIn, const BlockAssembler& assembler)
+    : chainparams(chainparamsIn), nBlockMaxWeight(assembler.GetBlockMaxWeight()), nBlockMaxSize(assembler.GetBlockMaxSize()),
+      fNeedSizeAccounting(assembler.NeedSizeAccounting()), blockMinFeeRate(assembler.GetBlockMinFeeRate()),
+      fTipChanged(true), fStop(false), nHeight(0), nLockTimeCutoff(0),
+      nBlockWeight(0), nBlockSize(0), nBlockSigOpsCost(0), nFees(0),
+      fNeedsRebuild(false), fValidated(false), nLastRebuild(0), nLastValidate(0)
+{
+}
+
+CBlockCandidate::~CBlockCandidate()
+{
+    Stop();
+}
+
+void CBlockCandidate::Start()
+{
+    RegisterValidationInterface(this);
+    threadUpdate = std::thread(&TraceThread<std::function<void()> >, "candidate", std::function<void()>(std::bind(&CBlockCandidate::ThreadUpdate, this)));
+}
+
+void CBlockCandidate::Stop()
+{
+    if (!threadUpdate.joinable())
+        return;
+
+    UnregisterValidationInterface(this);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    threadUpdate.join();
+}
+
+void CBlockCandidate::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fTipChanged = true;
+    }
+    cond.notify_all();
+}
+
+void CBlockCandidate::TransactionAddedToMempool(const CTransactionRef &ptx)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vPending.push_back(std::make_pair(ptx, true));
+    }
+    cond.notify_all();
+}
+
+void CBlockCandidate::TransactionRemovedFromMempool(const CTransactionRef &ptx)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vPending.push_back(std::make_pair(ptx, false));
+    }
+    cond.notify_all();
+}
+
+void CBlockCandidate::ThreadUpdate()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait_for(lock, std::chrono::milliseconds(CANDIDATE_VALIDATE_INTERVAL_MS), [this] { return fStop || fTipChanged || !vPending.empty(); });
+            if (fStop)
+                return;
+        }
+
+        {
+            LOCK2(cs_main, mempool.cs);
+            ApplyPending();
+            if (fNeedsRebuild && GetTimeMillis() - nLastRebuild >= CANDIDATE_REBUILD_INTERVAL_MS)
+                Rebuild();
+            if (!fValidated && GetTimeMillis() - nLastValidate >= CANDIDATE_VALIDATE_INTERVAL_MS)
+                Validate();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait_for(lock, std::chrono::milliseconds(CANDIDATE_UPDATE_INTERVAL_MS), [this] { return fStop; });
+        if (fStop)
+            return;
+    }
+}
+
+void CBlockCandidate::Rebuild()
+{
+    int64_t nTimeStart = GetTimeMicros();
+    nLastRebuild = GetTimeMillis();
+    fNeedsRebuild = false;
+    fValidated = false;
+
+    vEntries.clear();
+    setTxids.clear();
+    // Reserve space for the coinbase, as BlockAssembler does
+    nBlockSize = 1000;
+    nBlockWeight = 4000;
+    nBlockSigOpsCost = 400;
+    nFees = 0;
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    hashPrevBlock = pindexPrev->GetBlockHash();
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : GetTime();
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(CScript() << OP_TRUE, CScript() << OP_RETURN, GetTime());
+    if (!pblocktemplate) {
+        // Try again later rather than forging from a candidate that may be invalid
+        fNeedsRebuild = true;
+        return;
+    }
+
+    const CBlock& block = pblocktemplate->block;
+    vEntries.reserve(block.vtx.size() - 1);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        Entry entry;
+        entry.tx = block.vtx[i];
+        entry.nFee = pblocktemplate->vTxFees[i];
+        entry.nSigOpsCost = pblocktemplate->vTxSigOpsCost[i];
+        entry.nWeight = GetTransactionWeight(*entry.tx);
+        entry.nSize = ::GetSerializeSize(*entry.tx, SER_NETWORK, PROTOCOL_VERSION);
+        nBlockWeight += entry.nWeight;
+        nBlockSize += entry.nSize;
+        nBlockSigOpsCost += entry.nSigOpsCost;
+        nFees += entry.nFee;
+        setTxids.insert(entry.tx->GetHash());
+        vEntries.push_back(entry);
+    }
+    fValidated = true;
+    nLastValidate = nLastRebuild;
+
+    LogPrint("bench", "CBlockCandidate: rebuilt at height %d with %u txs: %.2fms\n", nHeight, vEntries.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void CBlockCandidate::ApplyPending()
+{
+    std::vector<std::pair<CTransactionRef, bool> > vChanges;
+    bool fNewTip;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vChanges.swap(vPending);
+        fNewTip = fTipChanged;
+        fTipChanged = false;
+    }
+
+    if (fNewTip || hashPrevBlock != chainActive.Tip()->GetBlockHash()) {
+        Rebuild();
+        return;
+    }
+
+    std::set<uint256> setRemoved;
+    for (const std::pair<CTransactionRef, bool>& change : vChanges) {
+        const uint256& txid = change.first->GetHash();
+        if (!change.second) {
+            // A transaction added back later is still in the mempool
+            if (setTxids.count(txid) && !mempool.exists(txid))
+                setRemoved.insert(txid);
+        } else if (!setTxids.count(txid) && !Append(change.first)) {
+            fNeedsRebuild = true;
+        }
+    }
+
+    if (setRemoved.empty())
+        return;
+
+    std::vector<Entry> vKept;
+    vKept.reserve(vEntries.size());
+    for (const Entry& entry : vEntries) {
+        if (!setRemoved.count(entry.tx->GetHash())) {
+            vKept.push_back(entry);
+            continue;
+        }
+        nBlockWeight -= entry.nWeight;
+        nBlockSize -= entry.nSize;
+        nBlockSigOpsCost -= entry.nSigOpsCost;
+        nFees -= entry.nFee;
+        setTxids.erase(entry.tx->GetHash());
+    }
+    vEntries.swap(vKept);
+    fValidated = false;
+    // The space freed may fit transactions that were left out
+    fNeedsRebuild = true;
+}
+
+bool CBlockCandidate::Append(const CTransactionRef& ptx)
+{
+    CTxMemPool::txiter it = mempool.mapTx.find(ptx->GetHash());
+    if (it == mempool.mapTx.end())
+        return true;
+
+    // Transactions a rebuild would leave out too
+    const CTransaction& tx = it->GetTx();
+    if (tx.HasWitness() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
+        return true;
+    if (CFeeRate(it->GetModifiedFee(), it->GetTxSize()) < blockMinFeeRate)
+        return true;
+
+    // Parents have to come first; a rebuild may include them as a package
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mempool.exists(txin.prevout.hash) && !setTxids.count(txin.prevout.hash))
+            return false;
+    }
+
+    Entry entry;
+    entry.tx = it->GetSharedTx();
+    entry.nFee = it->GetFee();
+    entry.nSigOpsCost = it->GetSigOpCost();
+    entry.nWeight = it->GetTxWeight();
+    entry.nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    if (nBlockWeight + entry.nWeight >= nBlockMaxWeight)
+        return false;
+    if (nBlockSigOpsCost + entry.nSigOpsCost >= MAX_BLOCK_SIGOPS_COST)
+        return false;
+    if (fNeedSizeAccounting && nBlockSize + entry.nSize >= nBlockMaxSize)
+        return false;
+
+    nBlockWeight += entry.nWeight;
+    nBlockSize += entry.nSize;
+    nBlockSigOpsCost += entry.nSigOpsCost;
+    nFees += entry.nFee;
+    setTxids.insert(entry.tx->GetHash());
+    vEntries.push_back(entry);
+    fValidated = false;
+    return true;
+}
+
+void CBlockCandidate::Validate()
+{
+    nLastValidate = GetTimeMillis();
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlockTemplate blocktemplate;
+    FillBlock(blocktemplate, pindexPrev, CScript() << OP_TRUE, CScript() << OP_RETURN, GetTime());
+
+    CValidationState state;
+    fValidated = TestBlockValidity(state, chainparams, blocktemplate.block, pindexPrev, false, false);
+    if (!fValidated) {
+        LogPrintf("CBlockCandidate: TestBlockValidity failed, rebuilding: %s\n", FormatStateMessage(state));
+        Rebuild();
+    }
+}
+
+void CBlockCandidate::FillBlock(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn, const CScript& opReturn, time_t t) const
+{
+    CBlock& block = blocktemplate.block;
+    block.nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (chainparams.MineBlocksOnDemand())
+        block.nVersion = GetArg("-blockversion", block.nVersion);
+
+    // Create coinbase transaction, as BlockAssembler does for a delegate
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(2);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbaseTx.vout[1].nValue = 0;
+    coinbaseTx.vout[1].scriptPubKey = opReturn;
+
+    block.vtx.reserve(vEntries.size() + 1);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbaseTx)));
+    blocktemplate.vTxFees.push_back(-nFees);
+    blocktemplate.vTxSigOpsCost.push_back(WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*block.vtx[0]));
+    for (const Entry& entry : vEntries) {
+        block.vtx.push_back(entry.tx);
+        blocktemplate.vTxFees.push_back(entry.nFee);
+        blocktemplate.vTxSigOpsCost.push_back(entry.nSigOpsCost);
+    }
+
+    // Fill in header
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = t;
+    block.nBits = GetNextWorkRequired(pindexPrev, &block, chainparams.GetConsensus());
+    block.nNonce = 0;
+}
+
+std::unique_ptr<CBlockTemplate> CBlockCandidate::CreateNewBlock(const CScript& scriptPubKeyIn, const CScript& opReturn, time_t t)
+{
+    AssertLockHeld(cs_main);
+    int64_t nTimeStart = GetTimeMicros();
+
+    LOCK(mempool.cs);
+    // Picks up the last changes of the mempool, and rebuilds if the tip moved
+    ApplyPending();
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    FillBlock(*pblocktemplate, pindexPrev, scriptPubKeyIn, opReturn, t);
+
+    bool fChecked = !fValidated;
+    if (!fValidated) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, pblocktemplate->block, pindexPrev, false, false)) {
+            LogPrintf("CBlockCandidate: TestBlockValidity failed: %s\n", FormatStateMessage(state));
+            fNeedsRebuild = true;
+            return BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn, opReturn, t);
+        }
+        fValidated = true;
+    }
+
+    nLastBlockTx = vEntries.size();
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
+
+    int64_t nFinalizeTime = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "CreateNewBlock() finalize: %.2fms (%u txs, fees: %ld, validity %s)\n", 0.001 * nFinalizeTime, vEntries.size(), nFees, fChecked ? "checked" : "cached");
+    TRACE5(miner, block_assembled, nHeight, (uint64_t)vEntries.size(), nFees, fChecked, nFinalizeTime);
+
+    return pblocktemplate;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -752,12 +1087,13 @@ static DPoS *gpDPoS = NULL;
 
 DPoS::~DPoS()
 {
-	WriteIrreversibleBlockInfo(cIrreversibleBlockInfo);
+	if(fileIrreversibleBlockJournal) {
+		fclose(fileIrreversibleBlockJournal);
+	}
 }
 
 void DPoS::Init()
 {
-    nMaxMemory = GetArg("-maxmemory", DEFAULT_MAX_MEMORY_SIZE);
     if(Params().NetworkIDString() == "main") {
         cSuperForgerAddress = CBitcoinAddress("166D9UoFdPcDEGFngswE226zigS8uBnm3C");
         gDPoS.nDposStartTime = 1539181795;
@@ -774,7 +1110,10 @@ void DPoS::Init()
         nDposStartHeight = 7000;
     }
 
+    cSuperForgerAddress.GetKeyID(cSuperForgerKeyID);
+
 	strIrreversibleBlockFileName = (GetDataDir() / "dpos" / "irreversible_block.dat").string();
+	strIrreversibleBlockJournalName = (GetDataDir() / "dpos" / "irreversible_block.log").string();
 	ReadIrreversibleBlockInfo(cIrreversibleBlockInfo);
    
     if(chainActive.Height() >= nDposStartHeight - 1) {
@@ -792,20 +1131,18 @@ DPoS& DPoS::GetInstance()
     return gDPoS;
 }
 
-bool DPoS::IsMining(DelegateInfo& cDelegateInfo, const CBitcoinAddress& cAddress, time_t t)
+bool DPoS::GetSlotDelegate(DelegateInfo& cDelegateInfo, CKeyID& keyid, time_t t)
 {
     CBlockIndex* pBlockIndex = chainActive.Tip();
+
     if(pBlockIndex->nHeight < nDposStartHeight - 1) {
-        if(cAddress == cSuperForgerAddress) {
-            static time_t tLast = 0;
-            if(t < tLast + nBlockIntervalTime) {
-                return false;
-            } else {
-                tLast = t;
-                return true;
-            }
-        } else {
+        static time_t tLast = 0;
+        if(t < tLast + nBlockIntervalTime) {
             return false;
+        } else {
+            tLast = t;
+            keyid = cSuperForgerKeyID;
+            return true;
         }
     }
 
@@ -814,44 +1151,21 @@ bool DPoS::IsMining(DelegateInfo& cDelegateInfo, const CBitcoinAddress& cAddress
     uint64_t nPrevLoopIndex = GetLoopIndex(pBlockIndex->nTime);
     uint32_t nPrevDelegateIndex = GetDelegateIndex(pBlockIndex->nTime);
 
-    CKeyID keyid;
-    if(cAddress.GetKeyID(keyid) == false) {
-        LogPrintf("IsMining: GetKeyID failed");
-        return false;
-    }
-
-    if(pBlockIndex->nHeight == nDposStartHeight - 1) {
+    if(pBlockIndex->nHeight == nDposStartHeight - 1 || nCurrentLoopIndex > nPrevLoopIndex) {
         cDelegateInfo = DPoS::GetNextDelegates(t);
-        if(cDelegateInfo.delegates[nCurrentDelegateIndex].keyid == keyid) {
-            return true;
-        } else {
-            return false;
-        }
-    }
-
-    if(nCurrentLoopIndex > nPrevLoopIndex) {
-        cDelegateInfo = DPoS::GetNextDelegates(t);
-        if(cDelegateInfo.delegates[nCurrentDelegateIndex].keyid == keyid) {
-            return true;
-        } else {
+        if(nCurrentDelegateIndex + 1 > cDelegateInfo.delegates.size()) {
             return false;
         }
+        keyid = cDelegateInfo.delegates[nCurrentDelegateIndex].keyid;
+        return true;
     } else if(nCurrentLoopIndex == nPrevLoopIndex && nCurrentDelegateIndex > nPrevDelegateIndex) {
         DelegateInfo cCurrentDelegateInfo;
-        if(GetBlockDelegates(cCurrentDelegateInfo, pBlockIndex)) {
-            if(nCurrentDelegateIndex + 1 > cCurrentDelegateInfo.delegates.size()) {
-                return false;
-            } else if(cCurrentDelegateInfo.delegates[nCurrentDelegateIndex].keyid == keyid) {
-                //cDelegateInfo.delegates.clear();
-                return true;
-            } else {
-                return false;
-            }
-        } else {
+        if(GetBlockDelegates(cCurrentDelegateInfo, pBlockIndex) == false
+            || nCurrentDelegateIndex + 1 > cCurrentDelegateInfo.delegates.size()) {
             return false;
         }
-    } else {
-        return false;
+        keyid = cCurrentDelegateInfo.delegates[nCurrentDelegateIndex].keyid;
+        return true;
     }
 
     return false;
@@ -859,6 +1173,17 @@ bool DPoS::IsMining(DelegateInfo& cDelegateInfo, const CBitcoinAddress& cAddress
 
 DelegateInfo DPoS::GetNextDelegates(int64_t t)
 {
+    uint64_t nGeneration = Vote::GetInstance().GetStateGeneration();
+    {
+        std::lock_guard<std::mutex> lock(mutexNextDelegates);
+        if(nGeneration == nNextDelegatesGeneration) {
+            auto it = mapNextDelegates.find(t);
+            if(it != mapNextDelegates.end()) {
+                return it->second;
+            }
+        }
+    }
+
     uint64_t nMinHoldBalance = 500000000000;
 
     std::vector<Delegate> delegates = Vote::GetInstance().GetTopDelegateInfo(nMinHoldBalance, nMaxDelegateNumber - 1);
@@ -878,47 +1203,65 @@ DelegateInfo DPoS::GetNextDelegates(int64_t t)
     DelegateInfo cDelegateInfo;
     cDelegateInfo.delegates = SortDelegate(delegates, t);
 
-    return cDelegateInfo;
-}
-
-std::vector<char> GetRand(unsigned num, unsigned int seed)
-{
-    std::vector<char> r;
-    std::vector<char> s(num, -1);
-
-    while(r.size() < num) {
-        uint64_t v;
-        v = rand_r(&seed);
-        v %= num;
-        if(s[v] < 0) {
-            s[v] = 1;
-            r.push_back(v);
+    // Only kept if no block changed the votes meanwhile
+    if(Vote::GetInstance().GetStateGeneration() == nGeneration) {
+        std::lock_guard<std::mutex> lock(mutexNextDelegates);
+        if(nGeneration != nNextDelegatesGeneration) {
+            mapNextDelegates.clear();
+            nNextDelegatesGeneration = nGeneration;
+        }
+        if(mapNextDelegates.size() < nMaxCachedNextDelegates) {
+            mapNextDelegates[t] = cDelegateInfo;
         }
     }
 
-    return r;
+    return cDelegateInfo;
 }
 
 std::vector<Delegate> DPoS::SortDelegate(const std::vector<Delegate>& delegates, uint64_t t)
 {
+    // The delegates in the order rand_r draws their indexes, skipping the ones drawn before
     std::vector<Delegate> result;
+    result.reserve(delegates.size());
+    std::vector<bool> vDrawn(delegates.size(), false);
     unsigned int seed = (unsigned int)t;
-    std::vector<char>&& r = GetRand(delegates.size(), seed);
-    for(auto& i : r) {
-        result.push_back(delegates[i]);
+    while(result.size() < delegates.size()) {
+        uint64_t v = rand_r(&seed);
+        v %= delegates.size();
+        if(vDrawn[v] == false) {
+            vDrawn[v] = true;
+            result.push_back(delegates[v]);
+        }
     }
     return result;
 }
 
-bool DPoS::GetBlockDelegates(DelegateInfo& cDelegateInfo, CBlockIndex* pBlockIndex)
+bool DPoS::GetBlockDelegates(DelegateInfo& cDelegateInfo, const CBlockIndex* pBlockIndex)
 {
     bool ret = false;
     uint64_t nLoopIndex = GetLoopIndex(pBlockIndex->nTime);
     while(pBlockIndex) {
         if(pBlockIndex->nHeight == nDposStartHeight || GetLoopIndex(pBlockIndex->pprev->nTime) < nLoopIndex) {
+            if(pBlockIndex->phashBlock && FindRoundDelegates(cDelegateInfo, nLoopIndex, pBlockIndex->GetBlockHash())) {
+                ret = true;
+                break;
+            }
+
             CBlock block;
-            if(ReadBlockFromDisk(block, pBlockIndex, Params().GetConsensus())) {
-                ret = GetBlockDelegate(cDelegateInfo, block);
+            if(pBlockIndex->nStatus & BLOCK_HAVE_DATA) {
+                ret = ReadBlockFromDisk(block, pBlockIndex, Params().GetConsensus());
+            } else {
+                // Pruned, its coinbase was kept aside
+                CTransactionRef coinbase;
+                ret = pblocktree->ReadRoundCoinbase(pBlockIndex->GetBlockHash(), coinbase);
+                if(ret) {
+                    block = pBlockIndex->GetBlockHeader();
+                    block.vtx.push_back(coinbase);
+                }
+            }
+            ret = ret && GetBlockDelegate(cDelegateInfo, block);
+            if(ret) {
+                AddRoundDelegates(nLoopIndex, pBlockIndex->GetBlockHash(), cDelegateInfo);
             }
             break;
         }
@@ -929,6 +1272,195 @@ bool DPoS::GetBlockDelegates(DelegateInfo& cDelegateInfo, CBlockIndex* pBlockInd
     return ret;
 }
 
+void DPoS::GetDelegateSlotStats(CBlockIndex* pindexTip, int nBlocks, std::map<CKeyID, CDelegateSlotStats>& mapStats)
+{
+    AssertLockHeld(cs_main);
+    int nMinHeight = std::max(nDposStartHeight + 1, pindexTip->nHeight - nBlocks + 1);
+
+    // The schedule of each round, by loop index, so it is looked up once per round
+    std::map<uint64_t, DelegateInfo> mapSchedules;
+    auto GetSchedule = [this, &mapSchedules](CBlockIndex* pBlockIndex) -> const DelegateInfo* {
+        uint64_t nLoopIndex = GetLoopIndex(pBlockIndex->nTime);
+        auto it = mapSchedules.find(nLoopIndex);
+        if(it == mapSchedules.end()) {
+            DelegateInfo cDelegateInfo;
+            if(GetBlockDelegates(cDelegateInfo, pBlockIndex) == false) {
+                return NULL;
+            }
+            it = mapSchedules.insert(std::make_pair(nLoopIndex, cDelegateInfo)).first;
+        }
+        return &it->second;
+    };
+    auto CountMissed = [&mapStats](const DelegateInfo* pSchedule, uint32_t nFrom, uint32_t nTo) {
+        for(uint32_t i = nFrom; i < nTo && i < pSchedule->delegates.size(); ++i) {
+            mapStats[pSchedule->delegates[i].keyid].nMissed++;
+        }
+    };
+
+    for(CBlockIndex* pBlockIndex = pindexTip; pBlockIndex && pBlockIndex->nHeight >= nMinHeight; pBlockIndex = pBlockIndex->pprev) {
+        const DelegateInfo* pSchedule = GetSchedule(pBlockIndex);
+        if(pSchedule == NULL) {
+            continue;
+        }
+
+        uint64_t nLoopIndex = GetLoopIndex(pBlockIndex->nTime);
+        uint32_t nDelegateIndex = GetDelegateIndex(pBlockIndex->nTime);
+        uint64_t nPrevLoopIndex = GetLoopIndex(pBlockIndex->pprev->nTime);
+        uint32_t nPrevDelegateIndex = GetDelegateIndex(pBlockIndex->pprev->nTime);
+        if(nDelegateIndex < pSchedule->delegates.size()) {
+            mapStats[pSchedule->delegates[nDelegateIndex].keyid].nProduced++;
+        }
+
+        if(nLoopIndex == nPrevLoopIndex) {
+            CountMissed(pSchedule, nPrevDelegateIndex + 1, nDelegateIndex);
+        } else {
+            CountMissed(pSchedule, 0, nDelegateIndex);
+            // The rest of the previous round; rounds without any block have no schedule on the chain
+            if(nLoopIndex == nPrevLoopIndex + 1 && pBlockIndex->pprev->nHeight > nDposStartHeight) {
+                const DelegateInfo* pPrevSchedule = GetSchedule(pBlockIndex->pprev);
+                if(pPrevSchedule) {
+                    CountMissed(pPrevSchedule, nPrevDelegateIndex + 1, pPrevSchedule->delegates.size());
+                }
+            }
+        }
+    }
+
+    for(const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
+        CBlockIndex* pBlockIndex = item.second;
+        if(pBlockIndex->nHeight < nMinHeight || pBlockIndex->nHeight > pindexTip->nHeight ||
+           chainActive.Contains(pBlockIndex) || !(pBlockIndex->nStatus & BLOCK_HAVE_DATA)) {
+            continue;
+        }
+
+        CBlock block;
+        CKeyID keyid;
+        if(ReadBlockFromDisk(block, pBlockIndex, Params().GetConsensus()) && GetBlockForgerKeyID(keyid, block)) {
+            mapStats[keyid].nOrphaned++;
+        }
+    }
+}
+
+std::vector<int> DPoS::GetForgedHeights(const CKeyID& keyid, int nStartHeight, int nEndHeight)
+{
+    AssertLockHeld(cs_main);
+    std::vector<int> vHeight;
+    nStartHeight = std::max(nDposStartHeight + 1, nStartHeight);
+    nEndHeight = std::min(chainActive.Height(), nEndHeight);
+
+    // The blocks of a round are consecutive, so the schedule of the last one is all it keeps
+    uint64_t nScheduleLoopIndex = 0;
+    DelegateInfo cSchedule;
+    bool fHaveSchedule = false;
+    for(int nHeight = nStartHeight; nHeight <= nEndHeight; ++nHeight) {
+        CBlockIndex* pBlockIndex = chainActive[nHeight];
+        uint64_t nLoopIndex = GetLoopIndex(pBlockIndex->nTime);
+        if(nHeight == nStartHeight || nLoopIndex != nScheduleLoopIndex) {
+            fHaveSchedule = GetBlockDelegates(cSchedule, pBlockIndex);
+            nScheduleLoopIndex = nLoopIndex;
+        }
+        if(!fHaveSchedule) {
+            continue;
+        }
+
+        uint32_t nDelegateIndex = GetDelegateIndex(pBlockIndex->nTime);
+        if(nDelegateIndex < cSchedule.delegates.size() && cSchedule.delegates[nDelegateIndex].keyid == keyid) {
+            vHeight.push_back(nHeight);
+        }
+    }
+    return vHeight;
+}
+
+bool DPoS::GetRoundProof(const CBlockIndex* pBlockIndex, std::vector<CCoinbaseProof>& vProof)
+{
+    AssertLockHeld(cs_main);
+    if(pBlockIndex->nHeight < nDposStartHeight) {
+        return false;
+    }
+
+    std::vector<const CBlockIndex*> vIndex;
+    uint64_t nLoopIndex = GetLoopIndex(pBlockIndex->nTime);
+    while(true) {
+        vIndex.push_back(pBlockIndex);
+        if(pBlockIndex->nHeight == nDposStartHeight || GetLoopIndex(pBlockIndex->pprev->nTime) < nLoopIndex) {
+            break;
+        }
+        pBlockIndex = pBlockIndex->pprev;
+    }
+
+    vProof.clear();
+    vProof.reserve(vIndex.size());
+    for(auto it = vIndex.rbegin(); it != vIndex.rend(); ++it) {
+        CBlock block;
+        if(((*it)->nStatus & BLOCK_HAVE_DATA) == 0 || ReadBlockFromDisk(block, *it, Params().GetConsensus()) == false) {
+            return false;
+        }
+        vProof.push_back(CCoinbaseProof(block));
+    }
+
+    return true;
+}
+
+bool DPoS::VerifyRoundProof(const std::vector<CCoinbaseProof>& vProof, DelegateInfo& cDelegateInfo, std::string& strError)
+{
+    if(vProof.empty()) {
+        strError = "No blocks";
+        return false;
+    }
+
+    uint64_t nLoopIndex = GetLoopIndex(vProof[0].header.nTime);
+    for(size_t i = 0; i < vProof.size(); ++i) {
+        const CCoinbaseProof& proof = vProof[i];
+        uint256 hash = proof.header.GetHash();
+        if(proof.Verify() == false) {
+            strError = strprintf("The coinbase of block %s is not proven", hash.ToString());
+            return false;
+        }
+        uint32_t nDelegateIndex = GetDelegateIndex(proof.header.nTime);
+        if(GetLoopIndex(proof.header.nTime) != nLoopIndex
+            || (i > 0 && (proof.header.hashPrevBlock != vProof[i - 1].header.GetHash() || nDelegateIndex <= GetDelegateIndex(vProof[i - 1].header.nTime)))) {
+            strError = strprintf("Block %s does not follow the one before it in the round", hash.ToString());
+            return false;
+        }
+
+        CBlock block(proof.header);
+        block.vtx.push_back(proof.coinbase);
+        if(i == 0 && GetBlockDelegate(cDelegateInfo, block) == false) {
+            strError = strprintf("Block %s does not list the delegates of a round", hash.ToString());
+            return false;
+        }
+
+        CKeyID keyid;
+        if(CheckCoinbase(*proof.coinbase, proof.header.nTime) == false || GetBlockForgerKeyID(keyid, block) == false
+            || nDelegateIndex >= cDelegateInfo.delegates.size() || cDelegateInfo.delegates[nDelegateIndex].keyid != keyid) {
+            strError = strprintf("Block %s is not signed by the delegate of its slot", hash.ToString());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DPoS::FindRoundDelegates(DelegateInfo& cDelegateInfo, uint64_t nLoopIndex, const uint256& hash)
+{
+    READ_LOCK(lockRoundDelegates);
+    auto it = mapRoundDelegates.find(std::make_pair(nLoopIndex, hash));
+    if(it == mapRoundDelegates.end()) {
+        return false;
+    }
+
+    cDelegateInfo = it->second;
+    return true;
+}
+
+void DPoS::AddRoundDelegates(uint64_t nLoopIndex, const uint256& hash, const DelegateInfo& cDelegateInfo)
+{
+    WRITE_LOCK(lockRoundDelegates);
+    mapRoundDelegates[std::make_pair(nLoopIndex, hash)] = cDelegateInfo;
+    while(mapRoundDelegates.size() > nMaxCachedRounds) {
+        mapRoundDelegates.erase(mapRoundDelegates.begin());
+    }
+}
+
 bool DPoS::GetBlockDelegates(DelegateInfo& cDelegateInfo, const CBlock& block)
 {
     CBlockIndex blockindex;
@@ -942,6 +1474,12 @@ bool DPoS::GetBlockDelegates(DelegateInfo& cDelegateInfo, const CBlock& block)
     return GetBlockDelegates(cDelegateInfo, &blockindex);
 }
 
+bool DPoS::IsRoundStart(const CBlockIndex* pBlockIndex)
+{
+    return pBlockIndex->nHeight == nDposStartHeight
+        || (pBlockIndex->nHeight > nDposStartHeight && GetLoopIndex(pBlockIndex->pprev->nTime) < GetLoopIndex(pBlockIndex->nTime));
+}
+
 uint64_t DPoS::GetLoopIndex(uint64_t time)
 {
     if(time < nDposStartTime) {
@@ -960,7 +1498,46 @@ uint32_t DPoS::GetDelegateIndex(uint64_t time)
     }
 }
 
-bool DPoS::CheckCoinbase(const CTransaction& tx, time_t t, int64_t height)
+int64_t DPoS::GetNextSlotTime(int64_t t)
+{
+    if(nDposStartTime == 0 || t < (int64_t)nDposStartTime) {
+        return t + 1;
+    } else {
+        return nDposStartTime + ((t - nDposStartTime) / nBlockIntervalTime + 1) * nBlockIntervalTime;
+    }
+}
+
+int64_t DPoS::GetSlotTime(uint64_t nLoopIndex, uint32_t nDelegateIndex)
+{
+    return nDposStartTime + (nLoopIndex * nMaxDelegateNumber + nDelegateIndex) * nBlockIntervalTime;
+}
+
+std::vector<CKeyID> DPoS::GetNextSlotDelegates(CBlockIndex* pBlockIndex, const CBlock& block, int nCount)
+{
+    std::vector<CKeyID> vKeyIDs;
+    if(pBlockIndex->nHeight < nDposStartHeight) {
+        return vKeyIDs;
+    }
+
+    DelegateInfo cDelegateInfo;
+    bool fHaveDelegates;
+    if(pBlockIndex->nHeight == nDposStartHeight || GetLoopIndex(pBlockIndex->pprev->nTime) < GetLoopIndex(pBlockIndex->nTime)) {
+        // The first block of a round is relayed before it is written to disk, so take the schedule from its coinbase
+        fHaveDelegates = GetBlockDelegate(cDelegateInfo, block);
+    } else {
+        fHaveDelegates = GetBlockDelegates(cDelegateInfo, pBlockIndex->pprev);
+    }
+    if(fHaveDelegates == false) {
+        return vKeyIDs;
+    }
+
+    for(uint32_t i = GetDelegateIndex(pBlockIndex->nTime) + 1; i < cDelegateInfo.delegates.size() && vKeyIDs.size() < (size_t)nCount; ++i) {
+        vKeyIDs.push_back(cDelegateInfo.delegates[i].keyid);
+    }
+    return vKeyIDs;
+}
+
+bool DPoS::CheckCoinbase(const CTransaction& tx, time_t t)
 {
     bool ret = false;
     if(tx.vout.size() == 2) {
@@ -981,13 +1558,16 @@ bool DPoS::CheckCoinbase(const CTransaction& tx, time_t t, int64_t height)
 //OP_RETURN PUBKEY SIG(t) DELEGATE_IDS
 CScript DPoS::DelegateInfoToScript(const DelegateInfo& cDelegateInfo, const CKey& delegatekey, uint64_t t)
 {
-    const std::vector<Delegate>& delegates = cDelegateInfo.delegates;
+    return DelegateInfoToScript(cDelegateInfo, delegatekey.GetPubKey(), SignSlot(delegatekey, t));
+}
 
-    int nDataLen = 1 + delegates.size() * 20;
-    std::vector<unsigned char> data;
+CScript DPoS::DelegateInfoToScript(const DelegateInfo& cDelegateInfo, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig)
+{
+    const std::vector<Delegate>& delegates = cDelegateInfo.delegates;
 
-    if(cDelegateInfo.delegates.empty() == false) {
-        data.resize(nDataLen);
+    CScript script;
+    if(delegates.empty() == false) {
+        std::vector<unsigned char> data(1 + delegates.size() * 20);
         data[0] = 0x7;
 
         unsigned char* pData = &data[1];
@@ -995,19 +1575,32 @@ CScript DPoS::DelegateInfoToScript(const DelegateInfo& cDelegateInfo, const CKey
             memcpy(pData, delegates[i].keyid.begin(), 20);
             pData += 20;
         }
+        script << OP_RETURN << ToByteVector(pubkey) << vchSig << data;
+    } else {
+        script << OP_RETURN << ToByteVector(pubkey) << vchSig;
     }
+    return script;
+}
 
+std::vector<unsigned char> DPoS::SignSlot(const CKey& delegatekey, uint64_t t)
+{
     std::vector<unsigned char> vchSig;
     std::string ts = std::to_string(t);
     delegatekey.Sign(Hash(ts.begin(), ts.end()), vchSig);
+    return vchSig;
+}
 
-    CScript script;
-    if(cDelegateInfo.delegates.empty() == false) {
-        script << OP_RETURN << ToByteVector(delegatekey.GetPubKey()) << vchSig << data;
-    } else {
-        script << OP_RETURN << ToByteVector(delegatekey.GetPubKey()) << vchSig;
-    }
-    return script;
+/** Slot signatures verified last, as the hash of their pubkey, slot time and signature */
+static const size_t MAX_CHECKED_SLOT_SIGNATURES = 1024;
+static CCriticalSection cs_checkedSlotSignatures;
+static std::set<uint256> setCheckedSlotSignatures;
+static std::deque<uint256> dequeCheckedSlotSignatures;
+
+static uint256 SlotSignatureHash(const CPubKey& pubkey, uint64_t t, const std::vector<unsigned char>& vchSig)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << pubkey << t << vchSig;
+    return ss.GetHash();
 }
 
 //OP_RETURN VECTOR<UNSIGNED CHAR>
@@ -1031,12 +1624,27 @@ bool DPoS::ScriptToDelegateInfo(DelegateInfo& cDelegateInfo, uint64_t t, const C
             return false;
         }
 
-        std::string sh = std::to_string(t);
-        auto hash = Hash(sh.begin(), sh.end());
-
         if(fCheck) {
-            if(pubkey.Verify(hash, vctSig) == false) {
-                return false;
+            // A block is checked as its header's proof, on receipt and when connected
+            uint256 hashChecked = SlotSignatureHash(pubkey, t, vctSig);
+            bool fChecked;
+            {
+                LOCK(cs_checkedSlotSignatures);
+                fChecked = setCheckedSlotSignatures.count(hashChecked) > 0;
+            }
+            if(fChecked == false) {
+                std::string sh = std::to_string(t);
+                if(pubkey.Verify(Hash(sh.begin(), sh.end()), vctSig) == false) {
+                    return false;
+                }
+                LOCK(cs_checkedSlotSignatures);
+                if(setCheckedSlotSignatures.insert(hashChecked).second) {
+                    dequeCheckedSlotSignatures.push_back(hashChecked);
+                }
+                if(dequeCheckedSlotSignatures.size() > MAX_CHECKED_SLOT_SIGNATURES) {
+                    setCheckedSlotSignatures.erase(dequeCheckedSlotSignatures.front());
+                    dequeCheckedSlotSignatures.pop_front();
+                }
             }
         }
 
@@ -1082,10 +1690,17 @@ CBitcoinAddress DPoS::GetBlockForgerAddress(const CBlock& block)
 
 bool DPoS::GetBlockForgerKeyID(CKeyID& keyid, const CBlock& block)
 {
-    bool ret = false;
-    CBitcoinAddress address = GetBlockForgerAddress(block);
-    ret = address.GetKeyID(keyid);
-    return ret;
+    // Straight from the script, without a round trip through CBitcoinAddress
+    auto& tx = block.vtx[0];
+    CTxDestination dest;
+    if(tx->IsCoinBase() && tx->vout.size() == 2 && ExtractDestination(tx->vout[0].scriptPubKey, dest)) {
+        const CKeyID* pkeyid = boost::get<CKeyID>(&dest);
+        if(pkeyid) {
+            keyid = *pkeyid;
+            return true;
+        }
+    }
+    return false;
 }
 
 bool DPoS::GetBlockDelegate(DelegateInfo& cDelegateInfo, const CBlock& block)
@@ -1145,7 +1760,7 @@ bool DPoS::CheckBlockHeader(const CBlockHeader& block)
 {
     auto t = time(NULL) + 3;
     if(block.nTime > t) {
-        LogPrintf("Block:%u time:%s error\n", block.nTime, t - 3);
+        LogPrintfThrottled(60, "Block:%u time:%s error\n", block.nTime, t - 3);
         return false;
     }
 
@@ -1197,6 +1812,11 @@ bool DPoS::CheckBlock(const CBlockIndex& blockindex, bool fIsCheckDelegateInfo)
         SetStartTime(chainActive[nDposStartHeight -1]->nTime);
     }
 
+    // Connecting a block checked when it was accepted needs no disk read
+    if(FindCheckedBlock(blockindex.GetBlockHash(), (fIsCheckDelegateInfo ? CHECKED_DELEGATE_INFO : 0) | CHECKED_FORGER)) {
+        return true;
+    }
+
     CBlock block;
     if(ReadBlockFromDisk(block, &blockindex, Params().GetConsensus()) == false) {
         return false;
@@ -1205,11 +1825,20 @@ bool DPoS::CheckBlock(const CBlockIndex& blockindex, bool fIsCheckDelegateInfo)
     return CheckBlock(block, fIsCheckDelegateInfo);
 }
 
-bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
+bool DPoS::CheckBlock(const CBlockIndex& blockindex, const CBlock& block, bool fIsCheckDelegateInfo, bool fCheckForger)
+{
+    if(chainActive.Height() == nDposStartHeight - 1) {
+        SetStartTime(chainActive[nDposStartHeight -1]->nTime);
+    }
+
+    return CheckBlock(block, fIsCheckDelegateInfo, fCheckForger);
+}
+
+bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo, bool fCheckForger)
 {
     auto t = time(NULL) + 3;
     if(block.nTime > t) {
-        LogPrintf("Block:%u time:%s error\n", block.nTime, t - 3);
+        LogPrintfThrottled(60, "Block:%u time:%s error\n", block.nTime, t - 3);
         return false;
     }
 
@@ -1217,6 +1846,12 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
         return true;
     }
 
+    const uint256 hash = block.GetHash();
+    uint8_t nChecks = (fIsCheckDelegateInfo ? CHECKED_DELEGATE_INFO : 0) | (fCheckForger ? CHECKED_FORGER : 0);
+    if(FindCheckedBlock(hash, nChecks)) {
+        return true;
+    }
+
     BlockMap::iterator miSelf = mapBlockIndex.find(block.hashPrevBlock);
     if(miSelf == mapBlockIndex.end()) {
         LogPrintf("CheckBlock find blockindex(%s) error\n", block.hashPrevBlock.ToString().c_str());
@@ -1227,7 +1862,7 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
 
     int64_t nBlockHeight = pPrevBlockIndex->nHeight + 1;
 
-    if(CheckCoinbase(*block.vtx[0], block.nTime, nBlockHeight) == false) {
+    if(fCheckForger && CheckCoinbase(*block.vtx[0], block.nTime) == false) {
         LogPrintf("CheckBlock CheckCoinbase error\n");
         return false;
     }
@@ -1237,7 +1872,9 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
     }
 
     if(nBlockHeight < nDposStartHeight) {
-        if(GetBlockForgerAddress(block) == cSuperForgerAddress) {
+        CKeyID forger;
+        if(GetBlockForgerKeyID(forger, block) && forger == cSuperForgerKeyID) {
+            AddCheckedBlock(hash, nChecks);
             return true;
         } else {
             LogPrintf("CheckBlock nBlockHeight < nDposStartHeight ForgerAddress error\n");
@@ -1254,6 +1891,7 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
     nPrevDelegateIndex = GetDelegateIndex(pPrevBlockIndex->nTime);
 
     bool ret = false;
+    bool fRoundStart = true;
     DelegateInfo cDelegateInfo;
 
     if(nBlockHeight == nDposStartHeight) {
@@ -1272,7 +1910,7 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
             if(CheckBlockDelegate(block) == false) {
                 return false;
             }
-            ProcessIrreversibleBlock(nBlockHeight, block.GetHash());
+            ProcessIrreversibleBlock(nBlockHeight, hash);
         }
 
         GetBlockDelegate(cDelegateInfo, block);
@@ -1283,6 +1921,7 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
             return false;
         }
 
+        fRoundStart = false;
         GetBlockDelegates(cDelegateInfo, pPrevBlockIndex);
     }
 
@@ -1291,6 +1930,12 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
     if(nCurrentDelegateIndex < cDelegateInfo.delegates.size()
         && cDelegateInfo.delegates[nCurrentDelegateIndex].keyid == delegate) {
         ret = true;
+        if(fRoundStart) {
+            AddRoundDelegates(nCurrentLoopIndex, hash, cDelegateInfo);
+        }
+        // The delegates a round's first block lists are checked against the votes of the
+        // moment, and it counts toward irreversibility, so that check is done every time
+        AddCheckedBlock(hash, fRoundStart ? (nChecks & CHECKED_FORGER) : nChecks);
     } else {
         LogPrintf("CheckBlock GetDelegateID blockhash:%s error\n", block.ToString().c_str());
     }
@@ -1298,16 +1943,35 @@ bool DPoS::CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo)
     return ret;
 }
 
-int DPoS::FastCheckBlockHash(const uint256& hash, uint64_t height)
+bool DPoS::FindCheckedBlock(const uint256& hash, uint8_t nChecks)
 {
-    int ret = 0;
-    if(height < 622578 || height > 1334286) {
-        return ret;
+    std::lock_guard<std::mutex> l(csCheckedBlocks);
+    auto it = mapCheckedBlocks.find(hash);
+    return it != mapCheckedBlocks.end() && (it->second & nChecks) == nChecks;
+}
+
+void DPoS::AddCheckedBlock(const uint256& hash, uint8_t nChecks)
+{
+    std::lock_guard<std::mutex> l(csCheckedBlocks);
+    auto ret = mapCheckedBlocks.insert(std::make_pair(hash, 0));
+    if(ret.second) {
+        dequeCheckedBlocks.push_back(hash);
+        while(dequeCheckedBlocks.size() > nMaxCheckedBlocks) {
+            mapCheckedBlocks.erase(dequeCheckedBlocks.front());
+            dequeCheckedBlocks.pop_front();
+        }
     }
+    ret.first->second |= nChecks;
+}
 
-    auto it = mapBlockHash.find(height);
-    if(it != mapBlockHash.end()) {
-        if(it->second == hash.ToString()) {
+int DPoS::FastCheckBlockHash(const uint256& hash, uint64_t height)
+{
+    int ret = 0;
+    auto end = std::end(vBlockHashCheckpoint);
+    auto it = std::lower_bound(std::begin(vBlockHashCheckpoint), end, height,
+        [](const CBlockHashCheckpoint& checkpoint, uint64_t h) { return checkpoint.nHeight < h; });
+    if(it != end && it->nHeight == height) {
+        if(memcmp(it->hash, hash.begin(), sizeof(it->hash)) == 0) {
             ret = 1;
         } else {
             ret = -1;
@@ -1317,23 +1981,32 @@ int DPoS::FastCheckBlockHash(const uint256& hash, uint64_t height)
     return ret;
 }
 
-bool DPoS::IsOnTheSameChain(const std::pair<int64_t, uint256>& first, const std::pair<int64_t, uint256>& second)
+int64_t DPoS::GetBlockHashCheckpointHeight(int64_t nMaxHeight)
 {
-    bool ret = false;
+    if(nMaxHeight < 0) {
+        return -1;
+    }
 
-    BlockMap::iterator it = mapBlockIndex.find(second.second);
-    if(it != mapBlockIndex.end()) {
-        CBlockIndex *pindex = it->second;
-        while(pindex->nHeight != first.first) {
-            pindex = pindex->pprev;
-        }
+    auto it = std::upper_bound(std::begin(vBlockHashCheckpoint), std::end(vBlockHashCheckpoint), (uint64_t)nMaxHeight,
+        [](uint64_t h, const CBlockHashCheckpoint& checkpoint) { return h < checkpoint.nHeight; });
+    if(it == std::begin(vBlockHashCheckpoint)) {
+        return -1;
+    }
 
-        if(*pindex->phashBlock == first.second) {
-            ret = true;
-        }
+    return (--it)->nHeight;
+}
+
+bool DPoS::IsOnTheSameChain(const std::pair<int64_t, uint256>& first, const std::pair<int64_t, uint256>& second)
+{
+    BlockMap::iterator it = mapBlockIndex.find(second.second);
+    if(it == mapBlockIndex.end()) {
+        return false;
     }
 
-    return ret;
+    // The skip list takes O(log n) steps back instead of one per block, and
+    // there is no ancestor at a height above the block's own
+    const CBlockIndex* pindex = it->second->GetAncestor(first.first);
+    return pindex && *pindex->phashBlock == first.second;
 }
 
 IrreversibleBlockInfo DPoS::GetIrreversibleBlockInfo()
@@ -1346,60 +2019,162 @@ void DPoS::SetIrreversibleBlockInfo(const IrreversibleBlockInfo& info)
 	cIrreversibleBlockInfo = info;
 }
 
+// A journal record: the height, little endian, the hash and the first bytes of the double SHA-256 of both
+static const size_t IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE = 8 + 32;
+static const size_t IRREVERSIBLE_BLOCK_RECORD_SIZE = IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE + 4;
+
+static bool WriteIrreversibleBlockRecord(FILE* file, int64_t height, const uint256& hash)
+{
+	unsigned char record[IRREVERSIBLE_BLOCK_RECORD_SIZE];
+	WriteLE64(record, height);
+	memcpy(record + 8, hash.begin(), 32);
+	uint256 check = Hash(record, record + IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE);
+	memcpy(record + IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE, check.begin(), 4);
+	return fwrite(record, 1, sizeof(record), file) == sizeof(record);
+}
+
+bool DPoS::ReadIrreversibleBlockJournal()
+{
+	FILE *file = fopen(strIrreversibleBlockJournalName.c_str(), "rb");
+	if(!file) {
+		return false;
+	}
+
+	unsigned char record[IRREVERSIBLE_BLOCK_RECORD_SIZE];
+	size_t nRead;
+	int nRecords = 0;
+	while((nRead = fread(record, 1, sizeof(record), file)) == sizeof(record)) {
+		uint256 check = Hash(record, record + IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE);
+		if(memcmp(check.begin(), record + IRREVERSIBLE_BLOCK_RECORD_DATA_SIZE, 4) != 0) {
+			break;
+		}
+		uint256 hash;
+		memcpy(hash.begin(), record + 8, 32);
+		AddIrreversibleBlock((int64_t)ReadLE64(record), hash);
+		nRecords++;
+	}
+	// What follows the last whole record was being written when the node stopped
+	if(nRead != 0) {
+		LogPrintf("%s: dropping the irreversible blocks after record %d of %s\n", __func__, nRecords, strIrreversibleBlockJournalName);
+	}
+
+	fclose(file);
+	return true;
+}
+
 bool DPoS::ReadIrreversibleBlockInfo(IrreversibleBlockInfo& info)
 {
 	if(fUseIrreversibleBlock == false) {
 		return true;
 	}
 
-	bool ret = false;
-    FILE *file = fopen(strIrreversibleBlockFileName.c_str(), "r");
-    if(file) {
-        char buff[128];
-		char line[256];
-		int64_t height;
-		uint256 hash;
-
-       while(fgets(line, sizeof(line), file)) {
-      		if(sscanf(line, "%ld;%s\n", &height, buff) > 0) {
-				hash.SetHex(buff);
-				AddIrreversibleBlock(height, hash);
+	bool ret = ReadIrreversibleBlockJournal();
+	bool fLegacy = false;
+	if(ret == false) {
+		// Before the journal, the blocks were written out as text at shutdown
+		FILE *file = fopen(strIrreversibleBlockFileName.c_str(), "r");
+		if(file) {
+			char buff[128];
+			char line[256];
+			int64_t height;
+			uint256 hash;
+
+			while(fgets(line, sizeof(line), file)) {
+				if(sscanf(line, "%ld;%s\n", &height, buff) > 0) {
+					hash.SetHex(buff);
+					AddIrreversibleBlock(height, hash);
+				}
 			}
+
+			fclose(file);
+			ret = true;
+			fLegacy = true;
 		}
+	}
 
-        fclose(file);
-		ret = true;
-    }
+	// Start the journal over from the blocks read, which appends from here on
+	if(WriteIrreversibleBlockInfo(info) && fLegacy) {
+		remove(strIrreversibleBlockFileName.c_str());
+	}
 
 	return ret;
 }
 
+/** Write the journal anew through a temporary file, so a crash leaves either the old or the new one */
+static bool WriteIrreversibleBlockJournal(const std::string& strFileName, const std::map<int64_t, uint256>& mapHeightHash)
+{
+	std::string strNewFileName = strFileName + ".new";
+	FILE *file = fopen(strNewFileName.c_str(), "wb");
+	if(file == NULL) {
+		LogPrintf("%s: cannot open %s\n", __func__, strNewFileName);
+		return false;
+	}
+
+	bool ret = true;
+	for(auto& it : mapHeightHash) {
+		ret = WriteIrreversibleBlockRecord(file, it.first, it.second) && ret;
+	}
+	FileCommit(file);
+	fclose(file);
+	if(ret == false || RenameOver(strNewFileName, strFileName) == false) {
+		LogPrintf("%s: cannot write %s\n", __func__, strFileName);
+		return false;
+	}
+
+	return true;
+}
+
 bool DPoS::WriteIrreversibleBlockInfo(const IrreversibleBlockInfo& info)
 {
 	if(fUseIrreversibleBlock == false) {
 		return true;
 	}
 
-    bool ret = false;
-	if(cIrreversibleBlockInfo.mapHeightHash.empty()) {
-		return true;	
+	if(fileIrreversibleBlockJournal) {
+		fclose(fileIrreversibleBlockJournal);
+		fileIrreversibleBlockJournal = NULL;
 	}
 
-    FILE *file = fopen(strIrreversibleBlockFileName.c_str(), "w");
-    if(file) {
-		for(auto& it : cIrreversibleBlockInfo.mapHeightHash) {
-        	fprintf(file, "%ld;%s\n", it.first, it.second.ToString().c_str());
-		}
-        fclose(file);
-        ret = true;
-    }
+	if(WriteIrreversibleBlockJournal(strIrreversibleBlockJournalName, cIrreversibleBlockInfo.mapHeightHash) == false) {
+		return false;
+	}
 
-    return ret;
+	nIrreversibleBlockJournalCount = cIrreversibleBlockInfo.mapHeightHash.size();
+	fileIrreversibleBlockJournal = fopen(strIrreversibleBlockJournalName.c_str(), "ab");
+	return fileIrreversibleBlockJournal != NULL;
+}
+
+bool DPoS::ImportIrreversibleBlocks(const std::map<int64_t, uint256>& mapHeightHash)
+{
+	boost::filesystem::path pathDPoS = GetDataDir() / "dpos";
+	TryCreateDirectory(pathDPoS);
+	return WriteIrreversibleBlockJournal((pathDPoS / "irreversible_block.log").string(), mapHeightHash);
+}
+
+void DPoS::AppendIrreversibleBlock(int64_t height, const uint256& hash)
+{
+	if(WriteIrreversibleBlockRecord(fileIrreversibleBlockJournal, height, hash) == false) {
+		LogPrintf("%s: cannot write %s\n", __func__, strIrreversibleBlockJournalName);
+	}
+
+	// One fsync for the records of each -irreversiblesyncwindow, the others only leave the stdio buffer
+	int64_t nNow = GetTimeMillis();
+	if(nNow - nIrreversibleBlockJournalSyncTime >= nIrreversibleSyncWindow) {
+		FileCommit(fileIrreversibleBlockJournal);
+		nIrreversibleBlockJournalSyncTime = nNow;
+	} else {
+		fflush(fileIrreversibleBlockJournal);
+	}
+
+	// The map keeps the last nMaxIrreversibleCount blocks, the journal all of them
+	if(++nIrreversibleBlockJournalCount >= 2 * nMaxIrreversibleCount) {
+		WriteIrreversibleBlockInfo(cIrreversibleBlockInfo);
+	}
 }
 
 std::pair<uint64_t, uint256> DPoS::GetIrreversibleBlock()
 {
-	read_lock l(lockIrreversibleBlockInfo);
+	READ_LOCK(lockIrreversibleBlockInfo);
 	auto& m = cIrreversibleBlockInfo.mapHeightHash;
 	if(m.empty() == false) {
 		return std::make_pair(m.rbegin()->first, m.rbegin()->second);
@@ -1414,7 +2189,7 @@ void DPoS::ProcessIrreversibleBlock(int64_t height, uint256 hash)
 		return;
 	}
 
-    write_lock l(lockIrreversibleBlockInfo);
+    WRITE_LOCK(lockIrreversibleBlockInfo);
 
 	int i = 0;
 	for(i = nMaxConfirmBlockCount - 1; i >= 0; --i) {
@@ -1426,6 +2201,7 @@ void DPoS::ProcessIrreversibleBlock(int64_t height, uint256 hash)
 				if((height - cIrreversibleBlockInfo.heights[i]) * 100 >= nMaxDelegateNumber * nFirstIrreversibleThreshold) {
 					AddIrreversibleBlock(cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i]);
 					LogPrintf("First NewIrreversibleBlock height:%ld hash:%s\n", cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i].ToString().c_str());
+					GetMainSignals().IrreversibleBlock(cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i]);
 
 					Vote::GetInstance().GetCommittee().NewIrreversibleBlock(cIrreversibleBlockInfo.heights[i]);
 					Vote::GetInstance().GetBill().NewIrreversibleBlock(cIrreversibleBlockInfo.heights[i]);
@@ -1440,6 +2216,7 @@ void DPoS::ProcessIrreversibleBlock(int64_t height, uint256 hash)
 					if(i == nMaxConfirmBlockCount - 1) {
 						AddIrreversibleBlock(cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i]);
 						LogPrintf("Second NewIrreversibleBlock height:%ld hash:%s\n", cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i].ToString().c_str());
+						GetMainSignals().IrreversibleBlock(cIrreversibleBlockInfo.heights[i], cIrreversibleBlockInfo.hashs[i]);
 						Vote::GetInstance().GetCommittee().NewIrreversibleBlock(cIrreversibleBlockInfo.heights[i]);
 						Vote::GetInstance().GetBill().NewIrreversibleBlock(cIrreversibleBlockInfo.heights[i]);
 
@@ -1484,7 +2261,7 @@ bool DPoS::IsValidBlockCheckIrreversibleBlock(int64_t height, uint256 hash)
 	}
 
 	bool ret = true;
-    read_lock l(lockIrreversibleBlockInfo);
+    READ_LOCK(lockIrreversibleBlockInfo);
 
 	auto it = cIrreversibleBlockInfo.mapHeightHash.find(height);
 	if(it != cIrreversibleBlockInfo.mapHeightHash.end()) {
@@ -1503,7 +2280,11 @@ void DPoS::AddIrreversibleBlock(int64_t height, uint256 hash)
 		cIrreversibleBlockInfo.mapHeightHash.erase(cIrreversibleBlockInfo.mapHeightHash.begin());
 	}
 
-	cIrreversibleBlockInfo.mapHeightHash.insert(std::make_pair(height, hash));
+	bool fInserted = cIrreversibleBlockInfo.mapHeightHash.insert(std::make_pair(height, hash)).second;
+	// Nothing is appended while the journal is being read back
+	if(fInserted && fileIrreversibleBlockJournal) {
+		AppendIrreversibleBlock(height, hash);
+	}
 
 	Vote::GetInstance().DeleteInvalidVote(height);
 }
@@ -11,15 +11,23 @@
 #include "key.h"
 #include "script/standard.h"
 #include "base58.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include <boost/thread/shared_mutex.hpp>
 
 class CBlockIndex;
 class CChainParams;
+class CCoinbaseProof;
 class CReserveKey;
 class CScript;
 class CWallet;
@@ -27,6 +35,10 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Milliseconds a standby forger waits into a slot for the block of the node it backs up, 0 to forge at the slot start */
+static const int64_t DEFAULT_FORGING_STANDBY = 0;
+/** The latest a standby forger may start, leaving time for its block to reach the next forger */
+static const int64_t MAX_FORGING_STANDBY = 2000;
 
 struct CBlockTemplate
 {
@@ -172,6 +184,11 @@ public:
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const CScript& opReturn, time_t, bool fMineWitnessTx = false);
 
+    unsigned int GetBlockMaxWeight() const { return nBlockMaxWeight; }
+    unsigned int GetBlockMaxSize() const { return nBlockMaxSize; }
+    bool NeedSizeAccounting() const { return fNeedSizeAccounting; }
+    const CFeeRate& GetBlockMinFeeRate() const { return blockMinFeeRate; }
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -214,6 +231,91 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * The transactions of the next block of a delegate, kept up to date while
+ * waiting for its slot. Transactions accepted to the mempool are appended as
+ * long as they fit, and the ones removed from it are dropped, by a thread of
+ * its own; the candidate is only assembled from scratch when the tip changes
+ * or a transaction could not be appended, at most every few seconds. At the
+ * slot only the coinbase and the header are filled in.
+ */
+class CBlockCandidate : public CValidationInterface
+{
+public:
+    explicit CBlockCandidate(const CChainParams& chainparamsIn);
+    virtual ~CBlockCandidate();
+
+    void Start();
+    void Stop();
+
+    /**
+     * Block on top of the chain tip made of the candidate, with coinbase to
+     * scriptPubKeyIn and opReturn, at time t. Assembles one from scratch if
+     * the candidate is not for the tip. Requires cs_main.
+     */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const CScript& opReturn, time_t t);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef &ptx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
+
+private:
+    /** Take the block limits of assembler, which reads them from the arguments */
+    CBlockCandidate(const CChainParams& chainparamsIn, const BlockAssembler& assembler);
+
+    struct Entry {
+        CTransactionRef tx;
+        CAmount nFee;
+        int64_t nSigOpsCost;
+        uint64_t nWeight;
+        uint64_t nSize;
+    };
+
+    void ThreadUpdate();
+    /** Assemble the candidate from the mempool. Requires cs_main and mempool.cs. */
+    void Rebuild();
+    /** Apply the mempool changes queued so far. Requires cs_main and mempool.cs. */
+    void ApplyPending();
+    /** Append a transaction of the mempool if it fits, false if the candidate has to be rebuilt for it */
+    bool Append(const CTransactionRef& ptx);
+    /** Check the candidate with a placeholder coinbase. Requires cs_main. */
+    void Validate();
+    /** Fill in a block of the candidate on top of pindexPrev. Requires cs_main. */
+    void FillBlock(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn, const CScript& opReturn, time_t t) const;
+
+    const CChainParams& chainparams;
+    unsigned int nBlockMaxWeight, nBlockMaxSize;
+    bool fNeedSizeAccounting;
+    CFeeRate blockMinFeeRate;
+
+    //! Guards the members up to threadUpdate; taken after cs_main and mempool.cs
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Changes of the mempool in the order they happened: the transaction and whether it was added
+    std::vector<std::pair<CTransactionRef, bool> > vPending;
+    bool fTipChanged;
+    bool fStop;
+    std::thread threadUpdate;
+
+    // The candidate, guarded by cs_main
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    std::vector<Entry> vEntries;
+    std::set<uint256> setTxids;
+    uint64_t nBlockWeight;
+    uint64_t nBlockSize;
+    int64_t nBlockSigOpsCost;
+    CAmount nFees;
+    //! Some transaction of the mempool was left out that a rebuild could include
+    bool fNeedsRebuild;
+    //! The candidate passed TestBlockValidity since it last changed
+    bool fValidated;
+    int64_t nLastRebuild;
+    int64_t nLastValidate;
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -229,6 +331,87 @@ struct DelegateInfo{
     std::vector<Delegate> delegates;
 };
 
+/** What became of a block slot of the delegate we forge for, durations in microseconds */
+struct CForgingSlotStats {
+    enum Result : uint8_t {
+        //! The block was accepted
+        FORGED = 0,
+        //! No block could be assembled, or it was rejected
+        FAILED = 1,
+        //! In standby, the block of the slot came from the node backed up
+        STANDBY = 2,
+    };
+
+    //! Start of the slot, in seconds
+    int64_t nSlotTime;
+    //! The delegate forged for in the slot
+    CKeyID delegate;
+    int nHeight;
+    uint256 hashBlock;
+    uint8_t nResult;
+    //! Times the block was assembled again because a late block of the previous slot arrived
+    int nRetries;
+    //! Building the delegate info of the coinbase in DelegateInfoToScript, signed ahead by SignSlot if it could be
+    int64_t nSignTime;
+    //! Assembling the block in CreateNewBlock
+    int64_t nCreateTime;
+    //! ProcessNewBlock, which announces the block to peers as soon as it is valid
+    int64_t nProcessTime;
+    //! From the slot start to the return of ProcessNewBlock
+    int64_t nBroadcastDelay;
+
+    CForgingSlotStats() : nSlotTime(0), nHeight(-1), nResult(FAILED), nRetries(0), nSignTime(0), nCreateTime(0), nProcessTime(0), nBroadcastDelay(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nSlotTime);
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(nResult);
+        READWRITE(nRetries);
+        READWRITE(nSignTime);
+        READWRITE(nCreateTime);
+        READWRITE(nProcessTime);
+        READWRITE(nBroadcastDelay);
+        READWRITE(delegate);
+    }
+};
+
+/** The delegates of a new round, in slot order, as published to the pubdposround ZMQ topic */
+struct CDPoSRoundEvent {
+    uint64_t nLoopIndex;
+    int nHeight;
+    //! The first block of the round, which carries its delegates
+    uint256 hashBlock;
+    std::vector<std::pair<CKeyID, uint64_t>> vDelegates;
+
+    CDPoSRoundEvent() : nLoopIndex(0), nHeight(-1) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nLoopIndex);
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(vDelegates);
+    }
+};
+
+/** Slots of a delegate, as far as the chain tells them */
+struct CDelegateSlotStats {
+    //! Blocks on the active chain
+    uint64_t nProduced;
+    //! Slots of the active chain without a block
+    uint64_t nMissed;
+    //! Blocks received that are not on the active chain
+    uint64_t nOrphaned;
+
+    CDelegateSlotStats() : nProduced(0), nMissed(0), nOrphaned(0) {}
+};
+
 const int nMaxConfirmBlockCount = 2;
 struct IrreversibleBlockInfo{
     int64_t heights[nMaxConfirmBlockCount];
@@ -245,29 +428,79 @@ struct IrreversibleBlockInfo{
 
 class DPoS{
 public:
-    DPoS() { nDposStartTime = 0;}
+    DPoS() { nDposStartTime = 0; fileIrreversibleBlockJournal = NULL; nIrreversibleBlockJournalCount = 0; nIrreversibleBlockJournalSyncTime = 0; nNextDelegatesGeneration = 0;}
     ~DPoS();
     static DPoS& GetInstance();
     void Init();
 
-    bool IsMining(DelegateInfo& cDelegateInfo, const CBitcoinAddress& address, time_t t);
+    /**
+     * The delegate whose block may follow the tip in the slot of t. At the start
+     * of a round cDelegateInfo is set to the delegates of the round, which its
+     * first block carries. Requires cs_main
+     */
+    bool GetSlotDelegate(DelegateInfo& cDelegateInfo, CKeyID& keyid, time_t t);
 
     DelegateInfo GetNextDelegates(int64_t t);
-    bool GetBlockDelegates(DelegateInfo& cDelegateInfo, CBlockIndex* pBlockIndex);
+    bool GetBlockDelegates(DelegateInfo& cDelegateInfo, const CBlockIndex* pBlockIndex);
     bool GetBlockDelegates(DelegateInfo& cDelegateInfo, const CBlock& block);
     bool CheckBlockDelegate(const CBlock& block);
     bool CheckBlockHeader(const CBlockHeader& block);
     bool CheckBlock(const CBlockIndex& blockindex, bool fIsCheckDelegateInfo);
-    bool CheckCoinbase(const CTransaction& tx, time_t t, int64_t height);
+    /** fCheckForger false skips CheckCoinbase, for blocks whose forger was verified by a CForgerCheck */
+    bool CheckBlock(const CBlockIndex& blockindex, const CBlock& block, bool fIsCheckDelegateInfo, bool fCheckForger = true);
+    /** Verify the forger signature and address of a coinbase, safe to call from any thread */
+    bool CheckCoinbase(const CTransaction& tx, time_t t);
 
     uint64_t GetLoopIndex(uint64_t time);
     uint32_t GetDelegateIndex(uint64_t time);
+    /** Whether pBlockIndex is the first block of its round, whose coinbase lists the delegates of the round */
+    bool IsRoundStart(const CBlockIndex* pBlockIndex);
+    /** Start time of the first block slot after t */
+    int64_t GetNextSlotTime(int64_t t);
+    /** Start time of the slot of the given delegate index in a round */
+    int64_t GetSlotTime(uint64_t nLoopIndex, uint32_t nDelegateIndex);
+    /** The delegates of up to nCount slots following a new block, as far as its round goes. Requires cs_main */
+    std::vector<CKeyID> GetNextSlotDelegates(CBlockIndex* pBlockIndex, const CBlock& block, int nCount);
+    /**
+     * Count the blocks each delegate forged and the slots it missed over the
+     * last nBlocks blocks up to pindexTip, reconstructed from the delegate
+     * schedules of their rounds, and the blocks it forged at those heights
+     * that are not on the active chain. Requires cs_main
+     */
+    void GetDelegateSlotStats(CBlockIndex* pindexTip, int nBlocks, std::map<CKeyID, CDelegateSlotStats>& mapStats);
+    /**
+     * The heights from nStartHeight to nEndHeight of the active chain whose
+     * blocks keyid forged, found from the delegate schedules of their rounds
+     * without reading the blocks. Requires cs_main
+     */
+    std::vector<int> GetForgedHeights(const CKeyID& keyid, int nStartHeight, int nEndHeight);
+    /**
+     * The coinbase proofs of the blocks of the round of pBlockIndex, from the first
+     * block of the round up to pBlockIndex. False if one of them is not on disk. Requires cs_main
+     */
+    bool GetRoundProof(const CBlockIndex* pBlockIndex, std::vector<CCoinbaseProof>& vProof);
+    /**
+     * Check the coinbase proofs of consecutive blocks of a round, the first block of the
+     * round first: every coinbase is under its header and signed by the delegate of its
+     * slot as the first one lists them, which cDelegateInfo is set to
+     */
+    bool VerifyRoundProof(const std::vector<CCoinbaseProof>& vProof, DelegateInfo& cDelegateInfo, std::string& strError);
 
     static bool DataToDelegate(DelegateInfo& cDelegateInfo, const std::string& data);
     static std::string DelegateToData(const DelegateInfo& cDelegateInfo);
 
+    /** fCheck verifies the slot signature, once for each pubkey, t and signature */
     static bool ScriptToDelegateInfo(DelegateInfo& cDelegateInfo, uint64_t t, const CScript& script, const CTxDestination* paddress, bool fCheck);
     static CScript DelegateInfoToScript(const DelegateInfo& cDelegateInfo, const CKey& delegatekey, uint64_t t);
+    /** The coinbase script with the slot signature made ahead of the slot by SignSlot */
+    static CScript DelegateInfoToScript(const DelegateInfo& cDelegateInfo, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig);
+    /** The signature of the slot starting at t by the delegate of delegatekey, which only depends on them */
+    static std::vector<unsigned char> SignSlot(const CKey& delegatekey, uint64_t t);
+
+    /** 1 if height is in the block hash table and hash matches it, -1 if it does not match, 0 if height is not in the table */
+    static int FastCheckBlockHash(const uint256& hash, uint64_t height);
+    /** The highest height of the block hash table that is not above nMaxHeight, or -1 */
+    static int64_t GetBlockHashCheckpointHeight(int64_t nMaxHeight);
 
     static CBitcoinAddress GetBlockForgerAddress(const CBlock& block);
     static bool GetBlockForgerKeyID(CKeyID& keyid, const CBlock& block);
@@ -277,14 +510,16 @@ public:
     CBitcoinAddress GetSuperForgerAddress() {return cSuperForgerAddress;}
 
     uint64_t GetStartTime() {return nDposStartTime;}
+    int GetBlockIntervalTime() {return nBlockIntervalTime;}
     void SetStartTime(uint64_t t) {nDposStartTime = t;}
 
-    int GetMaxMemory() {return nMaxMemory;}
 
     IrreversibleBlockInfo GetIrreversibleBlockInfo();
     void SetIrreversibleBlockInfo(const IrreversibleBlockInfo& info);
     bool ReadIrreversibleBlockInfo(IrreversibleBlockInfo& info);
     bool WriteIrreversibleBlockInfo(const IrreversibleBlockInfo& info);
+    /** Write the irreversible blocks of a state snapshot as the journal, before the DPoS state is read */
+    static bool ImportIrreversibleBlocks(const std::map<int64_t, uint256>& mapHeightHash);
     void ProcessIrreversibleBlock(int64_t height, uint256 hash);
     bool IsValidBlockCheckIrreversibleBlock(int64_t height, uint256 hash);
     void AddIrreversibleBlock(int64_t height, uint256 hash);
@@ -295,22 +530,63 @@ public:
     const int nMaxIrreversibleCount = 10000;
 
 private:
-    bool CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo);
-    static int FastCheckBlockHash(const uint256& hash, uint64_t height);
+    bool CheckBlock(const CBlock& block, bool fIsCheckDelegateInfo, bool fCheckForger = true);
     std::vector<Delegate> SortDelegate(const std::vector<Delegate>& delegates, uint64_t t);
 
     bool IsOnTheSameChain(const std::pair<int64_t, uint256>& first, const std::pair<int64_t, uint256>& second);
 
+    /** Add the irreversible blocks of the journal, up to its first damaged record. False if there is none */
+    bool ReadIrreversibleBlockJournal();
+    /** Append an irreversible block to the journal and sync it to disk */
+    void AppendIrreversibleBlock(int64_t height, const uint256& hash);
+
+    bool FindRoundDelegates(DelegateInfo& cDelegateInfo, uint64_t nLoopIndex, const uint256& hash);
+    void AddRoundDelegates(uint64_t nLoopIndex, const uint256& hash, const DelegateInfo& cDelegateInfo);
+
+    bool FindCheckedBlock(const uint256& hash, uint8_t nChecks);
+    void AddCheckedBlock(const uint256& hash, uint8_t nChecks);
+
 private:
-    int nMaxMemory;                    //GB
     int nMaxDelegateNumber;
     int nBlockIntervalTime;            //seconds
     int nDposStartHeight;
     uint64_t nDposStartTime;
     CBitcoinAddress cSuperForgerAddress;
+    CKeyID cSuperForgerKeyID;
     std::string strIrreversibleBlockFileName;
+    // The irreversible blocks, appended as they are found and rewritten from
+    // mapHeightHash at startup and whenever it has twice nMaxIrreversibleCount records
+    std::string strIrreversibleBlockJournalName;
+    FILE* fileIrreversibleBlockJournal;
+    int nIrreversibleBlockJournalCount;
+    // When the journal was last synced to disk, see -irreversiblesyncwindow
+    int64_t nIrreversibleBlockJournalSyncTime;
     IrreversibleBlockInfo cIrreversibleBlockInfo;
     boost::shared_mutex lockIrreversibleBlockInfo;
+
+    // Delegate schedules by (loop index, hash of the round's first block). Entries are keyed by
+    // block hash, so a reorg never makes one stale; only the oldest rounds are evicted.
+    const size_t nMaxCachedRounds = 64;
+    std::map<std::pair<uint64_t, uint256>, DelegateInfo> mapRoundDelegates;
+    boost::shared_mutex lockRoundDelegates;
+
+    // The schedules GetNextDelegates drew by time, for the vote state generation they were drawn
+    // from. The forger and then the validation of the round's first block both ask for them.
+    const size_t nMaxCachedNextDelegates = 16;
+    uint64_t nNextDelegatesGeneration;
+    std::map<int64_t, DelegateInfo> mapNextDelegates;
+    std::mutex mutexNextDelegates;
+
+    // Blocks that passed CheckBlock, with the CHECKED_* flags of the checks they passed, so
+    // the checks at header acceptance, ContextualCheckBlock and ActivateBestChainStep run once
+    // per block. Only passes are kept: they depend on nothing but the block and its ancestors,
+    // which its hash commits to.
+    static const uint8_t CHECKED_DELEGATE_INFO = 1;
+    static const uint8_t CHECKED_FORGER = 2;
+    const size_t nMaxCheckedBlocks = 4096;
+    std::map<uint256, uint8_t> mapCheckedBlocks;
+    std::deque<uint256> dequeCheckedBlocks;
+    std::mutex csCheckedBlocks;
 };
 
 #endif // BITCOIN_MINER_H
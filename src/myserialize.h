@@ -14,11 +14,18 @@
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/set.hpp>
 
+#include <boost/filesystem.hpp>
 
 #include <fstream>
 #include <map>
 #include <vector>
 
+#include "clientversion.h"
+#include "hash.h"
+#include "serialize.h"
+#include "streams.h"
+#include "util.h"
+
 template<typename A, typename B>
 void SerializeData(A& a, B& b)
 {
@@ -64,4 +71,187 @@ void MyUnserialize(const std::string& file, Args& ... arg)
    }
 }
 
+/**
+ * Binary snapshot files for the DPoS vote state.
+ *
+ * Layout: magic (4 bytes) | format version (int32) | payload | sha256d checksum
+ * of everything before it. The payload is written with the regular
+ * serialize.h primitives, so the files are a fraction of the size of the
+ * boost text archives above, which are only kept to migrate old data dirs.
+ */
+static const unsigned char VOTE_SNAPSHOT_MAGIC[4] = {'l', 'v', 's', 'n'};
+static const int32_t VOTE_SNAPSHOT_VERSION = 1;
+static const size_t VOTE_SNAPSHOT_BUFFER_SIZE = 1 << 20;
+
+/** Stream that writes to a file and hashes everything that passes through it. */
+class CVoteSnapshotWriter
+{
+private:
+    CAutoFile fileout;
+    CHashWriter hasher;
+    std::vector<char> vBuffer;
+
+public:
+    CVoteSnapshotWriter(FILE* file) : fileout(file, SER_DISK, CLIENT_VERSION), hasher(SER_DISK, CLIENT_VERSION)
+    {
+        vBuffer.resize(VOTE_SNAPSHOT_BUFFER_SIZE);
+        if (file)
+            setvbuf(file, &vBuffer[0], _IOFBF, vBuffer.size());
+    }
+
+    int GetType() const { return SER_DISK; }
+    int GetVersion() const { return CLIENT_VERSION; }
+    bool IsNull() const { return fileout.IsNull(); }
+
+    void write(const char* pch, size_t nSize)
+    {
+        hasher.write(pch, nSize);
+        fileout.write(pch, nSize);
+    }
+
+    template<typename T>
+    CVoteSnapshotWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+
+    /** Append the checksum, flush and close the file. */
+    void Commit()
+    {
+        uint256 hash = hasher.GetHash();
+        fileout << hash;
+        if (fflush(fileout.Get()) != 0)
+            throw std::ios_base::failure("CVoteSnapshotWriter::Commit: fflush failed");
+        FileCommit(fileout.Get());
+        fileout.fclose();
+    }
+};
+
+/** Return true if the file starts with the binary snapshot magic. */
+inline bool IsVoteSnapshotFile(const std::string& file)
+{
+    FILE* f = fopen(file.c_str(), "rb");
+    if (!f)
+        return false;
+
+    unsigned char magic[sizeof(VOTE_SNAPSHOT_MAGIC)];
+    bool ret = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+        && memcmp(magic, VOTE_SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return ret;
+}
+
+/** Write the header, let writePayload serialize the state, then commit and rename into place. */
+template<typename F>
+bool WriteVoteSnapshotFile(const std::string& file, F writePayload)
+{
+    std::string tmpfile = file + ".tmp";
+    try {
+        CVoteSnapshotWriter writer(fopen(tmpfile.c_str(), "wb"));
+        if (writer.IsNull())
+            return error("%s: Failed to open file %s", __func__, tmpfile);
+
+        writer << FLATDATA(VOTE_SNAPSHOT_MAGIC) << VOTE_SNAPSHOT_VERSION;
+        writePayload(writer);
+        writer.Commit();
+    } catch (const std::exception& e) {
+        remove(tmpfile.c_str());
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+
+    if (!RenameOver(tmpfile, file))
+        return error("%s: Rename-into-place of %s failed", __func__, file);
+
+    return true;
+}
+
+template<typename ... Args>
+bool WriteVoteSnapshot(const std::string& file, const Args& ... args)
+{
+    return WriteVoteSnapshotFile(file, [&](CVoteSnapshotWriter& writer) {
+        SerializeMany(writer, args...);
+    });
+}
+
+/**
+ * Write a payload that was already serialized into memory, e.g. to take a
+ * consistent copy of the state under its lock and do the I/O later.
+ */
+inline bool WriteVoteSnapshotData(const std::string& file, const CDataStream& payload)
+{
+    return WriteVoteSnapshotFile(file, [&](CVoteSnapshotWriter& writer) {
+        if (!payload.empty())
+            writer.write(&payload[0], payload.size());
+    });
+}
+
+template<typename ... Args>
+bool ReadVoteSnapshot(const std::string& file, Args& ... args)
+{
+    CAutoFile filein(fopen(file.c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: Failed to open file %s", __func__, file);
+
+    uint64_t fileSize = boost::filesystem::file_size(file);
+    uint64_t dataSize = 0;
+    if (fileSize >= sizeof(uint256))
+        dataSize = fileSize - sizeof(uint256);
+
+    std::vector<unsigned char> vchData(dataSize);
+    uint256 hashIn;
+    try {
+        if (dataSize)
+            filein.read((char*)&vchData[0], dataSize);
+        filein >> hashIn;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    if (Hash(vchData.begin(), vchData.end()) != hashIn)
+        return error("%s: Checksum mismatch in %s, data corrupted", __func__, file);
+
+    CDataStream ss(vchData, SER_DISK, CLIENT_VERSION);
+    try {
+        unsigned char magic[sizeof(VOTE_SNAPSHOT_MAGIC)];
+        int32_t nSnapshotVersion = 0;
+        ss >> FLATDATA(magic) >> nSnapshotVersion;
+        if (memcmp(magic, VOTE_SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+            return error("%s: Invalid snapshot magic in %s", __func__, file);
+        if (nSnapshotVersion > VOTE_SNAPSHOT_VERSION)
+            return error("%s: Unsupported snapshot version %d in %s", __func__, nSnapshotVersion, file);
+
+        UnserializeMany(ss, args...);
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+/**
+ * Load a snapshot written by WriteVoteSnapshot, falling back to the legacy
+ * boost text archive for data dirs that have not been migrated yet. The next
+ * WriteVoteSnapshot of the same state replaces the text file.
+ */
+template<typename ... Args>
+bool LoadVoteSnapshot(const std::string& file, Args& ... args)
+{
+    if (IsVoteSnapshotFile(file))
+        return ReadVoteSnapshot(file, args...);
+
+    if (!boost::filesystem::exists(file))
+        return true;
+
+    try {
+        LogPrintf("%s: migrating legacy text archive %s\n", __func__, file);
+        MyUnserialize(file, args...);
+    } catch (const std::exception& e) {
+        return error("%s: Failed to read legacy archive %s - %s", __func__, file, e.what());
+    }
+
+    return true;
+}
+
 #endif
@@ -19,6 +19,7 @@
 #include "primitives/transaction.h"
 #include "netbase.h"
 #include "scheduler.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
 
@@ -26,6 +27,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -48,6 +50,13 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// Buffers handed to the socket in one call, the least IOV_MAX POSIX allows. One at a time on Windows.
+#ifdef WIN32
+static const size_t MAX_SEND_BUFFERS = 1;
+#else
+static const size_t MAX_SEND_BUFFERS = 16;
+#endif
+
 // Fix for ancient MinGW versions, that don't have defined these in ws2tcpip.h.
 // Todo: Can be removed when our pull-tester is upgraded to a modern MinGW version.
 #ifdef WIN32
@@ -74,7 +83,9 @@ std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 static bool vfLimited[NET_MAX] = {};
 std::string strSubVersion;
 
-limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
+SaltedInvHasher::SaltedInvHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+flatlimitedmap<uint256, int64_t, SaltedInvHasher> mapAlreadyAskedFor(MAX_INV_SZ);
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -674,6 +685,8 @@ void CNode::copyStats(CNodeStats &stats)
     stats.dPingTime = (((double)nPingUsecTime) / 1e6);
     stats.dMinPing  = (((double)nMinPingUsecTime) / 1e6);
     stats.dPingWait = (((double)nPingUsecWait) / 1e6);
+    stats.nBlockAnnouncements = nBlockAnnouncements;
+    stats.dBlockRelayDelay = (((double)nBlockRelayDelayUsec) / 1e6);
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     CService addrLocalUnlocked = GetAddrLocal();
@@ -693,7 +706,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -760,26 +773,88 @@ int CNode::GetSendVersion() const
 }
 
 
+namespace {
+/**
+ * Buffers of received messages kept for reuse once the messages are
+ * processed, by size class, so that a flood of small messages does not
+ * allocate and free a buffer for each one.
+ */
+class CRecvBufferPool
+{
+public:
+    /** Give vch a buffer with room for nSize bytes, or for the largest class */
+    void Get(size_t nSize, CSerializeData& vch)
+    {
+        size_t nClass = 0;
+        while (nClass + 1 < NUM_CLASSES && CLASS_SIZE[nClass] < nSize)
+            nClass++;
+        {
+            LOCK(cs);
+            if (!vBuffers[nClass].empty()) {
+                vch.swap(vBuffers[nClass].back());
+                vBuffers[nClass].pop_back();
+                return;
+            }
+        }
+        vch.reserve(CLASS_SIZE[nClass]);
+    }
+
+    /** Take the buffer of vch back, unless it is too small or too large to keep */
+    void Put(CSerializeData& vch)
+    {
+        size_t nCapacity = vch.capacity();
+        if (nCapacity < CLASS_SIZE[0] || nCapacity > 2 * CLASS_SIZE[NUM_CLASSES - 1])
+            return;
+        size_t nClass = NUM_CLASSES - 1;
+        while (CLASS_SIZE[nClass] > nCapacity)
+            nClass--;
+        vch.clear();
+        LOCK(cs);
+        if (vBuffers[nClass].size() < MAX_BUFFERS[nClass]) {
+            vBuffers[nClass].emplace_back();
+            vBuffers[nClass].back().swap(vch);
+        }
+    }
+
+private:
+    static const size_t NUM_CLASSES = 3;
+    // readData grows a buffer 256 KiB at a time, the size of the largest class
+    const size_t CLASS_SIZE[NUM_CLASSES] = {1024, 16 * 1024, 256 * 1024};
+    // About 2 MB, 4 MB and 2 MB at most
+    const size_t MAX_BUFFERS[NUM_CLASSES] = {128, 16, 4};
+
+    CCriticalSection cs;
+    std::vector<CSerializeData> vBuffers[NUM_CLASSES];
+};
+
+CRecvBufferPool recvBufferPool;
+} // namespace
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.SwapData(vch);
+    recvBufferPool.Put(vch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    }
-    catch (const std::exception&) {
-        return -1;
-    }
+    // take the fields of CMessageHeader right out of the buffer
+    memcpy(hdr.pchMessageStart, hdrbuf, CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, hdrbuf + CMessageHeader::MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    hdr.nMessageSize = ReadLE32((const unsigned char*)hdrbuf + CMessageHeader::MESSAGE_SIZE_OFFSET);
+    memcpy(hdr.pchChecksum, hdrbuf + CMessageHeader::CHECKSUM_OFFSET, CMessageHeader::CHECKSUM_SIZE);
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -787,6 +862,11 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 
     // switch state to reading message data
     in_data = true;
+    if (hdr.nMessageSize > 0) {
+        CSerializeData vch;
+        recvBufferPool.Get(hdr.nMessageSize, vch);
+        vRecv.SwapData(vch);
+    }
 
     return nCopy;
 }
@@ -801,6 +881,7 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
+    // The payload is hashed as it arrives, so the checksum takes no second pass over it
     hasher.Write((const unsigned char*)pch, nCopy);
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
@@ -831,27 +912,73 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // The unsent headers and payloads at the front of the queue, sent in one go where the socket allows
+        std::pair<const unsigned char*, size_t> vBuffers[MAX_SEND_BUFFERS];
+        size_t nBuffers = 0;
+        size_t nRequested = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto itBuf = it; itBuf != pnode->vSendMsg.end() && nBuffers < MAX_SEND_BUFFERS; ++itBuf) {
+            const std::vector<unsigned char>* parts[2] = {&(*itBuf)->header, (*itBuf)->payload.get()};
+            for (const std::vector<unsigned char>* part : parts) {
+                if (nOffset >= part->size()) {
+                    nOffset -= part->size();
+                    continue;
+                }
+                if (nBuffers == MAX_SEND_BUFFERS)
+                    break;
+                vBuffers[nBuffers++] = std::make_pair(part->data() + nOffset, part->size() - nOffset);
+                nRequested += part->size() - nOffset;
+                nOffset = 0;
+            }
+        }
+        assert(nRequested > 0);
+
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(vBuffers[0].first), vBuffers[0].second, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            struct iovec iov[MAX_SEND_BUFFERS];
+            for (size_t i = 0; i < nBuffers; i++) {
+                iov[i].iov_base = const_cast<unsigned char*>(vBuffers[i].first);
+                iov[i].iov_len = vBuffers[i].second;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nBuffers;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Move past the messages sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nMessageSize = (*it)->header.size() + (*it)->payload->size();
+                size_t nUnsent = nMessageSize - pnode->nSendOffset;
+                if (nLeft < nUnsent) {
+                    pnode->nSendOffset += nLeft;
+                    // Nothing goes ahead of a message partly sent
+                    if (!pnode->nSendPriority)
+                        pnode->nSendPriority = 1;
+                    break;
+                }
+                nLeft -= nUnsent;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= nMessageSize;
+                if (pnode->nSendPriority)
+                    pnode->nSendPriority--;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1106,9 +1233,22 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/** How long the socket handler waits for socket events, when new data to send wakes it up */
+static const int SOCKET_EVENTS_TIMEOUT_MS = 100;
+/** How long it waits if it cannot be woken up and has to poll for data to send */
+static const int SOCKET_POLL_TIMEOUT_MS = 50;
+
 void CConnman::ThreadSocketHandler()
 {
+    LogPrintf("Waiting for socket events with %s\n", CSocketEvents::GetBackendName());
+    // Listening sockets are tagged -2, -3, ... as -1 is taken by the wakeup of socketEvents
+    for (size_t i = 0; i < vhListenSocket.size(); i++) {
+        if (vhListenSocket[i].socket != INVALID_SOCKET)
+            socketEvents.Set(vhListenSocket[i].socket, -2 - (int64_t)i, CSocketEvents::EVENT_RECV);
+    }
+
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
     while (!interruptNet)
     {
         //
@@ -1129,6 +1269,10 @@ void CConnman::ThreadSocketHandler()
                     pnode->grantOutbound.Release();
 
                     // close socket and cleanup
+                    if (pnode->hSocketEvents != INVALID_SOCKET) {
+                        socketEvents.Remove(pnode->hSocketEvents, pnode->id);
+                        pnode->hSocketEvents = INVALID_SOCKET;
+                    }
                     pnode->CloseSocketDisconnect();
 
                     // hold in disconnected pool until all refs are released
@@ -1173,38 +1317,28 @@ void CConnman::ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Register the events each socket is waited for
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
         {
             LOCK(cs_vNodes);
+            // Forget closed sockets first, as sockets registered below may have reused their descriptors
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                LOCK(pnode->cs_hSocket);
+                if (pnode->hSocketEvents != INVALID_SOCKET && pnode->hSocketEvents != pnode->hSocket) {
+                    socketEvents.Remove(pnode->hSocketEvents, pnode->id);
+                    pnode->hSocketEvents = INVALID_SOCKET;
+                }
+            }
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
+                // * Otherwise, if there is space left in the receive buffer, wait for
                 //   receiving data.
                 // * Hand off all complete messages to the processor, to be handled without
                 //   blocking here.
@@ -1215,53 +1349,44 @@ void CConnman::ThreadSocketHandler()
                     LOCK(pnode->cs_vSend);
                     select_send = !pnode->vSendMsg.empty();
                 }
+                int nEvents = select_send ? CSocketEvents::EVENT_SEND : (select_recv ? CSocketEvents::EVENT_RECV : 0);
 
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
+                if (pnode->hSocketEvents != pnode->hSocket || pnode->nSocketEvents != nEvents) {
+                    socketEvents.Set(pnode->hSocket, pnode->id, nEvents);
+                    pnode->hSocketEvents = pnode->hSocket;
+                    pnode->nSocketEvents = nEvents;
                 }
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
-            return;
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+        //
+        // Wait for sockets to be ready, or for data to send
+        //
+        int nTimeout = socketEvents.CanWakeup() ? SOCKET_EVENTS_TIMEOUT_MS : SOCKET_POLL_TIMEOUT_MS;
+        std::vector<std::pair<int64_t, int> > vReady;
+        if (!socketEvents.Wait(nTimeout, vReady)) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket %s error %s\n", CSocketEvents::GetBackendName(), NetworkErrorString(nErr));
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(nTimeout)))
                 return;
         }
+        if (interruptNet)
+            return;
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
-        {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
+        std::map<NodeId, int> mapReady;
+        for (const std::pair<int64_t, int>& ready : vReady) {
+            if (ready.first >= 0) {
+                mapReady[ready.first] |= ready.second;
+            } else {
+                const ListenSocket& hListenSocket = vhListenSocket[-2 - ready.first];
+                if (hListenSocket.socket != INVALID_SOCKET)
+                    AcceptConnection(hListenSocket);
             }
         }
 
@@ -1275,6 +1400,9 @@ void CConnman::ThreadSocketHandler()
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 pnode->AddRef();
         }
+        int64_t nTime = GetSystemTimeInSeconds();
+        bool fCheckInactivity = nTime != nLastInactivityCheck;
+        nLastInactivityCheck = nTime;
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             if (interruptNet)
@@ -1286,13 +1414,11 @@ void CConnman::ThreadSocketHandler()
             bool recvSet = false;
             bool sendSet = false;
             bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+            std::map<NodeId, int>::const_iterator itReady = mapReady.find(pnode->id);
+            if (itReady != mapReady.end()) {
+                recvSet = itReady->second & CSocketEvents::EVENT_RECV;
+                sendSet = itReady->second & CSocketEvents::EVENT_SEND;
+                errorSet = itReady->second & CSocketEvents::EVENT_ERROR;
             }
             if (recvSet || errorSet)
             {
@@ -1325,7 +1451,7 @@ void CConnman::ThreadSocketHandler()
                                     LOCK(pnode->cs_vProcessMsg);
                                     pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
                                     pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize || pnode->vProcessMsg.size() >= MAX_PROCESS_QUEUE_MESSAGES;
                                 }
                                 WakeMessageHandler();
                             }
@@ -1365,9 +1491,10 @@ void CConnman::ThreadSocketHandler()
             }
 
             //
-            // Inactivity checking
+            // Inactivity checking, once a second
             //
-            int64_t nTime = GetSystemTimeInSeconds();
+            if (!fCheckInactivity)
+                continue;
             if (nTime - pnode->nTimeConnected > 60)
             {
                 if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
@@ -1405,6 +1532,11 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+void CConnman::WakeSocketHandler()
+{
+    socketEvents.Wakeup();
+}
+
 void CConnman::WakeMessageHandler()
 {
     {
@@ -1694,6 +1826,8 @@ void CConnman::ThreadOpenConnections()
 
     // Minimum time before next feeler connection (in microseconds).
     int64_t nNextFeeler = PoissonNextSend(nStart*1000*1000, FEELER_INTERVAL);
+    // Time before the slowest outbound peer is next rotated out, with -latencypeers
+    int64_t nNextRotation = nStart + LATENCY_ROTATION_INTERVAL;
     while (!interruptNet)
     {
         ProcessOneShot();
@@ -1759,6 +1893,11 @@ void CConnman::ThreadOpenConnections()
         //    connections.
         //  * Only make a feeler connection once every few minutes.
         //
+        if (nLatencyPeers && nOutbound >= nMaxOutbound && GetTime() >= nNextRotation) {
+            nNextRotation = GetTime() + LATENCY_ROTATION_INTERVAL;
+            RotateSlowOutbound();
+        }
+
         bool fFeeler = false;
         if (nOutbound >= nMaxOutbound) {
             int64_t nTime = GetTimeMicros(); // The current time right now (in microseconds).
@@ -1838,6 +1977,33 @@ void CConnman::ThreadOpenConnections()
     }
 }
 
+void CConnman::RotateSlowOutbound()
+{
+    LOCK(cs_vNodes);
+    std::vector<CNode*> vMeasured;
+    for (CNode* pnode : vNodes) {
+        if (!pnode->fInbound && !pnode->fAddnode && !pnode->fFeeler && pnode->fSuccessfullyConnected && !pnode->fDisconnect &&
+            pnode->nBlockAnnouncements >= LATENCY_MIN_ANNOUNCEMENTS)
+            vMeasured.push_back(pnode);
+    }
+    if ((int)vMeasured.size() <= nLatencyPeers)
+        return;
+
+    // Fastest first, by the delay of their block announcements, then by ping
+    std::sort(vMeasured.begin(), vMeasured.end(), [](const CNode* a, const CNode* b) {
+        if (a->nBlockRelayDelayUsec != b->nBlockRelayDelayUsec)
+            return a->nBlockRelayDelayUsec < b->nBlockRelayDelayUsec;
+        return a->nMinPingUsecTime < b->nMinPingUsecTime;
+    });
+    CNode* pslowest = vMeasured.back();
+    int64_t nKeptDelay = vMeasured[nLatencyPeers - 1]->nBlockRelayDelayUsec;
+    if (pslowest->nBlockRelayDelayUsec < nKeptDelay + LATENCY_ROTATION_MARGIN_USEC)
+        return;
+
+    LogPrint("net", "disconnecting slow outbound peer=%d, relaying blocks %dms late on average\n", pslowest->id, pslowest->nBlockRelayDelayUsec / 1000);
+    pslowest->fDisconnect = true;
+}
+
 std::vector<AddedNodeInfo> CConnman::GetAddedNodeInfo()
 {
     std::vector<AddedNodeInfo> ret;
@@ -1893,12 +2059,6 @@ std::vector<AddedNodeInfo> CConnman::GetAddedNodeInfo()
 
 void CConnman::ThreadOpenAddedConnections()
 {
-    {
-        LOCK(cs_vAddedNodes);
-        if (mapMultiArgs.count("-addnode"))
-            vAddedNodes = mapMultiArgs.at("-addnode");
-    }
-
     while (true)
     {
         CSemaphoreGrant grant(*semAddnode);
@@ -1964,11 +2124,13 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    // Start waiting for the version reply right away
+    WakeSocketHandler();
 
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nHandler)
 {
     while (!flagInterruptMsgProc)
     {
@@ -1983,24 +2145,29 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // Handlers start at different nodes, and skip the nodes another one is working on
+        size_t nStart = vNodesCopy.size() * nHandler / nMessageHandlers;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
+            bool fExpected = false;
+            if (!pnode->fProcessingMessages.compare_exchange_strong(fExpected, true))
+                continue;
 
             // Receive messages
             bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
-            if (flagInterruptMsgProc)
-                return;
 
             // Send messages
-            {
+            if (!flagInterruptMsgProc) {
                 LOCK(pnode->cs_sendProcessing);
                 GetNodeSignals().SendMessages(pnode, *this, flagInterruptMsgProc);
             }
+            pnode->fProcessingMessages = false;
             if (flagInterruptMsgProc)
-                return;
+                break;
         }
 
         {
@@ -2205,6 +2372,8 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nMaxConnections = 0;
     nMaxOutbound = 0;
     nMaxAddnode = 0;
+    nMessageHandlers = 1;
+    nLatencyPeers = 0;
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
@@ -2228,6 +2397,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nMaxOutbound = std::min((connOptions.nMaxOutbound), nMaxConnections);
     nMaxAddnode = connOptions.nMaxAddnode;
     nMaxFeeler = connOptions.nMaxFeeler;
+    nMessageHandlers = std::max(1, std::min(connOptions.nMessageHandlers, MAX_MESSAGE_HANDLERS));
+    nLatencyPeers = std::max(0, std::min(connOptions.nLatencyPeers, nMaxOutbound));
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
@@ -2304,7 +2475,11 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     else
         threadDNSAddressSeed = std::thread(&TraceThread<std::function<void()> >, "dnsseed", std::function<void()>(std::bind(&CConnman::ThreadDNSAddressSeed, this)));
 
-    // Initiate outbound connections from -addnode
+    // Initiate outbound connections from -addnode, keeping nodes added before the start (-delegatepeer)
+    if (mapMultiArgs.count("-addnode")) {
+        for (const std::string& strAddedNode : mapMultiArgs.at("-addnode"))
+            AddNode(strAddedNode);
+    }
     threadOpenAddedConnections = std::thread(&TraceThread<std::function<void()> >, "addcon", std::function<void()>(std::bind(&CConnman::ThreadOpenAddedConnections, this)));
 
     // Initiate outbound connections unless connect=0
@@ -2312,10 +2487,11 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlers; i++)
+        vThreadMessageHandler.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))));
 
     // Dump network addresses
-    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL, SCHEDULER_PRIORITY_LOW, "dumpaddresses");
 
     return true;
 }
@@ -2344,6 +2520,7 @@ void CConnman::Interrupt()
     condMsgProc.notify_all();
 
     interruptNet();
+    socketEvents.Wakeup();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2361,8 +2538,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& threadMessageHandler : vThreadMessageHandler) {
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    }
+    vThreadMessageHandler.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2627,6 +2807,21 @@ uint64_t CConnman::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+size_t CConnman::GetBufferedBytes()
+{
+    size_t nBytes = 0;
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        {
+            LOCK(pnode->cs_vSend);
+            nBytes += pnode->nSendSize;
+        }
+        LOCK(pnode->cs_vProcessMsg);
+        nBytes += pnode->nProcessQueueSize;
+    }
+    return nBytes;
+}
+
 ServiceFlags CConnman::GetLocalServices() const
 {
     return nLocalServices;
@@ -2680,6 +2875,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendPriority = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2699,12 +2895,17 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nPingUsecTime = 0;
     fPingQueued = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
+    nBlockAnnouncements = 0;
+    nBlockRelayDelayUsec = 0;
     minFeeFilter = 0;
     lastSentFeeFilter = 0;
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fProcessingMessages = false;
     nProcessQueueSize = 0;
+    hSocketEvents = INVALID_SOCKET;
+    nSocketEvents = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
         mapRecvBytesPerMsgCmd[msg] = 0;
@@ -2734,12 +2935,10 @@ void CNode::AskFor(const CInv& inv)
 
     // We're using mapAskFor as a priority queue,
     // the key is the earliest time the request can be sent
-    int64_t nRequestTime;
-    limitedmap<uint256, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv.hash);
-    if (it != mapAlreadyAskedFor.end())
-        nRequestTime = it->second;
-    else
-        nRequestTime = 0;
+    int64_t nRequestTime = 0;
+    const int64_t* pnRequestTime = mapAlreadyAskedFor.find(inv.hash);
+    if (pnRequestTime)
+        nRequestTime = *pnRequestTime;
     LogPrint("net", "askfor %s  %d (%s) peer=%d\n", inv.ToString(), nRequestTime, DateTimeStrFormat("%H:%M:%S", nRequestTime/1000000), id);
 
     // Make sure not to reuse time indexes to keep things in the same order
@@ -2751,10 +2950,7 @@ void CNode::AskFor(const CInv& inv)
 
     // Each retry is 2 minutes after the last
     nRequestTime = std::max(nRequestTime + 2 * 60 * 1000000, nNow);
-    if (it != mapAlreadyAskedFor.end())
-        mapAlreadyAskedFor.update(it, nRequestTime);
-    else
-        mapAlreadyAskedFor.insert(std::make_pair(inv.hash, nRequestTime));
+    mapAlreadyAskedFor.set(inv.hash, nRequestTime);
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
@@ -2763,19 +2959,46 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+/**
+ * Whether a message carries blocks or headers, which a peer's send queue
+ * sends at the next message boundary, ahead of the transaction relay.
+ */
+static bool IsBlockRelayCommand(const std::string& command)
+{
+    return command == NetMsgType::BLOCK || command == NetMsgType::CMPCTBLOCK || command == NetMsgType::BLOCKTXN ||
+           command == NetMsgType::HEADERS || command == NetMsgType::CHEADERS;
+}
+
+CSharedNetMsgRef MakeSharedNetMsg(const std::string& command, const std::shared_ptr<const std::vector<unsigned char> >& payload)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
+    std::shared_ptr<CSharedNetMsg> msg = std::make_shared<CSharedNetMsg>();
+    msg->command = command;
+    msg->payload = payload;
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(payload->data(), payload->data() + payload->size());
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), payload->size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    msg->header.reserve(CMessageHeader::HEADER_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, msg->header, 0, hdr};
+    return msg;
+}
+
+CSharedNetMsgRef MakeSharedNetMsg(CSerializedNetMsg&& msg)
+{
+    return MakeSharedNetMsg(msg.command, std::make_shared<const std::vector<unsigned char> >(std::move(msg.data)));
+}
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, MakeSharedNetMsg(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsgRef& msg)
+{
+    size_t nMessageSize = msg->payload->size();
+    size_t nTotalSize = nMessageSize + msg->header.size();
+    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg->command.c_str()), nMessageSize, pnode->id);
+    TRACE3(net, outbound_message, pnode->GetId(), msg->command.c_str(), (uint64_t)nMessageSize);
 
     size_t nBytesSent = 0;
     {
@@ -2783,18 +3006,27 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[msg->command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        if (IsBlockRelayCommand(msg->command)) {
+            // Ahead of the transactions and addresses queued, behind the
+            // block relay messages queued before and the message partly sent
+            pnode->vSendMsg.insert(pnode->vSendMsg.begin() + pnode->nSendPriority, msg);
+            pnode->nSendPriority++;
+        } else {
+            pnode->vSendMsg.push_back(msg);
+        }
 
-        // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+        // If write queue empty, attempt "optimistic write", and have the
+        // socket handler wait until the rest can be sent
+        if (optimisticSend == true) {
             nBytesSent = SocketSendData(pnode);
+            if (!pnode->vSendMsg.empty())
+                WakeSocketHandler();
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
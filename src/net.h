@@ -16,6 +16,7 @@
 #include "netaddress.h"
 #include "protocol.h"
 #include "random.h"
+#include "sockevents.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
@@ -60,6 +61,14 @@ static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of automatic outgoing nodes */
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
+/** Default for -latencypeers, the outbound peers relaying blocks fastest kept while the others rotate */
+static const int DEFAULT_LATENCY_PEERS = 0;
+/** Seconds between disconnections of the slowest outbound peer, with -latencypeers */
+static const int64_t LATENCY_ROTATION_INTERVAL = 10 * 60;
+/** Block announcements a peer must have made for its relay delay to count */
+static const int LATENCY_MIN_ANNOUNCEMENTS = 20;
+/** How much later than the slowest kept peer a peer relays blocks on average to be rotated out */
+static const int64_t LATENCY_ROTATION_MARGIN_USEC = 500 * 1000;
 /** Maximum number of addnode outgoing nodes */
 static const int MAX_ADDNODE_CONNECTIONS = 8;
 /** -listen default */
@@ -86,6 +95,11 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Pause receiving from a peer with this many messages waiting to be processed, however small */
+static const size_t MAX_PROCESS_QUEUE_MESSAGES = 1000;
+/** -msghandlers default: threads processing messages, each working on one peer at a time */
+static const int DEFAULT_MESSAGE_HANDLERS = 2;
+static const int MAX_MESSAGE_HANDLERS = 16;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -119,6 +133,22 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * A message serialized once, with its header, that the send queues of any
+ * number of peers hold without copying it. The payload may be shared with
+ * other owners too, such as the raw block cache.
+ */
+struct CSharedNetMsg
+{
+    std::string command;
+    std::vector<unsigned char> header;
+    std::shared_ptr<const std::vector<unsigned char> > payload;
+};
+typedef std::shared_ptr<const CSharedNetMsg> CSharedNetMsgRef;
+
+CSharedNetMsgRef MakeSharedNetMsg(CSerializedNetMsg&& msg);
+CSharedNetMsgRef MakeSharedNetMsg(const std::string& command, const std::shared_ptr<const std::vector<unsigned char> >& payload);
+
 
 class CConnman
 {
@@ -145,6 +175,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        int nMessageHandlers = 1;
+        int nLatencyPeers = 0;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -160,6 +192,8 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    /** Queue a message that other peers' send queues may hold as well, serialized for all of them alike */
+    void PushMessage(CNode* pnode, const CSharedNetMsgRef& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -276,6 +310,8 @@ public:
 
     uint64_t GetTotalBytesRecv();
     uint64_t GetTotalBytesSent();
+    //! Bytes queued to be sent to the peers and received from them but not processed yet
+    size_t GetBufferedBytes();
 
     void SetBestHeight(int height);
     int GetBestHeight() const;
@@ -286,6 +322,8 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+    /** Have the socket handler look at the nodes again, e.g. for data left to send */
+    void WakeSocketHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -297,7 +335,9 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    //! Disconnect the outbound peer relaying blocks the slowest, unless it is among the nLatencyPeers fastest
+    void RotateSlowOutbound();
+    void ThreadMessageHandler(int nHandler);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
@@ -383,6 +423,8 @@ private:
     int nMaxOutbound;
     int nMaxAddnode;
     int nMaxFeeler;
+    int nMessageHandlers;
+    int nLatencyPeers;
     std::atomic<int> nBestHeight;
     CClientUIInterface* clientInterface;
 
@@ -398,11 +440,14 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    /** Readiness of the listening and node sockets, waited for by the socket handler */
+    CSocketEvents socketEvents;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> vThreadMessageHandler;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -469,7 +514,17 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
-extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
+/** Salted, as peers pick the hashes they announce */
+class SaltedInvHasher
+{
+    const uint64_t k0, k1;
+
+public:
+    SaltedInvHasher();
+    size_t operator()(const uint256& hash) const { return SipHashUint256(k0, k1, hash); }
+};
+
+extern flatlimitedmap<uint256, int64_t, SaltedInvHasher> mapAlreadyAskedFor;
 
 /** Subversion as sent to the P2P network in `version` messages */
 extern std::string strSubVersion;
@@ -507,6 +562,8 @@ public:
     double dPingTime;
     double dPingWait;
     double dMinPing;
+    int nBlockAnnouncements;
+    double dBlockRelayDelay;
     std::string addrLocal;
     CAddress addr;
 };
@@ -521,22 +578,22 @@ private:
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, in a buffer from the receive buffer pool
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -549,7 +606,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -568,9 +624,10 @@ public:
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
     size_t nSendSize; // total size of all vSendMsg entries
-    size_t nSendOffset; // offset inside the first vSendMsg already sent
+    size_t nSendOffset; // offset inside the header and payload of the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSharedNetMsgRef> vSendMsg;
+    size_t nSendPriority; // leading vSendMsg entries ahead of the rest: the one partly sent and the block relay messages
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -620,6 +677,8 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Set by the message handler working on this node, so that its messages are handled in order
+    std::atomic_bool fProcessingMessages;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -630,6 +689,7 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    CCriticalSection cs_addrSend; // protects vAddrToSend and addrKnown, which other nodes' handlers relay to
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -672,6 +732,10 @@ public:
     std::atomic<int64_t> nPingUsecTime;
     // Best measured round-trip time.
     std::atomic<int64_t> nMinPingUsecTime;
+    // New blocks announced, and the moving average of how long after the
+    // first announcement of each by any peer (in usec).
+    std::atomic<int> nBlockAnnouncements;
+    std::atomic<int64_t> nBlockRelayDelayUsec;
     // Whether a ping is requested.
     std::atomic<bool> fPingQueued;
     // Minimum fee rate with which to filter inv's to this node
@@ -694,6 +758,9 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    // The socket and events registered with CConnman::socketEvents, used only by SocketHandler thread
+    SOCKET hSocketEvents;
+    int nSocketEvents;
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -752,6 +819,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -760,6 +828,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
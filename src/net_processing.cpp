@@ -8,12 +8,15 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilter.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "indexer.h"
 #include "init.h"
 #include "validation.h"
 #include "merkleblock.h"
+#include "miner.h"
 #include "net.h"
 #include "netmessagemaker.h"
 #include "netbase.h"
@@ -22,14 +25,21 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "rawblockcache.h"
 #include "tinyformat.h"
+#include "trace.h"
 #include "txmempool.h"
+#include "txorphanage.h"
+#include "txprevalidator.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <unordered_map>
+
 #include <boost/thread.hpp>
 
 #if defined(NDEBUG)
@@ -38,30 +48,21 @@
 
 std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b)
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct COrphanTx {
-    // When modifying, adapt the copy of this definition in tests/DoS_tests.
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/** Transactions waiting for their parents, under its own lock */
+static CTxOrphanage orphanage;
 
 static size_t vExtraTxnForCompactIt = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(cs_main);
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
+/** Most blocks a getcfilters request may cover, as in BIP 157 */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Most blocks a getcfheaders request may cover, as in BIP 157 */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Blocks between two filter headers of a cfcheckpt, as in BIP 157 */
+static const int CFCHECKPT_INTERVAL = 1000;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -105,23 +106,64 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was asked for, in microseconds.
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
     /** Stack of nodes which we have set to announce using compact blocks */
     std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
 
+    /** Compact block reconstruction statistics of all peers. Protected by cs_main. */
+    CCompactBlockStats cmpctBlockStatsTotal;
+
+    /** Hosts of the delegates' nodes from -delegatepeer, filled before the network starts. */
+    struct DelegatePeer {
+        CKeyID keyid;
+        std::string strHost;
+        CNetAddr addr;
+    };
+    std::vector<DelegatePeer> vDelegatePeers;
+
+    /**
+     * Held by the message handlers while processing a message whose handling
+     * is not known to be safe next to other peers' messages, so those are
+     * still processed one at a time. Taken before cs_main.
+     */
+    CCriticalSection cs_serialMessages;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Transactions to relay, with their tx messages without and with witness once serialized for a peer */
+    struct RelayTx {
+        CTransactionRef tx;
+        CSharedNetMsgRef msg[2];
+
+        explicit RelayTx(CTransactionRef txIn) : tx(std::move(txIn)) {}
+    };
     /** Relay map, protected by cs_main. */
-    typedef std::map<uint256, CTransactionRef> MapRelay;
+    typedef std::map<uint256, RelayTx> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /**
+     * Rank of the mempool transactions in the order they are announced,
+     * fewest ancestors and highest fee first. It is computed once per
+     * trickle interval for all peers instead of comparing mempool entries
+     * in each peer's heap. Protected by cs_main.
+     */
+    std::unordered_map<uint256, uint32_t, SaltedTxidHasher> mapRelayOrder;
+    int64_t nNextRelayOrder = 0;
+
+    /** Message and block timing statistics, see CNetTimeStats. Protected by cs_netStats */
+    CCriticalSection cs_netStats;
+    std::map<std::string, CMessageTimeStats> mapCommandTimes;
+    std::map<NodeId, CMessageTimeStats> mapPeerTimes;
+    std::deque<CBlockRelayTimes> dequeBlockTimes;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -175,6 +217,11 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving averages of the time from asking this peer for a block to receiving it, and between blocks it
+    //! delivers back to back, in microseconds. 0 until measured.
+    int64_t nAvgBlockLatency;
+    int64_t nAvgBlockInterval;
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -196,6 +243,23 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer is the node of a delegate from -delegatepeer, and which one
+    bool fDelegatePeer;
+    CKeyID delegateKeyID;
+    //! How well the compact blocks of this peer could be reconstructed
+    CCompactBlockStats cmpctBlockStats;
+    //! Salt we sent in sendrecon, 0 if we did not
+    uint64_t nReconSalt;
+    //! Whether both sides sent sendrecon, so transactions are reconciled rather than announced
+    bool fReconcile;
+    //! Keys of the short ids of the transactions reconciled with this peer
+    uint64_t nReconK0, nReconK1;
+    //! Transactions to reconcile in the next sketch
+    std::set<uint256> setReconTx;
+    //! Outbound peers: the transactions of the sketch sent last, by short id, until it is answered
+    std::map<uint32_t, uint256> mapReconSketched;
+    int64_t nReconSketchTime;
+    int64_t nNextReconSketch;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -211,6 +275,9 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nAvgBlockLatency = 0;
+        nAvgBlockInterval = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -218,6 +285,12 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fDelegatePeer = false;
+        nReconSalt = 0;
+        fReconcile = false;
+        nReconK0 = nReconK1 = 0;
+        nReconSketchTime = 0;
+        nNextReconSketch = 0;
     }
 };
 
@@ -268,7 +341,15 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
     NodeId nodeid = pnode->GetId();
     {
         LOCK(cs_main);
-        mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
+        std::map<NodeId, CNodeState>::iterator it = mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, addrName));
+        // Our connection to a delegate is named after its host, theirs to us comes from its address
+        for (const DelegatePeer& peer : vDelegatePeers) {
+            if (addrName == peer.strHost || (peer.addr.IsValid() && (CNetAddr)addr == peer.addr)) {
+                it->second.fDelegatePeer = true;
+                it->second.delegateKeyID = peer.keyid;
+                break;
+            }
+        }
     }
     if(!pnode->fInbound)
         PushNodeVersion(pnode, connman, GetTime());
@@ -276,6 +357,8 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
 
 void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     fUpdateConnectionTime = false;
+    if (ptxprevalidator)
+        ptxprevalidator->RemoveNode(nodeid);
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
 
@@ -289,12 +372,16 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
         mapBlocksInFlight.erase(entry.hash);
     }
-    EraseOrphansFor(nodeid);
+    orphanage.EraseForPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
 
     mapNodeState.erase(nodeid);
+    {
+        LOCK(cs_netStats);
+        mapPeerTimes.erase(nodeid);
+    }
 
     if (mapNodeState.empty()) {
         // Do a consistency check after the last peer is removed.
@@ -329,6 +416,35 @@ bool MarkBlockAsReceived(const uint256& hash) {
     return false;
 }
 
+// Requires cs_main.
+// Update the download timing of a peer with a block it sent as requested. Call before MarkBlockAsReceived.
+void MeasureBlockReceived(NodeId nodeid, const uint256& hash) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    int64_t nNow = GetTimeMicros();
+    int64_t nLatency = nNow - itInFlight->second.second->nTimeRequested;
+    state->nAvgBlockLatency = state->nAvgBlockLatency ? (7 * state->nAvgBlockLatency + nLatency) / 8 : nLatency;
+    // Only blocks that were queued behind the previous one tell how fast the peer delivers
+    if (state->nLastBlockReceived && itInFlight->second.second->nTimeRequested < state->nLastBlockReceived) {
+        int64_t nInterval = std::max<int64_t>(nNow - state->nLastBlockReceived, 1);
+        state->nAvgBlockInterval = state->nAvgBlockInterval ? (7 * state->nAvgBlockInterval + nInterval) / 8 : nInterval;
+    }
+    state->nLastBlockReceived = nNow;
+}
+
+// Requires cs_main.
+// The number of blocks to keep in flight from a peer: enough to keep it busy for two round trips
+// at the rate it delivered blocks so far, so the download is not held up by latency.
+int GetBlockDownloadWindow(const CNode* pnode, const CNodeState* state) {
+    int64_t nRoundTrip = pnode->nMinPingUsecTime;
+    if (state->nAvgBlockInterval == 0 || nRoundTrip == std::numeric_limits<int64_t>::max())
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nWindow = 2 * nRoundTrip / state->nAvgBlockInterval + 1;
+    return std::max<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
@@ -347,7 +463,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -396,6 +512,48 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+/** Recent new blocks, with when any peer first announced them and the peers that did since */
+static std::map<uint256, std::pair<int64_t, std::set<NodeId> > > mapBlockFirstSeen; // Protected by cs_main
+static std::deque<uint256> dequeBlockFirstSeen; // Protected by cs_main, oldest first
+static const size_t MAX_BLOCK_FIRST_SEEN = 64;
+/** Cap of the delay of one announcement, so a single late one does not swamp the average */
+static const int64_t MAX_BLOCK_RELAY_DELAY_USEC = 60 * 1000 * 1000;
+
+/**
+ * Measure how long after the first announcement of a block by any peer
+ * pfrom announced it, for the block relay delay of the peer that
+ * -latencypeers picks the outbound peers to keep by. Only blocks new at the
+ * tip count, not those of a sync.
+ */
+static void RecordBlockAnnouncement(CNode* pfrom, const uint256& hash, int64_t nTimeReceived)
+{
+    AssertLockHeld(cs_main);
+    if (IsInitialBlockDownload())
+        return;
+
+    auto it = mapBlockFirstSeen.find(hash);
+    if (it == mapBlockFirstSeen.end()) {
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+            return;
+        if (dequeBlockFirstSeen.size() >= MAX_BLOCK_FIRST_SEEN) {
+            mapBlockFirstSeen.erase(dequeBlockFirstSeen.front());
+            dequeBlockFirstSeen.pop_front();
+        }
+        it = mapBlockFirstSeen.insert(std::make_pair(hash, std::make_pair(nTimeReceived, std::set<NodeId>()))).first;
+        dequeBlockFirstSeen.push_back(hash);
+    }
+    if (!it->second.second.insert(pfrom->GetId()).second)
+        return;
+
+    int64_t nDelay = std::max(std::min(nTimeReceived - it->second.first, MAX_BLOCK_RELAY_DELAY_USEC), (int64_t)0);
+    if (pfrom->nBlockAnnouncements == 0)
+        pfrom->nBlockRelayDelayUsec = nDelay;
+    else
+        pfrom->nBlockRelayDelayUsec = (pfrom->nBlockRelayDelayUsec * 7 + nDelay) / 8;
+    pfrom->nBlockAnnouncements++;
+}
+
 void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman& connman) {
     AssertLockHeld(cs_main);
     CNodeState* nodestate = State(nodeid);
@@ -554,8 +712,38 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     }
 }
 
+/** The block after our tip if it is in flight from another peer that takes far longer than it usually does to
+ *  deliver it while this peer is known to be faster, so this peer should be asked for it instead. */
+const CBlockIndex* FindSlowNextBlock(NodeId nodeid) {
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->nAvgBlockLatency == 0 || state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->nHeight <= chainActive.Height())
+        return NULL;
+    const CBlockIndex* pindexNext = state->pindexBestKnownBlock->GetAncestor(chainActive.Height() + 1);
+    if (pindexNext->pprev != chainActive.Tip() || (pindexNext->nStatus & BLOCK_HAVE_DATA))
+        return NULL;
+
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(pindexNext->GetBlockHash());
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first == nodeid)
+        return NULL;
+    CNodeState *stateOther = State(itInFlight->second.first);
+    int64_t nWaiting = GetTimeMicros() - itInFlight->second.second->nTimeRequested;
+    if (stateOther->nAvgBlockLatency == 0 || nWaiting < BLOCK_REREQUEST_LATENCY_FACTOR * stateOther->nAvgBlockLatency || nWaiting < 2 * state->nAvgBlockLatency)
+        return NULL;
+    return pindexNext;
+}
+
 } // anon namespace
 
+void AddDelegatePeer(const CKeyID& keyid, const std::string& strHost)
+{
+    DelegatePeer peer;
+    peer.keyid = keyid;
+    peer.strHost = strHost;
+    peer.addr = LookupNumeric(strHost.c_str(), Params().GetDefaultPort());
+    vDelegatePeers.push_back(peer);
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -568,9 +756,91 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.cmpctBlockStats = state->cmpctBlockStats;
     return true;
 }
 
+void GetCompactBlockStats(CCompactBlockStats& stats) {
+    LOCK(cs_main);
+    stats = cmpctBlockStatsTotal;
+}
+
+static void RecordMessageTimes(NodeId nodeid, const std::string& strCommand, int64_t nQueueTime, int64_t nProcessTime)
+{
+    LOCK(cs_netStats);
+    std::map<std::string, CMessageTimeStats>::iterator it = mapCommandTimes.find(strCommand);
+    if (it == mapCommandTimes.end()) {
+        // Commands peers make up would grow the map without bound
+        const std::vector<std::string>& vTypes = getAllNetMessageTypes();
+        bool fKnown = std::find(vTypes.begin(), vTypes.end(), strCommand) != vTypes.end();
+        it = mapCommandTimes.insert(std::make_pair(fKnown ? strCommand : std::string("*other*"), CMessageTimeStats())).first;
+    }
+    it->second.queueTime.Add(nQueueTime);
+    it->second.processTime.Add(nProcessTime);
+    CMessageTimeStats& peerTimes = mapPeerTimes[nodeid];
+    peerTimes.queueTime.Add(nQueueTime);
+    peerTimes.processTime.Add(nProcessTime);
+}
+
+static CBlockRelayTimes& GetBlockRelayTimes(const uint256& hash, NodeId nFromPeer, int64_t nTime)
+{
+    AssertLockHeld(cs_netStats);
+    for (CBlockRelayTimes& times : dequeBlockTimes) {
+        if (times.hash == hash)
+            return times;
+    }
+    if (dequeBlockTimes.size() >= MAX_BLOCK_RELAY_TIMES)
+        dequeBlockTimes.pop_back();
+    CBlockRelayTimes times = {hash, -1, nFromPeer, nTime, 0};
+    dequeBlockTimes.push_front(times);
+    return dequeBlockTimes.front();
+}
+
+/** A block or compact block was received from a peer */
+static void RecordBlockSeen(const uint256& hash, NodeId nodeid, int64_t nTimeReceived)
+{
+    LOCK(cs_netStats);
+    GetBlockRelayTimes(hash, nodeid, nTimeReceived);
+}
+
+/** A block was announced to a peer, or ours was accepted before it was */
+static void RecordBlockRelayed(const CBlockIndex* pindex, bool fAnnounced)
+{
+    int64_t nNow = GetTimeMicros();
+    LOCK(cs_netStats);
+    CBlockRelayTimes& times = GetBlockRelayTimes(pindex->GetBlockHash(), -1, nNow);
+    times.nHeight = pindex->nHeight;
+    if (fAnnounced && times.nRelayed == 0)
+        times.nRelayed = nNow;
+}
+
+void GetNetTimeStats(CNetTimeStats& stats)
+{
+    LOCK(cs_netStats);
+    stats.mapCommand = mapCommandTimes;
+    stats.mapPeer = mapPeerTimes;
+    stats.vBlocks.assign(dequeBlockTimes.begin(), dequeBlockTimes.end());
+}
+
+void LogNetTimeStats()
+{
+    CNetTimeStats stats;
+    GetNetTimeStats(stats);
+    for (const auto& item : stats.mapCommand) {
+        const CMessageTimeStats& times = item.second;
+        LogPrintf("netstats: %s count=%u queue avg/p90/max=%d/%d/%dus process avg/p90/max=%d/%d/%dus\n", item.first, times.processTime.nCount,
+            times.queueTime.nTotal / times.queueTime.nCount, times.queueTime.GetPercentile(0.9), times.queueTime.nMax,
+            times.processTime.nTotal / times.processTime.nCount, times.processTime.GetPercentile(0.9), times.processTime.nMax);
+    }
+    for (const CBlockRelayTimes& times : stats.vBlocks) {
+        if (times.nRelayed == 0)
+            continue;
+        LogPrintf("netstats: block %s height=%d peer=%d relayed after %dus\n", times.hash.ToString(), times.nHeight, times.nFromPeer, times.nRelayed - times.nFirstSeen);
+        // Only the latest one
+        break;
+    }
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
@@ -589,7 +859,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// orphan transactions
 //
 
 void AddToCompactExtraTransactions(const CTransactionRef& tx)
@@ -603,109 +873,6 @@ void AddToCompactExtraTransactions(const CTransactionRef& tx)
     vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
 }
 
-bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    const uint256& hash = tx->GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is
-    // at most 10 megabytes of orphans and somewhat more byprev index (in the worst case):
-    unsigned int sz = GetTransactionWeight(*tx);
-    if (sz >= MAX_STANDARD_TX_WEIGHT)
-    {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
-        return false;
-    }
-
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
-    assert(ret.second);
-    BOOST_FOREACH(const CTxIn& txin, tx->vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
-    }
-
-    AddToCompactExtraTransactions(tx);
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return 0;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx->vin)
-    {
-        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(it);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
-    return 1;
-}
-
-void EraseOrphansFor(NodeId peer)
-{
-    int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer=%d\n", nErased, peer);
-}
-
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    unsigned int nEvicted = 0;
-    static int64_t nNextSweep;
-    int64_t nNow = GetTime();
-    if (nNextSweep <= nNow) {
-        // Sweep out expired orphan pool entries:
-        int nErased = 0;
-        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-        while (iter != mapOrphanTransactions.end())
-        {
-            std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
-            if (maybeErase->second.nTimeExpire <= nNow) {
-                nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
-            } else {
-                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
-            }
-        }
-        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
-        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
-        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
-    }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
-}
-
 // Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
@@ -747,38 +914,47 @@ void PeerLogicValidation::SyncTransaction(const CTransaction& tx, const CBlockIn
     if (nPosInBlock == CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK)
         return;
 
-    LOCK(cs_main);
-
-    std::vector<uint256> vOrphanErase;
-    // Which orphan pool entries must we evict?
-    for (size_t j = 0; j < tx.vin.size(); j++) {
-        auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
-        if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
-        for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-            const CTransaction& orphanTx = *(*mi)->second.tx;
-            const uint256& orphanHash = orphanTx.GetHash();
-            vOrphanErase.push_back(orphanHash);
-        }
-    }
-
     // Erase orphan transactions include or precluded by this block
-    if (vOrphanErase.size()) {
-        int nErased = 0;
-        BOOST_FOREACH(uint256 &orphanHash, vOrphanErase) {
-            nErased += EraseOrphanTx(orphanHash);
-        }
-        LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
-    }
+    orphanage.EraseForBlockTx(tx);
 }
 
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
+static CSharedNetMsgRef most_recent_compact_block_msg;
 static uint256 most_recent_block_hash;
 
+/**
+ * Transactions of a new block that its peers are likely to miss: those that
+ * reached our mempool only just before it, DPoS operations, which peers may
+ * have evicted under their own -maxmempooldpos limit, and those that did not
+ * come through our mempool at all. The block is not connected yet, so the
+ * mempool still holds its transactions.
+ */
+static std::vector<size_t> GetCompactBlockPrefill(const CBlock& block)
+{
+    std::vector<size_t> vIndexes;
+    int64_t nNow = GetTime();
+    size_t nBytes = 0;
+    LOCK(mempool.cs);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(block.vtx[i]->GetHash());
+        if (it != mempool.mapTx.end() && !it->IsDPoSOp() && it->GetTime() < nNow - CMPCTBLOCK_PREFILL_RECENT_SECONDS)
+            continue;
+        size_t nTxSize = ::GetSerializeSize(*block.vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+        if (nBytes + nTxSize > MAX_CMPCTBLOCK_PREFILL_BYTES)
+            continue;
+        nBytes += nTxSize;
+        vIndexes.push_back(i);
+    }
+    return vIndexes;
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
-    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true, GetCompactBlockPrefill(*pblock));
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    // Serialized once for all the peers it is announced to
+    CSharedNetMsgRef pcmpctmsg = MakeSharedNetMsg(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
 
     LOCK(cs_main);
 
@@ -789,16 +965,41 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
     bool fWitnessEnabled = IsWitnessEnabled(pindex->pprev, Params().GetConsensus());
     uint256 hashBlock(pblock->GetHash());
+    // Blocks we forged are seen first here
+    RecordBlockRelayed(pindex, false);
 
     {
         LOCK(cs_most_recent_block);
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block_msg = pcmpctmsg;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // The delegates forging the next slots need the block before their slot opens,
+    // so their nodes get it first, in slot order, whether or not they asked for it
+    if (!vDelegatePeers.empty()) {
+        std::vector<CKeyID> vNextDelegates = DPoS::GetInstance().GetNextSlotDelegates(const_cast<CBlockIndex*>(pindex), *pblock, DELEGATE_RELAY_SLOTS);
+        for (const CKeyID& keyid : vNextDelegates) {
+            connman->ForEachNode([this, &pcmpctmsg, pindex, fWitnessEnabled, &hashBlock, &keyid](CNode* pnode) {
+                if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
+                    return;
+                CNodeState &state = *State(pnode->GetId());
+                if (!state.fDelegatePeer || state.delegateKeyID != keyid)
+                    return;
+                ProcessBlockAvailability(pnode->GetId());
+                if (state.fProvidesHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) && !PeerHasHeader(&state, pindex)) {
+                    LogPrint("net", "%s sending header-and-ids %s to delegate peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
+                            hashBlock.ToString(), pnode->id);
+                    connman->PushMessage(pnode, pcmpctmsg);
+                    state.pindexBestHeaderSent = pindex;
+                    RecordBlockRelayed(pindex, true);
+                }
+            });
+        }
+    }
+
+    connman->ForEachNode([this, &pcmpctmsg, pindex, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -810,8 +1011,9 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, pcmpctmsg);
             state.pindexBestHeaderSent = pindex;
+            RecordBlockRelayed(pindex, true);
         }
     });
 }
@@ -904,12 +1106,14 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // Only the first two outputs are checked, as most transactions have no more.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   orphanage.HaveTx(inv.hash) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -964,8 +1168,111 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/** Plain block requests at the front of a getdata served together, as many as a syncing peer asks for at once */
+static const size_t MAX_GETDATA_BLOCK_BATCH = 16;
+
+/**
+ * Serve the plain block requests at the front of the getdata queue of the
+ * peer together. Recent blocks are sent as they were serialized when
+ * connected, others of the active chain are read in one pass over the block
+ * files, after their positions are looked up and cs_main is released. A
+ * request that needs more, such as a block outside the active chain or the
+ * one of hashContinue, ends the batch and is left to ProcessGetData. False
+ * if no block was sent.
+ */
+static bool ProcessGetBlockBatch(CNode* pfrom, CConnman& connman)
+{
+    std::vector<CInv> vInv;
+    for (const CInv& inv : pfrom->vRecvGetData) {
+        if ((inv.type != MSG_BLOCK && inv.type != MSG_WITNESS_BLOCK) || inv.hash == pfrom->hashContinue || vInv.size() == MAX_GETDATA_BLOCK_BATCH)
+            break;
+        vInv.push_back(inv);
+    }
+
+    std::vector<std::shared_ptr<const std::vector<unsigned char> > > vData(vInv.size());
+    bool fCached = true;
+    for (size_t i = 0; i < vInv.size(); i++) {
+        vData[i] = rawBlockCache.Get(vInv[i].hash, vInv[i].type == MSG_WITNESS_BLOCK);
+        fCached &= !!vData[i];
+    }
+
+    size_t nBatch = vInv.size();
+    std::vector<size_t> vRead;
+    std::vector<CDiskBlockPos> vPos;
+    if (!fCached) {
+        LOCK(cs_main);
+        static const int nOneWeek = 7 * 24 * 60 * 60;
+        for (size_t i = 0; i < nBatch; i++) {
+            if (vData[i])
+                continue;
+            BlockMap::iterator mi = mapBlockIndex.find(vInv[i].hash);
+            const CBlockIndex* pindex = mi == mapBlockIndex.end() ? NULL : mi->second;
+            if (!pindex || !chainActive.Contains(pindex) || !(pindex->nStatus & BLOCK_HAVE_DATA) ||
+                (!pfrom->fWhitelisted && pindexBestHeader != NULL && pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > nOneWeek &&
+                 connman.OutboundTargetReached(true))) {
+                nBatch = i;
+                break;
+            }
+            vRead.push_back(i);
+            vPos.push_back(pindex->GetBlockPos());
+        }
+    }
+
+    std::vector<std::vector<unsigned char> > vBlocks;
+    if (!vPos.empty())
+        ReadRawBlocksFromDisk(vBlocks, vPos);
+    for (size_t j = 0; j < vRead.size(); j++) {
+        size_t i = vRead[j];
+        const char* pbegin = (const char*)vBlocks[j].data();
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pbegin, pbegin + vBlocks[j].size());
+        CBlock block;
+        uint256 hash;
+        bool fWitness = false;
+        try {
+            // Blocks are stored with their witness data, which a peer asking for a plain block does not get
+            if (vInv[i].type == MSG_WITNESS_BLOCK) {
+                CBlockHeader header;
+                reader >> header;
+                hash = header.GetHash();
+            } else {
+                reader >> block;
+                hash = block.GetHash();
+                for (const CTransactionRef& tx : block.vtx)
+                    fWitness |= tx->HasWitness();
+            }
+        } catch (const std::exception&) {
+            hash.SetNull();
+        }
+        if (hash != vInv[i].hash) {
+            // ProcessGetData reads it again the usual way
+            nBatch = i;
+            break;
+        }
+        if (fWitness) {
+            std::vector<unsigned char> vchBlock;
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, vchBlock, 0, block);
+            vData[i] = std::make_shared<const std::vector<unsigned char> >(std::move(vchBlock));
+        } else {
+            vData[i] = std::make_shared<const std::vector<unsigned char> >(std::move(vBlocks[j]));
+        }
+    }
+
+    size_t nSent = 0;
+    while (nSent < nBatch && !pfrom->fPauseSend) {
+        connman.PushMessage(pfrom, MakeSharedNetMsg(NetMsgType::BLOCK, vData[nSent]));
+        GetMainSignals().Inventory(vInv[nSent].hash);
+        nSent++;
+    }
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), pfrom->vRecvGetData.begin() + nSent);
+    return nSent > 0;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
+    // Blocks of the active chain are sent in batches, reading them from disk without holding cs_main
+    if (!pfrom->fPauseSend && !pfrom->vRecvGetData.empty() && ProcessGetBlockBatch(pfrom, connman))
+        return;
+
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
@@ -1034,11 +1341,16 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
+                    // Send a recent block as it was serialized when connected, others from disk
+                    std::shared_ptr<const std::vector<unsigned char> > pblockData;
+                    if (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+                        pblockData = rawBlockCache.Get(inv.hash, inv.type == MSG_WITNESS_BLOCK);
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!pblockData && !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    if (pblockData)
+                        connman.PushMessage(pfrom, MakeSharedNetMsg(NetMsgType::BLOCK, pblockData));
+                    else if (inv.type == MSG_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
@@ -1103,7 +1415,11 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 auto mi = mapRelay.find(inv.hash);
                 int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
                 if (mi != mapRelay.end()) {
-                    connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                    // Every peer asking for it gets the same serialization
+                    CSharedNetMsgRef& msg = mi->second.msg[inv.type == MSG_TX ? 0 : 1];
+                    if (!msg)
+                        msg = MakeSharedNetMsg(msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second.tx));
+                    connman.PushMessage(pfrom, msg);
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
@@ -1166,6 +1482,239 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Try to add a transaction received from pfrom to the mempool, relay it and the
+ * orphans it lets in, or keep it as an orphan
+ */
+static void ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, const CChainParams& chainparams, CConnman& connman)
+{
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    std::deque<COutPoint> vWorkQueue;
+    std::vector<uint256> vEraseQueue;
+    const CTransaction& tx = *ptx;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    LOCK(cs_main);
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    pfrom->setAskFor.erase(inv.hash);
+    mapAlreadyAskedFor.erase(inv.hash);
+
+    std::list<CTransactionRef> lRemovedTxn;
+
+    if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx, connman);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            vWorkQueue.emplace_back(inv.hash, i);
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->id,
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        std::set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty()) {
+            // Copied out, so the orphanage is not locked while they are validated
+            std::vector<std::pair<CTransactionRef, NodeId>> vChildren = orphanage.GetChildren(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            for (const auto& child : vChildren)
+            {
+                const CTransactionRef& porphanTx = child.first;
+                const CTransaction& orphanTx = *porphanTx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = child.second;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanHash, i);
+                    }
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions or
+                        // witness-stripped transactions, as they can have been malleated.
+                        // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
+                    }
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(uint256 hash, vEraseQueue)
+            orphanage.EraseTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+            }
+            if (orphanage.AddTx(ptx, pfrom->GetId(), GetTime() + ORPHAN_TX_EXPIRE_TIME))
+                AddToCompactExtraTransactions(ptx);
+
+            // DoS prevention: do not allow the orphans to grow unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            size_t nMaxOrphanBytes = (size_t)std::max((int64_t)0, GetArg("-maxorphanmem", DEFAULT_MAX_ORPHAN_MEMORY)) * 1000000;
+            unsigned int nEvicted = orphanage.Limit(nMaxOrphanTx, nMaxOrphanBytes, GetTime());
+            if (nEvicted > 0)
+                LogPrint("mempool", "orphan pool overflow, removed %u tx\n", nEvicted);
+        } else {
+            LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        if (!tx.HasWitness() && !state.CorruptionPossible()) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been malleated.
+            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
+            AddToCompactExtraTransactions(ptx);
+        }
+
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx, connman);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+            }
+        }
+    }
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->id,
+            FormatStateMessage(state));
+        if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, std::string(NetMsgType::TX), (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+        if (nDoS > 0) {
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+/** Announce transactions left over from a reconciliation with a peer */
+static void PushTxInventory(CNode* pto, const std::vector<uint256>& vHash, CConnman& connman)
+{
+    const CNetMsgMaker msgMaker(pto->GetSendVersion());
+    std::vector<CInv> vInv;
+    for (const uint256& hash : vHash) {
+        vInv.push_back(CInv(MSG_TX, hash));
+        if (vInv.size() == MAX_INV_SZ) {
+            connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+            vInv.clear();
+        }
+    }
+    if (!vInv.empty())
+        connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+}
+
+/**
+ * Check a request for block filters and find the blocks of the active chain it
+ * covers, from nStartHeight up to the stop block, or with nMaxSize 0 the
+ * checkpoints up to the stop block. A peer asking for filters we
+ * do not serve, or for a range that is not well-formed, is disconnected.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop,
+                                      uint32_t nMaxSize, std::vector<const CBlockIndex*>& vIndex)
+{
+    if (!(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) || pblockfilterindexer == NULL || nFilterType != BLOCK_FILTER_BASIC) {
+        LogPrint("net", "peer %d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(hashStop);
+    if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+        LogPrint("net", "peer %d requested block filters up to block %s not on the active chain\n", pfrom->id, hashStop.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    const CBlockIndex* pindexStop = it->second;
+    if (nMaxSize > 0 && (nStartHeight > (uint32_t)pindexStop->nHeight || pindexStop->nHeight - nStartHeight >= nMaxSize)) {
+        LogPrint("net", "peer %d requested block filters from height %u to %d\n", pfrom->id, nStartHeight, pindexStop->nHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    if (nMaxSize > 0) {
+        vIndex.resize(pindexStop->nHeight - nStartHeight + 1);
+        for (const CBlockIndex* pindex = pindexStop; pindex && (uint32_t)pindex->nHeight >= nStartHeight; pindex = pindex->pprev)
+            vIndex[pindex->nHeight - nStartHeight] = pindex;
+    } else {
+        // The checkpoints of a cfcheckpt
+        for (int nHeight = CFCHECKPT_INTERVAL; nHeight <= pindexStop->nHeight; nHeight += CFCHECKPT_INTERVAL)
+            vIndex.push_back(pindexStop->GetAncestor(nHeight));
+    }
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1422,6 +1971,22 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             nCMPCTBLOCKVersion = 1;
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
         }
+        bool fRelay;
+        {
+            LOCK(pfrom->cs_filter);
+            fRelay = pfrom->fRelayTxes;
+        }
+        if (GetBoolArg("-txreconciliation", DEFAULT_TX_RECONCILIATION) && fRelay && pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Offer to reconcile transaction announcements, which starts once the peer offers too
+            uint64_t nSalt = 0;
+            while (nSalt == 0)
+                GetRandBytes((unsigned char*)&nSalt, sizeof(nSalt));
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->nReconSalt = nSalt;
+            }
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDRECON, TX_RECONCILIATION_VERSION, nSalt));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1506,10 +2071,200 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 else
                     State(pfrom->GetId())->fSupportsDesiredCmpctVersion = (nCMPCTBLOCKVersion == 1);
             }
+            // Have the nodes of delegates announce their blocks to us as compact blocks right away
+            if (State(pfrom->GetId())->fDelegatePeer)
+                MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId(), connman);
         }
     }
 
 
+    else if (strCommand == NetMsgType::SENDRECON)
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nSalt = 0;
+        vRecv >> nReconVersion >> nSalt;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        // Only once, and only if we offered to reconcile as well
+        if (state->nReconSalt != 0 && !state->fReconcile && nReconVersion >= TX_RECONCILIATION_VERSION) {
+            GetReconciliationKeys(state->nReconSalt, nSalt, state->nReconK0, state->nReconK1);
+            state->fReconcile = true;
+            LogPrint("net", "reconciling transactions with peer=%d\n", pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::RECONSKETCH)
+    {
+        CReconSketch sketch;
+        vRecv >> sketch;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        // Sketches are only sent by the outbound side
+        if (!state->fReconcile || !pfrom->fInbound)
+            return true;
+        if (sketch.GetCells() < MIN_RECON_SKETCH_CELLS || sketch.GetCells() > MAX_RECON_SKETCH_CELLS) {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("reconsketch message size = %u", sketch.GetCells());
+        }
+
+        // Sketch the transactions we would have announced, in the same size
+        CReconSketch ours(sketch.GetCells());
+        std::map<uint32_t, uint256> mapOurs;
+        std::vector<uint256> vAnnounce;
+        for (const uint256& hash : state->setReconTx) {
+            uint32_t nShortId = GetReconciliationShortId(state->nReconK0, state->nReconK1, hash);
+            if (!mapOurs.emplace(nShortId, hash).second) {
+                // A short id can only stand for one transaction, announce the other
+                vAnnounce.push_back(hash);
+                continue;
+            }
+            ours.Add(nShortId);
+        }
+        state->setReconTx.clear();
+
+        std::vector<uint32_t> vOnlyTheirs, vOnlyOurs;
+        bool fDecoded = sketch.Subtract(ours) && sketch.Decode(vOnlyTheirs, vOnlyOurs);
+        if (fDecoded) {
+            for (uint32_t nShortId : vOnlyOurs) {
+                std::map<uint32_t, uint256>::iterator it = mapOurs.find(nShortId);
+                if (it != mapOurs.end())
+                    vAnnounce.push_back(it->second);
+            }
+        } else {
+            // Too many differences, fall back to announcing everything both ways
+            vOnlyTheirs.clear();
+            for (const auto& item : mapOurs)
+                vAnnounce.push_back(item.second);
+        }
+        PushTxInventory(pfrom, vAnnounce, connman);
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONDIFF, fDecoded, vOnlyTheirs));
+    }
+
+
+    else if (strCommand == NetMsgType::RECONDIFF)
+    {
+        bool fDecoded = false;
+        std::vector<uint32_t> vWanted;
+        vRecv >> fDecoded >> vWanted;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->fReconcile || pfrom->fInbound)
+            return true;
+        if (vWanted.size() > MAX_RECON_SKETCH_CELLS) {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("recondiff message size = %u", vWanted.size());
+        }
+        std::vector<uint256> vAnnounce;
+        if (fDecoded) {
+            for (uint32_t nShortId : vWanted) {
+                std::map<uint32_t, uint256>::iterator it = state->mapReconSketched.find(nShortId);
+                if (it != state->mapReconSketched.end())
+                    vAnnounce.push_back(it->second);
+            }
+        } else {
+            for (const auto& item : state->mapReconSketched)
+                vAnnounce.push_back(item.second);
+        }
+        state->mapReconSketched.clear();
+        PushTxInventory(pfrom, vAnnounce, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETROUNDPROOF)
+    {
+        uint256 hashBlock;
+        vRecv >> hashBlock;
+
+        std::vector<CCoinbaseProof> vProof;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+            if (it == mapBlockIndex.end() || !chainActive.Contains(it->second) || !DPoS::GetInstance().GetRoundProof(it->second, vProof)) {
+                LogPrint("net", "Peer %d asked for the round proof of block %s we cannot prove\n", pfrom->id, hashBlock.ToString());
+                vProof.clear();
+            }
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::ROUNDPROOF, vProof));
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFILTERS)
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<const CBlockIndex*> vIndex;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, vIndex))
+            return true;
+
+        // The filters come from the index, the blocks are never read
+        for (const CBlockIndex* pindex : vIndex) {
+            CBlockFilter filter;
+            if (!pblockfilterindexer->LookupFilter(pindex, filter)) {
+                LogPrint("net", "Peer %d asked for the filter of block %s, not indexed yet\n", pfrom->id, pindex->GetBlockHash().ToString());
+                break;
+            }
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, nFilterType, filter.GetBlockHash(), filter.GetEncoded()));
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFHEADERS)
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<const CBlockIndex*> vIndex;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, vIndex))
+            return true;
+
+        uint256 hashFilter, hashPrevHeader, hashHeader;
+        if (vIndex[0]->pprev && !pblockfilterindexer->LookupFilterHashes(vIndex[0]->pprev, hashFilter, hashPrevHeader)) {
+            LogPrint("net", "Peer %d asked for filter headers above block %s, not indexed yet\n", pfrom->id, vIndex[0]->pprev->GetBlockHash().ToString());
+            return true;
+        }
+        std::vector<uint256> vFilterHash;
+        vFilterHash.reserve(vIndex.size());
+        for (const CBlockIndex* pindex : vIndex) {
+            if (!pblockfilterindexer->LookupFilterHashes(pindex, hashFilter, hashHeader)) {
+                LogPrint("net", "Peer %d asked for the filter hash of block %s, not indexed yet\n", pfrom->id, pindex->GetBlockHash().ToString());
+                return true;
+            }
+            vFilterHash.push_back(hashFilter);
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, nFilterType, hashStop, hashPrevHeader, vFilterHash));
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT)
+    {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        std::vector<const CBlockIndex*> vIndex;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, hashStop, 0, vIndex))
+            return true;
+
+        uint256 hashFilter, hashHeader;
+        std::vector<uint256> vHeader;
+        vHeader.reserve(vIndex.size());
+        for (const CBlockIndex* pindex : vIndex) {
+            if (!pblockfilterindexer->LookupFilterHashes(pindex, hashFilter, hashHeader)) {
+                LogPrint("net", "Peer %d asked for the filter header of block %s, not indexed yet\n", pfrom->id, pindex->GetBlockHash().ToString());
+                return true;
+            }
+            vHeader.push_back(hashHeader);
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType, hashStop, vHeader));
+    }
+
+
     else if (strCommand == NetMsgType::INV)
     {
         if(IsInitialBlockDownload())
@@ -1550,6 +2305,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             }
 
             if (inv.type == MSG_BLOCK) {
+                RecordBlockAnnouncement(pfrom, inv.hash, nTimeReceived);
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
                     // We used to request the full block here, but since headers-announcements are now the
@@ -1765,7 +2521,12 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // will re-announce the new block via headers (or compact blocks again)
         // in the SendMessages logic.
         nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
-        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+        if ((pfrom->GetLocalServices() & NODE_COMPRESSED_HEADERS) && (pfrom->nServices & NODE_COMPRESSED_HEADERS)) {
+            std::vector<CBlockHeader> vCompressed(vHeaders.begin(), vHeaders.end());
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CHEADERS, CCompressedHeaders(DPoS::GetInstance().GetBlockIntervalTime(), vCompressed)));
+        } else {
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+        }
     }
 
 
@@ -1779,8 +2540,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -1788,169 +2547,13 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv.hash);
-
-        std::list<CTransactionRef> lRemovedTxn;
-
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
-                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0)
-                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-            } else {
-                LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
-            }
-        } else {
-            if (!tx.HasWitness() && !state.CorruptionPossible()) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been malleated.
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
-                AddToCompactExtraTransactions(ptx);
-            }
-
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
-                }
-            }
+        // Verify the scripts on the prevalidation workers first, unless the transaction is known
+        if (ptxprevalidator && !mempool.exists(inv.hash)) {
+            ptxprevalidator->Submit(pfrom->GetId(), ptx);
+            return true;
         }
 
-        for (const CTransactionRef& removedTx : lRemovedTxn)
-            AddToCompactExtraTransactions(removedTx);
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->id,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
+        ProcessTransaction(pfrom, ptx, chainparams, connman);
     }
 
 
@@ -1958,6 +2561,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     {
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
+        RecordBlockSeen(cmpctblock.header.GetHash(), pfrom->GetId(), nTimeReceived);
 
         {
         LOCK(cs_main);
@@ -2005,6 +2609,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         LOCK(cs_main);
         // If AcceptBlockHeader returned true, it set pindex
         assert(pindex);
+        RecordBlockAnnouncement(pfrom, pindex->GetBlockHash(), nTimeReceived);
         UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
 
         std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
@@ -2073,6 +2678,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     if (!partialBlock.IsTxAvailable(i))
                         req.indexes.push_back(i);
                 }
+                nodestate->cmpctBlockStats.Add(cmpctblock.BlockTxCount(), cmpctblock.PrefilledTxCount(), req.indexes.size());
+                cmpctBlockStatsTotal.Add(cmpctblock.BlockTxCount(), cmpctblock.PrefilledTxCount(), req.indexes.size());
                 if (req.indexes.empty()) {
                     // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
                     BlockTransactions txn;
@@ -2218,6 +2825,31 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::CHEADERS && !fImporting && !fReindex)
+    {
+        if (!(pfrom->GetLocalServices() & NODE_COMPRESSED_HEADERS)) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("cheaders message from peer=%d without NODE_COMPRESSED_HEADERS", pfrom->id);
+        }
+
+        // The headers are expanded as far as the message has data for them
+        CCompressedHeaders compressed;
+        vRecv >> compressed;
+        if (compressed.vHeaders.size() > MAX_HEADERS_RESULTS) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("cheaders message size = %u", compressed.vHeaders.size());
+        }
+
+        // Processed as the headers message it stands for
+        CDataStream vHeadersMsg(SER_NETWORK, PROTOCOL_VERSION);
+        std::vector<CBlock> headers(compressed.vHeaders.begin(), compressed.vHeaders.end());
+        vHeadersMsg << headers;
+        return ProcessMessage(pfrom, NetMsgType::HEADERS, vHeadersMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
+    }
+
+
     else if (strCommand == NetMsgType::HEADERS && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
@@ -2303,6 +2935,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         nodestate->nUnconnectingHeaders = 0;
 
         assert(pindexLast);
+        if (nCount <= MAX_BLOCKS_TO_ANNOUNCE)
+            RecordBlockAnnouncement(pfrom, pindexLast->GetBlockHash(), nTimeReceived);
         UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
         if (nCount == MAX_HEADERS_RESULTS) {
@@ -2373,6 +3007,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         vRecv >> *pblock;
 
         LogPrint("net", "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->id);
+        RecordBlockSeen(pblock->GetHash(), pfrom->GetId(), nTimeReceived);
 
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
@@ -2384,6 +3019,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            MeasureBlockReceived(pfrom->GetId(), hash);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2416,7 +3052,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
         BOOST_FOREACH(const CAddress &addr, vAddr)
@@ -2638,6 +3277,20 @@ static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman& connman)
     return false;
 }
 
+/**
+ * Messages whose handling only uses the peer itself and state protected by
+ * cs_main or locks of its own, which can be processed while another message
+ * handler works on other peers' messages.
+ */
+static bool IsConcurrentMessage(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::PING || strCommand == NetMsgType::PONG ||
+           strCommand == NetMsgType::ADDR || strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::INV || strCommand == NetMsgType::GETDATA ||
+           strCommand == NetMsgType::GETCFILTERS || strCommand == NetMsgType::GETCFHEADERS ||
+           strCommand == NetMsgType::GETCFCHECKPT;
+}
+
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     const CChainParams& chainparams = Params();
@@ -2657,6 +3310,16 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
     if (pfrom->fDisconnect)
         return false;
 
+    // Transactions whose scripts were verified meanwhile, in the order they were received
+    CTransactionRef ptxReady;
+    CPendingSignatures pending;
+    while (ptxprevalidator && ptxprevalidator->TakeReady(pfrom->GetId(), ptxReady, pending)) {
+        LOCK(cs_serialMessages);
+        CPendingSignatures::Scope scope(pending);
+        ProcessTransaction(pfrom, ptxReady, chainparams, connman);
+        pending.clear();
+    }
+
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
@@ -2669,10 +3332,18 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
                 return false;
+            // Other messages wait for the transactions still being verified, to keep their order
+            size_t nPreValidating = ptxprevalidator ? ptxprevalidator->GetQueued(pfrom->GetId()) : 0;
+            if (nPreValidating > 0 && (nPreValidating >= MAX_PREVALIDATION_TXS_PER_PEER ||
+                                       pfrom->vProcessMsg.front().hdr.GetCommand() != NetMsgType::TX))
+                return false;
             // Just take one message
             msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
             pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
-            pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
+            bool fWasPaused = pfrom->fPauseRecv;
+            pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize() || pfrom->vProcessMsg.size() >= MAX_PROCESS_QUEUE_MESSAGES;
+            if (fWasPaused && !pfrom->fPauseRecv)
+                connman.WakeSocketHandler();
             fMoreWork = !pfrom->vProcessMsg.empty();
         }
         CNetMessage& msg(msgs.front());
@@ -2713,7 +3384,18 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            int64_t nTimeStart;
+            if (IsConcurrentMessage(strCommand)) {
+                nTimeStart = GetTimeMicros();
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            } else {
+                LOCK(cs_serialMessages);
+                nTimeStart = GetTimeMicros();
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+            }
+            int64_t nTimeDone = GetTimeMicros();
+            RecordMessageTimes(pfrom->GetId(), strCommand, nTimeStart - msg.nTime, nTimeDone - nTimeStart);
+            TRACE6(net, inbound_message, pfrom->GetId(), strCommand.c_str(), nMessageSize, nTimeStart - msg.nTime, nTimeDone - nTimeStart, fRet);
             if (interruptMsgProc)
                 return false;
             if (!pfrom->vRecvGetData.empty())
@@ -2770,7 +3452,14 @@ public:
     bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
     {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
+         * fewest ancestors/highest fee to sort later. Transactions that
+         * arrived since the order was ranked go after the ranked ones. */
+        auto ita = mapRelayOrder.find(*a);
+        auto itb = mapRelayOrder.find(*b);
+        if (ita != mapRelayOrder.end() && itb != mapRelayOrder.end())
+            return ita->second > itb->second;
+        if (ita != mapRelayOrder.end() || itb != mapRelayOrder.end())
+            return ita == mapRelayOrder.end();
         return mp->CompareDepthAndScore(*b, *a);
     }
 };
@@ -2835,6 +3524,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
@@ -2864,8 +3554,8 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             pindexBestHeader = chainActive.Tip();
         bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
         if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
-            // Only actively request headers from a single peer, unless we're close to today.
-            if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 24 * 60 * 60) {
+            // Only actively request headers from a few peers, unless we're close to today.
+            if ((nSyncStarted < MAX_HEADERS_SYNC_PEERS && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 24 * 60 * 60) {
                 state.fSyncStarted = true;
                 nSyncStarted++;
                 const CBlockIndex *pindexStart = pindexBestHeader;
@@ -2972,7 +3662,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
                             if (state.fWantsCmpctWitness)
-                                connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                                connman.PushMessage(pto, most_recent_compact_block_msg);
                             else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
                                 connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
@@ -2988,6 +3678,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
+                    RecordBlockRelayed(pBestIndex, true);
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
                         LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
@@ -3000,6 +3691,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     }
                     connman.PushMessage(pto, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
                     state.pindexBestHeaderSent = pBestIndex;
+                    RecordBlockRelayed(pBestIndex, true);
                 } else
                     fRevertToInv = true;
             }
@@ -3026,6 +3718,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         pto->PushInventory(CInv(MSG_BLOCK, hashToAnnounce));
                         LogPrint("net", "%s: sending inv peer=%d hash=%s\n", __func__,
                             pto->id, hashToAnnounce.ToString());
+                        RecordBlockRelayed(pindex, true);
                     }
                 }
             }
@@ -3112,6 +3805,15 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                 }
                 // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                 // A heap is used so that not all items need sorting if only a few are being sent.
+                if (nNow >= nNextRelayOrder) {
+                    std::vector<uint256> vtxid;
+                    mempool.queryHashes(vtxid);
+                    mapRelayOrder.clear();
+                    mapRelayOrder.reserve(vtxid.size());
+                    for (uint32_t i = 0; i < vtxid.size(); i++)
+                        mapRelayOrder.emplace(vtxid[i], i);
+                    nNextRelayOrder = nNow + (int64_t)INVENTORY_BROADCAST_INTERVAL * 1000000;
+                }
                 CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
                 std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
@@ -3139,8 +3841,11 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         continue;
                     }
                     if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
+                    // Send, or keep it for the next reconciliation
+                    if (state.fReconcile && state.setReconTx.size() < MAX_RECON_SET_SIZE)
+                        state.setReconTx.insert(hash);
+                    else
+                        vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
                     {
                         // Expire old relay messages
@@ -3150,7 +3855,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, RelayTx(std::move(txinfo.tx))));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3166,6 +3871,40 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
+        //
+        // Message: reconsketch
+        //
+        if (state.fReconcile && !pto->fInbound) {
+            if (!state.mapReconSketched.empty() && state.nReconSketchTime + RECON_RESPONSE_TIMEOUT * 1000000LL < nNow) {
+                // No answer, announce the sketched transactions after all
+                std::vector<uint256> vAnnounce;
+                for (const auto& item : state.mapReconSketched)
+                    vAnnounce.push_back(item.second);
+                state.mapReconSketched.clear();
+                PushTxInventory(pto, vAnnounce, connman);
+            }
+            if (state.mapReconSketched.empty() && state.nNextReconSketch < nNow) {
+                state.nNextReconSketch = PoissonNextSend(nNow, RECON_REQUEST_INTERVAL);
+                if (!state.setReconTx.empty()) {
+                    // Room for a difference as large as our own set
+                    CReconSketch sketch(std::min(MAX_RECON_SKETCH_CELLS, MIN_RECON_SKETCH_CELLS + state.setReconTx.size()));
+                    std::vector<uint256> vAnnounce;
+                    for (const uint256& hash : state.setReconTx) {
+                        uint32_t nShortId = GetReconciliationShortId(state.nReconK0, state.nReconK1, hash);
+                        if (!state.mapReconSketched.emplace(nShortId, hash).second) {
+                            vAnnounce.push_back(hash);
+                            continue;
+                        }
+                        sketch.Add(nShortId);
+                    }
+                    state.setReconTx.clear();
+                    state.nReconSketchTime = nNow;
+                    PushTxInventory(pto, vAnnounce, connman);
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::RECONSKETCH, sketch));
+                }
+            }
+        }
+
         // Detect whether we're stalling
         nNow = GetTimeMicros();
         if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
@@ -3195,10 +3934,18 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlockWindow = GetBlockDownloadWindow(pto, &state);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlockWindow) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexNext = FindSlowNextBlock(pto->GetId());
+            if (pindexNext) {
+                LogPrint("net", "Requesting block %s (%d) again, it holds up validation\n", pindexNext->GetBlockHash().ToString(), pindexNext->nHeight);
+                vToDownload.push_back(pindexNext);
+            }
+            unsigned int nCount = nBlockWindow - state.nBlocksInFlight;
+            if (vToDownload.size() < nCount)
+                FindNextBlocksToDownload(pto->GetId(), nCount, vToDownload, staller, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3245,7 +3992,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // We don't want white listed peers to filter txs to us if we have -whitelistforcerelay
         if (pto->nVersion >= FEEFILTER_VERSION && GetBoolArg("-feefilter", DEFAULT_FEEFILTER) &&
             !(pto->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY))) {
-            CAmount currentFilter = mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+            CAmount currentFilter = mempool.GetMinFee(GetMempoolSizeLimit()).GetFeePerK();
             int64_t timeNow = GetTimeMicros();
             if (timeNow > pto->nextSendTimeFeeFilter) {
                 static CFeeRate default_feerate(DEFAULT_MIN_RELAY_TX_FEE);
@@ -3277,7 +4024,6 @@ public:
     CNetProcessingCleanup() {}
     ~CNetProcessingCleanup() {
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanage.Clear();
     }
 } instance_of_cnetprocessingcleanup;
@@ -7,17 +7,30 @@
 #define BITCOIN_NET_PROCESSING_H
 
 #include "net.h"
+#include "pubkey.h"
 #include "validationinterface.h"
 
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Default for -maxorphanmem, maximum megabytes of memory the orphan transactions use */
+static const unsigned int DEFAULT_MAX_ORPHAN_MEMORY = 10;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 
+/** Transactions that entered our mempool this many seconds before a new block are sent along with its compact block */
+static const int64_t CMPCTBLOCK_PREFILL_RECENT_SECONDS = 2;
+/** Most bytes of transactions sent along with a compact block */
+static const size_t MAX_CMPCTBLOCK_PREFILL_BYTES = 10000;
+/** Number of slots after a new block whose delegates get it pushed before anyone else */
+static const int DELEGATE_RELAY_SLOTS = 3;
+
+/** Default for -netstatsinterval, seconds between logs of the message timing statistics, 0 to disable */
+static const int64_t DEFAULT_NETSTATS_INTERVAL = 0;
+/** Number of recent blocks whose first seen and relay times are kept */
+static const size_t MAX_BLOCK_RELAY_TIMES = 50;
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -36,18 +49,116 @@ public:
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock);
 };
 
+/** How many of the transactions of the compact blocks received were at hand without a GETBLOCKTXN round trip */
+struct CCompactBlockStats {
+    //! Compact blocks we tried to reconstruct
+    uint64_t nBlocks;
+    //! Of those, the ones that needed no transactions requested
+    uint64_t nReconstructed;
+    //! Transactions in those blocks, sent along with them and requested
+    uint64_t nTxs;
+    uint64_t nPrefilledTxs;
+    uint64_t nMissingTxs;
+
+    CCompactBlockStats() : nBlocks(0), nReconstructed(0), nTxs(0), nPrefilledTxs(0), nMissingTxs(0) {}
+
+    void Add(size_t nTxsIn, size_t nPrefilledTxsIn, size_t nMissingTxsIn)
+    {
+        nBlocks++;
+        if (nMissingTxsIn == 0)
+            nReconstructed++;
+        nTxs += nTxsIn;
+        nPrefilledTxs += nPrefilledTxsIn;
+        nMissingTxs += nMissingTxsIn;
+    }
+};
+
+/** Durations in microseconds, counted in power of two buckets */
+struct CTimeHistogram {
+    //! Bucket i counts durations below 2^i microseconds, the last one all longer ones
+    static const int BUCKETS = 24;
+
+    uint64_t nCount;
+    int64_t nTotal;
+    int64_t nMax;
+    uint64_t vBuckets[BUCKETS];
+
+    CTimeHistogram() : nCount(0), nTotal(0), nMax(0) { memset(vBuckets, 0, sizeof(vBuckets)); }
+
+    void Add(int64_t nMicros)
+    {
+        if (nMicros < 0)
+            nMicros = 0;
+        int nBucket = 0;
+        while (nBucket < BUCKETS - 1 && nMicros >= ((int64_t)1 << nBucket))
+            nBucket++;
+        vBuckets[nBucket]++;
+        nCount++;
+        nTotal += nMicros;
+        nMax = std::max(nMax, nMicros);
+    }
+
+    /** Upper bound of the bucket holding the given share of the durations */
+    int64_t GetPercentile(double dShare) const
+    {
+        uint64_t nSeen = 0;
+        for (int i = 0; i < BUCKETS - 1; i++) {
+            nSeen += vBuckets[i];
+            if (nSeen > 0 && nSeen >= dShare * nCount)
+                return std::min(nMax, ((int64_t)1 << i) - 1);
+        }
+        return nMax;
+    }
+};
+
+/** How long messages waited in vProcessMsg after they were received, and how long ProcessMessage took */
+struct CMessageTimeStats {
+    CTimeHistogram queueTime;
+    CTimeHistogram processTime;
+};
+
+/** When a recent block was first received and first announced to a peer, in microseconds */
+struct CBlockRelayTimes {
+    uint256 hash;
+    //! -1 until the block is connected to a header
+    int nHeight;
+    //! Peer the block came from, -1 for our own
+    NodeId nFromPeer;
+    int64_t nFirstSeen;
+    //! 0 until it is announced
+    int64_t nRelayed;
+};
+
+struct CNetTimeStats {
+    //! By message command, "*other*" for unknown ones
+    std::map<std::string, CMessageTimeStats> mapCommand;
+    std::map<NodeId, CMessageTimeStats> mapPeer;
+    //! The most recent blocks first
+    std::vector<CBlockRelayTimes> vBlocks;
+};
+
 struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    CCompactBlockStats cmpctBlockStats;
 };
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Get the compact block reconstruction statistics of all peers */
+void GetCompactBlockStats(CCompactBlockStats& stats);
+/** Get the message processing and block relay timing statistics */
+void GetNetTimeStats(CNetTimeStats& stats);
+/** Log a summary of the timing statistics, for -netstatsinterval */
+void LogNetTimeStats();
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
+/** Register the host running the node of a delegate, for -delegatepeer. Call before the network starts */
+void AddDelegatePeer(const CKeyID& keyid, const std::string& strHost);
+
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
 /**
@@ -19,6 +19,8 @@ public:
     {
         CSerializedNetMsg msg;
         msg.command = std::move(sCommand);
+        // One allocation, rather than a reallocation for every doubling of a block
+        msg.data.reserve(GetSerializeSizeMany(SER_NETWORK, nFlags | nVersion, args...));
         CVectorWriter{ SER_NETWORK, nFlags | nVersion, msg.data, 0, std::forward<Args>(args)... };
         return msg;
     }
@@ -0,0 +1,146 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notifier.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/thread.hpp>
+
+CNotifier* pnotifier = NULL;
+
+CNotifier::CNotifier(int nWorkers, const std::string& strPipeIn) : strPipe(strPipeIn), fStop(false)
+{
+    // One writer keeps the lines of the pipe in order
+    if (IsPiped())
+        nWorkers = 1;
+    for (int i = 0; i < std::max(nWorkers, 1); i++)
+        vThreadWork.push_back(std::thread(&CNotifier::ThreadWork, this));
+}
+
+CNotifier::~CNotifier()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    for (std::thread& thread : vThreadWork)
+        thread.join();
+}
+
+void CNotifier::Notify(const std::string& strKind, const std::string& strCmd, const std::string& strArg, bool fLatest)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Event& event : queueEvents) {
+            if (event.strKind != strKind)
+                continue;
+            if (fLatest) {
+                event.strCmd = strCmd;
+                event.strArg = strArg;
+                return;
+            }
+            if (event.strArg == strArg && event.strCmd == strCmd)
+                return;
+        }
+        if (queueEvents.size() >= MAX_NOTIFY_QUEUE) {
+            LogPrintf("%s: %u events waiting, dropping the %s event of %s\n", __func__, queueEvents.size(), queueEvents.front().strKind, queueEvents.front().strArg);
+            queueEvents.pop_front();
+        }
+        queueEvents.push_back(Event{strKind, strCmd, strArg, fLatest});
+    }
+    cond.notify_one();
+}
+
+void CNotifier::ThreadWork()
+{
+    RenameThread("bitcoin-notify");
+    while (true) {
+        std::vector<Event> vEvents;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return fStop || !queueEvents.empty(); });
+            if (fStop)
+                return;
+            if (IsPiped()) {
+                vEvents.assign(queueEvents.begin(), queueEvents.end());
+                queueEvents.clear();
+            } else {
+                vEvents.push_back(queueEvents.front());
+                queueEvents.pop_front();
+            }
+        }
+
+        if (IsPiped()) {
+            WritePipe(vEvents);
+            continue;
+        }
+        std::string strCmd = vEvents[0].strCmd;
+        if (strCmd.empty())
+            continue;
+        boost::replace_all(strCmd, "%s", vEvents[0].strArg);
+        runCommand(strCmd);
+    }
+}
+
+void CNotifier::WritePipe(const std::vector<Event>& vEvents) const
+{
+    std::string strLines;
+    for (const Event& event : vEvents)
+        strLines += event.strKind + " " + event.strArg + "\n";
+
+#ifndef WIN32
+    // Not blocking, so a pipe without a reader or with a full buffer does not hold up the events after
+    int fd = open(strPipe.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0600);
+    if (fd < 0) {
+        LogPrint("notify", "%s: cannot open %s (%s), %u events lost\n", __func__, strPipe, strerror(errno), vEvents.size());
+        return;
+    }
+    size_t nWritten = 0;
+    while (nWritten < strLines.size()) {
+        ssize_t n = write(fd, strLines.data() + nWritten, strLines.size() - nWritten);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            LogPrint("notify", "%s: cannot write to %s (%s), %u of %u bytes lost\n", __func__, strPipe, strerror(errno), strLines.size() - nWritten, strLines.size());
+            break;
+        }
+        nWritten += n;
+    }
+    close(fd);
+#else
+    FILE* file = fopen(strPipe.c_str(), "ab");
+    if (!file) {
+        LogPrint("notify", "%s: cannot open %s, %u events lost\n", __func__, strPipe, vEvents.size());
+        return;
+    }
+    fwrite(strLines.data(), 1, strLines.size(), file);
+    fclose(file);
+#endif
+}
+
+void QueueNotify(const std::string& strKind, const std::string& strCmd, const std::string& strArg, bool fLatest)
+{
+    if (pnotifier) {
+        pnotifier->Notify(strKind, strCmd, strArg, fLatest);
+        return;
+    }
+    if (strCmd.empty())
+        return;
+    std::string strRun = strCmd;
+    boost::replace_all(strRun, "%s", strArg);
+    boost::thread t(runCommand, strRun); // thread runs free
+}
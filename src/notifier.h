@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTIFIER_H
+#define BITCOIN_NOTIFIER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Default for -notifythreads, the commands of -blocknotify, -walletnotify and -alertnotify run at once */
+static const int DEFAULT_NOTIFY_THREADS = 2;
+static const int MAX_NOTIFY_THREADS = 16;
+/** Events waiting for a worker past which the oldest are dropped */
+static const size_t MAX_NOTIFY_QUEUE = 10000;
+
+/**
+ * Runs the -blocknotify, -walletnotify and -alertnotify commands on a few
+ * worker threads instead of a new free running thread each. An event of a
+ * kind that only the latest one matters of, like a new tip, replaces the one
+ * of the same kind still waiting, and an event already waiting is not queued
+ * twice, so a burst of blocks or of updates to a wallet transaction costs a
+ * command or two.
+ *
+ * With -notifypipe, the events are written instead as lines of "<kind>
+ * <argument>" to a named pipe or a file, all those waiting in one write, so
+ * no process is started for them. A pipe with no reader loses the events.
+ */
+class CNotifier
+{
+public:
+    CNotifier(int nWorkers, const std::string& strPipeIn);
+    /** Drops the events not started yet and waits for the running commands */
+    ~CNotifier();
+
+    /**
+     * Queue the event strKind of strArg: strCmd with %s replaced by strArg is
+     * run, or the event is written to the pipe. fLatest when only the latest
+     * event of strKind matters.
+     */
+    void Notify(const std::string& strKind, const std::string& strCmd, const std::string& strArg, bool fLatest);
+
+    /** Whether the events go to a pipe, and are wanted even without their command */
+    bool IsPiped() const { return !strPipe.empty(); }
+
+private:
+    struct Event {
+        std::string strKind;
+        std::string strCmd;
+        std::string strArg;
+        bool fLatest;
+    };
+
+    void ThreadWork();
+    void WritePipe(const std::vector<Event>& vEvents) const;
+
+    const std::string strPipe;
+
+    //! Guards everything below
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Event> queueEvents;
+    bool fStop;
+
+    std::vector<std::thread> vThreadWork;
+};
+
+/** The notification workers of the node, NULL before they are started */
+extern CNotifier* pnotifier;
+
+/** Notify through pnotifier, or on a thread of its own for strCmd when it is not started */
+void QueueNotify(const std::string& strKind, const std::string& strCmd, const std::string& strArg, bool fLatest);
+
+#endif // BITCOIN_NOTIFIER_H
@@ -74,29 +74,28 @@ private:
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
     std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
 
+    // The moving averages below are kept multiplied by scale, which grows by
+    // 1/decay every block. Decaying them for a new block is then a single
+    // division, and the transactions of the block are added with weight scale.
+
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total feerate of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg feerate per bucket
 
     double decay;
+    double scale;
 
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
@@ -115,11 +114,11 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
+    /** Decay the moving averages and start counting for the new block */
     void ClearCurrent(unsigned int nBlockHeight);
 
     /**
-     * Record a new transaction data point in the current block stats
+     * Record a new transaction data point in the moving averages, for the current block
      * @param blocksToConfirm the number of blocks it took this transaction to confirm
      * @param val the feerate of the transaction
      * @warning blocksToConfirm is 1-based and has to be >= 1
@@ -133,9 +132,8 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
+    /** Divide the moving averages by scale, bringing it back to 1 */
+    void Normalize();
 
     /**
      * Calculate a feerate estimate.  Find the lowest value bucket (or range of buckets
@@ -259,6 +257,14 @@ private:
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats;
 
+    /**
+     * EstimateMedianVal of each target (at index target - 1) for the current
+     * block, computed at the first query after the block. The estimates only
+     * change much when a block comes in, so later queries are a lookup.
+     */
+    std::vector<double> vEstimates;
+    double GetEstimate(int confTarget);
+
     unsigned int trackedTxs;
     unsigned int untrackedTxs;
 };
@@ -30,7 +30,9 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS_COST = MAX_BLOCK_SIGOPS_COST/5;
 /** Default for -maxmempool, maximum megabytes of mempool memory usage */
 static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
-/** Default for -maxmemory, maximum Gigabyte of memory usage */
+/** Default for -maxmempooldpos, maximum megabytes of DPoS operation transactions in the mempool */
+static const unsigned int DEFAULT_MAX_MEMPOOL_DPOS_SIZE = 30;
+/** Default for -maxmemory, GiB the caches, the mempool and the block index may use together */
 static const unsigned int DEFAULT_MAX_MEMORY_SIZE = 8;
 /** Default for -incrementalrelayfee, which sets the minimum feerate increase for mempool limiting or BIP 125 replacement **/
 static const unsigned int DEFAULT_INCREMENTAL_RELAY_FEE = 1000;
@@ -29,7 +29,8 @@
  *      (only the first _size are initialized).
  *
  *  The data type T must be movable by memmove/realloc(). Once we switch to C++,
- *  move constructors can be used instead.
+ *  move constructors can be used instead. The items are relocated through
+ *  void pointers, as T need not be trivially copyable, only relocatable.
  */
 template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
 class prevector {
@@ -165,7 +166,7 @@ private:
                 T* indirect = indirect_ptr(0);
                 T* src = indirect;
                 T* dst = direct_ptr(0);
-                memcpy(dst, src, size() * sizeof(T));
+                memcpy((void*)dst, src, size() * sizeof(T));
                 free(indirect);
                 _size -= N + 1;
             }
@@ -182,7 +183,7 @@ private:
                 assert(new_indirect);
                 T* src = direct_ptr(0);
                 T* dst = reinterpret_cast<T*>(new_indirect);
-                memcpy(dst, src, size() * sizeof(T));
+                memcpy((void*)dst, src, size() * sizeof(T));
                 _union.indirect = new_indirect;
                 _union.capacity = new_capacity;
                 _size += N + 1;
@@ -345,7 +346,7 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + 1), item_ptr(p), (size() - p) * sizeof(T));
+        memmove((void*)item_ptr(p + 1), item_ptr(p), (size() - p) * sizeof(T));
         _size++;
         new(static_cast<void*>(item_ptr(p))) T(value);
         return iterator(item_ptr(p));
@@ -357,7 +358,7 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        memmove((void*)item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
         for (size_type i = 0; i < count; i++) {
             new(static_cast<void*>(item_ptr(p + i))) T(value);
@@ -372,7 +373,7 @@ public:
         if (capacity() < new_size) {
             change_capacity(new_size + (new_size >> 1));
         }
-        memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
+        memmove((void*)item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
         while (first != last) {
             new(static_cast<void*>(item_ptr(p))) T(*first);
@@ -393,7 +394,7 @@ public:
             _size--;
             ++p;
         }
-        memmove(&(*first), &(*last), endp - ((char*)(&(*last))));
+        memmove((void*)&(*first), &(*last), endp - ((char*)(&(*last))));
         return first;
     }
 
@@ -76,14 +76,36 @@ uint256 CTransaction::GetWitnessHash() const
 }
 
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), hash() {}
-CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
-CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion), vin(std::move(tx.vin)), vout(std::move(tx.vout)), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
+void CTransaction::FindDPoSPayload()
+{
+    nDPoSBegin = nDPoSEnd = 0;
+    if (vout.empty())
+        return;
+    const CScript& script = vout[0].scriptPubKey;
+    if (vout[0].nValue != 0 || script.size() < 5 || script[0] != OP_RETURN)
+        return;
+
+    CScript::const_iterator pc = script.begin() + 1;
+    opcodetype opcode;
+    if (!script.GetOp(pc, opcode) || opcode > OP_PUSHDATA4)
+        return;
+    // Skip the size of the push, GetOp having checked it is all there
+    unsigned int nHeader = opcode < OP_PUSHDATA1 ? 1 : opcode == OP_PUSHDATA1 ? 2 : opcode == OP_PUSHDATA2 ? 3 : 5;
+    CScript::const_iterator pdata = script.begin() + 1 + nHeader;
+    if (pc - pdata < 4 || pdata[0] != 0 || pdata[1] != 0 || pdata[2] != 0 || pdata[3] != 0)
+        return;
+    nDPoSBegin = pdata + 4 - script.begin();
+    nDPoSEnd = pc - script.begin();
+}
+
+CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), hash(), nDPoSBegin(0), nDPoSEnd(0) {}
+CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), hash(ComputeHash()) { FindDPoSPayload(); }
+CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion), vin(std::move(tx.vin)), vout(std::move(tx.vout)), nLockTime(tx.nLockTime), hash(ComputeHash()) { FindDPoSPayload(); }
 
 CAmount CTransaction::GetValueOut() const
 {
     CAmount nValueOut = 0;
-    for (std::vector<CTxOut>::const_iterator it(vout.begin()); it != vout.end(); ++it)
+    for (CTxOutVector::const_iterator it(vout.begin()); it != vout.end(); ++it)
     {
         nValueOut += it->nValue;
         if (!MoneyRange(it->nValue) || !MoneyRange(nValueOut))
@@ -8,6 +8,7 @@
 
 #include "pubkey.h"
 #include "amount.h"
+#include "prevector.h"
 #include "script/script.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -215,6 +216,20 @@ public:
 
 struct CMutableTransaction;
 
+//! Outputs kept inside a transaction, enough for a payment and its change
+static const unsigned int TX_INLINE_OUTPUTS = 2;
+
+/**
+ * The outputs of a transaction, which only allocate when there are more
+ * than TX_INLINE_OUTPUTS, and serialize like a std::vector. prevector moves
+ * its items with memmove, which CTxOut allows, being an amount and a
+ * prevector script, but CTxIn does not: its witness is a std::vector.
+ * CTxOut is not trivially copyable, but relocating one is fine: its script
+ * owns no pointer into itself, and prevector still runs the destructors of
+ * the items it erases and of the ones left when it is destroyed.
+ */
+typedef prevector<TX_INLINE_OUTPUTS, CTxOut> CTxOutVector;
+
 /**
  * Basic transaction serialization format:
  * - int32_t nVersion
@@ -321,15 +336,18 @@ public:
     // structure, including the hash.
     const int32_t nVersion;
     const std::vector<CTxIn> vin;
-    const std::vector<CTxOut> vout;
+    const CTxOutVector vout;
     const uint32_t nLockTime;
 
-    CKeyID address;
 private:
     /** Memory only. */
     const uint256 hash;
+    /** Memory only. Where the DPoS operation lies in vout[0].scriptPubKey, nDPoSEnd being 0 without one */
+    uint32_t nDPoSBegin;
+    uint32_t nDPoSEnd;
 
     uint256 ComputeHash() const;
+    void FindDPoSPayload();
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -360,6 +378,21 @@ public:
     // Compute a hash that includes both transaction and witness data
     uint256 GetWitnessHash() const;
 
+    /**
+     * The DPoS operation of the transaction: the data of the push that
+     * follows OP_RETURN in a zero valued vout[0], past its four zero bytes.
+     * Returns false if there is none.
+     */
+    bool GetDPoSPayload(const unsigned char*& pbegin, const unsigned char*& pend) const
+    {
+        if (nDPoSEnd == 0)
+            return false;
+        const CScript& script = vout[0].scriptPubKey;
+        pbegin = &script[0] + nDPoSBegin;
+        pend = &script[0] + nDPoSEnd;
+        return true;
+    }
+
     // Return sum of txouts.
     CAmount GetValueOut() const;
     // GetValueIn() is a method on CCoinsViewCache, because
@@ -411,7 +444,7 @@ struct CMutableTransaction
 {
     int32_t nVersion;
     std::vector<CTxIn> vin;
-    std::vector<CTxOut> vout;
+    CTxOutVector vout;
     uint32_t nLockTime;
 
     CMutableTransaction();
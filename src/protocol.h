@@ -240,6 +240,75 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains a 4-byte LE reconciliation version and an 8-byte LE salt.
+ * Indicates that a node reconciles transaction announcements with sketches
+ * instead of sending each transaction in an inv, when both sides send it.
+ * Experimental, LBTC only.
+ */
+extern const char *SENDRECON;
+/**
+ * Contains a CReconSketch of the transactions the sender would announce.
+ * Sent by the outbound side of a reconciling connection, answered with
+ * "recondiff".
+ */
+extern const char *RECONSKETCH;
+/**
+ * Contains a 1-byte bool, whether the sketch decoded, and the short ids
+ * of the sketched transactions the sender lacks, to be announced by inv.
+ */
+extern const char *RECONDIFF;
+/**
+ * Contains the hash of a block. Asks for the coinbase proofs of the DPoS round
+ * of the block on the active chain, from its first block up to the block given,
+ * answered with "roundproof". For light clients to check the forgers of headers.
+ * LBTC only.
+ */
+extern const char *GETROUNDPROOF;
+/**
+ * Contains a vector of CCoinbaseProof, the first one of the round's first block,
+ * whose coinbase lists the delegates of the round. Empty if the block is unknown
+ * or not on the active chain, or one of the round's blocks was pruned.
+ */
+extern const char *ROUNDPROOF;
+/**
+ * Contains a 1-byte filter type, a 4-byte start height and the hash of a stop
+ * block. Asks for the compact filters of the blocks of the active chain from
+ * the start height up to the stop block, each answered with a "cfilter".
+ * @since protocol version 70015 as described by BIP 157
+ */
+extern const char *GETCFILTERS;
+/**
+ * Contains the filter type, the hash of a block and its encoded filter.
+ */
+extern const char *CFILTER;
+/**
+ * Like "getcfilters", asks for the filter hashes of the blocks in the range,
+ * answered with "cfheaders".
+ */
+extern const char *GETCFHEADERS;
+/**
+ * Contains the filter type, the hash of the stop block, the filter header of
+ * the block before the range and the filter hashes of the blocks in the range,
+ * from which the client computes their filter headers.
+ */
+extern const char *CFHEADERS;
+/**
+ * Contains the filter type and the hash of a stop block. Asks for the filter
+ * headers of every 1000th block of the active chain up to it,
+ * answered with "cfcheckpt".
+ */
+extern const char *GETCFCHECKPT;
+/**
+ * Contains the filter type, the hash of the stop block and the filter headers.
+ */
+extern const char *CFCHECKPT;
+/**
+ * Contains a CCompressedHeaders. Sent in place of "headers" in reply to
+ * "getheaders" when both sides set NODE_COMPRESSED_HEADERS.
+ * LBTC only.
+ */
+extern const char *CHEADERS;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -267,6 +336,13 @@ enum ServiceFlags : uint64_t {
     // NODE_XTHIN means the node supports Xtreme Thinblocks
     // If this is turned off then the node will not service nor make xthin requests
     NODE_XTHIN = (1 << 4),
+    // NODE_COMPACT_FILTERS means the node serves the basic compact block filters
+    // of BIP 157, in place of matching bloom filters.
+    NODE_COMPACT_FILTERS = (1 << 6),
+    // NODE_COMPRESSED_HEADERS means the node reads and answers getheaders with
+    // "cheaders" messages, headers without the fields a DPoS chain makes redundant.
+    // LBTC only.
+    NODE_COMPRESSED_HEADERS = (1 << 7),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -282,6 +282,21 @@ bool CExtPubKey::Derive(CExtPubKey &out, unsigned int _nChild) const {
 
 /* static */ int ECCVerifyHandle::refcount = 0;
 
+std::vector<CKeyID> GetPubKeyIDs(const std::vector<CPubKey>& vPubKeys)
+{
+    std::vector<const unsigned char*> vInputs;
+    std::vector<size_t> vLens;
+    vInputs.reserve(vPubKeys.size());
+    vLens.reserve(vPubKeys.size());
+    for (const CPubKey& pubkey : vPubKeys) {
+        vInputs.push_back(pubkey.begin());
+        vLens.push_back(pubkey.size());
+    }
+    std::vector<uint160> vHashes(vPubKeys.size());
+    Hash160Multi(vHashes.data(), vInputs.data(), vLens.data(), vPubKeys.size());
+    return std::vector<CKeyID>(vHashes.begin(), vHashes.end());
+}
+
 ECCVerifyHandle::ECCVerifyHandle()
 {
     if (refcount == 0) {
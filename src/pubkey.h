@@ -190,6 +190,9 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/** The GetID of each public key, hashed several at a time for a large number of keys */
+std::vector<CKeyID> GetPubKeyIDs(const std::vector<CPubKey>& vPubKeys);
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
@@ -0,0 +1,188 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "billtablemodel.h"
+
+#include "bitcoinunits.h"
+#include "clientmodel.h"
+#include "guiutil.h"
+#include "optionsmodel.h"
+
+#include "vote.h"
+
+#include <QDateTime>
+
+struct CBillEntry {
+    uint160 id;
+    QString title;
+    QString detail;
+    uint64_t nEndTime;
+    bool fFinished;
+    bool fPassed;
+    uint64_t nVotes;
+};
+
+// private implementation
+class BillTablePriv
+{
+public:
+    /** Local cache of the bills, in the order of their ids */
+    QList<CBillEntry> cachedBills;
+
+    /** The rows of the bills of a view */
+    static QList<CBillEntry> build(const CVoteView& view)
+    {
+        const CVoteView::CBillMap& mapBills = view.ListBills();
+        QList<CBillEntry> bills;
+#if QT_VERSION >= 0x040700
+        bills.reserve(mapBills.size());
+#endif
+        for (const std::pair<const uint160, CBillInfo>& item : mapBills) {
+            const CBillInfo& info = item.second;
+            CBillEntry entry;
+            entry.id = item.first;
+            entry.title = QString::fromStdString(info.data.title);
+            entry.detail = QString::fromStdString(info.data.detail);
+            entry.nEndTime = info.data.endtime;
+            entry.fFinished = info.state.bFinished;
+            entry.fPassed = info.state.bPassed;
+            // Open bills are counted as they go, finished ones keep their final count
+            entry.nVotes = info.state.bFinished ? info.state.nTotalVote : 0;
+            for (uint64_t nTally : info.vTally)
+                entry.nVotes += nTally;
+            bills.append(entry);
+        }
+        return bills;
+    }
+
+    /** Whether the rows are for the same bills */
+    bool sameBills(const QList<CBillEntry>& bills) const
+    {
+        if (bills.size() != cachedBills.size())
+            return false;
+        for (int i = 0; i < bills.size(); i++) {
+            if (bills[i].id != cachedBills[i].id)
+                return false;
+        }
+        return true;
+    }
+
+    int size() const
+    {
+        return cachedBills.size();
+    }
+
+    CBillEntry *index(int idx)
+    {
+        if (idx >= 0 && idx < cachedBills.size())
+            return &cachedBills[idx];
+
+        return 0;
+    }
+};
+
+BillTableModel::BillTableModel(ClientModel *_clientModel, QObject *parent) :
+    QAbstractTableModel(parent),
+    clientModel(_clientModel),
+    priv(new BillTablePriv())
+{
+    columns << tr("Title") << tr("Voting ends") << tr("Status") << tr("Votes");
+}
+
+BillTableModel::~BillTableModel()
+{
+    // Intentionally left empty
+}
+
+void BillTableModel::setView(const std::shared_ptr<const CVoteView>& view)
+{
+    QList<CBillEntry> bills = BillTablePriv::build(*view);
+    if (!priv->sameBills(bills)) {
+        beginResetModel();
+        priv->cachedBills.swap(bills);
+        endResetModel();
+        return;
+    }
+
+    // Only the states and tallies change from block to block
+    if (bills.isEmpty())
+        return;
+    for (int i = 0; i < bills.size(); i++)
+        priv->cachedBills[i] = bills[i];
+    Q_EMIT dataChanged(index(0, Status, QModelIndex()), index(priv->size() - 1, Votes, QModelIndex()));
+}
+
+int BillTableModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return priv->size();
+}
+
+int BillTableModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return columns.length();
+}
+
+QVariant BillTableModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid())
+        return QVariant();
+
+    CBillEntry *rec = static_cast<CBillEntry*>(index.internalPointer());
+
+    if (role == Qt::DisplayRole) {
+        switch(index.column())
+        {
+        case Title:
+            return rec->title;
+        case EndTime:
+            return GUIUtil::dateTimeStr(rec->nEndTime);
+        case Status:
+            if (!rec->fFinished)
+                return tr("Open");
+            return rec->fPassed ? tr("Passed") : tr("Not passed");
+        case Votes:
+            return BitcoinUnits::format(clientModel->getOptionsModel()->getDisplayUnit(), rec->nVotes);
+        }
+    } else if (role == Qt::ToolTipRole) {
+        return QString::fromStdString(rec->id.GetHex()) + "\n" + rec->detail;
+    } else if (role == Qt::TextAlignmentRole) {
+        if (index.column() == Votes)
+            return QVariant(Qt::AlignRight | Qt::AlignVCenter);
+    }
+
+    return QVariant();
+}
+
+QVariant BillTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(orientation == Qt::Horizontal)
+    {
+        if(role == Qt::DisplayRole && section < columns.size())
+        {
+            return columns[section];
+        }
+    }
+    return QVariant();
+}
+
+Qt::ItemFlags BillTableModel::flags(const QModelIndex &index) const
+{
+    if(!index.isValid())
+        return 0;
+
+    Qt::ItemFlags retval = Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    return retval;
+}
+
+QModelIndex BillTableModel::index(int row, int column, const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    CBillEntry *data = priv->index(row);
+
+    if (data)
+        return createIndex(row, column, data);
+    return QModelIndex();
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_BILLTABLEMODEL_H
+#define BITCOIN_QT_BILLTABLEMODEL_H
+
+#include <memory>
+
+#include <QAbstractTableModel>
+#include <QStringList>
+
+class BillTablePriv;
+class ClientModel;
+class CVoteView;
+
+/**
+   Qt model of the bills and the votes on them, similar to the "listbills"
+   RPC call. Used by the DPoS page.
+ */
+class BillTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    explicit BillTableModel(ClientModel *clientModel, QObject *parent = 0);
+    ~BillTableModel();
+
+    enum ColumnIndex {
+        Title = 0,
+        EndTime = 1,
+        Status = 2,
+        Votes = 3
+    };
+
+    /** Take the bills of a newly published view, only resetting the rows when bills were added or removed */
+    void setView(const std::shared_ptr<const CVoteView>& view);
+
+    /** @name Methods overridden from QAbstractTableModel
+        @{*/
+    int rowCount(const QModelIndex &parent) const;
+    int columnCount(const QModelIndex &parent) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+    QModelIndex index(int row, int column, const QModelIndex &parent) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    /*@}*/
+
+private:
+    ClientModel *clientModel;
+    QStringList columns;
+    std::unique_ptr<BillTablePriv> priv;
+};
+
+#endif // BITCOIN_QT_BILLTABLEMODEL_H
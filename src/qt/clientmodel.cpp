@@ -5,6 +5,7 @@
 #include "clientmodel.h"
 
 #include "bantablemodel.h"
+#include "dposmodel.h"
 #include "guiconstants.h"
 #include "guiutil.h"
 #include "peertablemodel.h"
@@ -34,12 +35,14 @@ ClientModel::ClientModel(OptionsModel *_optionsModel, QObject *parent) :
     optionsModel(_optionsModel),
     peerTableModel(0),
     banTableModel(0),
+    dposModel(0),
     pollTimer(0)
 {
     cachedBestHeaderHeight = -1;
     cachedBestHeaderTime = -1;
     peerTableModel = new PeerTableModel(this);
     banTableModel = new BanTableModel(this);
+    dposModel = new DPoSModel(this);
     pollTimer = new QTimer(this);
     connect(pollTimer, SIGNAL(timeout()), this, SLOT(updateTimer()));
     pollTimer->start(MODEL_UPDATE_DELAY);
@@ -220,6 +223,11 @@ BanTableModel *ClientModel::getBanTableModel()
     return banTableModel;
 }
 
+DPoSModel *ClientModel::getDPoSModel()
+{
+    return dposModel;
+}
+
 QString ClientModel::formatFullVersion() const
 {
     return QString::fromStdString(FormatFullVersion());
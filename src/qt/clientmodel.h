@@ -12,6 +12,7 @@
 
 class AddressTableModel;
 class BanTableModel;
+class DPoSModel;
 class OptionsModel;
 class PeerTableModel;
 class TransactionTableModel;
@@ -49,6 +50,7 @@ public:
     OptionsModel *getOptionsModel();
     PeerTableModel *getPeerTableModel();
     BanTableModel *getBanTableModel();
+    DPoSModel *getDPoSModel();
 
     //! Return number of connections, default is in- and outbound (total)
     int getNumConnections(unsigned int flags = CONNECTIONS_ALL) const;
@@ -91,6 +93,7 @@ private:
     OptionsModel *optionsModel;
     PeerTableModel *peerTableModel;
     BanTableModel *banTableModel;
+    DPoSModel *dposModel;
 
     QTimer *pollTimer;
 
@@ -0,0 +1,242 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "delegatetablemodel.h"
+
+#include "bitcoinunits.h"
+#include "clientmodel.h"
+#include "optionsmodel.h"
+
+#include "base58.h"
+#include "vote.h"
+
+#include <algorithm>
+
+struct CDelegateEntry {
+    CKeyID keyid;
+    QString name;
+    QString address;
+    uint64_t nVotes;
+    size_t nVoters;
+    int nRank;
+};
+
+class DelegateLessThan
+{
+public:
+    DelegateLessThan(int nColumn, Qt::SortOrder fOrder) :
+        column(nColumn), order(fOrder) {}
+    bool operator()(const CDelegateEntry& left, const CDelegateEntry& right) const
+    {
+        const CDelegateEntry* pLeft = &left;
+        const CDelegateEntry* pRight = &right;
+
+        if (order == Qt::DescendingOrder)
+            std::swap(pLeft, pRight);
+
+        switch(column)
+        {
+        case DelegateTableModel::Rank:
+            return pLeft->nRank < pRight->nRank;
+        case DelegateTableModel::Name:
+            return pLeft->name.compare(pRight->name) < 0;
+        case DelegateTableModel::Address:
+            return pLeft->address.compare(pRight->address) < 0;
+        case DelegateTableModel::Votes:
+            return pLeft->nVotes < pRight->nVotes;
+        case DelegateTableModel::Voters:
+            return pLeft->nVoters < pRight->nVoters;
+        }
+
+        return false;
+    }
+
+private:
+    int column;
+    Qt::SortOrder order;
+};
+
+// private implementation
+class DelegateTablePriv
+{
+public:
+    DelegateTablePriv() : pNameDelegate(0), sortColumn(DelegateTableModel::Rank), sortOrder(Qt::AscendingOrder) {}
+
+    /** Local cache of the delegates, in display order */
+    std::vector<CDelegateEntry> cachedDelegates;
+    /** The registrations the rows were built from, shared by the views until one changes them */
+    const std::map<std::string, CKeyID>* pNameDelegate;
+    std::shared_ptr<const CVoteView> view;
+    /** Column to sort delegates by */
+    int sortColumn;
+    /** Order (ascending or descending) to sort delegates by */
+    Qt::SortOrder sortOrder;
+
+    /** Refresh the rows from the view; true when they had to be rebuilt */
+    bool refresh(const std::shared_ptr<const CVoteView>& viewIn)
+    {
+        view = viewIn;
+        bool fRebuild = pNameDelegate != &view->ListDelegates();
+        if (fRebuild) {
+            pNameDelegate = &view->ListDelegates();
+            cachedDelegates.clear();
+            cachedDelegates.reserve(pNameDelegate->size());
+            for (const std::pair<const std::string, CKeyID>& item : *pNameDelegate) {
+                CDelegateEntry entry;
+                entry.keyid = item.second;
+                entry.name = QString::fromStdString(item.first);
+                entry.address = QString::fromStdString(CBitcoinAddress(item.second).ToString());
+                cachedDelegates.push_back(entry);
+            }
+        }
+
+        // The totals move with the balances of the voters at every block
+        std::vector<std::pair<uint64_t, size_t> > vRank;
+        vRank.reserve(cachedDelegates.size());
+        for (size_t i = 0; i < cachedDelegates.size(); i++) {
+            CDelegateEntry& entry = cachedDelegates[i];
+            entry.nVotes = view->GetDelegateVotes(entry.keyid);
+            entry.nVoters = view->GetDelegateVoterCount(entry.keyid);
+            vRank.push_back(std::make_pair(entry.nVotes, i));
+        }
+        std::sort(vRank.begin(), vRank.end(), [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+        for (size_t i = 0; i < vRank.size(); i++)
+            cachedDelegates[vRank[i].second].nRank = i + 1;
+
+        std::stable_sort(cachedDelegates.begin(), cachedDelegates.end(), DelegateLessThan(sortColumn, sortOrder));
+        return fRebuild;
+    }
+
+    int size() const
+    {
+        return cachedDelegates.size();
+    }
+
+    CDelegateEntry *index(int idx)
+    {
+        if (idx >= 0 && idx < (int)cachedDelegates.size())
+            return &cachedDelegates[idx];
+
+        return 0;
+    }
+};
+
+DelegateTableModel::DelegateTableModel(ClientModel *_clientModel, QObject *parent) :
+    QAbstractTableModel(parent),
+    clientModel(_clientModel),
+    priv(new DelegateTablePriv())
+{
+    columns << tr("Rank") << tr("Name") << tr("Address") << tr("Votes") << tr("Voters");
+}
+
+DelegateTableModel::~DelegateTableModel()
+{
+    // Intentionally left empty
+}
+
+void DelegateTableModel::setView(const std::shared_ptr<const CVoteView>& view)
+{
+    if (priv->pNameDelegate != &view->ListDelegates()) {
+        beginResetModel();
+        priv->refresh(view);
+        endResetModel();
+        return;
+    }
+
+    Q_EMIT layoutAboutToBeChanged();
+    std::map<CKeyID, int> mapOldRow;
+    for (int i = 0; i < priv->size(); i++)
+        mapOldRow[priv->cachedDelegates[i].keyid] = i;
+    priv->refresh(view);
+    std::vector<int> vNewRow(priv->size());
+    for (int i = 0; i < priv->size(); i++)
+        vNewRow[mapOldRow[priv->cachedDelegates[i].keyid]] = i;
+    Q_FOREACH(const QModelIndex &index, persistentIndexList())
+        changePersistentIndex(index, createIndex(vNewRow[index.row()], index.column(), priv->index(vNewRow[index.row()])));
+    Q_EMIT layoutChanged();
+}
+
+int DelegateTableModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return priv->size();
+}
+
+int DelegateTableModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return columns.length();
+}
+
+QVariant DelegateTableModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid())
+        return QVariant();
+
+    CDelegateEntry *rec = static_cast<CDelegateEntry*>(index.internalPointer());
+
+    if (role == Qt::DisplayRole) {
+        switch(index.column())
+        {
+        case Rank:
+            return rec->nRank;
+        case Name:
+            return rec->name;
+        case Address:
+            return rec->address;
+        case Votes:
+            return BitcoinUnits::format(clientModel->getOptionsModel()->getDisplayUnit(), rec->nVotes);
+        case Voters:
+            return qulonglong(rec->nVoters);
+        }
+    } else if (role == Qt::TextAlignmentRole) {
+        if (index.column() == Rank || index.column() == Votes || index.column() == Voters)
+            return QVariant(Qt::AlignRight | Qt::AlignVCenter);
+    } else if (role == KeyIDRole) {
+        return QByteArray((const char*)rec->keyid.begin(), rec->keyid.size());
+    }
+
+    return QVariant();
+}
+
+QVariant DelegateTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(orientation == Qt::Horizontal)
+    {
+        if(role == Qt::DisplayRole && section < columns.size())
+        {
+            return columns[section];
+        }
+    }
+    return QVariant();
+}
+
+Qt::ItemFlags DelegateTableModel::flags(const QModelIndex &index) const
+{
+    if(!index.isValid())
+        return 0;
+
+    Qt::ItemFlags retval = Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    return retval;
+}
+
+QModelIndex DelegateTableModel::index(int row, int column, const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    CDelegateEntry *data = priv->index(row);
+
+    if (data)
+        return createIndex(row, column, data);
+    return QModelIndex();
+}
+
+void DelegateTableModel::sort(int column, Qt::SortOrder order)
+{
+    priv->sortColumn = column;
+    priv->sortOrder = order;
+    if (priv->view)
+        setView(priv->view);
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_DELEGATETABLEMODEL_H
+#define BITCOIN_QT_DELEGATETABLEMODEL_H
+
+#include <memory>
+
+#include <QAbstractTableModel>
+#include <QStringList>
+
+class ClientModel;
+class CVoteView;
+class DelegateTablePriv;
+
+/**
+   Qt model of the registered delegates with their votes, similar to the
+   "listdelegates" RPC call. Used by the DPoS page.
+ */
+class DelegateTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    explicit DelegateTableModel(ClientModel *clientModel, QObject *parent = 0);
+    ~DelegateTableModel();
+
+    enum ColumnIndex {
+        Rank = 0,
+        Name = 1,
+        Address = 2,
+        Votes = 3,
+        Voters = 4
+    };
+
+    enum RoleIndex {
+        /** The CKeyID of the delegate, as a QByteArray */
+        KeyIDRole = Qt::UserRole
+    };
+
+    /**
+     * Take the delegates of a newly published view. The rows are only rebuilt
+     * when the registrations changed; otherwise they are updated and sorted
+     * again, the persistent indexes (e.g. the selection) staying on their delegates.
+     */
+    void setView(const std::shared_ptr<const CVoteView>& view);
+
+    /** @name Methods overridden from QAbstractTableModel
+        @{*/
+    int rowCount(const QModelIndex &parent) const;
+    int columnCount(const QModelIndex &parent) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+    QModelIndex index(int row, int column, const QModelIndex &parent) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    void sort(int column, Qt::SortOrder order);
+    /*@}*/
+
+private:
+    ClientModel *clientModel;
+    QStringList columns;
+    std::unique_ptr<DelegateTablePriv> priv;
+};
+
+#endif // BITCOIN_QT_DELEGATETABLEMODEL_H
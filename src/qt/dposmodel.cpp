@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dposmodel.h"
+
+#include "billtablemodel.h"
+#include "clientmodel.h"
+#include "delegatetablemodel.h"
+#include "guiconstants.h"
+#include "voterlistmodel.h"
+
+#include "ui_interface.h"
+#include "utiltime.h"
+#include "vote.h"
+
+#include <QTimer>
+
+DPoSModel::DPoSModel(ClientModel *parent) :
+    QObject(parent),
+    clientModel(parent),
+    view(Vote::GetInstance().GetView()),
+    nLastRefresh(0),
+    fRefreshQueued(false)
+{
+    delegateTableModel = new DelegateTableModel(parent, this);
+    voterListModel = new VoterListModel(this);
+    billTableModel = new BillTableModel(parent, this);
+    delegateTableModel->setView(view);
+    billTableModel->setView(view);
+
+    refreshTimer = new QTimer(this);
+    refreshTimer->setSingleShot(true);
+    connect(refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+
+    subscribeToCoreSignals();
+}
+
+DPoSModel::~DPoSModel()
+{
+    unsubscribeFromCoreSignals();
+}
+
+void DPoSModel::notifyBlockTip()
+{
+    if (!fRefreshQueued.exchange(true))
+        QMetaObject::invokeMethod(this, "refresh", Qt::QueuedConnection);
+}
+
+void DPoSModel::refresh()
+{
+    // While syncing the tip moves faster than anyone can read the tables
+    int64_t nNow = GetTimeMillis();
+    if (nNow - nLastRefresh < MODEL_UPDATE_DELAY) {
+        if (!refreshTimer->isActive())
+            refreshTimer->start(MODEL_UPDATE_DELAY - (nNow - nLastRefresh));
+        return;
+    }
+    nLastRefresh = nNow;
+    fRefreshQueued = false;
+
+    std::shared_ptr<const CVoteView> viewNew = Vote::GetInstance().GetView();
+    if (viewNew == view)
+        return;
+    view = viewNew;
+
+    delegateTableModel->setView(view);
+    voterListModel->setView(view);
+    billTableModel->setView(view);
+    Q_EMIT viewChanged();
+}
+
+static void BlockTipChanged(DPoSModel *dposmodel, bool initialSync, const CBlockIndex *pIndex)
+{
+    dposmodel->notifyBlockTip();
+}
+
+void DPoSModel::subscribeToCoreSignals()
+{
+    uiInterface.NotifyBlockTip.connect(boost::bind(BlockTipChanged, this, _1, _2));
+}
+
+void DPoSModel::unsubscribeFromCoreSignals()
+{
+    uiInterface.NotifyBlockTip.disconnect(boost::bind(BlockTipChanged, this, _1, _2));
+}
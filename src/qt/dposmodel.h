@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_DPOSMODEL_H
+#define BITCOIN_QT_DPOSMODEL_H
+
+#include <atomic>
+#include <memory>
+
+#include <QObject>
+
+class BillTableModel;
+class ClientModel;
+class CVoteView;
+class DelegateTableModel;
+class VoterListModel;
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+/**
+   Qt model of the DPoS state: delegates, the voters of one of them and bills.
+   It is fed by the view Vote publishes after every block, which is read
+   without any lock. The models only pick up what changed between two views,
+   the unchanged parts being shared by the views themselves.
+ */
+class DPoSModel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DPoSModel(ClientModel *parent);
+    ~DPoSModel();
+
+    DelegateTableModel *getDelegateTableModel() { return delegateTableModel; }
+    VoterListModel *getVoterListModel() { return voterListModel; }
+    BillTableModel *getBillTableModel() { return billTableModel; }
+
+    std::shared_ptr<const CVoteView> getView() const { return view; }
+
+    //! Core thread: ask the GUI thread for a refresh, unless one is queued already
+    void notifyBlockTip();
+
+public Q_SLOTS:
+    /** Pick up the latest published view, at most once per MODEL_UPDATE_DELAY */
+    void refresh();
+
+Q_SIGNALS:
+    void viewChanged();
+
+private:
+    ClientModel *clientModel;
+    std::shared_ptr<const CVoteView> view;
+    DelegateTableModel *delegateTableModel;
+    VoterListModel *voterListModel;
+    BillTableModel *billTableModel;
+    QTimer *refreshTimer;
+    int64_t nLastRefresh;
+    std::atomic<bool> fRefreshQueued;
+
+    void subscribeToCoreSignals();
+    void unsubscribeFromCoreSignals();
+};
+
+#endif // BITCOIN_QT_DPOSMODEL_H
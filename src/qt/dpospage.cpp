@@ -0,0 +1,116 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dpospage.h"
+
+#include "billtablemodel.h"
+#include "delegatetablemodel.h"
+#include "dposmodel.h"
+#include "voterlistmodel.h"
+
+#include "pubkey.h"
+
+#include <string.h>
+
+#include <QHeaderView>
+#include <QLabel>
+#include <QListView>
+#include <QSplitter>
+#include <QTabWidget>
+#include <QTableView>
+#include <QVBoxLayout>
+
+DPoSPage::DPoSPage(QWidget *parent) :
+    QWidget(parent),
+    model(0)
+{
+    QTabWidget *tabs = new QTabWidget(this);
+
+    // Delegates above the voters of the selected one
+    QSplitter *splitter = new QSplitter(Qt::Vertical, this);
+    delegateView = new QTableView(this);
+    delegateView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    delegateView->setSelectionMode(QAbstractItemView::SingleSelection);
+    delegateView->setSortingEnabled(true);
+    delegateView->verticalHeader()->hide();
+    delegateView->horizontalHeader()->setStretchLastSection(true);
+    splitter->addWidget(delegateView);
+
+    QWidget *votersWidget = new QWidget(this);
+    QVBoxLayout *votersLayout = new QVBoxLayout(votersWidget);
+    votersLayout->setContentsMargins(0, 0, 0, 0);
+    votersLabel = new QLabel(tr("Select a delegate to list its voters."), this);
+    votersLayout->addWidget(votersLabel);
+    voterView = new QListView(this);
+    // A fixed row height lets the view skip measuring every row
+    voterView->setUniformItemSizes(true);
+    votersLayout->addWidget(voterView);
+    splitter->addWidget(votersWidget);
+    tabs->addTab(splitter, tr("Delegates"));
+
+    billView = new QTableView(this);
+    billView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    billView->verticalHeader()->hide();
+    billView->horizontalHeader()->setStretchLastSection(true);
+    tabs->addTab(billView, tr("Bills"));
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(tabs);
+    setLayout(layout);
+}
+
+void DPoSPage::setModel(DPoSModel *_model)
+{
+    this->model = _model;
+    if (!_model)
+        return;
+
+    delegateView->setModel(_model->getDelegateTableModel());
+    delegateView->sortByColumn(DelegateTableModel::Rank, Qt::AscendingOrder);
+#if QT_VERSION < 0x050000
+    delegateView->horizontalHeader()->setResizeMode(DelegateTableModel::Address, QHeaderView::ResizeToContents);
+#else
+    delegateView->horizontalHeader()->setSectionResizeMode(DelegateTableModel::Address, QHeaderView::ResizeToContents);
+#endif
+    connect(delegateView->selectionModel(), SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
+            this, SLOT(delegateSelectionChanged(QItemSelection,QItemSelection)));
+
+    voterView->setModel(_model->getVoterListModel());
+    connect(_model->getVoterListModel(), SIGNAL(votersChanged(int)), this, SLOT(updateVotersLabel(int)));
+
+    billView->setModel(_model->getBillTableModel());
+#if QT_VERSION < 0x050000
+    billView->horizontalHeader()->setResizeMode(BillTableModel::Title, QHeaderView::Stretch);
+#else
+    billView->horizontalHeader()->setSectionResizeMode(BillTableModel::Title, QHeaderView::Stretch);
+#endif
+}
+
+void DPoSPage::delegateSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected)
+{
+    Q_UNUSED(selected);
+    Q_UNUSED(deselected);
+    if (!model)
+        return;
+
+    QModelIndexList selection = delegateView->selectionModel()->selectedRows();
+    if (selection.isEmpty()) {
+        model->getVoterListModel()->clear();
+        votersLabel->setText(tr("Select a delegate to list its voters."));
+        return;
+    }
+
+    QByteArray keyid = selection.at(0).data(DelegateTableModel::KeyIDRole).toByteArray();
+    if (keyid.size() != (int)sizeof(CKeyID))
+        return;
+    CKeyID delegate;
+    memcpy(delegate.begin(), keyid.constData(), keyid.size());
+    model->getVoterListModel()->setDelegate(model->getView(), delegate);
+}
+
+void DPoSPage::updateVotersLabel(int count)
+{
+    if (delegateView->selectionModel() && delegateView->selectionModel()->hasSelection())
+        votersLabel->setText(tr("%n voter(s) of the selected delegate", "", count));
+}
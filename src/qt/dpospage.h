@@ -0,0 +1,41 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_DPOSPAGE_H
+#define BITCOIN_QT_DPOSPAGE_H
+
+#include <QWidget>
+
+class DPoSModel;
+
+QT_BEGIN_NAMESPACE
+class QItemSelection;
+class QLabel;
+class QListView;
+class QTableView;
+QT_END_NAMESPACE
+
+/** Page showing the delegates and their voters, and the bills */
+class DPoSPage : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit DPoSPage(QWidget *parent = 0);
+
+    void setModel(DPoSModel *model);
+
+private:
+    DPoSModel *model;
+    QTableView *delegateView;
+    QLabel *votersLabel;
+    QListView *voterView;
+    QTableView *billView;
+
+private Q_SLOTS:
+    void delegateSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected);
+    void updateVotersLabel(int count);
+};
+
+#endif // BITCOIN_QT_DPOSPAGE_H
@@ -19,6 +19,12 @@ static const bool DEFAULT_SPLASHSCREEN = true;
 /* Invalid field background style */
 #define STYLE_INVALID "background:#FF8080"
 
+/* Transaction list -- wallet transactions decomposed at a time as the view scrolls down */
+static const int TRANSACTION_FETCH_BATCH = 1000;
+
+/* DPoS page -- voters of a delegate listed at a time as the view scrolls down */
+static const int VOTER_FETCH_BATCH = 1000;
+
 /* Transaction list -- unconfirmed transaction */
 #define COLOR_UNCONFIRMED QColor(128, 128, 128)
 /* Transaction list -- negative amount */
@@ -20,11 +20,14 @@
 #include "util.h"
 #include "wallet/wallet.h"
 
+#include <set>
+
 #include <QColor>
 #include <QDateTime>
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QTimer>
 
 #include <boost/foreach.hpp>
 
@@ -38,21 +41,17 @@ static int column_alignments[] = {
         Qt::AlignRight|Qt::AlignVCenter /* amount */
     };
 
-// Comparison operator for sort/binary search of model tx list
-struct TxLessThan
+// A wallet notification, queued until the GUI thread handles it
+struct TransactionNotification
 {
-    bool operator()(const TransactionRecord &a, const TransactionRecord &b) const
-    {
-        return a.hash < b.hash;
-    }
-    bool operator()(const TransactionRecord &a, const uint256 &b) const
-    {
-        return a.hash < b;
-    }
-    bool operator()(const uint256 &a, const TransactionRecord &b) const
-    {
-        return a < b.hash;
-    }
+public:
+    TransactionNotification() {}
+    TransactionNotification(uint256 _hash, ChangeType _status, bool _showTransaction):
+        hash(_hash), status(_status), showTransaction(_showTransaction) {}
+
+    uint256 hash;
+    ChangeType status;
+    bool showTransaction;
 };
 
 // Private implementation
@@ -68,45 +67,156 @@ public:
     CWallet *wallet;
     TransactionTableModel *parent;
 
-    /* Local cache of wallet.
-     * As it is in the same order as the CWallet, by definition
-     * this is sorted by sha256.
+    /* Local cache of wallet, in the order the records were loaded.
+     * The records of one transaction are always next to each other.
      */
     QList<TransactionRecord> cachedWallet;
+    /* Row of the first record of each transaction in the model */
+    std::map<uint256, int> mapFirstRow;
+    /* Wallet transactions not decomposed yet, the newest last */
+    std::vector<uint256> vUnloaded;
 
-    /* Query entire wallet anew from core.
+    /* Query the list of wallet transactions anew from core. The transactions
+     * are only decomposed into records as the view asks for them, newest first.
      */
     void refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
         cachedWallet.clear();
+        mapFirstRow.clear();
+        vUnloaded.clear();
         {
-            LOCK2(cs_main, wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            LOCK(wallet->cs_wallet);
+            vUnloaded.reserve(wallet->wtxOrdered.size());
+            for (CWallet::TxItems::const_iterator it = wallet->wtxOrdered.begin(); it != wallet->wtxOrdered.end(); ++it)
             {
-                if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                if (it->second.first)
+                    vUnloaded.push_back(it->second.first->GetHash());
             }
         }
     }
 
+    bool canLoadMore() const
+    {
+        return !vUnloaded.empty();
+    }
+
+    /* Decompose up to nCount of the newest transactions not loaded yet.
+     * Waits for the core locks when fWait is set; otherwise returns false,
+     * having loaded nothing, when the core holds them.
+     */
+    bool loadMore(size_t nCount, bool fWait)
+    {
+        QList<TransactionRecord> toInsert;
+        if (fWait)
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+            decomposeUnloaded(nCount, toInsert);
+        }
+        else
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if (!lockMain)
+                return false;
+            TRY_LOCK(wallet->cs_wallet, lockWallet);
+            if (!lockWallet)
+                return false;
+            decomposeUnloaded(nCount, toInsert);
+        }
+        appendRecords(toInsert);
+        return true;
+    }
+
+    void decomposeUnloaded(size_t nCount, QList<TransactionRecord> &toInsert)
+    {
+        AssertLockHeld(cs_main);
+        AssertLockHeld(wallet->cs_wallet);
+        for (size_t n = 0; n < nCount && !vUnloaded.empty(); n++)
+        {
+            uint256 hash = vUnloaded.back();
+            vUnloaded.pop_back();
+            // Already added by a notification
+            if (mapFirstRow.count(hash))
+                continue;
+            std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+            if (mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second))
+                toInsert.append(TransactionRecord::decomposeTransaction(wallet, mi->second));
+        }
+    }
+
+    /* Add records at the end of the model, in one insertion */
+    void appendRecords(const QList<TransactionRecord> &toInsert)
+    {
+        if (toInsert.isEmpty())
+            return;
+        parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size() + toInsert.size() - 1);
+        Q_FOREACH(const TransactionRecord &rec, toInsert)
+        {
+            mapFirstRow.insert(std::make_pair(rec.hash, cachedWallet.size()));
+            cachedWallet.append(rec);
+        }
+        parent->endInsertRows();
+    }
+
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
        with that of the core.
 
-       Call with transaction that was added, removed or changed.
+       Call with the transactions that were added, removed or changed, all the notifications
+       that came in since the last call at once. The new transactions are decomposed under a
+       single try of the core locks, which are released before the model changes; returns false,
+       having changed nothing, when the core holds them.
      */
-    void updateWallet(const uint256 &hash, int status, bool showTransaction)
+    bool updateWallet(const std::vector<TransactionNotification> &vNotifications)
+    {
+        qDebug() << "TransactionTablePriv::updateWallet: " + QString::number(vNotifications.size()) + " notifications";
+
+        // Decompose the transactions that may have to be inserted
+        std::map<uint256, QList<TransactionRecord> > mapDecomposed;
+        std::set<uint256> setToDecompose;
+        for (const TransactionNotification &notification : vNotifications)
+        {
+            if (notification.status != CT_DELETED && notification.showTransaction && !mapFirstRow.count(notification.hash))
+                setToDecompose.insert(notification.hash);
+        }
+        if (!setToDecompose.empty())
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if (!lockMain)
+                return false;
+            TRY_LOCK(wallet->cs_wallet, lockWallet);
+            if (!lockWallet)
+                return false;
+            for (const uint256 &hash : setToDecompose)
+            {
+                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                if (mi != wallet->mapWallet.end())
+                    mapDecomposed[hash] = TransactionRecord::decomposeTransaction(wallet, mi->second);
+            }
+        }
+
+        for (size_t i = 0; i < vNotifications.size(); i++)
+        {
+            // Prevent balloon spam, show at most the last 10 new transactions
+            parent->setProcessingQueuedTransactions(vNotifications.size() - i > 10);
+            updateTransaction(vNotifications[i], mapDecomposed);
+        }
+        parent->setProcessingQueuedTransactions(false);
+        return true;
+    }
+
+    void updateTransaction(const TransactionNotification &notification, const std::map<uint256, QList<TransactionRecord> > &mapDecomposed)
     {
-        qDebug() << "TransactionTablePriv::updateWallet: " + QString::fromStdString(hash.ToString()) + " " + QString::number(status);
+        const uint256 &hash = notification.hash;
+        int status = notification.status;
+        bool showTransaction = notification.showTransaction;
 
         // Find bounds of this transaction in model
-        QList<TransactionRecord>::iterator lower = qLowerBound(
-            cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
-        QList<TransactionRecord>::iterator upper = qUpperBound(
-            cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
-        int lowerIndex = (lower - cachedWallet.begin());
-        int upperIndex = (upper - cachedWallet.begin());
-        bool inModel = (lower != upper);
+        std::map<uint256, int>::const_iterator it = mapFirstRow.find(hash);
+        bool inModel = (it != mapFirstRow.end());
+        int lowerIndex = inModel ? it->second : cachedWallet.size();
+        int upperIndex = lowerIndex;
+        while (upperIndex < cachedWallet.size() && cachedWallet[upperIndex].hash == hash)
+            upperIndex++;
 
         if(status == CT_UPDATED)
         {
@@ -116,7 +226,7 @@ public:
                 status = CT_DELETED; /* In model, but want to hide, treat as deleted */
         }
 
-        qDebug() << "    inModel=" + QString::number(inModel) +
+        qDebug() << "    " + QString::fromStdString(hash.ToString()) + " inModel=" + QString::number(inModel) +
                     " Index=" + QString::number(lowerIndex) + "-" + QString::number(upperIndex) +
                     " showTransaction=" + QString::number(showTransaction) + " derivedStatus=" + QString::number(status);
 
@@ -130,28 +240,14 @@ public:
             }
             if(showTransaction)
             {
-                LOCK2(cs_main, wallet->cs_wallet);
-                // Find transaction in wallet
-                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
-                if(mi == wallet->mapWallet.end())
+                std::map<uint256, QList<TransactionRecord> >::const_iterator mi = mapDecomposed.find(hash);
+                if(mi == mapDecomposed.end())
                 {
                     qWarning() << "TransactionTablePriv::updateWallet: Warning: Got CT_NEW, but transaction is not in wallet";
                     break;
                 }
-                // Added -- insert at the right position
-                QList<TransactionRecord> toInsert =
-                        TransactionRecord::decomposeTransaction(wallet, mi->second);
-                if(!toInsert.isEmpty()) /* only if something to insert */
-                {
-                    parent->beginInsertRows(QModelIndex(), lowerIndex, lowerIndex+toInsert.size()-1);
-                    int insert_idx = lowerIndex;
-                    Q_FOREACH(const TransactionRecord &rec, toInsert)
-                    {
-                        cachedWallet.insert(insert_idx, rec);
-                        insert_idx += 1;
-                    }
-                    parent->endInsertRows();
-                }
+                // Added -- insert at the end
+                appendRecords(mi->second);
             }
             break;
         case CT_DELETED:
@@ -162,7 +258,13 @@ public:
             }
             // Removed -- remove entire transaction from table
             parent->beginRemoveRows(QModelIndex(), lowerIndex, upperIndex-1);
-            cachedWallet.erase(lower, upper);
+            cachedWallet.erase(cachedWallet.begin() + lowerIndex, cachedWallet.begin() + upperIndex);
+            mapFirstRow.erase(hash);
+            for (int idx = lowerIndex; idx < cachedWallet.size(); idx++)
+            {
+                if (idx == lowerIndex || cachedWallet[idx].hash != cachedWallet[idx - 1].hash)
+                    mapFirstRow[cachedWallet[idx].hash] = idx;
+            }
             parent->endRemoveRows();
             break;
         case CT_UPDATED:
@@ -224,7 +326,7 @@ public:
 
     QString getTxHex(TransactionRecord *rec)
     {
-        LOCK2(cs_main, wallet->cs_wallet);
+        LOCK(wallet->cs_wallet);
         std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(rec->hash);
         if(mi != wallet->mapWallet.end())
         {
@@ -241,10 +343,12 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *_platformStyle
         walletModel(parent),
         priv(new TransactionTablePriv(_wallet, this)),
         fProcessingQueuedTransactions(false),
+        fFetchRetryScheduled(false),
         platformStyle(_platformStyle)
 {
     columns << QString() << QString() << tr("Date") << tr("Type") << tr("Label") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
     priv->refreshWallet();
+    fetchMore(QModelIndex());
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
@@ -264,12 +368,14 @@ void TransactionTableModel::updateAmountColumnTitle()
     Q_EMIT headerDataChanged(Qt::Horizontal,Amount,Amount);
 }
 
+static void QueueNotification(TransactionTableModel *ttm, const TransactionNotification &notification);
+
 void TransactionTableModel::updateTransaction(const QString &hash, int status, bool showTransaction)
 {
     uint256 updated;
     updated.SetHex(hash.toStdString());
 
-    priv->updateWallet(updated, status, showTransaction);
+    QueueNotification(this, TransactionNotification(updated, (ChangeType)status, showTransaction));
 }
 
 void TransactionTableModel::updateConfirmations()
@@ -288,6 +394,35 @@ int TransactionTableModel::rowCount(const QModelIndex &parent) const
     return priv->size();
 }
 
+bool TransactionTableModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && priv->canLoadMore();
+}
+
+void TransactionTableModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid() || !priv->canLoadMore())
+        return;
+    // Try again shortly when the core is busy, rather than blocking the GUI
+    if (!priv->loadMore(TRANSACTION_FETCH_BATCH, false) && !fFetchRetryScheduled)
+    {
+        fFetchRetryScheduled = true;
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(retryFetchMore()));
+    }
+}
+
+void TransactionTableModel::fetchAll()
+{
+    while (priv->canLoadMore())
+        priv->loadMore(TRANSACTION_FETCH_BATCH, true);
+}
+
+void TransactionTableModel::retryFetchMore()
+{
+    fFetchRetryScheduled = false;
+    fetchMore(QModelIndex());
+}
+
 int TransactionTableModel::columnCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
@@ -709,31 +844,49 @@ void TransactionTableModel::updateDisplayUnit()
     Q_EMIT dataChanged(index(0, Amount), index(priv->size()-1, Amount));
 }
 
-// queue notifications to show a non freezing progress dialog e.g. for rescan
-struct TransactionNotification
+// Notifications are queued and handled by the GUI thread together: those of
+// all the transactions of a block, or of a whole rescan behind a non freezing
+// progress dialog.
+static CCriticalSection cs_notifications;
+static bool fQueueNotifications = false;
+static bool fNotificationsScheduled = false;
+static std::vector< TransactionNotification > vQueueNotifications;
+
+static void ScheduleNotifications(TransactionTableModel *ttm)
 {
-public:
-    TransactionNotification() {}
-    TransactionNotification(uint256 _hash, ChangeType _status, bool _showTransaction):
-        hash(_hash), status(_status), showTransaction(_showTransaction) {}
+    AssertLockHeld(cs_notifications);
+    if (fQueueNotifications || fNotificationsScheduled || vQueueNotifications.empty())
+        return;
+    fNotificationsScheduled = true;
+    QMetaObject::invokeMethod(ttm, "processQueuedNotifications", Qt::QueuedConnection);
+}
 
-    void invoke(QObject *ttm)
-    {
-        QString strHash = QString::fromStdString(hash.GetHex());
-        qDebug() << "NotifyTransactionChanged: " + strHash + " status= " + QString::number(status);
-        QMetaObject::invokeMethod(ttm, "updateTransaction", Qt::QueuedConnection,
-                                  Q_ARG(QString, strHash),
-                                  Q_ARG(int, status),
-                                  Q_ARG(bool, showTransaction));
-    }
-private:
-    uint256 hash;
-    ChangeType status;
-    bool showTransaction;
-};
+static void QueueNotification(TransactionTableModel *ttm, const TransactionNotification &notification)
+{
+    LOCK(cs_notifications);
+    vQueueNotifications.push_back(notification);
+    ScheduleNotifications(ttm);
+}
 
-static bool fQueueNotifications = false;
-static std::vector< TransactionNotification > vQueueNotifications;
+void TransactionTableModel::processQueuedNotifications()
+{
+    std::vector<TransactionNotification> vNotifications;
+    {
+        LOCK(cs_notifications);
+        vNotifications.swap(vQueueNotifications);
+    }
+    if (!priv->updateWallet(vNotifications))
+    {
+        // The core is busy; put them back in front of any newer ones and retry shortly
+        LOCK(cs_notifications);
+        vQueueNotifications.insert(vQueueNotifications.begin(), vNotifications.begin(), vNotifications.end());
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(processQueuedNotifications()));
+        return;
+    }
+    LOCK(cs_notifications);
+    fNotificationsScheduled = false;
+    ScheduleNotifications(this);
+}
 
 static void NotifyTransactionChanged(TransactionTableModel *ttm, CWallet *wallet, const uint256 &hash, ChangeType status)
 {
@@ -743,34 +896,20 @@ static void NotifyTransactionChanged(TransactionTableModel *ttm, CWallet *wallet
     bool inWallet = mi != wallet->mapWallet.end();
     bool showTransaction = (inWallet && TransactionRecord::showTransaction(mi->second));
 
-    TransactionNotification notification(hash, status, showTransaction);
-
-    if (fQueueNotifications)
-    {
-        vQueueNotifications.push_back(notification);
-        return;
-    }
-    notification.invoke(ttm);
+    qDebug() << "NotifyTransactionChanged: " + QString::fromStdString(hash.GetHex()) + " status= " + QString::number(status);
+    QueueNotification(ttm, TransactionNotification(hash, status, showTransaction));
 }
 
 static void ShowProgress(TransactionTableModel *ttm, const std::string &title, int nProgress)
 {
+    LOCK(cs_notifications);
     if (nProgress == 0)
         fQueueNotifications = true;
 
     if (nProgress == 100)
     {
         fQueueNotifications = false;
-        if (vQueueNotifications.size() > 10) // prevent balloon spam, show maximum 10 balloons
-            QMetaObject::invokeMethod(ttm, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, true));
-        for (unsigned int i = 0; i < vQueueNotifications.size(); ++i)
-        {
-            if (vQueueNotifications.size() - i <= 10)
-                QMetaObject::invokeMethod(ttm, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, false));
-
-            vQueueNotifications[i].invoke(ttm);
-        }
-        std::vector<TransactionNotification >().swap(vQueueNotifications); // clear
+        ScheduleNotifications(ttm);
     }
 }
 
@@ -79,6 +79,11 @@ public:
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
+    /** The wallet transactions are loaded newest first, as the view asks for more rows */
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+    /** Load every wallet transaction, waiting for the core locks, e.g. before an export */
+    void fetchAll();
     bool processingQueuedTransactions() { return fProcessingQueuedTransactions; }
 
 private:
@@ -87,6 +92,7 @@ private:
     QStringList columns;
     TransactionTablePriv *priv;
     bool fProcessingQueuedTransactions;
+    bool fFetchRetryScheduled;
     const PlatformStyle *platformStyle;
 
     void subscribeToCoreSignals();
@@ -113,6 +119,9 @@ public Q_SLOTS:
     void updateAmountColumnTitle();
     /* Needed to update fProcessingQueuedTransactions through a QueuedConnection */
     void setProcessingQueuedTransactions(bool value) { fProcessingQueuedTransactions = value; }
+    /* Handle the wallet notifications queued since the last call, all at once */
+    void processQueuedNotifications();
+    void retryFetchMore();
 
     friend class TransactionTablePriv;
 };
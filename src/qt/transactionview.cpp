@@ -339,6 +339,9 @@ void TransactionView::exportClicked()
 
     CSVModelWriter writer(filename);
 
+    // The model only holds the transactions the view scrolled to so far
+    model->getTransactionTableModel()->fetchAll();
+
     // name, column, role
     writer.setModel(transactionProxyModel);
     writer.addColumn(tr("Confirmed"), 0, TransactionTableModel::ConfirmedRole);
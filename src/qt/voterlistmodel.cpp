@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "voterlistmodel.h"
+
+#include "guiconstants.h"
+
+#include "base58.h"
+#include "vote.h"
+
+#include <algorithm>
+
+VoterListModel::VoterListModel(QObject *parent) :
+    QAbstractListModel(parent),
+    fDelegate(false),
+    pVoters(std::make_shared<const CKeyIDSet>())
+{
+    itNext = pVoters->end();
+}
+
+void VoterListModel::setDelegate(const std::shared_ptr<const CVoteView>& view, const CKeyID& delegateIn)
+{
+    delegate = delegateIn;
+    fDelegate = true;
+    reset(view->GetDelegateVoterSet(delegate), VOTER_FETCH_BATCH);
+}
+
+void VoterListModel::setView(const std::shared_ptr<const CVoteView>& view)
+{
+    if (!fDelegate)
+        return;
+    // Views share the voter sets no vote changed
+    std::shared_ptr<const CKeyIDSet> pVotersNew = view->GetDelegateVoterSet(delegate);
+    if (pVotersNew == pVoters)
+        return;
+    reset(pVotersNew, std::max<size_t>(vListed.size(), VOTER_FETCH_BATCH));
+}
+
+void VoterListModel::clear()
+{
+    fDelegate = false;
+    reset(std::make_shared<const CKeyIDSet>(), 0);
+}
+
+void VoterListModel::reset(std::shared_ptr<const CKeyIDSet> pVotersIn, size_t nRows)
+{
+    beginResetModel();
+    pVoters = std::move(pVotersIn);
+    itNext = pVoters->begin();
+    vListed.clear();
+    for (; vListed.size() < nRows && itNext != pVoters->end(); ++itNext)
+        vListed.push_back(*itNext);
+    endResetModel();
+    Q_EMIT votersChanged(pVoters->size());
+}
+
+int VoterListModel::getVoterCount() const
+{
+    return pVoters->size();
+}
+
+int VoterListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return vListed.size();
+}
+
+QVariant VoterListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= (int)vListed.size())
+        return QVariant();
+
+    if (role == Qt::DisplayRole)
+        return QString::fromStdString(CBitcoinAddress(vListed[index.row()]).ToString());
+
+    return QVariant();
+}
+
+bool VoterListModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && itNext != pVoters->end();
+}
+
+void VoterListModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid())
+        return;
+
+    std::vector<CKeyID> vMore;
+    for (; vMore.size() < (size_t)VOTER_FETCH_BATCH && itNext != pVoters->end(); ++itNext)
+        vMore.push_back(*itNext);
+    if (vMore.empty())
+        return;
+
+    beginInsertRows(QModelIndex(), vListed.size(), vListed.size() + vMore.size() - 1);
+    vListed.insert(vListed.end(), vMore.begin(), vMore.end());
+    endInsertRows();
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_VOTERLISTMODEL_H
+#define BITCOIN_QT_VOTERLISTMODEL_H
+
+#include "flatset.h"
+#include "pubkey.h"
+
+#include <memory>
+#include <vector>
+
+#include <QAbstractListModel>
+
+class CVoteView;
+
+/**
+   Qt model of the voters of one delegate. The voter set is shared with the
+   published view, and its addresses are only listed as the view scrolls down,
+   so a delegate with tens of thousands of voters shows at once.
+ */
+class VoterListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit VoterListModel(QObject *parent = 0);
+
+    /** Show the voters of a delegate as of the given view */
+    void setDelegate(const std::shared_ptr<const CVoteView>& view, const CKeyID& delegate);
+    /** Follow a newly published view, which only resets the list when the voters changed */
+    void setView(const std::shared_ptr<const CVoteView>& view);
+    void clear();
+
+    int getVoterCount() const;
+
+    /** @name Methods overridden from QAbstractListModel
+        @{*/
+    int rowCount(const QModelIndex &parent) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+    /*@}*/
+
+Q_SIGNALS:
+    void votersChanged(int count);
+
+private:
+    CKeyID delegate;
+    bool fDelegate;
+    std::shared_ptr<const CFlatSet<CKeyID>> pVoters;
+    //! The next voter to list
+    CFlatSet<CKeyID>::const_iterator itNext;
+    std::vector<CKeyID> vListed;
+
+    void reset(std::shared_ptr<const CFlatSet<CKeyID>> pVotersIn, size_t nRows);
+};
+
+#endif // BITCOIN_QT_VOTERLISTMODEL_H
@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rawblockcache.h"
+
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+CRawBlockCache rawBlockCache(DEFAULT_RAW_BLOCK_CACHE_SIZE);
+
+void CRawBlockCache::Insert(const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    {
+        LOCK(cs);
+        if (mapBlocks.count(hash))
+            return;
+    }
+
+    // Serialize without holding the lock
+    Entry entry;
+    std::shared_ptr<std::vector<unsigned char> > data = std::make_shared<std::vector<unsigned char> >();
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, *data, 0, block);
+    if (data->size() > nMaxBytes)
+        return;
+    entry.data = data;
+    entry.fHasWitness = false;
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->HasWitness()) {
+            entry.fHasWitness = true;
+            break;
+        }
+    }
+
+    LOCK(cs);
+    if (!mapBlocks.insert(std::make_pair(hash, entry)).second)
+        return;
+    queueBlocks.push_back(hash);
+    nBytes += data->size();
+    while (nBytes > nMaxBytes) {
+        std::map<uint256, Entry>::iterator it = mapBlocks.find(queueBlocks.front());
+        nBytes -= it->second.data->size();
+        mapBlocks.erase(it);
+        queueBlocks.pop_front();
+    }
+}
+
+std::shared_ptr<const std::vector<unsigned char> > CRawBlockCache::Get(const uint256& hash, bool fWitness) const
+{
+    LOCK(cs);
+    std::map<uint256, Entry>::const_iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end() || (it->second.fHasWitness && !fWitness))
+        return nullptr;
+    return it->second.data;
+}
+
+size_t CRawBlockCache::Bytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
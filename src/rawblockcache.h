@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RAWBLOCKCACHE_H
+#define BITCOIN_RAWBLOCKCACHE_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+class CBlock;
+
+/** Bytes of serialized blocks kept by the raw block cache */
+static const size_t DEFAULT_RAW_BLOCK_CACHE_SIZE = 16 << 20;
+
+/**
+ * The network serialization of the most recently connected blocks, so the
+ * block messages of getdata requests, REST and getblock can send them as
+ * they are, instead of reading each block from disk and serializing it again.
+ * Every peer asks for a new block right after it is connected. The oldest
+ * blocks are dropped once the cache holds more than its size in bytes.
+ */
+class CRawBlockCache
+{
+public:
+    explicit CRawBlockCache(size_t nMaxBytesIn) : nMaxBytes(nMaxBytesIn), nBytes(0) {}
+
+    /** Add a block, which must have been fully validated */
+    void Insert(const CBlock& block);
+
+    /**
+     * The serialized block with the given hash, with witness data unless
+     * fWitness is false. NULL when the block is not cached, or when it has
+     * witness data and fWitness is false.
+     */
+    std::shared_ptr<const std::vector<unsigned char> > Get(const uint256& hash, bool fWitness) const;
+
+    /** Bytes of serialized blocks held */
+    size_t Bytes() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::vector<unsigned char> > data;
+        bool fHasWitness;
+    };
+
+    mutable CCriticalSection cs;
+    const size_t nMaxBytes;
+    size_t nBytes;
+    std::map<uint256, Entry> mapBlocks;
+    //! Hashes of the cached blocks, oldest first
+    std::deque<uint256> queueBlocks;
+};
+
+extern CRawBlockCache rawBlockCache;
+
+#endif // BITCOIN_RAWBLOCKCACHE_H
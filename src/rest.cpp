@@ -3,24 +3,34 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "miner.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "rawblockcache.h"
 #include "validation.h"
 #include "httpserver.h"
+#include "indexer.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "undo.h"
 #include "utilstrencodings.h"
 #include "version.h"
+#include "vote.h"
 
 #include <boost/algorithm/string.hpp>
 
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int MAX_REST_BLOCKS = 1000; //allow a max of 1000 blocks to be streamed at once
+static const size_t REST_BLOCKS_CHUNK_SIZE = 1 << 20; //bytes of blocks sent per chunk of the reply
+static const size_t REST_MEMPOOL_CHUNK_SIZE = 1 << 16; //bytes of mempool entries sent per chunk of the reply
 
 enum RetFormat {
     RF_UNDEF,
@@ -40,25 +50,28 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
     ADD_SERIALIZE_METHODS;
 
+    CCoin() : nHeight(0) {}
+    CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
 };
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
-extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CTxUndo* ptxundo = NULL);
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false, const CBlockUndo* pblockundo = NULL);
 extern UniValue mempoolInfoToJSON();
-extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void entryInfoToJSON(UniValue& info, const CTxMemPoolEntryInfo& e);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -210,6 +223,11 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // Binary and hex output of a recent block can go out as it was serialized when connected
+    std::shared_ptr<const std::vector<unsigned char> > pblockData;
+    if (rf != RF_JSON)
+        pblockData = rawBlockCache.Get(hash, !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS));
+
     CBlock block;
     CBlockIndex* pblockindex = NULL;
     {
@@ -221,12 +239,15 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        if (!pblockData && !ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    if (pblockData)
+        ssBlock.write((const char*)pblockData->data(), pblockData->size());
+    else if (rf != RF_JSON)
+        ssBlock << block;
 
     switch (rf) {
     case RF_BINARY: {
@@ -260,6 +281,81 @@ static bool rest_block(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: bin)");
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() < 2 || path.size() > 3 || (path.size() == 3 && path[2] != "undo"))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blocks/<fromheight>/<count>[/undo].bin");
+    bool fUndo = path.size() == 3;
+
+    int32_t nFromHeight, nCount;
+    if (!ParseInt32(path[0], &nFromHeight) || nFromHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+    if (!ParseInt32(path[1], &nCount) || nCount < 1 || nCount > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Block count out of range: %s, must be 1 to %d", path[1], MAX_REST_BLOCKS));
+
+    // Disk positions of the blocks, then read without holding cs_main
+    std::vector<std::pair<CDiskBlockPos, CDiskBlockPos> > vPos;
+    {
+        LOCK(cs_main);
+        for (int nHeight = nFromHeight; nHeight < nFromHeight + nCount && nHeight <= chainActive.Height(); nHeight++) {
+            const CBlockIndex* pindex = chainActive[nHeight];
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (fUndo && pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                break;
+            vPos.push_back(std::make_pair(pindex->GetBlockPos(), pindex->GetUndoPos()));
+        }
+    }
+    if (vPos.empty())
+        return RESTERR(req, HTTP_NOT_FOUND, path[0] + " not found or not available (pruned data)");
+
+    // The blocks follow each other in the stream, each with its undo data after it if asked for
+    bool fWitness = !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS);
+    req->WriteHeader("Content-Type", "application/octet-stream");
+    req->StartChunkedReply(HTTP_OK);
+    std::string strChunk;
+    for (size_t i = 0; i < vPos.size(); i++) {
+        if (fWitness) {
+            if (!ReadRawRecordFromDisk(strChunk, vPos[i].first, false))
+                break;
+        } else {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, vPos[i].first, Params().GetConsensus()))
+                break;
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+            ssBlock << block;
+            strChunk.append(ssBlock.begin(), ssBlock.end());
+        }
+
+        if (fUndo) {
+            if (vPos[i].second.IsNull()) {
+                // The genesis block spends nothing
+                CDataStream ssUndo(SER_NETWORK, PROTOCOL_VERSION);
+                ssUndo << CBlockUndo();
+                strChunk.append(ssUndo.begin(), ssUndo.end());
+            } else if (!ReadRawRecordFromDisk(strChunk, vPos[i].second, true)) {
+                break;
+            }
+        }
+
+        if (strChunk.size() >= REST_BLOCKS_CHUNK_SIZE) {
+            req->WriteReplyChunk(strChunk);
+            strChunk.clear();
+        }
+    }
+    // A block that can't be read, because it was pruned meanwhile, cuts the stream short
+    req->WriteReplyChunk(strChunk);
+    req->EndChunkedReply();
+    return true;
+}
+
 static bool rest_block_extended(HTTPRequest* req, const std::string& strURIPart)
 {
     return rest_block(req, strURIPart, true);
@@ -333,11 +429,32 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
+        }
+        uint64_t nSequence;
+        std::vector<CTxMemPoolEntryInfo> vInfo = mempool.SnapshotEntries(nHeight, nSequence);
 
-        std::string strJSON = mempoolObject.write() + "\n";
+        // Write the object out entry by entry, without the pool locked or the whole of it built
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->StartChunkedReply(HTTP_OK);
+        std::string strChunk = "{";
+        for (size_t i = 0; i < vInfo.size(); i++) {
+            UniValue info(UniValue::VOBJ);
+            entryInfoToJSON(info, vInfo[i]);
+            if (i)
+                strChunk += ",";
+            strChunk += "\"" + vInfo[i].txid.ToString() + "\":" + info.write();
+            if (strChunk.size() >= REST_MEMPOOL_CHUNK_SIZE) {
+                req->WriteReplyChunk(strChunk);
+                strChunk.clear();
+            }
+        }
+        strChunk += "}\n";
+        req->WriteReplyChunk(strChunk);
+        req->EndChunkedReply();
         return true;
     }
     default: {
@@ -514,22 +631,11 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
             bool hit = false;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hit = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hit = true;
+                outs.emplace_back(std::move(coin));
             }
 
             hits.push_back(hit);
@@ -573,7 +679,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         BOOST_FOREACH (const CCoin& coin, outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
             utxo.push_back(Pair("height", (int32_t)coin.nHeight));
             utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
 
@@ -600,6 +705,261 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** The reply of /rest/dpos/delegates, built once for each published vote view */
+struct CRESTDelegatesReply {
+    std::shared_ptr<const CVoteView> view;
+    std::string strBinary;
+    std::string strJSON;
+};
+
+static CCriticalSection cs_restDelegates;
+static std::shared_ptr<const CRESTDelegatesReply> pRESTDelegates;
+
+static std::shared_ptr<const CRESTDelegatesReply> GetRESTDelegates()
+{
+    std::shared_ptr<const CVoteView> view = Vote::GetInstance().GetView();
+    {
+        LOCK(cs_restDelegates);
+        if (pRESTDelegates && pRESTDelegates->view == view)
+            return pRESTDelegates;
+    }
+
+    std::shared_ptr<CRESTDelegatesReply> reply = std::make_shared<CRESTDelegatesReply>();
+    reply->view = view;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    UniValue delegates(UniValue::VARR);
+    const std::map<std::string, CKeyID>& mapDelegates = view->ListDelegates();
+    WriteCompactSize(ss, mapDelegates.size());
+    for (const auto& item : mapDelegates) {
+        uint64_t nVotes = view->GetDelegateVotes(item.second);
+        ss << item.first << item.second << nVotes;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("name", item.first));
+        entry.push_back(Pair("address", CBitcoinAddress(item.second).ToString()));
+        entry.push_back(Pair("votes", nVotes));
+        delegates.push_back(entry);
+    }
+    reply->strBinary = ss.str();
+    reply->strJSON = delegates.write() + "\n";
+
+    LOCK(cs_restDelegates);
+    pRESTDelegates = reply;
+    return reply;
+}
+
+/** Send a reply that has a binary and a JSON form in the requested format */
+static bool RESTWriteReply(HTTPRequest* req, RetFormat rf, const std::string& strBinary, const std::string& strJSON)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, strBinary);
+        return true;
+    }
+
+    case RF_HEX: {
+        std::string strHex = HexStr(strBinary.begin(), strBinary.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool rest_dpos_delegates(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/dpos/delegates.<ext>");
+
+    std::shared_ptr<const CRESTDelegatesReply> reply = GetRESTDelegates();
+    return RESTWriteReply(req, rf, reply->strBinary, reply->strJSON);
+}
+
+static bool rest_dpos_round(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    int64_t nRound;
+    if (!ParseInt64(param, &nRound) || nRound < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid round: " + param);
+
+    // Block times only grow with the slots, so the first block of the round is found by bisecting the active chain
+    DPoS& dpos = DPoS::GetInstance();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    int nLow = std::max(dpos.GetStartDPoSHeight(), 0);
+    int nHigh = tip->nHeight + 1;
+    if (nLow > tip->nHeight || (int64_t)dpos.GetLoopIndex(tip->pindexTip->nTime) < nRound)
+        return RESTERR(req, HTTP_NOT_FOUND, "round " + param + " not found");
+    while (nLow < nHigh) {
+        int nMid = nLow + (nHigh - nLow) / 2;
+        if ((int64_t)dpos.GetLoopIndex(tip->pindexTip->GetAncestor(nMid)->nTime) < nRound)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    const CBlockIndex* pindex = tip->pindexTip->GetAncestor(nLow);
+    DelegateInfo cDelegateInfo;
+    if ((int64_t)dpos.GetLoopIndex(pindex->nTime) != nRound || !dpos.GetBlockDelegates(cDelegateInfo, pindex))
+        return RESTERR(req, HTTP_NOT_FOUND, "round " + param + " not found");
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint64_t)nRound << pindex->nHeight << pindex->GetBlockHash();
+    WriteCompactSize(ss, cDelegateInfo.delegates.size());
+    UniValue delegates(UniValue::VARR);
+    for (const Delegate& delegate : cDelegateInfo.delegates) {
+        ss << delegate.keyid << delegate.votes;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", CBitcoinAddress(delegate.keyid).ToString()));
+        entry.push_back(Pair("votes", delegate.votes));
+        delegates.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("round", nRound));
+    result.push_back(Pair("height", pindex->nHeight));
+    result.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+    result.push_back(Pair("delegates", delegates));
+    return RESTWriteReply(req, rf, ss.str(), result.write() + "\n");
+}
+
+static bool rest_address(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2 || path[1] != "balance")
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/address/<address>/balance.<ext>");
+
+    CBitcoinAddress address(path[0]);
+    if (!address.IsValid())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + path[0]);
+
+    CTxDestination dest = address.Get();
+    uint64_t nBalance;
+    if (address.IsScript())
+        nBalance = Vote::GetInstance().GetAddressBalance(CMyAddress(boost::get<CScriptID>(dest), CChainParams::SCRIPT_ADDRESS));
+    else
+        nBalance = Vote::GetInstance().GetAddressBalance(CMyAddress(boost::get<CKeyID>(dest), CChainParams::PUBKEY_ADDRESS));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nBalance;
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("address", path[0]));
+    result.push_back(Pair("balance", nBalance));
+    return RESTWriteReply(req, rf, ss.str(), result.write() + "\n");
+}
+
+/** The block of the request for its basic filter, after checking that the index is on */
+static bool RESTGetFilterBlock(HTTPRequest* req, const std::string& strFilterType, const std::string& hashStr, const CBlockIndex*& pindex)
+{
+    if (pblockfilterindexer == NULL)
+        return RESTERR(req, HTTP_NOT_FOUND, "Block filters are not available, use -blockfilterindex");
+    if (strFilterType != "basic")
+        return RESTERR(req, HTTP_BAD_REQUEST, "Unknown filter type: " + strFilterType);
+
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    if (it == mapBlockIndex.end())
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+    pindex = it->second;
+    return true;
+}
+
+static bool rest_blockfilter(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilter/<filtertype>/<hash>.<ext>");
+
+    const CBlockIndex* pindex = NULL;
+    if (!RESTGetFilterBlock(req, path[0], path[1], pindex))
+        return false;
+    CBlockFilter filter;
+    if (!pblockfilterindexer->LookupFilter(pindex, filter))
+        return RESTERR(req, HTTP_NOT_FOUND, "Filter of block " + path[1] + " not found, the index may not be synced yet");
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << filter.GetEncoded();
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("filter", HexStr(filter.GetEncoded())));
+    return RESTWriteReply(req, rf, ss.str(), result.write() + "\n");
+}
+
+static bool rest_blockfilterheaders(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilterheaders/<filtertype>/<count>/<hash>.<ext>");
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[1]);
+
+    const CBlockIndex* pindex = NULL;
+    if (!RESTGetFilterBlock(req, path[0], path[2], pindex))
+        return false;
+
+    // In upward direction, as /rest/headers/
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        while (pindex != NULL && chainActive.Contains(pindex) && vIndex.size() < (unsigned long)count) {
+            vIndex.push_back(pindex);
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    UniValue headers(UniValue::VARR);
+    for (const CBlockIndex* pindexHeader : vIndex) {
+        uint256 hashFilter, hashHeader;
+        if (!pblockfilterindexer->LookupFilterHashes(pindexHeader, hashFilter, hashHeader))
+            break;
+        ss << hashHeader;
+        headers.push_back(hashHeader.GetHex());
+    }
+    return RESTWriteReply(req, rf, ss.str(), headers.write() + "\n");
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -607,11 +967,17 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/dpos/delegates", rest_dpos_delegates},
+      {"/rest/dpos/round/", rest_dpos_round},
+      {"/rest/address/", rest_address},
+      {"/rest/blockfilter/", rest_blockfilter},
+      {"/rest/blockfilterheaders/", rest_blockfilterheaders},
 };
 
 bool StartREST()
@@ -13,13 +13,17 @@
 #include "validation.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rawblockcache.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "undo.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
+#include "vote.h"
+#include "indexer.h"
 #include "miner.h"
 #include "init.h"
 #include "../validation.h"
@@ -28,6 +32,8 @@
 
 #include <univalue.h>
 
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 #include <mutex>
@@ -44,7 +50,7 @@ static std::mutex cs_blockchange;
 static std::condition_variable cond_blockchange;
 static CUpdatedBlock latestblock;
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CTxUndo* ptxundo = NULL);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
 double GetDifficulty(const CBlockIndex* blockindex)
@@ -107,7 +113,18 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** Transactions of a block below which getblock formats them on the calling thread, and the least each thread takes on */
+static const size_t BLOCK_JSON_TXS_PER_THREAD = 250;
+
+static void BlockTxsToJSON(const CBlock& block, const CBlockUndo* pblockundo, std::vector<UniValue>& vTxs, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        vTxs[i] = UniValue(UniValue::VOBJ);
+        TxToJSON(*block.vtx[i], uint256(), vTxs[i], pblockundo && i > 0 ? &pblockundo->vtxundo[i - 1] : NULL);
+    }
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false, const CBlockUndo* pblockundo = NULL)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
@@ -124,15 +141,19 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
     UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(*tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
+    if (txDetails) {
+        // The transactions are independent of each other, a large block is split into contiguous ranges
+        std::vector<UniValue> vTxs(block.vtx.size());
+        size_t nThreads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), block.vtx.size() / BLOCK_JSON_TXS_PER_THREAD));
+        size_t nPerThread = (block.vtx.size() + nThreads - 1) / nThreads;
+        boost::thread_group threadGroup;
+        for (size_t i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&BlockTxsToJSON, boost::cref(block), pblockundo, boost::ref(vTxs), i * nPerThread, std::min(block.vtx.size(), (i + 1) * nPerThread)));
+        BlockTxsToJSON(block, pblockundo, vTxs, 0, std::min(block.vtx.size(), nPerThread));
+        threadGroup.join_all();
+        txs.push_backV(vTxs);
+    } else {
+        for (const auto& tx : block.vtx)
             txs.push_back(tx->GetHash().GetHex());
     }
     result.push_back(Pair("tx", txs));
@@ -164,8 +185,7 @@ UniValue getblockcount(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSnapshot()->nHeight;
 }
 
 UniValue getbestblockhash(const JSONRPCRequest& request)
@@ -181,8 +201,7 @@ UniValue getbestblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipSnapshot()->hashTip.GetHex();
 }
 
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
@@ -195,6 +214,30 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
     cond_blockchange.notify_all();
 }
 
+/**
+ * Wait up to timeout milliseconds, 0 for no limit, for done to hold for the
+ * latest block, and return that block. A request the transport can park is
+ * parked instead, with strState to be given back when it runs again, and the
+ * timeout counts from when it was first run.
+ */
+static CUpdatedBlock WaitForBlockChange(const JSONRPCRequest& request, int timeout, const std::string& strState, const std::function<bool(const CUpdatedBlock&)>& done)
+{
+    std::unique_lock<std::mutex> lock(cs_blockchange);
+    if (request.fParkable) {
+        int64_t nWakeTime = 0;
+        if (timeout)
+            nWakeTime = (request.nParkedSince ? request.nParkedSince : GetTimeMillis()) + timeout;
+        if (!done(latestblock) && IsRPCRunning() && (!nWakeTime || GetTimeMillis() < nWakeTime))
+            throw RPCParkRequest(nWakeTime, strState);
+        return latestblock;
+    }
+    if(timeout)
+        cond_blockchange.wait_for(lock, std::chrono::milliseconds(timeout), [&done]{return done(latestblock) || !IsRPCRunning(); });
+    else
+        cond_blockchange.wait(lock, [&done]{return done(latestblock) || !IsRPCRunning(); });
+    return latestblock;
+}
+
 UniValue waitfornewblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -217,16 +260,15 @@ UniValue waitfornewblock(const JSONRPCRequest& request)
     if (request.params.size() > 0)
         timeout = request.params[0].get_int();
 
+    // The block at the first run of a parked request is the one it waits to change
     CUpdatedBlock block;
-    {
-        std::unique_lock<std::mutex> lock(cs_blockchange);
-        block = latestblock;
-        if(timeout)
-            cond_blockchange.wait_for(lock, std::chrono::milliseconds(timeout), [&block]{return latestblock.height != block.height || latestblock.hash != block.hash || !IsRPCRunning(); });
-        else
-            cond_blockchange.wait(lock, [&block]{return latestblock.height != block.height || latestblock.hash != block.hash || !IsRPCRunning(); });
+    if (request.strParkState.empty()) {
+        std::lock_guard<std::mutex> lock(cs_blockchange);
         block = latestblock;
+    } else {
+        block.hash = uint256S(request.strParkState);
     }
+    block = WaitForBlockChange(request, timeout, block.hash.GetHex(), [&block](const CUpdatedBlock& latest) { return latest.hash != block.hash; });
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("hash", block.hash.GetHex()));
     ret.push_back(Pair("height", block.height));
@@ -259,15 +301,7 @@ UniValue waitforblock(const JSONRPCRequest& request)
     if (request.params.size() > 1)
         timeout = request.params[1].get_int();
 
-    CUpdatedBlock block;
-    {
-        std::unique_lock<std::mutex> lock(cs_blockchange);
-        if(timeout)
-            cond_blockchange.wait_for(lock, std::chrono::milliseconds(timeout), [&hash]{return latestblock.hash == hash || !IsRPCRunning();});
-        else
-            cond_blockchange.wait(lock, [&hash]{return latestblock.hash == hash || !IsRPCRunning(); });
-        block = latestblock;
-    }
+    CUpdatedBlock block = WaitForBlockChange(request, timeout, "", [&hash](const CUpdatedBlock& latest) { return latest.hash == hash; });
 
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("hash", block.hash.GetHex()));
@@ -302,15 +336,7 @@ UniValue waitforblockheight(const JSONRPCRequest& request)
     if (request.params.size() > 1)
         timeout = request.params[1].get_int();
 
-    CUpdatedBlock block;
-    {
-        std::unique_lock<std::mutex> lock(cs_blockchange);
-        if(timeout)
-            cond_blockchange.wait_for(lock, std::chrono::milliseconds(timeout), [&height]{return latestblock.height >= height || !IsRPCRunning();});
-        else
-            cond_blockchange.wait(lock, [&height]{return latestblock.height >= height || !IsRPCRunning(); });
-        block = latestblock;
-    }
+    CUpdatedBlock block = WaitForBlockChange(request, timeout, "", [&height](const CUpdatedBlock& latest) { return latest.height >= height; });
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("hash", block.hash.GetHex()));
     ret.push_back(Pair("height", block.height));
@@ -354,30 +380,24 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+void entryInfoToJSON(UniValue &info, const CTxMemPoolEntryInfo &e)
 {
-    AssertLockHeld(mempool.cs);
-
-    info.push_back(Pair("size", (int)e.GetTxSize()));
-    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-    info.push_back(Pair("time", e.GetTime()));
-    info.push_back(Pair("height", (int)e.GetHeight()));
-    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-    info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
-    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
-    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
-    info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    const CTransaction& tx = e.GetTx();
+    info.push_back(Pair("size", (int)e.nTxSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("startingpriority", e.dStartingPriority));
+    info.push_back(Pair("currentpriority", e.dCurrentPriority));
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants));
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants));
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants));
+    info.push_back(Pair("ancestorcount", e.nCountWithAncestors));
+    info.push_back(Pair("ancestorsize", e.nSizeWithAncestors));
+    info.push_back(Pair("ancestorfees", e.nModFeesWithAncestors));
     set<string> setDepends;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-    {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
-    }
+    BOOST_FOREACH(const uint256& dep, e.vDepends)
+        setDepends.insert(dep.ToString());
 
     UniValue depends(UniValue::VARR);
     BOOST_FOREACH(const string& dep, setDepends)
@@ -388,25 +408,45 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+{
+    AssertLockHeld(mempool.cs);
+    entryInfoToJSON(info, mempool.GetEntryInfo(mempool.mapTx.iterator_to(e), chainActive.Height()));
+}
+
+UniValue mempoolToJSON(bool fVerbose = false, uint64_t* pnSequence = NULL)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
+        // Copy the entries out, so the pool is not locked while they are formatted
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
+        }
+        uint64_t nSequence;
+        std::vector<CTxMemPoolEntryInfo> vInfo = mempool.SnapshotEntries(nHeight, nSequence);
+        if (pnSequence)
+            *pnSequence = nSequence;
+
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntryInfo& e, vInfo)
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            entryInfoToJSON(info, e);
+            o.push_back(Pair(e.txid.ToString(), info));
         }
         return o;
     }
     else
     {
         vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
+        {
+            LOCK(mempool.cs);
+            mempool.queryHashes(vtxid);
+            if (pnSequence)
+                *pnSequence = mempool.GetSequence();
+        }
 
         UniValue a(UniValue::VARR);
         BOOST_FOREACH(const uint256& hash, vtxid)
@@ -418,13 +458,14 @@ UniValue mempoolToJSON(bool fVerbose = false)
 
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() > 1)
+    if (request.fHelp || request.params.size() > 2)
         throw runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose mempool_sequence )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nHint: use getmempoolentry to fetch a specific transaction from the mempool.\n"
             "\nArguments:\n"
-            "1. verbose (boolean, optional, default=false) True for a json object, false for array of transaction ids\n"
+            "1. verbose          (boolean, optional, default=false) True for a json object, false for array of transaction ids\n"
+            "2. mempool_sequence (boolean, optional, default=false) True to also return the sequence of the pool the result is from, see getmempoolchanges\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
@@ -436,6 +477,12 @@ UniValue getrawmempool(const JSONRPCRequest& request)
             + EntryDescriptionString()
             + "  }, ...\n"
             "}\n"
+            "\nResult: (for mempool_sequence = true):\n"
+            "{\n"
+            "  \"txids\" : [...],           (json array) The transaction ids, for verbose = false\n"
+            "  \"entries\" : {...},         (json object) The transactions as above, for verbose = true\n"
+            "  \"mempool_sequence\" : n     (numeric) The sequence of the pool the result is from\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getrawmempool", "true")
             + HelpExampleRpc("getrawmempool", "true")
@@ -444,8 +491,80 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     bool fVerbose = false;
     if (request.params.size() > 0)
         fVerbose = request.params[0].get_bool();
+    bool fSequence = false;
+    if (request.params.size() > 1)
+        fSequence = request.params[1].get_bool();
+
+    if (!fVerbose && !fSequence) {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        CRPCArrayResult result(request);
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            result.push_back(hash.ToString());
+        return result.get();
+    }
+
+    uint64_t nSequence = 0;
+    UniValue entries = mempoolToJSON(fVerbose, fSequence ? &nSequence : NULL);
+    if (!fSequence)
+        return entries;
 
-    return mempoolToJSON(fVerbose);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair(fVerbose ? "entries" : "txids", entries));
+    ret.push_back(Pair("mempool_sequence", nSequence));
+    return ret;
+}
+
+UniValue getmempoolchanges(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getmempoolchanges sequence\n"
+            "\nReturns the transactions that entered or left the memory pool since the given pool sequence,\n"
+            "for a copy of the pool read with getrawmempool with mempool_sequence to be kept up to date.\n"
+            "\nArguments:\n"
+            "1. sequence    (numeric, required) The pool sequence the copy is at\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"added\" : [\"txid\",...],     (json array) Transactions in the pool now that entered it since sequence\n"
+            "  \"removed\" : [\"txid\",...],   (json array) Transactions that left the pool since sequence\n"
+            "  \"mempool_sequence\" : n        (numeric) The sequence the changes bring the copy to\n"
+            "}\n"
+            "\nAn error is returned when the changes since sequence are no longer kept, the pool is then read again.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolchanges", "1000")
+            + HelpExampleRpc("getmempoolchanges", "1000")
+        );
+
+    int64_t nSince = request.params[0].get_int64();
+    if (nSince < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence");
+
+    std::vector<CTxMemPoolChange> vChanges;
+    uint64_t nSequence;
+    if (!mempool.GetChangesSince(nSince, vChanges, nSequence))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("The changes since sequence %d are not kept, the pool is at %d", nSince, nSequence));
+
+    // Only the last change of a transaction counts
+    std::map<uint256, bool> mapLast;
+    BOOST_FOREACH(const CTxMemPoolChange& change, vChanges)
+        mapLast[change.txid] = change.fAdded;
+
+    UniValue added(UniValue::VARR);
+    UniValue removed(UniValue::VARR);
+    for (const auto& item : mapLast) {
+        if (item.second)
+            added.push_back(item.first.ToString());
+        else
+            removed.push_back(item.first.ToString());
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    ret.push_back(Pair("mempool_sequence", nSequence));
+    return ret;
 }
 
 UniValue getmempoolancestors(const JSONRPCRequest& request)
@@ -624,13 +743,13 @@ UniValue getblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
 
     int nHeight = request.params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > tip->nHeight)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = tip->pindexTip->GetAncestor(nHeight);
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -646,12 +765,42 @@ bool getAddressFromIndex(const int &type, const uint160 &hash, std::string &addr
     return true;
 }
 
+/** Wait for the address index to include the chain tip, it is built in the background */
+static void WaitForAddressIndex()
+{
+    if (paddressindexer && !paddressindexer->BlockUntilSyncedToCurrentChain())
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still syncing with the block chain");
+}
+
+/** Largest page of getaddresstxids in the object form */
+static const int MAX_ADDRESS_TXIDS_PAGE = 10000;
+
+static UniValue AddressTxidToJSON(const CAddressIndexKey& key)
+{
+    UniValue entry(UniValue::VOBJ);
+    entry.push_back(Pair("txid", key.txhash.GetHex()));
+    entry.push_back(Pair("height", key.blockHeight));
+    entry.push_back(Pair("time", (uint64_t)chainActive[key.blockHeight]->nTime));
+    return entry;
+}
+
+static std::pair<uint160, int> ParseIndexAddress(const std::string& strAddress)
+{
+    CBitcoinAddress address(strAddress);
+    std::pair<uint160, int> key;
+    if (!address.GetIndexKey(key.first, key.second)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    return key;
+}
+
 UniValue getaddresstxids(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1)
         throw runtime_error(
             "getaddresstxids address maxnumber startheight endheight\n"
-            "\nReturns transactions on the address.\n"
+            "getaddresstxids {\"addresses\": [address, ...], \"start\": n, \"end\": n, \"limit\": n, \"cursor\": \"cursor\"}\n"
+            "\nReturns transactions on the address, newest first.\n"
             "\nArguments:\n"
             "1. address           (string, required) The address\n"
             "2. maxnumber         (number, optional) The max number of transactions hash\n"
@@ -665,49 +814,177 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
                     "\"time\"     (number) The transaction time\n"
                 "}\n"
             "]\n"
+            "\nWith an object as the only argument, the transactions of several addresses are\n"
+            "returned one page at a time:\n"
+            "  \"addresses\"    (array, required) The addresses\n"
+            "  \"start\"        (number, optional) The first height to include\n"
+            "  \"end\"          (number, optional) The height to stop before\n"
+            "  \"limit\"        (number, optional, default=100) Page size, at most " + std::to_string(MAX_ADDRESS_TXIDS_PAGE) + "\n"
+            "  \"cursor\"       (string, optional) The cursor of the previous page, to continue after it\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txids\": [...],  (array) Transactions as above\n"
+            "  \"cursor\": \"...\"  (string) Present if there are older transactions, pass it to get the next page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
             + HelpExampleCli("getaddresstxids", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\" 200 10000 100000")
             + HelpExampleRpc("getaddresstxids", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
             + HelpExampleRpc("getaddresstxids", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\", 200, 10000, 1000000")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\", \"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"], \"limit\": 50}")
         );
 
-    if((request.params.size() == 1
+    bool fObject = request.params[0].isObject();
+    if (fObject) {
+        if (request.params.size() != 1)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter");
+    } else if((request.params.size() == 1
         || request.params.size() == 2
         || request.params.size() == 4) == false) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid parameter");
     }
 
+    std::vector<std::pair<uint160, int> > vAddress;
     int maxCount = 100;
-    if(request.params.size() >= 2) {
-        maxCount = atoi(request.params[1].get_str().c_str());
-        if(maxCount <= 0) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid maxnumber");
-        }
-    }
-
     int64_t startBlockNum = -1;
     int64_t endBlockNum = -1;
-    if(request.params.size() == 4) {
-        startBlockNum = atoi(request.params[2].get_str().c_str());
-        endBlockNum = atoi(request.params[3].get_str().c_str());
-        if(startBlockNum <= 0) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid startBlockNum");
+    // Position of the last transaction of the previous page
+    int cursorHeight = -1;
+    int cursorTxIndex = 0;
+    if (fObject) {
+        const UniValue& options = request.params[0];
+        RPCTypeCheckObj(options,
+            {
+                {"addresses", UniValueType(UniValue::VARR)},
+                {"start", UniValueType(UniValue::VNUM)},
+                {"end", UniValueType(UniValue::VNUM)},
+                {"limit", UniValueType(UniValue::VNUM)},
+                {"cursor", UniValueType(UniValue::VSTR)},
+            }, true, true);
+        const UniValue& addresses = find_value(options, "addresses");
+        if (addresses.isNull() || addresses.empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "No addresses given");
+        for (size_t i = 0; i < addresses.size(); i++) {
+            vAddress.push_back(ParseIndexAddress(addresses[i].get_str()));
+        }
+        if (!find_value(options, "limit").isNull()) {
+            maxCount = find_value(options, "limit").get_int();
+            if (maxCount <= 0 || maxCount > MAX_ADDRESS_TXIDS_PAGE)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid limit");
         }
-        if(endBlockNum <= 0) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid endBlockNum");
+        if (!find_value(options, "start").isNull()) {
+            startBlockNum = find_value(options, "start").get_int();
+            if (startBlockNum < 0)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start");
         }
-        if(endBlockNum < startBlockNum) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid endBlockNum, endBlockNum < startBlockNUm");
+        if (!find_value(options, "end").isNull()) {
+            endBlockNum = find_value(options, "end").get_int();
+            if (endBlockNum <= 0 || endBlockNum < startBlockNum)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid end");
+        }
+        if (!find_value(options, "cursor").isNull()) {
+            std::string strCursor = find_value(options, "cursor").get_str();
+            size_t nSep = strCursor.find(':');
+            if (nSep == std::string::npos || !ParseInt32(strCursor.substr(0, nSep), &cursorHeight) ||
+                !ParseInt32(strCursor.substr(nSep + 1), &cursorTxIndex) || cursorHeight < 0 || cursorTxIndex < 0)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+    } else {
+        if(request.params.size() >= 2) {
+            maxCount = atoi(request.params[1].get_str().c_str());
+            if(maxCount <= 0) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid maxnumber");
+            }
+        }
+
+        if(request.params.size() == 4) {
+            startBlockNum = atoi(request.params[2].get_str().c_str());
+            endBlockNum = atoi(request.params[3].get_str().c_str());
+            if(startBlockNum <= 0) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid startBlockNum");
+            }
+            if(endBlockNum <= 0) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid endBlockNum");
+            }
+            if(endBlockNum < startBlockNum) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid endBlockNum, endBlockNum < startBlockNUm");
+            }
         }
     }
 
-    LOCK(cs_main);
+    if (!fAddressIndex) {
+        if (fObject)
+            throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+        return UniValue(UniValue::VARR);
+    }
+    if (!fObject)
+        vAddress.push_back(ParseIndexAddress(request.params[0].get_str()));
+
+    WaitForAddressIndex();
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    if(fAddressIndex) {
     LOCK(cs_main);
 
+    // Read backwards from the end height, the cursor or the chain tip,
+    // whichever comes first, so a page costs no more than its size.
+    int endHeight = chainActive.Height() + 1;
+    unsigned int endTxIndex = 0;
+    if (endBlockNum > 0 && endBlockNum < endHeight)
+        endHeight = endBlockNum;
+    if (cursorHeight >= 0 && std::make_pair(cursorHeight, (unsigned int)cursorTxIndex) < std::make_pair(endHeight, endTxIndex)) {
+        endHeight = cursorHeight;
+        endTxIndex = cursorTxIndex;
+    }
+
+    std::vector<CAddressIndexKey> vTxid;
+    bool fMore = false;
+    if (!paddressindex->ReadAddressTxids(vAddress, std::max<int64_t>(startBlockNum, 0), endHeight, endTxIndex, maxCount, vTxid, fMore)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    if (!fObject) {
+        CRPCArrayResult result(request);
+        for (const CAddressIndexKey& key : vTxid) {
+            result.push_back(AddressTxidToJSON(key));
+        }
+        return result.get();
+    }
+
+    UniValue txids(UniValue::VARR);
+    for (const CAddressIndexKey& key : vTxid) {
+        txids.push_back(AddressTxidToJSON(key));
+    }
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    if (fMore)
+        result.push_back(Pair("cursor", strprintf("%d:%u", vTxid.back().blockHeight, vTxid.back().txindex)));
+    return result;
+}
+
+UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos address\n"
+            "\nReturns the unspent outputs of the address, requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. address           (string, required) The address\n"
+            "\nResult:\n"
+            "[\n"
+                "{\n"
+                    "\"txid\"       (string) The transaction hash\n"
+                    "\"vout\"       (number) The output index\n"
+                    "\"satoshis\"   (number) The amount of the output\n"
+                    "\"height\"     (number) The height of the block with the transaction\n"
+                "}\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
+            + HelpExampleRpc("getaddressutxos", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
+        );
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+
     CBitcoinAddress address(request.params[0].get_str());
     uint160 hashBytes;
     int type = 0;
@@ -715,52 +992,66 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    if (!pblocktree->ReadAddressIndex(hashBytes, type, addressIndex, startBlockNum, endBlockNum)) {
+    WaitForAddressIndex();
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    if (!paddressindex->ReadAddressUnspentIndex(hashBytes, type, unspentOutputs)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
     }
+
+    UniValue result(UniValue::VARR);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = unspentOutputs.begin(); it != unspentOutputs.end(); it++) {
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("vout", (int)it->first.index));
+        output.push_back(Pair("satoshis", it->second.satoshis));
+        output.push_back(Pair("height", it->second.blockHeight));
+        result.push_back(output);
     }
 
-    std::multimap<uint64_t, int> map_result;
-    std::set<std::string> set_hxs;
+    return result;
+}
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if(set_hxs.find(it->first.txhash.GetHex()) != set_hxs.end()) {
-            continue;
-        }
-        set_hxs.insert(it->first.txhash.GetHex());
+UniValue getaddresssummary(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getaddresssummary address\n"
+            "\nReturns the balance of the address and the total it received, requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. address           (string, required) The address\n"
+            "\nResult:\n"
+            "{\n"
+                "\"balance\"    (number) The current balance in satoshis\n"
+                "\"received\"   (number) The total amount received in satoshis\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresssummary", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
+            + HelpExampleRpc("getaddresssummary", "\"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"")
+        );
 
-        if(map_result.size() >= (size_t)maxCount) {
-            if((uint64_t)it->first.blockHeight <= map_result.begin()->first) {
-                continue;
-            }
-            map_result.erase(map_result.begin());
-        }
-        map_result.insert(std::make_pair(it->first.blockHeight, it - addressIndex.begin()));
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+
+    CBitcoinAddress address(request.params[0].get_str());
+    uint160 hashBytes;
+    int type = 0;
+    if (!address.GetIndexKey(hashBytes, type)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    int64_t height = chainActive.Height();
-    UniValue result(UniValue::VARR);
-    for(auto i = map_result.rbegin(); i != map_result.rend(); ++i) {
-        auto it = &addressIndex[i->second];
-        if(it->first.blockHeight > height) {
-            continue;
-        }
+    WaitForAddressIndex();
 
-        std::string address;
-        if (!getAddressFromIndex(it->first.type, it->first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
+    LOCK(cs_main);
 
-        UniValue delta(UniValue::VOBJ);
-        //delta.push_back(Pair("satoshis", it->second));
-        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
-        //delta.push_back(Pair("index", (int)it->first.index));
-        delta.push_back(Pair("height", it->first.blockHeight));
-        //delta.push_back(Pair("address", address));
-        delta.push_back(Pair("time", (uint64_t)chainActive[it->first.blockHeight]->nTime));
-        result.push_back(delta);
-    }
+    CAddressBalance balance;
+    paddressindex->ReadAddressBalance(hashBytes, type, balance);
 
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", balance.nBalance));
+    result.push_back(Pair("received", balance.nReceived));
     return result;
 }
 
@@ -827,13 +1118,15 @@ UniValue getblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
         throw runtime_error(
-            "getblock \"blockhash\" ( verbose )\n"
-            "\nIf verbose is false, returns a string that is serialized, hex-encoded data for block 'hash'.\n"
-            "If verbose is true, returns an Object with information about block <hash>.\n"
+            "getblock \"blockhash\" ( verbosity )\n"
+            "\nIf verbosity is 0 or false, returns a string that is serialized, hex-encoded data for block 'hash'.\n"
+            "If verbosity is 1 or true, returns an Object with information about block <hash>.\n"
+            "If verbosity is 2, returns an Object with information about block <hash> and each of its transactions,\n"
+            "the inputs with the outputs they spend and the transactions with their fee, read from the undo data of the block.\n"
             "\nArguments:\n"
             "1. \"blockhash\"          (string, required) The block hash\n"
-            "2. verbose                (boolean, optional, default=true) true for a json object, false for the hex encoded data\n"
-            "\nResult (for verbose = true):\n"
+            "2. verbosity              (numeric or boolean, optional, default=1) 0 for hex encoded data, 1 for a json object, 2 for a json object with the transactions\n"
+            "\nResult (for verbosity = 1):\n"
             "{\n"
             "  \"hash\" : \"hash\",     (string) the block hash (same as provided)\n"
             "  \"confirmations\" : n,   (numeric) The number of confirmations, or -1 if the block is not on the main chain\n"
@@ -857,10 +1150,31 @@ UniValue getblock(const JSONRPCRequest& request)
             "  \"previousblockhash\" : \"hash\",  (string) The hash of the previous block\n"
             "  \"nextblockhash\" : \"hash\"       (string) The hash of the next block\n"
             "}\n"
-            "\nResult (for verbose=false):\n"
+            "\nResult (for verbosity = 2):\n"
+            "{\n"
+            "  ...,                     Same output as verbosity = 1, with\n"
+            "  \"tx\" : [               (array of Objects) The transactions in the format of getrawtransaction, with\n"
+            "     {\n"
+            "       \"fee\" : x.xxx,      (numeric) The fee in " + CURRENCY_UNIT + ", except for the coinbase\n"
+            "       \"vin\" : [\n"
+            "         {\n"
+            "           \"prevout\" : {   (json object) The output spent, when the block has undo data\n"
+            "             \"generated\" : true|false, (boolean) Whether it is a coinbase output\n"
+            "             \"height\" : n, (numeric) The height of the block that created it\n"
+            "             \"value\" : x.xxx, (numeric) The value in " + CURRENCY_UNIT + "\n"
+            "             \"scriptPubKey\" : {...} (json object) The output script, as in vout\n"
+            "           }\n"
+            "         },...\n"
+            "       ]\n"
+            "     },...\n"
+            "  ],\n"
+            "  ...\n"
+            "}\n"
+            "\nResult (for verbosity = 0):\n"
             "\"data\"             (string) A string that is serialized, hex-encoded data for block 'hash'.\n"
             "\nExamples:\n"
             + HelpExampleCli("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleCli("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" 2")
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
@@ -869,9 +1183,10 @@ UniValue getblock(const JSONRPCRequest& request)
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
 
-    bool fVerbose = true;
+    int nVerbosity = 1;
     if (request.params.size() > 1)
-        fVerbose = request.params[1].get_bool();
+        nVerbosity = request.params[1].isNum() ? request.params[1].get_int() : (request.params[1].get_bool() ? 1 : 0);
+    bool fVerbose = nVerbosity > 0;
 
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
@@ -882,6 +1197,14 @@ UniValue getblock(const JSONRPCRequest& request)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
+    if (!fVerbose)
+    {
+        // A recent block can go out as it was serialized when connected
+        std::shared_ptr<const std::vector<unsigned char> > pblockData = rawBlockCache.Get(hash, !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS));
+        if (pblockData)
+            return HexStr(pblockData->begin(), pblockData->end());
+    }
+
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
@@ -898,7 +1221,15 @@ UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex);
+    if (nVerbosity < 2)
+        return blockToJSON(block, pblockindex);
+
+    // All the outputs the block spends in one read, for blocks that were connected once
+    CBlockUndo blockundo;
+    bool fUndo = pblockindex->pprev && (pblockindex->nStatus & BLOCK_HAVE_UNDO) &&
+                 UndoReadFromDisk(blockundo, pblockindex->GetUndoPos(), pblockindex->pprev->GetBlockHash()) &&
+                 blockundo.vtxundo.size() + 1 == block.vtx.size();
+    return blockToJSON(block, pblockindex, true, fUndo ? &blockundo : NULL);
 }
 
 struct CCoinsStats
@@ -907,13 +1238,31 @@ struct CCoinsStats
     uint256 hashBlock;
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
-    uint64_t nSerializedSize;
+    uint64_t nBogoSize;
     uint256 hashSerialized;
     CAmount nTotalAmount;
 
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
 };
 
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << *(const CScriptBase*)(&output.second.out.scriptPubKey);
+        ss << VARINT(output.second.out.nValue);
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+    }
+    ss << VARINT(0);
+}
+
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
@@ -926,32 +1275,28 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -1004,30 +1349,111 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+UniValue dumpstatesnapshot(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "dumpstatesnapshot \"filename\"\n"
+            "\nWrite the chain state, the vote state and the irreversible blocks of the tip to a file, with the\n"
+            "block index of the active chain and the last blocks. A node with an empty data directory starts from\n"
+            "it with -loadsnapshot. The node processes no blocks while the file is written.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The file to write, relative to the data directory if not absolute. It must not exist\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,          (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",  (string) The hash of the snapshot block\n"
+            "  \"blocks\": n,          (numeric) The number of blocks written with their data\n"
+            "  \"coins\": n,           (numeric) The number of unspent transaction outputs\n"
+            "  \"balances\": n,        (numeric) The number of address balances\n"
+            "  \"bytes\": n,           (numeric) The size of the file\n"
+            "  \"hash\": \"hex\",       (string) The hash of the snapshot, for -loadsnapshothash\n"
+            "  \"votestatehash\": \"hex\", (string) The vote state commitment of the snapshot block, see getvotestateinfo\n"
+            "  \"path\": \"path\"       (string) The file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpstatesnapshot", "\"snapshot.dat\"")
+            + HelpExampleRpc("dumpstatesnapshot", "\"snapshot.dat\""));
+
+    boost::filesystem::path path = boost::filesystem::absolute(request.params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    // Written under another name first, so a file of that name is always a whole snapshot
+    boost::filesystem::path pathTemp = path.string() + ".incomplete";
+    CStateSnapshotStats stats;
+    std::string strError;
+    if (!DumpStateSnapshot(pathTemp, stats, strError)) {
+        boost::filesystem::remove(pathTemp);
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+    if (!RenameOver(pathTemp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot rename " + pathTemp.string());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("blocks", stats.nBlocks));
+    ret.push_back(Pair("coins", stats.nCoins));
+    ret.push_back(Pair("balances", stats.nBalances));
+    ret.push_back(Pair("bytes", stats.nFileSize));
+    ret.push_back(Pair("hash", stats.hashSnapshot.GetHex()));
+    ret.push_back(Pair("votestatehash", stats.hashVoteState.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The \"hash_serialized_2\" statistics take a scan of the whole set, which may take some time. The \"muhash\"\n"
+            "ones are kept up to date block by block and come at once, without the number of transactions.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=\"hash_serialized_2\") \"hash_serialized_2\" or \"muhash\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
-            "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs, with \"hash_serialized_2\" only\n"
+            "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
+            "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash3072 of the set, with \"muhash\"\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash, with \"hash_serialized_2\"\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    std::string strHashType = request.params.size() > 0 ? request.params[0].get_str() : "hash_serialized_2";
+    if (strHashType != "muhash" && strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+
     UniValue ret(UniValue::VOBJ);
 
+    if (strHashType == "muhash") {
+        CUTXOStats stats;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            if (!GetTipUTXOStats(stats))
+                throw JSONRPCError(RPC_MISC_ERROR, "The UTXO set statistics are not loaded, use hash_serialized_2");
+            nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("muhash", stats.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsTip, stats)) {
@@ -1035,8 +1461,8 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
@@ -1044,6 +1470,39 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getvotestateinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getvotestateinfo\n"
+            "\nReturns the commitment to the vote state at the tip: the balances, delegates, votes, bills and committees.\n"
+            "Nodes agree on it exactly when they agree on the vote state, and a state snapshot carries it for its block.\n"
+            "The balance hash is kept up to date block by block, the rest of the state is hashed as it is serialized.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,           (numeric) The current block height\n"
+            "  \"bestblock\": \"hex\",   (string) The best block hash\n"
+            "  \"balancehash\": \"hex\", (string) The MuHash3072 of the address balances\n"
+            "  \"hash\": \"hex\"         (string) The commitment to the whole vote state\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvotestateinfo", "")
+            + HelpExampleRpc("getvotestateinfo", "")
+        );
+
+    // The vote state moves with the tip under cs_main
+    LOCK(cs_main);
+    uint256 hashBalances;
+    uint256 hash = Vote::GetInstance().GetStateHash(hashBalances);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", chainActive.Height()));
+    ret.push_back(Pair("bestblock", chainActive.Tip()->GetBlockHash().GetHex()));
+    ret.push_back(Pair("balancehash", hashBalances.GetHex()));
+    ret.push_back(Pair("hash", hash.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1069,7 +1528,6 @@ UniValue gettxout(const JSONRPCRequest& request)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -1093,33 +1551,33 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
-    CCoins coins;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) { // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+        }
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin)) {
             return NullUniValue;
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.push_back(Pair("confirmations", 0));
-    else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+    } else {
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    }
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1230,6 +1688,11 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"dposrepair\": {           (object) only while the DPoS state is repaired or rebuilt at startup\n"
+            "     \"blocks\": xxxxxx,        (numeric) the blocks applied so far\n"
+            "     \"total\": xxxxxx,         (numeric) the blocks to apply\n"
+            "     \"progress\": xxxx         (numeric) estimate of the repair progress [0..1]\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1288,6 +1751,16 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
 
         obj.push_back(Pair("pruneheight",        block->nHeight));
     }
+
+    if (fDPoSRepairing)
+    {
+        int nDone = nDPoSRepairDone, nTotal = nDPoSRepairTotal;
+        UniValue repair(UniValue::VOBJ);
+        repair.push_back(Pair("blocks",          nDone));
+        repair.push_back(Pair("total",           nTotal));
+        repair.push_back(Pair("progress",        nTotal > 0 ? (double)nDone / nTotal : 0.0));
+        obj.push_back(Pair("dposrepair",         repair));
+    }
     return obj;
 }
 
@@ -1341,31 +1814,8 @@ UniValue getchaintips(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
-    /*
-     * Idea:  the set of chain tips is chainActive.tip, plus orphan blocks which do not have another orphan building off of them. 
-     * Algorithm:
-     *  - Make one pass through mapBlockIndex, picking out the orphan blocks, and also storing a set of the orphan block's pprev pointers.
-     *  - Iterate through the orphan blocks. If the block isn't pointed to by another orphan, it is a chain tip.
-     *  - add chainActive.Tip()
-     */
-    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    std::set<const CBlockIndex*> setOrphans;
-    std::set<const CBlockIndex*> setPrevs;
-
-    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        if (!chainActive.Contains(item.second)) {
-            setOrphans.insert(item.second);
-            setPrevs.insert(item.second->pprev);
-        }
-    }
-
-    for (std::set<const CBlockIndex*>::iterator it = setOrphans.begin(); it != setOrphans.end(); ++it)
-    {
-        if (setPrevs.erase(*it) == 0) {
-            setTips.insert(*it);
-        }
-    }
+    // The blocks without a child, whose set is kept as blocks are added
+    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips(setBlockIndexLeaves.begin(), setBlockIndexLeaves.end());
 
     // Always report the currently active tip.
     setTips.insert(chainActive.Tip());
@@ -1415,7 +1865,7 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
-    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    size_t maxmempool = GetMempoolSizeLimit();
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
@@ -1433,7 +1883,7 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"size\": xxxxx,               (numeric) Current tx count\n"
             "  \"bytes\": xxxxx,              (numeric) Sum of all virtual transaction sizes as defined in BIP 141. Differs from actual serialized size because witness data is discounted\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
-            "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool, lowered while -maxmemory takes a share of -maxmempool\n"
             "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
             "}\n"
             "\nExamples:\n"
@@ -1563,9 +2013,11 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
-    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
+    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbosity"} },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getaddresstxids",        &getaddresstxids,        true,  {"address"} },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        true,  {"address"} },
+    { "blockchain",         "getaddresssummary",      &getaddresssummary,      true,  {"address"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
@@ -1573,9 +2025,12 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose","mempool_sequence"} },
+    { "blockchain",         "getmempoolchanges",      &getmempoolchanges,      true,  {"sequence"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"hash_type"} },
+    { "blockchain",         "dumpstatesnapshot",      &dumpstatesnapshot,      true,  {"filename"} },
+    { "blockchain",         "getvotestateinfo",       &getvotestateinfo,       true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
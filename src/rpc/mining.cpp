@@ -15,6 +15,7 @@
 #include "validation.h"
 #include "miner.h"
 #include "net.h"
+#include "net_processing.h"
 #include "pow.h"
 #include "rpc/server.h"
 #include "txmempool.h"
@@ -329,56 +330,195 @@ std::string gbt_vb_name(const Consensus::DeploymentPos pos) {
 
 CCriticalSection cs_mining;
 bool fIsDelegating = false;
-CBitcoinAddress delegateaddress;
-CKey delegatekey;
+//! The keys of the delegates forged for, guarded by cs_mining
+static std::map<CKeyID, CKey> mapDelegateKeys;
 
-void* ThreadDelegating(void *arg)
+/** How long before its slot a block is assembled, in milliseconds */
+static const int64_t DELEGATING_PREPARE_MS = 500;
+
+/** Number of recent slots of our delegates kept for getforgingstats */
+static const size_t MAX_FORGING_SLOT_STATS = 100;
+
+static CCriticalSection cs_forgingStats;
+//! The most recent slots first
+static std::deque<CForgingSlotStats> dequeForgingSlots;
+
+static void RecordForgingSlot(const CForgingSlotStats& slot)
 {
-    DPoS& dPos = DPoS::GetInstance();
+    {
+        LOCK(cs_forgingStats);
+        dequeForgingSlots.push_front(slot);
+        if(dequeForgingSlots.size() > MAX_FORGING_SLOT_STATS) {
+            dequeForgingSlots.pop_back();
+        }
+    }
+    GetMainSignals().ForgingSlot(slot);
+}
+
+/** Sleep until nTimeMillis, returning false if forging stopped meanwhile */
+static bool DelegatingSleepUntil(int64_t nTimeMillis)
+{
+    while(!ShutdownRequested() && fIsDelegating) {
+        int64_t nWait = nTimeMillis - GetTimeMillis();
+        if(nWait <= 0) {
+            return true;
+        }
+        MilliSleep(std::min<int64_t>(nWait, 100));
+    }
+
+    return false;
+}
+
+/**
+ * Whether a block of the slot starting at t on top of hashPrevBlock was connected
+ * or its header received, as another node forging for the same delegate would
+ * send it. Requires cs_main
+ */
+static bool IsSlotBlockKnown(const uint256& hashPrevBlock, int64_t t)
+{
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if(pindexTip->GetBlockHash() != hashPrevBlock && pindexTip->GetBlockTime() >= t) {
+        return true;
+    }
+    return pindexBestHeader && pindexBestHeader->pprev && pindexBestHeader->pprev->GetBlockHash() == hashPrevBlock
+        && pindexBestHeader->GetBlockTime() >= t;
+}
 
-    CPubKey pubkey = delegatekey.GetPubKey();
-    vector<unsigned char> dd;
-    CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+/** The slot signature of one of our delegates, made before its slot */
+struct CPresignedSlot
+{
+    int64_t nTime;
+    CKeyID keyid;
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
 
-    std::vector<unsigned char> vctPublicKey;
-    opcodetype op;
-    CScript::const_iterator it = scriptPubKey.begin();
-    scriptPubKey.GetOp2(it, op, &vctPublicKey);
-    CPubKey pubkey2;
-       pubkey2.Set(vctPublicKey.begin(), vctPublicKey.end());    
-    auto addr2 = CBitcoinAddress(pubkey2.GetID()).ToString();
+    CPresignedSlot() : nTime(0) {}
+};
 
-    CKeyID keyID = pubkey.GetID();
-    auto addr = CBitcoinAddress(keyID).ToString();
+/**
+ * Sign the slot starting at t ahead if it is one of our delegates' as of the
+ * current tip, so that at the slot the coinbase costs no signing under cs_main
+ */
+static void PresignSlot(DPoS& dPos, int64_t t, CPresignedSlot& presigned)
+{
+    CKeyID keyid;
+    CKey key;
+    {
+        LOCK(cs_main);
+        DelegateInfo cDelegateInfo;
+        if(dPos.GetSlotDelegate(cDelegateInfo, keyid, t) == false) {
+            return;
+        }
+        LOCK(cs_mining);
+        std::map<CKeyID, CKey>::const_iterator it = mapDelegateKeys.find(keyid);
+        if(it == mapDelegateKeys.end()) {
+            return;
+        }
+        key = it->second;
+    }
+    presigned.nTime = t;
+    presigned.keyid = keyid;
+    presigned.pubkey = key.GetPubKey();
+    presigned.vchSig = DPoS::SignSlot(key, t);
+}
 
-    while(!ShutdownRequested() && fIsDelegating){
-        do {
+void* ThreadDelegating(void *arg)
+{
+    DPoS& dPos = DPoS::GetInstance();
+    int64_t nStandbyMillis = std::max<int64_t>(0, std::min<int64_t>(GetArg("-forgingstandby", DEFAULT_FORGING_STANDBY), MAX_FORGING_STANDBY));
+
+    // Keep the transactions of our next block up to date meanwhile, so assembling
+    // one only takes the coinbase and the header. All our delegates share it.
+    CBlockCandidate candidate(Params(CBaseChainParams::MAIN));
+    candidate.Start();
+
+    // Wake up once per block slot instead of polling: assemble the block shortly before
+    // the slot opens if it is one of our delegates', and submit it right at the slot start.
+    // In standby the block is only submitted if the node backed up did not send one in time.
+    int64_t t = GetTime();
+    CForgingSlotStats slot;
+    CPresignedSlot presigned;
+    PresignSlot(dPos, t, presigned);
+    while(DelegatingSleepUntil(t * 1000 - DELEGATING_PREPARE_MS)) {
+        std::unique_ptr<CBlockTemplate> pblock;
+        uint256 hashPrevBlock;
+        bool fOurSlot = false;
+        {
             LOCK(cs_main);
-            time_t t = time(NULL);
             DelegateInfo cDelegateInfo;
-
-            if(dPos.IsMining(cDelegateInfo, addr, t) == false){
-                break;
+            CKeyID keyid;
+            CKey key;
+            if(dPos.GetSlotDelegate(cDelegateInfo, keyid, t)) {
+                LOCK(cs_mining);
+                std::map<CKeyID, CKey>::const_iterator it = mapDelegateKeys.find(keyid);
+                if(it != mapDelegateKeys.end()) {
+                    fOurSlot = true;
+                    key = it->second;
+                }
             }
-
-            const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
-        
-            std::unique_ptr<CBlockTemplate> pblock = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey, DPoS::DelegateInfoToScript(cDelegateInfo, delegatekey, t), t);
-            if(pblock) {
-                unsigned int extraNonce = 0; 
-                IncrementExtraNonce(&pblock->block, chainActive.Tip(), extraNonce);
-            
-                std::shared_ptr<CBlock> blockptr = std::make_shared<CBlock>(pblock->block);
-
-                if(ProcessNewBlock(Params(), blockptr, true, NULL) == false) {
-                    LogPrintf("ProcessNewBlock failed");
+            if(fOurSlot) {
+                slot.nSlotTime = t;
+                slot.delegate = keyid;
+                slot.nHeight = chainActive.Height() + 1;
+                int64_t nTimeStart = GetTimeMicros();
+                // Signed ahead unless a block since made the slot another of our delegates'
+                CScript scriptDelegate;
+                if(presigned.nTime == t && presigned.keyid == keyid) {
+                    scriptDelegate = DPoS::DelegateInfoToScript(cDelegateInfo, presigned.pubkey, presigned.vchSig);
+                } else {
+                    scriptDelegate = DPoS::DelegateInfoToScript(cDelegateInfo, key, t);
                 }
+                int64_t nTimeSigned = GetTimeMicros();
+                CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(keyid) << OP_EQUALVERIFY << OP_CHECKSIG;
+                pblock = candidate.CreateNewBlock(scriptPubKey, scriptDelegate, t);
+                slot.nSignTime = nTimeSigned - nTimeStart;
+                slot.nCreateTime = GetTimeMicros() - nTimeSigned;
+                hashPrevBlock = chainActive.Tip()->GetBlockHash();
+            }
+        }
+
+        if(pblock && DelegatingSleepUntil(t * 1000 + nStandbyMillis)) {
+            {
+                LOCK(cs_main);
+                if(nStandbyMillis > 0 && IsSlotBlockKnown(hashPrevBlock, t)) {
+                    // The node we back up forged the slot
+                    slot.nResult = CForgingSlotStats::STANDBY;
+                } else if(chainActive.Tip()->GetBlockHash() != hashPrevBlock) {
+                    // A late block of the previous slot arrived meanwhile, assemble again on top of it
+                    slot.nRetries++;
+                    continue;
+                } else {
+                    unsigned int extraNonce = 0; 
+                    IncrementExtraNonce(&pblock->block, chainActive.Tip(), extraNonce);
+
+                    std::shared_ptr<CBlock> blockptr = std::make_shared<CBlock>(pblock->block);
+                    slot.hashBlock = blockptr->GetHash();
+
+                    int64_t nTimeStart = GetTimeMicros();
+                    if(ProcessNewBlock(Params(), blockptr, true, NULL) == false) {
+                        LogPrintf("ProcessNewBlock failed");
+                        slot.nResult = CForgingSlotStats::FAILED;
+                    } else {
+                        slot.nResult = CForgingSlotStats::FORGED;
+                    }
+                    int64_t nTimeProcessed = GetTimeMicros();
+                    slot.nProcessTime = nTimeProcessed - nTimeStart;
+                    slot.nBroadcastDelay = nTimeProcessed - t * 1000000;
 
-                printf("mining addr:%s height:%u time:%lu starttime:%lu...\n", addr.c_str(), chainActive.Height(), t, DPoS::GetInstance().GetStartTime());
+                    printf("mining addr:%s height:%u time:%lu starttime:%lu...\n", CBitcoinAddress(slot.delegate).ToString().c_str(), chainActive.Height(), t, DPoS::GetInstance().GetStartTime());
+                }
             }
-        } while(0);
-        sleep(1);
+            RecordForgingSlot(slot);
+        } else if(fOurSlot && !pblock) {
+            slot.nResult = CForgingSlotStats::FAILED;
+            RecordForgingSlot(slot);
+        }
+
+        t = std::max(dPos.GetNextSlotTime(t), GetTime());
+        slot = CForgingSlotStats();
+        PresignSlot(dPos, t, presigned);
     }
+    candidate.Stop();
     return NULL;
 }
 
@@ -389,6 +529,7 @@ UniValue startforging(const JSONRPCRequest& request)
             "startforging delegateAddress"
             "\nstart forging on the lbtc address which have been registered as delegate"
             "\nand receivce enough votes and rank in the top 101.\n"
+            "\nCall it once per delegate to forge for several delegates from this node.\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
             "1. \"delegateAddress\"     (string, required) The delegate address.\n"
@@ -399,22 +540,22 @@ UniValue startforging(const JSONRPCRequest& request)
             + HelpExampleRpc("startforging", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
     );
 
-    LOCK(cs_mining);
-    if(fIsDelegating == false) {
-        delegateaddress.SetString(request.params[0].get_str());
-        CKeyID delegate;
-        delegateaddress.GetKeyID(delegate);
-
-        if (!pwalletMain->GetKey(delegate, delegatekey)) {
-            LogPrintf("startforging address:%s get private_key fail", request.params[0].get_str());
-            return "false";
-        }
+    CBitcoinAddress delegateaddress(request.params[0].get_str());
+    CKeyID delegate;
+    CKey delegatekey;
+    if (!delegateaddress.GetKeyID(delegate) || !pwalletMain->GetKey(delegate, delegatekey)) {
+        LogPrintf("startforging address:%s get private_key fail", request.params[0].get_str());
+        return "false";
+    }
 
-        if(!(delegateaddress == DPoS::GetInstance().GetSuperForgerAddress()) && Vote::GetInstance().GetDelegate(delegate).empty()) {
-            LogPrintf("startforging address:%s not registe", request.params[0].get_str());
-            return "false";
-        }
+    if(!(delegateaddress == DPoS::GetInstance().GetSuperForgerAddress()) && Vote::GetInstance().GetView()->GetDelegate(delegate).empty()) {
+        LogPrintf("startforging address:%s not registe", request.params[0].get_str());
+        return "false";
+    }
 
+    LOCK(cs_mining);
+    mapDelegateKeys[delegate] = delegatekey;
+    if(fIsDelegating == false) {
         fIsDelegating = true;
         pthread_t id;
         pthread_create(&id, NULL, ThreadDelegating, NULL);
@@ -427,20 +568,209 @@ UniValue stopforging(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
         throw runtime_error(
-            "stopforging"
-            "\nstop forging.\n"
+            "stopforging ( \"delegateAddress\" )"
+            "\nstop forging, for all delegates or only for the one given.\n"
             + HelpRequiringPassphrase() +
+            "\nArguments:\n"
+            "1. \"delegateAddress\"     (string, optional) The delegate address to stop forging for.\n"
             "\nResult:\n"
             "\"result\"                 (bool) Forging sucess return \"true\", other return \"false\".\n"
             "\nExamples:\n"
             + HelpExampleCli("stopforging", "")
+            + HelpExampleCli("stopforging", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
             + HelpExampleRpc("stopforging", "")
     );
 
-    fIsDelegating = false;
+    LOCK(cs_mining);
+    if (request.params.size() > 0) {
+        CKeyID delegate;
+        if (!CBitcoinAddress(request.params[0].get_str()).GetKeyID(delegate) || mapDelegateKeys.erase(delegate) == 0)
+            return "false";
+    } else {
+        mapDelegateKeys.clear();
+    }
+    if (mapDelegateKeys.empty())
+        fIsDelegating = false;
     return "true";
 }
 
+UniValue getforgingstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw runtime_error(
+            "getforgingstats ( nblocks )\n"
+            "\nReturns the timings of the recent block slots of the delegates forged for with startforging,\n"
+            "and the blocks each delegate forged and the slots it missed in the last nblocks blocks.\n"
+            "Durations are in microseconds.\n"
+            "\nArguments:\n"
+            "1. nblocks     (numeric, optional, default=1000) The number of blocks to count the delegates' slots in, at most 10000\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"forging\": true|false,       (boolean) Whether we are forging\n"
+            "  \"addresses\": [ \"address\", ... ], (json array) The addresses of the delegates forged for\n"
+            "  \"slots\": [                   (json array) The last slots of those delegates, the most recent first\n"
+            "    {\n"
+            "      \"time\": n,                (numeric) Slot start time, in seconds since epoch\n"
+            "      \"address\": \"address\",   (string) The delegate of the slot\n"
+            "      \"height\": n,              (numeric) Height of the block\n"
+            "      \"hash\": \"hash\",           (string) The block hash, if a block was assembled\n"
+            "      \"result\": \"forged|failed|standby\", (string) Whether the block was accepted, standby if the node backed up forged it\n"
+            "      \"orphaned\": true|false,   (boolean) Whether an accepted block is off the active chain now\n"
+            "      \"retries\": n,             (numeric) Times the block was assembled again for a late previous block\n"
+            "      \"signtime\": n,            (numeric) Building the delegate info of the coinbase, signed before the slot unless a late block changed it\n"
+            "      \"createtime\": n,          (numeric) Assembling the block\n"
+            "      \"processtime\": n,         (numeric) ProcessNewBlock\n"
+            "      \"broadcastdelay\": n,      (numeric) From the slot start to the return of ProcessNewBlock\n"
+            "      \"relaydelay\": n           (numeric) From the slot start to the first announcement to a peer, if known\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"blocks\": n,                 (numeric) The number of blocks the delegates' slots were counted in\n"
+            "  \"delegates\": [               (json array)\n"
+            "    {\n"
+            "      \"address\": \"address\",   (string) The delegate address\n"
+            "      \"produced\": n,           (numeric) Blocks it forged on the active chain\n"
+            "      \"missed\": n,             (numeric) Its slots without a block\n"
+            "      \"orphaned\": n            (numeric) Blocks it forged that are not on the active chain\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getforgingstats", "")
+            + HelpExampleCli("getforgingstats", "303")
+            + HelpExampleRpc("getforgingstats", "303")
+    );
+
+    int nBlocks = 1000;
+    if (request.params.size() > 0)
+        nBlocks = request.params[0].get_int();
+    if (nBlocks < 1 || nBlocks > 10000)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "nblocks must be between 1 and 10000");
+
+    std::vector<CForgingSlotStats> vSlots;
+    {
+        LOCK(cs_forgingStats);
+        vSlots.assign(dequeForgingSlots.begin(), dequeForgingSlots.end());
+    }
+    CNetTimeStats netStats;
+    GetNetTimeStats(netStats);
+
+    UniValue result(UniValue::VOBJ);
+    UniValue addresses(UniValue::VARR);
+    {
+        LOCK(cs_mining);
+        result.push_back(Pair("forging", fIsDelegating));
+        for (const std::pair<CKeyID, CKey>& item : mapDelegateKeys)
+            addresses.push_back(CBitcoinAddress(item.first).ToString());
+    }
+    result.push_back(Pair("addresses", addresses));
+
+    LOCK(cs_main);
+    UniValue slots(UniValue::VARR);
+    for (const CForgingSlotStats& slot : vSlots) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("time", slot.nSlotTime));
+        obj.push_back(Pair("address", CBitcoinAddress(slot.delegate).ToString()));
+        obj.push_back(Pair("height", slot.nHeight));
+        if (!slot.hashBlock.IsNull())
+            obj.push_back(Pair("hash", slot.hashBlock.GetHex()));
+        obj.push_back(Pair("result", slot.nResult == CForgingSlotStats::FORGED ? "forged" : slot.nResult == CForgingSlotStats::STANDBY ? "standby" : "failed"));
+        if (slot.nResult == CForgingSlotStats::FORGED) {
+            BlockMap::iterator mi = mapBlockIndex.find(slot.hashBlock);
+            obj.push_back(Pair("orphaned", mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)));
+        }
+        obj.push_back(Pair("retries", slot.nRetries));
+        obj.push_back(Pair("signtime", slot.nSignTime));
+        obj.push_back(Pair("createtime", slot.nCreateTime));
+        obj.push_back(Pair("processtime", slot.nProcessTime));
+        obj.push_back(Pair("broadcastdelay", slot.nBroadcastDelay));
+        for (const CBlockRelayTimes& times : netStats.vBlocks) {
+            if (times.hash == slot.hashBlock && times.nRelayed != 0) {
+                obj.push_back(Pair("relaydelay", times.nRelayed - slot.nSlotTime * 1000000));
+                break;
+            }
+        }
+        slots.push_back(obj);
+    }
+    result.push_back(Pair("slots", slots));
+
+    std::map<CKeyID, CDelegateSlotStats> mapStats;
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip)
+        DPoS::GetInstance().GetDelegateSlotStats(pindexTip, nBlocks, mapStats);
+    UniValue delegates(UniValue::VARR);
+    for (const std::pair<CKeyID, CDelegateSlotStats>& item : mapStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("address", CBitcoinAddress(item.first).ToString()));
+        obj.push_back(Pair("produced", item.second.nProduced));
+        obj.push_back(Pair("missed", item.second.nMissed));
+        obj.push_back(Pair("orphaned", item.second.nOrphaned));
+        delegates.push_back(obj);
+    }
+    result.push_back(Pair("blocks", std::min(nBlocks, pindexTip ? pindexTip->nHeight : 0)));
+    result.push_back(Pair("delegates", delegates));
+    return result;
+}
+
+static UniValue RoundScheduleToJSON(DPoS& dPos, uint64_t nLoopIndex, const DelegateInfo& cDelegateInfo)
+{
+    UniValue round(UniValue::VOBJ);
+    round.push_back(Pair("loop", nLoopIndex));
+    round.push_back(Pair("starttime", dPos.GetSlotTime(nLoopIndex, 0)));
+    UniValue slots(UniValue::VARR);
+    for (size_t i = 0; i < cDelegateInfo.delegates.size(); i++) {
+        const Delegate& delegate = cDelegateInfo.delegates[i];
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("time", dPos.GetSlotTime(nLoopIndex, i)));
+        obj.push_back(Pair("address", CBitcoinAddress(delegate.keyid).ToString()));
+        obj.push_back(Pair("votes", delegate.votes));
+        slots.push_back(obj);
+    }
+    round.push_back(Pair("slots", slots));
+    return round;
+}
+
+UniValue getroundschedule(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw runtime_error(
+            "getroundschedule\n"
+            "\nReturns the delegates of the DPoS round of the tip by slot, and the ones the next round\n"
+            "would have if its first slot got a block on top of the tip.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"current\": {                 (json object) The round of the tip, once DPoS started\n"
+            "    \"loop\": n,                  (numeric) The loop index of the round\n"
+            "    \"starttime\": n,             (numeric) Start of its first slot, in seconds since epoch\n"
+            "    \"slots\": [                  (json array) The slots in order\n"
+            "      {\n"
+            "        \"time\": n,              (numeric) Slot start time, in seconds since epoch\n"
+            "        \"address\": \"address\", (string) The delegate of the slot\n"
+            "        \"votes\": n              (numeric) The votes the delegate had when the round was drawn\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  },\n"
+            "  \"next\": { ... }              (json object) The next round as drawn from the votes of now. More blocks\n"
+            "                                 of this round or a block later than its first slot change it\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getroundschedule", "")
+            + HelpExampleRpc("getroundschedule", "")
+    );
+
+    LOCK(cs_main);
+    DPoS& dPos = DPoS::GetInstance();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    uint64_t nLoopIndex = dPos.GetLoopIndex(pindexTip->nTime);
+
+    UniValue result(UniValue::VOBJ);
+    DelegateInfo cDelegateInfo;
+    if (pindexTip->nHeight >= dPos.GetStartDPoSHeight() && dPos.GetBlockDelegates(cDelegateInfo, pindexTip))
+        result.push_back(Pair("current", RoundScheduleToJSON(dPos, nLoopIndex, cDelegateInfo)));
+    if (dPos.GetStartTime() > 0)
+        result.push_back(Pair("next", RoundScheduleToJSON(dPos, nLoopIndex + 1, dPos.GetNextDelegates(dPos.GetSlotTime(nLoopIndex + 1, 0)))));
+    return result;
+}
+
 UniValue getblocktemplate(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -621,24 +951,40 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
-        // Release the wallet and main lock while waiting
-        LEAVE_CRITICAL_SECTION(cs_main);
+        if (request.fParkable)
         {
-            checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
-
-            boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            // Park instead of waiting here, to run again when the tip
+            // changes or at the next time to check for more transactions
+            int64_t nNow = GetTimeMillis();
+            int64_t nCheckTxTime = (request.nParkedSince ? request.nParkedSince : nNow) + 60 * 1000;
+            if (nCheckTxTime <= nNow)
+                nCheckTxTime += ((nNow - nCheckTxTime) / (10 * 1000) + 1) * 10 * 1000;
+            bool fCheckTx = request.nParkedSince && nNow >= request.nParkedSince + 60 * 1000;
+            if (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning() &&
+                !(fCheckTx && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP))
+                throw RPCParkRequest(nCheckTxTime, "");
+        }
+        else
+        {
+            // Release the wallet and main lock while waiting
+            LEAVE_CRITICAL_SECTION(cs_main);
             {
-                if (!cvBlockChange.timed_wait(lock, checktxtime))
+                checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
+
+                boost::unique_lock<boost::mutex> lock(csBestBlock);
+                while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
                 {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
-                        break;
-                    checktxtime += boost::posix_time::seconds(10);
+                    if (!cvBlockChange.timed_wait(lock, checktxtime))
+                    {
+                        // Timeout: Check transactions for update
+                        if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
+                            break;
+                        checktxtime += boost::posix_time::seconds(10);
+                    }
                 }
             }
+            ENTER_CRITICAL_SECTION(cs_main);
         }
-        ENTER_CRITICAL_SECTION(cs_main);
 
         if (!IsRPCRunning())
             throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
@@ -658,12 +1004,16 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     // Cache whether the last invocation was with segwit support, to avoid returning
     // a segwit-block to a non-segwit caller.
     static bool fLastTemplateSupportsSegwit = true;
+    // The transactions of the template, encoded once for all the calls it is returned to
+    static UniValue transactions(UniValue::VARR);
+    static bool fTransactionsCached = false;
     if (pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = nullptr;
+        fTransactionsCached = false;
 
         // Store the pindexBest used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
@@ -692,42 +1042,45 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
     UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
 
-    UniValue transactions(UniValue::VARR);
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    for (const auto& it : pblock->vtx) {
-        const CTransaction& tx = *it;
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
+    if (!fTransactionsCached) {
+        transactions = UniValue(UniValue::VARR);
+        map<uint256, int64_t> setTxIndex;
+        int i = 0;
+        for (const auto& it : pblock->vtx) {
+            const CTransaction& tx = *it;
+            uint256 txHash = tx.GetHash();
+            setTxIndex[txHash] = i++;
 
-        if (tx.IsCoinBase())
-            continue;
+            if (tx.IsCoinBase())
+                continue;
 
-        UniValue entry(UniValue::VOBJ);
+            UniValue entry(UniValue::VOBJ);
 
-        entry.push_back(Pair("data", EncodeHexTx(tx)));
-        entry.push_back(Pair("txid", txHash.GetHex()));
-        entry.push_back(Pair("hash", tx.GetWitnessHash().GetHex()));
+            entry.push_back(Pair("data", EncodeHexTx(tx)));
+            entry.push_back(Pair("txid", txHash.GetHex()));
+            entry.push_back(Pair("hash", tx.GetWitnessHash().GetHex()));
 
-        UniValue deps(UniValue::VARR);
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.push_back(Pair("depends", deps));
-
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        int64_t nTxSigOps = pblocktemplate->vTxSigOpsCost[index_in_template];
-        if (fPreSegWit) {
-            assert(nTxSigOps % WITNESS_SCALE_FACTOR == 0);
-            nTxSigOps /= WITNESS_SCALE_FACTOR;
-        }
-        entry.push_back(Pair("sigops", nTxSigOps));
-        entry.push_back(Pair("weight", GetTransactionWeight(tx)));
+            UniValue deps(UniValue::VARR);
+            BOOST_FOREACH (const CTxIn &in, tx.vin)
+            {
+                if (setTxIndex.count(in.prevout.hash))
+                    deps.push_back(setTxIndex[in.prevout.hash]);
+            }
+            entry.push_back(Pair("depends", deps));
+
+            int index_in_template = i - 1;
+            entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
+            int64_t nTxSigOps = pblocktemplate->vTxSigOpsCost[index_in_template];
+            if (fPreSegWit) {
+                assert(nTxSigOps % WITNESS_SCALE_FACTOR == 0);
+                nTxSigOps /= WITNESS_SCALE_FACTOR;
+            }
+            entry.push_back(Pair("sigops", nTxSigOps));
+            entry.push_back(Pair("weight", GetTransactionWeight(tx)));
 
-        transactions.push_back(entry);
+            transactions.push_back(entry);
+        }
+        fTransactionsCached = true;
     }
 
     UniValue aux(UniValue::VOBJ);
@@ -1061,6 +1414,8 @@ static const CRPCCommand commands[] =
     { "mining",             "submitblock",            &submitblock,            true,  {"hexdata","parameters"} },
     { "mining",             "startforging",           &startforging,           true,  {"address"} },
     { "mining",             "stopforging",            &stopforging,            true,  {} },
+    { "mining",             "getforgingstats",        &getforgingstats,        true,  {"nblocks"} },
+    { "mining",             "getroundschedule",       &getroundschedule,       true,  {} },
 
     { "generating",         "generate",               &generate,               true,  {"nblocks","maxtries"} },
     { "generating",         "generatetoaddress",      &generatetoaddress,      true,  {"nblocks","address","maxtries"} },
@@ -10,9 +10,14 @@
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "scheduler.h"
+#include "script/sigcache.h"
+#include "support/arena.h"
+#include "threadinfo.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "vote.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
@@ -467,6 +472,77 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCArenaInfo()
+{
+    UniValue obj(UniValue::VOBJ);
+    for (const CMemoryArena* parena : GetMemoryArenas()) {
+        CMemoryArena::Stats stats = parena->GetStats();
+        UniValue arena(UniValue::VOBJ);
+        arena.push_back(Pair("chunks", uint64_t(stats.nChunks)));
+        arena.push_back(Pair("bytes", uint64_t(stats.nBytes)));
+        arena.push_back(Pair("peak", uint64_t(stats.nPeakBytes)));
+        arena.push_back(Pair("hugepages", stats.fHugePages));
+        obj.push_back(Pair(parena->GetName(), arena));
+    }
+    return obj;
+}
+
+static UniValue RPCHeapInfo()
+{
+    CHeapStats stats;
+    UniValue obj(UniValue::VOBJ);
+    bool fStats = GetHeapStats(stats);
+    obj.push_back(Pair("allocator", stats.strAllocator));
+    if (fStats) {
+        obj.push_back(Pair("allocated", uint64_t(stats.nAllocated)));
+        obj.push_back(Pair("resident", uint64_t(stats.nResident)));
+    }
+    return obj;
+}
+
+static UniValue RPCVoteCacheInfo()
+{
+    CBalanceCacheStats stats = Vote::GetInstance().GetCacheStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("usage", uint64_t(stats.nUsage)));
+    obj.push_back(Pair("entries", uint64_t(stats.nEntries)));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    return obj;
+}
+
+static UniValue RPCSignatureCacheInfo()
+{
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("usage", uint64_t(stats.nUsage)));
+    obj.push_back(Pair("capacity", uint64_t(stats.nElements)));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserts", stats.nInserts));
+    obj.push_back(Pair("evictions", stats.nEvictions));
+    return obj;
+}
+
+static UniValue RPCMemoryUsageInfo()
+{
+    CMemoryUsageStats stats = GetMemoryUsageStats();
+    size_t nNetBuffers = g_connman ? g_connman->GetBufferedBytes() : 0;
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("coinscache", uint64_t(stats.nCoinsCache)));
+    obj.push_back(Pair("votecache", uint64_t(stats.nVoteCache)));
+    obj.push_back(Pair("mempool", uint64_t(stats.nMempool)));
+    obj.push_back(Pair("blockindex", uint64_t(stats.nBlockIndex)));
+    obj.push_back(Pair("sigcache", uint64_t(stats.nSigCache)));
+    obj.push_back(Pair("rawblockcache", uint64_t(stats.nRawBlockCache)));
+    obj.push_back(Pair("netbuffers", uint64_t(nNetBuffers)));
+    obj.push_back(Pair("total", uint64_t(stats.GetTotal() + nNetBuffers)));
+    obj.push_back(Pair("maxmemory", uint64_t(nMaxMemoryUsage)));
+    obj.push_back(Pair("coinslimit", uint64_t(stats.nCoinsLimit)));
+    obj.push_back(Pair("mempoollimit", uint64_t(stats.nMempoolLimit)));
+    return obj;
+}
+
 UniValue getmemoryinfo(const JSONRPCRequest& request)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -485,6 +561,46 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"arenas\": {               (json object) Memory the coinscache, mempool and blockindex take for their own nodes\n"
+            "    \"name\": {               (json object) One of them\n"
+            "      \"chunks\": xxxxx,      (numeric) Number of chunks held\n"
+            "      \"bytes\": xxxxx,       (numeric) Bytes of the chunks held, free nodes included\n"
+            "      \"peak\": xxxxx,        (numeric) Most bytes held at once\n"
+            "      \"hugepages\": true|false, (boolean) Whether large chunks are asked for as huge pages, see -hugepages\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"heap\": {                 (json object) What the heap allocator reports\n"
+            "    \"allocator\": \"name\",    (string) glibc, jemalloc or system\n"
+            "    \"allocated\": xxxxx,     (numeric) Bytes handed out, the arenas included, if the allocator tells\n"
+            "    \"resident\": xxxxx,      (numeric) Bytes the allocator holds, handed out or freed but kept, if the allocator tells\n"
+            "  },\n"
+            "  \"votecache\": {            (json object) Information about the DPoS address balance cache\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes used\n"
+            "    \"entries\": xxxxx,       (numeric) Number of cached address balances\n"
+            "    \"hits\": xxxxx,          (numeric) Balance lookups served from the cache\n"
+            "    \"misses\": xxxxx,        (numeric) Balance lookups that read the vote database\n"
+            "  },\n"
+            "  \"usage\": {                (json object) Memory of the large structures of the node, in bytes, and the bounds -maxmemory sets\n"
+            "    \"coinscache\": xxxxx,    (numeric) UTXO cache\n"
+            "    \"votecache\": xxxxx,     (numeric) DPoS address balance cache\n"
+            "    \"mempool\": xxxxx,       (numeric) Memory pool\n"
+            "    \"blockindex\": xxxxx,    (numeric) Block index\n"
+            "    \"sigcache\": xxxxx,      (numeric) Valid signature cache\n"
+            "    \"rawblockcache\": xxxxx, (numeric) Serialized blocks kept for relay\n"
+            "    \"netbuffers\": xxxxx,    (numeric) Messages queued to and from peers\n"
+            "    \"total\": xxxxx,         (numeric) Sum of the above\n"
+            "    \"maxmemory\": xxxxx,     (numeric) The -maxmemory bound, 0 for none\n"
+            "    \"coinslimit\": xxxxx,    (numeric) What the UTXO and vote caches are flushed above\n"
+            "    \"mempoollimit\": xxxxx,  (numeric) What the memory pool is trimmed to\n"
+            "  },\n"
+            "  \"sigcache\": {             (json object) Information about the valid signature cache\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes allocated, set by -maxsigcachesize\n"
+            "    \"capacity\": xxxxx,      (numeric) Number of signatures the cache can hold\n"
+            "    \"hits\": xxxxx,          (numeric) Signature checks answered by the cache\n"
+            "    \"misses\": xxxxx,        (numeric) Signature checks not found in the cache\n"
+            "    \"inserts\": xxxxx,       (numeric) Verified signatures added to the cache\n"
+            "    \"evictions\": xxxxx,     (numeric) Inserts that pushed an entry out of the cache\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -493,6 +609,183 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
         );
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("locked", RPCLockedMemoryInfo()));
+    obj.push_back(Pair("arenas", RPCArenaInfo()));
+    obj.push_back(Pair("heap", RPCHeapInfo()));
+    obj.push_back(Pair("votecache", RPCVoteCacheInfo()));
+    obj.push_back(Pair("usage", RPCMemoryUsageInfo()));
+    obj.push_back(Pair("sigcache", RPCSignatureCacheInfo()));
+    return obj;
+}
+
+static UniValue LockTimeStatsToJSON(const CLockTimeStats& stats)
+{
+    UniValue histogram(UniValue::VARR);
+    int nLast = LOCKSTATS_BUCKETS - 1;
+    while (nLast > 0 && stats.vBuckets[nLast] == 0)
+        nLast--;
+    for (int i = 0; i <= nLast; i++)
+        histogram.push_back(stats.vBuckets[i]);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("total", stats.nTotal));
+    obj.push_back(Pair("max", stats.nMax));
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
+static bool CompareLockSiteWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.wait.nTotal > b.wait.nTotal;
+}
+
+UniValue getlockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( reset )\n"
+            "Returns how long locks were waited for and held, by the place in the source they are taken at,\n"
+            "most waited for first. Every contended acquisition is timed, and one in -lockstatssample of the\n"
+            "others on each thread.\n"
+            "\nArguments:\n"
+            "1. reset      (boolean, optional, default=false) Start counting over afterwards\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"xxx\",          (string) The lock, as written where it is taken\n"
+            "    \"file\": \"xxx\",          (string) The source file\n"
+            "    \"line\": n,              (numeric) The line in it\n"
+            "    \"contended\": n,         (numeric) Timed acquisitions that had to wait\n"
+            "    \"wait\": {               (json object) The time until the lock was got, in microseconds\n"
+            "      \"count\": n,           (numeric) Timed acquisitions\n"
+            "      \"total\": n,           (numeric) Their sum\n"
+            "      \"max\": n,             (numeric) The longest\n"
+            "      \"histogram\": [n,...]  (array) How many took under 1, then 1 to 2, 2 to 4, ... microseconds\n"
+            "    },\n"
+            "    \"hold\": {...}           (json object) The time the lock was then held, likewise\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "true")
+        );
+
+    bool fReset = request.params.size() > 0 && request.params[0].get_bool();
+    std::vector<CLockSiteStats> vSites = GetLockStats(fReset);
+    std::sort(vSites.begin(), vSites.end(), CompareLockSiteWait);
+
+    UniValue result(UniValue::VARR);
+    for (const CLockSiteStats& site : vSites) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("lock", site.strName));
+        entry.push_back(Pair("file", site.strFile));
+        entry.push_back(Pair("line", site.nLine));
+        entry.push_back(Pair("contended", site.nContended));
+        entry.push_back(Pair("wait", LockTimeStatsToJSON(site.wait)));
+        entry.push_back(Pair("hold", LockTimeStatsToJSON(site.hold)));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+UniValue getthreadinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getthreadinfo\n"
+            "Returns the threads of the node, the CPUs each is pinned to with -scriptcheckcpus, -rpccpus\n"
+            "and -netcpus, and the CPU time each used.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxx\",          (string) The name of the thread\n"
+            "    \"group\": \"xxx\",         (string) scriptcheck, http, net or other\n"
+            "    \"cpus\": [n,...],        (array) The CPUs it is pinned to, empty if it is not\n"
+            "    \"cputime\": n            (numeric, optional) The CPU time it used, in microseconds\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getthreadinfo", "")
+            + HelpExampleRpc("getthreadinfo", "")
+        );
+
+    UniValue result(UniValue::VARR);
+    for (const CThreadInfo& info : GetThreadInfos()) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("name", info.strName));
+        entry.push_back(Pair("group", GetThreadGroupName(info.group)));
+        UniValue cpus(UniValue::VARR);
+        for (int nCpu : info.vCpus)
+            cpus.push_back(nCpu);
+        entry.push_back(Pair("cpus", cpus));
+        if (info.nCpuTimeUsec >= 0)
+            entry.push_back(Pair("cputime", info.nCpuTimeUsec));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+static const char* SchedulerPriorityName(SchedulerPriority priority)
+{
+    switch (priority) {
+    case SCHEDULER_PRIORITY_HIGH: return "high";
+    case SCHEDULER_PRIORITY_NORMAL: return "normal";
+    case SCHEDULER_PRIORITY_LOW: return "low";
+    default: return "unknown";
+    }
+}
+
+UniValue getschedulerinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "Returns the state of the background task scheduler and what its tasks cost so far.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,             (numeric) Threads running the tasks\n"
+            "  \"queued\": n,              (numeric) Tasks waiting for their time or a thread\n"
+            "  \"tasks\": {                (json object) The tasks by name, unnamed ones together\n"
+            "    \"name\": {\n"
+            "      \"priority\": \"xxx\",    (string) high, normal or low\n"
+            "      \"runs\": n,            (numeric) Times the task ran\n"
+            "      \"totalruntime\": n,    (numeric) Microseconds spent running it\n"
+            "      \"maxruntime\": n,      (numeric) Longest run in microseconds\n"
+            "      \"totaldelay\": n,      (numeric) Microseconds it waited past its time for a thread\n"
+            "      \"maxdelay\": n         (numeric) Longest wait in microseconds\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+        );
+
+    if (!g_scheduler)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "The scheduler is not running");
+
+    std::map<std::string, CSchedulerTaskStats> mapStats;
+    int nThreads = g_scheduler->getTaskStats(mapStats);
+    boost::chrono::system_clock::time_point first, last;
+    size_t nQueued = g_scheduler->getQueueInfo(first, last);
+
+    UniValue tasks(UniValue::VOBJ);
+    for (const auto& item : mapStats) {
+        const CSchedulerTaskStats& stats = item.second;
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("priority", SchedulerPriorityName(stats.priority)));
+        entry.push_back(Pair("runs", stats.nRuns));
+        entry.push_back(Pair("totalruntime", stats.nTotalRunTime));
+        entry.push_back(Pair("maxruntime", stats.nMaxRunTime));
+        entry.push_back(Pair("totaldelay", stats.nTotalDelay));
+        entry.push_back(Pair("maxdelay", stats.nMaxDelay));
+        tasks.push_back(Pair(item.first.empty() ? "unnamed" : item.first, entry));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("threads", nThreads));
+    obj.push_back(Pair("queued", (uint64_t)nQueued));
+    obj.push_back(Pair("tasks", tasks));
     return obj;
 }
 
@@ -514,6 +807,9 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true,  {} }, /* uses wallet if enabled */
     { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  {} },
+    { "control",            "getschedulerinfo",       &getschedulerinfo,       true,  {} },
+    { "control",            "getlockstats",           &getlockstats,           true,  {"reset"} },
+    { "control",            "getthreadinfo",          &getthreadinfo,          true,  {} },
     { "util",               "validateaddress",        &validateaddress,        true,  {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true,  {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          true,  {"address","signature","message"} },
@@ -67,6 +67,41 @@ UniValue ping(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue CompactBlockStatsToJSON(const CCompactBlockStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("blocks", stats.nBlocks));
+    obj.push_back(Pair("reconstructed", stats.nReconstructed));
+    obj.push_back(Pair("transactions", stats.nTxs));
+    obj.push_back(Pair("prefilled", stats.nPrefilledTxs));
+    obj.push_back(Pair("missing", stats.nMissingTxs));
+    return obj;
+}
+
+static UniValue TimeHistogramToJSON(const CTimeHistogram& hist)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("avg", hist.nCount ? hist.nTotal / (int64_t)hist.nCount : 0));
+    obj.push_back(Pair("p50", hist.GetPercentile(0.5)));
+    obj.push_back(Pair("p90", hist.GetPercentile(0.9)));
+    obj.push_back(Pair("p99", hist.GetPercentile(0.99)));
+    obj.push_back(Pair("max", hist.nMax));
+    UniValue buckets(UniValue::VARR);
+    for (int i = 0; i < CTimeHistogram::BUCKETS; i++)
+        buckets.push_back(hist.vBuckets[i]);
+    obj.push_back(Pair("histogram", buckets));
+    return obj;
+}
+
+static UniValue MessageTimeStatsToJSON(const CMessageTimeStats& times)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", times.processTime.nCount));
+    obj.push_back(Pair("queuetime", TimeHistogramToJSON(times.queueTime)));
+    obj.push_back(Pair("processtime", TimeHistogramToJSON(times.processTime)));
+    return obj;
+}
+
 UniValue getpeerinfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -90,6 +125,8 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"pingtime\": n,             (numeric) ping time (if available)\n"
             "    \"minping\": n,              (numeric) minimum observed ping time (if any at all)\n"
             "    \"pingwait\": n,             (numeric) ping wait (if non-zero)\n"
+            "    \"blockannouncements\": n,   (numeric) The new blocks the peer announced\n"
+            "    \"blockrelaydelay\": n,      (numeric) Moving average of how long after their first announcement by any peer it announced them (if any)\n"
             "    \"version\": v,              (numeric) The peer version, such as 7001\n"
             "    \"subver\": \"/Satoshi:0.8.5/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
@@ -102,6 +139,13 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"cmpctblocks\": {           (json object) The compact blocks of this peer we tried to reconstruct\n"
+            "       \"blocks\": n,            (numeric) The number of compact blocks\n"
+            "       \"reconstructed\": n,     (numeric) How many of them needed no transactions requested\n"
+            "       \"transactions\": n,      (numeric) The transactions in those blocks\n"
+            "       \"prefilled\": n,         (numeric) How many of them the peer sent along\n"
+            "       \"missing\": n            (numeric) How many of them we had to request\n"
+            "    },\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"					
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -149,6 +193,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             obj.push_back(Pair("minping", stats.dMinPing));
         if (stats.dPingWait > 0.0)
             obj.push_back(Pair("pingwait", stats.dPingWait));
+        obj.push_back(Pair("blockannouncements", stats.nBlockAnnouncements));
+        if (stats.nBlockAnnouncements > 0)
+            obj.push_back(Pair("blockrelaydelay", stats.dBlockRelayDelay));
         obj.push_back(Pair("version", stats.nVersion));
         // Use the sanitized form of subver here, to avoid tricksy remote peers from
         // corrupting or modifying the JSON output by putting special characters in
@@ -166,6 +213,7 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("cmpctblocks", CompactBlockStatsToJSON(statestats.cmpctBlockStats)));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -467,6 +515,110 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getcompactblockinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getcompactblockinfo\n"
+            "Returns how well the compact blocks received from all peers could be reconstructed from the mempool.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": n,                (numeric) The number of compact blocks we tried to reconstruct\n"
+            "  \"reconstructed\": n,         (numeric) How many of them needed no transactions requested\n"
+            "  \"transactions\": n,          (numeric) The transactions in those blocks\n"
+            "  \"prefilled\": n,             (numeric) How many of them the peers sent along\n"
+            "  \"missing\": n,               (numeric) How many of them we had to request\n"
+            "  \"hitrate\": x.xxx,           (numeric) The share of blocks that needed no round trip\n"
+            "  \"missingperblock\": x.xxx    (numeric) The average number of transactions requested per block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcompactblockinfo", "")
+            + HelpExampleRpc("getcompactblockinfo", "")
+        );
+
+    CCompactBlockStats stats;
+    GetCompactBlockStats(stats);
+    UniValue obj = CompactBlockStatsToJSON(stats);
+    obj.push_back(Pair("hitrate", stats.nBlocks ? (double)stats.nReconstructed / stats.nBlocks : 0.0));
+    obj.push_back(Pair("missingperblock", stats.nBlocks ? (double)stats.nMissingTxs / stats.nBlocks : 0.0));
+    return obj;
+}
+
+UniValue getnetstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getnetstats\n"
+            "Returns how long peer messages waited to be processed and took to process, and when recent blocks were received and relayed.\n"
+            "Durations are in microseconds. Bucket i of a histogram counts durations below 2^i microseconds, the last one all longer ones.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"commands\": {             (json object) By message type, \"*other*\" for unknown ones\n"
+            "    \"type\": {\n"
+            "      \"count\": n,            (numeric) The number of messages processed\n"
+            "      \"queuetime\": {         (json object) Time from receiving a message to processing it\n"
+            "        \"avg\": n, \"p50\": n, \"p90\": n, \"p99\": n, \"max\": n,\n"
+            "        \"histogram\": [n,...]\n"
+            "      },\n"
+            "      \"processtime\": {...}   (json object) Time spent processing it, in the same format\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"peers\": [                (json array) The same for each connected peer\n"
+            "    {\n"
+            "      \"id\": n,               (numeric) Peer index\n"
+            "      \"count\": n, \"queuetime\": {...}, \"processtime\": {...}\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"blocks\": [               (json array) The most recent blocks first\n"
+            "    {\n"
+            "      \"hash\": \"hash\",        (string) The block hash\n"
+            "      \"height\": n,           (numeric) The block height, -1 if not known yet\n"
+            "      \"peer\": n,             (numeric) The peer it was first received from, -1 for our own\n"
+            "      \"firstseen\": n,        (numeric) When it was first received, in microseconds since epoch\n"
+            "      \"relayed\": n,          (numeric) When it was first announced to a peer, 0 if it was not\n"
+            "      \"relaytime\": n         (numeric) Time from receiving to announcing it, if it was announced\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetstats", "")
+            + HelpExampleRpc("getnetstats", "")
+        );
+
+    CNetTimeStats stats;
+    GetNetTimeStats(stats);
+
+    UniValue commands(UniValue::VOBJ);
+    for (const auto& item : stats.mapCommand)
+        commands.push_back(Pair(item.first, MessageTimeStatsToJSON(item.second)));
+
+    UniValue peers(UniValue::VARR);
+    for (const auto& item : stats.mapPeer) {
+        UniValue obj = MessageTimeStatsToJSON(item.second);
+        obj.push_back(Pair("id", item.first));
+        peers.push_back(obj);
+    }
+
+    UniValue blocks(UniValue::VARR);
+    for (const CBlockRelayTimes& times : stats.vBlocks) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("hash", times.hash.GetHex()));
+        obj.push_back(Pair("height", times.nHeight));
+        obj.push_back(Pair("peer", times.nFromPeer));
+        obj.push_back(Pair("firstseen", times.nFirstSeen));
+        obj.push_back(Pair("relayed", times.nRelayed));
+        if (times.nRelayed)
+            obj.push_back(Pair("relaytime", times.nRelayed - times.nFirstSeen));
+        blocks.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("commands", commands));
+    ret.push_back(Pair("peers", peers));
+    ret.push_back(Pair("blocks", blocks));
+    return ret;
+}
+
 UniValue setban(const JSONRPCRequest& request)
 {
     string strCommand;
@@ -613,6 +765,8 @@ static const CRPCCommand commands[] =
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
+    { "network",            "getcompactblockinfo",    &getcompactblockinfo,    true,  {} },
+    { "network",            "getnetstats",            &getnetstats,            true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
     { "network",            "clearbanned",            &clearbanned,            true,  {} },
@@ -8,6 +8,7 @@
 #include "coins.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "indexer.h"
 #include "init.h"
 #include "keystore.h"
 #include "validation.h"
@@ -22,6 +23,7 @@
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
+#include "undo.h"
 #include "utilstrencodings.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -60,7 +62,33 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fInclud
     out.push_back(Pair("addresses", a));
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+/** The output an input spends, as the undo data of its block or the UTXO set has it */
+static void PrevoutToJSON(const Coin& coin, UniValue& in)
+{
+    UniValue prevout(UniValue::VOBJ);
+    // Undo data of older versions has these for the last output a transaction spends from a transaction only,
+    // and outputs of mempool transactions have no height yet
+    if (coin.nHeight > 0 && coin.nHeight != MEMPOOL_HEIGHT) {
+        prevout.push_back(Pair("generated", coin.IsCoinBase()));
+        prevout.push_back(Pair("height", (int64_t)coin.nHeight));
+    }
+    prevout.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+    UniValue o(UniValue::VOBJ);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+    prevout.push_back(Pair("scriptPubKey", o));
+    in.push_back(Pair("prevout", prevout));
+}
+
+/** The fee of a transaction whose spent outputs are known */
+static void FeeToJSON(const CTransaction& tx, const CTxUndo& txundo, UniValue& entry)
+{
+    CAmount nFee = -tx.GetValueOut();
+    for (const Coin& coin : txundo.vprevout)
+        nFee += coin.out.nValue;
+    entry.push_back(Pair("fee", ValueFromAmount(nFee)));
+}
+
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CTxUndo* ptxundo = NULL)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
     entry.push_back(Pair("hash", tx.GetWitnessHash().GetHex()));
@@ -82,6 +110,8 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             o.push_back(Pair("asm", ScriptToAsmStr(txin.scriptSig, true)));
             o.push_back(Pair("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end())));
             in.push_back(Pair("scriptSig", o));
+            if (ptxundo)
+                PrevoutToJSON(ptxundo->vprevout[i], in);
         }
         if (tx.HasWitness()) {
                 UniValue txinwitness(UniValue::VARR);
@@ -95,6 +125,8 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         vin.push_back(in);
     }
     entry.push_back(Pair("vin", vin));
+    if (ptxundo && !tx.IsCoinBase())
+        FeeToJSON(tx, *ptxundo, entry);
     UniValue vout(UniValue::VARR);
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
@@ -125,7 +157,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
-void TxToJSONNew(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+void TxToJSONNew(const CTransaction& tx, const uint256 hashBlock, UniValue& entry, const CTxUndo* ptxundo = NULL)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
     entry.push_back(Pair("hash", tx.GetWitnessHash().GetHex()));
@@ -147,6 +179,8 @@ void TxToJSONNew(const CTransaction& tx, const uint256 hashBlock, UniValue& entr
             o.push_back(Pair("asm", ScriptToAsmStr(txin.scriptSig, true)));
             o.push_back(Pair("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end())));
             in.push_back(Pair("scriptSig", o));
+            if (ptxundo)
+                PrevoutToJSON(ptxundo->vprevout[i], in);
         }
         if (tx.HasWitness()) {
                 UniValue txinwitness(UniValue::VARR);
@@ -160,6 +194,8 @@ void TxToJSONNew(const CTransaction& tx, const uint256 hashBlock, UniValue& entr
         vin.push_back(in);
     }
     entry.push_back(Pair("vin", vin));
+    if (ptxundo && !tx.IsCoinBase())
+        FeeToJSON(tx, *ptxundo, entry);
     UniValue vout(UniValue::VARR);
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
@@ -205,6 +241,13 @@ void TxToJSONNew(const CTransaction& tx, const uint256 hashBlock, UniValue& entr
     }
 }
 
+/** Let the transaction index, which is built in the background, include the chain tip */
+static void WaitForTxIndex()
+{
+    if (ptxindexer)
+        ptxindexer->BlockUntilSyncedToCurrentChain();
+}
+
 UniValue getrawtransaction(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -277,6 +320,8 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", true")
         );
 
+    WaitForTxIndex();
+
     LOCK(cs_main);
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
@@ -317,6 +362,49 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
     return result;
 }
 
+/**
+ * The outputs a transaction spends, from the undo data of its block when it is confirmed
+ * or from the mempool and the UTXO set when it is not. Requires cs_main.
+ */
+static bool GetTxUndo(const CTransaction& tx, const uint256& hashBlock, CTxUndo& txundo)
+{
+    if (tx.IsCoinBase())
+        return false;
+
+    if (hashBlock.IsNull()) {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        txundo.vprevout.clear();
+        for (const CTxIn& txin : tx.vin) {
+            Coin coin;
+            if (!viewMempool.GetCoin(txin.prevout, coin))
+                return false;
+            txundo.vprevout.push_back(coin);
+        }
+        return true;
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end())
+        return false;
+    CBlockIndex* pindex = mi->second;
+    if (!pindex->pprev || !(pindex->nStatus & BLOCK_HAVE_UNDO) || !(pindex->nStatus & BLOCK_HAVE_DATA))
+        return false;
+    CBlock block;
+    CBlockUndo blockundo;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()) ||
+        !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+        blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return false;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        if (block.vtx[i]->GetHash() == tx.GetHash()) {
+            txundo = blockundo.vtxundo[i - 1];
+            return txundo.vprevout.size() == tx.vin.size();
+        }
+    }
+    return false;
+}
+
 UniValue gettransactionnew(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -354,11 +442,18 @@ UniValue gettransactionnew(const JSONRPCRequest& request)
             "         \"asm\": \"asm\",  (string) asm\n"
             "         \"hex\": \"hex\"   (string) hex\n"
             "       },\n"
+            "       \"prevout\": {       (json object) The output spent, when it is known\n"
+            "         \"generated\": true|false, (boolean) Whether it is a coinbase output\n"
+            "         \"height\": n,     (numeric) The height of the block that created it\n"
+            "         \"value\": x.xxx,  (numeric) The value in " + CURRENCY_UNIT + "\n"
+            "         \"scriptPubKey\": {...} (json object) The output script, as in vout\n"
+            "       },\n"
             "       \"sequence\": n      (numeric) The script sequence number\n"
             "       \"txinwitness\": [\"hex\", ...] (array of string) hex-encoded witness data (if any)\n"
             "     }\n"
             "     ,...\n"
             "  ],\n"
+            "  \"fee\" : x.xxx,          (numeric) The fee in " + CURRENCY_UNIT + ", when the outputs spent are known\n"
             "  \"vout\" : [              (array of json objects)\n"
             "     {\n"
             "       \"value\" : x.xxx,            (numeric) The value in " + CURRENCY_UNIT + "\n"
@@ -387,6 +482,8 @@ UniValue gettransactionnew(const JSONRPCRequest& request)
             + HelpExampleRpc("gettransactionnew", "\"mytxid\"")
         );
 
+    WaitForTxIndex();
+
     LOCK(cs_main);
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
@@ -400,8 +497,11 @@ UniValue gettransactionnew(const JSONRPCRequest& request)
 
     string strHex = EncodeHexTx(*tx, RPCSerializationFlags());
 
+    CTxUndo txundo;
+    bool fUndo = GetTxUndo(*tx, hashBlock, txundo);
+
     UniValue result(UniValue::VOBJ);
-    TxToJSONNew(CTransaction(*tx), hashBlock, result);
+    TxToJSONNew(CTransaction(*tx), hashBlock, result, fUndo ? &txundo : NULL);
     return result;
 }
 
@@ -452,9 +552,10 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, oneTxid);
+        if (!coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= chainActive.Height()) {
+            pblockindex = chainActive[coin.nHeight];
+        }
     }
 
     if (pblockindex == NULL)
@@ -519,6 +620,86 @@ UniValue verifytxoutproof(const JSONRPCRequest& request)
     return res;
 }
 
+UniValue getroundproof(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getroundproof \"blockhash\"\n"
+            "\nReturns a hex-encoded proof of the forgers of the DPoS round of a block on the active chain,\n"
+            "up to that block: the header, coinbase and coinbase merkle branch of each block of the round.\n"
+            "The coinbase of the first block lists the delegates of the round.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"   (string, required) The last block to prove\n"
+            "\nResult:\n"
+            "\"data\"           (string) A string that is a serialized, hex-encoded data for the proof.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getroundproof", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("getroundproof", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+        );
+
+    uint256 hashBlock = ParseHashV(request.params[0], "blockhash");
+
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+    if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found in chain");
+
+    std::vector<CCoinbaseProof> vProof;
+    if (!DPoS::GetInstance().GetRoundProof(it->second, vProof))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not in a DPoS round or a block of its round not available");
+
+    CDataStream ssProof(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ssProof << vProof;
+    return HexStr(ssProof.begin(), ssProof.end());
+}
+
+UniValue verifyroundproof(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "verifyroundproof \"proof\"\n"
+            "\nVerifies that every block of a round proof was signed by the delegate of its slot, as the first\n"
+            "block of the proof lists them. Whether that block starts a round and lists the right delegates\n"
+            "follows from the chain of headers, which is not checked.\n"
+            "\nArguments:\n"
+            "1. \"proof\"    (string, required) The hex-encoded proof generated by getroundproof\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"valid\": true|false,       (boolean) Whether the proof checks out\n"
+            "  \"error\": \"message\",       (string) Why not, if it does not\n"
+            "  \"delegates\": [ \"address\", ... ], (json array) The delegates of the round by slot\n"
+            "  \"blocks\": [ \"hash\", ... ]   (json array) The hashes of the blocks proven\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("verifyroundproof", "\"proof\"")
+            + HelpExampleRpc("verifyroundproof", "\"proof\"")
+        );
+
+    CDataStream ssProof(ParseHexV(request.params[0], "proof"), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    std::vector<CCoinbaseProof> vProof;
+    ssProof >> vProof;
+
+    UniValue result(UniValue::VOBJ);
+    DelegateInfo cDelegateInfo;
+    std::string strError;
+    if (!DPoS::GetInstance().VerifyRoundProof(vProof, cDelegateInfo, strError)) {
+        result.push_back(Pair("valid", false));
+        result.push_back(Pair("error", strError));
+        return result;
+    }
+
+    result.push_back(Pair("valid", true));
+    UniValue delegates(UniValue::VARR);
+    for (const Delegate& delegate : cDelegateInfo.delegates)
+        delegates.push_back(CBitcoinAddress(delegate.keyid).ToString());
+    result.push_back(Pair("delegates", delegates));
+    UniValue blocks(UniValue::VARR);
+    for (const CCoinbaseProof& proof : vProof)
+        blocks.push_back(proof.header.GetHash().GetHex());
+    result.push_back(Pair("blocks", blocks));
+    return result;
+}
+
 UniValue createrawtransaction(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -861,9 +1042,7 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -917,21 +1096,23 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
             vector<unsigned char> pkData(ParseHexO(prevOut, "scriptPubKey"));
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
+            COutPoint out(txid, nOut);
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -986,33 +1167,45 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     // Use CTransaction for the constant parts of the
     // transaction to avoid rehashing.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    // Sign what we can, all the inputs at once:
+    std::vector<const CScript*> vScriptPubKey(mergedTx.vin.size(), NULL);
+    std::vector<CAmount> vAmount(mergedTx.vin.size(), 0);
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        const Coin& coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        if (coin.IsSpent())
+            continue;
+        vAmount[i] = coin.out.nValue;
+        // Only sign SIGHASH_SINGLE if there's a corresponding output:
+        if (!fHashSingle || (i < mergedTx.vout.size()))
+            vScriptPubKey[i] = &coin.out.scriptPubKey;
+    }
+    std::vector<SignatureData> vSigData;
+    ProduceSignatures(&keystore, txConst, vScriptPubKey, vAmount, nHashType, vSigData);
+
+    const PrecomputedTransactionData txdata(txConst);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
-
-        SignatureData sigdata;
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata);
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
+        const TransactionSignatureChecker checker(&txConst, i, amount, txdata);
 
         // ... and merge in other signatures:
+        SignatureData& sigdata = vSigData[i];
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
             if (txv.vin.size() > i) {
-                sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i));
+                sigdata = CombineSignatures(prevPubKey, checker, sigdata, DataFromTransaction(txv, i));
             }
         }
 
         UpdateTransaction(mergedTx, i, sigdata);
 
         ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), &serror)) {
+        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, checker, &serror)) {
             TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
         }
     }
@@ -1067,9 +1260,12 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
         nMaxRawTxFee = 0;
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -1111,6 +1307,8 @@ static const CRPCCommand commands[] =
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  {"txids", "blockhash"} },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,  {"proof"} },
+    { "blockchain",         "getroundproof",          &getroundproof,          true,  {"blockhash"} },
+    { "blockchain",         "verifyroundproof",       &verifyroundproof,       true,  {"proof"} },
 };
 
 void RegisterRawTransactionRPCCommands(CRPCTable &t)
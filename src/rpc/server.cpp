@@ -6,6 +6,7 @@
 #include "rpc/server.h"
 
 #include "base58.h"
+#include "httpserver.h"
 #include "init.h"
 #include "random.h"
 #include "sync.h"
@@ -24,6 +25,7 @@
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
 #include <memory> // for unique_ptr
+#include <set>
 #include <unordered_map>
 
 using namespace RPCServer;
@@ -415,11 +417,60 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+//! Commands that only read state, so the elements of a batch calling them may run at the same time
+static const std::set<std::string> setConcurrentCommands = {
+    "echo", "echojson", "getaddressbalance", "getaddresssummary", "getaddresstxids", "getaddressutxos",
+    "getbestblockhash", "getbill", "getblock", "getblockchaininfo", "getblockcount", "getblockhash",
+    "getblockheader", "getcommittee", "getdelegatefunds", "getdelegatesinfo", "getdelegatevotes",
+    "getirreversibleblock", "getmempoolchanges", "getmempoolentry", "getmempoolinfo", "getrawmempool", "getrawtransaction",
+    "gettransactionnew", "gettxout", "decoderawtransaction", "decodescript", "listbills", "listbillvoters",
+    "listcommitteebills", "listcommittees", "listcommitteevoters", "listdelegates", "listreceivedvotes",
+    "listvoterbills", "listvotercommittees", "listvoteddelegates", "validateaddress",
+};
+
+static bool IsConcurrentRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    return method.isStr() && setConcurrentCommands.count(method.get_str());
+}
+
+static void JSONRPCExecRange(const UniValue& vReq, std::vector<UniValue>& vReply, size_t nBegin, size_t nEnd, int nThread, int nThreads)
+{
+    for (size_t reqIdx = nBegin + nThread; reqIdx < nEnd; reqIdx += nThreads)
+        vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
+    // Runs of read-only elements are spread over -rpcthreads threads, any other element runs on its own
+    // once the elements before it are done, so a batch sees its own writes in order
+    int nThreads = std::max((int)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1);
+    std::vector<UniValue> vReply(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsConcurrentRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd == reqIdx) {
+            vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
+
+        int nRunThreads = std::min<size_t>(nThreads, nEnd - reqIdx);
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nRunThreads; i++)
+            threadGroup.create_thread(boost::bind(&JSONRPCExecRange, boost::cref(vReq), boost::ref(vReply), reqIdx, nEnd, i, nRunThreads));
+        JSONRPCExecRange(vReq, vReply, reqIdx, nEnd, 0, nRunThreads);
+        threadGroup.join_all();
+        reqIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (const UniValue& reply : vReply)
+        ret.push_back(reply);
 
     return ret.write() + "\n";
 }
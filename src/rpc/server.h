@@ -43,6 +43,14 @@ struct UniValueType {
     UniValue::VType type;
 };
 
+/** Receives the elements of an array result while the RPC produces them, see CRPCArrayResult */
+class CRPCArrayWriter
+{
+public:
+    virtual ~CRPCArrayWriter() {}
+    virtual void Push(const UniValue& value) = 0;
+};
+
 class JSONRPCRequest
 {
 public:
@@ -52,11 +60,54 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    CRPCArrayWriter* pArrayWriter; // Set when the transport can stream an array result
+    bool fParkable; // Set when the transport can park the request instead of a thread waiting, see RPCParkRequest
+    int64_t nParkedSince; // Time in milliseconds the parked request first ran, 0 before it was parked
+    std::string strParkState; // What the call asked to be given back when it runs again after parking
 
-    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; }
+    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; pArrayWriter = NULL; fParkable = false; nParkedSince = 0; }
     void parse(const UniValue& valRequest);
 };
 
+/**
+ * Thrown by a call that waits for the tip to change, when the request is
+ * fParkable, instead of waiting on its thread. The transport keeps the
+ * request and runs it again, with nParkedSince and strParkState set, once
+ * the tip changed or at nWakeTime, whichever comes first.
+ */
+struct RPCParkRequest
+{
+    int64_t nWakeTime; // Milliseconds, 0 to wait for the tip only
+    std::string strState;
+
+    RPCParkRequest(int64_t nWakeTimeIn, const std::string& strStateIn) : nWakeTime(nWakeTimeIn), strState(strStateIn) {}
+};
+
+/**
+ * Array result of an RPC that can grow large. When the transport streams
+ * the reply, pushed elements are written out right away and the array
+ * returned by get() carries none of them.
+ */
+class CRPCArrayResult
+{
+public:
+    explicit CRPCArrayResult(const JSONRPCRequest& request) : writer(request.pArrayWriter), array(UniValue::VARR) {}
+
+    void push_back(const UniValue& value)
+    {
+        if (writer)
+            writer->Push(value);
+        else
+            array.push_back(value);
+    }
+
+    const UniValue& get() const { return array; }
+
+private:
+    CRPCArrayWriter* writer;
+    UniValue array;
+};
+
 /** Query whether RPC is running */
 bool IsRPCRunning();
 
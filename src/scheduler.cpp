@@ -6,11 +6,12 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nThreadsRunningBackground(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -27,6 +28,21 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+bool CScheduler::empty() const
+{
+    for (int i = 0; i < SCHEDULER_PRIORITY_COUNT; i++) {
+        if (!taskQueue[i].empty())
+            return false;
+    }
+    return true;
+}
+
+bool CScheduler::mayRun(SchedulerPriority priority) const
+{
+    return priority == SCHEDULER_PRIORITY_HIGH || nThreadsServicingQueue < 2 ||
+           nThreadsRunningBackground < nThreadsServicingQueue - 1;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -37,43 +53,75 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
-                newTaskScheduled.wait(lock);
+            // Find the due task of the highest priority this thread may run,
+            // and otherwise the time the first one it may run is due
+            boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+            TaskQueue* pqueue = NULL;
+            TaskQueue* pnext = NULL;
+            for (int i = 0; i < SCHEDULER_PRIORITY_COUNT; i++) {
+                if (taskQueue[i].empty() || !mayRun((SchedulerPriority)i))
+                    continue;
+                if (taskQueue[i].begin()->first <= now) {
+                    pqueue = &taskQueue[i];
+                    break;
+                }
+                if (!pnext || taskQueue[i].begin()->first < pnext->begin()->first)
+                    pnext = &taskQueue[i];
             }
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
+            if (!pqueue) {
+                // Wait until there is a new task, a thread is done with one,
+                // or the time of the first one comes
+                if (!pnext) {
+                    newTaskScheduled.wait(lock);
+                } else {
 // wait_until needs boost 1.50 or later; older versions have timed_wait:
 #if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
+                    newTaskScheduled.timed_wait(lock, toPosixTime(pnext->begin()->first));
 #else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty()) {
-                boost::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until<>(lock, timeToWaitFor) == boost::cv_status::timeout)
-                    break; // Exit loop after timeout, it means we reached the time of the event
-            }
+                    // Some boost versions have a conflicting overload of wait_until that returns void.
+                    // Explicitly use a template here to avoid hitting that overload.
+                    newTaskScheduled.wait_until<>(lock, pnext->begin()->first);
 #endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+                }
+                // If there are multiple threads, the queue can change while we're waiting
+                // (another thread may service the task we were waiting on), so look again.
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            Task task = pqueue->begin()->second;
+            pqueue->erase(pqueue->begin());
+            bool fBackground = task.priority != SCHEDULER_PRIORITY_HIGH;
+            if (fBackground)
+                nThreadsRunningBackground++;
 
-            {
+            boost::chrono::system_clock::time_point start = boost::chrono::system_clock::now();
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
+            } catch (...) {
+                if (fBackground)
+                    nThreadsRunningBackground--;
+                throw;
             }
+            boost::chrono::system_clock::time_point end = boost::chrono::system_clock::now();
+            if (fBackground) {
+                // A thread kept back for high priority tasks may run this kind again
+                nThreadsRunningBackground--;
+                newTaskScheduled.notify_one();
+            }
+
+            CSchedulerTaskStats& stats = mapTaskStats[task.strName];
+            int64_t nRunTime = boost::chrono::duration_cast<boost::chrono::microseconds>(end - start).count();
+            int64_t nDelay = std::max<int64_t>(0, boost::chrono::duration_cast<boost::chrono::microseconds>(start - task.t).count());
+            stats.priority = task.priority;
+            stats.nRuns++;
+            stats.nTotalRunTime += nRunTime;
+            stats.nMaxRunTime = std::max(stats.nMaxRunTime, nRunTime);
+            stats.nTotalDelay += nDelay;
+            stats.nMaxDelay = std::max(stats.nMaxDelay, nDelay);
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -95,39 +143,160 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                          SchedulerPriority priority, const std::string& strName)
 {
+    assert(priority >= 0 && priority < SCHEDULER_PRIORITY_COUNT);
+    Task task;
+    task.f = f;
+    task.priority = priority;
+    task.strName = strName;
+    task.t = t;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        taskQueue[priority].insert(std::make_pair(t, task));
     }
-    newTaskScheduled.notify_one();
+    // Any thread may be the one free to run it
+    newTaskScheduled.notify_all();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                 SchedulerPriority priority, const std::string& strName)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority, strName);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds, SchedulerPriority priority, const std::string& strName)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&CScheduler::Repeat, s, f, deltaSeconds, priority, strName), deltaSeconds, priority, strName);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+bool CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                               SchedulerPriority priority, const std::string& strName)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    if (!strName.empty()) {
+        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        if (!setPeriodic.insert(strName).second)
+            return false;
+    }
+    scheduleFromNow(boost::bind(&CScheduler::Repeat, this, f, deltaSeconds, priority, strName), deltaSeconds, priority, strName);
+    return true;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
                              boost::chrono::system_clock::time_point &last) const
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
-    size_t result = taskQueue.size();
-    if (!taskQueue.empty()) {
-        first = taskQueue.begin()->first;
-        last = taskQueue.rbegin()->first;
+    size_t result = 0;
+    for (int i = 0; i < SCHEDULER_PRIORITY_COUNT; i++) {
+        if (taskQueue[i].empty())
+            continue;
+        if (result == 0 || taskQueue[i].begin()->first < first)
+            first = taskQueue[i].begin()->first;
+        if (result == 0 || taskQueue[i].rbegin()->first > last)
+            last = taskQueue[i].rbegin()->first;
+        result += taskQueue[i].size();
     }
     return result;
 }
+
+bool CScheduler::AreThreadsServicingQueue() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return nThreadsServicingQueue > 0;
+}
+
+int CScheduler::getTaskStats(std::map<std::string, CSchedulerTaskStats>& mapStats) const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    mapStats = mapTaskStats;
+    return nThreadsServicingQueue;
+}
+
+
+SingleThreadedSchedulerClient::SingleThreadedSchedulerClient(CScheduler* pschedulerIn) : queue(std::make_shared<Queue>())
+{
+    queue->pscheduler = pschedulerIn;
+    queue->fCallbacksRunning = false;
+}
+
+void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue(const std::shared_ptr<Queue>& queue)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(queue->mutex);
+        // A second ProcessQueue scheduled by a race returns right away
+        if (queue->fCallbacksRunning || queue->callbacksPending.empty())
+            return;
+    }
+    queue->pscheduler->schedule(boost::bind(&SingleThreadedSchedulerClient::ProcessQueue, queue), boost::chrono::system_clock::now());
+}
+
+void SingleThreadedSchedulerClient::ProcessQueue(std::shared_ptr<Queue> queue)
+{
+    CScheduler::Function callback;
+    {
+        boost::unique_lock<boost::mutex> lock(queue->mutex);
+        if (queue->fCallbacksRunning || queue->callbacksPending.empty())
+            return;
+        queue->fCallbacksRunning = true;
+        callback = queue->callbacksPending.front();
+        queue->callbacksPending.pop_front();
+    }
+
+    // The queue is released again even if the callback throws, after which
+    // the next one is scheduled
+    struct RAIICallbacksRunning {
+        const std::shared_ptr<Queue>& queue;
+        explicit RAIICallbacksRunning(const std::shared_ptr<Queue>& queueIn) : queue(queueIn) {}
+        ~RAIICallbacksRunning()
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(queue->mutex);
+                queue->fCallbacksRunning = false;
+            }
+            MaybeScheduleProcessQueue(queue);
+        }
+    } raiicallbacksrunning(queue);
+
+    callback();
+}
+
+void SingleThreadedSchedulerClient::AddToProcessQueue(CScheduler::Function f)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(queue->mutex);
+        queue->callbacksPending.push_back(f);
+    }
+    MaybeScheduleProcessQueue(queue);
+}
+
+void SingleThreadedSchedulerClient::Flush()
+{
+    if (!queue->pscheduler->AreThreadsServicingQueue()) {
+        // Nothing else runs the queue, so run it here
+        while (CallbacksPending() > 0)
+            ProcessQueue(queue);
+        return;
+    }
+
+    // Wait for a marker behind the functions queued so far, rather than for
+    // an empty queue that others may keep filling
+    boost::mutex mutexDone;
+    boost::condition_variable condDone;
+    bool fDone = false;
+    AddToProcessQueue([&mutexDone, &condDone, &fDone]() {
+        boost::unique_lock<boost::mutex> lock(mutexDone);
+        fDone = true;
+        condDone.notify_all();
+    });
+    boost::unique_lock<boost::mutex> lock(mutexDone);
+    while (!fDone)
+        condDone.wait(lock);
+}
+
+size_t SingleThreadedSchedulerClient::CallbacksPending() const
+{
+    boost::unique_lock<boost::mutex> lock(queue->mutex);
+    return queue->callbacksPending.size();
+}
@@ -13,7 +13,43 @@
 #include <boost/function.hpp>
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
+#include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <string>
+
+/** Threads servicing the scheduler, one of them kept for high priority tasks */
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+static const int MAX_SCHEDULER_THREADS = 16;
+
+/**
+ * Due tasks run highest priority first. While more than one thread
+ * services the queue, normal and low priority tasks leave one of them
+ * free, so that a high priority task never waits behind background work.
+ */
+enum SchedulerPriority {
+    SCHEDULER_PRIORITY_HIGH = 0,
+    SCHEDULER_PRIORITY_NORMAL,
+    SCHEDULER_PRIORITY_LOW,
+    SCHEDULER_PRIORITY_COUNT
+};
+
+/** What the tasks of one name cost so far */
+struct CSchedulerTaskStats
+{
+    SchedulerPriority priority;
+    uint64_t nRuns;
+    //! time spent running, in microseconds
+    int64_t nTotalRunTime;
+    int64_t nMaxRunTime;
+    //! time from when a task was due until it started, in microseconds
+    int64_t nTotalDelay;
+    int64_t nMaxDelay;
+
+    CSchedulerTaskStats() : priority(SCHEDULER_PRIORITY_NORMAL), nRuns(0), nTotalRunTime(0), nMaxRunTime(0), nTotalDelay(0), nMaxDelay(0) {}
+};
 
 //
 // Simple class for background tasks that should be run
@@ -41,18 +77,25 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    // Call func at/after time t. Tasks are accounted for under strName
+    // in getTaskStats, unnamed ones together.
+    void schedule(Function f, boost::chrono::system_clock::time_point t,
+                  SchedulerPriority priority = SCHEDULER_PRIORITY_NORMAL, const std::string& strName = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds,
+                         SchedulerPriority priority = SCHEDULER_PRIORITY_NORMAL, const std::string& strName = "");
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    // A named task that is already scheduled every so often is not
+    // added a second time, so that the two are coalesced into one;
+    // this returns false then.
+    bool scheduleEvery(Function f, int64_t deltaSeconds,
+                       SchedulerPriority priority = SCHEDULER_PRIORITY_NORMAL, const std::string& strName = "");
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -70,14 +113,74 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns true if there are threads actively running in serviceQueue()
+    bool AreThreadsServicingQueue() const;
+
+    // Returns the number of threads in serviceQueue() and the run time
+    // and delay of the tasks so far, by name
+    int getTaskStats(std::map<std::string, CSchedulerTaskStats>& mapStats) const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        SchedulerPriority priority;
+        std::string strName;
+        boost::chrono::system_clock::time_point t;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue[SCHEDULER_PRIORITY_COUNT];
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    //! threads running a task that is not of high priority
+    int nThreadsRunningBackground;
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    //! names of the tasks added by scheduleEvery
+    std::set<std::string> setPeriodic;
+    std::map<std::string, CSchedulerTaskStats> mapTaskStats;
+
+    bool empty() const;
+    bool shouldStop() const { return stopRequested || (stopWhenEmpty && empty()); }
+    // Whether this thread may start a task of the priority now
+    bool mayRun(SchedulerPriority priority) const;
+    static void Repeat(CScheduler* s, Function f, int64_t deltaSeconds, SchedulerPriority priority, const std::string& strName);
+};
+
+/**
+ * Runs the functions added to it one at a time and in order on a
+ * CScheduler, as if they had a thread of their own, without keeping a
+ * scheduler thread busy while the queue is empty.
+ */
+class SingleThreadedSchedulerClient
+{
+public:
+    explicit SingleThreadedSchedulerClient(CScheduler* pschedulerIn);
+
+    // Queue f to run after the functions queued before it
+    void AddToProcessQueue(CScheduler::Function f);
+
+    // Return once the functions queued so far have run. They run on the
+    // calling thread when no thread services the scheduler any more, so
+    // this also works at shutdown. Must not be called from a queued function.
+    void Flush();
+
+    size_t CallbacksPending() const;
+
+private:
+    // Shared with the tasks scheduled to process it, so that the client
+    // may go away while one is still waiting in the scheduler
+    struct Queue {
+        CScheduler* pscheduler;
+        std::list<CScheduler::Function> callbacksPending;
+        bool fCallbacksRunning;
+        boost::mutex mutex;
+    };
+    std::shared_ptr<Queue> queue;
+
+    static void MaybeScheduleProcessQueue(const std::shared_ptr<Queue>& queue);
+    static void ProcessQueue(std::shared_ptr<Queue> queue);
 };
 
 #endif
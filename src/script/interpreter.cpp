@@ -6,11 +6,13 @@
 #include "interpreter.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 #include "miner.h"
 #include "utilstrencodings.h"
@@ -1168,6 +1170,14 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
     return ss.GetHash();
 }
 
+/** Size of an input with a blank script in the legacy signature hash: prevout, empty script and nSequence */
+const size_t LEGACY_BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
+/** Whether the legacy signature hash for the hash type serializes every input and output like SIGHASH_ALL */
+bool IsLegacyHashAll(int nHashType) {
+    return !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE;
+}
+
 } // anon namespace
 
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
@@ -1175,6 +1185,28 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
     hashOutputs = GetOutputsHash(txTo);
+
+    if (txTo.vin.size() > 1) {
+        CVectorWriter suffix(SER_GETHASH, 0, vchLegacySuffix, 0);
+        for (unsigned int n = 0; n < txTo.vin.size(); n++) {
+            suffix << txTo.vin[n].prevout << CScriptBase() << txTo.vin[n].nSequence;
+        }
+        suffix << txTo.vout << txTo.nLockTime;
+        assert(vchLegacySuffix.size() >= txTo.vin.size() * LEGACY_BLANK_INPUT_SIZE);
+
+        std::vector<unsigned char> vchHeader;
+        CVectorWriter header(SER_GETHASH, 0, vchHeader, 0);
+        header << txTo.nVersion;
+        WriteCompactSize(header, txTo.vin.size());
+
+        CHash256 hasher;
+        hasher.Write(vchHeader.data(), vchHeader.size());
+        vLegacyPrefix.reserve(txTo.vin.size());
+        for (unsigned int n = 0; n < txTo.vin.size(); n++) {
+            vLegacyPrefix.push_back(hasher);
+            hasher.Write(&vchLegacySuffix[n * LEGACY_BLANK_INPUT_SIZE], LEGACY_BLANK_INPUT_SIZE);
+        }
+    }
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1243,6 +1275,25 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && nIn < cache->vLegacyPrefix.size() && IsLegacyHashAll(nHashType)) {
+        // Resume from the inputs before nIn and only serialize the input being signed
+        std::vector<unsigned char> vchInput;
+        CVectorWriter input(SER_GETHASH, 0, vchInput, 0);
+        txTmp.SerializeInput(input, nIn);
+        size_t nSuffix = (nIn + 1) * LEGACY_BLANK_INPUT_SIZE;
+        unsigned char trailer[8];
+        WriteLE32(trailer, nHashType);
+        WriteLE32(trailer + 4, 0x4354424c);
+
+        uint256 result;
+        CHash256 hasher(cache->vLegacyPrefix[nIn]);
+        hasher.Write(vchInput.data(), vchInput.size())
+              .Write(&cache->vchLegacySuffix[nSuffix], cache->vchLegacySuffix.size() - nSuffix)
+              .Write(trailer, sizeof(trailer))
+              .Finalize((unsigned char*)&result);
+        return result;
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1360,6 +1411,56 @@ bool TransactionSignatureChecker::CheckSequence(const CScriptNum& nSequence) con
     return true;
 }
 
+/**
+ * Split a scriptSig made of two data pushes, as EvalScript would push them,
+ * into the signature and the public key. Returns false for anything else,
+ * including pushes EvalScript would reject, which are then left to it.
+ */
+static bool GetSigAndPubKey(const CScript& scriptSig, unsigned int flags, valtype& vchSig, valtype& vchPubKey)
+{
+    CScript::const_iterator pc = scriptSig.begin();
+    opcodetype opcode;
+    valtype* pushes[2] = {&vchSig, &vchPubKey};
+    for (valtype* push : pushes) {
+        if (!scriptSig.GetOp(pc, opcode, *push) || opcode > OP_PUSHDATA4 || push->size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(*push, opcode))
+            return false;
+    }
+    return pc == scriptSig.end();
+}
+
+/**
+ * Evaluate OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG, which is
+ * scriptCode, on a stack of the signature and the public key without going
+ * through EvalScript. Fails with the error EvalScript would set, and also
+ * when the resulting stack would be false.
+ */
+static bool EvalPayToPubKeyHash(const valtype& vchSig, const valtype& vchPubKey, const unsigned char* hash, const CScript& scriptCode, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    uint160 hashPubKey;
+    CHash160().Write(vchPubKey.data(), vchPubKey.size()).Finalize(hashPubKey.begin());
+    if (memcmp(hashPubKey.begin(), hash, 20) != 0)
+        return set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+
+    CScript scriptCodeSig(scriptCode);
+    if (sigversion == SIGVERSION_BASE) {
+        scriptCodeSig.FindAndDelete(CScript(vchSig));
+    }
+
+    if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
+        //serror is set
+        return false;
+    }
+    bool fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCodeSig, sigversion);
+
+    if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
+        return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+    if (!fSuccess)
+        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    return set_success(serror);
+}
+
 static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion, const std::vector<unsigned char>& program, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
     vector<vector<unsigned char> > stack;
@@ -1401,6 +1502,10 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
             return set_error(serror, SCRIPT_ERR_PUSH_SIZE);
     }
 
+    if (witversion == 0 && program.size() == 20) {
+        return EvalPayToPubKeyHash(stack[0], stack[1], program.data(), scriptPubKey, flags, checker, SIGVERSION_WITNESS_V0, serror);
+    }
+
     if (!EvalScript(stack, scriptPubKey, flags, checker, SIGVERSION_WITNESS_V0, serror)) {
         return false;
     }
@@ -1428,18 +1533,27 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     }
 
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
-        // serror is set
-        return false;
-    if (flags & SCRIPT_VERIFY_P2SH)
-        stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
-        // serror is set
-        return false;
-    if (stack.empty())
-        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
-    if (CastToBool(stack.back()) == false)
-        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    valtype vchSig, vchPubKey;
+    if (scriptPubKey.IsPayToPubKeyHash() && GetSigAndPubKey(scriptSig, flags, vchSig, vchPubKey)) {
+        // Pay-to-pubkey-hash spends are the bulk of the chain and skip the interpreter
+        if (!EvalPayToPubKeyHash(vchSig, vchPubKey, &scriptPubKey[3], scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
+            // serror is set
+            return false;
+        stack.push_back(valtype(1, 1));
+    } else {
+        if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
+            // serror is set
+            return false;
+        if (flags & SCRIPT_VERIFY_P2SH)
+            stackCopy = stack;
+        if (!EvalScript(stack, scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
+            // serror is set
+            return false;
+        if (stack.empty())
+            return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        if (CastToBool(stack.back()) == false)
+            return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    }
 
     // Bare witness programs
     int witnessversion;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -114,6 +115,16 @@ struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
+    /**
+     * Legacy SIGHASH_ALL signatures of a transaction with several inputs hash
+     * the same serialization but for the input being signed. vLegacyPrefix[n]
+     * is the hasher state after the inputs before n, vchLegacySuffix the
+     * serialization of all inputs with blank scripts followed by the outputs
+     * and nLockTime. Both are empty for transactions with a single input.
+     */
+    std::vector<CHash256> vLegacyPrefix;
+    std::vector<unsigned char> vchLegacySuffix;
+
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
@@ -12,30 +12,13 @@
 #include "util.h"
 
 #include "cuckoocache.h"
+#include <atomic>
 #include <boost/thread.hpp>
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- *
- * This may exhibit platform endian dependent behavior but because these are
- * nonced hashes (random) and this state is only ever used locally it is safe.
- * All that matters is local consistency.
- */
-class SignatureCacheHasher
-{
-public:
-    template <uint8_t hash_select>
-    uint32_t operator()(const uint256& key) const
-    {
-        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
-        uint32_t u;
-        std::memcpy(&u, key.begin()+4*hash_select, 4);
-        return u;
-    }
-};
+//! Number of separately locked parts of the signature cache
+static const unsigned int SIGNATURE_CACHE_SHARDS = 16;
 
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
@@ -48,11 +31,32 @@ private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+
+    /**
+     * The cache is split by the low bits of the first byte of the entries,
+     * which barely move their cuckoo locations, so that script check threads
+     * looking up signatures seldom wait for an insert. Each part sits on its
+     * own cache lines, and its insert counters are guarded by its lock.
+     */
+    struct alignas(64) Shard {
+        map_type setValid;
+        boost::shared_mutex cs_sigcache;
+        std::atomic<uint64_t> nHits;
+        std::atomic<uint64_t> nMisses;
+        uint64_t nInserts;
+
+        Shard() : nHits(0), nMisses(0), nInserts(0) {}
+    };
+    Shard shards[SIGNATURE_CACHE_SHARDS];
+    size_t nElements;
+
+    Shard& GetShard(const uint256& entry)
+    {
+        return shards[*entry.begin() % SIGNATURE_CACHE_SHARDS];
+    }
 
 public:
-    CSignatureCache()
+    CSignatureCache() : nElements(0)
     {
         GetRandBytes(nonce.begin(), 32);
     }
@@ -66,18 +70,42 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        Shard& shard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        bool fFound = shard.setValid.contains(entry, erase);
+        (fFound ? shard.nHits : shard.nMisses).fetch_add(1, std::memory_order_relaxed);
+        return fFound;
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+        shard.nInserts++;
+        shard.setValid.insert(entry);
     }
     uint32_t setup_bytes(size_t n)
     {
-        return setValid.setup_bytes(n);
+        nElements = 0;
+        for (Shard& shard : shards)
+            nElements += shard.setValid.setup_bytes(n / SIGNATURE_CACHE_SHARDS);
+        return nElements;
+    }
+
+    CSignatureCacheStats GetStats()
+    {
+        CSignatureCacheStats stats;
+        stats.nUsage = nElements * sizeof(uint256);
+        stats.nElements = nElements;
+        stats.nHits = stats.nMisses = stats.nInserts = stats.nEvictions = 0;
+        for (Shard& shard : shards) {
+            boost::shared_lock<boost::shared_mutex> lock(shard.cs_sigcache);
+            stats.nHits += shard.nHits.load(std::memory_order_relaxed);
+            stats.nMisses += shard.nMisses.load(std::memory_order_relaxed);
+            stats.nInserts += shard.nInserts;
+            stats.nEvictions += shard.setValid.evictions();
+        }
+        return stats;
     }
 };
 
@@ -101,15 +129,45 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
 }
 
+CSignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
+static thread_local CPendingSignatures* ppendingSignatures = NULL;
+
+CPendingSignatures::Scope::Scope(CPendingSignatures& pending) : pprev(ppendingSignatures)
+{
+    ppendingSignatures = &pending;
+}
+
+CPendingSignatures::Scope::~Scope()
+{
+    ppendingSignatures = pprev;
+}
+
+CPendingSignatures* CPendingSignatures::Current()
+{
+    return ppendingSignatures;
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
-    if (signatureCache.Get(entry, !store))
+    CPendingSignatures* ppending = ppendingSignatures;
+    if (signatureCache.Get(entry, !store && !ppending))
+        return true;
+    if (ppending && ppending->Contains(entry)) {
+        if (store)
+            signatureCache.Set(entry);
         return true;
+    }
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
     if (store)
         signatureCache.Set(entry);
+    else if (ppending)
+        ppending->Add(entry);
     return true;
 }
@@ -7,7 +7,10 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <cstring>
+#include <set>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -19,6 +22,59 @@ static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin()+4*hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * Signatures of a transaction verified ahead of AcceptToMemoryPool, which are
+ * not stored in the signature cache before it accepts the transaction. While a
+ * Scope is alive on a thread, the caching checkers of the thread keep the
+ * signatures they verify without storing them here, and take the ones here as
+ * verified; a storing check then stores them as usual.
+ */
+class CPendingSignatures
+{
+public:
+    class Scope
+    {
+    public:
+        explicit Scope(CPendingSignatures& pending);
+        ~Scope();
+
+    private:
+        CPendingSignatures* pprev;
+    };
+
+    bool Contains(const uint256& entry) const { return setEntries.count(entry) > 0; }
+    void Add(const uint256& entry) { setEntries.insert(entry); }
+    bool empty() const { return setEntries.empty(); }
+    void clear() { setEntries.clear(); }
+
+    /** The pending signatures of the Scope alive on this thread, NULL if there is none */
+    static CPendingSignatures* Current();
+
+private:
+    std::set<uint256> setEntries;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -30,6 +86,17 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size and counters of the signature cache, reported by getmemoryinfo */
+struct CSignatureCacheStats {
+    size_t nUsage;
+    size_t nElements;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+};
+
 void InitSignatureCache();
+CSignatureCacheStats GetSignatureCacheStats();
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
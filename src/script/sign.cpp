@@ -11,6 +11,7 @@
 #include "primitives/transaction.h"
 #include "script/standard.h"
 #include "uint256.h"
+#include "util.h"
 
 #include "chainparams.h"
 #include "validation.h"
@@ -19,13 +20,16 @@
 #include "base58.h"
 #include "wallet/wallet.h"
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
 typedef std::vector<unsigned char> valtype;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), checker(txTo, nIn, amountIn) {}
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn, const PrecomputedTransactionData* txdataIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(txdataIn),
+    checker(txdataIn ? TransactionSignatureChecker(txTo, nIn, amountIn, *txdataIn) : TransactionSignatureChecker(txTo, nIn, amountIn)) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode, SigVersion sigversion) const
 {
@@ -37,7 +41,7 @@ bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig,
     if (sigversion == SIGVERSION_WITNESS_V0 && !key.IsCompressed())
         return false;
 
-    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion);
+    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, txdata);
     if (!key.Sign(hash, vchSig))
         return false;
     vchSig.push_back((unsigned char)nHashType);
@@ -212,6 +216,33 @@ void UpdateTransaction(CMutableTransaction& tx, unsigned int nIn, const Signatur
     tx.vin[nIn].scriptWitness = data.scriptWitness;
 }
 
+std::vector<bool> ProduceSignatures(const CKeyStore* keystore, const CTransaction& txTo, const std::vector<const CScript*>& vScriptPubKey, const std::vector<CAmount>& vAmount, int nHashType, std::vector<SignatureData>& vSigData)
+{
+    assert(vScriptPubKey.size() == txTo.vin.size() && vAmount.size() == txTo.vin.size());
+    const PrecomputedTransactionData txdata(txTo);
+    vSigData.assign(txTo.vin.size(), SignatureData());
+    // Not a vector<bool>, whose elements the threads could not write apart
+    std::vector<char> vSigned(txTo.vin.size(), 0);
+
+    auto signRange = [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++) {
+            if (vScriptPubKey[n])
+                vSigned[n] = ProduceSignature(TransactionSignatureCreator(keystore, &txTo, n, vAmount[n], nHashType, &txdata), *vScriptPubKey[n], vSigData[n]);
+        }
+    };
+
+    size_t nThreads = std::min<size_t>(std::min(GetNumCores(), MAX_SIGNING_THREADS), txTo.vin.size() / SIGNING_INPUTS_PER_THREAD);
+    if (nThreads < 2) {
+        signRange(0, txTo.vin.size());
+    } else {
+        boost::thread_group threadGroup;
+        for (size_t i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind<void>(signRange, txTo.vin.size() * i / nThreads, txTo.vin.size() * (i + 1) / nThreads));
+        threadGroup.join_all();
+    }
+    return std::vector<bool>(vSigned.begin(), vSigned.end());
+}
+
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CAmount& amount, int nHashType)
 {
     assert(nIn < txTo.vin.size());
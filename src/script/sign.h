@@ -36,10 +36,12 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     int nHashType;
     CAmount amount;
+    const PrecomputedTransactionData* txdata;
     const TransactionSignatureChecker checker;
 
 public:
-    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL);
+    /** txdataIn, when given, holds the sighash midstates of txTo shared by the signatures of all its inputs */
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL, const PrecomputedTransactionData* txdataIn=NULL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode, SigVersion sigversion) const;
 };
@@ -70,6 +72,19 @@ struct SignatureData {
 /** Produce a script signature using a generic signature creator. */
 bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata);
 
+/** Inputs past which ProduceSignatures signs on several threads, and the most threads it uses */
+static const size_t SIGNING_INPUTS_PER_THREAD = 16;
+static const int MAX_SIGNING_THREADS = 8;
+
+/**
+ * Produce the script signatures of the inputs of txTo at once, input n
+ * spending vScriptPubKey[n] of vAmount[n] into vSigData[n]. A NULL script
+ * skips the input. The inputs are independent, so those of a wide
+ * transaction are split between threads, and they share the sighash
+ * midstates of txTo. Returns whether each input was signed.
+ */
+std::vector<bool> ProduceSignatures(const CKeyStore* keystore, const CTransaction& txTo, const std::vector<const CScript*>& vScriptPubKey, const std::vector<CAmount>& vAmount, int nHashType, std::vector<SignatureData>& vSigData);
+
 /** Produce a script signature for a transaction. */
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CAmount& amount, int nHashType);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType);
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string>
 #include <string.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include "uint256.h"
@@ -203,7 +204,7 @@ template<typename Stream> inline void Unserialize(Stream& s, int32_t& a ) { a =
 template<typename Stream> inline void Unserialize(Stream& s, uint32_t& a) { a = ser_readdata32(s); }
 template<typename Stream> inline void Unserialize(Stream& s, int64_t& a ) { a = ser_readdata64(s); }
 template<typename Stream> inline void Unserialize(Stream& s, uint64_t& a) { a = ser_readdata64(s); }
-template<typename Stream> inline void Unserialize(Stream& s, uint160 a)   { a.Unserialize(s); }
+template<typename Stream> inline void Unserialize(Stream& s, uint160& a)  { a.Unserialize(s); }
 template<typename Stream> inline void Unserialize(Stream& s, float& a   ) { a = ser_uint32_to_float(ser_readdata32(s)); }
 template<typename Stream> inline void Unserialize(Stream& s, double& a  ) { a = ser_uint64_to_double(ser_readdata64(s)); }
 
@@ -518,6 +519,12 @@ template<typename Stream, typename K, typename T> void Unserialize(Stream& is, s
 template<typename Stream, typename K, typename T, typename Pred, typename A> void Serialize(Stream& os, const std::map<K, T, Pred, A>& m);
 template<typename Stream, typename K, typename T, typename Pred, typename A> void Unserialize(Stream& is, std::map<K, T, Pred, A>& m);
 
+/**
+ * unordered_map
+ */
+template<typename Stream, typename K, typename T, typename H, typename Eq, typename A> void Serialize(Stream& os, const std::unordered_map<K, T, H, Eq, A>& m);
+template<typename Stream, typename K, typename T, typename H, typename Eq, typename A> void Unserialize(Stream& is, std::unordered_map<K, T, H, Eq, A>& m);
+
 /**
  * set
  */
@@ -761,6 +768,32 @@ void Unserialize(Stream& is, std::map<K, T, Pred, A>& m)
 
 
 
+/**
+ * unordered_map
+ */
+template<typename Stream, typename K, typename T, typename H, typename Eq, typename A>
+void Serialize(Stream& os, const std::unordered_map<K, T, H, Eq, A>& m)
+{
+    WriteCompactSize(os, m.size());
+    for (typename std::unordered_map<K, T, H, Eq, A>::const_iterator mi = m.begin(); mi != m.end(); ++mi)
+        Serialize(os, (*mi));
+}
+
+template<typename Stream, typename K, typename T, typename H, typename Eq, typename A>
+void Unserialize(Stream& is, std::unordered_map<K, T, H, Eq, A>& m)
+{
+    m.clear();
+    unsigned int nSize = ReadCompactSize(is);
+    m.reserve(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+    {
+        std::pair<K, T> item;
+        Unserialize(is, item);
+        m.insert(item);
+    }
+}
+
+
 /**
  * set
  */
@@ -972,4 +1005,13 @@ size_t GetSerializeSize(const S& s, const T& t)
     return (CSizeComputer(s.GetType(), s.GetVersion()) << t).size();
 }
 
+/** The size of the objects serialized one after the other, to reserve a buffer up front */
+template <typename... T>
+size_t GetSerializeSizeMany(int nType, int nVersion, const T&... t)
+{
+    CSizeComputer sc(nType, nVersion);
+    ::SerializeMany(sc, t...);
+    return sc.size();
+}
+
 #endif // BITCOIN_SERIALIZE_H
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "hash.h"
+#include "util.h"
+
+#include <string.h>
+
+CSnapshotWriter::CSnapshotWriter(FILE* fileIn, int nTypeIn, int nVersionIn) :
+    file(fileIn, nTypeIn, nVersionIn), nType(nTypeIn), nVersion(nVersionIn), nFileSize(0)
+{
+    vChunk.reserve(SNAPSHOT_CHUNK_SIZE);
+}
+
+void CSnapshotWriter::write(const char* pch, size_t nSize)
+{
+    while (nSize > 0) {
+        size_t nCopy = std::min(nSize, SNAPSHOT_CHUNK_SIZE - vChunk.size());
+        vChunk.insert(vChunk.end(), pch, pch + nCopy);
+        pch += nCopy;
+        nSize -= nCopy;
+        if (vChunk.size() == SNAPSHOT_CHUNK_SIZE)
+            WriteChunk();
+    }
+}
+
+void CSnapshotWriter::WriteChunk()
+{
+    hashChain = Hash(hashChain.begin(), hashChain.end(), vChunk.begin(), vChunk.end());
+    file << vChunk << hashChain;
+    nFileSize += GetSizeOfCompactSize(vChunk.size()) + vChunk.size() + sizeof(hashChain);
+    vChunk.clear();
+}
+
+uint256 CSnapshotWriter::Finish()
+{
+    if (!vChunk.empty())
+        WriteChunk();
+    // The empty chunk that ends the snapshot
+    WriteChunk();
+    FileCommit(file.Get());
+    file.fclose();
+    return hashChain;
+}
+
+CSnapshotReader::CSnapshotReader(FILE* fileIn, int nTypeIn, int nVersionIn) :
+    file(fileIn, nTypeIn, nVersionIn), nType(nTypeIn), nVersion(nVersionIn), nChunkPos(0), fEnd(false)
+{
+}
+
+void CSnapshotReader::ReadChunk()
+{
+    if (fEnd)
+        throw std::ios_base::failure("CSnapshotReader::read(): end of snapshot");
+
+    uint256 hash;
+    file >> vChunk >> hash;
+    if (vChunk.size() > SNAPSHOT_CHUNK_SIZE)
+        throw std::ios_base::failure("CSnapshotReader::read(): chunk too large");
+    uint256 hashExpected = Hash(hashChain.begin(), hashChain.end(), vChunk.begin(), vChunk.end());
+    if (hash != hashExpected)
+        throw std::ios_base::failure("CSnapshotReader::read(): chunk hash mismatch");
+    hashChain = hash;
+    nChunkPos = 0;
+    fEnd = vChunk.empty();
+}
+
+void CSnapshotReader::read(char* pch, size_t nSize)
+{
+    while (nSize > 0) {
+        if (nChunkPos == vChunk.size())
+            ReadChunk();
+        size_t nCopy = std::min(nSize, vChunk.size() - nChunkPos);
+        memcpy(pch, vChunk.data() + nChunkPos, nCopy);
+        nChunkPos += nCopy;
+        pch += nCopy;
+        nSize -= nCopy;
+    }
+}
+
+void CSnapshotReader::ignore(size_t nSize)
+{
+    while (nSize > 0) {
+        if (nChunkPos == vChunk.size())
+            ReadChunk();
+        size_t nSkip = std::min(nSize, vChunk.size() - nChunkPos);
+        nChunkPos += nSkip;
+        nSize -= nSkip;
+    }
+}
+
+uint256 CSnapshotReader::Finish()
+{
+    if (nChunkPos != vChunk.size())
+        throw std::ios_base::failure("CSnapshotReader::Finish(): data after the last record");
+    if (!fEnd)
+        ReadChunk();
+    if (!fEnd)
+        throw std::ios_base::failure("CSnapshotReader::Finish(): data after the last record");
+    return hashChain;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SNAPSHOT_H
+#define BITCOIN_SNAPSHOT_H
+
+#include "serialize.h"
+#include "streams.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/** Identifies a state snapshot file, "LBSS" */
+static const uint32_t SNAPSHOT_MAGIC = 0x5353424c;
+/** Version 2 ends the vote state with the commitment to it */
+static const int SNAPSHOT_VERSION = 2;
+/** Serialized bytes collected before a chunk is hashed and written out */
+static const size_t SNAPSHOT_CHUNK_SIZE = 1 << 20;
+
+/**
+ * A state snapshot is a stream of serialized records, cut into chunks of
+ * about SNAPSHOT_CHUNK_SIZE bytes. Each chunk is written as its bytes,
+ * length prefixed, followed by the double SHA-256 of the hash of the chunk
+ * before it and its bytes. An empty chunk ends the file. The hash of that
+ * last chunk thus commits to the whole snapshot, and a reader checks every
+ * chunk as it comes in, before any of its records are used.
+ *
+ * Records may span chunks; the two classes below are plain serialization
+ * streams that hide the chunking.
+ */
+class CSnapshotWriter
+{
+public:
+    /** Takes over fileIn and closes it when destroyed */
+    CSnapshotWriter(FILE* fileIn, int nTypeIn, int nVersionIn);
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    void write(const char* pch, size_t nSize);
+
+    template<typename T>
+    CSnapshotWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+
+    /** Write out the last chunk and the end of the snapshot, sync the file and return the hash of the snapshot */
+    uint256 Finish();
+    /** Bytes written to the file so far */
+    uint64_t GetFileSize() const { return nFileSize; }
+
+private:
+    CAutoFile file;
+    const int nType;
+    const int nVersion;
+    std::vector<char> vChunk;
+    uint256 hashChain;
+    uint64_t nFileSize;
+
+    void WriteChunk();
+};
+
+class CSnapshotReader
+{
+public:
+    /** Takes over fileIn and closes it when destroyed */
+    CSnapshotReader(FILE* fileIn, int nTypeIn, int nVersionIn);
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    /** Throws std::ios_base::failure when the file ends early or a chunk does not match its hash */
+    void read(char* pch, size_t nSize);
+    void ignore(size_t nSize);
+
+    template<typename T>
+    CSnapshotReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return *this;
+    }
+
+    /**
+     * Read the end of the snapshot after its last record and return its hash.
+     * Throws when there is anything else first.
+     */
+    uint256 Finish();
+
+private:
+    CAutoFile file;
+    const int nType;
+    const int nVersion;
+    std::vector<char> vChunk;
+    size_t nChunkPos;
+    uint256 hashChain;
+    bool fEnd;
+
+    void ReadChunk();
+};
+
+#endif // BITCOIN_SNAPSHOT_H
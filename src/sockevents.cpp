@@ -0,0 +1,251 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sockevents.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#if defined(__linux__)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define USE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#elif !defined(WIN32)
+#define USE_POLL
+#include <poll.h>
+#endif
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//! Tag of the wakeup pipe
+static const int64_t WAKEUP_TAG = -1;
+
+CSocketEvents::CSocketEvents() : fdEvents(-1)
+{
+    fdWakeup[0] = fdWakeup[1] = -1;
+#ifndef WIN32
+    if (pipe(fdWakeup) == 0) {
+        for (int i = 0; i < 2; i++)
+            fcntl(fdWakeup[i], F_SETFL, fcntl(fdWakeup[i], F_GETFL, 0) | O_NONBLOCK);
+    } else {
+        fdWakeup[0] = fdWakeup[1] = -1;
+    }
+#endif
+#if defined(USE_EPOLL)
+    fdEvents = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(USE_KQUEUE)
+    fdEvents = kqueue();
+#endif
+    if (fdWakeup[0] != -1)
+        Set(fdWakeup[0], WAKEUP_TAG, EVENT_RECV);
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifndef WIN32
+    if (fdEvents != -1)
+        close(fdEvents);
+    for (int i = 0; i < 2; i++) {
+        if (fdWakeup[i] != -1)
+            close(fdWakeup[i]);
+    }
+#endif
+}
+
+const char* CSocketEvents::GetBackendName()
+{
+#if defined(USE_EPOLL)
+    return "epoll";
+#elif defined(USE_KQUEUE)
+    return "kqueue";
+#elif defined(USE_POLL)
+    return "poll";
+#else
+    return "select";
+#endif
+}
+
+bool CSocketEvents::CanWakeup() const
+{
+    return fdWakeup[0] != -1;
+}
+
+void CSocketEvents::Set(SOCKET hSocket, int64_t nTag, int nEvents)
+{
+    std::map<SOCKET, Registration>::iterator it = mapSockets.find(hSocket);
+    bool fNew = it == mapSockets.end() || it->second.nTag != nTag;
+    if (!fNew && it->second.nEvents == nEvents)
+        return;
+
+#if defined(USE_EPOLL)
+    struct epoll_event event;
+    event.events = ((nEvents & EVENT_RECV) ? (uint32_t)EPOLLIN : 0) | ((nEvents & EVENT_SEND) ? (uint32_t)EPOLLOUT : 0);
+    event.data.u64 = (uint64_t)nTag;
+    // A descriptor closed elsewhere has left the epoll set already, so a new owner has to add it again
+    if (it == mapSockets.end() || epoll_ctl(fdEvents, EPOLL_CTL_MOD, hSocket, &event) != 0)
+        epoll_ctl(fdEvents, EPOLL_CTL_ADD, hSocket, &event);
+#elif defined(USE_KQUEUE)
+    struct kevent changes[2];
+    EV_SET(&changes[0], hSocket, EVFILT_READ, EV_ADD | ((nEvents & EVENT_RECV) ? EV_ENABLE : EV_DISABLE), 0, 0, (void*)(intptr_t)nTag);
+    EV_SET(&changes[1], hSocket, EVFILT_WRITE, EV_ADD | ((nEvents & EVENT_SEND) ? EV_ENABLE : EV_DISABLE), 0, 0, (void*)(intptr_t)nTag);
+    kevent(fdEvents, changes, 2, NULL, 0, NULL);
+#endif
+
+    Registration& reg = mapSockets[hSocket];
+    reg.nTag = nTag;
+    reg.nEvents = nEvents;
+}
+
+void CSocketEvents::Remove(SOCKET hSocket, int64_t nTag)
+{
+    std::map<SOCKET, Registration>::iterator it = mapSockets.find(hSocket);
+    if (it == mapSockets.end() || it->second.nTag != nTag)
+        return;
+    mapSockets.erase(it);
+
+    // These fail harmlessly if the socket is closed already, which removed it
+#if defined(USE_EPOLL)
+    struct epoll_event event;
+    epoll_ctl(fdEvents, EPOLL_CTL_DEL, hSocket, &event);
+#elif defined(USE_KQUEUE)
+    struct kevent changes[2];
+    EV_SET(&changes[0], hSocket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], hSocket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(fdEvents, changes, 2, NULL, 0, NULL);
+#endif
+}
+
+void CSocketEvents::Wakeup()
+{
+#ifndef WIN32
+    if (fdWakeup[1] != -1) {
+        char c = 0;
+        // A full pipe means a wakeup is pending already
+        if (write(fdWakeup[1], &c, 1) < 0) {}
+    }
+#endif
+}
+
+bool CSocketEvents::Wait(int nTimeoutMs, std::vector<std::pair<int64_t, int> >& vReady)
+{
+    vReady.clear();
+
+#if defined(USE_EPOLL)
+    std::vector<struct epoll_event> vEvents(std::max<size_t>(mapSockets.size(), 1));
+    int nReady = epoll_wait(fdEvents, vEvents.data(), vEvents.size(), nTimeoutMs);
+    if (nReady < 0)
+        return errno == EINTR;
+    for (int i = 0; i < nReady; i++) {
+        int nEvents = 0;
+        if (vEvents[i].events & EPOLLIN)
+            nEvents |= EVENT_RECV;
+        if (vEvents[i].events & EPOLLOUT)
+            nEvents |= EVENT_SEND;
+        if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+            nEvents |= EVENT_ERROR;
+        vReady.push_back(std::make_pair((int64_t)vEvents[i].data.u64, nEvents));
+    }
+#elif defined(USE_KQUEUE)
+    std::vector<struct kevent> vEvents(std::max<size_t>(2 * mapSockets.size(), 1));
+    struct timespec timeout;
+    timeout.tv_sec = nTimeoutMs / 1000;
+    timeout.tv_nsec = (nTimeoutMs % 1000) * 1000000;
+    int nReady = kevent(fdEvents, NULL, 0, vEvents.data(), vEvents.size(), &timeout);
+    if (nReady < 0)
+        return errno == EINTR;
+    for (int i = 0; i < nReady; i++) {
+        int nEvents = vEvents[i].filter == EVFILT_READ ? EVENT_RECV : EVENT_SEND;
+        if (vEvents[i].flags & (EV_EOF | EV_ERROR))
+            nEvents |= EVENT_ERROR;
+        vReady.push_back(std::make_pair((int64_t)(intptr_t)vEvents[i].udata, nEvents));
+    }
+#elif defined(USE_POLL)
+    std::vector<struct pollfd> vPoll;
+    std::vector<int64_t> vTags;
+    vPoll.reserve(mapSockets.size());
+    vTags.reserve(mapSockets.size());
+    for (const std::pair<SOCKET, Registration>& item : mapSockets) {
+        struct pollfd pfd;
+        pfd.fd = item.first;
+        pfd.events = ((item.second.nEvents & EVENT_RECV) ? POLLIN : 0) | ((item.second.nEvents & EVENT_SEND) ? POLLOUT : 0);
+        pfd.revents = 0;
+        vPoll.push_back(pfd);
+        vTags.push_back(item.second.nTag);
+    }
+    int nReady = poll(vPoll.data(), vPoll.size(), nTimeoutMs);
+    if (nReady < 0)
+        return errno == EINTR;
+    for (size_t i = 0; i < vPoll.size() && nReady > 0; i++) {
+        if (vPoll[i].revents == 0)
+            continue;
+        nReady--;
+        int nEvents = 0;
+        if (vPoll[i].revents & POLLIN)
+            nEvents |= EVENT_RECV;
+        if (vPoll[i].revents & POLLOUT)
+            nEvents |= EVENT_SEND;
+        if (vPoll[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+            nEvents |= EVENT_ERROR;
+        vReady.push_back(std::make_pair(vTags[i], nEvents));
+    }
+#else
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    for (const std::pair<SOCKET, Registration>& item : mapSockets) {
+        FD_SET(item.first, &fdsetError);
+        if (item.second.nEvents & EVENT_RECV)
+            FD_SET(item.first, &fdsetRecv);
+        if (item.second.nEvents & EVENT_SEND)
+            FD_SET(item.first, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, item.first);
+    }
+    struct timeval timeout;
+    timeout.tv_sec = nTimeoutMs / 1000;
+    timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+    if (mapSockets.empty()) {
+        // select() without sockets fails on Windows
+        MilliSleep(nTimeoutMs);
+        return true;
+    }
+    int nReady = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nReady == SOCKET_ERROR)
+        return false;
+    for (const std::pair<SOCKET, Registration>& item : mapSockets) {
+        int nEvents = 0;
+        if (FD_ISSET(item.first, &fdsetRecv))
+            nEvents |= EVENT_RECV;
+        if (FD_ISSET(item.first, &fdsetSend))
+            nEvents |= EVENT_SEND;
+        if (FD_ISSET(item.first, &fdsetError))
+            nEvents |= EVENT_ERROR;
+        if (nEvents)
+            vReady.push_back(std::make_pair(item.second.nTag, nEvents));
+    }
+#endif
+
+    // Drain the wakeup pipe and keep it out of the results
+    for (size_t i = 0; i < vReady.size(); i++) {
+        if (vReady[i].first != WAKEUP_TAG)
+            continue;
+#ifndef WIN32
+        char buf[64];
+        while (read(fdWakeup[0], buf, sizeof(buf)) > 0) {}
+#endif
+        vReady.erase(vReady.begin() + i);
+        break;
+    }
+    return true;
+}
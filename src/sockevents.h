@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKEVENTS_H
+#define BITCOIN_SOCKEVENTS_H
+
+#include "compat.h"
+
+#include <map>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Readiness of the sockets of CConnman::ThreadSocketHandler. The backend is
+ * epoll on Linux, kqueue on the BSDs and macOS, poll on other Unix systems
+ * and select on Windows. The caller registers the events it waits for on
+ * each socket and only pays a system call when they change, and a wait
+ * costs the number of ready sockets instead of the highest descriptor.
+ *
+ * Each socket is registered with a tag that is reported back with its
+ * events. A socket closed elsewhere may have its descriptor reused before
+ * it is removed here, so Set takes a descriptor over for a new tag and
+ * Remove leaves it alone unless the tag still matches.
+ *
+ * Readiness is level-triggered: a socket that is left with data to read,
+ * because its peer's receive queue is full, is simply not waited for until
+ * it may be read again.
+ */
+class CSocketEvents
+{
+public:
+    static const int EVENT_RECV = 1;
+    static const int EVENT_SEND = 2;
+    static const int EVENT_ERROR = 4;
+
+    CSocketEvents();
+    ~CSocketEvents();
+
+    /** Wait for nEvents, possibly none, on hSocket. Errors and hangups are always reported. Tag -1 is reserved. */
+    void Set(SOCKET hSocket, int64_t nTag, int nEvents);
+    /** Stop waiting on hSocket, if it is still registered with nTag */
+    void Remove(SOCKET hSocket, int64_t nTag);
+
+    /**
+     * Wait up to nTimeoutMs for events or a Wakeup. The tags of the ready
+     * sockets and their events go to vReady. Returns false on an error.
+     */
+    bool Wait(int nTimeoutMs, std::vector<std::pair<int64_t, int> >& vReady);
+
+    /** Make the current or next Wait return right away. Does nothing with select. */
+    void Wakeup();
+
+    /** Whether Wakeup works, so a Wait does not have to be short to notice new work */
+    bool CanWakeup() const;
+
+    static const char* GetBackendName();
+
+private:
+    CSocketEvents(const CSocketEvents&) = delete;
+    CSocketEvents& operator=(const CSocketEvents&) = delete;
+
+    struct Registration {
+        int64_t nTag;
+        int nEvents;
+    };
+
+    //! Sockets registered, only touched by the thread that waits
+    std::map<SOCKET, Registration> mapSockets;
+    //! epoll or kqueue descriptor
+    int fdEvents;
+    //! Both ends of the pipe Wakeup writes to
+    int fdWakeup[2];
+};
+
+#endif // BITCOIN_SOCKEVENTS_H
@@ -138,6 +138,59 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from a byte range owned by someone else, such as
+ * a memory mapped file, without copying it into a buffer first
+ *
+ * The range must stay valid while the stream is used
+ */
+class CSpanReader
+{
+ public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, const char* pendIn) : nType(nTypeIn), nVersion(nVersionIn), pcur(pbeginIn), pend(pendIn) {}
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pcur += nSize;
+    }
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    size_t size() const
+    {
+        return pend - pcur;
+    }
+    bool empty() const
+    {
+        return pcur == pend;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const char* pcur;
+    const char* pend;
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -208,6 +261,13 @@ public:
         nVersion = nVersionIn;
     }
 
+    /** Exchange the stream's buffer with vchOther, keeping both allocations, and read from the start */
+    void SwapData(vector_type& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
+
     CDataStream& operator+=(const CDataStream& b)
     {
         vch.insert(vch.end(), b.begin(), b.end());
@@ -0,0 +1,219 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include "support/arena.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource for node based containers such as the coins cache map.
+ *
+ * Memory is taken from the system in chunks of a fixed size, and blocks of up
+ * to MAX_BLOCK_SIZE_BYTES are carved out of the current chunk. A freed block
+ * goes onto a free list for its size and is handed out again by the next
+ * allocation of the same size, so a container that keeps inserting and erasing
+ * nodes does not go back to malloc at all. The chunks themselves are only
+ * released when the resource is destroyed, which frees the whole container in
+ * a few calls instead of one per node.
+ *
+ * Allocations that are too big or too strictly aligned for the free lists
+ * (such as the bucket array of a hash map) are passed on to operator new.
+ *
+ * Since the resource owns all node memory, its usage is simply the number of
+ * chunks times the chunk size; no per-node estimate is needed.
+ *
+ * Given a CMemoryArena, the chunks are taken from it, which counts them for
+ * its subsystem and may back them with huge pages.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    /** In-place linked list of free blocks, stored inside the free blocks themselves */
+    struct ListNode {
+        ListNode* m_next;
+
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+
+    /** Blocks are a multiple of this size and aligned to it, big enough to hold a ListNode */
+    static const std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "Units of size ELEM_ALIGN_BYTES need to be able to store a ListNode");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "Chunks from operator new must be aligned to ELEM_ALIGN_BYTES");
+    static_assert(MAX_BLOCK_SIZE_BYTES % ELEM_ALIGN_BYTES == 0, "MAX_BLOCK_SIZE_BYTES needs to be a multiple of the alignment");
+
+    /** Size of the chunks taken from the system */
+    const std::size_t m_chunk_size_bytes;
+
+    /** Where the chunks come from, operator new if null */
+    CMemoryArena* const m_arena;
+
+    /** Every chunk taken from the system, released in the destructor */
+    std::vector<char*> m_allocated_chunks;
+
+    /** One free list per block size, indexed by the size in units of ELEM_ALIGN_BYTES */
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+
+    /** The part of the newest chunk that has not been handed out yet */
+    char* m_available_memory_it;
+    char* m_available_memory_end;
+
+    /** Number of ELEM_ALIGN_BYTES units needed for a block of the given size; never zero. */
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlaceInFreeList(ListNode*& node, void* p)
+    {
+        node = new (p) ListNode(node);
+    }
+
+    /** Start a new chunk. The unused tail of the current one is kept on the free lists. */
+    void AllocateChunk()
+    {
+        if (m_available_memory_it != m_available_memory_end) {
+            const std::size_t remaining_units = (m_available_memory_end - m_available_memory_it) / ELEM_ALIGN_BYTES;
+            PlaceInFreeList(m_free_lists[remaining_units], m_available_memory_it);
+        }
+
+        char* chunk = static_cast<char*>(m_arena ? m_arena->AllocateChunk(m_chunk_size_bytes) : ::operator new(m_chunk_size_bytes));
+        m_allocated_chunks.push_back(chunk);
+        m_available_memory_it = chunk;
+        m_available_memory_end = chunk + m_chunk_size_bytes;
+    }
+
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE_BYTES = 262144;
+
+    /** Construct a resource that takes memory from arena, or the system if null, in chunks of chunk_size_bytes. */
+    explicit PoolResource(std::size_t chunk_size_bytes, CMemoryArena* arena = nullptr)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES), m_arena(arena),
+          m_available_memory_it(nullptr), m_available_memory_end(nullptr)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+    }
+
+    /** Construct a resource with 256 KiB chunks. */
+    PoolResource() : PoolResource(DEFAULT_CHUNK_SIZE_BYTES) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    /** Release all chunks. Blocks that are still in use become invalid. */
+    ~PoolResource()
+    {
+        for (char* chunk : m_allocated_chunks) {
+            if (m_arena)
+                m_arena->FreeChunk(chunk, m_chunk_size_bytes);
+            else
+                ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            return ::operator new(bytes);
+        }
+
+        const std::size_t num_units = NumElemAlignBytes(bytes);
+        if (m_free_lists[num_units] != nullptr) {
+            ListNode* node = m_free_lists[num_units];
+            m_free_lists[num_units] = node->m_next;
+            return node;
+        }
+
+        if (static_cast<std::size_t>(m_available_memory_end - m_available_memory_it) < num_units * ELEM_ALIGN_BYTES) {
+            AllocateChunk();
+        }
+        void* p = m_available_memory_it;
+        m_available_memory_it += num_units * ELEM_ALIGN_BYTES;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PlaceInFreeList(m_free_lists[NumElemAlignBytes(bytes)], p);
+    }
+
+    /** Number of chunks taken from the system so far */
+    std::size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+
+    /** Size of a single chunk */
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+/**
+ * Allocator that hands out the memory of a PoolResource. The resource must
+ * outlive every container using it; copies of an allocator share the
+ * resource of the original.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(void*)>
+class PoolAllocator
+{
+    PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* m_resource;
+
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    /** Not explicit, so a container can be constructed straight from its resource. */
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource())
+    {
+    }
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,155 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "support/arena.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+
+#ifdef USE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#ifndef WIN32
+#include <sys/mman.h> // for madvise
+#endif
+
+static std::mutex csArenas;
+static std::vector<CMemoryArena*>* pvArenas = nullptr;
+
+CMemoryArena::CMemoryArena(const std::string& strNameIn) : strName(strNameIn), fHugePages(false), nChunks(0), nBytes(0), nPeakBytes(0)
+{
+    std::lock_guard<std::mutex> lock(csArenas);
+    if (!pvArenas)
+        pvArenas = new std::vector<CMemoryArena*>();
+    pvArenas->push_back(this);
+}
+
+CMemoryArena::~CMemoryArena()
+{
+    std::lock_guard<std::mutex> lock(csArenas);
+    pvArenas->erase(std::remove(pvArenas->begin(), pvArenas->end(), this), pvArenas->end());
+}
+
+size_t CMemoryArena::ChunkSize(size_t nBytesIn) const
+{
+    if (!fHugePages)
+        return nBytesIn;
+    return (nBytesIn + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+void* CMemoryArena::AllocateChunk(size_t nBytesIn)
+{
+    void* p = nullptr;
+#ifndef WIN32
+    // Always from posix_memalign, so FreeChunk frees the same way whether huge pages were on
+    bool fHuge = fHugePages && nBytesIn % HUGE_PAGE_SIZE == 0;
+    if (posix_memalign(&p, fHuge ? HUGE_PAGE_SIZE : alignof(std::max_align_t), nBytesIn) != 0)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    // Only advice, a kernel without transparent huge pages backs the chunk with normal ones
+    if (fHuge)
+        madvise(p, nBytesIn, MADV_HUGEPAGE);
+#endif
+#else
+    p = malloc(nBytesIn);
+    if (!p)
+        throw std::bad_alloc();
+#endif
+    nChunks++;
+    size_t nNow = nBytes += nBytesIn;
+    size_t nPeak = nPeakBytes;
+    while (nNow > nPeak && !nPeakBytes.compare_exchange_weak(nPeak, nNow)) {}
+    return p;
+}
+
+void CMemoryArena::FreeChunk(void* p, size_t nBytesIn)
+{
+    free(p);
+    nChunks--;
+    nBytes -= nBytesIn;
+}
+
+CMemoryArena::Stats CMemoryArena::GetStats() const
+{
+    Stats stats;
+    stats.nChunks = nChunks;
+    stats.nBytes = nBytes;
+    stats.nPeakBytes = nPeakBytes;
+    stats.fHugePages = fHugePages;
+    return stats;
+}
+
+CMemoryArena& CoinsCacheArena()
+{
+    static CMemoryArena* parena = new CMemoryArena("coinscache");
+    return *parena;
+}
+
+CMemoryArena& MempoolArena()
+{
+    static CMemoryArena* parena = new CMemoryArena("mempool");
+    return *parena;
+}
+
+CMemoryArena& BlockIndexArena()
+{
+    static CMemoryArena* parena = new CMemoryArena("blockindex");
+    return *parena;
+}
+
+std::vector<CMemoryArena*> GetMemoryArenas()
+{
+    // Make the three of them, so they are listed before they are first used
+    CoinsCacheArena();
+    MempoolArena();
+    BlockIndexArena();
+    std::lock_guard<std::mutex> lock(csArenas);
+    return *pvArenas;
+}
+
+bool GetHeapStats(CHeapStats& stats)
+{
+#ifdef USE_JEMALLOC
+    // The statistics are a snapshot taken at each new epoch
+    uint64_t nEpoch = 1;
+    size_t nSize = sizeof(nEpoch);
+    mallctl("epoch", &nEpoch, &nSize, &nEpoch, nSize);
+    nSize = sizeof(size_t);
+    stats.strAllocator = "jemalloc";
+    return mallctl("stats.allocated", &stats.nAllocated, &nSize, NULL, 0) == 0 &&
+           mallctl("stats.resident", &stats.nResident, &nSize, NULL, 0) == 0;
+#elif defined(__GLIBC__)
+    stats.strAllocator = "glibc";
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    // Fields of int, which wrap past 2 GB
+    struct mallinfo info = mallinfo();
+#endif
+    stats.nAllocated = (size_t)info.uordblks + (size_t)info.hblkhd;
+    stats.nResident = (size_t)info.arena + (size_t)info.hblkhd;
+    return true;
+#else
+    stats.strAllocator = "system";
+    return false;
+#endif
+}
+
+bool SetMallocArenas(int nArenas)
+{
+#if defined(HAVE_MALLOPT_ARENA_MAX) && !defined(USE_JEMALLOC)
+    return mallopt(M_ARENA_MAX, nArenas) == 1;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ARENA_H
+#define BITCOIN_SUPPORT_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/** Default for -hugepages */
+static const bool DEFAULT_HUGE_PAGES = false;
+/** Size of the transparent huge pages of x86-64 and arm64 Linux */
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * The chunks of memory one subsystem, such as the coins cache or the block
+ * index, takes from the heap for its own allocator. They are counted apart,
+ * so getmemoryinfo tells what each subsystem holds, free nodes included,
+ * from the heap as a whole.
+ *
+ * With huge pages enabled, chunks that are a multiple of HUGE_PAGE_SIZE are
+ * aligned to it and the kernel is asked to back them with transparent huge
+ * pages, which saves TLB misses on the lookups spread over a large cache.
+ *
+ * The arenas of the subsystems are never destroyed, as containers freed at
+ * exit still give their chunks back to them.
+ */
+class CMemoryArena
+{
+public:
+    struct Stats {
+        size_t nChunks;
+        size_t nBytes;
+        size_t nPeakBytes;
+        bool fHugePages;
+    };
+
+    explicit CMemoryArena(const std::string& strNameIn);
+    ~CMemoryArena();
+    CMemoryArena(const CMemoryArena&) = delete;
+    CMemoryArena& operator=(const CMemoryArena&) = delete;
+
+    /** The size to make the chunks of a resource that would take nBytes: whole huge pages when they are enabled */
+    size_t ChunkSize(size_t nBytes) const;
+
+    /** Throws std::bad_alloc like operator new */
+    void* AllocateChunk(size_t nBytes);
+    void FreeChunk(void* p, size_t nBytes);
+
+    void SetHugePages(bool fEnable) { fHugePages = fEnable; }
+    const std::string& GetName() const { return strName; }
+    Stats GetStats() const;
+
+private:
+    const std::string strName;
+    std::atomic<bool> fHugePages;
+    std::atomic<size_t> nChunks;
+    std::atomic<size_t> nBytes;
+    std::atomic<size_t> nPeakBytes;
+};
+
+/** The arenas of the nodes of the coins caches, of the mempool and of the block index entries */
+CMemoryArena& CoinsCacheArena();
+CMemoryArena& MempoolArena();
+CMemoryArena& BlockIndexArena();
+std::vector<CMemoryArena*> GetMemoryArenas();
+
+/** What the heap allocator the node is linked with reports, beyond the arenas */
+struct CHeapStats {
+    std::string strAllocator;
+    //! Bytes handed out to the program, arenas included
+    size_t nAllocated;
+    //! Bytes the allocator holds in memory, those handed out and those freed but kept
+    size_t nResident;
+};
+
+/** False if the allocator gives no statistics */
+bool GetHeapStats(CHeapStats& stats);
+
+/** Limit the heaps glibc keeps, up to eight per core by default, which is most of the fragmentation of a long running node */
+bool SetMallocArenas(int nArenas);
+
+#endif // BITCOIN_SUPPORT_ARENA_H
@@ -9,9 +9,106 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <map>
+
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+int nLockStatsSample = DEFAULT_LOCKSTATS_SAMPLE;
+
+CLockTimeStats::CLockTimeStats() : nCount(0), nTotal(0), nMax(0)
+{
+    std::fill(vBuckets, vBuckets + LOCKSTATS_BUCKETS, 0);
+}
+
+void CLockTimeStats::Add(int64_t nTime)
+{
+    nTime = std::max<int64_t>(nTime, 0);
+    int nBucket = 0;
+    while (nBucket < LOCKSTATS_BUCKETS - 1 && (nTime >> nBucket) > 0)
+        nBucket++;
+    vBuckets[nBucket]++;
+    nCount++;
+    nTotal += nTime;
+    nMax = std::max(nMax, nTime);
+}
+
+void CLockTimeStats::Merge(const CLockTimeStats& other)
+{
+    for (int i = 0; i < LOCKSTATS_BUCKETS; i++)
+        vBuckets[i] += other.vBuckets[i];
+    nCount += other.nCount;
+    nTotal += other.nTotal;
+    nMax = std::max(nMax, other.nMax);
+}
+
+namespace {
+struct LockStatsData {
+    // Not a CCriticalSection, which would profile itself
+    boost::mutex mutex;
+    //! by the file and line strings of the LOCK, which stay put
+    std::map<std::pair<const char*, int>, CLockSiteStats> mapSites;
+};
+
+LockStatsData& GetLockStatsData()
+{
+    // Never destroyed, as locks may still be taken during static destruction
+    static LockStatsData* data = new LockStatsData();
+    return *data;
+}
+} // namespace
+
+bool LockStatsSampleNext()
+{
+    static thread_local unsigned int nCount = 0;
+    return ++nCount % (unsigned int)nLockStatsSample == 0;
+}
+
+void RecordLockStats(const char* pszName, const char* pszFile, int nLine, bool fContended, int64_t nWait, int64_t nHold)
+{
+    LockStatsData& data = GetLockStatsData();
+    boost::unique_lock<boost::mutex> lock(data.mutex);
+    CLockSiteStats& site = data.mapSites[std::make_pair(pszFile, nLine)];
+    if (site.strName.empty()) {
+        site.strName = pszName;
+        site.strFile = pszFile;
+        site.nLine = nLine;
+    }
+    if (fContended)
+        site.nContended++;
+    site.wait.Add(nWait);
+    site.hold.Add(nHold);
+}
+
+std::vector<CLockSiteStats> GetLockStats(bool fReset)
+{
+    LockStatsData& data = GetLockStatsData();
+    boost::unique_lock<boost::mutex> lock(data.mutex);
+    // A header's __FILE__ may be a different string in each file that includes it
+    std::map<std::pair<std::string, int>, CLockSiteStats> mapMerged;
+    for (const auto& item : data.mapSites) {
+        const CLockSiteStats& site = item.second;
+        CLockSiteStats& merged = mapMerged[std::make_pair(site.strFile, site.nLine)];
+        if (merged.strName.empty()) {
+            merged.strName = site.strName;
+            merged.strFile = site.strFile;
+            merged.nLine = site.nLine;
+        }
+        merged.nContended += site.nContended;
+        merged.wait.Merge(site.wait);
+        merged.hold.Merge(site.hold);
+    }
+    if (fReset)
+        data.mapSites.clear();
+
+    std::vector<CLockSiteStats> vSites;
+    vSites.reserve(mapMerged.size());
+    for (const auto& item : mapMerged)
+        vSites.push_back(item.second);
+    return vSites;
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
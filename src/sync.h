@@ -7,11 +7,17 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 
 ////////////////////////////////////////////////
@@ -108,24 +114,110 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock profiling. Every contended acquisition, and one in nLockStatsSample
+ * of the others on each thread, is timed: how long it waited for the lock
+ * and how long the lock was then held. The times are kept per place the
+ * lock is taken, see getlockstats. 0 turns the profiling off.
+ */
+static const int DEFAULT_LOCKSTATS_SAMPLE = 256;
+extern int nLockStatsSample;
+
+//! buckets of a lock time histogram, the last one taking everything longer
+static const int LOCKSTATS_BUCKETS = 24;
+
+/** Durations in microseconds, bucket 0 counting those under 1 and bucket i those in [2^(i-1), 2^i) */
+struct CLockTimeStats
+{
+    uint64_t nCount;
+    int64_t nTotal;
+    int64_t nMax;
+    uint64_t vBuckets[LOCKSTATS_BUCKETS];
+
+    CLockTimeStats();
+    void Add(int64_t nTime);
+    void Merge(const CLockTimeStats& other);
+};
+
+/** What the timed acquisitions at one place took */
+struct CLockSiteStats
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    //! timed acquisitions that had to wait
+    uint64_t nContended;
+    CLockTimeStats wait;
+    CLockTimeStats hold;
+
+    CLockSiteStats() : nLine(0), nContended(0) {}
+};
+
+/** The places a lock was timed at, optionally starting over */
+std::vector<CLockSiteStats> GetLockStats(bool fReset);
+
+//! Whether to time the next uncontended acquisition on this thread
+bool LockStatsSampleNext();
+void RecordLockStats(const char* pszName, const char* pszFile, int nLine, bool fContended, int64_t nWait, int64_t nHold);
+
+/** The timing of one acquisition, for the lock wrappers below */
+class CLockTimer
+{
+private:
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    bool fContended;
+    int64_t nWaitStart;
+    int64_t nLocked;
+
+public:
+    CLockTimer(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+        pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn), fContended(false), nWaitStart(0), nLocked(0) {}
+
+    //! Once try_lock got the lock or, if fContendedIn, did not
+    void BeforeLock(bool fContendedIn)
+    {
+        fContended = fContendedIn;
+        if (nLockStatsSample > 0 && (fContended || LockStatsSampleNext()))
+            nWaitStart = GetTimeMicros();
+    }
+
+    void Locked()
+    {
+        if (nWaitStart)
+            nLocked = GetTimeMicros();
+    }
+
+    void Unlocking()
+    {
+        if (nLocked) {
+            RecordLockStats(pszName, pszFile, nLine, fContended, nLocked - nWaitStart, GetTimeMicros() - nLocked);
+            nLocked = 0;
+        }
+    }
+};
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockTimer timer;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        bool fContended = !lock.try_lock();
+        timer.BeforeLock(fContended);
+        if (fContended) {
 #ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
 #endif
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
         }
-#endif
+        timer.Locked();
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -138,7 +230,7 @@ private:
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), timer(pszName, pszFile, nLine)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -146,7 +238,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : timer(pszName, pszFile, nLine)
     {
         if (!pmutexIn) return;
 
@@ -159,8 +251,10 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            timer.Unlocking();
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -171,6 +265,33 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
+/**
+ * A boost::shared_lock or boost::unique_lock on a boost::shared_mutex,
+ * profiled like LOCK. Shared mutexes are left out of the lock order checks.
+ */
+template <typename Lock>
+class CSharedMutexLock
+{
+private:
+    Lock lock;
+    CLockTimer timer;
+
+public:
+    CSharedMutexLock(typename Lock::mutex_type& mutexIn, const char* pszName, const char* pszFile, int nLine) : lock(mutexIn, boost::defer_lock), timer(pszName, pszFile, nLine)
+    {
+        bool fContended = !lock.try_lock();
+        timer.BeforeLock(fContended);
+        if (fContended)
+            lock.lock();
+        timer.Locked();
+    }
+
+    ~CSharedMutexLock()
+    {
+        timer.Unlocking();
+    }
+};
+
 #define PASTE(x, y) x ## y
 #define PASTE2(x, y) PASTE(x, y)
 
@@ -178,6 +299,9 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
 #define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
 #define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
 
+#define READ_LOCK(cs) CSharedMutexLock<boost::shared_lock<boost::shared_mutex> > PASTE2(sharedblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
+#define WRITE_LOCK(cs) CSharedMutexLock<boost::unique_lock<boost::shared_mutex> > PASTE2(sharedblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
+
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
         EnterCritical(#cs, __FILE__, __LINE__, (void*)(&cs)); \
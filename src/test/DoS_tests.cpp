@@ -11,6 +11,7 @@
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
+#include "txorphanage.h"
 #include "util.h"
 #include "validation.h"
 
@@ -23,17 +24,6 @@
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests these internal-to-net_processing.cpp methods:
-extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-
 CService ip(uint32_t i)
 {
     struct in_addr s;
@@ -126,17 +116,16 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!connman->IsBanned(addr));
 }
 
-CTransactionRef RandomOrphan()
+CTransactionRef RandomOrphan(const std::vector<CTransactionRef>& vOrphans)
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return vOrphans[GetRand(vOrphans.size())];
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
 {
+    CTxOrphanage orphanage;
+    std::vector<CTransactionRef> vOrphans;
+    int64_t nExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
     CKey key;
     key.MakeNewKey(true);
     CBasicKeyStore keystore;
@@ -154,13 +143,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        vOrphans.push_back(MakeTransactionRef(tx));
+        BOOST_CHECK(orphanage.AddTx(vOrphans.back(), i, nExpire));
     }
 
     // ... and 50 that depend on other orphans:
     for (int i = 0; i < 50; i++)
     {
-        CTransactionRef txPrev = RandomOrphan();
+        CTransactionRef txPrev = RandomOrphan(vOrphans);
 
         CMutableTransaction tx;
         tx.vin.resize(1);
@@ -171,13 +161,19 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, *txPrev, tx, 0, SIGHASH_ALL);
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        vOrphans.push_back(MakeTransactionRef(tx));
+        BOOST_CHECK(orphanage.AddTx(vOrphans.back(), i, nExpire));
     }
+    BOOST_CHECK_EQUAL(orphanage.Size(), 100U);
+    BOOST_CHECK(!orphanage.AddTx(vOrphans[0], 0, nExpire));
+    BOOST_CHECK(orphanage.HaveTx(vOrphans[0]->GetHash()));
+    BOOST_CHECK_EQUAL(orphanage.GetChildren(COutPoint(vOrphans[0]->GetHash(), 0)).size(),
+        (size_t)std::count_if(vOrphans.begin(), vOrphans.end(), [&](const CTransactionRef& tx) { return tx->vin[0].prevout.hash == vOrphans[0]->GetHash(); }));
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransactionRef txPrev = RandomOrphan();
+        CTransactionRef txPrev = RandomOrphan(vOrphans);
 
         CMutableTransaction tx;
         tx.vout.resize(1);
@@ -195,24 +191,70 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(MakeTransactionRef(tx), i));
+        BOOST_CHECK(!orphanage.AddTx(MakeTransactionRef(tx), i, nExpire));
     }
 
-    // Test EraseOrphansFor:
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = orphanage.Size();
+        BOOST_CHECK_EQUAL(orphanage.EraseForPeer(i), 2);
+        BOOST_CHECK_EQUAL(orphanage.Size(), sizeBefore - 2);
+        BOOST_CHECK_EQUAL(orphanage.PeerSize(i), 0U);
+        BOOST_CHECK_EQUAL(orphanage.PeerBytes(i), 0U);
     }
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
+    // Test Limit() by count:
+    orphanage.Limit(40, orphanage.Bytes(), GetTime());
+    BOOST_CHECK(orphanage.Size() <= 40);
+    orphanage.Limit(10, orphanage.Bytes(), GetTime());
+    BOOST_CHECK(orphanage.Size() <= 10);
+    orphanage.Limit(0, orphanage.Bytes(), GetTime());
+    BOOST_CHECK_EQUAL(orphanage.Size(), 0U);
+    BOOST_CHECK_EQUAL(orphanage.Bytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanage_limits)
+{
+    CTxOrphanage orphanage;
+    int64_t nNow = GetTime();
+
+    // Peer 0 floods 20 orphans, peer 1 sends 2, expiring later
+    std::vector<CTransactionRef> vOrphans;
+    for (int i = 0; i < 22; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+        vOrphans.push_back(MakeTransactionRef(tx));
+        BOOST_CHECK(orphanage.AddTx(vOrphans.back(), i < 20 ? 0 : 1, nNow + 100 + i));
+    }
+    BOOST_CHECK_EQUAL(orphanage.PeerSize(0), 20U);
+    BOOST_CHECK_EQUAL(orphanage.PeerBytes(0) + orphanage.PeerBytes(1), orphanage.Bytes());
+
+    // Over the memory budget, the flooding peer loses its oldest orphans
+    size_t nBytesEach = orphanage.Bytes() / 22;
+    BOOST_CHECK_EQUAL(orphanage.Limit(100, nBytesEach * 12, nNow), 10U);
+    BOOST_CHECK_EQUAL(orphanage.PeerSize(0), 10U);
+    BOOST_CHECK_EQUAL(orphanage.PeerSize(1), 2U);
+    BOOST_CHECK(!orphanage.HaveTx(vOrphans[9]->GetHash()));
+    BOOST_CHECK(orphanage.HaveTx(vOrphans[10]->GetHash()));
+
+    // A block spending the parent of an orphan drops it
+    BOOST_CHECK_EQUAL(orphanage.EraseForBlockTx(*vOrphans[10]), 1);
+    BOOST_CHECK(!orphanage.HaveTx(vOrphans[10]->GetHash()));
+
+    // Orphans expire in order
+    BOOST_CHECK_EQUAL(orphanage.Limit(100, orphanage.Bytes(), nNow + 115), 0U);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 6U);
+    BOOST_CHECK(orphanage.HaveTx(vOrphans[16]->GetHash()));
+    BOOST_CHECK(!orphanage.HaveTx(vOrphans[15]->GetHash()));
+    orphanage.Limit(100, orphanage.Bytes(), nNow + 1000);
+    BOOST_CHECK_EQUAL(orphanage.Size(), 0U);
+    BOOST_CHECK_EQUAL(orphanage.PeerBytes(1), 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+#include "random.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(addressindex_update)
+{
+    CAddressIndexDB db(1 << 20, true, false);
+    uint160 address(std::vector<unsigned char>(20, 0x01));
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    uint256 hash1 = GetRandHash();
+    uint256 hash2 = GetRandHash();
+
+    // Block 1 pays 50 to the address, block 2 spends it and pays 20 back.
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory1;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent1;
+    vHistory1.push_back(std::make_pair(CAddressIndexKey(1, address, 1, 0, txid1, 0, false), 50));
+    vUnspent1.push_back(std::make_pair(CAddressUnspentKey(1, address, txid1, 0), CAddressUnspentValue(50, 1)));
+    BOOST_CHECK(db.UpdateBlock(vHistory1, vUnspent1, hash1, false));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory2;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent2;
+    vHistory2.push_back(std::make_pair(CAddressIndexKey(1, address, 2, 1, txid2, 0, true), -50));
+    vUnspent2.push_back(std::make_pair(CAddressUnspentKey(1, address, txid1, 0), CAddressUnspentValue()));
+    vHistory2.push_back(std::make_pair(CAddressIndexKey(1, address, 2, 1, txid2, 0, false), 20));
+    vUnspent2.push_back(std::make_pair(CAddressUnspentKey(1, address, txid2, 0), CAddressUnspentValue(20, 2)));
+    BOOST_CHECK(db.UpdateBlock(vHistory2, vUnspent2, hash2, false));
+    BOOST_CHECK(db.GetBestBlock() == hash2);
+
+    CAddressBalance balance;
+    BOOST_CHECK(db.ReadAddressBalance(address, 1, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, 20);
+    BOOST_CHECK_EQUAL(balance.nReceived, 70);
+    BOOST_CHECK(!db.ReadAddressBalance(address, 2, balance));
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == txid2);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.blockHeight, 2);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, vHistory));
+    BOOST_CHECK_EQUAL(vHistory.size(), 3U);
+    vHistory.clear();
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, vHistory, 2, 3));
+    BOOST_CHECK_EQUAL(vHistory.size(), 2U);
+
+    // Disconnecting block 2 restores the state after block 1. The caller
+    // passes the unspent entries it restores in place of the erased ones.
+    vUnspent2[0].second = CAddressUnspentValue(50, 1);
+    vUnspent2[1].second = CAddressUnspentValue();
+    BOOST_CHECK(db.UpdateBlock(vHistory2, vUnspent2, hash1, true));
+    BOOST_CHECK(db.GetBestBlock() == hash1);
+    BOOST_CHECK(db.ReadAddressBalance(address, 1, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, 50);
+    BOOST_CHECK_EQUAL(balance.nReceived, 50);
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == txid1);
+    vHistory.clear();
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, vHistory));
+    BOOST_CHECK_EQUAL(vHistory.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_txids)
+{
+    CAddressIndexDB db(1 << 20, true, false);
+    uint160 address1(std::vector<unsigned char>(20, 0x01));
+    uint160 address2(std::vector<unsigned char>(20, 0x02));
+
+    // Address 1 has transactions at heights 1, 3 and 5, address 2 at 2, 3 and
+    // 4; the one at height 3 pays both and has two rows for address 1.
+    std::vector<uint256> vTxid;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    for (int nHeight = 1; nHeight <= 5; nHeight++) {
+        vTxid.push_back(GetRandHash());
+        const uint160& address = nHeight % 2 ? address1 : address2;
+        vHistory.push_back(std::make_pair(CAddressIndexKey(1, address, nHeight, 1, vTxid.back(), 0, false), 10));
+    }
+    vHistory.push_back(std::make_pair(CAddressIndexKey(1, address2, 3, 1, vTxid[2], 1, false), 10));
+    vHistory.push_back(std::make_pair(CAddressIndexKey(1, address1, 3, 1, vTxid[2], 2, false), 10));
+    BOOST_CHECK(db.UpdateBlock(vHistory, vUnspent, GetRandHash(), false));
+
+    std::vector<std::pair<uint160, int> > vAddress;
+    vAddress.push_back(std::make_pair(address1, 1));
+    vAddress.push_back(std::make_pair(address2, 1));
+
+    // Newest first, each transaction once
+    std::vector<CAddressIndexKey> vResult;
+    bool fMore;
+    BOOST_CHECK(db.ReadAddressTxids(vAddress, 0, 6, 0, 100, vResult, fMore));
+    BOOST_CHECK(!fMore);
+    BOOST_REQUIRE_EQUAL(vResult.size(), 5U);
+    for (int i = 0; i < 5; i++) {
+        BOOST_CHECK(vResult[i].txhash == vTxid[4 - i]);
+    }
+
+    // Pages of two, each continuing before the last transaction of the previous one
+    std::vector<CAddressIndexKey> vPage;
+    BOOST_CHECK(db.ReadAddressTxids(vAddress, 0, 6, 0, 2, vPage, fMore));
+    BOOST_CHECK(fMore);
+    BOOST_REQUIRE_EQUAL(vPage.size(), 2U);
+    BOOST_CHECK(vPage[1].txhash == vTxid[3]);
+    vPage.clear();
+    BOOST_CHECK(db.ReadAddressTxids(vAddress, 0, 4, 1, 2, vPage, fMore));
+    BOOST_CHECK(fMore);
+    BOOST_REQUIRE_EQUAL(vPage.size(), 2U);
+    BOOST_CHECK(vPage[0].txhash == vTxid[2]);
+    BOOST_CHECK(vPage[1].txhash == vTxid[1]);
+    vPage.clear();
+    BOOST_CHECK(db.ReadAddressTxids(vAddress, 0, 2, 1, 2, vPage, fMore));
+    BOOST_CHECK(!fMore);
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0].txhash == vTxid[0]);
+
+    // Height range [2, 4) of address 2 alone
+    vPage.clear();
+    BOOST_CHECK(db.ReadAddressTxids(std::vector<std::pair<uint160, int> >(1, vAddress[1]), 2, 4, 0, 100, vPage, fMore));
+    BOOST_REQUIRE_EQUAL(vPage.size(), 2U);
+    BOOST_CHECK(vPage[0].txhash == vTxid[2]);
+    BOOST_CHECK(vPage[1].txhash == vTxid[1]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 #include "addrman.h"
 #include "test/test_bitcoin.h"
 #include <string>
+#include <set>
 #include <boost/test/unit_test.hpp>
 
 #include "hash.h"
@@ -353,6 +354,33 @@ BOOST_AUTO_TEST_CASE(addrman_delete)
     BOOST_CHECK(info2 == NULL);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_delete_reuse)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    CAddress addr1 = CAddress(ResolveService("250.1.2.1", 9999), NODE_NONE);
+    CAddress addr2 = CAddress(ResolveService("250.1.2.2", 9999), NODE_NONE);
+    CAddress addr3 = CAddress(ResolveService("250.1.2.3", 9999), NODE_NONE);
+    CNetAddr source1 = ResolveIP("250.1.2.1");
+
+    int nId1, nId2, nId3;
+    addrman.Create(addr1, source1, &nId1);
+    addrman.Create(addr2, source1, &nId2);
+    addrman.Delete(nId1);
+
+    // Test 21a: the entry of a deleted address is handed out again.
+    CAddrInfo* info3 = addrman.Create(addr3, source1, &nId3);
+    BOOST_CHECK_EQUAL(nId3, nId1);
+    BOOST_CHECK(info3->ToString() == "250.1.2.3:9999");
+    BOOST_CHECK(addrman.Find(addr1) == NULL);
+    CAddrInfo* info2 = addrman.Find(addr2);
+    BOOST_CHECK(info2 && info2->ToString() == "250.1.2.2:9999");
+    BOOST_CHECK(addrman.size() == 2);
+}
+
 BOOST_AUTO_TEST_CASE(addrman_getaddr)
 {
     CAddrManTest addrman;
@@ -413,6 +441,9 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     size_t percent23 = (addrman.size() * 23) / 100;
     BOOST_CHECK(vAddr.size() == percent23);
     BOOST_CHECK(vAddr.size() == 461);
+    // Test 25a: the addresses returned are distinct.
+    std::set<CService> setAddr(vAddr.begin(), vAddr.end());
+    BOOST_CHECK(setAddr.size() == vAddr.size());
     // (Addrman.size() < number of addresses added) due to address collisons.
     BOOST_CHECK(addrman.size() == 2007);
 }
@@ -4,10 +4,14 @@
 
 #include "util.h"
 
+#include "memusage.h"
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
+#include "support/arena.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
 
@@ -204,6 +208,116 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_mock)
     BOOST_CHECK(pool.stats().used == 0);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+
+    // Blocks are carved from the same chunk and rounded to the alignment
+    void *a0 = resource.Allocate(8, 8);
+    void *a1 = resource.Allocate(5, 4);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(static_cast<char*>(a1) - static_cast<char*>(a0), 8);
+
+    // A freed block is handed out again for the next allocation of its size
+    resource.Deallocate(a0, 8, 8);
+    void *a2 = resource.Allocate(16, 8);
+    BOOST_CHECK(a2 != a0);
+    void *a3 = resource.Allocate(7, 8);
+    BOOST_CHECK(a3 == a0);
+
+    // Too big or too strictly aligned allocations do not use the chunks
+    void *big = resource.Allocate(65, 8);
+    void *aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 8, 16);
+
+    // Filling the chunk starts a new one
+    std::vector<void*> blocks;
+    for (int i = 0; i < 1024 / 64; i++) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    for (void* p : blocks) {
+        resource.Deallocate(p, 64, 8);
+    }
+    resource.Deallocate(a1, 5, 4);
+    resource.Deallocate(a2, 16, 8);
+    resource.Deallocate(a3, 7, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_arena_tests)
+{
+    CMemoryArena arena("test");
+    BOOST_CHECK_EQUAL(arena.ChunkSize(1024), 1024U);
+    {
+        PoolResource<64, 8> resource(1024, &arena);
+        std::vector<void*> blocks;
+        for (int i = 0; i < 3 * 1024 / 64; i++) {
+            blocks.push_back(resource.Allocate(64, 8));
+        }
+        CMemoryArena::Stats stats = arena.GetStats();
+        BOOST_CHECK_EQUAL(stats.nChunks, 3U);
+        BOOST_CHECK_EQUAL(stats.nBytes, 3 * 1024U);
+        BOOST_CHECK(!stats.fHugePages);
+        // Freed blocks stay in the chunks of the arena
+        for (void* p : blocks) {
+            resource.Deallocate(p, 64, 8);
+        }
+        BOOST_CHECK_EQUAL(arena.GetStats().nChunks, 3U);
+    }
+    // The chunks go back with the resource, the peak is kept
+    BOOST_CHECK_EQUAL(arena.GetStats().nChunks, 0U);
+    BOOST_CHECK_EQUAL(arena.GetStats().nBytes, 0U);
+    BOOST_CHECK_EQUAL(arena.GetStats().nPeakBytes, 3 * 1024U);
+
+    // With huge pages, chunks round up to them and are aligned to them
+    arena.SetHugePages(true);
+    BOOST_CHECK_EQUAL(arena.ChunkSize(1024), HUGE_PAGE_SIZE);
+    BOOST_CHECK_EQUAL(arena.ChunkSize(HUGE_PAGE_SIZE + 1), 2 * HUGE_PAGE_SIZE);
+    void* chunk = arena.AllocateChunk(HUGE_PAGE_SIZE);
+#ifndef WIN32
+    BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(chunk) % HUGE_PAGE_SIZE, 0U);
+#endif
+    arena.FreeChunk(chunk, HUGE_PAGE_SIZE);
+    BOOST_CHECK_EQUAL(arena.GetStats().nBytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map_tests)
+{
+    typedef std::pair<const uint64_t, uint64_t> Value;
+    typedef PoolResource<sizeof(Value) + sizeof(void*) * 4, alignof(void*)> Resource;
+    typedef boost::unordered_map<uint64_t, uint64_t, boost::hash<uint64_t>, std::equal_to<uint64_t>,
+                                 PoolAllocator<Value, sizeof(Value) + sizeof(void*) * 4, alignof(void*)> > Map;
+
+    Resource resource(4096);
+    {
+        Map map(0, boost::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource);
+        BOOST_CHECK(map.get_allocator().resource() == &resource);
+        for (uint64_t i = 0; i < 1000; i++) {
+            map[i] = i;
+        }
+        size_t chunks = resource.NumAllocatedChunks();
+        BOOST_CHECK(chunks > 0);
+        BOOST_CHECK(memusage::DynamicUsage(map) >= chunks * resource.ChunkSizeBytes());
+
+        // Erased nodes are reused instead of taking more chunks
+        for (uint64_t i = 0; i < 1000; i++) {
+            map.erase(i);
+            map[i + 1000] = i;
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+
+        // Copies of the allocator share the resource
+        Map copy(map.begin(), map.end(), 0, boost::hash<uint64_t>(), std::equal_to<uint64_t>(), map.get_allocator());
+        BOOST_CHECK(copy.get_allocator() == map.get_allocator());
+        BOOST_CHECK_EQUAL(copy.size(), 1000U);
+        BOOST_CHECK_EQUAL(copy[1500], 500U);
+    }
+}
+
 // These tests used the live LockedPoolManager object, this is also used
 // by other tests so the conditions are somewhat less controllable and thus the
 // tests are somewhat more error-prone.
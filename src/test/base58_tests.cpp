@@ -14,6 +14,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
@@ -73,6 +74,51 @@ BOOST_AUTO_TEST_CASE(base58_DecodeBase58)
     BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), expected.begin(), expected.end());
 }
 
+// Digit at a time encoding, as before the limbs
+static std::string EncodeBase58Reference(const std::vector<unsigned char>& vch)
+{
+    static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+    std::vector<unsigned char>::const_iterator pbegin = vch.begin();
+    std::string str;
+    while (pbegin != vch.end() && *pbegin == 0) {
+        str += '1';
+        pbegin++;
+    }
+    std::vector<unsigned char> b58;
+    for (; pbegin != vch.end(); pbegin++) {
+        int carry = *pbegin;
+        for (unsigned char& digit : b58) {
+            carry += 256 * digit;
+            digit = carry % 58;
+            carry /= 58;
+        }
+        for (; carry != 0; carry /= 58)
+            b58.push_back(carry % 58);
+    }
+    for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); ++it)
+        str += pszBase58[*it];
+    return str;
+}
+
+// Goal: check the encoding of random data of every length, with leading zeroes
+BOOST_AUTO_TEST_CASE(base58_random_roundtrip)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 1000; i++) {
+        std::vector<unsigned char> data(i % 100);
+        for (unsigned char& c : data)
+            c = insecure_rand() % 4 ? insecure_rand() : 0;
+        if (!data.empty() && i % 3 == 0)
+            std::fill(data.begin(), data.begin() + insecure_rand() % data.size(), 0);
+
+        std::string str = EncodeBase58(data.data(), data.data() + data.size());
+        BOOST_CHECK_EQUAL(str, EncodeBase58Reference(data));
+        std::vector<unsigned char> result;
+        BOOST_CHECK(DecodeBase58(" " + str + " ", result));
+        BOOST_CHECK(result == data);
+    }
+}
+
 // Visitor to check address type
 class TestAddrTypeVisitor : public boost::static_visitor<bool>
 {
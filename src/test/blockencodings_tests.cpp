@@ -270,6 +270,39 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
     BOOST_CHECK_EQUAL(pool.mapTx.find(txhash)->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 }
 
+BOOST_AUTO_TEST_CASE(PrefillConstructorRTTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    pool.addUnchecked(block.vtx[1]->GetHash(), entry.FromTx(*block.vtx[1]));
+
+    // Sending tx 2 along leaves nothing to request with tx 1 in the mempool
+    CBlockHeaderAndShortTxIDs shortIDs(block, true, std::vector<size_t>(1, 2));
+    BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), 3);
+    BOOST_CHECK_EQUAL(shortIDs.PrefilledTxCount(), 2);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+    BOOST_CHECK( partialBlock.IsTxAvailable(0));
+    BOOST_CHECK( partialBlock.IsTxAvailable(1));
+    BOOST_CHECK( partialBlock.IsTxAvailable(2));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    bool mutated;
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
 BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -337,4 +370,49 @@ BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
 }
 
+BOOST_AUTO_TEST_CASE(CompressedHeadersSerializationTest) {
+    // A chain of DPoS headers in 3 second slots, with one missed slot, a PoW
+    // style header off the slot grid and one with another version and a nonce
+    std::vector<CBlockHeader> vHeaders(6);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        CBlockHeader& header = vHeaders[i];
+        header.nVersion = 0x20000000;
+        header.hashPrevBlock = i == 0 ? GetRandHash() : vHeaders[i - 1].GetHash();
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = i == 0 ? 1500000000 : vHeaders[i - 1].nTime + (i == 2 ? 6 : 3);
+        header.nBits = 0x207fffff;
+        if (i == 4)
+            header.nTime += 1;
+        if (i == 5) {
+            header.nVersion = 0x20000002;
+            header.nNonce = 7;
+        }
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CCompressedHeaders(3, vHeaders);
+    // The first header takes 77 bytes, the ones on the slot grid the flags byte, the merkle
+    // root and a one byte slot count, the others 4 bytes more for each field they send
+    BOOST_CHECK_EQUAL(stream.size(), 2U + 77 + 3 * 34 + 37 + 42);
+
+    CCompressedHeaders compressed;
+    stream >> compressed;
+    BOOST_CHECK_EQUAL(compressed.nSlotInterval, 3U);
+    BOOST_CHECK_EQUAL(compressed.vHeaders.size(), vHeaders.size());
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        BOOST_CHECK_EQUAL(compressed.vHeaders[i].GetHash().ToString(), vHeaders[i].GetHash().ToString());
+
+    // A header that does not follow the one before keeps its hashPrevBlock
+    vHeaders[3].hashPrevBlock = GetRandHash();
+    stream << CCompressedHeaders(3, vHeaders);
+    stream >> compressed;
+    BOOST_CHECK(compressed.vHeaders[3].hashPrevBlock == vHeaders[3].hashPrevBlock);
+
+    // The first header must be complete
+    stream.clear();
+    uint64_t nCount = 1;
+    stream << VARINT(compressed.nSlotInterval) << COMPACTSIZE(nCount) << (uint8_t)0 << uint256() << (uint32_t)0;
+    BOOST_CHECK_THROW(stream >> compressed, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
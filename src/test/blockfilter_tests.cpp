@@ -0,0 +1,144 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "vote.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <ios>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static CGCSFilter::Element RandomElement()
+{
+    CGCSFilter::Element element(32);
+    for (unsigned char& c : element)
+        c = insecure_rand();
+    return element;
+}
+
+static CScript KeyScript(unsigned char n)
+{
+    return GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, n))));
+}
+
+static CGCSFilter::Element ScriptElement(const CScript& script)
+{
+    return CGCSFilter::Element(script.begin(), script.end());
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_match)
+{
+    CGCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    CGCSFilter filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100);
+    for (const CGCSFilter::Element& element : included)
+        BOOST_CHECK(filter.Match(element));
+    // One false positive in about 784931 lookups
+    int nFalsePositives = 0;
+    for (const CGCSFilter::Element& element : excluded)
+        nFalsePositives += filter.Match(element);
+    BOOST_CHECK(nFalsePositives <= 1);
+    BOOST_CHECK(!filter.MatchAny(excluded) || nFalsePositives > 0);
+
+    CGCSFilter::ElementSet query = excluded;
+    query.insert(*included.rbegin());
+    BOOST_CHECK(filter.MatchAny(query));
+
+    // The encoding reads back to the same filter
+    CGCSFilter decoded(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, filter.GetEncoded());
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    for (const CGCSFilter::Element& element : included)
+        BOOST_CHECK(decoded.Match(element));
+
+    // Another key gives another filter
+    CGCSFilter other(1, 0, BASIC_FILTER_P, BASIC_FILTER_M, included);
+    BOOST_CHECK(other.GetEncoded() != filter.GetEncoded());
+
+    CGCSFilter empty;
+    BOOST_CHECK_EQUAL(empty.GetN(), 0);
+    BOOST_CHECK(empty.GetEncoded() == std::vector<unsigned char>(1, 0));
+    BOOST_CHECK(!empty.Match(*included.begin()));
+    BOOST_CHECK(!empty.MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_malformed)
+{
+    CGCSFilter::ElementSet elements;
+    for (int i = 0; i < 10; i++)
+        elements.insert(RandomElement());
+    std::vector<unsigned char> vEncoded = CGCSFilter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, elements).GetEncoded();
+
+    std::vector<unsigned char> vShort(vEncoded.begin(), vEncoded.end() - 1);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, vShort), std::ios_base::failure);
+    std::vector<unsigned char> vLong = vEncoded;
+    vLong.push_back(0);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, vLong), std::ios_base::failure);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, std::vector<unsigned char>()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(3);
+    coinbase.vout[0].scriptPubKey = KeyScript(1);
+    coinbase.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(4, 2);
+    coinbase.vout[2].scriptPubKey = CScript();
+
+    // A vote for two delegates, spending an output paid to key 3
+    CVoteForgerData data;
+    data.opcode = OP_VOTE;
+    data.forgers.insert(CKeyID(uint160(std::vector<unsigned char>(20, 4))));
+    data.forgers.insert(CKeyID(uint160(std::vector<unsigned char>(20, 5))));
+    std::vector<unsigned char> push(4, 0);
+    std::vector<unsigned char> payload = StructToData(data);
+    push.insert(push.end(), payload.begin(), payload.end());
+    CMutableTransaction vote;
+    vote.vin.resize(1);
+    vote.vout.resize(2);
+    vote.vout[0].nValue = 0;
+    vote.vout[0].scriptPubKey = CScript() << OP_RETURN << push;
+    vote.vout[1].scriptPubKey = KeyScript(6);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(vote));
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(Coin(CTxOut(COIN, KeyScript(3)), 1, false));
+
+    CGCSFilter::ElementSet elements = CBlockFilter::GetElements(block, blockundo);
+    BOOST_CHECK_EQUAL(elements.size(), 5);
+    for (unsigned char n : {1, 3, 4, 5, 6})
+        BOOST_CHECK(elements.count(ScriptElement(KeyScript(n))));
+
+    uint256 hashBlock = block.GetHash();
+    CBlockFilter filter(hashBlock, block, blockundo);
+    for (unsigned char n : {1, 3, 4, 5, 6})
+        BOOST_CHECK(filter.GetFilter().Match(ScriptElement(KeyScript(n))));
+    BOOST_CHECK(!filter.GetFilter().Match(ScriptElement(KeyScript(7))));
+
+    CBlockFilter decoded(hashBlock, filter.GetEncoded());
+    BOOST_CHECK(decoded.GetHash() == filter.GetHash());
+    BOOST_CHECK(decoded.GetFilter().Match(ScriptElement(KeyScript(4))));
+
+    // The header commits to the one before
+    uint256 hashHeader = filter.ComputeHeader(uint256());
+    BOOST_CHECK(hashHeader != filter.ComputeHeader(hashHeader));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
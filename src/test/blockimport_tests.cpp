@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, BasicTestingSetup)
+
+static const CMessageHeader::MessageStartChars MESSAGE_START = {0xf9, 0xbe, 0xb4, 0xd9};
+
+static CBlock MakeBlock(uint32_t nTime)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_TRUE;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nTime;
+
+    CBlock block;
+    block.nTime = nTime;
+    block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    return block;
+}
+
+/** Append a block record as written by WriteBlockToDisk, returning the position of the block data */
+static uint64_t WriteRecord(CDataStream& ss, const CBlock& block)
+{
+    ss << FLATDATA(MESSAGE_START) << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    uint64_t nPos = ss.size();
+    ss << block;
+    return nPos;
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_order)
+{
+    std::vector<CBlock> vBlock;
+    std::vector<uint64_t> vPos;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (uint32_t i = 0; i < 50; i++) {
+        vBlock.push_back(MakeBlock(i));
+        vPos.push_back(WriteRecord(ss, vBlock.back()));
+        // Bytes between the blocks are skipped
+        if (i % 10 == 0)
+            ss << uint32_t(0x12345678);
+    }
+
+    // A record that fails to deserialize, with the next block starting inside
+    // of it: that block is found by scanning again from the failed record.
+    CDataStream ssBad(SER_DISK, CLIENT_VERSION);
+    vBlock.push_back(MakeBlock(100));
+    ssBad << FLATDATA(MESSAGE_START) << (unsigned int)(80 + 9 + 20);
+    std::vector<char> vGarbage(80, 0);
+    vGarbage.resize(80 + 9, (char)0xff);
+    ssBad.write(vGarbage.data(), vGarbage.size());
+    vPos.push_back(ss.size() + WriteRecord(ssBad, vBlock.back()));
+    ss.write(&ssBad[0], ssBad.size());
+
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    FILE* file = fopen(path.string().c_str(), "wb+");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(&ss[0], 1, ss.size(), file), ss.size());
+    rewind(file);
+
+    {
+        CBlockFileImporter importer(file, MESSAGE_START, 4);
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        uint64_t nPos;
+        for (size_t i = 0; i < vBlock.size(); i++) {
+            BOOST_REQUIRE(importer.Next(pblock, hash, nPos));
+            BOOST_CHECK(hash == vBlock[i].GetHash());
+            BOOST_CHECK(pblock->GetHash() == hash);
+            BOOST_CHECK_EQUAL(nPos, vPos[i]);
+        }
+        BOOST_CHECK(!importer.Next(pblock, hash, nPos));
+    }
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -539,6 +539,14 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     for (int i = 0; i < DATASIZE; i++) {
         BOOST_CHECK(rb2.contains(data[i]));
     }
+
+    // A hash is the same item as its bytes
+    uint256 hash = GetRandHash();
+    rb2.insert(hash);
+    BOOST_CHECK(rb2.contains(std::vector<unsigned char>(hash.begin(), hash.end())));
+    std::vector<unsigned char> vHash = RandomData();
+    rb2.insert(vHash);
+    BOOST_CHECK(rb2.contains(uint256(vHash)));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
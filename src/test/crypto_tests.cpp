@@ -3,16 +3,21 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
 
+#include <algorithm>
+#include <string.h>
 #include <vector>
 
 #include <boost/assign/list_of.hpp>
@@ -255,6 +260,95 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256_implementations) {
+    static const sha256_implementation::UseImplementation implementations[] = {
+        sha256_implementation::USE_SSE4,
+        sha256_implementation::USE_AVX2,
+        sha256_implementation::USE_SHANI,
+        sha256_implementation::USE_ARMV8,
+        sha256_implementation::USE_ALL,
+    };
+
+    // Reference double hashes of up to 32 blobs from the standard implementation.
+    unsigned char in[64 * 32];
+    unsigned char ref[32 * 32];
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = insecure_rand();
+    SHA256AutoDetect(sha256_implementation::STANDARD);
+    for (int i = 0; i < 32; i++)
+        CHash256().Write(in + 64 * i, 64).Finalize(ref + 32 * i);
+
+    for (sha256_implementation::UseImplementation use : implementations) {
+        BOOST_TEST_MESSAGE("SHA256 implementation: " << SHA256AutoDetect(use));
+        TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        TestSHA256(std::string(1000000, 'a'),
+                   "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        for (int i = 0; i <= 32; i++) {
+            unsigned char out[32 * 32];
+            SHA256D64(out, in, i);
+            BOOST_CHECK(memcmp(out, ref, 32 * i) == 0);
+        }
+        // The merkle computation hashes each level in place.
+        unsigned char inout[64 * 32];
+        memcpy(inout, in, sizeof(inout));
+        SHA256D64(inout, inout, 32);
+        BOOST_CHECK(memcmp(inout, ref, sizeof(ref)) == 0);
+    }
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(hash160_multi) {
+    static const sha256_implementation::UseImplementation implementations[] = {
+        sha256_implementation::STANDARD,
+        sha256_implementation::USE_SSE4,
+        sha256_implementation::USE_AVX2,
+        sha256_implementation::USE_ALL,
+    };
+
+    // Public keys of both sizes, mixed, plus a message of more than one block
+    std::vector<std::vector<unsigned char> > vIn;
+    for (int i = 0; i < 19; i++) {
+        size_t nLen = i == 7 ? 100 : (insecure_rand() & 1) ? 33 : 65;
+        vIn.push_back(std::vector<unsigned char>(nLen));
+        for (unsigned char& c : vIn.back())
+            c = insecure_rand();
+    }
+    std::vector<const unsigned char*> vPtr;
+    std::vector<size_t> vLen;
+    for (const std::vector<unsigned char>& v : vIn) {
+        vPtr.push_back(v.data());
+        vLen.push_back(v.size());
+    }
+
+    for (sha256_implementation::UseImplementation use : implementations) {
+        BOOST_TEST_MESSAGE("SHA256 implementation: " << SHA256AutoDetect(use));
+        for (size_t n = 0; n <= vIn.size(); n++) {
+            std::vector<uint160> vOut(n);
+            Hash160Multi(vOut.data(), vPtr.data(), vLen.data(), n);
+            for (size_t i = 0; i < n; i++)
+                BOOST_CHECK(vOut[i] == Hash160(vIn[i].begin(), vIn[i].end()));
+        }
+
+        // The two stages on their own, over messages of the same length
+        unsigned char sha[32 * 19], ref[32 * 19];
+        SHA256Multi(sha, vPtr.data(), 33, vIn.size());
+        for (size_t i = 0; i < vIn.size(); i++)
+            CSHA256().Write(vPtr[i], 33).Finalize(ref + 32 * i);
+        BOOST_CHECK(memcmp(sha, ref, sizeof(ref)) == 0);
+
+        // Every count, so the 8-way, 4-way and single blocks are all mixed
+        unsigned char rmdref[20 * 19];
+        for (size_t i = 0; i < vIn.size(); i++)
+            CRIPEMD160().Write(sha + 32 * i, 32).Finalize(rmdref + 20 * i);
+        for (size_t n = 0; n <= vIn.size(); n++) {
+            unsigned char rmd[20 * 19];
+            RIPEMD160_32(rmd, sha, n);
+            BOOST_CHECK(memcmp(rmd, rmdref, 20 * n) == 0);
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -439,4 +533,77 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    // The prime minus one is its own inverse, and needs every reduction on the way
+    unsigned char minusone[Num3072::BYTE_SIZE];
+    memset(minusone, 0xff, sizeof(minusone));
+    minusone[0] = 0x9a;
+    minusone[1] = 0x28;
+    minusone[2] = 0xef;
+    Num3072 x(minusone);
+    x.Multiply(Num3072(minusone));
+    unsigned char out[Num3072::BYTE_SIZE];
+    x.ToBytes(out);
+    BOOST_CHECK(out[0] == 1 && std::count(out + 1, out + sizeof(out), 0) == (int)sizeof(out) - 1);
+    x = Num3072(minusone);
+    x.Divide(Num3072(minusone));
+    x.ToBytes(out);
+    BOOST_CHECK(out[0] == 1 && std::count(out + 1, out + sizeof(out), 0) == (int)sizeof(out) - 1);
+
+    // The empty set is the number one
+    unsigned char hash[MuHash3072::OUTPUT_SIZE];
+    MuHash3072().Finalize(hash);
+    BOOST_CHECK_EQUAL(HexStr(hash, hash + sizeof(hash)), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+
+    std::vector<std::vector<unsigned char> > vElements;
+    for (int i = 0; i < 8; i++) {
+        std::vector<unsigned char> element(1 + insecure_rand() % 40);
+        for (unsigned char& c : element)
+            c = insecure_rand();
+        vElements.push_back(element);
+    }
+
+    // Any order, with elements added and taken out again on the way
+    MuHash3072 forward, backward, partial;
+    for (size_t i = 0; i < vElements.size(); i++) {
+        forward.Insert(vElements[i].data(), vElements[i].size());
+        const std::vector<unsigned char>& element = vElements[vElements.size() - 1 - i];
+        backward.Insert(element.data(), element.size());
+        backward.Remove(vElements[0].data(), vElements[0].size());
+        backward.Insert(vElements[0].data(), vElements[0].size());
+    }
+    unsigned char hash1[MuHash3072::OUTPUT_SIZE], hash2[MuHash3072::OUTPUT_SIZE];
+    forward.Finalize(hash1);
+    backward.Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, sizeof(hash1)) == 0);
+    BOOST_CHECK(memcmp(hash1, hash, sizeof(hash)) != 0);
+
+    // Combining the hashes of two halves, or taking one back out
+    MuHash3072 first, second;
+    for (size_t i = 0; i < vElements.size(); i++)
+        (i % 2 ? first : second).Insert(vElements[i].data(), vElements[i].size());
+    partial = first;
+    partial *= second;
+    partial.Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, sizeof(hash1)) == 0);
+    partial /= second;
+    unsigned char hash3[MuHash3072::OUTPUT_SIZE];
+    partial.Finalize(hash2);
+    first.Finalize(hash3);
+    BOOST_CHECK(memcmp(hash2, hash3, sizeof(hash2)) == 0);
+
+    MuHash3072 single(vElements[0].data(), vElements[0].size());
+    single.Remove(vElements[0].data(), vElements[0].size());
+    single.Finalize(hash2);
+    BOOST_CHECK(memcmp(hash2, hash, sizeof(hash)) == 0);
+
+    CDataStream ss(SER_DISK, 0);
+    ss << forward;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 read;
+    ss >> read;
+    read.Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, sizeof(hash1)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
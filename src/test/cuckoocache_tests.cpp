@@ -72,6 +72,40 @@ BOOST_AUTO_TEST_CASE(test_cuckoocache_no_fakes)
     }
 };
 
+/* Test that evictions counts the elements that age out without having been
+ * erased, and only those.
+ */
+BOOST_AUTO_TEST_CASE(test_cuckoocache_evictions)
+{
+    insecure_rand = FastRandomContext(true);
+    CuckooCache::cache<uint256, uint256Hasher> cc{};
+    uint32_t nElems = cc.setup(1024);
+    std::vector<uint256> hashes(nElems * 4);
+    for (uint256& v : hashes)
+        insecure_GetRandHash(v);
+
+    // Less than an epoch fits without aging anything
+    for (uint32_t x = 0; x < nElems / 4; ++x)
+        cc.insert(hashes[x]);
+    BOOST_CHECK_EQUAL(cc.evictions(), 0);
+
+    // Erased elements are not evictions
+    for (uint32_t x = 0; x < nElems / 4; ++x)
+        BOOST_CHECK(cc.contains(hashes[x], true));
+    for (uint32_t x = nElems / 4; x < nElems; ++x)
+        cc.insert(hashes[x]);
+    BOOST_CHECK_EQUAL(cc.evictions(), 0);
+
+    // Past two epochs of elements never looked up, the oldest are dropped
+    for (uint32_t x = nElems; x < hashes.size(); ++x)
+        cc.insert(hashes[x]);
+    uint64_t nMissing = 0;
+    for (uint32_t x = nElems / 4; x < hashes.size(); ++x)
+        nMissing += !cc.contains(hashes[x], false);
+    BOOST_CHECK(cc.evictions() > 0);
+    BOOST_CHECK(cc.evictions() >= nMissing);
+};
+
 /** This helper returns the hit rate when megabytes*load worth of entries are
  * inserted into a megabytes sized cache
  */
@@ -43,6 +43,79 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    CDBOptions options;
+    BOOST_CHECK(CDBOptions::FromProfile("default", options));
+    BOOST_CHECK(!options.fCompression);
+    BOOST_CHECK_EQUAL(options.nMaxOpenFiles, 64);
+    BOOST_CHECK(CDBOptions::FromProfile("index", options));
+    BOOST_CHECK(options.fCompression);
+    BOOST_CHECK(options.nBlockSize > CDBOptions().nBlockSize);
+    BOOST_CHECK(!CDBOptions::FromProfile("fast", options));
+
+    // Data written with one profile is read back with another, and without a bloom filter.
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CDBOptions::FromProfile("index", options);
+    uint256 in = GetRandHash();
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, true, false, options);
+        BOOST_CHECK(dbw.Write('k', in));
+    }
+    options = CDBOptions();
+    options.nBloomBits = 0;
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, false, false, options);
+        uint256 res;
+        BOOST_CHECK(dbw.Read('k', res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        BOOST_CHECK(!dbw.Exists('l'));
+    }
+    boost::filesystem::remove_all(ph);
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    CDBOptions options;
+    std::string strError;
+    BOOST_CHECK(CDBOptions::ParseOptions("", options, strError));
+    BOOST_CHECK(CDBOptions::ParseOptions("compression=kSnappyCompression;max_open_files=500;block_size=65536;bloom_bits=0;write_buffer_size=67108864;", options, strError));
+    BOOST_CHECK(options.fCompression);
+    BOOST_CHECK_EQUAL(options.nMaxOpenFiles, 500);
+    BOOST_CHECK_EQUAL(options.nBlockSize, 65536U);
+    BOOST_CHECK_EQUAL(options.nBloomBits, 0);
+    BOOST_CHECK_EQUAL(options.nWriteBufferSize, 67108864U);
+    BOOST_CHECK(CDBOptions::ParseOptions("compression=kNoCompression", options, strError));
+    BOOST_CHECK(!options.fCompression);
+    BOOST_CHECK_EQUAL(options.nMaxOpenFiles, 500);
+
+    BOOST_CHECK(!CDBOptions::ParseOptions("compression=kZSTD", options, strError));
+    BOOST_CHECK(!CDBOptions::ParseOptions("max_background_compactions=4", options, strError));
+    BOOST_CHECK(!CDBOptions::ParseOptions("block_size=0", options, strError));
+    BOOST_CHECK(!CDBOptions::ParseOptions("max_open_files", options, strError));
+    BOOST_CHECK(!CDBOptions::ParseOptions("bloom_bits=-1", options, strError));
+
+    // A database written uncompressed reads back after a full compaction with compression on.
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    options = CDBOptions();
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, true, false, options);
+        for (int i = 0; i < 1000; i++)
+            BOOST_CHECK(dbw.Write(std::make_pair('k', i), uint256S("ff")));
+    }
+    BOOST_CHECK(CDBOptions::ParseOptions("compression=kSnappyCompression;write_buffer_size=65536", options, strError));
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, false, false, options);
+        dbw.CompactFull();
+        uint256 res;
+        for (int i = 0; i < 1000; i++) {
+            BOOST_CHECK(dbw.Read(std::make_pair('k', i), res));
+            BOOST_CHECK_EQUAL(res.ToString(), uint256S("ff").ToString());
+        }
+    }
+    boost::filesystem::remove_all(ph);
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
@@ -232,6 +305,32 @@ BOOST_AUTO_TEST_CASE(iterator_ordering)
         }
         BOOST_CHECK(!it->Valid());
     }
+
+    // And backwards, from the end and from a seek
+    for (int c=0; c<2; ++c) {
+        int seek_start;
+        if (c == 0) {
+            seek_start = 0xff;
+            it->SeekToLast();
+        } else {
+            seek_start = 0x7f;
+            it->Seek((uint8_t)0x80);
+            it->Prev();
+        }
+        for (int x=seek_start; x>=0; --x) {
+            uint8_t key;
+            uint32_t value;
+            BOOST_CHECK(it->Valid());
+            if (!it->Valid())
+                break;
+            BOOST_CHECK(it->GetKey(key));
+            BOOST_CHECK(it->GetValue(value));
+            BOOST_CHECK_EQUAL(key, x);
+            BOOST_CHECK_EQUAL(value, x*x);
+            it->Prev();
+        }
+        BOOST_CHECK(!it->Valid());
+    }
 }
 
 struct StringContentsSerializer {
@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatset.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+#include <set>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatset_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatset_matches_set)
+{
+    std::set<int> reference;
+    CFlatSet<int> flat;
+    for (int i = 0; i < 2000; i++) {
+        int n = insecure_rand() % 200;
+        if (insecure_rand() % 3) {
+            BOOST_CHECK_EQUAL(flat.insert(n).second, reference.insert(n).second);
+        } else {
+            BOOST_CHECK_EQUAL(flat.erase(n), reference.erase(n));
+        }
+        BOOST_CHECK_EQUAL(flat.count(n), reference.count(n));
+    }
+    BOOST_CHECK_EQUAL(flat.size(), reference.size());
+    BOOST_CHECK(std::equal(flat.begin(), flat.end(), reference.begin()));
+    BOOST_CHECK(flat.find(200) == flat.end());
+
+    CFlatSet<int> copy(reference.rbegin(), reference.rend());
+    BOOST_CHECK(copy == flat);
+}
+
+BOOST_AUTO_TEST_CASE(flatset_serialization)
+{
+    std::set<int> reference = {7, 3, 11, -2};
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << reference;
+    std::vector<char> vSet(ss.begin(), ss.end());
+
+    // Reads what a std::set wrote, and writes the same bytes back
+    CFlatSet<int> flat;
+    ss >> flat;
+    BOOST_CHECK(std::equal(flat.begin(), flat.end(), reference.begin()));
+    ss << flat;
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == vSet);
+
+    // Out of order elements are sorted, duplicates refused
+    ss.clear();
+    ss << std::vector<int>{5, 1, 3};
+    ss >> flat;
+    BOOST_CHECK(std::is_sorted(flat.begin(), flat.end()));
+    BOOST_CHECK_EQUAL(flat.size(), 3U);
+    ss << std::vector<int>{5, 1, 5};
+    BOOST_CHECK_THROW(ss >> flat, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 
 #include <vector>
 
@@ -128,6 +129,34 @@ BOOST_AUTO_TEST_CASE(siphash)
     tx.nVersion = 1;
     ss << tx;
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check the outpoint variant against the generic hasher
+    uint256 hash = ss.GetHash();
+    for (uint32_t n = 0; n < 1000; n += 37) {
+        unsigned char extra[4] = {(unsigned char)n, (unsigned char)(n >> 8), (unsigned char)(n >> 16), (unsigned char)(n >> 24)};
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, hash, n), CSipHasher(1, 2).Write(hash.begin(), 32).Write(extra, 4).Finalize());
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(hashwriter_chunks)
+{
+    // The buffered writer must hash the same bytes however they are split up
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = insecure_rand();
+    uint256 expected = Hash(data.begin(), data.end());
+
+    for (int i = 0; i < 100; i++) {
+        CHashWriter ss(SER_GETHASH, 0);
+        size_t nPos = 0;
+        while (nPos < data.size()) {
+            size_t nSize = std::min(data.size() - nPos, (size_t)(insecure_rand() % 150));
+            ss.write((const char*)&data[nPos], nSize);
+            nPos += nSize;
+        }
+        BOOST_CHECK(ss.GetHash() == expected);
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
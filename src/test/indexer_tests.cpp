@@ -0,0 +1,170 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "address_index.h"
+#include "blockfilter.h"
+#include "chainparams.h"
+#include "indexer.h"
+#include "txdb.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(indexer_tests, TestChain100Setup)
+
+static void WaitForSync(CIndexer& indexer)
+{
+    int64_t nTimeout = GetTimeMillis() + 10000;
+    while (!indexer.IsSynced()) {
+        BOOST_REQUIRE(GetTimeMillis() < nTimeout);
+        MilliSleep(10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txindexer_sync)
+{
+    CTxIndexer indexer(pblocktree);
+    BOOST_CHECK(!indexer.BlockUntilSyncedToCurrentChain());
+    BOOST_REQUIRE(indexer.Start());
+    WaitForSync(indexer);
+
+    std::vector<CDiskTxPos> vPos;
+    for (const CTransaction& tx : coinbaseTxns) {
+        BOOST_CHECK(pblocktree->ReadTxIndex(tx.GetHash(), vPos));
+    }
+
+    // Blocks connected after the catch up are indexed as well.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_CHECK(indexer.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(pblocktree->ReadTxIndex(block.vtx[0]->GetHash(), vPos));
+    BOOST_CHECK_EQUAL(vPos.size(), 1);
+    CTransactionRef tx;
+    uint256 hashBlock;
+    fTxIndex = true;
+    BOOST_CHECK(GetTransaction(block.vtx[0]->GetHash(), tx, Params().GetConsensus(), hashBlock, false));
+    fTxIndex = false;
+    BOOST_CHECK(hashBlock == block.GetHash());
+
+    indexer.Interrupt();
+    indexer.Stop();
+
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadTxIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(txindex_prefix)
+{
+    // Two txids sharing the prefix the index is keyed by, and a third that does not
+    uint256 txid1 = uint256S("0x1111111111111111111111111111111111111111111111110123456789abcdef");
+    uint256 txid2 = uint256S("0x2222222222222222222222222222222222222222222222220123456789abcdef");
+    uint256 txid3 = uint256S("0x1111111111111111111111111111111111111111111111110123456789abcdee");
+    std::vector<std::pair<uint256, CDiskTxPos> > vEntries;
+    vEntries.push_back(std::make_pair(txid1, CDiskTxPos(CDiskBlockPos(1, 100), 10)));
+    vEntries.push_back(std::make_pair(txid2, CDiskTxPos(CDiskBlockPos(1, 100), 20)));
+    vEntries.push_back(std::make_pair(txid3, CDiskTxPos(CDiskBlockPos(2, 200), 30)));
+    uint256 hashBlock = uint256S("0x01");
+    BOOST_REQUIRE(pblocktree->WriteTxIndex(vEntries, hashBlock));
+
+    std::vector<CDiskTxPos> vPos;
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid1, vPos));
+    BOOST_CHECK_EQUAL(vPos.size(), 2);
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid3, vPos));
+    BOOST_REQUIRE_EQUAL(vPos.size(), 1);
+    BOOST_CHECK_EQUAL(vPos[0].nFile, 2);
+    BOOST_CHECK_EQUAL(vPos[0].nTxOffset, 30);
+
+    // Erasing the entries of a block leaves the others
+    vEntries.pop_back();
+    vEntries.erase(vEntries.begin());
+    BOOST_REQUIRE(pblocktree->EraseTxIndex(vEntries, uint256()));
+    BOOST_CHECK(pblocktree->ReadTxIndex(txid2, vPos));
+    BOOST_REQUIRE_EQUAL(vPos.size(), 1);
+    BOOST_CHECK_EQUAL(vPos[0].nTxOffset, 10);
+    BOOST_CHECK(!pblocktree->ReadTxIndex(uint256S("0x01"), vPos));
+}
+
+BOOST_AUTO_TEST_CASE(addressindexer_sync)
+{
+    CAddressIndexDB db(1 << 20, true, false);
+    CAddressIndexer indexer(&db);
+    BOOST_REQUIRE(indexer.Start());
+    WaitForSync(indexer);
+    BOOST_CHECK(indexer.BlockUntilSyncedToCurrentChain());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(db.GetBestBlock() == chainActive.Tip()->GetBlockHash());
+    }
+
+    // Everything the coinbase key received is still unspent.
+    uint160 hashKey = coinbaseKey.GetPubKey().GetID();
+    CAmount nExpected = 0;
+    for (const CTransaction& tx : coinbaseTxns) {
+        for (const CTxOut& out : tx.vout) {
+            CMyAddress address;
+            if (ExtractAddress(out.scriptPubKey, address) && address.first == hashKey)
+                nExpected += out.nValue;
+        }
+    }
+    CAddressBalance balance;
+    BOOST_CHECK(db.ReadAddressBalance(hashKey, 1, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, nExpected);
+    BOOST_CHECK_EQUAL(balance.nReceived, nExpected);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(hashKey, 1, vUnspent));
+    BOOST_CHECK(!vUnspent.empty());
+
+    indexer.Interrupt();
+    indexer.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindexer_sync)
+{
+    CBlockFilterDB db(1 << 20, true, false);
+    CBlockFilterIndexer indexer(&db);
+    BOOST_REQUIRE(indexer.Start());
+    WaitForSync(indexer);
+    BOOST_CHECK(indexer.BlockUntilSyncedToCurrentChain());
+
+    // Every block has its filter, chained by the filter headers
+    std::vector<CBlockFilter> vFilter;
+    std::vector<uint256> vFilterHash, vHeader;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(db.GetBestBlock() == chainActive.Tip()->GetBlockHash());
+        for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++) {
+            CBlockFilter filter;
+            uint256 hashFilter, hashHeader;
+            BOOST_REQUIRE(indexer.LookupFilter(chainActive[nHeight], filter));
+            BOOST_REQUIRE(indexer.LookupFilterHashes(chainActive[nHeight], hashFilter, hashHeader));
+            vFilter.push_back(filter);
+            vFilterHash.push_back(hashFilter);
+            vHeader.push_back(hashHeader);
+        }
+    }
+    uint256 hashPrevHeader;
+    for (size_t i = 0; i < vFilter.size(); i++) {
+        BOOST_CHECK(vFilterHash[i] == vFilter[i].GetHash());
+        BOOST_CHECK(vHeader[i] == vFilter[i].ComputeHeader(hashPrevHeader));
+        hashPrevHeader = vHeader[i];
+    }
+
+    // The filters match what the coinbases pay to
+    for (size_t i = 0; i < coinbaseTxns.size() && i + 1 < vFilter.size(); i++) {
+        for (const CTxOut& out : coinbaseTxns[i].vout) {
+            const CScript& script = out.scriptPubKey;
+            if (!script.empty() && script[0] != OP_RETURN)
+                BOOST_CHECK(vFilter[i + 1].GetFilter().Match(CGCSFilter::Element(script.begin(), script.end())));
+        }
+    }
+
+    indexer.Interrupt();
+    indexer.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -98,4 +98,61 @@ BOOST_AUTO_TEST_CASE(limitedmap_test)
     BOOST_CHECK(map.empty());
 }
 
+struct IntHasher {
+    // Few buckets for many keys, so the probe sequences overlap
+    size_t operator()(int n) const { return n / 4; }
+};
+
+BOOST_AUTO_TEST_CASE(flatlimitedmap_test)
+{
+    flatlimitedmap<int, int, IntHasher> map(10);
+    BOOST_CHECK(map.max_size() == 10);
+    BOOST_CHECK(map.empty());
+
+    for (int i = 0; i < 10; i++)
+        map.set(i, i + 100);
+    BOOST_CHECK(map.size() == 10);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(map.find(i) && *map.find(i) == i + 100);
+
+    // Updating 0 makes 1 the element set the longest ago
+    map.set(0, 200);
+    map.set(10, 110);
+    BOOST_CHECK(map.size() == 10);
+    BOOST_CHECK(!map.count(1));
+    BOOST_CHECK(*map.find(0) == 200);
+    BOOST_CHECK(*map.find(10) == 110);
+
+    // Erasing in the middle of probe sequences leaves the others found
+    map.erase(4);
+    map.erase(5);
+    map.erase(42);
+    BOOST_CHECK(map.size() == 8);
+    for (int i = 0; i <= 10; i++)
+        BOOST_CHECK(map.count(i) == (i != 1 && i != 4 && i != 5));
+
+    // Rolling keys through drops the same as limitedmap does with the time each was set as value
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(!map.count(0));
+    limitedmap<int, int> model(10);
+    for (int i = 0; i < 1000; i++) {
+        int nKey = i % 37;
+        map.set(nKey, i);
+        model.erase(nKey);
+        model.insert(std::make_pair(nKey, i));
+        if (i % 7 == 0) {
+            map.erase(i % 13);
+            model.erase(i % 13);
+        }
+        BOOST_CHECK(map.size() == model.size());
+        for (int n = 0; n < 37; n++)
+            BOOST_CHECK(map.count(n) == model.count(n));
+    }
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(!map.count(36));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
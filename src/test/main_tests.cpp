@@ -5,9 +5,14 @@
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "policy/policy.h"
+#include "txdb.h"
+#include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <limits>
+
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -73,4 +78,97 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+static CMemoryUsageStats FixedMemoryUsage(size_t nBlockIndex, size_t nSigCache, size_t nRawBlockCache)
+{
+    CMemoryUsageStats stats = CMemoryUsageStats();
+    stats.nBlockIndex = nBlockIndex;
+    stats.nSigCache = nSigCache;
+    stats.nRawBlockCache = nRawBlockCache;
+    return stats;
+}
+
+/** Check that the coins cache and the mempool share the space left of nMaxMemory in proportion to their bounds */
+static void CheckMemoryShare(size_t nMaxMemory, size_t nCoinsMax, size_t nMempoolMax)
+{
+    CMemoryUsageStats stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    size_t nSpace = nMaxMemory - stats.nBlockIndex - stats.nSigCache - stats.nRawBlockCache;
+    BOOST_REQUIRE(nSpace < nCoinsMax + nMempoolMax);
+    SplitMemoryBudget(stats, nMaxMemory, nCoinsMax, nMempoolMax, DEFAULT_DESCENDANT_SIZE_LIMIT * 1000 * 40);
+    BOOST_CHECK(stats.nCoinsLimit < nCoinsMax);
+    BOOST_CHECK(stats.nMempoolLimit < nMempoolMax);
+    BOOST_CHECK(stats.nCoinsLimit + stats.nMempoolLimit <= nSpace);
+    BOOST_CHECK(stats.nCoinsLimit + stats.nMempoolLimit >= nSpace - 2);
+    BOOST_CHECK_CLOSE((double)stats.nCoinsLimit / stats.nMempoolLimit, (double)nCoinsMax / nMempoolMax, 0.0001);
+}
+
+BOOST_AUTO_TEST_CASE(memory_budget_split)
+{
+    const size_t nCoinsDefault = nDefaultDbCache << 20;
+    const size_t nMempoolDefault = DEFAULT_MAX_MEMPOOL_SIZE * 1000000;
+    const size_t nMempoolMin = DEFAULT_DESCENDANT_SIZE_LIMIT * 1000 * 40;
+
+    // The default budget leaves the default bounds alone
+    CMemoryUsageStats stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    SplitMemoryBudget(stats, (size_t)DEFAULT_MAX_MEMORY_SIZE << 30, nCoinsDefault, nMempoolDefault, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, nCoinsDefault);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, nMempoolDefault);
+
+    // No budget, however much the fixed structures take
+    stats = FixedMemoryUsage((size_t)16 << 30, 0, 0);
+    SplitMemoryBudget(stats, 0, nCoinsDefault, nMempoolDefault, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, nCoinsDefault);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, nMempoolDefault);
+
+    // A huge budget, up to the largest -maxmemory, with the largest -dbcache
+    stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    SplitMemoryBudget(stats, (std::numeric_limits<size_t>::max() >> 30) << 30, nMaxDbCache << 20, nMempoolDefault, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, (size_t)nMaxDbCache << 20);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, nMempoolDefault);
+
+    // A small budget is shared, and the default bounds as much as explicit ones
+    CheckMemoryShare(512 << 20, nCoinsDefault, nMempoolDefault);
+    CheckMemoryShare((size_t)2 << 30, (size_t)4000 << 20, 1000 * 1000000);
+    CheckMemoryShare((size_t)1 << 30, 100 << 20, 2000 * 1000000);
+
+    // Small explicit bounds which fit are kept
+    stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    SplitMemoryBudget(stats, 512 << 20, nMinDbCache << 20, 10 * 1000000, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, (size_t)nMinDbCache << 20);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, 10 * 1000000);
+
+    // A budget the fixed structures already exceed leaves the floors
+    stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    SplitMemoryBudget(stats, 128 << 20, nCoinsDefault, nMempoolDefault, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, (size_t)nMinDbCache << 20);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, nMempoolMin);
+    stats = FixedMemoryUsage(200 << 20, 32 << 20, 16 << 20);
+    SplitMemoryBudget(stats, 128 << 20, nCoinsDefault, nMempoolMin / 2, nMempoolMin);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, nMempoolMin / 2);
+}
+
+BOOST_AUTO_TEST_CASE(memory_budget_args)
+{
+    // -dbcache ends up in nCoinCacheUsage, -maxmemory in nMaxMemoryUsage
+    size_t nCoinCacheUsageOld = nCoinCacheUsage;
+    size_t nMaxMemoryUsageOld = nMaxMemoryUsage;
+    nCoinCacheUsage = (size_t)4000 << 20;
+    ForceSetArg("-maxmempool", "10");
+
+    nMaxMemoryUsage = 0;
+    CMemoryUsageStats stats = GetMemoryUsageStats();
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, (size_t)4000 << 20);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, 10 * 1000000);
+
+    // Less than the genesis block index already takes
+    nMaxMemoryUsage = 1;
+    stats = GetMemoryUsageStats();
+    BOOST_CHECK(stats.nBlockIndex > 0);
+    BOOST_CHECK_EQUAL(stats.nCoinsLimit, (size_t)nMinDbCache << 20);
+    BOOST_CHECK_EQUAL(stats.nMempoolLimit, DEFAULT_DESCENDANT_SIZE_LIMIT * 1000 * 40);
+
+    ForceSetArg("-maxmempool", std::to_string(DEFAULT_MAX_MEMPOOL_SIZE));
+    nCoinCacheUsage = nCoinCacheUsageOld;
+    nMaxMemoryUsage = nMaxMemoryUsageOld;
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "mappedfile.h"
+#include "streams.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mappedfile_tests, BasicTestingSetup)
+
+#ifndef WIN32
+static void AppendToFile(const boost::filesystem::path& path, const std::string& str)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(str.data(), 1, str.size(), file), str.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(mappedfile_cache)
+{
+    boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir);
+    boost::filesystem::path path1 = dir / "file1";
+    boost::filesystem::path path2 = dir / "file2";
+    boost::filesystem::path path3 = dir / "file3";
+    AppendToFile(path1, "abcd");
+    AppendToFile(path2, "efgh");
+    AppendToFile(path3, "ijkl");
+
+    CMappedFileCache cache(2);
+    BOOST_CHECK(!cache.Get(dir / "missing", 0));
+
+    std::shared_ptr<const CMappedFile> file1 = cache.Get(path1, 4);
+    BOOST_REQUIRE(file1);
+    BOOST_CHECK_EQUAL(std::string(file1->data(), file1->size()), "abcd");
+    BOOST_CHECK(cache.Get(path1, 2) == file1);
+
+    // Data appended later is mapped again once asked for
+    AppendToFile(path1, "mnop");
+    BOOST_CHECK(cache.Get(path1, 4) == file1);
+    std::shared_ptr<const CMappedFile> file1Grown = cache.Get(path1, 8);
+    BOOST_REQUIRE(file1Grown);
+    BOOST_CHECK_EQUAL(std::string(file1Grown->data(), file1Grown->size()), "abcdmnop");
+    BOOST_CHECK(!cache.Get(path1, 9));
+    file1Grown = cache.Get(path1, 8);
+    BOOST_REQUIRE(file1Grown);
+    // The old map is still valid while referenced
+    BOOST_CHECK_EQUAL(std::string(file1->data(), file1->size()), "abcd");
+
+    // The least recently used file is dropped first
+    BOOST_CHECK(cache.Get(path2, 4));
+    BOOST_CHECK(cache.Get(path1, 4) == file1Grown);
+    BOOST_CHECK(cache.Get(path3, 4));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK(cache.Get(path1, 4) == file1Grown);
+
+    cache.Erase(path1);
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+    BOOST_CHECK(cache.Get(path1, 4) != file1Grown);
+
+    boost::filesystem::remove_all(dir);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << uint32_t(1) << std::string("abc") << uint16_t(2);
+
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, &ss[0], &ss[0] + ss.size());
+    uint32_t a;
+    std::string b;
+    uint16_t c;
+    reader >> a;
+    reader.ignore(4);
+    reader >> c;
+    BOOST_CHECK_EQUAL(a, 1);
+    BOOST_CHECK_EQUAL(c, 2);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> c, std::ios_base::failure);
+
+    CSpanReader reader2(SER_DISK, CLIENT_VERSION, &ss[0], &ss[0] + ss.size());
+    reader2 >> a >> b;
+    BOOST_CHECK_EQUAL(b, "abc");
+    BOOST_CHECK_EQUAL(reader2.size(), 2);
+    BOOST_CHECK_THROW(reader2.ignore(3), std::ios_base::failure);
+}
+
+BOOST_FIXTURE_TEST_CASE(raw_blocks_read, TestChain100Setup)
+{
+    // Out of the order of the file, with one position asked for twice and one that holds no block
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<uint256> vHash;
+    {
+        LOCK(cs_main);
+        for (int nHeight = chainActive.Height(); nHeight > 0; nHeight -= 3) {
+            vPos.push_back(chainActive[nHeight]->GetBlockPos());
+            vHash.push_back(chainActive[nHeight]->GetBlockHash());
+        }
+        vPos.push_back(chainActive[1]->GetBlockPos());
+        vHash.push_back(chainActive[1]->GetBlockHash());
+    }
+    std::reverse(vPos.begin() + vPos.size() / 2, vPos.end());
+    std::reverse(vHash.begin() + vHash.size() / 2, vHash.end());
+    vPos.push_back(CDiskBlockPos());
+    vHash.push_back(uint256());
+
+    std::vector<std::vector<unsigned char> > vData;
+    BOOST_CHECK(!ReadRawBlocksFromDisk(vData, vPos));
+    BOOST_REQUIRE_EQUAL(vData.size(), vPos.size());
+    for (size_t i = 0; i + 1 < vPos.size(); i++) {
+        std::string strData;
+        BOOST_REQUIRE(ReadRawRecordFromDisk(strData, vPos[i], false));
+        BOOST_CHECK(std::string(vData[i].begin(), vData[i].end()) == strData);
+        const char* pbegin = (const char*)vData[i].data();
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pbegin, pbegin + vData[i].size());
+        CBlockHeader header;
+        reader >> header;
+        BOOST_CHECK(header.GetHash() == vHash[i]);
+    }
+    BOOST_CHECK(vData.back().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "policy/policy.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -429,6 +430,129 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorChainTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    // A chain of transactions, each spending the one before
+    std::vector<CMutableTransaction> vChain(10);
+    for (size_t i = 0; i < vChain.size(); i++) {
+        vChain[i].vin.resize(1);
+        vChain[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0)
+            vChain[i].vin[0].prevout = COutPoint(vChain[i - 1].GetHash(), 0);
+        vChain[i].vout.resize(1);
+        vChain[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vChain[i].vout[0].nValue = (100 - i) * COIN;
+    }
+    for (size_t i = 0; i < vChain.size(); i++) {
+        CTxMemPool::setEntries setAncestors;
+        BOOST_CHECK(pool.CalculateMemPoolAncestors(entry.FromTx(vChain[i]), setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy));
+        BOOST_CHECK_EQUAL(setAncestors.size(), i);
+        pool.addUnchecked(vChain[i].GetHash(), entry.FromTx(vChain[i]));
+    }
+
+    // The limits are those of the whole chain
+    CMutableTransaction txNext;
+    txNext.vin.resize(1);
+    txNext.vin[0].prevout = COutPoint(vChain.back().GetHash(), 0);
+    txNext.vout.resize(1);
+    txNext.vout[0].nValue = COIN;
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(txNext), setAncestors, 10, nNoLimit, nNoLimit, nNoLimit, dummy));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(txNext), setAncestors, nNoLimit, nNoLimit, 10, nNoLimit, dummy));
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry.FromTx(txNext), setAncestors, 11, nNoLimit, 11, nNoLimit, dummy));
+
+    // Mining the start of the chain drops it from the ancestors of the rest
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(vChain[0]));
+    vtx.push_back(MakeTransactionRef(vChain[1]));
+    pool.removeForBlock(vtx, 1);
+    CTxMemPool::txiter it = pool.mapTx.find(vChain.back().GetHash());
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), vChain.size() - 3);
+    BOOST_CHECK(setAncestors.count(pool.mapTx.find(vChain[2].GetHash())));
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), vChain.size() - 2);
+
+    // Putting them back as a disconnected block makes them ancestors again
+    pool.addUnchecked(vChain[0].GetHash(), entry.FromTx(vChain[0]));
+    pool.addUnchecked(vChain[1].GetHash(), entry.FromTx(vChain[1]));
+    std::vector<uint256> vHashUpdate;
+    vHashUpdate.push_back(vChain[0].GetHash());
+    vHashUpdate.push_back(vChain[1].GetHash());
+    pool.UpdateTransactionsFromBlock(vHashUpdate);
+    it = pool.mapTx.find(vChain.back().GetHash());
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), vChain.size() - 1);
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), vChain.size());
+
+    // Removing a transaction with its descendants leaves those before it intact
+    pool.removeRecursive(vChain[5]);
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+    it = pool.mapTx.find(vChain[4].GetHash());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolAncestors(it).size(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPriorityIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* highest priority at first */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Priority(10.0).FromTx(tx1));
+
+    /* lower priority, but its in-chain inputs age it */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 1;
+    pool.addUnchecked(tx2.GetHash(), entry.Priority(5.0).FromTx(tx2, &pool));
+
+    /* lowest priority */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Priority(1.0).FromTx(tx3));
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.push_back(tx1.GetHash().ToString());
+    sortedOrder.push_back(tx2.GetHash().ToString());
+    sortedOrder.push_back(tx3.GetHash().ToString());
+    CheckSort<mining_priority>(pool, sortedOrder);
+
+    /* a thousand blocks later tx2 overtakes tx1 */
+    pool.UpdateMiningPriorities(1000);
+    BOOST_CHECK(pool.mapTx.find(tx2.GetHash())->GetMiningPriority() > 10.0);
+    std::swap(sortedOrder[0], sortedOrder[1]);
+    CheckSort<mining_priority>(pool, sortedOrder);
+
+    /* priority deltas are part of the key */
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 1000.0, 0);
+    sortedOrder.insert(sortedOrder.begin(), sortedOrder.back());
+    sortedOrder.pop_back();
+    CheckSort<mining_priority>(pool, sortedOrder);
+
+    /* entries added later are keyed at the height of the index */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    tx4.vout[0].nValue = 1;
+    pool.addUnchecked(tx4.GetHash(), entry.Priority(5.0).FromTx(tx4, &pool));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4.GetHash())->GetMiningPriority(), pool.mapTx.find(tx4.GetHash())->GetPriority(1000));
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -584,4 +708,113 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolDPoSLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    std::vector<unsigned char> vchVote(4, 0);
+    vchVote.push_back(OP_VOTE);
+    vchVote.resize(30);
+    CMutableTransaction vote[3];
+    for (int i = 0; i < 3; i++) {
+        vote[i].vin.resize(1);
+        vote[i].vin[0].scriptSig = CScript() << i;
+        vote[i].vout.resize(1);
+        vote[i].vout[0].scriptPubKey = CScript() << OP_RETURN << vchVote;
+        vote[i].vout[0].nValue = 0;
+        pool.addUnchecked(vote[i].GetHash(), entry.Fee(OP_VOTE_FORGER_FEE).Time(i + 1).FromTx(vote[i], &pool));
+    }
+    uint64_t nVoteSize = GetVirtualTransactionSize(vote[0]);
+    BOOST_CHECK_EQUAL(pool.GetTotalDPoSTxSize(), 3 * nVoteSize);
+
+    CMutableTransaction tx = CMutableTransaction();
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_4;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx.GetHash(), entry.Fee(10 * COIN).Time(0).FromTx(tx, &pool));
+
+    // The newest operation goes first when they are over their own limit, without a fee bump
+    pool.TrimToSize(pool.DynamicMemoryUsage(), NULL, 2 * nVoteSize);
+    BOOST_CHECK(pool.exists(vote[0].GetHash()));
+    BOOST_CHECK(pool.exists(vote[1].GetHash()));
+    BOOST_CHECK(!pool.exists(vote[2].GetHash()));
+    BOOST_CHECK(pool.exists(tx.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetTotalDPoSTxSize(), 2 * nVoteSize);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // Other transactions are evicted before them, whatever their feerate
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(vote[0].GetHash()));
+    BOOST_CHECK(pool.exists(vote[1].GetHash()));
+    BOOST_CHECK(!pool.exists(tx.GetHash()));
+
+    // ... until nothing else is left
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(pool.GetTotalDPoSTxSize(), nVoteSize);
+}
+
+
+BOOST_AUTO_TEST_CASE(MempoolChangesTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+
+    uint64_t nStart = pool.GetSequence();
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(10000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(10000LL).FromTx(txChild));
+
+    // The snapshot has the entries with their in-pool parents
+    uint64_t nSequence;
+    std::vector<CTxMemPoolEntryInfo> vInfo = pool.SnapshotEntries(1, nSequence);
+    BOOST_CHECK_EQUAL(nSequence, nStart + 2);
+    BOOST_CHECK_EQUAL(vInfo.size(), 2);
+    for (const CTxMemPoolEntryInfo& info : vInfo) {
+        if (info.txid == txChild.GetHash()) {
+            BOOST_CHECK_EQUAL(info.vDepends.size(), 1);
+            BOOST_CHECK(info.vDepends[0] == txParent.GetHash());
+            BOOST_CHECK_EQUAL(info.nCountWithAncestors, 2);
+        } else {
+            BOOST_CHECK(info.vDepends.empty());
+            BOOST_CHECK_EQUAL(info.nCountWithDescendants, 2);
+        }
+    }
+
+    pool.removeRecursive(txParent);
+    std::vector<CTxMemPoolChange> vChanges;
+    BOOST_CHECK(pool.GetChangesSince(nStart + 1, vChanges, nSequence));
+    BOOST_CHECK_EQUAL(nSequence, nStart + 4);
+    BOOST_CHECK_EQUAL(vChanges.size(), 3);
+    BOOST_CHECK(vChanges[0].txid == txChild.GetHash() && vChanges[0].fAdded);
+    BOOST_CHECK(!vChanges[1].fAdded && !vChanges[2].fAdded);
+    BOOST_CHECK_EQUAL(vChanges[2].nSequence, nStart + 4);
+
+    BOOST_CHECK(pool.GetChangesSince(nSequence, vChanges, nSequence));
+    BOOST_CHECK(vChanges.empty());
+    BOOST_CHECK(!pool.GetChangesSince(nSequence + 1, vChanges, nSequence));
+
+    // Clearing the pool drops the changes before it
+    pool.clear();
+    BOOST_CHECK(!pool.GetChangesSince(nStart, vChanges, nSequence));
+    BOOST_CHECK(pool.GetChangesSince(pool.GetSequence(), vChanges, nSequence));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "net_processing.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -172,4 +173,53 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnode_send_priority)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    // No socket, so the messages stay queued
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", false));
+    CConnman connman(0x1337, 0x1337);
+
+    const char* commands[] = {NetMsgType::TX, NetMsgType::BLOCK, NetMsgType::INV, NetMsgType::HEADERS, NetMsgType::TX, NetMsgType::CMPCTBLOCK};
+    for (const char* command : commands)
+        connman.PushMessage(pnode.get(), MakeSharedNetMsg(command, std::make_shared<const std::vector<unsigned char> >(10)));
+
+    // The block relay messages go first, in the order they were pushed
+    const char* expected[] = {NetMsgType::BLOCK, NetMsgType::HEADERS, NetMsgType::CMPCTBLOCK, NetMsgType::TX, NetMsgType::INV, NetMsgType::TX};
+    BOOST_CHECK_EQUAL(pnode->vSendMsg.size(), 6U);
+    for (size_t i = 0; i < pnode->vSendMsg.size(); i++)
+        BOOST_CHECK_EQUAL(pnode->vSendMsg[i]->command, expected[i]);
+    BOOST_CHECK_EQUAL(pnode->nSendPriority, 3U);
+    BOOST_CHECK_EQUAL(pnode->nSendSize, 6 * (10 + CMessageHeader::HEADER_SIZE));
+}
+
+BOOST_AUTO_TEST_CASE(time_histogram)
+{
+    CTimeHistogram hist;
+    BOOST_CHECK_EQUAL(hist.GetPercentile(0.5), 0);
+
+    // 0 goes to the first bucket, 1 to the second, 2 and 3 to the third
+    hist.Add(0);
+    hist.Add(1);
+    hist.Add(3);
+    hist.Add(-5);
+    BOOST_CHECK_EQUAL(hist.vBuckets[0], 2U);
+    BOOST_CHECK_EQUAL(hist.vBuckets[1], 1U);
+    BOOST_CHECK_EQUAL(hist.vBuckets[2], 1U);
+    BOOST_CHECK_EQUAL(hist.nCount, 4U);
+    BOOST_CHECK_EQUAL(hist.nTotal, 4);
+    BOOST_CHECK_EQUAL(hist.nMax, 3);
+    BOOST_CHECK_EQUAL(hist.GetPercentile(0.5), 0);
+    BOOST_CHECK_EQUAL(hist.GetPercentile(0.75), 1);
+    BOOST_CHECK_EQUAL(hist.GetPercentile(1.0), 3);
+
+    // Very long durations land in the last bucket
+    hist.Add((int64_t)1 << 40);
+    BOOST_CHECK_EQUAL(hist.vBuckets[CTimeHistogram::BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(hist.GetPercentile(1.0), (int64_t)1 << 40);
+    BOOST_CHECK_EQUAL(hist.GetPercentile(0.9), (int64_t)1 << 40);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notifier.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(notifier_tests, BasicTestingSetup)
+
+static std::vector<std::string> ReadLines(const boost::filesystem::path& path)
+{
+    std::vector<std::string> vLines;
+    std::ifstream file(path.string());
+    std::string strLine;
+    while (std::getline(file, strLine))
+        vLines.push_back(strLine);
+    return vLines;
+}
+
+BOOST_AUTO_TEST_CASE(notifier_pipe)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / ("notify_" + GetRandHash().GetHex());
+    {
+        CNotifier notifier(4, path.string());
+        BOOST_CHECK(notifier.IsPiped());
+        for (int i = 0; i < 100; i++)
+            notifier.Notify("block", "", std::to_string(i), true);
+        for (int i = 0; i < 100; i++)
+            notifier.Notify("wallet", "", std::to_string(i % 10), false);
+        while (ReadLines(path).empty() || ReadLines(path).back() != "wallet 9")
+            MilliSleep(1);
+    }
+
+    // A tip only replaces the one still waiting, so the blocks come in
+    // order and end at the latest, and a waiting transaction is not repeated
+    std::vector<std::string> vLines = ReadLines(path);
+    int nLastBlock = -1;
+    std::vector<std::string> vWallet;
+    for (const std::string& strLine : vLines) {
+        if (strLine.compare(0, 6, "block ") == 0) {
+            int nBlock = std::stoi(strLine.substr(6));
+            BOOST_CHECK(nBlock > nLastBlock);
+            nLastBlock = nBlock;
+        } else {
+            BOOST_CHECK(strLine.compare(0, 7, "wallet ") == 0);
+            vWallet.push_back(strLine);
+        }
+    }
+    BOOST_CHECK_EQUAL(nLastBlock, 99);
+    BOOST_CHECK(vWallet.size() >= 10 && vWallet.size() <= 100);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -124,4 +124,45 @@ BOOST_AUTO_TEST_CASE(pmt_malleability)
     BOOST_CHECK(tree.ExtractMatches(vTxid, vIndex).IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(pmt_coinbase_proof)
+{
+    for (unsigned int nTx : {1, 2, 7, 100}) {
+        CBlock block;
+        for (unsigned int j = 0; j < nTx; j++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            if (j > 0)
+                tx.vin[0].prevout = COutPoint(ArithToUint256(j), 0);
+            tx.nLockTime = j;
+            block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+        }
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+
+        CCoinbaseProof proof(block);
+        BOOST_CHECK(proof.Verify());
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << proof;
+        CCoinbaseProof proof2;
+        ss >> proof2;
+        BOOST_CHECK(proof2.Verify());
+        BOOST_CHECK(proof2.coinbase->GetHash() == block.vtx[0]->GetHash());
+
+        // Another coinbase, or a header with another merkle root
+        CMutableTransaction coinbase(*block.vtx[0]);
+        coinbase.nLockTime++;
+        proof2.coinbase = MakeTransactionRef(std::move(coinbase));
+        BOOST_CHECK(!proof2.Verify());
+        proof.header.hashMerkleRoot = ArithToUint256(1);
+        BOOST_CHECK(!proof.Verify());
+
+        // A proof of another transaction of the block
+        if (nTx > 1) {
+            CCoinbaseProof proof3(block);
+            proof3.coinbase = block.vtx[1];
+            BOOST_CHECK(!proof3.Verify());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
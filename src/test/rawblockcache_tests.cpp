@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/block.h"
+#include "rawblockcache.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(rawblockcache_tests, BasicTestingSetup)
+
+static CBlock MakeBlock(uint32_t nTime, bool fWitness)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_TRUE;
+    if (fWitness)
+        tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 1));
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+
+    CBlock block;
+    block.nTime = nTime;
+    block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    return block;
+}
+
+static std::vector<unsigned char> SerializeBlock(const CBlock& block, int nFlags)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | nFlags);
+    ss << block;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(rawblockcache_get)
+{
+    CRawBlockCache cache(1 << 20);
+    CBlock block = MakeBlock(1, false);
+    CBlock blockWitness = MakeBlock(2, true);
+    BOOST_CHECK(!cache.Get(block.GetHash(), true));
+
+    cache.Insert(block);
+    cache.Insert(blockWitness);
+    cache.Insert(block);
+    BOOST_CHECK_EQUAL(cache.Bytes(), SerializeBlock(block, 0).size() + SerializeBlock(blockWitness, 0).size());
+
+    // Without witness data both serializations are the same
+    std::shared_ptr<const std::vector<unsigned char> > data = cache.Get(block.GetHash(), false);
+    BOOST_REQUIRE(data);
+    BOOST_CHECK(*data == SerializeBlock(block, SERIALIZE_TRANSACTION_NO_WITNESS));
+    BOOST_CHECK(cache.Get(block.GetHash(), true) == data);
+
+    data = cache.Get(blockWitness.GetHash(), true);
+    BOOST_REQUIRE(data);
+    BOOST_CHECK(*data == SerializeBlock(blockWitness, 0));
+    BOOST_CHECK(!cache.Get(blockWitness.GetHash(), false));
+}
+
+BOOST_AUTO_TEST_CASE(rawblockcache_evict)
+{
+    std::vector<CBlock> vBlock;
+    for (uint32_t i = 0; i < 4; i++)
+        vBlock.push_back(MakeBlock(i, false));
+    const size_t nBlockSize = SerializeBlock(vBlock[0], 0).size();
+
+    // Room for three blocks; the oldest one goes first
+    CRawBlockCache cache(3 * nBlockSize);
+    for (const CBlock& block : vBlock)
+        cache.Insert(block);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 3 * nBlockSize);
+    BOOST_CHECK(!cache.Get(vBlock[0].GetHash(), true));
+    for (size_t i = 1; i < vBlock.size(); i++)
+        BOOST_CHECK(cache.Get(vBlock[i].GetHash(), true));
+
+    // A block bigger than the whole cache is not kept
+    CRawBlockCache cacheSmall(nBlockSize - 1);
+    cacheSmall.Insert(vBlock[0]);
+    BOOST_CHECK_EQUAL(cacheSmall.Bytes(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -343,4 +344,44 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    // Read-only elements run on several threads, the others one by one, and the replies keep the order of the requests
+    ForceSetArg("-rpcthreads", "4");
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 40; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.push_back(Pair("method", i % 10 == 5 ? "getnewaddress" : "echo"));
+        req.push_back(Pair("params", UniValue(UniValue::VARR)));
+        req.push_back(Pair("id", i));
+        batch.push_back(req);
+    }
+    batch.push_back(UniValue("not an object"));
+
+    UniValue replies;
+    BOOST_CHECK(replies.read(JSONRPCExecBatch(batch)));
+    BOOST_CHECK(replies.isArray());
+    BOOST_CHECK_EQUAL(replies.size(), 41U);
+    for (int i = 0; i < 40; i++)
+        BOOST_CHECK_EQUAL(find_value(replies[i], "id").get_int(), i);
+    BOOST_CHECK(find_value(replies[40], "error").isObject());
+}
+
+BOOST_FIXTURE_TEST_CASE(rpc_chain_tip_snapshot, TestChain100Setup)
+{
+    // The tip RPCs answer from the published snapshot, which follows chainActive
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    LOCK(cs_main);
+    BOOST_CHECK(tip->pindexTip == chainActive.Tip());
+    BOOST_CHECK_EQUAL(tip->nHeight, chainActive.Height());
+    BOOST_CHECK(tip->hashTip == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(tip->nMedianTimePast, chainActive.Tip()->GetMedianTimePast());
+
+    BOOST_CHECK_EQUAL(CallRPC("getblockcount").get_int(), chainActive.Height());
+    BOOST_CHECK_EQUAL(CallRPC("getbestblockhash").get_str(), chainActive.Tip()->GetBlockHash().GetHex());
+    for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight += 7)
+        BOOST_CHECK_EQUAL(CallRPC(strprintf("getblockhash %d", nHeight)).get_str(), chainActive[nHeight]->GetBlockHash().GetHex());
+    BOOST_CHECK_THROW(CallRPC(strprintf("getblockhash %d", chainActive.Height() + 1)), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -114,4 +114,143 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+BOOST_AUTO_TEST_CASE(singlethreadedclient_ordering)
+{
+    // Two clients share a scheduler serviced by several threads, yet each
+    // runs its functions one at a time and in the order they were added
+    CScheduler scheduler;
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    SingleThreadedSchedulerClient client1(&scheduler);
+    SingleThreadedSchedulerClient client2(&scheduler);
+    std::vector<int> vOrder1, vOrder2;
+    int nRunning1 = 0, nRunning2 = 0;
+    bool fOverlap1 = false, fOverlap2 = false;
+    for (int i = 0; i < 100; i++) {
+        client1.AddToProcessQueue([i, &vOrder1, &nRunning1, &fOverlap1]() {
+            fOverlap1 |= ++nRunning1 > 1;
+            vOrder1.push_back(i);
+            MicroSleep(10);
+            nRunning1--;
+        });
+        client2.AddToProcessQueue([i, &vOrder2, &nRunning2, &fOverlap2]() {
+            fOverlap2 |= ++nRunning2 > 1;
+            vOrder2.push_back(i);
+            nRunning2--;
+        });
+    }
+    client1.Flush();
+    client2.Flush();
+    BOOST_CHECK(!fOverlap1 && !fOverlap2);
+    BOOST_CHECK_EQUAL(client1.CallbacksPending(), 0);
+    BOOST_CHECK_EQUAL(vOrder1.size(), 100);
+    BOOST_CHECK_EQUAL(vOrder2.size(), 100);
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(vOrder1[i], i);
+        BOOST_CHECK_EQUAL(vOrder2[i], i);
+    }
+
+    scheduler.stop(true);
+    threads.join_all();
+
+    // Without threads servicing the scheduler, Flush runs the queue itself
+    int nCount = 0;
+    client1.AddToProcessQueue([&nCount]() { nCount++; });
+    client1.AddToProcessQueue([&nCount]() { nCount++; });
+    BOOST_CHECK_EQUAL(client1.CallbacksPending(), 2);
+    client1.Flush();
+    BOOST_CHECK_EQUAL(nCount, 2);
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    CScheduler scheduler;
+
+    // Due tasks run highest priority first, whatever order they came in
+    std::vector<int> vOrder;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule([&vOrder]() { vOrder.push_back(SCHEDULER_PRIORITY_LOW); }, now, SCHEDULER_PRIORITY_LOW, "low");
+    scheduler.schedule([&vOrder]() { vOrder.push_back(SCHEDULER_PRIORITY_NORMAL); }, now, SCHEDULER_PRIORITY_NORMAL);
+    scheduler.schedule([&vOrder]() { vOrder.push_back(SCHEDULER_PRIORITY_HIGH); }, now, SCHEDULER_PRIORITY_HIGH, "high");
+    scheduler.stop(true);
+    scheduler.serviceQueue();
+    BOOST_CHECK_EQUAL(vOrder.size(), 3);
+    for (int i = 0; i < (int)vOrder.size(); i++)
+        BOOST_CHECK_EQUAL(vOrder[i], i);
+
+    std::map<std::string, CSchedulerTaskStats> mapStats;
+    BOOST_CHECK_EQUAL(scheduler.getTaskStats(mapStats), 0);
+    BOOST_CHECK_EQUAL(mapStats.size(), 3);
+    BOOST_CHECK_EQUAL(mapStats["high"].nRuns, 1);
+    BOOST_CHECK_EQUAL(mapStats["high"].priority, SCHEDULER_PRIORITY_HIGH);
+    BOOST_CHECK_EQUAL(mapStats["low"].priority, SCHEDULER_PRIORITY_LOW);
+    BOOST_CHECK_EQUAL(mapStats[""].nRuns, 1);
+    BOOST_CHECK(mapStats["low"].nTotalDelay >= mapStats["high"].nTotalDelay);
+}
+
+BOOST_AUTO_TEST_CASE(high_priority_thread)
+{
+    // With two threads, a background task that blocks leaves the other one
+    // to high priority tasks
+    CScheduler scheduler;
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fLowRunning = false, fRelease = false, fHighRan = false, fNormalRan = false;
+    scheduler.scheduleFromNow([&]() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fLowRunning = true;
+        cond.notify_all();
+        while (!fRelease)
+            cond.wait(lock);
+    }, 0, SCHEDULER_PRIORITY_LOW);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fLowRunning)
+            cond.wait(lock);
+    }
+    scheduler.scheduleFromNow([&]() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fNormalRan = true;
+        cond.notify_all();
+    }, 0, SCHEDULER_PRIORITY_NORMAL);
+    scheduler.scheduleFromNow([&]() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fHighRan = true;
+        cond.notify_all();
+    }, 0, SCHEDULER_PRIORITY_HIGH);
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fHighRan)
+            cond.wait(lock);
+        // The normal task waits for the thread the low one holds
+        BOOST_CHECK(!fNormalRan);
+        fRelease = true;
+        cond.notify_all();
+        while (!fNormalRan)
+            cond.wait(lock);
+    }
+
+    scheduler.stop(true);
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(coalesce_periodic)
+{
+    CScheduler scheduler;
+    int nCount = 0;
+    BOOST_CHECK(scheduler.scheduleEvery([&nCount]() { nCount++; }, 60, SCHEDULER_PRIORITY_LOW, "flush"));
+    BOOST_CHECK(!scheduler.scheduleEvery([&nCount]() { nCount++; }, 60, SCHEDULER_PRIORITY_LOW, "flush"));
+    BOOST_CHECK(scheduler.scheduleEvery([&nCount]() { nCount++; }, 60));
+    BOOST_CHECK(scheduler.scheduleEvery([&nCount]() { nCount++; }, 60));
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
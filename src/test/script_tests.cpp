@@ -13,6 +13,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 #include "rpc/server.h"
 
 #if defined(HAVE_CONSENSUS_LIB)
@@ -1443,4 +1444,148 @@ BOOST_AUTO_TEST_CASE(script_FindAndDelete)
     BOOST_CHECK(s == expect);
 }
 
+/** VerifyScript without P2SH, with the scriptPubKey always run by EvalScript */
+static bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness& witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
+        *serror = SCRIPT_ERR_SIG_PUSHONLY;
+        return false;
+    }
+    std::vector<std::vector<unsigned char> > stack;
+    if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
+        return false;
+    if (!EvalScript(stack, scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
+        return false;
+    // The script ends with OP_CHECKSIG, which pushes either true or an empty vector
+    if (stack.empty() || stack.back().empty()) {
+        *serror = SCRIPT_ERR_EVAL_FALSE;
+        return false;
+    }
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) != 0 && stack.size() != 1) {
+        *serror = SCRIPT_ERR_CLEANSTACK;
+        return false;
+    }
+    if ((flags & SCRIPT_VERIFY_WITNESS) != 0 && !witness.IsNull()) {
+        *serror = SCRIPT_ERR_WITNESS_UNEXPECTED;
+        return false;
+    }
+    *serror = SCRIPT_ERR_OK;
+    return true;
+}
+
+static std::vector<unsigned char> RandomPush(const std::vector<unsigned char>& vch)
+{
+    // Mostly the push as signed, sometimes changed in a way the script checks may catch
+    std::vector<unsigned char> ret(vch);
+    switch (insecure_rand() % 12) {
+    case 0: ret.clear(); break;
+    case 1: if (!ret.empty()) ret[insecure_rand() % ret.size()] ^= 1 << (insecure_rand() % 8); break;
+    case 2: if (!ret.empty()) ret.pop_back(); break;
+    case 3: ret.push_back(insecure_rand()); break;
+    case 4: ret.assign(1, insecure_rand() % 17); break;
+    case 5: ret.resize(MAX_SCRIPT_ELEMENT_SIZE + 1); break;
+    }
+    return ret;
+}
+
+static CScript RandomScriptSig(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey)
+{
+    switch (insecure_rand() % 8) {
+    case 0: {
+        // Non-minimal push of the signature
+        CScript script;
+        script.insert(script.end(), OP_PUSHDATA1);
+        script.insert(script.end(), (unsigned char)vchSig.size());
+        script.insert(script.end(), vchSig.begin(), vchSig.end());
+        return script << vchPubKey;
+    }
+    case 1: return CScript() << vchSig << vchPubKey << OP_NOP;
+    case 2: return CScript() << OP_1 << vchSig << vchPubKey;
+    case 3: return CScript() << vchPubKey;
+    case 4: return CScript() << vchSig << OP_DUP;
+    }
+    return CScript() << vchSig << vchPubKey;
+}
+
+static unsigned int RandomVerifyFlags()
+{
+    static const unsigned int vFlags[] = {SCRIPT_VERIFY_STRICTENC, SCRIPT_VERIFY_DERSIG, SCRIPT_VERIFY_LOW_S, SCRIPT_VERIFY_SIGPUSHONLY,
+        SCRIPT_VERIFY_MINIMALDATA, SCRIPT_VERIFY_NULLFAIL, SCRIPT_VERIFY_WITNESS_PUBKEYTYPE, SCRIPT_VERIFY_CLEANSTACK, SCRIPT_VERIFY_WITNESS};
+    unsigned int flags = SCRIPT_VERIFY_P2SH;
+    for (unsigned int flag : vFlags) {
+        if (insecure_rand() % 2)
+            flags |= flag;
+    }
+    if (flags & SCRIPT_VERIFY_CLEANSTACK)
+        flags |= SCRIPT_VERIFY_WITNESS;
+    return flags;
+}
+
+// Goal: check that the pay-to-pubkey-hash paths of VerifyScript agree with the interpreter
+BOOST_AUTO_TEST_CASE(script_P2PKH_interpreted)
+{
+    seed_insecure_rand(false);
+    CKey keys[2];
+    keys[0].MakeNewKey(true);
+    keys[1].MakeNewKey(false);
+
+    for (int i = 0; i < 2000; i++) {
+        const CKey& key = keys[insecure_rand() % 2];
+        CPubKey pubkey = key.GetPubKey();
+        CPubKey pubkeyOther = keys[insecure_rand() % 2].GetPubKey();
+        bool fWitness = insecure_rand() % 2;
+        CScript script = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        CScript scriptPubKey = fWitness ? CScript() << OP_0 << ToByteVector(pubkey.GetID()) : script;
+        unsigned int flags = RandomVerifyFlags();
+        CAmount amount = insecure_rand() % 2 ? 0 : COIN;
+
+        CMutableTransaction txCredit = BuildCreditingTransaction(scriptPubKey, amount);
+        CMutableTransaction tx = BuildSpendingTransaction(CScript(), CScriptWitness(), txCredit);
+        int nHashType = insecure_rand() % 4 ? (int)SIGHASH_ALL : insecure_rand() % 256;
+        uint256 hash = SignatureHash(script, tx, 0, nHashType, amount, fWitness ? SIGVERSION_WITNESS_V0 : SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)nHashType);
+        if (insecure_rand() % 8 == 0)
+            NegateSignatureS(vchSig);
+        vchSig = RandomPush(vchSig);
+        std::vector<unsigned char> vchPubKey = RandomPush(ToByteVector(insecure_rand() % 8 ? pubkey : pubkeyOther));
+
+        ScriptError err, errInterpreted;
+        bool fValid, fValidInterpreted;
+        if (fWitness) {
+            // P2WPKH against the same script as a witness script
+            CScriptWitness witness, witnessScript;
+            witness.stack.push_back(vchSig);
+            witness.stack.push_back(vchPubKey);
+            if (insecure_rand() % 8 == 0)
+                witness.stack.push_back(vchPubKey);
+            witnessScript = witness;
+            witnessScript.stack.push_back(std::vector<unsigned char>(script.begin(), script.end()));
+            uint256 hashScript;
+            CSHA256().Write(&script[0], script.size()).Finalize(hashScript.begin());
+            CScript scriptPubKeyScript = CScript() << OP_0 << ToByteVector(hashScript);
+            MutableTransactionSignatureChecker checker(&tx, 0, amount);
+            fValid = VerifyScript(CScript(), scriptPubKey, &witness, flags, checker, &err);
+            fValidInterpreted = VerifyScript(CScript(), scriptPubKeyScript, &witnessScript, flags, checker, &errInterpreted);
+            if (witness.stack.size() != 2 && (flags & SCRIPT_VERIFY_WITNESS)) {
+                // A P2WSH stack of three only fails at the end
+                BOOST_CHECK(!fValid && err == SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
+                continue;
+            }
+        } else {
+            CScriptWitness witness;
+            if (insecure_rand() % 8 == 0)
+                witness.stack.push_back(vchPubKey);
+            CScript scriptSig = RandomScriptSig(vchSig, vchPubKey);
+            tx.vin[0].scriptSig = scriptSig;
+            MutableTransactionSignatureChecker checker(&tx, 0, amount);
+            fValid = VerifyScript(scriptSig, scriptPubKey, &witness, flags, checker, &err);
+            fValidInterpreted = VerifyScriptInterpreted(scriptSig, scriptPubKey, witness, flags, checker, &errInterpreted);
+        }
+        BOOST_CHECK_EQUAL(fValid, fValidInterpreted);
+        BOOST_CHECK_MESSAGE(err == errInterpreted, std::string(FormatScriptError(err)) + " where " + FormatScriptError(errInterpreted) + " expected");
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
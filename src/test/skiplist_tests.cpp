@@ -143,4 +143,36 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_test)
         BOOST_CHECK(vBlocksMain[r].GetAncestor(ret->nHeight) == ret);
     }
 }
+
+BOOST_AUTO_TEST_CASE(blockindexarena_test)
+{
+    CBlockIndexArena arena;
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+
+    CBlockHeader header;
+    header.SetNull();
+    header.nTime = 1234;
+    std::vector<CBlockIndex*> vIndex;
+    for (size_t i = 0; i < CBlockIndexArena::ENTRIES_PER_CHUNK * 2 + 1; i++) {
+        header.nNonce = i;
+        vIndex.push_back(i % 2 ? arena.New(header) : arena.New());
+        vIndex.back()->nHeight = i;
+    }
+    BOOST_CHECK_EQUAL(arena.size(), vIndex.size());
+    BOOST_CHECK_EQUAL(arena.DynamicUsage(), 3 * CBlockIndexArena::ENTRIES_PER_CHUNK * sizeof(CBlockIndex));
+
+    // Entries keep their address and fields as the arena grows
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, (int)i);
+        BOOST_CHECK_EQUAL(vIndex[i]->nNonce, i % 2 ? i : 0U);
+        BOOST_CHECK_EQUAL(vIndex[i]->nTime, i % 2 ? 1234U : 0U);
+        BOOST_CHECK(vIndex[i]->pprev == NULL && vIndex[i]->phashBlock == NULL);
+    }
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+    BOOST_CHECK(arena.New()->nHeight == 0);
+    BOOST_CHECK_EQUAL(arena.size(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "snapshot.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(snapshot_tests, BasicTestingSetup)
+
+static const int NUM_RECORDS = 100000;
+
+/** Records of a few sizes, enough of them to fill several chunks */
+static std::vector<std::vector<unsigned char>> MakeRecords()
+{
+    std::vector<std::vector<unsigned char>> vRecords(NUM_RECORDS);
+    for (std::vector<unsigned char>& record : vRecords) {
+        record.resize(insecure_rand() % 64);
+        for (unsigned char& c : record)
+            c = insecure_rand();
+    }
+    return vRecords;
+}
+
+static uint256 WriteSnapshot(const boost::filesystem::path& path, const std::vector<std::vector<unsigned char>>& vRecords)
+{
+    CSnapshotWriter writer(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    writer << (uint32_t)vRecords.size();
+    for (const std::vector<unsigned char>& record : vRecords)
+        writer << record;
+    uint256 hash = writer.Finish();
+    BOOST_CHECK_EQUAL(writer.GetFileSize(), boost::filesystem::file_size(path));
+    return hash;
+}
+
+/** Read all the records back, throwing on the first error */
+static uint256 ReadSnapshot(const boost::filesystem::path& path, const std::vector<std::vector<unsigned char>>& vRecords)
+{
+    CSnapshotReader reader(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    uint32_t nRecords;
+    reader >> nRecords;
+    BOOST_CHECK_EQUAL(nRecords, vRecords.size());
+    std::vector<unsigned char> record;
+    for (uint32_t i = 0; i < nRecords; i++) {
+        reader >> record;
+        BOOST_CHECK(record == vRecords[i]);
+    }
+    return reader.Finish();
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::vector<std::vector<unsigned char>> vRecords = MakeRecords();
+
+    uint256 hash = WriteSnapshot(path, vRecords);
+    BOOST_CHECK(boost::filesystem::file_size(path) > 2 * SNAPSHOT_CHUNK_SIZE);
+    BOOST_CHECK(ReadSnapshot(path, vRecords) == hash);
+
+    // Records left unread
+    {
+        CSnapshotReader reader(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        uint32_t nRecords;
+        reader >> nRecords;
+        BOOST_CHECK_THROW(reader.Finish(), std::ios_base::failure);
+    }
+
+    // Any changed byte, in the data or in a chunk hash, is caught
+    uint64_t nSize = boost::filesystem::file_size(path);
+    for (uint64_t nPos : {(uint64_t)0, (uint64_t)SNAPSHOT_CHUNK_SIZE + 10, nSize / 2, nSize - 1}) {
+        FILE* file = fopen(path.string().c_str(), "rb+");
+        BOOST_REQUIRE(file);
+        fseek(file, nPos, SEEK_SET);
+        int c = fgetc(file);
+        fseek(file, nPos, SEEK_SET);
+        fputc(c ^ 1, file);
+        fclose(file);
+        BOOST_CHECK_THROW(ReadSnapshot(path, vRecords), std::ios_base::failure);
+
+        file = fopen(path.string().c_str(), "rb+");
+        BOOST_REQUIRE(file);
+        fseek(file, nPos, SEEK_SET);
+        fputc(c, file);
+        fclose(file);
+        BOOST_CHECK(ReadSnapshot(path, vRecords) == hash);
+    }
+
+    // A file cut short, even right after its last record
+    boost::filesystem::resize_file(path, nSize - 1);
+    BOOST_CHECK_THROW(ReadSnapshot(path, vRecords), std::ios_base::failure);
+    boost::filesystem::resize_file(path, nSize - 33);
+    BOOST_CHECK_THROW(ReadSnapshot(path, vRecords), std::ios_base::failure);
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
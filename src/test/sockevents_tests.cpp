@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sockevents.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sockevents_tests, BasicTestingSetup)
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(sockevents_ready)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    CSocketEvents events;
+    std::vector<std::pair<int64_t, int> > vReady;
+    events.Set(fds[0], 7, CSocketEvents::EVENT_RECV);
+    BOOST_CHECK(events.Wait(0, vReady));
+    BOOST_CHECK(vReady.empty());
+
+    BOOST_REQUIRE_EQUAL(write(fds[1], "x", 1), 1);
+    BOOST_CHECK(events.Wait(1000, vReady));
+    BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+    BOOST_CHECK_EQUAL(vReady[0].first, 7);
+    BOOST_CHECK(vReady[0].second & CSocketEvents::EVENT_RECV);
+
+    // Level-triggered: unread data keeps it ready, unless it is not waited for
+    BOOST_CHECK(events.Wait(0, vReady));
+    BOOST_CHECK_EQUAL(vReady.size(), 1);
+    events.Set(fds[0], 7, CSocketEvents::EVENT_SEND);
+    BOOST_CHECK(events.Wait(1000, vReady));
+    BOOST_REQUIRE_EQUAL(vReady.size(), 1);
+    BOOST_CHECK(vReady[0].second & CSocketEvents::EVENT_SEND);
+    BOOST_CHECK(!(vReady[0].second & CSocketEvents::EVENT_RECV));
+
+    // Only the tag it was registered with removes a socket
+    events.Remove(fds[0], 8);
+    BOOST_CHECK(events.Wait(0, vReady));
+    BOOST_CHECK_EQUAL(vReady.size(), 1);
+    events.Remove(fds[0], 7);
+    BOOST_CHECK(events.Wait(0, vReady));
+    BOOST_CHECK(vReady.empty());
+
+    // A wakeup ends a wait early without reporting anything
+    BOOST_CHECK(events.CanWakeup());
+    events.Wakeup();
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK(events.Wait(10000, vReady));
+    BOOST_CHECK(vReady.empty());
+    BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, BasicTestingSetup)
+
+static const CLockSiteStats* FindSite(const std::vector<CLockSiteStats>& vSites, const std::string& strName)
+{
+    for (const CLockSiteStats& site : vSites) {
+        if (site.strName == strName)
+            return &site;
+    }
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(locktimestats_buckets)
+{
+    CLockTimeStats stats;
+    stats.Add(0);
+    stats.Add(1);
+    stats.Add(3);
+    stats.Add(4);
+    stats.Add(-5);
+    stats.Add(std::numeric_limits<int64_t>::max());
+    BOOST_CHECK_EQUAL(stats.nCount, 6);
+    BOOST_CHECK_EQUAL(stats.vBuckets[0], 2);
+    BOOST_CHECK_EQUAL(stats.vBuckets[1], 1);
+    BOOST_CHECK_EQUAL(stats.vBuckets[2], 1);
+    BOOST_CHECK_EQUAL(stats.vBuckets[3], 1);
+    BOOST_CHECK_EQUAL(stats.vBuckets[LOCKSTATS_BUCKETS - 1], 1);
+    BOOST_CHECK_EQUAL(stats.nMax, std::numeric_limits<int64_t>::max());
+
+    CLockTimeStats merged;
+    merged.Merge(stats);
+    merged.Merge(stats);
+    BOOST_CHECK_EQUAL(merged.nCount, 12);
+    BOOST_CHECK_EQUAL(merged.vBuckets[0], 4);
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_sites)
+{
+    int nSampleOld = nLockStatsSample;
+    nLockStatsSample = 1;
+    GetLockStats(true);
+
+    CCriticalSection csTest;
+    boost::shared_mutex sharedTest;
+    for (int i = 0; i < 3; i++) {
+        LOCK(csTest);
+    }
+    {
+        READ_LOCK(sharedTest);
+    }
+    {
+        WRITE_LOCK(sharedTest);
+    }
+
+    // A write lock held by another thread makes the read below wait
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fLocked = false;
+    boost::thread thread([&]() {
+        WRITE_LOCK(sharedTest);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fLocked = true;
+            cond.notify_all();
+        }
+        MilliSleep(10);
+    });
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fLocked)
+            cond.wait(lock);
+    }
+    {
+        READ_LOCK(sharedTest);
+    }
+    thread.join();
+
+    std::vector<CLockSiteStats> vSites = GetLockStats(true);
+    nLockStatsSample = nSampleOld;
+
+    const CLockSiteStats* psite = FindSite(vSites, "csTest");
+    BOOST_CHECK(psite);
+    if (psite) {
+        BOOST_CHECK_EQUAL(psite->hold.nCount, 3);
+        BOOST_CHECK_EQUAL(psite->nContended, 0);
+        BOOST_CHECK(psite->strFile.find("sync_tests.cpp") != std::string::npos);
+    }
+
+    // The two read locks and the two write locks each make two sites
+    int nShared = 0;
+    uint64_t nContended = 0;
+    int64_t nMaxWait = 0;
+    for (const CLockSiteStats& site : vSites) {
+        if (site.strName != "sharedTest")
+            continue;
+        nShared++;
+        nContended += site.nContended;
+        nMaxWait = std::max(nMaxWait, site.wait.nMax);
+    }
+    BOOST_CHECK_EQUAL(nShared, 4);
+    BOOST_CHECK_EQUAL(nContended, 1);
+    BOOST_CHECK(nMaxWait > 0);
+
+    // Reset left nothing behind
+    BOOST_CHECK(GetLockStats(false).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
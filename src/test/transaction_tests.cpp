@@ -304,14 +304,14 @@ SetupDummyInputs(CBasicKeyStore& keystoreRet, CCoinsViewCache& coinsRet)
     dummyTransactions[0].vout[0].scriptPubKey << ToByteVector(key[0].GetPubKey()) << OP_CHECKSIG;
     dummyTransactions[0].vout[1].nValue = 50*CENT;
     dummyTransactions[0].vout[1].scriptPubKey << ToByteVector(key[1].GetPubKey()) << OP_CHECKSIG;
-    coinsRet.ModifyCoins(dummyTransactions[0].GetHash())->FromTx(dummyTransactions[0], 0);
+    AddCoins(coinsRet, dummyTransactions[0], 0);
 
     dummyTransactions[1].vout.resize(2);
     dummyTransactions[1].vout[0].nValue = 21*CENT;
     dummyTransactions[1].vout[0].scriptPubKey = GetScriptForDestination(key[2].GetPubKey().GetID());
     dummyTransactions[1].vout[1].nValue = 22*CENT;
     dummyTransactions[1].vout[1].scriptPubKey = GetScriptForDestination(key[3].GetPubKey().GetID());
-    coinsRet.ModifyCoins(dummyTransactions[1].GetHash())->FromTx(dummyTransactions[1], 0);
+    AddCoins(coinsRet, dummyTransactions[1], 0);
 
     return dummyTransactions;
 }
@@ -467,19 +467,19 @@ BOOST_AUTO_TEST_CASE(test_big_witness_transaction) {
     for (int i=0; i<20; i++)
         threadGroup.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, boost::ref(scriptcheckqueue)));
 
-    CCoins coins;
-    coins.nVersion = 1;
-    coins.fCoinBase = false;
+    std::vector<Coin> coins;
     for(uint32_t i = 0; i < mtx.vin.size(); i++) {
-        CTxOut txout;
-        txout.nValue = 1000;
-        txout.scriptPubKey = scriptPubKey;
-        coins.vout.push_back(txout);
+        Coin coin;
+        coin.nHeight = 1;
+        coin.fCoinBase = false;
+        coin.out.nValue = 1000;
+        coin.out.scriptPubKey = scriptPubKey;
+        coins.emplace_back(std::move(coin));
     }
 
     for(uint32_t i = 0; i < mtx.vin.size(); i++) {
         std::vector<CScriptCheck> vChecks;
-        CScriptCheck check(coins, tx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS, false, &txdata);
+        CScriptCheck check(coins[tx.vin[i].prevout.n].out, tx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS, false, &txdata);
         vChecks.push_back(CScriptCheck());
         check.swap(vChecks.back());
         control.Add(vChecks);
@@ -492,6 +492,48 @@ BOOST_AUTO_TEST_CASE(test_big_witness_transaction) {
     threadGroup.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_ProduceSignatures)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // enough inputs to be signed on several threads
+    CMutableTransaction mtx;
+    uint256 prevId;
+    prevId.SetHex("0000000000000000000000000000000000000000000000000000000000000100");
+    for (uint32_t i = 0; i < 8 * SIGNING_INPUTS_PER_THREAD; i++)
+        mtx.vin.push_back(CTxIn(COutPoint(prevId, i)));
+    mtx.vout.push_back(CTxOut(1000, CScript() << OP_1));
+    const CTransaction txConst(mtx);
+
+    std::vector<const CScript*> vScriptPubKey(mtx.vin.size(), &scriptPubKey);
+    std::vector<CAmount> vAmount(mtx.vin.size(), 1000);
+    CScript scriptUnknown = CScript() << OP_1;
+    vScriptPubKey[1] = NULL;
+    vScriptPubKey[2] = &scriptUnknown;
+
+    std::vector<SignatureData> vSigData;
+    std::vector<bool> vSigned = ProduceSignatures(&keystore, txConst, vScriptPubKey, vAmount, SIGHASH_ALL, vSigData);
+    BOOST_CHECK_EQUAL(vSigned.size(), mtx.vin.size());
+    BOOST_CHECK(!vSigned[1] && vSigData[1].scriptSig.empty());
+    BOOST_CHECK(!vSigned[2]);
+
+    // the same signatures as signing the inputs one by one
+    CMutableTransaction mtxSerial(mtx);
+    for (uint32_t i = 0; i < mtx.vin.size(); i++) {
+        if (i == 1 || i == 2)
+            continue;
+        BOOST_CHECK(vSigned[i]);
+        BOOST_CHECK(SignSignature(keystore, scriptPubKey, mtxSerial, i, 1000, SIGHASH_ALL));
+        UpdateTransaction(mtx, i, vSigData[i]);
+        BOOST_CHECK(mtx.vin[i].scriptSig == mtxSerial.vin[i].scriptSig);
+        BOOST_CHECK(VerifyScript(mtx.vin[i].scriptSig, scriptPubKey, NULL, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, 1000)));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_witness)
 {
     CBasicKeyStore keystore, keystore2;
@@ -758,4 +800,47 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_CheckTxInputs_spent_outputs)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+
+    CMutableTransaction t;
+    t.vin.resize(2);
+    t.vout.resize(1);
+    t.vout[0].nValue = 90 * CENT;
+    t.vout[0].scriptPubKey = GetScriptForDestination(key1.GetPubKey().GetID());
+
+    std::vector<Consensus::CSpentOutput> vSpent(2);
+    for (auto& spent : vSpent)
+        spent = Consensus::CSpentOutput(CTxOut(50 * CENT, GetScriptForDestination(key1.GetPubKey().GetID())), 1, false);
+
+    CValidationState state;
+    CAmount nTxFee = 0;
+    BOOST_CHECK(Consensus::CheckTxInputs(t, state, vSpent, 1000, nTxFee));
+    BOOST_CHECK_EQUAL(nTxFee, 10 * CENT);
+
+    // All inputs must spend from the same address
+    vSpent[1] = Consensus::CSpentOutput(CTxOut(50 * CENT, GetScriptForDestination(key2.GetPubKey().GetID())), 1, false);
+    BOOST_CHECK(!Consensus::CheckTxInputs(t, state, vSpent, 1000, nTxFee));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-many-inputaddress");
+
+    // A script address with the same hash is a different address
+    vSpent[1] = Consensus::CSpentOutput(CTxOut(vSpent[1].txout.nValue, GetScriptForDestination(CScriptID(uint160(key1.GetPubKey().GetID())))), 1, false);
+    BOOST_CHECK(vSpent[1].fAddress);
+    state = CValidationState();
+    BOOST_CHECK(!Consensus::CheckTxInputs(t, state, vSpent, 1000, nTxFee));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-many-inputaddress");
+
+    // Coinbase outputs must mature before they are spent
+    vSpent[1] = vSpent[0];
+    vSpent[0].fCoinBase = true;
+    state = CValidationState();
+    BOOST_CHECK(!Consensus::CheckTxInputs(t, state, vSpent, COINBASE_MATURITY, nTxFee));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-premature-spend-of-coinbase");
+    state = CValidationState();
+    BOOST_CHECK(Consensus::CheckTxInputs(t, state, vSpent, COINBASE_MATURITY + 1, nTxFee));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
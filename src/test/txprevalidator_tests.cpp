@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txprevalidator.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txprevalidator_tests, BasicTestingSetup)
+
+static CTransactionRef MakeTx(uint32_t nLockTime)
+{
+    CMutableTransaction mtx;
+    mtx.nLockTime = nLockTime;
+    return MakeTransactionRef(mtx);
+}
+
+BOOST_AUTO_TEST_CASE(txprevalidator_order)
+{
+    // Checks block until released, so the test decides when they are done
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool fRelease = false;
+    std::atomic<int> nChecked(0);
+    std::atomic<int> nBatches(0);
+    std::atomic<int> nNotified(0);
+    std::atomic<size_t> nMaxBatch(0);
+    CTxPreValidator prevalidator(4,
+        [&](const std::vector<CTransactionRef>& vtx, std::vector<CPendingSignatures>& vPending) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return fRelease; });
+            vPending.resize(vtx.size());
+            for (size_t i = 0; i < vtx.size(); i++) {
+                // Stands for the signatures of the transaction
+                vPending[i].Add(vtx[i]->GetHash());
+            }
+            nMaxBatch = std::max(nMaxBatch.load(), vtx.size());
+            nBatches++;
+            nChecked += vtx.size();
+        },
+        [&]() { nNotified++; });
+
+    for (uint32_t i = 0; i < 10; i++)
+        prevalidator.Submit(1, MakeTx(i));
+    prevalidator.Submit(2, MakeTx(100));
+    BOOST_CHECK_EQUAL(prevalidator.GetQueued(1), 10);
+    BOOST_CHECK_EQUAL(prevalidator.GetQueued(2), 1);
+    BOOST_CHECK_EQUAL(prevalidator.GetQueued(3), 0);
+
+    CTransactionRef tx;
+    CPendingSignatures pending;
+    BOOST_CHECK(!prevalidator.TakeReady(1, tx, pending));
+    BOOST_CHECK(!prevalidator.TakeReady(3, tx, pending));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fRelease = true;
+    }
+    cond.notify_all();
+    while (nChecked < 11 || nNotified < nBatches)
+        MilliSleep(1);
+    BOOST_CHECK_EQUAL(nChecked, 11);
+    BOOST_CHECK(nMaxBatch <= MAX_PREVALIDATION_BATCH);
+
+    // Each peer gets its transactions back in the order they were submitted
+    for (uint32_t i = 0; i < 10; i++) {
+        BOOST_REQUIRE(prevalidator.TakeReady(1, tx, pending));
+        BOOST_CHECK_EQUAL(tx->nLockTime, i);
+        BOOST_CHECK(pending.Contains(tx->GetHash()));
+        pending.clear();
+    }
+    BOOST_CHECK(!prevalidator.TakeReady(1, tx, pending));
+    BOOST_CHECK_EQUAL(prevalidator.GetQueued(1), 0);
+
+    prevalidator.RemoveNode(2);
+    BOOST_CHECK_EQUAL(prevalidator.GetQueued(2), 0);
+    BOOST_CHECK(!prevalidator.TakeReady(2, tx, pending));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+static void CheckDifference(size_t nCells, size_t nShared, size_t nOurs, size_t nTheirs)
+{
+    CReconSketch ours(nCells), theirs(nCells);
+    std::vector<uint32_t> vOurs, vTheirs;
+    for (size_t i = 0; i < nShared + nOurs + nTheirs; i++) {
+        uint32_t nShortId = insecure_rand();
+        if (i < nShared) {
+            ours.Add(nShortId);
+            theirs.Add(nShortId);
+        } else if (i < nShared + nOurs) {
+            ours.Add(nShortId);
+            vOurs.push_back(nShortId);
+        } else {
+            theirs.Add(nShortId);
+            vTheirs.push_back(nShortId);
+        }
+    }
+
+    // The sketch goes over the wire before it is subtracted
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << theirs;
+    CReconSketch received;
+    stream >> received;
+    BOOST_CHECK_EQUAL(received.GetCells(), nCells);
+
+    BOOST_CHECK(ours.Subtract(received));
+    std::vector<uint32_t> vOnlyOurs, vOnlyTheirs;
+    BOOST_CHECK(ours.Decode(vOnlyOurs, vOnlyTheirs));
+    std::sort(vOurs.begin(), vOurs.end());
+    std::sort(vTheirs.begin(), vTheirs.end());
+    std::sort(vOnlyOurs.begin(), vOnlyOurs.end());
+    std::sort(vOnlyTheirs.begin(), vOnlyTheirs.end());
+    BOOST_CHECK(vOnlyOurs == vOurs);
+    BOOST_CHECK(vOnlyTheirs == vTheirs);
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decodes_difference)
+{
+    // A few differences in a thousand do not decode, which the protocol falls back from
+    seed_insecure_rand(true);
+    CheckDifference(MIN_RECON_SKETCH_CELLS, 0, 0, 0);
+    CheckDifference(MIN_RECON_SKETCH_CELLS, 100, 0, 0);
+    CheckDifference(MIN_RECON_SKETCH_CELLS, 100, 3, 2);
+    CheckDifference(MIN_RECON_SKETCH_CELLS, 1000, 5, 0);
+    CheckDifference(256, 2000, 60, 40);
+}
+
+BOOST_AUTO_TEST_CASE(sketch_too_small)
+{
+    CReconSketch ours(MIN_RECON_SKETCH_CELLS), theirs(MIN_RECON_SKETCH_CELLS);
+    for (size_t i = 0; i < 10 * MIN_RECON_SKETCH_CELLS; i++)
+        ours.Add(insecure_rand());
+    BOOST_CHECK(ours.Subtract(theirs));
+    std::vector<uint32_t> vOnlyOurs, vOnlyTheirs;
+    BOOST_CHECK(!ours.Decode(vOnlyOurs, vOnlyTheirs));
+
+    // Sketches of different sizes cannot be subtracted
+    CReconSketch other(MIN_RECON_SKETCH_CELLS + 1);
+    BOOST_CHECK(!ours.Subtract(other));
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_keys)
+{
+    uint64_t k0, k1, k0Swapped, k1Swapped;
+    GetReconciliationKeys(1, 2, k0, k1);
+    GetReconciliationKeys(2, 1, k0Swapped, k1Swapped);
+    BOOST_CHECK_EQUAL(k0, k0Swapped);
+    BOOST_CHECK_EQUAL(k1, k1Swapped);
+    GetReconciliationKeys(1, 3, k0Swapped, k1Swapped);
+    BOOST_CHECK(k0 != k0Swapped || k1 != k1Swapped);
+
+    uint256 txid = GetRandHash();
+    BOOST_CHECK_EQUAL(GetReconciliationShortId(k0, k1, txid), GetReconciliationShortId(k0, k1, txid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/interpreter.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -84,4 +85,41 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_precomputed_data, TestChain100Setup)
+{
+    // The mempool keeps the signature hash data of its transactions for
+    // ConnectBlock, together with the flags their scripts passed under.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    std::shared_ptr<PrecomputedTransactionData> txdata;
+    BOOST_CHECK(!mempool.GetScriptsVerified(CTransaction(spend), SCRIPT_VERIFY_P2SH, txdata));
+    BOOST_CHECK(!txdata);
+
+    BOOST_CHECK(ToMemPool(spend));
+    // No block is checked with every flag, so the marker must not match.
+    BOOST_CHECK(!mempool.GetScriptsVerified(CTransaction(spend), ~0U, txdata));
+    BOOST_CHECK(txdata);
+
+    // The block skipping the script checks of spend is still connected.
+    std::vector<CMutableTransaction> spends(1, spend);
+    CBlock block = CreateAndProcessBlock(spends, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -162,6 +162,12 @@ BOOST_AUTO_TEST_CASE( methods ) // GetHex SetHex begin() end() size() GetLow64 G
     BOOST_CHECK(R2L.GetHex() == R2L.ToString());
     BOOST_CHECK(OneL.GetHex() == OneL.ToString());
     BOOST_CHECK(MaxL.GetHex() == MaxL.ToString());
+    char pszHex[65];
+    R1L.GetHex(pszHex);
+    BOOST_CHECK(std::string(pszHex) == ArrayToString(R1Array,32));
+    char pszHexS[41];
+    R1S.GetHex(pszHexS);
+    BOOST_CHECK(std::string(pszHexS) == ArrayToString(R1Array,20));
     uint256 TmpL(R1L);
     BOOST_CHECK(TmpL == R1L);
     TmpL.SetHex(R2L.ToString());   BOOST_CHECK(TmpL == R2L);
@@ -7,6 +7,7 @@
 #include "clientversion.h"
 #include "primitives/transaction.h"
 #include "sync.h"
+#include "threadinfo.h"
 #include "utilstrencodings.h"
 #include "utilmoneystr.h"
 #include "test/test_bitcoin.h"
@@ -566,4 +567,43 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(test_LogThrottle)
+{
+    uint64_t nSuppressed = 99;
+    CLogThrottle throttle(3600);
+    BOOST_CHECK(throttle.Allow(nSuppressed));
+    BOOST_CHECK_EQUAL(nSuppressed, 0);
+    BOOST_CHECK(!throttle.Allow(nSuppressed));
+    BOOST_CHECK(!throttle.Allow(nSuppressed));
+
+    // Without an interval every message gets through
+    CLogThrottle unthrottled(0);
+    for (int i = 0; i < 3; i++) {
+        nSuppressed = 99;
+        BOOST_CHECK(unthrottled.Allow(nSuppressed));
+        BOOST_CHECK_EQUAL(nSuppressed, 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_ParseCpuList)
+{
+    std::vector<int> vCpus;
+    BOOST_CHECK(ParseCpuList("0-3,8", vCpus));
+    BOOST_CHECK(vCpus == std::vector<int>({0, 1, 2, 3, 8}));
+    BOOST_CHECK(ParseCpuList("5", vCpus));
+    BOOST_CHECK(vCpus == std::vector<int>({5}));
+    BOOST_CHECK(!ParseCpuList("", vCpus));
+    BOOST_CHECK(!ParseCpuList("3-1", vCpus));
+    BOOST_CHECK(!ParseCpuList("1,,2", vCpus));
+    BOOST_CHECK(!ParseCpuList("-1", vCpus));
+    BOOST_CHECK(!ParseCpuList("0-1024", vCpus));
+    BOOST_CHECK(!ParseCpuList("a", vCpus));
+
+    BOOST_CHECK_EQUAL(GetThreadGroup("bitcoin-scriptch"), THREADGROUP_SCRIPTCHECK);
+    BOOST_CHECK_EQUAL(GetThreadGroup("bitcoin-httpworker"), THREADGROUP_HTTP);
+    BOOST_CHECK_EQUAL(GetThreadGroup("bitcoin-msghand"), THREADGROUP_NET);
+    BOOST_CHECK_EQUAL(GetThreadGroup("bitcoin-scheduler"), THREADGROUP_OTHER);
+    BOOST_CHECK_EQUAL(GetThreadGroupName(THREADGROUP_NET), "net");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chain.h"
 #include "versionbits.h"
 #include "test/test_bitcoin.h"
@@ -31,6 +32,14 @@ public:
 
     ThresholdState GetStateFor(const CBlockIndex* pindexPrev) const { return AbstractThresholdConditionChecker::GetStateFor(pindexPrev, paramsDummy, cache); }
     int GetStateSinceHeightFor(const CBlockIndex* pindexPrev) const { return AbstractThresholdConditionChecker::GetStateSinceHeightFor(pindexPrev, paramsDummy, cache); }
+    ThresholdCacheRecord GetCacheRecord(const CBlockIndex* pindexTip) const { return AbstractThresholdConditionChecker::GetCacheRecord(pindexTip, paramsDummy, cache); }
+    bool LoadCacheRecord(const ThresholdCacheRecord& record, const std::function<const CBlockIndex*(const uint256&)>& lookup) const { return AbstractThresholdConditionChecker::LoadCacheRecord(record, paramsDummy, cache, lookup); }
+};
+
+class TestOtherConditionChecker : public TestConditionChecker
+{
+public:
+    int Threshold(const Consensus::Params& params) const { return 800; }
 };
 
 #define CHECKERS 6
@@ -231,6 +240,56 @@ BOOST_AUTO_TEST_CASE(versionbits_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(versionbits_cache_record)
+{
+    // DEFINED -> STARTED -> LOCKEDIN -> ACTIVE, with hashes so that a record can name the blocks
+    std::vector<uint256> vHash(5000);
+    std::vector<CBlockIndex*> vpblock;
+    std::map<uint256, const CBlockIndex*> mapIndex;
+    for (int i = 0; i < 5000; i++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = i;
+        pindex->pprev = i > 0 ? vpblock.back() : NULL;
+        pindex->nTime = i < 1000 ? TestTime(1) : TestTime(10000);
+        pindex->nVersion = i < 3000 ? 0x100 : 0;
+        vHash[i] = ArithToUint256(arith_uint256(i + 1));
+        pindex->phashBlock = &vHash[i];
+        pindex->BuildSkip();
+        vpblock.push_back(pindex);
+        mapIndex[vHash[i]] = pindex;
+    }
+    std::function<const CBlockIndex*(const uint256&)> lookup = [&mapIndex](const uint256& hash) -> const CBlockIndex* {
+        std::map<uint256, const CBlockIndex*>::const_iterator it = mapIndex.find(hash);
+        return it == mapIndex.end() ? NULL : it->second;
+    };
+
+    TestConditionChecker checker;
+    BOOST_CHECK_EQUAL(checker.GetStateFor(vpblock.back()), THRESHOLD_ACTIVE);
+    BOOST_CHECK_EQUAL(checker.GetStateSinceHeightFor(vpblock.back()), 4000);
+    ThresholdCacheRecord record = checker.GetCacheRecord(vpblock.back());
+    BOOST_CHECK(record.hashFinal == vHash[3999]);
+    BOOST_CHECK_EQUAL(record.nStateFinal, THRESHOLD_ACTIVE);
+    BOOST_CHECK(record.hashLast == vHash[4999]);
+    BOOST_CHECK_EQUAL(record.nStateLast, THRESHOLD_ACTIVE);
+
+    // A cache restored from the record gives the same states
+    TestConditionChecker restored;
+    BOOST_CHECK(restored.LoadCacheRecord(record, lookup));
+    BOOST_CHECK(restored.GetCacheRecord(vpblock.back()) == record);
+    BOOST_CHECK_EQUAL(restored.GetStateFor(vpblock.back()), THRESHOLD_ACTIVE);
+    BOOST_CHECK_EQUAL(restored.GetStateSinceHeightFor(vpblock.back()), 4000);
+    BOOST_CHECK_EQUAL(restored.GetStateFor(vpblock[3500]), THRESHOLD_LOCKED_IN);
+    BOOST_CHECK_EQUAL(restored.GetStateFor(vpblock[2500]), THRESHOLD_STARTED);
+    BOOST_CHECK_EQUAL(restored.GetStateSinceHeightFor(vpblock[2500]), 2000);
+
+    // Nor is a record for other rules
+    TestOtherConditionChecker other;
+    BOOST_CHECK(!other.LoadCacheRecord(record, lookup));
+
+    for (CBlockIndex* pindex : vpblock)
+        delete pindex;
+}
+
 BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
 {
     // Check that ComputeBlockVersion will set the appropriate bit correctly
@@ -0,0 +1,920 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "vote.h"
+#include "myserialize.h"
+#include "random.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+typedef CVoteDBK1<CKeyID, CRegisterCommitteeData, CKeyID> CCommitteeDB;
+typedef CVoteDBK2<uint160, CSubmitBillData, CKeyID> CBillDB;
+
+static CKeyID RandKeyID()
+{
+    uint256 hash = GetRandHash();
+    return CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+}
+
+static std::vector<unsigned char> ReadFileBytes(const std::string& file)
+{
+    std::vector<unsigned char> data(boost::filesystem::file_size(file));
+    FILE* f = fopen(file.c_str(), "rb");
+    BOOST_CHECK(fread(&data[0], 1, data.size(), f) == data.size());
+    fclose(f);
+    return data;
+}
+
+static void WriteFileBytes(const std::string& file, const std::vector<unsigned char>& data)
+{
+    FILE* f = fopen(file.c_str(), "wb");
+    BOOST_CHECK(fwrite(&data[0], 1, data.size(), f) == data.size());
+    fclose(f);
+}
+
+BOOST_FIXTURE_TEST_SUITE(vote_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(vote_snapshot_roundtrip)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::string file = ph.string();
+
+    std::unordered_map<CMyAddress, uint64_t, key_hash> mapBalance;
+    std::map<CKeyID, std::set<CKeyID>> mapVoters;
+    for (int i = 0; i < 100; ++i) {
+        CKeyID id = RandKeyID();
+        mapBalance[CMyAddress(id, CChainParams::PUBKEY_ADDRESS)] = i * COIN;
+        mapVoters[RandKeyID()].insert(id);
+    }
+
+    BOOST_CHECK(WriteVoteSnapshot(file, mapBalance, mapVoters));
+    BOOST_CHECK(IsVoteSnapshotFile(file));
+
+    std::unordered_map<CMyAddress, uint64_t, key_hash> mapBalanceIn;
+    std::map<CKeyID, std::set<CKeyID>> mapVotersIn;
+    BOOST_CHECK(LoadVoteSnapshot(file, mapBalanceIn, mapVotersIn));
+    BOOST_CHECK(mapBalanceIn == mapBalance);
+    BOOST_CHECK(mapVotersIn == mapVoters);
+
+    // Any flipped byte must be caught by the checksum
+    std::vector<unsigned char> data = ReadFileBytes(file);
+    data[data.size() / 2] ^= 0x01;
+    WriteFileBytes(file, data);
+    BOOST_CHECK(!LoadVoteSnapshot(file, mapBalanceIn, mapVotersIn));
+
+    boost::filesystem::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(vote_snapshot_votedb)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::string file = ph.string();
+
+    CKeyID committee = RandKeyID();
+    CKeyID voter = RandKeyID();
+    CRegisterCommitteeData data;
+    data.name = "committee";
+    data.url = "https://example.com";
+
+    CCommitteeDB db(0);
+    BOOST_CHECK(db.Register(committee, data, GetRandHash(), 1, false));
+    BOOST_CHECK(db.Vote(voter, committee, GetRandHash(), 2, false));
+    BOOST_CHECK(db.Save(file));
+
+    CCommitteeDB dbIn(0);
+    BOOST_CHECK(dbIn.Load(file));
+    CRegisterCommitteeData dataIn;
+    BOOST_CHECK(dbIn.GetRegiste(&dataIn, committee));
+    BOOST_CHECK_EQUAL(dataIn.name, data.name);
+    BOOST_CHECK_EQUAL(dataIn.url, data.url);
+    BOOST_CHECK(dbIn.FindVoter(voter));
+    BOOST_CHECK_EQUAL(dbIn.GetVote(committee).size(), 1U);
+
+    // The lookup indexes are rebuilt on load
+    CKeyID key;
+    BOOST_CHECK(dbIn.GetRegisteByName(&key, data.name) && key == committee);
+    BOOST_CHECK(dbIn.GetVoterRegiste(&key, voter) && key == committee);
+
+    boost::filesystem::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(vote_votedb_index)
+{
+    CKeyID committee = RandKeyID();
+    CKeyID voter = RandKeyID();
+    CRegisterCommitteeData data;
+    data.name = "committee";
+
+    CCommitteeDB db(0);
+    uint256 hashRegister = GetRandHash();
+    BOOST_CHECK(db.Register(committee, data, hashRegister, 1, false));
+    BOOST_CHECK(!db.Register(RandKeyID(), data, GetRandHash(), 1, false));
+
+    CKeyID key;
+    BOOST_CHECK(db.GetRegisteByName(&key, data.name) && key == committee);
+    BOOST_CHECK(!db.GetVoterRegiste(NULL, voter));
+
+    uint256 hashVote = GetRandHash();
+    BOOST_CHECK(db.Vote(voter, committee, hashVote, 2, false));
+    BOOST_CHECK(db.GetVoterRegiste(&key, voter) && key == committee);
+
+    BOOST_CHECK(db.Vote(voter, committee, hashVote, 2, true));
+    BOOST_CHECK(!db.GetVoterRegiste(NULL, voter));
+    BOOST_CHECK(db.Register(committee, data, hashRegister, 1, true));
+    BOOST_CHECK(!db.GetRegisteByName(NULL, data.name));
+
+    CSubmitBillData bill;
+    bill.committee = committee;
+    bill.endtime = 100;
+    bill.options.push_back("yes");
+    bill.options.push_back("no");
+    uint160 billid = uint160(std::vector<unsigned char>(20, 1));
+
+    CBillDB billdb(0, 0, [](const CKeyID&) { return (uint64_t)0; });
+    uint256 hashBill = GetRandHash();
+    BOOST_CHECK(billdb.Register(billid, bill, hashBill, 1, false));
+    BOOST_CHECK(billdb.GetCommitteeRegiste(committee).count(billid));
+
+    uint256 hashBillVote = GetRandHash();
+    BOOST_CHECK(billdb.Vote(voter, billid, 1, hashBillVote, 2, false));
+    BOOST_CHECK(!billdb.Vote(voter, billid, 0, GetRandHash(), 2, false));
+    std::map<uint160, uint8_t> votes = billdb.GetVoterVote(voter);
+    BOOST_CHECK(votes.size() == 1 && votes[billid] == 1);
+
+    BOOST_CHECK(billdb.Vote(voter, billid, 1, hashBillVote, 2, true));
+    BOOST_CHECK(billdb.GetVoterVote(voter).empty());
+    BOOST_CHECK(billdb.Register(billid, bill, hashBill, 1, true));
+    BOOST_CHECK(billdb.GetCommitteeRegiste(committee).empty());
+}
+
+BOOST_AUTO_TEST_CASE(vote_snapshot_legacy_migration)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::string file = ph.string();
+
+    std::map<CKeyID, std::string> mapName;
+    mapName[RandKeyID()] = "delegate";
+    std::map<uint256, uint64_t> mapInvalid;
+    mapInvalid[GetRandHash()] = 42;
+
+    MySerialize(file, mapName, mapInvalid);
+    BOOST_CHECK(!IsVoteSnapshotFile(file));
+
+    std::map<CKeyID, std::string> mapNameIn;
+    std::map<uint256, uint64_t> mapInvalidIn;
+    BOOST_CHECK(LoadVoteSnapshot(file, mapNameIn, mapInvalidIn));
+    BOOST_CHECK(mapNameIn == mapName);
+    BOOST_CHECK(mapInvalidIn == mapInvalid);
+
+    // Rewriting converts the file to the binary format
+    BOOST_CHECK(WriteVoteSnapshot(file, mapNameIn, mapInvalidIn));
+    BOOST_CHECK(IsVoteSnapshotFile(file));
+
+    // A missing file is an empty state, as before
+    boost::filesystem::remove(file);
+    BOOST_CHECK(LoadVoteSnapshot(file, mapNameIn, mapInvalidIn));
+}
+
+BOOST_AUTO_TEST_CASE(vote_invalid_index)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::string file = ph.string();
+
+    std::map<uint256, uint64_t> mapInvalid;
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash(), hash3 = GetRandHash();
+    mapInvalid[hash1] = 10;
+    mapInvalid[hash2] = 10;
+    mapInvalid[hash3] = 20;
+
+    // Legacy archives of the plain map load into the index
+    MySerialize(file, mapInvalid);
+    CInvalidVoteIndex index;
+    BOOST_CHECK(LoadVoteSnapshot(file, index));
+    BOOST_CHECK_EQUAL(index.size(), 3U);
+    BOOST_CHECK(index.Find(hash1) && index.Find(hash3));
+    boost::filesystem::remove(file);
+
+    // and the binary format is the one of the plain map
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << index;
+    std::map<uint256, uint64_t> mapInvalidIn;
+    ss >> mapInvalidIn;
+    BOOST_CHECK(mapInvalidIn == mapInvalid);
+
+    // Re-adding moves a hash to its new bucket
+    index.Add(hash2, 30);
+    index.Erase(hash3);
+    BOOST_CHECK_EQUAL(index.Prune(11), 1U);
+    BOOST_CHECK(!index.Find(hash1));
+    BOOST_CHECK(index.Find(hash2));
+    BOOST_CHECK_EQUAL(index.Prune(31), 1U);
+    BOOST_CHECK_EQUAL(index.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(vote_bill_tally)
+{
+    std::map<CKeyID, uint64_t> mapBalance;
+    CKeyID voter1 = RandKeyID(), voter2 = RandKeyID();
+    mapBalance[voter1] = 5 * COIN;
+    mapBalance[voter2] = 3 * COIN;
+
+    CSubmitBillData bill;
+    bill.committee = RandKeyID();
+    bill.endtime = 100;
+    bill.options.push_back("yes");
+    bill.options.push_back("no");
+    uint160 billid = uint160(std::vector<unsigned char>(20, 2));
+
+    CBillDB db(0, COIN, [&mapBalance](const CKeyID& id) { return mapBalance[id]; });
+    BOOST_CHECK(db.Register(billid, bill, GetRandHash(), 1, false));
+    BOOST_CHECK(db.Vote(voter1, billid, 0, GetRandHash(), 2, false));
+    BOOST_CHECK(db.Vote(voter2, billid, 1, GetRandHash(), 2, false));
+
+    // voter2 overtakes voter1 before the bill expires, a change to the state to write
+    uint64_t nChanges = db.GetChanges();
+    mapBalance[voter2] += 10 * COIN;
+    db.UpdateVoterBalance(voter2, 10 * COIN);
+    BOOST_CHECK(db.GetChanges() != nChanges);
+    nChanges = db.GetChanges();
+    db.UpdateVoterBalance(RandKeyID(), COIN);
+    BOOST_CHECK_EQUAL(db.GetChanges(), nChanges);
+
+    db.NewBlockHeight(3, 50, false);
+    BOOST_CHECK(!db.GetState(billid).bFinished);
+
+    db.NewBlockHeight(4, 101, false);
+    CState state = db.GetState(billid);
+    BOOST_CHECK(state.bFinished && state.bPassed);
+    BOOST_CHECK_EQUAL(state.nFinishedHeight, 4U);
+    BOOST_CHECK_EQUAL(state.nOptionIndex, 1);
+    BOOST_CHECK_EQUAL(state.nTotalVote, 18 * COIN);
+
+    // Finished bills no longer follow the balances
+    db.UpdateVoterBalance(voter1, 100 * COIN);
+    BOOST_CHECK_EQUAL(db.GetVote(billid)[0][voter1], 5 * COIN);
+
+    // Undoing the finish recounts from the current balances
+    mapBalance[voter1] += 100 * COIN;
+    db.NewBlockHeight(4, 101, true);
+    BOOST_CHECK(!db.GetState(billid).bFinished);
+    db.NewBlockHeight(4, 101, false);
+    state = db.GetState(billid);
+    BOOST_CHECK_EQUAL(state.nOptionIndex, 0);
+    BOOST_CHECK_EQUAL(state.nTotalVote, 118 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(vote_bill_votes)
+{
+    std::map<CKeyID, uint64_t> mapBalance;
+    std::vector<CKeyID> vVoter;
+    for(int i = 0; i < 500; ++i) {
+        vVoter.push_back(RandKeyID());
+        mapBalance[vVoter.back()] = (i + 1) * COIN;
+    }
+
+    CSubmitBillData bill;
+    bill.committee = RandKeyID();
+    bill.endtime = 100;
+    bill.options = {"yes", "no", "abstain"};
+    uint160 billid = uint160(std::vector<unsigned char>(20, 3));
+
+    CBillDB db(0, COIN, [&mapBalance](const CKeyID& id) { return mapBalance[id]; });
+    BOOST_CHECK(db.Register(billid, bill, GetRandHash(), 1, false));
+
+    // Votes and their undos in any order, as kept per option before
+    std::vector<std::map<CKeyID, uint64_t>> vExpected(bill.options.size());
+    std::map<CKeyID, std::pair<uint8_t, uint256>> mapVoted;
+    for(int i = 0; i < 5000; ++i) {
+        const CKeyID& voter = vVoter[insecure_rand() % vVoter.size()];
+        uint8_t nOption = insecure_rand() % 4;
+        auto it = mapVoted.find(voter);
+        if(it == mapVoted.end()) {
+            uint256 hash = GetRandHash();
+            BOOST_CHECK_EQUAL(db.Vote(voter, billid, nOption, hash, 2, false), nOption < 3);
+            if(nOption < 3) {
+                mapVoted[voter] = std::make_pair(nOption, hash);
+                vExpected[nOption][voter] = mapBalance[voter];
+            }
+        } else if(insecure_rand() % 2) {
+            BOOST_CHECK(!db.Vote(voter, billid, nOption, GetRandHash(), 2, false));
+        } else {
+            BOOST_CHECK(db.Vote(voter, billid, it->second.first, it->second.second, 2, true));
+            vExpected[it->second.first].erase(voter);
+            mapVoted.erase(it);
+        }
+    }
+    BOOST_CHECK(db.GetVote(billid) == vExpected);
+    for(auto& it : mapVoted) {
+        std::map<uint160, uint8_t> votes = db.GetVoterVote(it.first);
+        BOOST_CHECK(votes.size() == 1 && votes[billid] == it.second.first);
+    }
+
+    // The dump is the one of the votes per option
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    db.Dump(ss);
+    CDataStream ssCopy = ss;
+    uint64_t nVersion;
+    std::map<uint160, CSubmitBillData> mapBill;
+    std::map<uint160, std::vector<std::map<CKeyID, uint64_t>>> mapVotes;
+    ssCopy >> nVersion >> mapBill >> mapVotes;
+    BOOST_CHECK(mapVotes.size() == 1 && mapVotes[billid] == vExpected);
+
+    CBillDB dbIn(0, COIN, [&mapBalance](const CKeyID& id) { return mapBalance[id]; });
+    dbIn.Restore(ss);
+    BOOST_CHECK(dbIn.GetVote(billid) == vExpected);
+    BOOST_CHECK(dbIn.GetVoterVote(mapVoted.begin()->first).size() == 1);
+
+    // The tallies follow the balances until the bill finishes
+    const CKeyID& voter = mapVoted.begin()->first;
+    uint8_t nOption = mapVoted.begin()->second.first;
+    mapBalance[voter] += 1000000 * COIN;
+    dbIn.UpdateVoterBalance(voter, 1000000 * COIN);
+    dbIn.NewBlockHeight(3, 101, false);
+    CState state = dbIn.GetState(billid);
+    BOOST_CHECK(state.bFinished && state.bPassed);
+    BOOST_CHECK_EQUAL(state.nOptionIndex, nOption);
+}
+
+BOOST_AUTO_TEST_CASE(vote_balance_index)
+{
+    CBalanceIndex index;
+    std::map<CMyAddress, uint64_t> mapBalance;
+    for(int i = 0; i < 2000; ++i) {
+        CMyAddress address(RandKeyID(), CChainParams::PUBKEY_ADDRESS);
+        uint64_t nBalance = insecure_rand() % 4 == 0 ? insecure_rand() % 100 : (uint64_t)insecure_rand() * (insecure_rand() % 1000);
+        index.Update(address, 0, nBalance);
+        mapBalance[address] = nBalance;
+    }
+
+    // Move some balances around, down to zero as well
+    for(auto& it : mapBalance) {
+        if(insecure_rand() % 3 == 0) {
+            uint64_t nBalance = insecure_rand() % 2 ? 0 : it.second / 2;
+            index.Update(it.first, it.second, nBalance);
+            it.second = nBalance;
+        }
+    }
+
+    std::vector<uint64_t> vThreshold = {0, 1, 15, 16, 17, 99, 1000, 123456, 1ULL << 40, std::numeric_limits<uint64_t>::max()};
+    for(uint64_t nThreshold : vThreshold) {
+        uint64_t nCount = 0, nSum = 0;
+        for(auto& it : mapBalance) {
+            if(it.second > 0 && it.second <= nThreshold) {
+                nCount++;
+                nSum += it.second;
+            }
+        }
+        std::pair<uint64_t, uint64_t> result = index.GetCumulative(nThreshold, NULL);
+        BOOST_CHECK_EQUAL(result.first, nCount);
+        BOOST_CHECK_EQUAL(result.second, nSum);
+    }
+
+    std::multiset<uint64_t> setTop;
+    for(auto& it : mapBalance) {
+        if(it.second > 0) {
+            setTop.insert(it.second);
+        }
+    }
+    std::multimap<uint64_t, CMyAddress> top = index.GetTop(10, NULL);
+    BOOST_CHECK_EQUAL(top.size(), 10U);
+    auto itTop = setTop.rbegin();
+    for(auto it = top.rbegin(); it != top.rend(); ++it, ++itTop) {
+        BOOST_CHECK_EQUAL(it->first, *itTop);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(vote_balance_index_db, TestingSetup)
+{
+    CVoteDB db(1 << 20, true, false);
+    CBalanceIndex index;
+    std::map<CMyAddress, uint64_t> mapBalance;
+    for(int i = 0; i < 500; ++i) {
+        CMyAddress address(RandKeyID(), CChainParams::PUBKEY_ADDRESS);
+        uint64_t nBalance = (uint64_t)insecure_rand() * (insecure_rand() % 1000 + 1);
+        index.Update(address, 0, nBalance);
+        mapBalance[address] = nBalance;
+    }
+
+    // Flush the changes to the rank records, the index then only keeps the buckets
+    BOOST_CHECK(db.WriteRanks(index.GetChanges(), true));
+    BOOST_CHECK(db.HaveRanks());
+    index.ClearChanges();
+    BOOST_CHECK_EQUAL(index.GetChanges().size(), 0U);
+    BOOST_CHECK_EQUAL(index.size(), 500U);
+
+    // Changes after the flush, some addresses twice and some back to what the records have
+    for(auto& it : mapBalance) {
+        if(insecure_rand() % 3 == 0) {
+            uint64_t nBalance = insecure_rand() % 2 ? 0 : it.second * 2;
+            index.Update(it.first, it.second, nBalance);
+            if(insecure_rand() % 2) {
+                index.Update(it.first, nBalance, it.second);
+            } else {
+                it.second = nBalance;
+            }
+        }
+    }
+    for(int i = 0; i < 100; ++i) {
+        CMyAddress address(RandKeyID(), CChainParams::SCRIPT_ADDRESS);
+        uint64_t nBalance = (uint64_t)insecure_rand() * (insecure_rand() % 1000 + 1);
+        index.Update(address, 0, nBalance);
+        mapBalance[address] = nBalance;
+    }
+
+    std::multiset<uint64_t> setTop;
+    for(auto& it : mapBalance) {
+        if(it.second > 0) {
+            setTop.insert(it.second);
+        }
+    }
+
+    for(int nPass = 0; nPass < 2; ++nPass) {
+        for(uint64_t nThreshold : {(uint64_t)1000, (uint64_t)insecure_rand() * 500, std::numeric_limits<uint64_t>::max()}) {
+            uint64_t nCount = 0, nSum = 0;
+            for(uint64_t nBalance : setTop) {
+                if(nBalance <= nThreshold) {
+                    nCount++;
+                    nSum += nBalance;
+                }
+            }
+            std::pair<uint64_t, uint64_t> result = index.GetCumulative(nThreshold, &db);
+            BOOST_CHECK_EQUAL(result.first, nCount);
+            BOOST_CHECK_EQUAL(result.second, nSum);
+        }
+
+        std::multimap<uint64_t, CMyAddress> top = index.GetTop(20, &db);
+        BOOST_CHECK_EQUAL(top.size(), 20U);
+        auto itTop = setTop.rbegin();
+        for(auto it = top.rbegin(); it != top.rend(); ++it, ++itTop) {
+            BOOST_CHECK_EQUAL(it->first, *itTop);
+            BOOST_CHECK_EQUAL(mapBalance[it->second], it->first);
+        }
+
+        // The same answers once the pending changes are in the records
+        BOOST_CHECK(db.WriteRanks(index.GetChanges(), true));
+        index.ClearChanges();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(vote_balance_map)
+{
+    CBalanceMap map;
+    std::map<CMyAddress, uint64_t> mapExpected;
+    std::vector<CMyAddress> vAddress;
+    for(int i = 0; i < 1000; ++i) {
+        // The same id with both address types must be two entries
+        CKeyID id = RandKeyID();
+        vAddress.push_back(CMyAddress(id, CChainParams::PUBKEY_ADDRESS));
+        vAddress.push_back(CMyAddress(id, CChainParams::SCRIPT_ADDRESS));
+    }
+
+    for(int i = 0; i < 20000; ++i) {
+        const CMyAddress& address = vAddress[insecure_rand() % vAddress.size()];
+        auto it = map.find(address);
+        BOOST_CHECK_EQUAL(it != map.end(), mapExpected.count(address) > 0);
+        if(it == map.end()) {
+            map.insert(address, i, CBalanceCacheEntry::FRESH);
+            mapExpected[address] = i;
+        } else if(insecure_rand() % 2) {
+            BOOST_CHECK_EQUAL(it->nBalance, mapExpected[address]);
+            map.erase(it);
+            mapExpected.erase(address);
+        } else {
+            it->nBalance = i;
+            mapExpected[address] = i;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(map.size(), mapExpected.size());
+    size_t nCount = 0;
+    for(auto& it : map) {
+        BOOST_CHECK_EQUAL(it.nBalance, mapExpected[it.GetAddress()]);
+        ++nCount;
+    }
+    BOOST_CHECK_EQUAL(nCount, mapExpected.size());
+}
+
+BOOST_AUTO_TEST_CASE(vote_delegate_ranking)
+{
+    Vote& vote = Vote::GetInstance();
+    CKeyID d1 = RandKeyID(), d2 = RandKeyID(), d3 = RandKeyID();
+    CKeyID v1 = RandKeyID(), v2 = RandKeyID();
+    BOOST_CHECK(vote.ProcessRegister(d1, "rank1", GetRandHash(), 1, false));
+    BOOST_CHECK(vote.ProcessRegister(d2, "rank2", GetRandHash(), 1, false));
+    BOOST_CHECK(vote.ProcessRegister(d3, "rank3", GetRandHash(), 1, false));
+
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(CMyAddress(v1, CChainParams::PUBKEY_ADDRESS), 10 * COIN));
+    vBalance.push_back(std::make_pair(CMyAddress(v2, CChainParams::PUBKEY_ADDRESS), 5 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+
+    BOOST_CHECK(vote.ProcessVote(v1, {d1}, GetRandHash(), 2, false));
+    BOOST_CHECK(vote.ProcessVote(v2, {d1, d2}, GetRandHash(), 2, false));
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d1), 15 * COIN);
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d2), 5 * COIN);
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d3), 0);
+
+    std::vector<Delegate> top = vote.GetTopDelegateInfo(0, 2);
+    BOOST_CHECK_EQUAL(top.size(), 2U);
+    BOOST_CHECK(top[0].keyid == d1 && top[1].keyid == d2);
+    BOOST_CHECK_EQUAL(vote.GetTopDelegateInfo(0, 3).size(), 3U);
+
+    // Balance changes move the totals of every delegate the address voted for
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(CMyAddress(v1, CChainParams::PUBKEY_ADDRESS), -5 * COIN));
+    vBalance.push_back(std::make_pair(CMyAddress(v2, CChainParams::PUBKEY_ADDRESS), 20 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d1), 30 * COIN);
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d2), 25 * COIN);
+
+    BOOST_CHECK(vote.ProcessCancelVote(v2, {d1}, GetRandHash(), 3, false));
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d1), 5 * COIN);
+    top = vote.GetTopDelegateInfo(0, 2);
+    BOOST_CHECK(top[0].keyid == d2 && top[1].keyid == d1);
+
+    // Undoing the first vote leaves d1 without voters, ranked by key among the unvoted delegates
+    BOOST_CHECK(vote.ProcessVote(v1, {d1}, GetRandHash(), 2, true));
+    BOOST_CHECK_EQUAL(vote.GetDelegateVotes(d1), 0);
+    top = vote.GetTopDelegateInfo(0, 3);
+    BOOST_CHECK_EQUAL(top.size(), 3U);
+    BOOST_CHECK(top[0].keyid == d2);
+    BOOST_CHECK_EQUAL(top[1].votes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(vote_delegate_funds)
+{
+    Vote& vote = Vote::GetInstance();
+    CKeyID d = RandKeyID();
+    CMyAddress delegate(d, CChainParams::PUBKEY_ADDRESS);
+    CMyAddress multi1(RandKeyID(), CChainParams::SCRIPT_ADDRESS), multi2(RandKeyID(), CChainParams::SCRIPT_ADDRESS);
+    BOOST_CHECK(vote.ProcessRegister(d, "funds1", GetRandHash(), 1, false));
+
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(delegate, 2 * COIN));
+    vBalance.push_back(std::make_pair(multi1, 5 * COIN));
+    vBalance.push_back(std::make_pair(multi2, 3 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK_EQUAL(vote.GetDelegateFunds(delegate), 2 * COIN);
+
+    // The funds are the largest balance among the delegate and its multiaddresses
+    uint256 txid1 = GetRandHash();
+    BOOST_CHECK(vote.AddDelegateMultiaddress(delegate, multi1, txid1));
+    BOOST_CHECK(vote.AddDelegateMultiaddress(delegate, multi2, GetRandHash()));
+    BOOST_CHECK_EQUAL(vote.GetDelegateFunds(delegate), 5 * COIN);
+
+    // Balance changes of any of them keep the cached funds current
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(multi2, 4 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK_EQUAL(vote.GetDelegateFunds(delegate), 7 * COIN);
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(multi2, -6 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK_EQUAL(vote.GetDelegateFunds(delegate), 5 * COIN);
+
+    BOOST_CHECK(vote.DelDelegateMultiaddress(delegate, multi1, txid1));
+    BOOST_CHECK_EQUAL(vote.GetDelegateFunds(delegate), 2 * COIN);
+    for(auto& info : vote.GetTopDelegateInfo(3 * COIN, 101)) {
+        BOOST_CHECK(info.keyid != d);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(vote_balance_lookup)
+{
+    Vote& vote = Vote::GetInstance();
+    size_t nEntries = vote.GetCacheStats().nEntries;
+
+    // Looking up addresses that never held coins leaves the cache as it was
+    for(int i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(vote.GetAddressBalance(CMyAddress(RandKeyID(), CChainParams::PUBKEY_ADDRESS)), 0U);
+    }
+    BOOST_CHECK_EQUAL(vote.GetCacheStats().nEntries, nEntries);
+
+    CMyAddress a(RandKeyID(), CChainParams::PUBKEY_ADDRESS);
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(a, 3 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK_EQUAL(vote.GetAddressBalance(a), 3 * COIN);
+    BOOST_CHECK_EQUAL(vote.GetCacheStats().nEntries, nEntries + 1);
+
+    vBalance[0].second = -3 * COIN;
+    vote.UpdateAddressBalance(vBalance);
+}
+
+BOOST_AUTO_TEST_CASE(vote_state_hash)
+{
+    Vote& vote = Vote::GetInstance();
+    uint256 hashBalances, hashBalancesNow;
+    uint256 hash = vote.GetStateHash(hashBalances);
+
+    CMyAddress a(RandKeyID(), CChainParams::PUBKEY_ADDRESS), b(RandKeyID(), CChainParams::SCRIPT_ADDRESS);
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(a, 3 * COIN));
+    vBalance.push_back(std::make_pair(b, 4 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK(vote.GetStateHash(hashBalancesNow) != hash);
+    BOOST_CHECK(hashBalancesNow != hashBalances);
+
+    // Undone in another order and in more steps, the balances hash as they did
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(b, -4 * COIN));
+    vBalance.push_back(std::make_pair(a, -1 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(a, -2 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK(vote.GetStateHash(hashBalancesNow) == hash);
+    BOOST_CHECK(hashBalancesNow == hashBalances);
+
+    // The rest of the state is committed to as well
+    BOOST_CHECK(vote.ProcessRegister(RandKeyID(), "statehash", GetRandHash(), 1, false));
+    BOOST_CHECK(vote.GetStateHash(hashBalancesNow) != hash);
+    BOOST_CHECK(hashBalancesNow == hashBalances);
+}
+
+BOOST_AUTO_TEST_CASE(vote_view)
+{
+    Vote& vote = Vote::GetInstance();
+    CKeyID d1 = RandKeyID(), d2 = RandKeyID();
+    CKeyID v1 = RandKeyID(), v2 = RandKeyID();
+    BOOST_CHECK(vote.ProcessRegister(d1, "view1", GetRandHash(), 1, false));
+    BOOST_CHECK(vote.ProcessRegister(d2, "view2", GetRandHash(), 1, false));
+
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(CMyAddress(v1, CChainParams::PUBKEY_ADDRESS), 3 * COIN));
+    vBalance.push_back(std::make_pair(CMyAddress(v2, CChainParams::PUBKEY_ADDRESS), 4 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    BOOST_CHECK(vote.ProcessVote(v1, {d1, d2}, GetRandHash(), 2, false));
+    vote.PublishView();
+
+    std::shared_ptr<const CVoteView> view = vote.GetView();
+    BOOST_CHECK(view->GetDelegate("view1") == d1);
+    BOOST_CHECK_EQUAL(view->GetDelegate(d2), "view2");
+    BOOST_CHECK(view->HaveDelegate("view2", d2));
+    BOOST_CHECK(!view->HaveDelegate("view2", d1));
+    BOOST_CHECK(view->HaveVote(v1, d1));
+    BOOST_CHECK_EQUAL(view->GetDelegateVotes(d1), 3 * COIN);
+    BOOST_CHECK_EQUAL(view->GetVotedDelegates(v1).size(), 2U);
+    BOOST_CHECK_EQUAL(view->ListDelegates().count("view1"), 1U);
+
+    // Changes stay invisible to a published view, even after the next one is published
+    BOOST_CHECK(vote.ProcessVote(v2, {d2}, GetRandHash(), 3, false));
+    BOOST_CHECK(!vote.GetView()->HaveVote(v2, d2));
+    vote.PublishView();
+    std::shared_ptr<const CVoteView> next = vote.GetView();
+    BOOST_CHECK(!view->HaveVote(v2, d2));
+    BOOST_CHECK_EQUAL(view->GetDelegateVotes(d2), 3 * COIN);
+    BOOST_CHECK(next->HaveVote(v2, d2));
+    BOOST_CHECK_EQUAL(next->GetDelegateVotes(d2), 7 * COIN);
+    BOOST_CHECK_EQUAL(next->GetDelegateVoters(d2).size(), 2U);
+
+    // Unchanged maps are shared with the previous view
+    BOOST_CHECK_EQUAL(next->GetDelegateVoters(d1).size(), 1U);
+    BOOST_CHECK(&next->ListDelegates() == &view->ListDelegates());
+
+    // Balance changes of voters reach the totals listdelegates and getdelegatevotes report
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(CMyAddress(v2, CChainParams::PUBKEY_ADDRESS), 6 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    vote.PublishView();
+    BOOST_CHECK_EQUAL(vote.GetView()->GetDelegateVotes(d2), 13 * COIN);
+    BOOST_CHECK_EQUAL(vote.GetView()->GetDelegateVotes(d1), 3 * COIN);
+    BOOST_CHECK_EQUAL(next->GetDelegateVotes(d2), 7 * COIN);
+
+    BOOST_CHECK(vote.ProcessCancelVote(v1, {d1}, GetRandHash(), 4, false));
+    vote.PublishView();
+    BOOST_CHECK(vote.GetView()->GetDelegateVoters(d1).empty());
+    BOOST_CHECK_EQUAL(vote.GetView()->GetVotedDelegates(v1).size(), 1U);
+    BOOST_CHECK(next->HaveVote(v1, d1));
+}
+
+BOOST_AUTO_TEST_CASE(vote_view_pending)
+{
+    Vote& vote = Vote::GetInstance();
+    CKeyID d1 = RandKeyID(), d2 = RandKeyID(), v1 = RandKeyID();
+    BOOST_CHECK(vote.ProcessRegister(d1, "pending1", GetRandHash(), 1, false));
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.push_back(std::make_pair(CMyAddress(v1, CChainParams::PUBKEY_ADDRESS), 2 * COIN));
+    vote.UpdateAddressBalance(vBalance);
+    vote.PublishView();
+
+    std::vector<CPendingDPoSOp> vOps(4);
+    vOps[0].opcode = OP_REGISTE;
+    vOps[0].address = d2;
+    vOps[0].name = "pending2";
+    vOps[1].opcode = OP_VOTE;
+    vOps[1].address = v1;
+    vOps[1].delegates = {d1, d2};
+    // Invalid like in a block: the name is taken and d1 is voted already
+    vOps[2].opcode = OP_REGISTE;
+    vOps[2].address = RandKeyID();
+    vOps[2].name = "pending1";
+    vOps[3].opcode = OP_VOTE;
+    vOps[3].address = v1;
+    vOps[3].delegates = {d1};
+
+    std::shared_ptr<const CVoteView> view = vote.GetView();
+    std::shared_ptr<const CVoteView> pending = view->WithPending(vOps);
+    BOOST_CHECK(pending->GetDelegate("pending2") == d2);
+    BOOST_CHECK(pending->GetDelegate("pending1") == d1);
+    BOOST_CHECK(pending->HaveVote(v1, d2));
+    BOOST_CHECK_EQUAL(pending->GetDelegateVotes(d1), 2 * COIN);
+    BOOST_CHECK_EQUAL(pending->GetVotedDelegates(v1).size(), 2U);
+    BOOST_CHECK(!view->HaveDelegate("pending2"));
+    BOOST_CHECK(!view->HaveVote(v1, d1));
+
+    std::vector<CPendingDPoSOp> vRevoke(1);
+    vRevoke[0].opcode = OP_REVOKE;
+    vRevoke[0].address = v1;
+    vRevoke[0].delegates = {d1};
+    pending = pending->WithPending(vRevoke);
+    BOOST_CHECK(!pending->HaveVote(v1, d1));
+    BOOST_CHECK_EQUAL(pending->GetDelegateVotes(d1), 0);
+    BOOST_CHECK_EQUAL(pending->GetVotedDelegates(v1).size(), 1U);
+}
+
+static CTransaction VotingTransaction(const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> push(4, 0);
+    push.insert(push.end(), data.begin(), data.end());
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 0;
+    mtx.vout[0].scriptPubKey = CScript() << OP_RETURN << push;
+    return CTransaction(mtx);
+}
+
+BOOST_AUTO_TEST_CASE(vote_parse_payload)
+{
+    CVoteForgerData data;
+    data.opcode = OP_VOTE;
+    for (int i = 0; i < 3; i++)
+        data.forgers.insert(RandKeyID());
+
+    // The payload found when the transaction is built parses like the old DataToStruct
+    CTransaction tx = VotingTransaction(StructToData(data));
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    BOOST_CHECK(tx.GetDPoSPayload(pbegin, pend));
+    BOOST_CHECK_EQUAL(*pbegin, OP_VOTE);
+    CDPoSKeys keys;
+    BOOST_CHECK(ParseDPoSKeys(keys, pbegin, pend));
+    BOOST_CHECK(std::set<CKeyID>(keys.begin(), keys.end()) == data.forgers);
+    BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+    CVoteForgerData parsed;
+    BOOST_CHECK(DataToStruct(parsed, CScript(pbegin, pend)));
+    BOOST_CHECK(parsed.forgers == data.forgers);
+
+    // Repeated, short and missing keys are refused
+    std::vector<unsigned char> vch = StructToData(data);
+    std::vector<unsigned char> vchDup(vch.begin(), vch.begin() + 2 + 21);
+    vchDup.insert(vchDup.end(), vch.begin() + 2, vch.begin() + 2 + 21);
+    vchDup[1] = 2;
+    CDPoSKeys keysDup;
+    BOOST_CHECK(!ParseDPoSKeys(keysDup, vchDup.data(), vchDup.data() + vchDup.size()));
+    CDPoSKeys keysShort;
+    BOOST_CHECK(!ParseDPoSKeys(keysShort, vch.data(), vch.data() + vch.size() - 1));
+    std::vector<unsigned char> vchEmpty(vch.begin(), vch.begin() + 2);
+    vchEmpty[1] = 0;
+    CDPoSKeys keysEmpty;
+    BOOST_CHECK(!ParseDPoSKeys(keysEmpty, vchEmpty.data(), vchEmpty.data() + vchEmpty.size()));
+
+    // More keys than a voter may vote for still parse, for Vote to refuse
+    CVoteForgerData many;
+    many.opcode = OP_VOTE;
+    while (many.forgers.size() <= Vote::MaxNumberOfVotes)
+        many.forgers.insert(RandKeyID());
+    std::vector<unsigned char> vchMany = StructToData(many);
+    CDPoSKeys keysMany;
+    BOOST_CHECK(ParseDPoSKeys(keysMany, vchMany.data(), vchMany.data() + vchMany.size()));
+    BOOST_CHECK_EQUAL(keysMany.size(), many.forgers.size());
+
+    // No payload without the zero prefix, or with a value
+    CMutableTransaction mtx(tx);
+    mtx.vout[0].scriptPubKey = CScript() << OP_RETURN << vch;
+    BOOST_CHECK(!CTransaction(mtx).GetDPoSPayload(pbegin, pend));
+    mtx = CMutableTransaction(tx);
+    mtx.vout[0].nValue = 1;
+    BOOST_CHECK(!CTransaction(mtx).GetDPoSPayload(pbegin, pend));
+    BOOST_CHECK(!CTransaction().GetDPoSPayload(pbegin, pend));
+}
+
+BOOST_FIXTURE_TEST_CASE(vote_db_state, TestingSetup)
+{
+    CVoteDB db(1 << 20, true, false);
+
+    int64_t nHeight = 0;
+    uint256 hashBlock;
+    BOOST_CHECK(!db.ReadBestBlock(nHeight, hashBlock));
+
+    CMyAddress a(RandKeyID(), CChainParams::PUBKEY_ADDRESS);
+    CMyAddress b(RandKeyID(), CChainParams::SCRIPT_ADDRESS);
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    vBalance.push_back(std::make_pair(a, 5 * COIN));
+    vBalance.push_back(std::make_pair(b, 7 * COIN));
+
+    CDataStream delegates(SER_DISK, CLIENT_VERSION), bills(SER_DISK, CLIENT_VERSION), committees(SER_DISK, CLIENT_VERSION);
+    std::map<CKeyID, std::string> mapName;
+    mapName[RandKeyID()] = "delegate";
+    delegates << mapName;
+
+    MuHash3072 muhash(a.first.begin(), a.first.size()), muhashIn;
+    BOOST_CHECK(!db.ReadBalanceHash(muhashIn));
+
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(db.WriteState(vBalance, std::vector<CVoteRankChange>(), &delegates, &bills, &committees, muhash, 100, hash));
+    BOOST_CHECK(db.ReadBestBlock(nHeight, hashBlock));
+    BOOST_CHECK_EQUAL(nHeight, 100);
+    BOOST_CHECK(hashBlock == hash);
+
+    uint64_t nBalance = 0;
+    BOOST_CHECK(db.ReadBalance(a, nBalance));
+    BOOST_CHECK_EQUAL(nBalance, 5 * COIN);
+
+    CDataStream delegatesIn(SER_DISK, CLIENT_VERSION), billsIn(SER_DISK, CLIENT_VERSION), committeesIn(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(db.ReadState(delegatesIn, billsIn, committeesIn));
+    std::map<CKeyID, std::string> mapNameIn;
+    delegatesIn >> mapNameIn;
+    BOOST_CHECK(mapNameIn == mapName);
+
+    unsigned char out[MuHash3072::OUTPUT_SIZE], outIn[MuHash3072::OUTPUT_SIZE];
+    BOOST_CHECK(db.ReadBalanceHash(muhashIn));
+    muhash.Finalize(out);
+    muhashIn.Finalize(outIn);
+    BOOST_CHECK(memcmp(out, outIn, sizeof(out)) == 0);
+
+    // A zero balance erases the entry, and parts of the state not passed are kept
+    vBalance.clear();
+    vBalance.push_back(std::make_pair(a, 0));
+    BOOST_CHECK(db.WriteState(vBalance, std::vector<CVoteRankChange>(), NULL, NULL, NULL, muhash, 101, GetRandHash()));
+    BOOST_CHECK(!db.ReadBalance(a, nBalance));
+    CDataStream delegatesKept(SER_DISK, CLIENT_VERSION), billsKept(SER_DISK, CLIENT_VERSION), committeesKept(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(db.ReadState(delegatesKept, billsKept, committeesKept));
+    mapNameIn.clear();
+    delegatesKept >> mapNameIn;
+    BOOST_CHECK(mapNameIn == mapName);
+
+    std::map<CMyAddress, uint64_t> mapAll;
+    BOOST_CHECK(db.ForEachBalance([&](const CMyAddress& address, uint64_t nValue) { mapAll[address] = nValue; }));
+    BOOST_CHECK_EQUAL(mapAll.size(), 1U);
+    BOOST_CHECK_EQUAL(mapAll[b], 7 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(dpos_history_heights)
+{
+    CDPoSHistoryDB db(1 << 20, true);
+    CKeyID delegate = RandKeyID(), v1 = RandKeyID(), v2 = RandKeyID();
+    CMyAddress a1(v1, CChainParams::PUBKEY_ADDRESS), a2(v2, CChainParams::PUBKEY_ADDRESS);
+    uint256 hash10 = GetRandHash(), hash11 = GetRandHash();
+
+    // The state at height 10, then a block that spends a1, pays a2 and moves the vote to v2
+    BOOST_CHECK(db.WriteStartBalances(10, {std::make_pair(a1, 5 * COIN)}));
+    BOOST_CHECK(db.WriteStartVoters(10, delegate, {v1}));
+    BOOST_CHECK(db.WriteStart(10, hash10));
+    BOOST_CHECK(db.WriteBlock(11, hash11, {std::make_pair(a1, 0), std::make_pair(a2, 3 * COIN)},
+        {std::make_pair(std::make_pair(delegate, v1), false), std::make_pair(std::make_pair(delegate, v2), true)}));
+
+    int nStart = 0, nBest = 0;
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadStartHeight(nStart) && nStart == 10);
+    BOOST_CHECK(db.ReadBestBlock(nBest, hashBest) && nBest == 11 && hashBest == hash11);
+
+    uint64_t nBalance = 0;
+    std::vector<CKeyID> vVoter;
+    BOOST_CHECK(db.ReadBalance(a1, 10, nBalance) && nBalance == 5 * COIN);
+    BOOST_CHECK(db.ReadBalance(a1, 11, nBalance) && nBalance == 0);
+    BOOST_CHECK(db.ReadBalance(a2, 10, nBalance) && nBalance == 0);
+    BOOST_CHECK(db.ReadBalance(a2, 12, nBalance) && nBalance == 3 * COIN);
+    BOOST_CHECK(db.ReadVoters(delegate, 10, vVoter) && vVoter == std::vector<CKeyID>{v1});
+    BOOST_CHECK(db.ReadVoters(delegate, 11, vVoter) && vVoter == std::vector<CKeyID>{v2});
+    BOOST_CHECK(db.ReadVoters(RandKeyID(), 11, vVoter) && vVoter.empty());
+
+    // The block lists what it changed, whose values are then read at its height
+    CDPoSHistoryBlock block;
+    bool fVoted = true;
+    BOOST_CHECK(db.ReadBlock(11, block) && block.hashBlock == hash11);
+    BOOST_CHECK(block.vAddress.size() == 2 && block.vVote.size() == 2);
+    BOOST_CHECK(!db.ReadBlock(10, block));
+    BOOST_CHECK(db.ReadVote(delegate, v1, 10, fVoted) && fVoted);
+    BOOST_CHECK(db.ReadVote(delegate, v1, 11, fVoted) && !fVoted);
+    BOOST_CHECK(db.ReadVote(delegate, v2, 10, fVoted) && !fVoted);
+    BOOST_CHECK(db.ReadVote(delegate, v2, 12, fVoted) && fVoted);
+
+    // Disconnecting the block leaves the state of height 10 at every height
+    BOOST_CHECK(db.RevertBlock(11, hash10));
+    BOOST_CHECK(db.ReadBestBlock(nBest, hashBest) && nBest == 10 && hashBest == hash10);
+    BOOST_CHECK(db.ReadBalance(a1, 11, nBalance) && nBalance == 5 * COIN);
+    BOOST_CHECK(db.ReadVoters(delegate, 11, vVoter) && vVoter == std::vector<CKeyID>{v1});
+
+    BOOST_CHECK(db.Clear());
+    BOOST_CHECK(!db.ReadBestBlock(nBest, hashBest));
+    BOOST_CHECK(db.ReadBalance(a1, 10, nBalance) && nBalance == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "threadinfo.h"
+
+#include "utilstrencodings.h"
+
+#include <list>
+#include <mutex>
+
+#include <boost/algorithm/string/split.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+namespace {
+
+struct ThreadRecord {
+    CThreadInfo info;
+#ifdef __linux__
+    clockid_t clock;
+    bool fClock;
+#endif
+};
+
+std::mutex csThreads;
+std::list<ThreadRecord> listThreads;
+std::vector<int> vGroupCpus[THREADGROUP_COUNT];
+
+/** Drops the record of its thread when the thread exits */
+struct ThreadRegistration {
+    std::list<ThreadRecord>::iterator it;
+    bool fRegistered;
+
+    ThreadRegistration() : fRegistered(false) {}
+    ~ThreadRegistration()
+    {
+        if (!fRegistered)
+            return;
+        std::lock_guard<std::mutex> lock(csThreads);
+        listThreads.erase(it);
+    }
+};
+
+thread_local ThreadRegistration threadRegistration;
+
+bool PinThread(const std::vector<int>& vCpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int nCpu : vCpus)
+        CPU_SET(nCpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+}
+
+std::string GetThreadGroupName(ThreadGroup group)
+{
+    switch (group) {
+    case THREADGROUP_SCRIPTCHECK: return "scriptcheck";
+    case THREADGROUP_HTTP: return "http";
+    case THREADGROUP_NET: return "net";
+    default: return "other";
+    }
+}
+
+ThreadGroup GetThreadGroup(const std::string& strThreadName)
+{
+    if (strThreadName == "bitcoin-scriptch" || strThreadName == "bitcoin-forgerch" ||
+        strThreadName == "bitcoin-inputch" || strThreadName == "bitcoin-coinfetch")
+        return THREADGROUP_SCRIPTCHECK;
+    if (strThreadName == "bitcoin-http" || strThreadName == "bitcoin-httpworker")
+        return THREADGROUP_HTTP;
+    if (strThreadName == "bitcoin-net" || strThreadName == "bitcoin-msghand" || strThreadName == "bitcoin-opencon" ||
+        strThreadName == "bitcoin-addcon" || strThreadName == "bitcoin-dnsseed")
+        return THREADGROUP_NET;
+    return THREADGROUP_OTHER;
+}
+
+bool ParseCpuList(const std::string& str, std::vector<int>& vCpus)
+{
+    vCpus.clear();
+    std::vector<std::string> vRanges;
+    boost::split(vRanges, str, [](char c) { return c == ','; });
+    for (const std::string& strRange : vRanges) {
+        size_t nDash = strRange.find('-');
+        int32_t nFirst, nLast;
+        if (!ParseInt32(strRange.substr(0, nDash), &nFirst))
+            return false;
+        nLast = nFirst;
+        if (nDash != std::string::npos && !ParseInt32(strRange.substr(nDash + 1), &nLast))
+            return false;
+        if (nFirst < 0 || nLast < nFirst || nLast >= 1024)
+            return false;
+        for (int n = nFirst; n <= nLast; n++)
+            vCpus.push_back(n);
+    }
+    return !vCpus.empty();
+}
+
+bool SetThreadGroupCpus(ThreadGroup group, const std::vector<int>& vCpus)
+{
+    std::lock_guard<std::mutex> lock(csThreads);
+    vGroupCpus[group] = vCpus;
+#ifdef __linux__
+    return true;
+#else
+    return vCpus.empty();
+#endif
+}
+
+void RegisterThread(const std::string& strName)
+{
+    ThreadGroup group = GetThreadGroup(strName);
+    std::lock_guard<std::mutex> lock(csThreads);
+    if (!threadRegistration.fRegistered) {
+        threadRegistration.it = listThreads.insert(listThreads.end(), ThreadRecord());
+        threadRegistration.fRegistered = true;
+    }
+    ThreadRecord& record = *threadRegistration.it;
+    record.info.strName = strName;
+    record.info.group = group;
+    record.info.vCpus.clear();
+    if (!vGroupCpus[group].empty() && PinThread(vGroupCpus[group]))
+        record.info.vCpus = vGroupCpus[group];
+#ifdef __linux__
+    record.fClock = pthread_getcpuclockid(pthread_self(), &record.clock) == 0;
+#endif
+}
+
+std::vector<CThreadInfo> GetThreadInfos()
+{
+    std::lock_guard<std::mutex> lock(csThreads);
+    std::vector<CThreadInfo> vInfos;
+    for (const ThreadRecord& record : listThreads) {
+        vInfos.push_back(record.info);
+        vInfos.back().nCpuTimeUsec = -1;
+#ifdef __linux__
+        // The thread is alive, a leaving one erases its record under csThreads first
+        struct timespec ts;
+        if (record.fClock && clock_gettime(record.clock, &ts) == 0)
+            vInfos.back().nCpuTimeUsec = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    }
+    return vInfos;
+}
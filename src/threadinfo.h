@@ -0,0 +1,55 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_THREADINFO_H
+#define BITCOIN_THREADINFO_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Threads pinned to the same CPUs, told apart by the name they give themselves */
+enum ThreadGroup {
+    THREADGROUP_OTHER,
+    //! Script, input and coin fetch checks of block validation: -scriptcheckcpus
+    THREADGROUP_SCRIPTCHECK,
+    //! The HTTP server and its RPC workers: -rpccpus
+    THREADGROUP_HTTP,
+    //! The threads of CConnman: -netcpus
+    THREADGROUP_NET,
+    THREADGROUP_COUNT
+};
+
+std::string GetThreadGroupName(ThreadGroup group);
+ThreadGroup GetThreadGroup(const std::string& strThreadName);
+
+/** Parse a list of CPUs like "0-3,8,10-11". False if it is malformed */
+bool ParseCpuList(const std::string& str, std::vector<int>& vCpus);
+
+/**
+ * Pin the threads of group that register from now on to vCpus, empty for
+ * no pinning. Memory the threads go on to allocate is then placed by the
+ * kernel on the NUMA node of those CPUs, so their caches stay local. False
+ * where threads cannot be pinned.
+ */
+bool SetThreadGroupCpus(ThreadGroup group, const std::vector<int>& vCpus);
+
+/**
+ * Register the calling thread under strName, pinning it to the CPUs of its
+ * group. Called by RenameThread, and undone when the thread exits.
+ */
+void RegisterThread(const std::string& strName);
+
+struct CThreadInfo {
+    std::string strName;
+    ThreadGroup group;
+    std::vector<int> vCpus;
+    //! CPU time the thread used, -1 where it cannot be read
+    int64_t nCpuTimeUsec;
+};
+
+/** The threads registered and running */
+std::vector<CThreadInfo> GetThreadInfos();
+
+#endif // BITCOIN_THREADINFO_H
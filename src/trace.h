@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TRACE_H
+#define BITCOIN_TRACE_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+/**
+ * Static tracepoints (USDT probes), see doc/tracing.md for the list and their
+ * arguments. Built with --enable-usdt, each one is a single nop in the code and
+ * a note in the binary that eBPF or perf can attach to; the arguments are only
+ * read when something is attached. Otherwise the arguments are not evaluated.
+ *
+ * When built in, the arguments are evaluated at every call whether or not a
+ * tracer is attached, so pass values the code already has at hand: integers,
+ * and pointers to hashes or strings that live at least as long as the call.
+ */
+#ifdef ENABLE_TRACING
+
+#include <sys/sdt.h>
+
+#define TRACE(context, event) DTRACE_PROBE(context, event)
+#define TRACE1(context, event, a) DTRACE_PROBE1(context, event, a)
+#define TRACE2(context, event, a, b) DTRACE_PROBE2(context, event, a, b)
+#define TRACE3(context, event, a, b, c) DTRACE_PROBE3(context, event, a, b, c)
+#define TRACE4(context, event, a, b, c, d) DTRACE_PROBE4(context, event, a, b, c, d)
+#define TRACE5(context, event, a, b, c, d, e) DTRACE_PROBE5(context, event, a, b, c, d, e)
+#define TRACE6(context, event, a, b, c, d, e, f) DTRACE_PROBE6(context, event, a, b, c, d, e, f)
+#define TRACE7(context, event, a, b, c, d, e, f, g) DTRACE_PROBE7(context, event, a, b, c, d, e, f, g)
+#define TRACE8(context, event, a, b, c, d, e, f, g, h) DTRACE_PROBE8(context, event, a, b, c, d, e, f, g, h)
+#define TRACE9(context, event, a, b, c, d, e, f, g, h, i) DTRACE_PROBE9(context, event, a, b, c, d, e, f, g, h, i)
+#define TRACE10(context, event, a, b, c, d, e, f, g, h, i, j) DTRACE_PROBE10(context, event, a, b, c, d, e, f, g, h, i, j)
+
+#else
+
+// The arguments sit in dead code, so values computed only for a tracepoint are
+// neither evaluated nor reported as unused
+#define TRACE_UNUSED(x) (void)(x)
+
+#define TRACE(context, event) do {} while (0)
+#define TRACE1(context, event, a) do { if (false) { TRACE_UNUSED(a); } } while (0)
+#define TRACE2(context, event, a, b) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); } } while (0)
+#define TRACE3(context, event, a, b, c) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); } } while (0)
+#define TRACE4(context, event, a, b, c, d) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); } } while (0)
+#define TRACE5(context, event, a, b, c, d, e) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); } } while (0)
+#define TRACE6(context, event, a, b, c, d, e, f) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); TRACE_UNUSED(f); } } while (0)
+#define TRACE7(context, event, a, b, c, d, e, f, g) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); TRACE_UNUSED(f); TRACE_UNUSED(g); } } while (0)
+#define TRACE8(context, event, a, b, c, d, e, f, g, h) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); TRACE_UNUSED(f); TRACE_UNUSED(g); TRACE_UNUSED(h); } } while (0)
+#define TRACE9(context, event, a, b, c, d, e, f, g, h, i) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); TRACE_UNUSED(f); TRACE_UNUSED(g); TRACE_UNUSED(h); TRACE_UNUSED(i); } } while (0)
+#define TRACE10(context, event, a, b, c, d, e, f, g, h, i, j) do { if (false) { TRACE_UNUSED(a); TRACE_UNUSED(b); TRACE_UNUSED(c); TRACE_UNUSED(d); TRACE_UNUSED(e); TRACE_UNUSED(f); TRACE_UNUSED(g); TRACE_UNUSED(h); TRACE_UNUSED(i); TRACE_UNUSED(j); } } while (0)
+
+#endif // ENABLE_TRACING
+
+#endif // BITCOIN_TRACE_H
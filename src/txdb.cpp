@@ -5,39 +5,122 @@
 
 #include "txdb.h"
 #include "address_index.h"
+#include "blockfilter.h"
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
+#include "versionbits.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
-static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX = 'x';
+static const char DB_TXINDEX_BEST_BLOCK = 'X';
+// The transaction index of older versions, keyed by the whole txid
+static const char DB_LEGACY_TXINDEX = 't';
+static const char DB_LEGACY_TXINDEX_BEST_BLOCK = 'T';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_ADDRESSINDEX = 'a';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 's';
+
+static const char DB_BLOCK_FILTER = 'f';
+static const char DB_BLOCK_FILTER_HASHES = 'h';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_UTXO_STATS = 'U';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_ROUND_COINBASE = 'D';
+static const char DB_THRESHOLD_CACHE = 'v';
+
+static const char DB_VOTE_BALANCE = 'b';
+static const char DB_VOTE_DELEGATES = 'd';
+static const char DB_VOTE_BILLS = 'k';
+static const char DB_VOTE_COMMITTEES = 'm';
+static const char DB_VOTE_BALANCE_HASH = 'u';
+static const char DB_VOTE_RANK = 'r';
+static const char DB_VOTE_RANKS_COMPLETE = 'R';
+
+static const char DB_HISTORY_BALANCE = 'b';
+static const char DB_HISTORY_VOTE = 'v';
+static const char DB_HISTORY_BLOCK = 'h';
+static const char DB_HISTORY_START = 'S';
+
+
+namespace {
+
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN)  {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        s << outpoint->hash;
+        s << VARINT(outpoint->n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        s >> outpoint->hash;
+        s >> VARINT(outpoint->n);
+    }
+};
+
+/**
+ * Key of a transaction index entry: the first 8 bytes of the txid and the
+ * position of the transaction. Transactions whose txids share the prefix
+ * still get keys of their own, and a lookup reads them all; they are less
+ * than one expected in a billion, and a peer grinding txids for them only
+ * makes its own lookups read a transaction more.
+ */
+struct TxIndexEntry {
+    char key;
+    uint64_t nPrefix;
+    CDiskTxPos pos;
+
+    TxIndexEntry() : key(DB_TXINDEX), nPrefix(0) {}
+    TxIndexEntry(const uint256& txid, const CDiskTxPos& posIn) : key(DB_TXINDEX), nPrefix(txid.GetUint64(0)), pos(posIn) {}
 
+    ADD_SERIALIZE_METHODS;
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(key);
+        READWRITE(nPrefix);
+        READWRITE(pos);
+    }
+};
+
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, dbOptions), fStatsPending(false)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(std::make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(std::make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -53,10 +136,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(std::make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(std::make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -65,12 +149,26 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
+    // Statistics of another block are left out, and a record from before is
+    // then recognized as stale by GetStats
+    if (fStatsPending && statsPending.hashBlock == hashBlock)
+        batch.Write(DB_UTXO_STATS, statsPending);
+    fStatsPending = false;
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewDB::GetStats(CUTXOStats &stats) const {
+    return db.Read(DB_UTXO_STATS, stats) && stats.hashBlock == GetBestBlock();
+}
+
+void CCoinsViewDB::SetStats(const CUTXOStats &stats) {
+    statsPending = stats;
+    fStatsPending = true;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dbOptions) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -99,29 +197,31 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
     if (i->pcursor->Valid()) {
-        i->pcursor->GetKey(i->keyTmp);
+        CoinEntry entry(&i->keyTmp.second);
+        i->pcursor->GetKey(entry);
+        i->keyTmp.first = entry.key;
     } else {
         i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
     }
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -131,14 +231,18 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else {
+        keyTmp.first = entry.key;
+    }
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -153,23 +257,420 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+bool CBlockTreeDB::WriteDiskBlockIndex(const std::vector<CDiskBlockIndex>& vIndex) {
+    CDBBatch batch(*this);
+    for (std::vector<CDiskBlockIndex>::const_iterator it=vIndex.begin(); it != vIndex.end(); it++) {
+        batch.Write(std::make_pair(DB_BLOCK_INDEX, it->GetBlockHash()), *it);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, std::vector<CDiskTxPos> &vPos) {
+    uint64_t nPrefix = txid.GetUint64(0);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_TXINDEX, nPrefix));
+    vPos.clear();
+    for (; pcursor->Valid(); pcursor->Next()) {
+        TxIndexEntry entry;
+        if (!pcursor->GetKey(entry) || entry.key != DB_TXINDEX || entry.nPrefix != nPrefix)
+            break;
+        vPos.push_back(entry.pos);
+    }
+    return !vPos.empty();
+}
+
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const uint256 &hashBlock) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    // The key says it all
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(TxIndexEntry(it->first, it->second), '\0');
+    batch.Write(DB_TXINDEX_BEST_BLOCK, hashBlock);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+bool CBlockTreeDB::EraseTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const uint256 &hashBlock) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(TxIndexEntry(it->first, it->second));
+    batch.Write(DB_TXINDEX_BEST_BLOCK, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseLegacyTxIndex() {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_LEGACY_TXINDEX, uint256()));
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(*this);
+    int64_t count = 0;
+    std::pair<char, uint256> key;
+    while (pcursor->Valid()) {
+        if (!pcursor->GetKey(key) || key.first != DB_LEGACY_TXINDEX)
+            break;
+        if (count == 0)
+            LogPrintf("Removing the transaction index of an older version, it is built again in the new format\n");
+        batch.Erase(key);
+        count++;
+        if (batch.SizeEstimate() > batch_size) {
+            if (!WriteBatch(batch))
+                return false;
+            batch.Clear();
+            if (ShutdownRequested())
+                return false;
+        }
+        pcursor->Next();
+    }
+    batch.Erase(DB_LEGACY_TXINDEX_BEST_BLOCK);
+    if (!WriteBatch(batch))
+        return false;
+    if (count > 0) {
+        LogPrintf("Removed %d entries of the old transaction index\n", count);
+        CompactRange(std::make_pair(DB_LEGACY_TXINDEX, uint256()), key);
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadTxIndexBestBlock(uint256 &hashBlock) {
+    return Read(DB_TXINDEX_BEST_BLOCK, hashBlock);
+}
+
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+bool CBlockTreeDB::WriteRoundCoinbases(const std::vector<std::pair<uint256, CTransactionRef> >& vCoinbase) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256, CTransactionRef> >::const_iterator it=vCoinbase.begin(); it != vCoinbase.end(); it++)
+        batch.Write(std::make_pair(DB_ROUND_COINBASE, it->first), it->second);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ReadRoundCoinbase(const uint256 &hashBlock, CTransactionRef &coinbase) {
+    return Read(std::make_pair(DB_ROUND_COINBASE, hashBlock), coinbase);
+}
+
+bool CBlockTreeDB::WriteThresholdCaches(const std::vector<std::pair<uint8_t, ThresholdCacheRecord> >& vRecords) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
+    for (const std::pair<uint8_t, ThresholdCacheRecord>& record : vRecords)
+        batch.Write(std::make_pair(DB_THRESHOLD_CACHE, record.first), record.second);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
-                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+bool CBlockTreeDB::ReadThresholdCache(uint8_t nId, ThresholdCacheRecord& record) {
+    return Read(std::make_pair(DB_THRESHOLD_CACHE, nId), record);
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    // Block hashes are uniformly distributed, so splitting the records by the first
+    // byte of the hash, which leads the key, gives every thread a similar share.
+    // Reading and hashing the headers is done in parallel, only the inserts are serialized.
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    boost::mutex csInsert;
+    std::atomic<bool> fFailed(false);
+
+    auto loadRange = [&](int nFirstByte, int nEndByte) {
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        uint256 hashStart;
+        *hashStart.begin() = nFirstByte;
+        pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, hashStart));
+
+        while (pcursor->Valid() && !fFailed) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEndByte)
+                break;
+
+            CDiskBlockIndex diskindex;
+            if (!pcursor->GetValue(diskindex)) {
+                fFailed = true;
+                error("LoadBlockIndex() : failed to read value");
+                break;
+            }
+            uint256 hash = diskindex.GetBlockHash();
+
+            {
+                boost::unique_lock<boost::mutex> lock(csInsert);
+                // Construct block index object
+                CBlockIndex* pindexNew = insertBlockIndex(hash);
+                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+                pindexNew->nHeight        = diskindex.nHeight;
+                pindexNew->nFile          = diskindex.nFile;
+                pindexNew->nDataPos       = diskindex.nDataPos;
+                pindexNew->nUndoPos       = diskindex.nUndoPos;
+                pindexNew->nVersion       = diskindex.nVersion;
+                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+                pindexNew->nTime          = diskindex.nTime;
+                pindexNew->nBits          = diskindex.nBits;
+                pindexNew->nNonce         = diskindex.nNonce;
+                pindexNew->nStatus        = diskindex.nStatus;
+                pindexNew->nTx            = diskindex.nTx;
+
+                if (!CheckProofOfWork(pindexNew->nHeight, pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus())) {
+                    fFailed = true;
+                    error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+                    break;
+                }
+            }
+
+            pcursor->Next();
+        }
+    };
+
+    if (nThreads == 1) {
+        loadRange(0, 256);
+    } else {
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind<void>(loadRange, 256 * i / nThreads, 256 * (i + 1) / nThreads));
+        threadGroup.join_all();
+    }
+
+    return !fFailed;
+}
+
+bool CBlockTreeDB::DeleteBlock(const CBlockIndex *pindex) 
+{
+    CDBBatch batch(*this); 
+    batch.Erase(std::make_pair(DB_BLOCK_FILES, pindex->nFile)); 
+    batch.Erase(std::make_pair(DB_BLOCK_INDEX, pindex->GetBlockHash())); 
+    
+    return WriteBatch(batch, true); 
+}
+
+
+namespace {
+
+//! Legacy class to deserialize pre-pertxout database entries without reindex.
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    //! empty constructor
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+}
+
+/** Upgrade the database from older formats.
+ *
+ * Currently implemented: from the per-tx utxo model to per-txout. Every
+ * batch converts a run of txid records and erases them in the same write,
+ * so an interrupted upgrade resumes where it stopped on the next start.
+ */
+bool CCoinsViewDB::Upgrade() {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<unsigned char, uint256> key;
+    std::pair<unsigned char, uint256> prev_key = std::make_pair((unsigned char)DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(std::make_pair((unsigned char)DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
+CAddressIndexDB::CAddressIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) : CDBWrapper(GetDataDir() / "indexes" / "address", nCacheSize, fMemory, fWipe, false, dbOptions) {
+    Read(DB_BEST_BLOCK, hashBestBlock);
+}
+
+bool CAddressIndexDB::UpdateBlock(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vHistory,
+                                  const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent,
+                                  const uint256& hashBlock, bool fDisconnect) {
+    CDBBatch batch(*this);
+    std::map<std::pair<unsigned int, uint160>, CAddressBalance> mapDelta;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vHistory.begin(); it != vHistory.end(); it++) {
+        if (fDisconnect)
+            batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
+        CAddressBalance& delta = mapDelta[std::make_pair(it->first.type, it->first.hashBytes)];
+        delta.nBalance += it->second;
+        if (!it->first.spending)
+            delta.nReceived += it->second;
+    }
+    for (std::map<std::pair<unsigned int, uint160>, CAddressBalance>::const_iterator it = mapDelta.begin(); it != mapDelta.end(); it++) {
+        CAddressBalance balance;
+        ReadAddressBalance(it->first.second, it->first.first, balance);
+        const int sign = fDisconnect ? -1 : 1;
+        balance.nBalance += sign * it->second.nBalance;
+        balance.nReceived += sign * it->second.nReceived;
+        CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        if (balance.nReceived == 0)
+            batch.Erase(std::make_pair(DB_ADDRESSBALANCE, key));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSBALANCE, key), balance);
+    }
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspent.begin(); it != vUnspent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+    }
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (!WriteBatch(batch))
+        return false;
+    hashBestBlock = hashBlock;
+    return true;
+}
+
+bool CAddressIndexDB::Sync() {
+    CDBBatch batch(*this);
+    batch.Write(DB_BEST_BLOCK, hashBestBlock);
+    return WriteBatch(batch, true);
+}
+
+CBlockFilterDB::CBlockFilterDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "indexes" / "blockfilter" / "basic", nCacheSize, fMemory, fWipe) {
+    Read(DB_BEST_BLOCK, hashBestBlock);
+}
+
+bool CBlockFilterDB::WriteFilter(const CBlockFilter& filter, const uint256& hashHeader) {
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_BLOCK_FILTER, filter.GetBlockHash()), filter.GetEncoded());
+    batch.Write(std::make_pair(DB_BLOCK_FILTER_HASHES, filter.GetBlockHash()), std::make_pair(filter.GetHash(), hashHeader));
+    batch.Write(DB_BEST_BLOCK, filter.GetBlockHash());
+    if (!WriteBatch(batch))
+        return false;
+    hashBestBlock = filter.GetBlockHash();
+    return true;
+}
+
+bool CBlockFilterDB::WriteBestBlock(const uint256& hashBlock) {
+    if (!Write(DB_BEST_BLOCK, hashBlock))
+        return false;
+    hashBestBlock = hashBlock;
+    return true;
+}
+
+bool CBlockFilterDB::Sync() {
+    return Write(DB_BEST_BLOCK, hashBestBlock, true);
+}
+
+bool CBlockFilterDB::ReadFilter(const uint256& hashBlock, CBlockFilter& filter) const {
+    std::vector<unsigned char> vEncoded;
+    if (!Read(std::make_pair(DB_BLOCK_FILTER, hashBlock), vEncoded))
+        return false;
+    try {
+        filter = CBlockFilter(hashBlock, std::move(vEncoded));
+    } catch (const std::ios_base::failure& e) {
+        return error("%s: filter of block %s is corrupted: %s", __func__, hashBlock.ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterDB::ReadFilterHashes(const uint256& hashBlock, uint256& hashFilter, uint256& hashHeader) const {
+    std::pair<uint256, uint256> hashes;
+    if (!Read(std::make_pair(DB_BLOCK_FILTER_HASHES, hashBlock), hashes))
+        return false;
+    hashFilter = hashes.first;
+    hashHeader = hashes.second;
+    return true;
+}
+
+bool CAddressIndexDB::ReadAddressIndex(uint160 addressHash, int type,
+                                       std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                       int start, int end) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
@@ -182,7 +683,7 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.type == (unsigned int)type && key.second.hashBytes == addressHash) {
             if (end > 0 && key.second.blockHeight >= end) {
                 break;
             }
@@ -201,64 +702,245 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+namespace {
+
+/** Walks the history of one address backwards, see CAddressIndexDB::ReadAddressTxids */
+struct CAddressHistoryCursor {
+    std::unique_ptr<CDBIterator> pcursor;
+    unsigned int type;
+    uint160 hashBytes;
+    CAddressIndexKey key; //!< The row the cursor is at
+
+    CAddressHistoryCursor(CDBIterator* pcursorIn, unsigned int typeIn, const uint160& hashBytesIn)
+        : pcursor(pcursorIn), type(typeIn), hashBytes(hashBytesIn) {}
+
+    //! Load the current row, false once the cursor left the rows of the address from height start on
+    bool Read(int start) {
+        std::pair<char, CAddressIndexKey> entry;
+        if (!pcursor->Valid() || !pcursor->GetKey(entry) || entry.first != DB_ADDRESSINDEX ||
+            entry.second.type != type || entry.second.hashBytes != hashBytes || entry.second.blockHeight < start)
+            return false;
+        key = entry.second;
+        return true;
+    }
+};
+
+//! Orders the cursors of a max-heap by the chain position of their rows
+bool CompareCursorPosition(const CAddressHistoryCursor* a, const CAddressHistoryCursor* b)
+{
+    return std::make_pair(a->key.blockHeight, a->key.txindex) < std::make_pair(b->key.blockHeight, b->key.txindex);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+bool CAddressIndexDB::ReadAddressTxids(const std::vector<std::pair<uint160, int> >& vAddress, int start,
+                                       int endHeight, unsigned int endTxIndex, size_t nLimit,
+                                       std::vector<CAddressIndexKey>& vTxid, bool& fMore) {
+
+    std::vector<std::unique_ptr<CAddressHistoryCursor> > vCursor;
+    std::vector<CAddressHistoryCursor*> heap;
+    for (const std::pair<uint160, int>& address : vAddress) {
+        vCursor.emplace_back(new CAddressHistoryCursor(NewIterator(), address.second, address.first));
+        CAddressHistoryCursor* cursor = vCursor.back().get();
+        // Every row at the end position or later sorts after its prefix.
+        cursor->pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorPositionKey(address.second, address.first, endHeight, endTxIndex)));
+        if (cursor->pcursor->Valid())
+            cursor->pcursor->Prev();
+        else
+            cursor->pcursor->SeekToLast();
+        if (cursor->Read(start))
+            heap.push_back(cursor);
+    }
+    std::make_heap(heap.begin(), heap.end(), CompareCursorPosition);
+
+    // The rows of a transaction are next to each other in the merged order,
+    // whichever addresses they belong to.
+    fMore = false;
+    while (!heap.empty()) {
+        boost::this_thread::interruption_point();
+        std::pop_heap(heap.begin(), heap.end(), CompareCursorPosition);
+        CAddressHistoryCursor* cursor = heap.back();
+        if (vTxid.empty() || vTxid.back().blockHeight != cursor->key.blockHeight || vTxid.back().txindex != cursor->key.txindex) {
+            if (vTxid.size() >= nLimit) {
+                fMore = true;
+                break;
+            }
+            vTxid.push_back(cursor->key);
+        }
+        cursor->pcursor->Prev();
+        if (cursor->Read(start))
+            std::push_heap(heap.begin(), heap.end(), CompareCursorPosition);
+        else
+            heap.pop_back();
+    }
+
+    return true;
 }
 
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
+bool CAddressIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                              std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressUnspentKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.type == (unsigned int)type && key.second.hashBytes == addressHash) {
+            CAddressUnspentValue value;
+            if (pcursor->GetValue(value)) {
+                unspentOutputs.push_back(std::make_pair(key.second, value));
+                pcursor->Next();
+            } else {
+                return error("failed to get address unspent value");
+            }
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CAddressIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalance& balance) {
+    balance = CAddressBalance();
+    return Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), balance);
+}
+
+CVoteDB::CVoteDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "dpos" / "db", nCacheSize, fMemory, fWipe) {
+}
+
+bool CVoteDB::ReadBalance(const CMyAddress& address, uint64_t& nBalance) const {
+    return Read(std::make_pair(DB_VOTE_BALANCE, address), VARINT(nBalance));
+}
+
+bool CVoteDB::ReadBestBlock(int64_t& nHeight, uint256& hashBlock) const {
+    std::pair<int64_t, uint256> best;
+    if (!Read(DB_BEST_BLOCK, best))
         return false;
-    fValue = ch == '1';
+    nHeight = best.first;
+    hashBlock = best.second;
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+static bool ReadStream(const CDBWrapper& db, char key, CDataStream& ss)
+{
+    std::vector<char> data;
+    if (!db.Read(key, data))
+        return false;
+    ss.clear();
+    ss.write(data.data(), data.size());
+    return true;
+}
+
+bool CVoteDB::ReadState(CDataStream& delegates, CDataStream& bills, CDataStream& committees) const {
+    return ReadStream(*this, DB_VOTE_DELEGATES, delegates)
+        && ReadStream(*this, DB_VOTE_BILLS, bills)
+        && ReadStream(*this, DB_VOTE_COMMITTEES, committees);
+}
+
+static void WriteBalanceBatch(CDBBatch& batch, const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance)
+{
+    for (std::vector<std::pair<CMyAddress, uint64_t> >::const_iterator it = vBalance.begin(); it != vBalance.end(); it++) {
+        if (it->second == 0)
+            batch.Erase(std::make_pair(DB_VOTE_BALANCE, it->first));
+        else
+            batch.Write(std::make_pair(DB_VOTE_BALANCE, it->first), VARINT(it->second));
+    }
+}
+
+static void WriteRankBatch(CDBBatch& batch, const std::vector<CVoteRankChange>& vRank)
+{
+    for (const CVoteRankChange& change : vRank) {
+        if (change.nOldBalance == change.nNewBalance)
+            continue;
+        if (change.nOldBalance > 0)
+            batch.Erase(std::make_pair(DB_VOTE_RANK, CVoteRankKey(change.nOldBalance, change.address)));
+        if (change.nNewBalance > 0)
+            batch.Write(std::make_pair(DB_VOTE_RANK, CVoteRankKey(change.nNewBalance, change.address)), '1');
+    }
+}
+
+bool CVoteDB::ReadBalanceHash(MuHash3072& muhashBalance) const {
+    return Read(DB_VOTE_BALANCE_HASH, muhashBalance);
+}
+
+bool CVoteDB::WriteState(const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance, const std::vector<CVoteRankChange>& vRank,
+                         const CDataStream* pdelegates, const CDataStream* pbills, const CDataStream* pcommittees,
+                         const MuHash3072& muhashBalance, int64_t nHeight, const uint256& hashBlock) {
+    CDBBatch batch(*this);
+    WriteBalanceBatch(batch, vBalance);
+    WriteRankBatch(batch, vRank);
+    if (pdelegates)
+        batch.Write(DB_VOTE_DELEGATES, std::vector<char>(pdelegates->begin(), pdelegates->end()));
+    if (pbills)
+        batch.Write(DB_VOTE_BILLS, std::vector<char>(pbills->begin(), pbills->end()));
+    if (pcommittees)
+        batch.Write(DB_VOTE_COMMITTEES, std::vector<char>(pcommittees->begin(), pcommittees->end()));
+    batch.Write(DB_VOTE_BALANCE_HASH, muhashBalance);
+    batch.Write(DB_BEST_BLOCK, std::make_pair(nHeight, hashBlock));
+
+    LogPrint("DPoS", "Committing %u changed balances to vote database at height %d...\n", (unsigned int)vBalance.size(), nHeight);
+    return WriteBatch(batch, true);
+}
+
+bool CVoteDB::WriteNewBalances(const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance) {
+    CDBBatch batch(*this);
+    WriteBalanceBatch(batch, vBalance);
+    std::vector<CVoteRankChange> vRank;
+    for (const std::pair<CMyAddress, uint64_t>& balance : vBalance)
+        vRank.push_back(CVoteRankChange(balance.first, 0, balance.second));
+    WriteRankBatch(batch, vRank);
+    return WriteBatch(batch);
+}
+
+bool CVoteDB::HaveRanks() const {
+    return Exists(DB_VOTE_RANKS_COMPLETE);
+}
+
+bool CVoteDB::WriteRanks(const std::vector<CVoteRankChange>& vRank, bool fComplete) {
+    CDBBatch batch(*this);
+    WriteRankBatch(batch, vRank);
+    if (fComplete)
+        batch.Write(DB_VOTE_RANKS_COMPLETE, '1');
+    return WriteBatch(batch);
+}
+
+bool CVoteDB::ForEachRank(uint64_t nMaxBalance, std::function<bool(uint64_t, const CMyAddress&)> func)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+    pcursor->Seek(std::make_pair(DB_VOTE_RANK, CVoteRankKey(nMaxBalance)));
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
+        std::pair<char, CVoteRankKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_VOTE_RANK)
+            break;
+        if (!func(key.second.nBalance, key.second.address))
+            break;
+        pcursor->Next();
+    }
 
-                if (!CheckProofOfWork(pindexNew->nHeight, pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+    return true;
+}
 
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
-            }
+bool CVoteDB::ForEachBalance(std::function<void(const CMyAddress&, uint64_t)> func)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_VOTE_BALANCE, CMyAddress()));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CMyAddress> key;
+        if (pcursor->GetKey(key) && key.first == DB_VOTE_BALANCE) {
+            uint64_t nBalance = 0;
+            if (!pcursor->GetValue(VARINT(nBalance)))
+                return error("%s: failed to read balance", __func__);
+            func(key.second, nBalance);
+            pcursor->Next();
         } else {
             break;
         }
@@ -267,12 +949,175 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
     return true;
 }
 
-bool CBlockTreeDB::DeleteBlock(const CBlockIndex *pindex) 
+typedef std::pair<char, std::pair<CMyAddress, CDPoSHistoryHeight> > CDPoSHistoryBalanceKey;
+typedef std::pair<char, std::pair<std::pair<CKeyID, CKeyID>, CDPoSHistoryHeight> > CDPoSHistoryVoteKey;
+
+static CDPoSHistoryBalanceKey MakeHistoryBalanceKey(const CMyAddress& address, int nHeight)
 {
-    CDBBatch batch(*this); 
-    batch.Erase(std::make_pair(DB_BLOCK_FILES, pindex->nFile)); 
-    batch.Erase(std::make_pair(DB_BLOCK_INDEX, pindex->GetBlockHash())); 
-    
-    return WriteBatch(batch, true); 
+    return std::make_pair(DB_HISTORY_BALANCE, std::make_pair(address, CDPoSHistoryHeight(nHeight)));
+}
+
+static CDPoSHistoryVoteKey MakeHistoryVoteKey(const CKeyID& delegate, const CKeyID& voter, int nHeight)
+{
+    return std::make_pair(DB_HISTORY_VOTE, std::make_pair(std::make_pair(delegate, voter), CDPoSHistoryHeight(nHeight)));
+}
+
+CDPoSHistoryDB::CDPoSHistoryDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "dpos" / "history", nCacheSize, fMemory, fWipe) {
+}
+
+bool CDPoSHistoryDB::ReadBestBlock(int& nHeight, uint256& hashBlock) const {
+    std::pair<int, uint256> best;
+    if (!Read(DB_BEST_BLOCK, best))
+        return false;
+    nHeight = best.first;
+    hashBlock = best.second;
+    return true;
 }
 
+bool CDPoSHistoryDB::ReadStartHeight(int& nHeight) const {
+    return Read(DB_HISTORY_START, nHeight);
+}
+
+bool CDPoSHistoryDB::WriteBlock(int nHeight, const uint256& hashBlock, const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance,
+                                const std::vector<std::pair<std::pair<CKeyID, CKeyID>, bool> >& vVote) {
+    CDBBatch batch(*this);
+    CDPoSHistoryBlock undo;
+    undo.hashBlock = hashBlock;
+    undo.vAddress.reserve(vBalance.size());
+    for (std::vector<std::pair<CMyAddress, uint64_t> >::const_iterator it = vBalance.begin(); it != vBalance.end(); it++) {
+        batch.Write(MakeHistoryBalanceKey(it->first, nHeight), VARINT(it->second));
+        undo.vAddress.push_back(it->first);
+    }
+    undo.vVote.reserve(vVote.size());
+    for (std::vector<std::pair<std::pair<CKeyID, CKeyID>, bool> >::const_iterator it = vVote.begin(); it != vVote.end(); it++) {
+        batch.Write(MakeHistoryVoteKey(it->first.first, it->first.second, nHeight), it->second);
+        undo.vVote.push_back(it->first);
+    }
+    batch.Write(std::make_pair(DB_HISTORY_BLOCK, CDPoSHistoryHeight(nHeight)), undo);
+    batch.Write(DB_BEST_BLOCK, std::make_pair(nHeight, hashBlock));
+    return WriteBatch(batch);
+}
+
+bool CDPoSHistoryDB::RevertBlock(int nHeight, const uint256& hashPrev) {
+    CDPoSHistoryBlock undo;
+    if (!Read(std::make_pair(DB_HISTORY_BLOCK, CDPoSHistoryHeight(nHeight)), undo))
+        return error("%s: no history of height %d", __func__, nHeight);
+
+    CDBBatch batch(*this);
+    for (const CMyAddress& address : undo.vAddress)
+        batch.Erase(MakeHistoryBalanceKey(address, nHeight));
+    for (const std::pair<CKeyID, CKeyID>& vote : undo.vVote)
+        batch.Erase(MakeHistoryVoteKey(vote.first, vote.second, nHeight));
+    batch.Erase(std::make_pair(DB_HISTORY_BLOCK, CDPoSHistoryHeight(nHeight)));
+    batch.Write(DB_BEST_BLOCK, std::make_pair(nHeight - 1, hashPrev));
+    return WriteBatch(batch);
+}
+
+/** Erase every record under a prefix, the keys being read as K after it */
+template<typename K>
+static bool EraseHistoryRecords(CDBWrapper& db, char chPrefix)
+{
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+    std::pair<char, K> key;
+    for (pcursor->Seek(chPrefix); pcursor->Valid() && pcursor->GetKey(key) && key.first == chPrefix; pcursor->Next()) {
+        batch.Erase(key);
+        if (batch.SizeEstimate() > (1 << 20)) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CDPoSHistoryDB::Clear() {
+    // The best block goes first, so an interrupted clear leaves an empty history
+    CDBBatch batch(*this);
+    batch.Erase(DB_BEST_BLOCK);
+    batch.Erase(DB_HISTORY_START);
+    return WriteBatch(batch, true)
+        && EraseHistoryRecords<std::pair<CMyAddress, CDPoSHistoryHeight> >(*this, DB_HISTORY_BALANCE)
+        && EraseHistoryRecords<std::pair<std::pair<CKeyID, CKeyID>, CDPoSHistoryHeight> >(*this, DB_HISTORY_VOTE)
+        && EraseHistoryRecords<CDPoSHistoryHeight>(*this, DB_HISTORY_BLOCK);
+}
+
+bool CDPoSHistoryDB::WriteStartBalances(int nHeight, const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CMyAddress, uint64_t> >::const_iterator it = vBalance.begin(); it != vBalance.end(); it++)
+        batch.Write(MakeHistoryBalanceKey(it->first, nHeight), VARINT(it->second));
+    return WriteBatch(batch);
+}
+
+bool CDPoSHistoryDB::WriteStartVoters(int nHeight, const CKeyID& delegate, const std::vector<CKeyID>& vVoter) {
+    CDBBatch batch(*this);
+    for (const CKeyID& voter : vVoter)
+        batch.Write(MakeHistoryVoteKey(delegate, voter, nHeight), true);
+    return WriteBatch(batch);
+}
+
+bool CDPoSHistoryDB::WriteStart(int nHeight, const uint256& hashBlock) {
+    CDBBatch batch(*this);
+    batch.Write(DB_HISTORY_START, nHeight);
+    batch.Write(DB_BEST_BLOCK, std::make_pair(nHeight, hashBlock));
+    return WriteBatch(batch, true);
+}
+
+bool CDPoSHistoryDB::ReadBalance(const CMyAddress& address, int nHeight, uint64_t& nBalance) {
+    nBalance = 0;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(MakeHistoryBalanceKey(address, nHeight));
+
+    CDPoSHistoryBalanceKey key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_HISTORY_BALANCE || key.second.first != address)
+        return true;
+    if (!pcursor->GetValue(VARINT(nBalance)))
+        return error("%s: failed to read balance", __func__);
+    return true;
+}
+
+bool CDPoSHistoryDB::ReadBlock(int nHeight, CDPoSHistoryBlock& block) const {
+    return Read(std::make_pair(DB_HISTORY_BLOCK, CDPoSHistoryHeight(nHeight)), block);
+}
+
+bool CDPoSHistoryDB::ReadVote(const CKeyID& delegate, const CKeyID& voter, int nHeight, bool& fVoted) {
+    fVoted = false;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(MakeHistoryVoteKey(delegate, voter, nHeight));
+
+    CDPoSHistoryVoteKey key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_HISTORY_VOTE
+        || key.second.first.first != delegate || key.second.first.second != voter)
+        return true;
+    if (!pcursor->GetValue(fVoted))
+        return error("%s: failed to read vote", __func__);
+    return true;
+}
+
+bool CDPoSHistoryDB::ReadVoters(const CKeyID& delegate, int nHeight, std::vector<CKeyID>& vVoter) {
+    vVoter.clear();
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(MakeHistoryVoteKey(delegate, CKeyID(), std::numeric_limits<uint32_t>::max()));
+
+    // The records of a voter are newest first, the first one at or below nHeight is in effect
+    CKeyID voterLast;
+    bool fHaveLast = false;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        CDPoSHistoryVoteKey key;
+        if (!pcursor->GetKey(key) || key.first != DB_HISTORY_VOTE || key.second.first.first != delegate)
+            break;
+        const CKeyID& voter = key.second.first.second;
+        if ((fHaveLast && voter == voterLast) || key.second.second.nHeight > (uint32_t)nHeight)
+            continue;
+
+        bool fVoted = false;
+        if (!pcursor->GetValue(fVoted))
+            return error("%s: failed to read vote", __func__);
+        if (fVoted)
+            vVoter.push_back(voter);
+        voterLast = voter;
+        fHaveLast = true;
+    }
+    return true;
+}
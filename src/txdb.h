@@ -11,6 +11,7 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "pubkey.h"
 
 #include <map>
 #include <string>
@@ -19,8 +20,10 @@
 
 #include <boost/function.hpp>
 
+class CBlockFilter;
 class CBlockIndex;
 class CCoinsViewDBCursor;
+struct ThresholdCacheRecord;
 class uint256;
 
 //! Compensate for extra memory peak (x1.5-x1.9) at flush time.
@@ -43,6 +46,20 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Max memory allocated to the address index DB specific cache (MiB)
+static const int64_t nMaxAddressIndexDBCache = 512;
+//! Max memory allocated to the block filter index DB specific cache (MiB)
+static const int64_t nMaxBlockFilterDBCache = 64;
+//! -chainstatedbprofile default, see CDBOptions::FromProfile
+static const char* const DEFAULT_CHAINSTATE_DB_PROFILE = "default";
+//! -blockindexdbprofile default, see CDBOptions::FromProfile
+static const char* const DEFAULT_BLOCKINDEX_DB_PROFILE = "default";
+//! Max memory allocated to DPoS vote DB specific cache (MiB)
+static const int64_t nMaxVoteDBCache = 64;
+//! Max memory allocated to the DPoS history DB specific cache (MiB)
+static const int64_t nMaxDPoSHistoryDBCache = 64;
+//! Threads reading the block index records at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -74,14 +91,25 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Statistics handed over by SetStats, written with the batch that moves the best block to them
+    CUTXOStats statsPending;
+    bool fStatsPending;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
-    uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
-    CCoinsViewCursor *Cursor() const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    CCoinsViewCursor *Cursor() const override;
+    //! The stored statistics, as long as they are of the best block
+    bool GetStats(CUTXOStats &stats) const override;
+    void SetStats(const CUTXOStats &stats) override;
+
+    //! Convert per-txid records of an older database to per-outpoint ones. Returns false on error or when interrupted.
+    bool Upgrade();
+    //! Rewrite the whole database with the options it is opened with, see CDBWrapper::CompactFull
+    void CompactFull() const { db.CompactFull(); }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -90,18 +118,18 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
-    unsigned int GetValueSize() const;
+    bool GetKey(COutPoint &key) const override;
+    bool GetValue(Coin &coin) const override;
+    unsigned int GetValueSize() const override;
 
-    bool Valid() const;
-    void Next();
+    bool Valid() const override;
+    void Next() override;
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     std::unique_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
@@ -110,28 +138,279 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    //! Write entries as they are stored, for block index entries not in mapBlockIndex
+    bool WriteDiskBlockIndex(const std::vector<CDiskBlockIndex>& vIndex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    /**
+     * The positions indexed under the first bytes of txid. Other transactions
+     * may share them, so the caller has to read the transactions to find its own.
+     */
+    bool ReadTxIndex(const uint256 &txid, std::vector<CDiskTxPos> &vPos);
+    //! Write the positions of transactions and make hashBlock the best block of the index
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const uint256 &hashBlock);
+    //! Remove the positions of the transactions of a disconnected block and make hashBlock the best block of the index
+    bool EraseTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const uint256 &hashBlock);
+    bool ReadTxIndexBestBlock(uint256 &hashBlock);
+    //! Remove the transaction index older versions wrote. Returns false on error or when interrupted.
+    bool EraseLegacyTxIndex();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /**
+     * Keep the coinbases of round-start blocks, which carry the delegate
+     * schedule of their round, so DPoS still finds it once the block files
+     * are pruned. Written synchronously, before the files are removed.
+     */
+    bool WriteRoundCoinbases(const std::vector<std::pair<uint256, CTransactionRef> >& vCoinbase);
+    bool ReadRoundCoinbase(const uint256 &hashBlock, CTransactionRef &coinbase);
+    //! Keep the versionbits and warning bits caches, which otherwise each walk the whole chain after a restart
+    bool WriteThresholdCaches(const std::vector<std::pair<uint8_t, ThresholdCacheRecord> >& vRecords);
+    bool ReadThresholdCache(uint8_t nId, ThresholdCacheRecord& record);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 	bool DeleteBlock(const CBlockIndex *pindex);
+};
+
+/**
+ * Access to the address index database (indexes/address/). It holds the
+ * transaction history of every address ordered by height, its unspent
+ * outputs and its running balance, so a balance or UTXO query is a single
+ * seek instead of a scan of the history.
+ */
+class CAddressIndexDB : public CDBWrapper
+{
+public:
+    CAddressIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
+private:
+    CAddressIndexDB(const CAddressIndexDB&);
+    void operator=(const CAddressIndexDB&);
+
+    //! Block the database is at, mirrored in memory
+    uint256 hashBestBlock;
+public:
+    /**
+     * Apply the index changes of a connected block, or revert them with fDisconnect.
+     * The history entries are written (erased), the balances follow their amounts,
+     * and the unspent entries are written as given, a null value erasing one.
+     * hashBlock becomes the best block.
+     */
+    bool UpdateBlock(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vHistory,
+                     const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent,
+                     const uint256& hashBlock, bool fDisconnect);
+    //! Make the writes so far durable
+    bool Sync();
+    uint256 GetBestBlock() const { return hashBestBlock; }
 
-    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
+    /**
+     * Transactions of a set of addresses, newest first, merged from the
+     * history of each address. Each transaction shows up once, as the first
+     * history row it has for any of the addresses. Only transactions at a
+     * height from start on and before the position (endHeight, endTxIndex)
+     * are read, and at most nLimit of them; fMore tells whether the limit
+     * cut off older ones.
+     */
+    bool ReadAddressTxids(const std::vector<std::pair<uint160, int> >& vAddress, int start,
+                          int endHeight, unsigned int endTxIndex, size_t nLimit,
+                          std::vector<CAddressIndexKey>& vTxid, bool& fMore);
+    bool ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+    //! False (and a zero balance) if the address never received anything
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalance& balance);
+};
+
+/**
+ * Access to the block filter index database (indexes/blockfilter/basic/). It
+ * holds the basic filter of every block indexed so far, apart from its filter
+ * hash and header so a range of headers is read without the filters. The
+ * entries are keyed by block hash and stay valid when a block is disconnected.
+ */
+class CBlockFilterDB : public CDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+
+    //! Block the database is at, mirrored in memory
+    uint256 hashBestBlock;
+public:
+    //! Write the filter of a block and its header, and make the block the best block
+    bool WriteFilter(const CBlockFilter& filter, const uint256& hashHeader);
+    bool WriteBestBlock(const uint256& hashBlock);
+    //! Make the writes so far durable
+    bool Sync();
+    uint256 GetBestBlock() const { return hashBestBlock; }
+
+    bool ReadFilter(const uint256& hashBlock, CBlockFilter& filter) const;
+    bool ReadFilterHashes(const uint256& hashBlock, uint256& hashFilter, uint256& hashHeader) const;
+};
+
+/**
+ * A balance in a rank record of the vote database, written inverted and
+ * big-endian so the records sort largest balance first.
+ */
+struct CVoteRankKey
+{
+    uint64_t nBalance;
+    CMyAddress address;
+
+    CVoteRankKey(uint64_t nBalanceIn = 0, const CMyAddress& addressIn = CMyAddress()) : nBalance(nBalanceIn), address(addressIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, ~(uint32_t)(nBalance >> 32));
+        ser_writedata32be(s, ~(uint32_t)nBalance);
+        s << address;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        nBalance = (uint64_t)~ser_readdata32be(s) << 32;
+        nBalance |= ~ser_readdata32be(s);
+        s >> address;
+    }
+};
+
+/** A balance moving in the rank records, from the one the vote database has (0 = none) to the new one (0 = none) */
+struct CVoteRankChange
+{
+    CMyAddress address;
+    uint64_t nOldBalance;
+    uint64_t nNewBalance;
+
+    CVoteRankChange(const CMyAddress& addressIn, uint64_t nOldBalanceIn, uint64_t nNewBalanceIn) :
+        address(addressIn), nOldBalance(nOldBalanceIn), nNewBalance(nNewBalanceIn) {}
+};
+
+/** Access to the DPoS vote database (dpos/db/) */
+class CVoteDB : public CDBWrapper
+{
+public:
+    CVoteDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CVoteDB(const CVoteDB&);
+    void operator=(const CVoteDB&);
+public:
+    bool ReadBalance(const CMyAddress& address, uint64_t& nBalance) const;
+    bool ReadBestBlock(int64_t& nHeight, uint256& hashBlock) const;
+    bool ReadState(CDataStream& delegates, CDataStream& bills, CDataStream& committees) const;
+    /** The set hash of all the balances, missing in databases from before it was kept */
+    bool ReadBalanceHash(MuHash3072& muhashBalance) const;
+    /**
+     * Atomically write changed balances (0 = erase) with their rank records, the non-balance vote state, the balance set hash
+     * and the block they belong to. Parts of the non-balance state passed as NULL did not change and are left as written before.
+     */
+    bool WriteState(const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance, const std::vector<CVoteRankChange>& vRank,
+                    const CDataStream* pdelegates, const CDataStream* pbills, const CDataStream* pcommittees,
+                    const MuHash3072& muhashBalance, int64_t nHeight, const uint256& hashBlock);
+    bool ForEachBalance(std::function<void(const CMyAddress&, uint64_t)> func);
+    /** Write the balances of addresses the database does not have yet, and their rank records, without the rest of the state */
+    bool WriteNewBalances(const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance);
+
+    /** Whether every balance has its rank record, which databases from before they were kept lack */
+    bool HaveRanks() const;
+    /** Write rank records, and with fComplete mark them as covering every balance */
+    bool WriteRanks(const std::vector<CVoteRankChange>& vRank, bool fComplete);
+    /** Call func with the balances of at most nMaxBalance, largest first, until it returns false */
+    bool ForEachRank(uint64_t nMaxBalance, std::function<bool(uint64_t, const CMyAddress&)> func);
+};
+
+/**
+ * A height in a DPoS history key, written inverted and big-endian so the
+ * records of a key sort newest first and a seek to a height finds the record
+ * in effect at that height.
+ */
+struct CDPoSHistoryHeight
+{
+    uint32_t nHeight;
+
+    explicit CDPoSHistoryHeight(uint32_t nHeightIn = 0) : nHeight(nHeightIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, ~nHeight);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        nHeight = ~ser_readdata32be(s);
+    }
+};
+
+/** What a block changed in the DPoS history, kept to erase its records again when it is disconnected */
+struct CDPoSHistoryBlock
+{
+    uint256 hashBlock;
+    std::vector<CMyAddress> vAddress;
+    //! (delegate, voter)
+    std::vector<std::pair<CKeyID, CKeyID> > vVote;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(vAddress);
+        READWRITE(vVote);
+    }
+};
+
+/**
+ * Versioned DPoS state (dpos/history/, -dposhistory). Every block writes the
+ * balances of the addresses it changed and the votes it made or revoked,
+ * keyed by address or by (delegate, voter) and then by its height. The state
+ * at a height is thus read with one seek per key instead of replaying the
+ * blocks after it. The history starts with the whole state at the height it
+ * was enabled at, or at the genesis block.
+ */
+class CDPoSHistoryDB : public CDBWrapper
+{
+public:
+    CDPoSHistoryDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CDPoSHistoryDB(const CDPoSHistoryDB&);
+    void operator=(const CDPoSHistoryDB&);
+public:
+    //! False when the history is empty
+    bool ReadBestBlock(int& nHeight, uint256& hashBlock) const;
+    //! The first height the history answers for
+    bool ReadStartHeight(int& nHeight) const;
+
+    /**
+     * Record the balances (0 once spent) and votes (false once revoked) a
+     * block left, which must come right after the best block, and make it the
+     * best block. An empty history starts at the parent of the block.
+     */
+    bool WriteBlock(int nHeight, const uint256& hashBlock, const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance,
+                    const std::vector<std::pair<std::pair<CKeyID, CKeyID>, bool> >& vVote);
+    //! Erase the records of the best block after it was disconnected, making hashPrev the best block
+    bool RevertBlock(int nHeight, const uint256& hashPrev);
+
+    /** Erase everything, then write part of the state at a height to start the history from */
+    bool Clear();
+    bool WriteStartBalances(int nHeight, const std::vector<std::pair<CMyAddress, uint64_t> >& vBalance);
+    bool WriteStartVoters(int nHeight, const CKeyID& delegate, const std::vector<CKeyID>& vVoter);
+    //! Mark the start state as complete and the block it belongs to as the best block
+    bool WriteStart(int nHeight, const uint256& hashBlock);
+
+    //! The balance of an address as of the block at nHeight, which the caller checks is within the history
+    bool ReadBalance(const CMyAddress& address, int nHeight, uint64_t& nBalance);
+    bool ReadVoters(const CKeyID& delegate, int nHeight, std::vector<CKeyID>& vVoter);
+    //! The addresses and votes the block at nHeight changed; their new values are read at nHeight
+    bool ReadBlock(int nHeight, CDPoSHistoryBlock& block) const;
+    //! Whether voter votes for delegate as of the block at nHeight
+    bool ReadVote(const CKeyID& delegate, const CKeyID& voter, int nHeight, bool& fVoted);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -11,12 +11,14 @@
 #include "validation.h"
 #include "policy/policy.h"
 #include "policy/fees.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utiltime.h"
 #include "version.h"
+#include "vote.h"
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
@@ -24,9 +26,14 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
     tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
     inChainInputValue(_inChainInputValue),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp),
+    fScriptsVerified(false), nScriptVerifyFlags(0), nDPoSOpcode(0)
 {
     nTxWeight = GetTransactionWeight(*tx);
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    if (tx->GetDPoSPayload(pbegin, pend) && pbegin != pend && GetDPoSOpMinFee(*pbegin) > 0)
+        nDPoSOpcode = *pbegin;
     nModSize = tx->CalculateModifiedSize(GetTxSize());
     nUsageSize = RecursiveDynamicUsage(*tx) + memusage::DynamicUsage(tx);
 
@@ -37,6 +44,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     assert(inChainInputValue <= nValueIn);
 
     feeDelta = 0;
+    miningPriority = GetPriority(entryHeight + 1);
 
     nCountWithAncestors = 1;
     nSizeWithAncestors = GetTxSize();
@@ -49,6 +57,15 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
     *this = other;
 }
 
+void CTxMemPoolEntry::SetScriptsVerified(const std::shared_ptr<PrecomputedTransactionData>& txdataIn, bool fVerified, unsigned int flags)
+{
+    if (!txdata)
+        nUsageSize += memusage::DynamicUsage(txdataIn) + (txdataIn ? RecursiveDynamicUsage(*txdataIn) : 0);
+    txdata = txdataIn;
+    fScriptsVerified = fVerified;
+    nScriptVerifyFlags = flags;
+}
+
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
@@ -81,14 +98,14 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    const setLinkEntries &setUpdateChildren = GetMemPoolChildren(updateIt);
+    setEntries stageEntries(setUpdateChildren.begin(), setUpdateChildren.end()), setAllDescendants;
 
     while (!stageEntries.empty()) {
         const txiter cit = *stageEntries.begin();
         setAllDescendants.insert(cit);
         stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
+        const setLinkEntries &setChildren = GetMemPoolChildren(cit);
         BOOST_FOREACH(const txiter childEntry, setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
@@ -116,6 +133,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             cachedDescendants[updateIt].insert(cit);
             // Update ancestor state for each descendant
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
+            UpdateAncestor(cit, updateIt, true);
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
@@ -173,61 +191,53 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 {
     LOCK(cs);
 
-    setEntries parentHashes;
-    const CTransaction &tx = entry.GetTx();
-
     if (fSearchForParents) {
-        // Get parents of this transaction that are in the mempool
-        // GetMemPoolParents() is only valid for entries in the mempool, so we
-        // iterate mapTx to find parents.
+        // Get parents of this transaction that are in the mempool, and add
+        // their ancestors as kept in mapLinks, as an entry's own are only
+        // valid once it is in the mempool.
+        const CTransaction &tx = entry.GetTx();
+        setEntries setParents;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
-                    errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
-                    return false;
-                }
+            if (piter == mapTx.end() || !setParents.insert(piter).second)
+                continue;
+            if (setParents.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                return false;
+            }
+            const setLinkEntries &setParentAncestors = GetMemPoolAncestors(piter);
+            setAncestors.insert(piter);
+            setAncestors.insert(setParentAncestors.begin(), setParentAncestors.end());
+            if (setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
             }
         }
     } else {
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
-        txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        const setLinkEntries &setEntryAncestors = GetMemPoolAncestors(mapTx.iterator_to(entry));
+        setAncestors.insert(setEntryAncestors.begin(), setEntryAncestors.end());
+        if (setAncestors.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+            return false;
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
-
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
-
-        setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
-        totalSizeWithAncestors += stageit->GetTxSize();
-
-        if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
-            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantSize);
-            return false;
-        } else if (stageit->GetCountWithDescendants() + 1 > limitDescendantCount) {
-            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantCount);
+    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+        totalSizeWithAncestors += ancestorIt->GetTxSize();
+        if (ancestorIt->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", ancestorIt->GetTx().GetHash().ToString(), limitDescendantSize);
             return false;
-        } else if (totalSizeWithAncestors > limitAncestorSize) {
-            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+        } else if (ancestorIt->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", ancestorIt->GetTx().GetHash().ToString(), limitDescendantCount);
             return false;
         }
-
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
-            // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
-            }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
-                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
-                return false;
-            }
-        }
+    }
+    if (totalSizeWithAncestors > limitAncestorSize) {
+        errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+        return false;
     }
 
     return true;
@@ -235,7 +245,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const setLinkEntries &setParents = GetMemPoolParents(it);
+    setEntries parentIters(setParents.begin(), setParents.end());
     // add or remove this tx as a child of each parent
     BOOST_FOREACH(txiter piter, parentIters) {
         UpdateChild(piter, it, add);
@@ -264,7 +275,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const setLinkEntries &setMemPoolChildren = GetMemPoolChildren(it);
     BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
@@ -291,6 +302,7 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
             int modifySigOps = -removeIt->GetSigOpCost();
             BOOST_FOREACH(txiter dit, setDescendants) {
                 mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                UpdateAncestor(dit, removeIt, false);
             }
         }
     }
@@ -349,7 +361,10 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nSequence(0), nChangesBegin(0), nPriorityHeight(0),
+    nodeResource(CTxMemPoolNodeResource::DEFAULT_CHUNK_SIZE_BYTES, &MempoolArena()),
+    mapTx(indexed_transaction_set::ctor_args_list(), &nodeResource),
+    mapLinks(CompareIteratorByHash(), &nodeResource)
 {
     _clear(); //lock free clear
 
@@ -366,17 +381,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    auto it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first->hash == hashTx) {
-        coins.Spend(it->first->n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -385,12 +393,63 @@ unsigned int CTxMemPool::GetTransactionsUpdated() const
     return nTransactionsUpdated;
 }
 
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs);
+    return nSequence;
+}
+
+bool CTxMemPool::GetChangesSince(uint64_t nSince, std::vector<CTxMemPoolChange>& vChanges, uint64_t& nSequenceOut) const
+{
+    LOCK(cs);
+    nSequenceOut = nSequence;
+    if (nSince < nChangesBegin || nSince > nSequence)
+        return false;
+    // The changes have consecutive sequences, the first one kept being nChangesBegin + 1
+    std::deque<CTxMemPoolChange>::const_iterator it = dequeChanges.begin() + (nSince - nChangesBegin);
+    vChanges.assign(it, dequeChanges.end());
+    return true;
+}
+
 void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 {
     LOCK(cs);
     nTransactionsUpdated += n;
 }
 
+/** Parse the forger operation of a transaction, when it pays the fee DoVoting requires */
+static bool ParsePendingDPoSOp(const CTxMemPoolEntry& entry, CPendingDPoSOp& op)
+{
+    const CTransaction& tx = entry.GetTx();
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    if (!tx.GetDPoSPayload(pbegin, pend) || pbegin == pend)
+        return false;
+
+    op.opcode = *pbegin;
+    op.address = entry.GetDPoSSender();
+    op.nTime = entry.GetTime();
+    switch (op.opcode) {
+        case OP_REGISTE: {
+            CRegisterForgerData data;
+            if (entry.GetFee() < OP_REGISTER_FORGER_FEE || !DataToStruct(data, CScript(pbegin, pend)))
+                return false;
+            op.name = data.name;
+            return true;
+        }
+        case OP_VOTE:
+        case OP_REVOKE: {
+            CDPoSKeys delegates;
+            if (entry.GetFee() < OP_VOTE_FORGER_FEE || !ParseDPoSKeys(delegates, pbegin, pend))
+                return false;
+            op.delegates.insert(delegates.begin(), delegates.end());
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate)
 {
     NotifyEntryAdded(entry.GetSharedTx());
@@ -399,17 +458,22 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    txlinksMap::iterator itLinks = mapLinks.insert(std::make_pair(newit, TxLinks(&nodeResource))).first;
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
     // into mapTx.
     std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    double dPriority = newit->GetPriority(nPriorityHeight ? nPriorityHeight : newit->GetHeight() + 1);
     if (pos != mapDeltas.end()) {
         const std::pair<double, CAmount> &deltas = pos->second;
         if (deltas.second) {
             mapTx.modify(newit, update_fee_delta(deltas.second));
         }
+        dPriority += deltas.first;
+    }
+    if (dPriority != newit->GetMiningPriority()) {
+        mapTx.modify(newit, update_mining_priority(dPriority));
     }
 
     // Update cachedInnerUsage to include contained transaction's usage.
@@ -439,14 +503,25 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     }
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
+    itLinks->second.ancestors.insert(setAncestors.begin(), setAncestors.end());
+    cachedInnerUsage += memusage::DynamicUsage(itLinks->second.ancestors);
 
     nTransactionsUpdated++;
+    RecordChange(hash, true);
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, validFeeEstimate);
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
 
+    CPendingDPoSOp op;
+    if (ParsePendingDPoSOp(entry, op))
+        mapPendingDPoS.insert(std::make_pair(hash, op));
+    if (newit->IsDPoSOp()) {
+        setDPoSOps.insert(newit);
+        totalDPoSTxSize += newit->GetTxSize();
+    }
+
     return true;
 }
 
@@ -466,15 +541,32 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     } else
         vTxHashes.clear();
 
+    mapPendingDPoS.erase(hash);
+    if (it->IsDPoSOp()) {
+        setDPoSOps.erase(it);
+        totalDPoSTxSize -= it->GetTxSize();
+    }
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    txlinksMap::iterator itLinks = mapLinks.find(it);
+    cachedInnerUsage -= memusage::DynamicUsage(itLinks->second.parents) + memusage::DynamicUsage(itLinks->second.children) + memusage::DynamicUsage(itLinks->second.ancestors);
+    mapLinks.erase(itLinks);
     mapTx.erase(it);
     nTransactionsUpdated++;
+    RecordChange(hash, false);
     minerPolicyEstimator->removeTx(hash);
 }
 
+void CTxMemPool::RecordChange(const uint256& txid, bool fAdded)
+{
+    nSequence++;
+    if (dequeChanges.size() >= MAX_MEMPOOL_CHANGES) {
+        nChangesBegin = dequeChanges.front().nSequence;
+        dequeChanges.pop_front();
+    }
+    dequeChanges.push_back(CTxMemPoolChange{nSequence, txid, fAdded});
+}
+
 // Calculates descendants of entry that are not already in setDescendants, and adds to
 // setDescendants. Assumes entryit is already a tx in the mempool and setMemPoolChildren
 // is correct for tx and all descendants.
@@ -495,7 +587,7 @@ void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants
         setDescendants.insert(it);
         stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const setLinkEntries &setChildren = GetMemPoolChildren(it);
         BOOST_FOREACH(const txiter &childiter, setChildren) {
             if (!setDescendants.count(childiter)) {
                 stage.insert(childiter);
@@ -554,9 +646,9 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-                if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+                if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
                     txToRemove.insert(it);
                     break;
                 }
@@ -618,6 +710,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
         removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
     }
+    // Age the priority index ahead of the next block, once it is in use
+    if (nPriorityHeight)
+        UpdateMiningPriorities(nBlockHeight + 1);
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
@@ -627,12 +722,19 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapPendingDPoS.clear();
+    setDPoSOps.clear();
     totalTxSize = 0;
+    totalDPoSTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    // The removed entries are not kept as changes, a mirror reads the pool again
+    nSequence++;
+    nChangesBegin = nSequence;
+    dequeChanges.clear();
 }
 
 void CTxMemPool::clear()
@@ -641,6 +743,20 @@ void CTxMemPool::clear()
     _clear();
 }
 
+std::vector<CPendingDPoSOp> CTxMemPool::GetPendingDPoSOps() const
+{
+    std::vector<CPendingDPoSOp> vOps;
+    {
+        LOCK(cs);
+        vOps.reserve(mapPendingDPoS.size());
+        for (const auto& it : mapPendingDPoS)
+            vOps.push_back(it.second);
+    }
+
+    std::stable_sort(vOps.begin(), vOps.end(), [](const CPendingDPoSOp& a, const CPendingDPoSOp& b) { return a.nTime < b.nTime; });
+    return vOps;
+}
+
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 {
     if (nCheckFrequency == 0)
@@ -652,6 +768,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t checkDPoSTotal = 0;
     uint64_t innerUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
@@ -662,12 +779,16 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->GetTxSize();
+        if (it->IsDPoSOp()) {
+            assert(setDPoSOps.count(mapTx.project<0>(it)));
+            checkDPoSTotal += it->GetTxSize();
+        }
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
         txlinksMap::const_iterator linksiter = mapLinks.find(it);
         assert(linksiter != mapLinks.end());
         const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children) + memusage::DynamicUsage(links.ancestors);
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -684,8 +805,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                     parentSigOpCost += it2->GetSigOpCost();
                 }
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
             auto it3 = mapNextTx.find(txin.prevout);
@@ -694,12 +814,17 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
-        // Verify ancestor state is correct.
-        setEntries setAncestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        assert(setParentCheck == setEntries(GetMemPoolParents(it).begin(), GetMemPoolParents(it).end()));
+        // Verify ancestor state is correct, walking the parents rather than
+        // trusting the ancestors kept in mapLinks.
+        setEntries setAncestors, setAncestorsToWalk(setParentCheck);
+        while (!setAncestorsToWalk.empty()) {
+            txiter ancestorIt = *setAncestorsToWalk.begin();
+            setAncestorsToWalk.erase(setAncestorsToWalk.begin());
+            if (setAncestors.insert(ancestorIt).second)
+                setAncestorsToWalk.insert(GetMemPoolParents(ancestorIt).begin(), GetMemPoolParents(ancestorIt).end());
+        }
+        assert(setAncestors == setEntries(links.ancestors.begin(), links.ancestors.end()));
         uint64_t nCountCheck = setAncestors.size() + 1;
         uint64_t nSizeCheck = it->GetTxSize();
         CAmount nFeesCheck = it->GetModifiedFee();
@@ -727,7 +852,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck == setEntries(GetMemPoolChildren(it).begin(), GetMemPoolChildren(it).end()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -768,6 +893,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     }
 
     assert(totalTxSize == checkTotal);
+    assert(totalDPoSTxSize == checkDPoSTotal);
     assert(innerUsage == cachedInnerUsage);
 }
 
@@ -856,6 +982,16 @@ CTransactionRef CTxMemPool::get(const uint256& hash) const
     return i->GetSharedTx();
 }
 
+bool CTxMemPool::GetScriptsVerified(const CTransaction& tx, unsigned int flags, std::shared_ptr<PrecomputedTransactionData>& txdata) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(tx.GetHash());
+    if (i == mapTx.end() || i->GetTx().GetWitnessHash() != tx.GetWitnessHash())
+        return false;
+    txdata = i->GetTxData();
+    return txdata && i->IsScriptsVerified(flags);
+}
+
 TxMempoolInfo CTxMemPool::info(const uint256& hash) const
 {
     LOCK(cs);
@@ -865,6 +1001,42 @@ TxMempoolInfo CTxMemPool::info(const uint256& hash) const
     return GetInfo(i);
 }
 
+CTxMemPoolEntryInfo CTxMemPool::GetEntryInfo(txiter it, unsigned int nCurrentHeight) const
+{
+    AssertLockHeld(cs);
+    CTxMemPoolEntryInfo info;
+    info.txid = it->GetTx().GetHash();
+    info.nTxSize = it->GetTxSize();
+    info.nFee = it->GetFee();
+    info.nModifiedFee = it->GetModifiedFee();
+    info.nTime = it->GetTime();
+    info.nHeight = it->GetHeight();
+    info.dStartingPriority = it->GetPriority(it->GetHeight());
+    info.dCurrentPriority = it->GetPriority(nCurrentHeight);
+    info.nCountWithDescendants = it->GetCountWithDescendants();
+    info.nSizeWithDescendants = it->GetSizeWithDescendants();
+    info.nModFeesWithDescendants = it->GetModFeesWithDescendants();
+    info.nCountWithAncestors = it->GetCountWithAncestors();
+    info.nSizeWithAncestors = it->GetSizeWithAncestors();
+    info.nModFeesWithAncestors = it->GetModFeesWithAncestors();
+    const setLinkEntries& parents = GetMemPoolParents(it);
+    info.vDepends.reserve(parents.size());
+    for (txiter parent : parents)
+        info.vDepends.push_back(parent->GetTx().GetHash());
+    return info;
+}
+
+std::vector<CTxMemPoolEntryInfo> CTxMemPool::SnapshotEntries(unsigned int nCurrentHeight, uint64_t& nSequenceOut) const
+{
+    LOCK(cs);
+    std::vector<CTxMemPoolEntryInfo> vInfo;
+    vInfo.reserve(mapTx.size());
+    for (txiter it = mapTx.begin(); it != mapTx.end(); ++it)
+        vInfo.push_back(GetEntryInfo(it, nCurrentHeight));
+    nSequenceOut = nSequence;
+    return vInfo;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -930,6 +1102,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
+            mapTx.modify(it, update_mining_priority(it->GetMiningPriority() + dPriorityDelta));
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -968,6 +1141,22 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
     mapDeltas.erase(hash);
 }
 
+void CTxMemPool::UpdateMiningPriorities(unsigned int nHeight)
+{
+    LOCK(cs);
+    if (nPriorityHeight == nHeight)
+        return;
+
+    nPriorityHeight = nHeight;
+    for (txiter it = mapTx.begin(); it != mapTx.end(); ++it) {
+        double dPriority = it->GetPriority(nHeight);
+        CAmount dummy;
+        ApplyDeltas(it->GetTx().GetHash(), dPriority, dummy);
+        if (dPriority != it->GetMiningPriority())
+            mapTx.modify(it, update_mining_priority(dPriority));
+    }
+}
+
 bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
 {
     for (unsigned int i = 0; i < tx.vin.size(); i++)
@@ -978,26 +1167,30 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    CTransactionRef ptx = mempool.get(txid);
+    CTransactionRef ptx = mempool.get(outpoint.hash);
     if (ptx) {
-        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
-        return true;
+        if (outpoint.n < ptx->vout.size()) {
+            coin = Coin(ptx->vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    return mempool.exists(outpoint) || base->HaveCoin(outpoint);
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 18 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(mapPendingDPoS) + memusage::DynamicUsage(setDPoSOps) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -1036,25 +1229,35 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
+    setLinkEntries& s = mapLinks.find(entry)->second.children;
+    if (add && s.insert(child).second) {
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+    } else if (!add && s.erase(child)) {
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    }
+}
+
+void CTxMemPool::UpdateAncestor(txiter entry, txiter ancestor, bool add)
+{
+    setLinkEntries& s = mapLinks.find(entry)->second.ancestors;
+    if (add && s.insert(ancestor).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
+    } else if (!add && s.erase(ancestor)) {
         cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
     }
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
+    setLinkEntries& s = mapLinks.find(entry)->second.parents;
+    if (add && s.insert(parent).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
+    } else if (!add && s.erase(parent)) {
         cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
     }
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::setLinkEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1062,7 +1265,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
     return it->second.parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::setLinkEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1070,6 +1273,14 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) cons
     return it->second.children;
 }
 
+const CTxMemPool::setLinkEntries & CTxMemPool::GetMemPoolAncestors(txiter entry) const
+{
+    assert (entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.ancestors;
+}
+
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     LOCK(cs);
     if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
@@ -1102,13 +1313,49 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
+unsigned int CTxMemPool::removeForSizeLimit(txiter entry, std::vector<COutPoint>* pvNoSpendsRemaining) {
+    setEntries stage;
+    CalculateDescendants(entry, stage);
+    unsigned int nRemoved = stage.size();
+
+    std::vector<CTransaction> txn;
+    if (pvNoSpendsRemaining) {
+        txn.reserve(stage.size());
+        BOOST_FOREACH(txiter iter, stage)
+            txn.push_back(iter->GetTx());
+    }
+    RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
+    if (pvNoSpendsRemaining) {
+        BOOST_FOREACH(const CTransaction& tx, txn) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (exists(txin.prevout.hash)) continue;
+                pvNoSpendsRemaining->push_back(txin.prevout);
+            }
+        }
+    }
+    return nRemoved;
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining, size_t dposSizeLimit) {
     LOCK(cs);
 
+    // DPoS operations pay fixed fees, so a burst of them is trimmed in their
+    // own order, without raising the minimum fee of other transactions.
+    unsigned nDPoSRemoved = 0;
+    while (!setDPoSOps.empty() && totalDPoSTxSize > dposSizeLimit)
+        nDPoSRemoved += removeForSizeLimit(*setDPoSOps.begin(), pvNoSpendsRemaining);
+    if (nDPoSRemoved > 0)
+        LogPrint("mempool", "Removed %u txn over the DPoS operation limit\n", nDPoSRemoved);
+
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
         indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        // Skip the DPoS operations, unless nothing else is left
+        while (it != mapTx.get<descendant_score>().end() && it->IsDPoSOp())
+            ++it;
+        if (it == mapTx.get<descendant_score>().end())
+            it = mapTx.get<descendant_score>().begin();
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
@@ -1119,28 +1366,7 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
-        nTxnRemoved += stage.size();
-
-        std::vector<CTransaction> txn;
-        if (pvNoSpendsRemaining) {
-            txn.reserve(stage.size());
-            BOOST_FOREACH(txiter iter, stage)
-                txn.push_back(iter->GetTx());
-        }
-        RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
-        if (pvNoSpendsRemaining) {
-            BOOST_FOREACH(const CTransaction& tx, txn) {
-                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                    if (exists(txin.prevout.hash))
-                        continue;
-                    auto iter = mapNextTx.lower_bound(COutPoint(txin.prevout.hash, 0));
-                    if (iter == mapNextTx.end() || iter->first->hash != txin.prevout.hash)
-                        pvNoSpendsRemaining->push_back(txin.prevout.hash);
-                }
-            }
-        }
+        nTxnRemoved += removeForSizeLimit(mapTx.project<0>(it), pvNoSpendsRemaining);
     }
 
     if (maxFeeRateRemoved > CFeeRate(0))
@@ -1153,3 +1379,5 @@ bool CTxMemPool::TransactionWithinChainLimit(const uint256& txid, size_t chainLi
     return it == mapTx.end() || (it->GetCountWithAncestors() < chainLimit &&
        it->GetCountWithDescendants() < chainLimit);
 }
+
+SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
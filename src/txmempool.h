@@ -6,6 +6,8 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
+#include <limits>
 #include <memory>
 #include <set>
 #include <map>
@@ -19,6 +21,7 @@
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
+#include "support/allocators/pool.h"
 
 #undef foreach
 #include "boost/multi_index_container.hpp"
@@ -42,7 +45,7 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 struct LockPoints
@@ -61,6 +64,7 @@ struct LockPoints
 };
 
 class CTxMemPool;
+struct PrecomputedTransactionData;
 
 /** \class CTxMemPoolEntry
  *
@@ -94,7 +98,13 @@ private:
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
+    double miningPriority;     //!< Priority at the height of the mempool's priority index, including its delta
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    std::shared_ptr<PrecomputedTransactionData> txdata; //!< Signature hash data computed when the scripts were checked
+    bool fScriptsVerified;     //!< All input scripts passed under nScriptVerifyFlags
+    unsigned int nScriptVerifyFlags;
+    uint8_t nDPoSOpcode;       //!< DPoS operation carried by the transaction, 0 if none
+    CKeyID dposSender;         //!< Key the inputs of the DPoS operation spend from, null if they are not pay-to-pubkey-hash
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -133,8 +143,14 @@ public:
     unsigned int GetHeight() const { return entryHeight; }
     int64_t GetSigOpCost() const { return sigOpCost; }
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
+    double GetMiningPriority() const { return miningPriority; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
+    uint8_t GetDPoSOpcode() const { return nDPoSOpcode; }
+    bool IsDPoSOp() const { return nDPoSOpcode != 0; }
+    const CKeyID& GetDPoSSender() const { return dposSender; }
+    // Set the sender of the DPoS operation, resolved from the spent coins before the entry is added
+    void SetDPoSSender(const CKeyID& sender) { dposSender = sender; }
 
     // Adjusts the descendant state, if this entry is not dirty.
     void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
@@ -145,6 +161,13 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Updates the priority the entry is sorted by in the priority index
+    void UpdateMiningPriority(double newMiningPriority) { miningPriority = newMiningPriority; }
+    // Keep the signature hash data and, if fVerified, the block script flags the inputs passed under
+    void SetScriptsVerified(const std::shared_ptr<PrecomputedTransactionData>& txdataIn, bool fVerified, unsigned int flags);
+
+    const std::shared_ptr<PrecomputedTransactionData>& GetTxData() const { return txdata; }
+    bool IsScriptsVerified(unsigned int flags) const { return fScriptsVerified && nScriptVerifyFlags == flags; }
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -202,6 +225,16 @@ private:
     int64_t feeDelta;
 };
 
+struct update_mining_priority
+{
+    update_mining_priority(double _miningPriority) : miningPriority(_miningPriority) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateMiningPriority(miningPriority); }
+
+private:
+    double miningPriority;
+};
+
 struct update_lock_points
 {
     update_lock_points(const LockPoints& _lp) : lp(_lp) { }
@@ -309,14 +342,44 @@ public:
     }
 };
 
+/** \class CompareTxMemPoolEntryByMiningPriority
+ *
+ *  Sort by coin age priority including its delta, in descending order
+ */
+class CompareTxMemPoolEntryByMiningPriority
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    {
+        if (a.GetMiningPriority() == b.GetMiningPriority()) {
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return a.GetMiningPriority() > b.GetMiningPriority();
+    }
+};
+
 // Multi_index tag names
 struct descendant_score {};
 struct entry_time {};
 struct mining_score {};
 struct ancestor_score {};
+struct mining_priority {};
 
 class CBlockPolicyEstimator;
 
+/**
+ * Delegate register, vote or revoke carried by a mempool transaction, parsed
+ * once when the transaction is accepted.
+ */
+struct CPendingDPoSOp
+{
+    uint8_t opcode; // OP_REGISTE, OP_VOTE or OP_REVOKE
+    CKeyID address;
+    std::string name; // OP_REGISTE only
+    std::set<CKeyID> delegates; // OP_VOTE and OP_REVOKE only
+    int64_t nTime; // Time the transaction entered the mempool
+};
+
 /**
  * Information about a mempool transaction.
  */
@@ -335,6 +398,41 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * The fields of a mempool entry that getrawmempool and the REST mempool
+ * report, copied out under the pool lock so they are formatted without it.
+ */
+struct CTxMemPoolEntryInfo
+{
+    uint256 txid;
+    size_t nTxSize;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    double dStartingPriority;
+    double dCurrentPriority;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    /** The in-mempool transactions it spends */
+    std::vector<uint256> vDepends;
+};
+
+/** A transaction entering or leaving the mempool, see CTxMemPool::GetChangesSince */
+struct CTxMemPoolChange
+{
+    uint64_t nSequence;
+    uint256 txid;
+    bool fAdded;
+};
+
+/** Changes to the mempool kept for GetChangesSince, past which the oldest are dropped */
+static const size_t MAX_MEMPOOL_CHANGES = 200000;
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -348,6 +446,27 @@ enum class MemPoolRemovalReason {
     REPLACED     //! Removed for replacement
 };
 
+class SaltedTxidHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedTxidHasher();
+
+    size_t operator()(const uint256& txid) const {
+        return SipHashUint256(k0, k1, txid);
+    }
+};
+
+/**
+ * Nodes of the mempool containers up to this size are recycled by its node
+ * pool; an entry with its six index nodes stays below it.
+ */
+static const size_t MEMPOOL_NODE_MAX_BYTES = 512;
+typedef PoolResource<MEMPOOL_NODE_MAX_BYTES, alignof(void*)> CTxMemPoolNodeResource;
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain transactions
  * that may be included in the next block.
@@ -376,7 +495,10 @@ enum class MemPoolRemovalReason {
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
  * the set of in-mempool direct parents and direct children in mapLinks.  Within
- * each CTxMemPoolEntry, we track the size and fees of all descendants.
+ * each CTxMemPoolEntry, we track the size and fees of all descendants.  mapLinks
+ * also keeps the set of all in-mempool ancestors of each entry, changed along
+ * with its ancestor state, so the ancestors of a new transaction are those of
+ * its parents rather than found by walking the chain it extends.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
@@ -433,15 +555,25 @@ class CTxMemPool
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation
+    uint64_t nSequence; //!< Bumped by every transaction entering or leaving the pool
+    std::deque<CTxMemPoolChange> dequeChanges; //!< The latest changes, for mirrors of the pool to catch up
+    uint64_t nChangesBegin; //!< Sequence from which dequeChanges has all the changes
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t totalDPoSTxSize;  //!< sum of the virtual sizes of the DPoS operation transactions
+    unsigned int nPriorityHeight; //!< Height the priority index is sorted for, 0 until the priority space is used
 
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    //! Memory of the nodes of mapTx, mapLinks and the link sets, which are
+    //! allocated and freed for every transaction. Declared before them, so it
+    //! outlives them.
+    CTxMemPoolNodeResource nodeResource;
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -476,8 +608,15 @@ public:
                 boost::multi_index::tag<ancestor_score>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by coin age priority (for the priority space of blocks)
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<mining_priority>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByMiningPriority
             >
-        >
+        >,
+        PoolAllocator<CTxMemPoolEntry, MEMPOOL_NODE_MAX_BYTES>
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
@@ -492,28 +631,55 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    //! The in-mempool parents, children or ancestors of an entry, on the node pool
+    typedef std::set<txiter, CompareIteratorByHash, PoolAllocator<txiter, MEMPOOL_NODE_MAX_BYTES> > setLinkEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const setLinkEntries & GetMemPoolParents(txiter entry) const;
+    const setLinkEntries & GetMemPoolChildren(txiter entry) const;
+    //! The entries the ancestor state of entry counts
+    const setLinkEntries & GetMemPoolAncestors(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
+    /** Order DPoS operations are evicted in: lowest feerate first, and of those the newest */
+    struct CompareDPoSOpEviction {
+        bool operator()(const txiter &a, const txiter &b) const {
+            double f1 = (double)a->GetFee() * b->GetTxSize();
+            double f2 = (double)b->GetFee() * a->GetTxSize();
+            if (f1 != f2)
+                return f1 < f2;
+            if (a->GetTime() != b->GetTime())
+                return a->GetTime() > b->GetTime();
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    //! The DPoS operation transactions, which have their own size limit
+    std::set<txiter, CompareDPoSOpEviction> setDPoSOps;
+
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        explicit TxLinks(CTxMemPoolNodeResource* resource) :
+            parents(CompareIteratorByHash(), resource), children(CompareIteratorByHash(), resource),
+            ancestors(CompareIteratorByHash(), resource) {}
+
+        setLinkEntries parents;
+        setLinkEntries children;
+        setLinkEntries ancestors;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash,
+                     PoolAllocator<std::pair<const txiter, TxLinks>, MEMPOOL_NODE_MAX_BYTES> > txlinksMap;
     txlinksMap mapLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
+    void UpdateAncestor(txiter entry, txiter ancestor, bool add);
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::map<uint256, CPendingDPoSOp> mapPendingDPoS;
 
     /** Create a new CTxMemPool.
      */
@@ -543,9 +709,11 @@ public:
 
     void clear();
     void _clear(); //lock free
+    /** DPoS forger operations of the mempool transactions, in the order they were accepted */
+    std::vector<CPendingDPoSOp> GetPendingDPoSOps() const;
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
     /**
@@ -559,6 +727,14 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta) const;
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * Sort the priority index by the priority of the entries at nHeight.
+     * After the first call the index is kept at the height of the next block
+     * as blocks are connected, so the priority space of a block is filled
+     * without going through the whole mempool.
+     */
+    void UpdateMiningPriorities(unsigned int nHeight);
+
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
@@ -589,6 +765,8 @@ public:
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
      *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *  The ancestors are those kept in mapLinks for the entry, or else for each of
+     *  its parents, so the chain of ancestors is not walked.
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
@@ -606,10 +784,12 @@ public:
     CFeeRate GetMinFee(size_t sizelimit) const;
 
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
-      *  pvNoSpendsRemaining, if set, will be populated with the list of transactions
+      *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
+      *  DPoS operations are first trimmed to dposSizeLimit of virtual size in their
+      *  own eviction order, and after that only evicted when nothing else is left.
       */
-    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL);
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=NULL, size_t dposSizeLimit=std::numeric_limits<size_t>::max());
 
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
@@ -629,16 +809,53 @@ public:
         return totalTxSize;
     }
 
+    uint64_t GetTotalDPoSTxSize()
+    {
+        LOCK(cs);
+        return totalDPoSTxSize;
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
         return (mapTx.count(hash) != 0);
     }
 
+    bool exists(const COutPoint& outpoint) const
+    {
+        LOCK(cs);
+        auto it = mapTx.find(outpoint.hash);
+        return (it != mapTx.end() && outpoint.n < it->GetTx().vout.size());
+    }
+
     CTransactionRef get(const uint256& hash) const;
+    /**
+     * Look up the precomputed signature hash data of a pool transaction with
+     * the same witness hash as tx. Returns whether its input scripts already
+     * passed under exactly the given flags.
+     */
+    bool GetScriptsVerified(const CTransaction& tx, unsigned int flags, std::shared_ptr<PrecomputedTransactionData>& txdata) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /** The reported fields of an entry, priced at nCurrentHeight. cs must be held. */
+    CTxMemPoolEntryInfo GetEntryInfo(txiter it, unsigned int nCurrentHeight) const;
+    /**
+     * Copy the reported fields of all the entries, with the sequence of the
+     * pool they were taken at. The pool is locked for the copy only, not for
+     * the formatting of the result.
+     */
+    std::vector<CTxMemPoolEntryInfo> SnapshotEntries(unsigned int nCurrentHeight, uint64_t& nSequenceOut) const;
+    /** Sequence of the pool, bumped by every transaction entering or leaving it */
+    uint64_t GetSequence() const;
+    /**
+     * The transactions that entered or left the pool after sequence nSince,
+     * in order, and the sequence they bring the pool to. Returns false when
+     * the changes since nSince are no longer kept, and the pool must be read
+     * again as a whole.
+     */
+    bool GetChangesSince(uint64_t nSince, std::vector<CTxMemPoolChange>& vChanges, uint64_t& nSequenceOut) const;
+
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
      *  at the lowest number of blocks where one can be given
@@ -703,6 +920,10 @@ private:
      *  removal.
      */
     void removeUnchecked(txiter entry, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
+    /** Bump the sequence for txid entering or leaving the pool, and keep the change */
+    void RecordChange(const uint256& txid, bool fAdded);
+    /** Remove a transaction and its descendants for the size limit. Returns the number removed. */
+    unsigned int removeForSizeLimit(txiter entry, std::vector<COutPoint>* pvNoSpendsRemaining);
 };
 
 /** 
@@ -716,8 +937,8 @@ protected:
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
 };
 
 // We want to sort transactions by coin age priority
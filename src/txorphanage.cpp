@@ -0,0 +1,189 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanage.h"
+
+#include "core_memusage.h"
+#include "policy/policy.h"
+#include "util.h"
+
+bool CTxOrphanage::AddTx(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire)
+{
+    const uint256& hash = tx->GetHash();
+
+    // Ignore big transactions, to avoid a
+    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
+    // large transaction with a missing parent then we assume
+    // it will rebroadcast it later, after the parent transaction(s)
+    // have been mined or received.
+    unsigned int sz = GetTransactionWeight(*tx);
+    if (sz >= MAX_STANDARD_TX_WEIGHT)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
+        return false;
+    }
+
+    LOCK(cs);
+    if (mapOrphans.count(hash))
+        return false;
+
+    size_t nBytes = RecursiveDynamicUsage(*tx);
+    auto ret = mapOrphans.emplace(hash, OrphanTx{tx, peer, nTimeExpire, nBytes});
+    assert(ret.second);
+    for (const CTxIn& txin : tx->vin)
+        mapOrphansByPrev[txin.prevout].insert(ret.first);
+    setByExpiry.insert(std::make_pair(nTimeExpire, hash));
+    PeerOrphans& peerOrphans = mapPeers[peer];
+    peerOrphans.setByExpiry.insert(std::make_pair(nTimeExpire, hash));
+    peerOrphans.nBytes += nBytes;
+    nTotalBytes += nBytes;
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u, %u bytes)\n", hash.ToString(),
+             mapOrphans.size(), mapOrphansByPrev.size(), nTotalBytes);
+    return true;
+}
+
+bool CTxOrphanage::HaveTx(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash) != 0;
+}
+
+int CTxOrphanage::EraseTxLocked(uint256 hash)
+{
+    OrphanMap::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return 0;
+    const OrphanTx& orphan = it->second;
+    for (const CTxIn& txin : orphan.tx->vin)
+    {
+        auto itPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(it);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+    setByExpiry.erase(std::make_pair(orphan.nTimeExpire, hash));
+    auto itPeer = mapPeers.find(orphan.fromPeer);
+    assert(itPeer != mapPeers.end());
+    itPeer->second.setByExpiry.erase(std::make_pair(orphan.nTimeExpire, hash));
+    itPeer->second.nBytes -= orphan.nBytes;
+    if (itPeer->second.setByExpiry.empty())
+        mapPeers.erase(itPeer);
+    nTotalBytes -= orphan.nBytes;
+    mapOrphans.erase(it);
+    return 1;
+}
+
+int CTxOrphanage::EraseTx(const uint256& hash)
+{
+    LOCK(cs);
+    return EraseTxLocked(hash);
+}
+
+int CTxOrphanage::EraseForPeer(NodeId peer)
+{
+    LOCK(cs);
+    auto itPeer = mapPeers.find(peer);
+    if (itPeer == mapPeers.end())
+        return 0;
+    // Copied, erasing the last orphan of the peer drops its entry
+    std::set<std::pair<int64_t, uint256>> setPeer(itPeer->second.setByExpiry);
+    int nErased = 0;
+    for (const auto& entry : setPeer)
+        nErased += EraseTxLocked(entry.second);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer=%d\n", nErased, peer);
+    return nErased;
+}
+
+int CTxOrphanage::EraseForBlockTx(const CTransaction& tx)
+{
+    LOCK(cs);
+    std::vector<uint256> vOrphanErase;
+    for (const CTxIn& txin : tx.vin) {
+        auto itByPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itByPrev == mapOrphansByPrev.end())
+            continue;
+        for (const OrphanMap::iterator& mi : itByPrev->second)
+            vOrphanErase.push_back(mi->first);
+    }
+
+    int nErased = 0;
+    for (const uint256& orphanHash : vOrphanErase)
+        nErased += EraseTxLocked(orphanHash);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
+    return nErased;
+}
+
+unsigned int CTxOrphanage::Limit(unsigned int nMaxOrphans, size_t nMaxBytes, int64_t nNow)
+{
+    LOCK(cs);
+    int nErased = 0;
+    while (!setByExpiry.empty() && setByExpiry.begin()->first <= nNow)
+        nErased += EraseTxLocked(setByExpiry.begin()->second);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+
+    unsigned int nEvicted = 0;
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxOrphans || nTotalBytes > nMaxBytes))
+    {
+        // The oldest orphan of the peer holding the most memory, a handful of peers at most hold any
+        auto itHeaviest = mapPeers.begin();
+        for (auto itPeer = mapPeers.begin(); itPeer != mapPeers.end(); ++itPeer) {
+            if (itPeer->second.nBytes > itHeaviest->second.nBytes)
+                itHeaviest = itPeer;
+        }
+        EraseTxLocked(itHeaviest->second.setByExpiry.begin()->second);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+std::vector<std::pair<CTransactionRef, NodeId>> CTxOrphanage::GetChildren(const COutPoint& outpoint) const
+{
+    LOCK(cs);
+    std::vector<std::pair<CTransactionRef, NodeId>> vChildren;
+    auto itByPrev = mapOrphansByPrev.find(outpoint);
+    if (itByPrev == mapOrphansByPrev.end())
+        return vChildren;
+    for (const OrphanMap::iterator& mi : itByPrev->second)
+        vChildren.push_back(std::make_pair(mi->second.tx, mi->second.fromPeer));
+    return vChildren;
+}
+
+size_t CTxOrphanage::Size() const
+{
+    LOCK(cs);
+    return mapOrphans.size();
+}
+
+size_t CTxOrphanage::Bytes() const
+{
+    LOCK(cs);
+    return nTotalBytes;
+}
+
+size_t CTxOrphanage::PeerSize(NodeId peer) const
+{
+    LOCK(cs);
+    auto itPeer = mapPeers.find(peer);
+    return itPeer == mapPeers.end() ? 0 : itPeer->second.setByExpiry.size();
+}
+
+size_t CTxOrphanage::PeerBytes(NodeId peer) const
+{
+    LOCK(cs);
+    auto itPeer = mapPeers.find(peer);
+    return itPeer == mapPeers.end() ? 0 : itPeer->second.nBytes;
+}
+
+void CTxOrphanage::Clear()
+{
+    LOCK(cs);
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    setByExpiry.clear();
+    mapPeers.clear();
+    nTotalBytes = 0;
+}
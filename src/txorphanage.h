@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANAGE_H
+#define BITCOIN_TXORPHANAGE_H
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Transactions received whose inputs are not known yet, kept until their
+ * parents arrive. It has its own lock, so peers add to it and drop from it
+ * without cs_main.
+ *
+ * Orphans expire in the order they came, and past the count or the memory
+ * budget those of the peer holding the most memory go first, oldest first,
+ * so a peer flooding orphans pushes out its own and not those of others.
+ */
+class CTxOrphanage
+{
+public:
+    CTxOrphanage() : nTotalBytes(0) {}
+
+    /** Keep tx from peer until nTimeExpire, false if it is known already or too large */
+    bool AddTx(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire);
+    bool HaveTx(const uint256& hash) const;
+    /** Number of orphans erased, 0 or 1 */
+    int EraseTx(const uint256& hash);
+    int EraseForPeer(NodeId peer);
+    /** Erase the orphans spending any input of tx, which a block included or conflicted */
+    int EraseForBlockTx(const CTransaction& tx);
+
+    /**
+     * Erase the orphans expired at nNow, then evict until at most nMaxOrphans
+     * of at most nMaxBytes are left. Returns the number evicted.
+     */
+    unsigned int Limit(unsigned int nMaxOrphans, size_t nMaxBytes, int64_t nNow);
+
+    /** The orphans spending outpoint, and the peer each came from */
+    std::vector<std::pair<CTransactionRef, NodeId>> GetChildren(const COutPoint& outpoint) const;
+
+    size_t Size() const;
+    /** Memory used by the orphans */
+    size_t Bytes() const;
+    size_t PeerSize(NodeId peer) const;
+    size_t PeerBytes(NodeId peer) const;
+    void Clear();
+
+private:
+    struct OrphanTx {
+        CTransactionRef tx;
+        NodeId fromPeer;
+        int64_t nTimeExpire;
+        size_t nBytes;
+    };
+    typedef std::map<uint256, OrphanTx> OrphanMap;
+
+    struct IteratorComparator
+    {
+        bool operator()(const OrphanMap::iterator& a, const OrphanMap::iterator& b) const
+        {
+            return &(*a) < &(*b);
+        }
+    };
+
+    struct PeerOrphans {
+        size_t nBytes;
+        std::set<std::pair<int64_t, uint256>> setByExpiry;
+
+        PeerOrphans() : nBytes(0) {}
+    };
+
+    /** By value, callers pass hashes held by the indexes it erases from */
+    int EraseTxLocked(uint256 hash);
+
+    mutable CCriticalSection cs;
+    OrphanMap mapOrphans;
+    std::map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>> mapOrphansByPrev;
+    std::set<std::pair<int64_t, uint256>> setByExpiry;
+    std::map<NodeId, PeerOrphans> mapPeers;
+    size_t nTotalBytes;
+};
+
+#endif // BITCOIN_TXORPHANAGE_H
@@ -0,0 +1,115 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txprevalidator.h"
+
+#include "util.h"
+
+#include <algorithm>
+
+CTxPreValidator* ptxprevalidator = NULL;
+
+CTxPreValidator::CTxPreValidator(int nWorkers, const CheckFunc& checkIn, const std::function<void()>& notifyIn) :
+    check(checkIn), notify(notifyIn), fStop(false)
+{
+    for (int i = 0; i < std::max(nWorkers, 1); i++)
+        vThreadWork.push_back(std::thread(&CTxPreValidator::ThreadWork, this));
+}
+
+CTxPreValidator::~CTxPreValidator()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    for (std::thread& thread : vThreadWork)
+        thread.join();
+}
+
+void CTxPreValidator::Submit(NodeId node, const CTransactionRef& tx)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->tx = tx;
+    job->fDone = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queueTodo.push_back(job);
+        mapNodeJobs[node].push_back(job);
+    }
+    cond.notify_one();
+}
+
+bool CTxPreValidator::TakeReady(NodeId node, CTransactionRef& tx, CPendingSignatures& pending)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<NodeId, std::deque<std::shared_ptr<Job> > >::iterator it = mapNodeJobs.find(node);
+    if (it == mapNodeJobs.end() || !it->second.front()->fDone)
+        return false;
+
+    tx = it->second.front()->tx;
+    std::swap(pending, it->second.front()->pending);
+    it->second.pop_front();
+    if (it->second.empty())
+        mapNodeJobs.erase(it);
+    return true;
+}
+
+size_t CTxPreValidator::GetQueued(NodeId node) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<NodeId, std::deque<std::shared_ptr<Job> > >::const_iterator it = mapNodeJobs.find(node);
+    return it == mapNodeJobs.end() ? 0 : it->second.size();
+}
+
+void CTxPreValidator::RemoveNode(NodeId node)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<NodeId, std::deque<std::shared_ptr<Job> > >::iterator it = mapNodeJobs.find(node);
+    if (it == mapNodeJobs.end())
+        return;
+
+    // Jobs a worker has not started yet are dropped, the others just finish
+    for (const std::shared_ptr<Job>& job : it->second) {
+        std::deque<std::shared_ptr<Job> >::iterator itTodo = std::find(queueTodo.begin(), queueTodo.end(), job);
+        if (itTodo != queueTodo.end())
+            queueTodo.erase(itTodo);
+    }
+    mapNodeJobs.erase(it);
+}
+
+void CTxPreValidator::ThreadWork()
+{
+    RenameThread("bitcoin-txcheck");
+
+    while (true) {
+        std::vector<std::shared_ptr<Job> > vJob;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return fStop || !queueTodo.empty(); });
+            if (fStop)
+                return;
+            while (!queueTodo.empty() && vJob.size() < MAX_PREVALIDATION_BATCH) {
+                vJob.push_back(queueTodo.front());
+                queueTodo.pop_front();
+            }
+        }
+
+        std::vector<CTransactionRef> vtx;
+        for (const std::shared_ptr<Job>& job : vJob)
+            vtx.push_back(job->tx);
+        std::vector<CPendingSignatures> vPending;
+        check(vtx, vPending);
+        vPending.resize(vJob.size());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < vJob.size(); i++) {
+                std::swap(vJob[i]->pending, vPending[i]);
+                vJob[i]->fDone = true;
+            }
+        }
+        notify();
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXPREVALIDATOR_H
+#define BITCOIN_TXPREVALIDATOR_H
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "script/sigcache.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Transactions of a peer that may be waiting for their checks before its other messages are handled */
+static const size_t MAX_PREVALIDATION_TXS_PER_PEER = 100;
+/** Transactions a worker checks at once, against one copy of the coins they spend */
+static const size_t MAX_PREVALIDATION_BATCH = 16;
+
+/**
+ * Runs the checks of transactions received from peers that need no lock on
+ * the chain on a few worker threads, ahead of AcceptToMemoryPool. Most of the
+ * cost of accepting a transaction is verifying its signatures, which are
+ * handed back with it and taken as verified by AcceptToMemoryPool, so only the
+ * cheap remainder of the checks, the conflict checks and the insertion into
+ * the mempool are done under cs_main. The transactions of each peer are
+ * handed back in the order they were received, once their checks are done.
+ */
+class CTxPreValidator
+{
+public:
+    typedef std::function<void(const std::vector<CTransactionRef>&, std::vector<CPendingSignatures>&)> CheckFunc;
+
+    /** check is run on a worker for each batch of up to MAX_PREVALIDATION_BATCH transactions, notify after each batch */
+    CTxPreValidator(int nWorkers, const CheckFunc& checkIn, const std::function<void()>& notifyIn);
+    ~CTxPreValidator();
+
+    void Submit(NodeId node, const CTransactionRef& tx);
+
+    /** Take the next transaction of node and the signatures verified for it, false if there is none or its checks are not done yet */
+    bool TakeReady(NodeId node, CTransactionRef& tx, CPendingSignatures& pending);
+
+    /** Number of transactions of node not taken yet */
+    size_t GetQueued(NodeId node) const;
+
+    /** Forget the transactions of a disconnected peer */
+    void RemoveNode(NodeId node);
+
+private:
+    struct Job {
+        CTransactionRef tx;
+        CPendingSignatures pending;
+        bool fDone;
+    };
+
+    void ThreadWork();
+
+    const CheckFunc check;
+    const std::function<void()> notify;
+
+    //! Guards everything below
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    //! Jobs not yet taken by a worker
+    std::deque<std::shared_ptr<Job> > queueTodo;
+    //! Jobs of each peer in the order they were submitted
+    std::map<NodeId, std::deque<std::shared_ptr<Job> > > mapNodeJobs;
+    bool fStop;
+
+    std::vector<std::thread> vThreadWork;
+};
+
+/** The transaction prevalidation of the node, NULL when transactions are checked by the message handler alone */
+extern CTxPreValidator* ptxprevalidator;
+
+#endif // BITCOIN_TXPREVALIDATOR_H
@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <algorithm>
+
+//! Each short id goes to one cell in each of this many parts of the table
+static const size_t SKETCH_HASHES = 3;
+
+void GetReconciliationKeys(uint64_t nSalt1, uint64_t nSalt2, uint64_t& k0, uint64_t& k1)
+{
+    static const std::string strTag = "LBTC tx reconciliation";
+    unsigned char salts[16];
+    WriteLE64(salts, std::min(nSalt1, nSalt2));
+    WriteLE64(salts + 8, std::max(nSalt1, nSalt2));
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)strTag.data(), strTag.size()).Write(salts, sizeof(salts)).Finalize(hash);
+    k0 = ReadLE64(hash);
+    k1 = ReadLE64(hash + 8);
+}
+
+uint32_t GetReconciliationShortId(uint64_t k0, uint64_t k1, const uint256& txid)
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+//! Short ids are already uniform, so a cheap mix tells the cells and the check apart
+static inline uint32_t MixShortId(uint32_t nShortId, uint32_t nSeed)
+{
+    uint32_t h = nShortId ^ (nSeed * 0x9e3779b9U);
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+void CReconSketch::Toggle(uint32_t nShortId, int nCount)
+{
+    size_t nPart = vCells.size() / SKETCH_HASHES;
+    uint32_t nCheck = MixShortId(nShortId, 0);
+    for (size_t i = 0; i < SKETCH_HASHES; i++) {
+        // Parts are of equal size, except the last one taking what is left
+        size_t nPartSize = i + 1 < SKETCH_HASHES ? nPart : vCells.size() - nPart * i;
+        Cell& cell = vCells[nPart * i + MixShortId(nShortId, i + 1) % nPartSize];
+        cell.nCount += nCount;
+        cell.nIdSum ^= nShortId;
+        cell.nCheckSum ^= nCheck;
+    }
+}
+
+void CReconSketch::Add(uint32_t nShortId)
+{
+    if (vCells.size() >= SKETCH_HASHES)
+        Toggle(nShortId, 1);
+}
+
+bool CReconSketch::Subtract(const CReconSketch& other)
+{
+    if (other.vCells.size() != vCells.size())
+        return false;
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nIdSum ^= other.vCells[i].nIdSum;
+        vCells[i].nCheckSum ^= other.vCells[i].nCheckSum;
+    }
+    return true;
+}
+
+bool CReconSketch::Decode(std::vector<uint32_t>& vOnlyOurs, std::vector<uint32_t>& vOnlyTheirs) const
+{
+    vOnlyOurs.clear();
+    vOnlyTheirs.clear();
+    if (vCells.size() < SKETCH_HASHES)
+        return false;
+
+    // Peel the cells holding a single id until none is left
+    CReconSketch sketch(*this);
+    bool fProgress = true;
+    while (fProgress) {
+        fProgress = false;
+        for (const Cell& cell : sketch.vCells) {
+            if ((cell.nCount != 1 && cell.nCount != -1) || cell.nCheckSum != MixShortId(cell.nIdSum, 0))
+                continue;
+            uint32_t nShortId = cell.nIdSum;
+            int nCount = cell.nCount;
+            (nCount == 1 ? vOnlyOurs : vOnlyTheirs).push_back(nShortId);
+            sketch.Toggle(nShortId, -nCount);
+            fProgress = true;
+        }
+    }
+
+    for (const Cell& cell : sketch.vCells) {
+        if (cell.nCount != 0 || cell.nIdSum != 0 || cell.nCheckSum != 0)
+            return false;
+    }
+    return true;
+}
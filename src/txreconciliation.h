@@ -0,0 +1,92 @@
+// Copyright (c) 2018 The LBTC developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+/** -txreconciliation default */
+static const bool DEFAULT_TX_RECONCILIATION = false;
+/** Version of set reconciliation announced in sendrecon */
+static const uint32_t TX_RECONCILIATION_VERSION = 1;
+/** Most transactions waiting to be reconciled with a peer, the others are announced by inv */
+static const size_t MAX_RECON_SET_SIZE = 4000;
+/** Cells of a sketch, which decodes a difference of up to about 80% of as many transactions */
+static const size_t MIN_RECON_SKETCH_CELLS = 32;
+static const size_t MAX_RECON_SKETCH_CELLS = 4096;
+/** Average seconds between the sketches an outbound peer is sent */
+static const unsigned int RECON_REQUEST_INTERVAL = 2;
+/** Seconds after which transactions sent in an unanswered sketch are announced by inv */
+static const unsigned int RECON_RESPONSE_TIMEOUT = 30;
+
+/**
+ * Keys of the short transaction ids reconciled with one peer, from the
+ * salts both sent in sendrecon, in either order.
+ */
+void GetReconciliationKeys(uint64_t nSalt1, uint64_t nSalt2, uint64_t& k0, uint64_t& k1);
+
+/** 32-bit short id of a transaction for reconciliation */
+uint32_t GetReconciliationShortId(uint64_t k0, uint64_t k1, const uint256& txid);
+
+/**
+ * Sketch of a set of short transaction ids, an invertible Bloom lookup
+ * table. A peer that subtracts its own sketch of the same size from the
+ * one it is sent is left with a sketch of the difference of both sets,
+ * which decodes unless the difference is too large for the cells.
+ */
+class CReconSketch
+{
+public:
+    CReconSketch() {}
+    explicit CReconSketch(size_t nCells) : vCells(nCells) {}
+
+    size_t GetCells() const { return vCells.size(); }
+
+    void Add(uint32_t nShortId);
+
+    /** Leave the difference of this set and of other, a sketch of the same size */
+    bool Subtract(const CReconSketch& other);
+
+    /**
+     * Find the short ids only in this sketch's set, and those only in the
+     * set of the sketch subtracted from it. False if they cannot be told.
+     */
+    bool Decode(std::vector<uint32_t>& vOnlyOurs, std::vector<uint32_t>& vOnlyTheirs) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vCells);
+    }
+
+private:
+    struct Cell {
+        int16_t nCount;
+        uint32_t nIdSum;
+        uint32_t nCheckSum;
+
+        Cell() : nCount(0), nIdSum(0), nCheckSum(0) {}
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(nCount);
+            READWRITE(nIdSum);
+            READWRITE(nCheckSum);
+        }
+    };
+
+    void Toggle(uint32_t nShortId, int nCount);
+
+    std::vector<Cell> vCells;
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
@@ -49,6 +49,8 @@ public:
     friend inline bool operator<(const base_blob& a, const base_blob& b) { return a.Compare(b) < 0; }
 
     std::string GetHex() const;
+    /** GetHex without the string, into a buffer of at least 2 * WIDTH + 1 chars */
+    void GetHex(char* psz) const;
     void SetHex(const char* psz);
     void SetHex(const std::string& str);
     std::string ToString() const;
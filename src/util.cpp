@@ -13,6 +13,7 @@
 #include "random.h"
 #include "serialize.h"
 #include "sync.h"
+#include "threadinfo.h"
 #include "utilstrencodings.h"
 #include "utiltime.h"
 
@@ -197,6 +198,28 @@ static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 static list<string> *vMsgsBeforeOpenLog;
 
+//! Most bytes of messages queued for the debug.log writer, past which they are written right away
+static const size_t MAX_LOG_QUEUE_BYTES = 16 * 1024 * 1024;
+
+/**
+ * A message queued for the debug.log writer, whose timestamp is formatted
+ * by the writer. nTimeMicros is -1 for a message that continues a line.
+ */
+struct CLogMessage {
+    std::string str;
+    int64_t nTimeMicros;
+    CLogMessage* pnext;
+};
+
+//! Messages queued for the writer, newest first. Producers push without a lock and the writer takes them all at once.
+static std::atomic<CLogMessage*> plogQueue(NULL);
+static std::atomic<size_t> nLogQueueBytes(0);
+static std::atomic<bool> fLogWriterRunning(false);
+//! Wakes the writer when a message is pushed on an empty queue, leaked like mutexDebugLog
+static boost::mutex* mutexLogWriter = NULL;
+static boost::condition_variable* condLogWriter = NULL;
+static boost::thread* threadLogWriter = NULL;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -207,6 +230,8 @@ static void DebugPrintInit()
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
     vMsgsBeforeOpenLog = new list<string>;
+    mutexLogWriter = new boost::mutex();
+    condLogWriter = new boost::condition_variable();
 }
 
 void OpenDebugLog()
@@ -231,6 +256,17 @@ void OpenDebugLog()
     vMsgsBeforeOpenLog = NULL;
 }
 
+/** The -debug categories, looked up without building a string for each message */
+struct CLogCategories {
+    bool fAll;
+    std::vector<std::string> vCategories; // sorted
+};
+
+static bool LogCategoryLess(const std::string& a, const char* b)
+{
+    return strcmp(a.c_str(), b) < 0;
+}
+
 bool LogAcceptCategory(const char* category)
 {
     if (category != NULL)
@@ -242,96 +278,223 @@ bool LogAcceptCategory(const char* category)
         // This helps prevent issues debugging global destructors,
         // where mapMultiArgs might be deleted before another
         // global destructor calls LogPrint()
-        static boost::thread_specific_ptr<set<string> > ptrCategory;
+        static boost::thread_specific_ptr<CLogCategories> ptrCategory;
         if (ptrCategory.get() == NULL)
         {
-            if (mapMultiArgs.count("-debug")) {
-                const vector<string>& categories = mapMultiArgs.at("-debug");
-                ptrCategory.reset(new set<string>(categories.begin(), categories.end()));
-                // thread_specific_ptr automatically deletes the set when the thread ends.
-            } else
-                ptrCategory.reset(new set<string>());
+            CLogCategories* pcategories = new CLogCategories();
+            if (mapMultiArgs.count("-debug"))
+                pcategories->vCategories = mapMultiArgs.at("-debug");
+            std::sort(pcategories->vCategories.begin(), pcategories->vCategories.end());
+            const std::vector<std::string>& v = pcategories->vCategories;
+            pcategories->fAll = std::binary_search(v.begin(), v.end(), std::string("")) || std::binary_search(v.begin(), v.end(), std::string("1"));
+            // thread_specific_ptr automatically deletes the categories when the thread ends.
+            ptrCategory.reset(pcategories);
         }
-        const set<string>& setCategories = *ptrCategory.get();
+        const CLogCategories& categories = *ptrCategory.get();
 
         // if not debugging everything and not debugging specific category, LogPrint does nothing.
-        if (setCategories.count(string("")) == 0 &&
-            setCategories.count(string("1")) == 0 &&
-            setCategories.count(string(category)) == 0)
-            return false;
+        if (!categories.fAll) {
+            std::vector<std::string>::const_iterator it = std::lower_bound(categories.vCategories.begin(), categories.vCategories.end(), category, LogCategoryLess);
+            if (it == categories.vCategories.end() || *it != category)
+                return false;
+        }
     }
     return true;
 }
 
+bool CLogThrottle::Allow(uint64_t& nSuppressed)
+{
+    int64_t nNow = GetTimeMicros();
+    int64_t nNext = nNextTime.load(std::memory_order_relaxed);
+    // Only the thread that moves the deadline on gets to log
+    if (nNow < nNext || !nNextTime.compare_exchange_strong(nNext, nNow + nIntervalMicros)) {
+        nSuppressedCount++;
+        return false;
+    }
+    nSuppressed = nSuppressedCount.exchange(0);
+    return true;
+}
+
 /**
  * fStartedNewLine is a state variable held by the calling context that will
  * suppress printing of the timestamp when multiple calls are made that don't
  * end in a newline. Initialize it to true, and hold it, in the calling context.
+ * Returns the time to stamp str with, or -1 if it continues a line.
  */
-static std::string LogTimestampStr(const std::string &str, std::atomic_bool *fStartedNewLine)
+static int64_t LogTimestampTime(const std::string &str, std::atomic_bool *fStartedNewLine)
 {
-    string strStamped;
-
     if (!fLogTimestamps)
-        return str;
+        return -1;
 
-    if (*fStartedNewLine) {
-        int64_t nTimeMicros = GetLogTimeMicros();
-        strStamped = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTimeMicros/1000000);
-        if (fLogTimeMicros)
-            strStamped += strprintf(".%06d", nTimeMicros%1000000);
-        strStamped += ' ' + str;
-    } else
-        strStamped = str;
+    int64_t nTimeMicros = *fStartedNewLine ? GetLogTimeMicros() : -1;
 
     if (!str.empty() && str[str.size()-1] == '\n')
         *fStartedNewLine = true;
     else
         *fStartedNewLine = false;
 
+    return nTimeMicros;
+}
+
+static std::string LogTimestampStr(const std::string &str, int64_t nTimeMicros)
+{
+    if (nTimeMicros < 0)
+        return str;
+
+    string strStamped = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTimeMicros/1000000);
+    if (fLogTimeMicros)
+        strStamped += strprintf(".%06d", nTimeMicros%1000000);
+    strStamped += ' ' + str;
     return strStamped;
 }
 
+/** Write to debug.log, or buffer until it is opened. mutexDebugLog must be held. */
+static int DebugLogWriteStr(const std::string &strTimestamped)
+{
+    // buffer if we haven't opened the log yet
+    if (fileout == NULL) {
+        assert(vMsgsBeforeOpenLog);
+        vMsgsBeforeOpenLog->push_back(strTimestamped);
+        return strTimestamped.length();
+    }
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+            setbuf(fileout, NULL); // unbuffered
+    }
+
+    return FileWriteStr(strTimestamped, fileout);
+}
+
+/** Write the messages queued so far, in the order they were logged */
+static bool DebugLogWriteQueued()
+{
+    CLogMessage* pqueue = plogQueue.exchange(NULL);
+    if (pqueue == NULL)
+        return false;
+
+    CLogMessage* plist = NULL;
+    while (pqueue) {
+        CLogMessage* pnext = pqueue->pnext;
+        pqueue->pnext = plist;
+        plist = pqueue;
+        pqueue = pnext;
+    }
+
+    // One write for the lot, the file being unbuffered
+    std::string strBatch;
+    size_t nBytes = 0;
+    while (plist) {
+        strBatch += LogTimestampStr(plist->str, plist->nTimeMicros);
+        nBytes += plist->str.size();
+        CLogMessage* pnext = plist->pnext;
+        delete plist;
+        plist = pnext;
+    }
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        DebugLogWriteStr(strBatch);
+    }
+    nLogQueueBytes -= nBytes;
+    return true;
+}
+
+static void ThreadDebugLogWriter()
+{
+    RenameThread("bitcoin-logwriter");
+    while (true) {
+        // Read before taking the queue, so that the pass after a stop empties it
+        bool fRunning = fLogWriterRunning;
+        if (DebugLogWriteQueued())
+            continue;
+        if (!fRunning)
+            break;
+        // A wakeup lost to a race only delays the messages until the timeout
+        boost::unique_lock<boost::mutex> lock(*mutexLogWriter);
+        condLogWriter->timed_wait(lock, boost::posix_time::milliseconds(100));
+    }
+}
+
+/** Queue a message for the writer, unless it is not running or is behind */
+static bool DebugLogQueueStr(const std::string &str, int64_t nTimeMicros)
+{
+    if (!fLogWriterRunning || nLogQueueBytes > MAX_LOG_QUEUE_BYTES)
+        return false;
+
+    CLogMessage* pmsg = new CLogMessage();
+    pmsg->str = str;
+    pmsg->nTimeMicros = nTimeMicros;
+    nLogQueueBytes += str.size();
+    CLogMessage* phead = plogQueue.load();
+    do {
+        pmsg->pnext = phead;
+    } while (!plogQueue.compare_exchange_weak(phead, pmsg));
+    if (phead == NULL)
+        condLogWriter->notify_one();
+    return true;
+}
+
+void StartDebugLogWriter()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    if (threadLogWriter)
+        return;
+    fLogWriterRunning = true;
+    threadLogWriter = new boost::thread(&ThreadDebugLogWriter);
+}
+
+void StopDebugLogWriter()
+{
+    if (!threadLogWriter)
+        return;
+    fLogWriterRunning = false;
+    condLogWriter->notify_one();
+    threadLogWriter->join();
+    delete threadLogWriter;
+    threadLogWriter = NULL;
+    // Whatever a thread queued while the writer stopped
+    DebugLogWriteQueued();
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
     static std::atomic_bool fStartedNewLine(true);
 
-    string strTimestamped = LogTimestampStr(str, &fStartedNewLine);
+    int64_t nTimeMicros = LogTimestampTime(str, &fStartedNewLine);
 
     if (fPrintToConsole)
     {
         // print to console
+        string strTimestamped = LogTimestampStr(str, nTimeMicros);
         ret = fwrite(strTimestamped.data(), 1, strTimestamped.size(), stdout);
         fflush(stdout);
     }
     else if (fPrintToDebugLog)
     {
+        if (DebugLogQueueStr(str, nTimeMicros))
+            return str.size();
+
+        string strTimestamped = LogTimestampStr(str, nTimeMicros);
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        // buffer if we haven't opened the log yet
-        if (fileout == NULL) {
-            assert(vMsgsBeforeOpenLog);
-            ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
-        }
-        else
-        {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout);
-        }
+        ret = DebugLogWriteStr(strTimestamped);
     }
     return ret;
 }
 
+int LogPrintThrottledStr(const std::string &str, uint64_t nSuppressed)
+{
+    if (nSuppressed == 0)
+        return LogPrintStr(str);
+    // Note the count before the line break, if there is one
+    size_t nEnd = (!str.empty() && str[str.size()-1] == '\n') ? str.size() - 1 : str.size();
+    return LogPrintStr(str.substr(0, nEnd) + strprintf(" (%u similar messages suppressed)", nSuppressed) + str.substr(nEnd));
+}
+
 /** Interpret string as boolean, for argument parsing */
 static bool InterpretBool(const std::string& strValue)
 {
@@ -788,10 +951,8 @@ void RenameThread(const char* name)
 
 #elif defined(MAC_OSX)
     pthread_setname_np(name);
-#else
-    // Prevent warnings for unused parameters...
-    (void)name;
 #endif
+    RegisterThread(name);
 }
 
 void SetupEnvironment()
@@ -32,6 +32,7 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC      = true;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -72,6 +73,26 @@ bool SetupNetworking();
 bool LogAcceptCategory(const char* category);
 /** Send a string to the log output */
 int LogPrintStr(const std::string &str);
+/** Send a string to the log output, noting how many messages like it were left out before */
+int LogPrintThrottledStr(const std::string &str, uint64_t nSuppressed);
+
+/**
+ * Lets through one message per interval from a call site of
+ * LogPrintfThrottled, and counts the ones it drops.
+ */
+class CLogThrottle
+{
+public:
+    explicit CLogThrottle(int64_t nIntervalSeconds) : nIntervalMicros(nIntervalSeconds * 1000000), nNextTime(0), nSuppressedCount(0) {}
+
+    /** Whether to log now, and if so how many messages were dropped since the last one */
+    bool Allow(uint64_t& nSuppressed);
+
+private:
+    const int64_t nIntervalMicros;
+    std::atomic<int64_t> nNextTime;
+    std::atomic<uint64_t> nSuppressedCount;
+};
 
 #define LogPrint(category, ...) do { \
     if (LogAcceptCategory((category))) { \
@@ -83,6 +104,15 @@ int LogPrintStr(const std::string &str);
     LogPrintStr(tfm::format(__VA_ARGS__)); \
 } while(0)
 
+/** LogPrintf for messages that peers or transactions can trigger at will, at most one per nIntervalSeconds from the same call site */
+#define LogPrintfThrottled(nIntervalSeconds, ...) do { \
+    static CLogThrottle logThrottle((nIntervalSeconds)); \
+    uint64_t nLogSuppressed = 0; \
+    if (logThrottle.Allow(nLogSuppressed)) { \
+        LogPrintThrottledStr(tfm::format(__VA_ARGS__), nLogSuppressed); \
+    } \
+} while(0)
+
 template<typename... Args>
 bool error(const char* fmt, const Args&... args)
 {
@@ -111,6 +141,14 @@ void ReadConfigFile(const std::string& confPath);
 boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 void OpenDebugLog();
+/**
+ * Have a background thread write debug.log, so logging threads only queue
+ * their messages. Messages logged while it is not running, or while too
+ * much is queued, are written right away.
+ */
+void StartDebugLogWriter();
+/** Write what is queued and stop the background thread */
+void StopDebugLogWriter();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 
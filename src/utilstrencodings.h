@@ -91,20 +91,24 @@ bool ParseUInt64(const std::string& str, uint64_t *out);
  */
 bool ParseDouble(const std::string& str, double *out);
 
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
 template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
-    std::string rv;
-    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
-                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
-    rv.reserve((itend-itbegin)*3);
-    for(T it = itbegin; it < itend; ++it)
+    size_t nBytes = itend - itbegin;
+    if (nBytes == 0)
+        return std::string();
+
+    // Sized once and written in place, rather than grown a character at a time
+    size_t nStride = fSpaces ? 3 : 2;
+    std::string rv(nBytes * nStride - (fSpaces ? 1 : 0), ' ');
+    char* psz = &rv[0];
+    for(T it = itbegin; it < itend; ++it, psz += nStride)
     {
         unsigned char val = (unsigned char)(*it);
-        if(fSpaces && it != itbegin)
-            rv.push_back(' ');
-        rv.push_back(hexmap[val>>4]);
-        rv.push_back(hexmap[val&15]);
+        psz[0] = HEX_DIGITS[val>>4];
+        psz[1] = HEX_DIGITS[val&15];
     }
 
     return rv;
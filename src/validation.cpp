@@ -8,25 +8,34 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockimport.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
+#include "mappedfile.h"
+#include "notifier.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "rawblockcache.h"
+#include "snapshot.h"
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
 #include "timedata.h"
 #include "tinyformat.h"
+#include "trace.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -41,7 +50,9 @@
 
 #include "address_index.h"
 
+#include <algorithm>
 #include <atomic>
+#include <numeric>
 #include <sstream>
 #include <utility>
 
@@ -65,31 +76,45 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+std::set<const CBlockIndex*> setBlockIndexLeaves;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
+std::atomic_bool fDPoSRepairing(false);
+std::atomic<int> nDPoSRepairDone(0);
+std::atomic<int> nDPoSRepairTotal(0);
 bool fReindex = false;
 bool fTxIndex = false;
 bool fAddressIndex = false;
+bool fBlockFilterIndex = false;
+bool fDPoSHistory = false;
 bool fUseIrreversibleBlock = true;
+int64_t nIrreversibleSyncWindow = DEFAULT_IRREVERSIBLE_SYNC_WINDOW;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckpointSync = DEFAULT_CHECKPOINT_SYNC;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nMaxMemoryUsage = 0;
+/** The mempool share of -maxmemory, updated as FlushStateToDisk measures the other structures */
+static std::atomic<size_t> nMempoolMemoryLimit(std::numeric_limits<size_t>::max());
 uint64_t nPruneTarget = 0;
+unsigned int nBlockFileChunkSize = BLOCKFILE_CHUNK_SIZE;
+unsigned int nUndoFileChunkSize = UNDOFILE_CHUNK_SIZE;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
 
 
-bool DoVoting(const CBlock& block, uint32_t nHeight, std::map<uint256, uint64_t>& mapTxFee);
-void ProcessDPoSConnectBlock(const CBlock& block, uint64_t nBlockHeight);
-void ProcessDPoSDisconnectBlock(const CBlock& block, uint64_t nBlockHeight);
+void AddDPoSSpend(CDPoSBlockDelta& delta, const CTransaction& tx, uint32_t nTx, uint32_t nIn, const Consensus::CSpentOutput& spent);
+void AddDPoSOutputs(CDPoSBlockDelta& delta, const CTransaction& tx, uint32_t nTx);
+void ProcessDPoSConnectBlock(const CBlock& block, const CDPoSBlockDelta& delta, uint64_t nBlockHeight, bool fNotify = true);
+void ProcessDPoSDisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, uint64_t nBlockHeight, bool fNotify = true);
 
 uint256 hashAssumeValid;
 
@@ -145,6 +170,9 @@ namespace {
      */
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
+    /** Owns the entries of mapBlockIndex */
+    CBlockIndexArena blockIndexArena;
+
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
@@ -225,7 +253,13 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+/** The statistics of the unspent outputs of pcoinsTip, when fUTXOStatsTip is set (protected by cs_main) */
+static CUTXOStats utxostatsTip;
+static bool fUTXOStatsTip = false;
 CBlockTreeDB *pblocktree = NULL;
+CAddressIndexDB *paddressindex = NULL;
+CBlockFilterDB *pblockfilterdb = NULL;
+CDPoSHistoryDB *pdposhistory = NULL;
 //CVoteDB *pvote = NULL;
 //CWitnessDB *pwitness = NULL;
 
@@ -386,10 +420,12 @@ bool TestLockPointValidity(const LockPoints* lp)
     return true;
 }
 
-bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool useExistingLockPoints)
+bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool useExistingLockPoints, const CCoinsView* pcoinsView)
 {
     AssertLockHeld(cs_main);
-    AssertLockHeld(mempool.cs);
+    if (!pcoinsView) {
+        AssertLockHeld(mempool.cs);
+    }
 
     CBlockIndex* tip = chainActive.Tip();
     CBlockIndex index;
@@ -411,19 +447,21 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
     else {
         // pcoinsTip contains the UTXO set for chainActive.Tip()
         CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        if (!pcoinsView)
+            pcoinsView = &viewMemPool;
         std::vector<int> prevheights;
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!pcoinsView->GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -479,7 +517,9 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     unsigned int nSigOps = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         if (prevout.scriptPubKey.IsPayToScriptHash())
             nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
     }
@@ -499,7 +539,9 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         nSigOps += CountWitnessSigOps(tx.vin[i].scriptSig, prevout.scriptPubKey, &tx.vin[i].scriptWitness, flags);
     }
     return nSigOps;
@@ -563,9 +605,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
-    pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    std::vector<COutPoint> vNoSpendsRemaining;
+    pool.TrimToSize(limit, &vNoSpendsRemaining, GetArg("-maxmempooldpos", DEFAULT_MAX_MEMPOOL_DPOS_SIZE) * 1000000);
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -590,9 +632,11 @@ static bool IsCurrentForFeeEstimation()
     return true;
 }
 
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams);
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -684,23 +728,22 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are the inputs missing because we already have it? Only the coins cache is
+                // asked: the outputs of a new transaction are not in the database either, and
+                // looking each of them up there cost a read per output of every transaction
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                }
+                if (pfMissingInputs) {
                     *pfMissingInputs = true;
+                }
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
@@ -716,15 +759,14 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
         view.SetBackend(dummy);
+        }
 
         // Only accept BIP68 sequence locked transactions that can be mined in the next
         // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        // be mined yet. The inputs come from view, not fetched from the mempool and
+        // pcoinsTip a second time
+        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp, false, &view))
             return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
-        }
 
         // Check for non-standard pay-to-script-hash in inputs
         if (fRequireStandard && !AreInputsStandard(tx, view))
@@ -750,8 +792,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -759,6 +801,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, dPriority, chainActive.Height(),
                               inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        if (entry.IsDPoSOp()) {
+            // All inputs spend from the same address, see CheckTxInputs
+            Consensus::CSpentOutput spent(view.AccessCoin(tx.vin[0].prevout));
+            if (spent.fAddress && spent.address.second == CChainParams::PUBKEY_ADDRESS)
+                entry.SetDPoSSender(spent.address.first);
+        }
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -770,7 +818,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
                 strprintf("%d", nSigOpsCost));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        // A DPoS operation paying less than DoVoting requires would be mined without effect
+        if (entry.IsDPoSOp() && nFees < GetDPoSOpMinFee(entry.GetDPoSOpcode()))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "dpos-op-fee-not-met", false,
+                strprintf("%d < %d", nFees, GetDPoSOpMinFee(entry.GetDPoSOpcode())));
+
+        CAmount mempoolRejectFee = pool.GetMinFee(GetMempoolSizeLimit()).GetFee(nSize);
         if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
         } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
@@ -970,14 +1023,15 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        std::shared_ptr<PrecomputedTransactionData> ptxdata = std::make_shared<PrecomputedTransactionData>(tx);
+        PrecomputedTransactionData& txdata = *ptxdata;
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
             CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
+            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
                 // Only the witness is missing, so the transaction itself may be fine.
                 state.SetCorruptionPossible();
             }
@@ -993,12 +1047,22 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // Check once more under the flags blocks on top of the tip are expected to use, so
+        // ConnectBlock can skip the script checks of this transaction. This only costs the
+        // script interpretation, the signatures are in the signature cache by now. If the
+        // flags change with the next block the marker simply does not match. The result
+        // also goes to the script execution cache, which outlives the mempool entry.
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+        CValidationState stateBlockFlags;
+        entry.SetScriptsVerified(ptxdata, CheckInputs(tx, stateBlockFlags, view, true, currentBlockScriptVerifyFlags, true, true, txdata),
+                                 currentBlockScriptVerifyFlags);
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1023,10 +1087,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         // trim mempool and check if tx was trimmed
         if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            LimitMempoolSize(pool, GetMempoolSizeLimit(), GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
             if (!pool.exists(hash))
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
         }
+        TRACE4(mempool, added, hash.begin(), nSize, nFees, (uint64_t)allConflicting.size());
     }
 
     GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
@@ -1038,10 +1103,11 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        TRACE3(mempool, rejected, tx->GetHash().begin(), state.GetRejectCode(), state.GetRejectReason().c_str());
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
@@ -1057,6 +1123,111 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
 }
 
+void PreCheckTransactions(const std::vector<CTransactionRef>& vtx, std::vector<CPendingSignatures>& vPending)
+{
+    vPending.resize(vtx.size());
+
+    // Copy the coins spent by the whole batch, from the chain or the mempool, leaving the coins cache as it was
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    bool witnessEnabled = false;
+    int nSpendHeight = 0;
+    CAmount nMempoolMinFeePerK = 0;
+    std::vector<CAmount> vFeeDelta(vtx.size(), 0);
+    {
+        LOCK2(cs_main, mempool.cs);
+        if (!Params().RequireStandard()) {
+            scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        }
+        witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        nSpendHeight = chainActive.Height() + 1;
+        nMempoolMinFeePerK = mempool.GetMinFee(GetMempoolSizeLimit()).GetFeePerK();
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            double dPriorityDelta = 0;
+            mempool.ApplyDeltas(vtx[i]->GetHash(), dPriorityDelta, vFeeDelta[i]);
+            for (const CTxIn& txin : vtx[i]->vin) {
+                if (view.HaveCoinInCache(txin.prevout))
+                    continue;
+                bool fHadCoin = pcoinsTip->HaveCoinInCache(txin.prevout);
+                Coin coin;
+                bool fHaveCoin = viewMemPool.GetCoin(txin.prevout, coin) && !coin.IsSpent();
+                if (!fHadCoin)
+                    pcoinsTip->Uncache(txin.prevout);
+                if (fHaveCoin)
+                    view.AddCoin(txin.prevout, std::move(coin), true);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vtx.size(); i++) {
+        const CTransaction& tx = *vtx[i];
+        CValidationState state;
+        if (!CheckTransaction(tx, state) || tx.IsCoinBase())
+            continue;
+
+        // The scripts are verified last, as in AcceptToMemoryPool, once the cheaper policy and fee checks passed
+        std::string reason;
+        if (fRequireStandard && !IsStandardTx(tx, reason, witnessEnabled))
+            continue;
+        if (!view.HaveInputs(tx) || !Consensus::CheckTxInputs(tx, state, view, nSpendHeight))
+            continue;
+        if (fRequireStandard && (!AreInputsStandard(tx, view) || (tx.HasWitness() && !IsWitnessStandard(tx, view))))
+            continue;
+        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+            continue;
+        // Free transactions AcceptToMemoryPool may still take are left to it
+        size_t nSize = GetVirtualTransactionSize(tx, nSigOpsCost);
+        CAmount nModifiedFees = view.GetValueIn(tx) - tx.GetValueOut() + vFeeDelta[i];
+        if (nModifiedFees < CFeeRate(nMempoolMinFeePerK).GetFee(nSize) || nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+            continue;
+
+        CPendingSignatures pending;
+        CPendingSignatures::Scope scope(pending);
+        PrecomputedTransactionData txdata(tx);
+        bool fValid = true;
+        for (unsigned int j = 0; j < tx.vin.size() && fValid; j++) {
+            CScriptCheck check(view.AccessCoin(tx.vin[j].prevout).out, tx, j, scriptVerifyFlags, false, &txdata);
+            fValid = check();
+        }
+        if (fValid)
+            std::swap(vPending[i], pending);
+    }
+}
+
+/** Block and undo files kept mapped for reads; far fewer on 32 bit systems, for lack of address space */
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 64 : 4;
+static CMappedFileCache mappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Map of the block or undo file with the record written at pos, and the bytes
+ * of the record plus nExtra bytes after it, which are the checksum of undo
+ * data. NULL when the file can't be mapped or the record does not fit in it,
+ * in which case the callers read through a CAutoFile, as before.
+ */
+static std::shared_ptr<const CMappedFile> MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, size_t nExtra, const char*& pbegin, const char*& pend)
+{
+    // Every record is preceded by the message start and its size, see WriteBlockToDisk
+    if (pos.IsNull() || pos.nPos < 8)
+        return nullptr;
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    std::shared_ptr<const CMappedFile> file = mappedBlockFiles.Get(path, pos.nPos);
+    if (!file)
+        return nullptr;
+    uint64_t nEnd = (uint64_t)pos.nPos + ReadLE32((const unsigned char*)file->data() + pos.nPos - 4) + nExtra;
+    if (nEnd > file->size()) {
+        // The record may have been appended after the file was mapped
+        file = mappedBlockFiles.Get(path, nEnd);
+        if (!file)
+            return nullptr;
+    }
+    pbegin = file->data() + pos.nPos;
+    pend = file->data() + nEnd;
+    return file;
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1071,34 +1242,45 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
         return true;
     }
 
-    if (fTxIndex) {
-        CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
+    std::vector<CDiskTxPos> vPos;
+    if (fTxIndex && pblocktree->ReadTxIndex(hash, vPos)) {
+        // The index only keeps a prefix of the txid, any other transaction sharing it comes along
+        for (const CDiskTxPos& postx : vPos) {
+            const char *pbegin, *pend;
+            std::shared_ptr<const CMappedFile> mapped = MapDiskRecord(postx, "blk", 0, pbegin, pend);
             CBlockHeader header;
             try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
+                if (mapped) {
+                    CSpanReader file(SER_DISK, CLIENT_VERSION, pbegin, pend);
+                    file >> header;
+                    file.ignore(postx.nTxOffset);
+                    file >> txOut;
+                } else {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                }
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
-            hashBlock = header.GetHash();
-            if (txOut->GetHash() != hash)
-                return error("%s: txid mismatch", __func__);
-            return true;
+            if (txOut->GetHash() == hash) {
+                hashBlock = header.GetHash();
+                return true;
+            }
         }
+        txOut.reset();
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
             const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(view, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1155,14 +1337,21 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    const char *pbegin, *pend;
+    std::shared_ptr<const CMappedFile> file = MapDiskRecord(pos, "blk", 0, pbegin, pend);
 
     // Read block
     try {
-        filein >> block;
+        if (file) {
+            CSpanReader filein(SER_DISK, CLIENT_VERSION, pbegin, pend);
+            filein >> block;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1185,6 +1374,100 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawRecordFromDisk(std::string& strData, const CDiskBlockPos& pos, bool fUndo)
+{
+    const char *pbegin, *pend;
+    std::shared_ptr<const CMappedFile> file = MapDiskRecord(pos, fUndo ? "rev" : "blk", 0, pbegin, pend);
+    if (file) {
+        strData.append(pbegin, pend);
+        return true;
+    }
+
+    // The size of the record is stored in the four bytes before it
+    if (pos.IsNull() || pos.nPos < 8)
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos posSize(pos.nFile, pos.nPos - 4);
+    CAutoFile filein(fUndo ? OpenUndoFile(posSize, true) : OpenBlockFile(posSize, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: open failed for %s", __func__, pos.ToString());
+    try {
+        unsigned int nSize;
+        filein >> nSize;
+        if (nSize > MAX_SIZE)
+            return error("%s: record too large at %s", __func__, pos.ToString());
+        size_t nOffset = strData.size();
+        strData.resize(nOffset + nSize);
+        filein.read(&strData[nOffset], nSize);
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlocksFromDisk(std::vector<std::vector<unsigned char> >& vData, const std::vector<CDiskBlockPos>& vPos)
+{
+    vData.assign(vPos.size(), std::vector<unsigned char>());
+    std::vector<size_t> vOrder(vPos.size());
+    std::iota(vOrder.begin(), vOrder.end(), 0);
+    std::sort(vOrder.begin(), vOrder.end(), [&vPos](size_t a, size_t b) {
+        return std::make_pair(vPos[a].nFile, vPos[a].nPos) < std::make_pair(vPos[b].nFile, vPos[b].nPos);
+    });
+
+    // In the order of the files, so blocks written one after another are read in a single pass
+    bool fAll = true;
+    std::unique_ptr<CAutoFile> filein;
+    int nFile = -1;
+    uint64_t nFilePos = 0;
+    for (size_t i : vOrder) {
+        const CDiskBlockPos& pos = vPos[i];
+        const char *pbegin, *pend;
+        std::shared_ptr<const CMappedFile> file = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+        if (file) {
+            vData[i].assign(pbegin, pend);
+            continue;
+        }
+
+        if (pos.IsNull() || pos.nPos < 8) {
+            fAll = error("%s: invalid position %s", __func__, pos.ToString());
+            continue;
+        }
+        try {
+            if (!filein || pos.nFile != nFile) {
+                filein.reset(new CAutoFile(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION));
+                nFile = pos.nFile;
+                nFilePos = pos.nPos - 4;
+            } else if (nFilePos + 4 == pos.nPos - 4) {
+                // Step over the message start of the next record rather than seek
+                char pchMessageStart[4];
+                filein->read(pchMessageStart, sizeof(pchMessageStart));
+                nFilePos += sizeof(pchMessageStart);
+            } else if (nFilePos != pos.nPos - 4) {
+                if (fseek(filein->Get(), pos.nPos - 4, SEEK_SET))
+                    throw std::ios_base::failure("fseek failed");
+                nFilePos = pos.nPos - 4;
+            }
+            if (filein->IsNull()) {
+                fAll = error("%s: open failed for %s", __func__, pos.ToString());
+                filein.reset();
+                continue;
+            }
+            unsigned int nSize;
+            *filein >> nSize;
+            if (nSize > MAX_SIZE)
+                throw std::ios_base::failure("record too large");
+            vData[i].resize(nSize);
+            filein->read((char*)vData[i].data(), nSize);
+            nFilePos = (uint64_t)pos.nPos + nSize;
+        } catch (const std::exception& e) {
+            // The position in the file is unknown after a failed read
+            vData[i].clear();
+            filein.reset();
+            fAll = error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+    return fAll;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = 0;
@@ -1235,7 +1518,7 @@ static void AlertNotify(const std::string& strMessage)
 {
     uiInterface.NotifyAlertChanged();
     std::string strCmd = GetArg("-alertnotify", "");
-    if (strCmd.empty()) return;
+    if (strCmd.empty() && !(pnotifier && pnotifier->IsPiped())) return;
 
     // Alert text should be plain ascii coming from a trusted source, but to
     // be safe we first strip anything not in safeChars, then add single quotes around
@@ -1243,9 +1526,8 @@ static void AlertNotify(const std::string& strMessage)
     std::string singleQuote("'");
     std::string safeStatus = SanitizeString(strMessage);
     safeStatus = singleQuote+safeStatus+singleQuote;
-    boost::replace_all(strCmd, "%s", safeStatus);
 
-    boost::thread t(runCommand, strCmd); // thread runs free
+    QueueNotify("alert", strCmd, safeStatus, false);
 }
 
 void CheckForkWarningConditions()
@@ -1354,24 +1636,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1396,127 +1667,61 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
     return pindexPrev->nHeight + 1;
 }
 
-typedef std::pair<uint256, uint32_t> TxoutKey;
-typedef const TxoutKey* TxoutKeyPtr;
-typedef std::shared_ptr<CTxOut> TxOutPtr;
-
-struct txoutkey_hash
-{
-    std::size_t operator()(TxoutKeyPtr k) const
-    {
-        std::size_t hash = 0;
-        boost::hash_range( hash, k->first.begin(), k->first.end() );
-        hash += k->second;
-        return hash;
-    }
-};
-
-struct txoutkey_equal
-{
-    bool operator()(TxoutKeyPtr a, TxoutKeyPtr b) const
-    {
-        return a->first == b->first && a->second == b->second;
-    }
-};
-
-std::unordered_map<TxoutKeyPtr, TxOutPtr, txoutkey_hash, txoutkey_equal> mapHashTxout(1000000);
-CCriticalSection cs_mapHashTxout;
-const uint32_t maxIndexVctTxoutKey = 200000;
-vector<TxoutKey> vctTxoutKey(maxIndexVctTxoutKey);
-uint32_t indexVctTxoutKey;
-bool fVctTxoutKeyFull = false;
-
-void PutTxoutCache(const TxoutKey& key, const CTxOut& txout)
-{
-    LOCK(cs_mapHashTxout);
-
-    if(mapHashTxout.find(&key) == mapHashTxout.end()) {
-        if(fVctTxoutKeyFull) {
-            mapHashTxout.erase(&vctTxoutKey[indexVctTxoutKey]);
-        }
-
-        vctTxoutKey[indexVctTxoutKey] = key;
-        mapHashTxout[&vctTxoutKey[indexVctTxoutKey]] = make_shared<CTxOut>(txout);
-
-        if(++indexVctTxoutKey == maxIndexVctTxoutKey) {
-            indexVctTxoutKey = 0;
-            fVctTxoutKeyFull = true;
-        }
-    }
-
-    return;
-}
-
-TxOutPtr GetTxoutCache(const TxoutKey& key)
+namespace Consensus {
+CSpentOutput::CSpentOutput(const CTxOut& txoutIn, int nHeightIn, bool fCoinBaseIn) : txout(txoutIn), nHeight(nHeightIn), fCoinBase(fCoinBaseIn)
 {
-    LOCK(cs_mapHashTxout);
-
-    auto it = mapHashTxout.find(&key);
-    if(it != mapHashTxout.end()) {
-        return it->second;
-    } else {
-        return TxOutPtr();
-    }
+    fAddress = ExtractAddress(txout.scriptPubKey, address);
 }
 
-TxOutPtr GetTxout(const uint256 &txid, uint32_t nTxoutIndex)
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight)
 {
-    TxOutPtr txout = GetTxoutCache(make_pair(txid, nTxoutIndex));
-
-    if(!txout) {
-        LogPrintf("GetTxoutCache txid:%s nTxoutIndex:%ld failed\n", txid.ToString().c_str(), nTxoutIndex);
-        CTransactionRef tx;
-        uint256 hashBlock;
+        // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
+        // for an attacker to attempt to split the network.
+        if (!inputs.HaveInputs(tx))
+            return state.Invalid(false, 0, "", "Inputs unavailable");
 
-        if (GetTransaction(txid, tx, Params().GetConsensus(), hashBlock, true)) {
-            txout = make_shared<CTxOut>(tx->vout[nTxoutIndex]);
+        std::vector<CSpentOutput> vSpent;
+        vSpent.reserve(tx.vin.size());
+        for (const CTxIn& txin : tx.vin) {
+            const Coin& coin = inputs.AccessCoin(txin.prevout);
+            assert(!coin.IsSpent());
+            vSpent.push_back(CSpentOutput(coin));
         }
-    }
 
-    return txout;
+        CAmount nTxFee;
+        return CheckTxInputs(tx, state, vSpent, nSpendHeight, nTxFee);
 }
 
-namespace Consensus {
-bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight)
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const std::vector<CSpentOutput>& vSpent, int nSpendHeight, CAmount& nTxFee)
 {
-        // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
-        // for an attacker to attempt to split the network.
-        if (!inputs.HaveInputs(tx))
-            return state.Invalid(false, 0, "", "Inputs unavailable");
+        assert(vSpent.size() == tx.vin.size());
 
         CAmount nValueIn = 0;
         CAmount nFees = 0;
 
-        CTxDestination inputAddress;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const CSpentOutput& spent = vSpent[i];
 
-            PutTxoutCache(make_pair(prevout.hash, prevout.n), coins->vout[prevout.n]);
-            if(i == 0) {
-                ExtractDestination(coins->vout[prevout.n].scriptPubKey, inputAddress);
-            } else {
-                CTxDestination address;
-                if(ExtractDestination(coins->vout[prevout.n].scriptPubKey, address) == false) {
+            if(i > 0) {
+                if(!spent.fAddress) {
                     return state.DoS(100, false, REJECT_INVALID, "bad-inputaddress");
-                } else if(address != inputAddress) {
+                } else if(!vSpent[0].fAddress || spent.address != vSpent[0].address) {
                     return state.DoS(100, false, REJECT_INVALID, "bad-many-inputaddress");
                 }
             }
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (spent.fCoinBase) {
+                if (nSpendHeight - spent.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - spent.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += spent.txout.nValue;
+            if (!MoneyRange(spent.txout.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1526,7 +1731,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
                 strprintf("value in (%s) < value out (%s)", FormatMoney(nValueIn), FormatMoney(tx.GetValueOut())));
 
         // Tally transaction fees
-        CAmount nTxFee = nValueIn - tx.GetValueOut();
+        nTxFee = nValueIn - tx.GetValueOut();
         if (nTxFee < 0)
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-fee-negative");
         nFees += nTxFee;
@@ -1536,11 +1741,23 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static uint256 scriptExecutionCacheNonce(GetRandHash());
+
+void InitScriptExecutionCache() {
+    // nMaxCacheSize is unsigned. If -maxscriptcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxscriptcachesize", DEFAULT_MAX_SCRIPT_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for script execution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks, bool fCheckTxInputs)
 {
     if (!tx.IsCoinBase())
     {
-        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
+        if (fCheckTxInputs && !Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
             return false;
 
         if (pvChecks)
@@ -1556,13 +1773,28 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // Of course, if an assumed valid block is invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // First check if script executions have been cached with the same
+            // flags. Note that this assumes that the inputs provided are
+            // correct (ie that the transaction hash which is in tx's prevouts
+            // properly commits to the scriptPubKey in the inputs view of that
+            // transaction).
+            uint256 hashCacheEntry;
+            // We only use the first 19 bytes of nonce to avoid a second SHA
+            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            AssertLockHeld(cs_main); // The cache is only written under cs_main
+            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                return true;
+            }
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1574,8 +1806,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
+                        CScriptCheck check2(coin.out, tx, i,
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1589,6 +1821,12 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            if (cacheFullScriptStore && !pvChecks) {
+                // We executed all of the provided scripts, and were told to
+                // cache the result. Do so now.
+                scriptExecutionCache.insert(hashCacheEntry);
+            }
         }
     }
 
@@ -1624,18 +1862,46 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+/** Abort with a message */
+bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
+{
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        userMessage.empty() ? _("Error: A fatal internal error occurred, see debug.log for details") : userMessage,
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+    return false;
+}
+
+bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
+{
+    AbortNode(strMessage, userMessage);
+    return state.Error(strMessage);
+}
+
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    const char *pbegin, *pend;
+    std::shared_ptr<const CMappedFile> file = MapDiskRecord(pos, "rev", sizeof(uint256), pbegin, pend);
 
     // Read block
     uint256 hashChecksum;
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        if (file) {
+            CSpanReader filein(SER_DISK, CLIENT_VERSION, pbegin, pend);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenUndoFile failed", __func__);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -1651,60 +1917,36 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-/** Abort with a message */
-bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
-{
-    SetMiscWarning(strMessage);
-    LogPrintf("*** %s\n", strMessage);
-    uiInterface.ThreadSafeMessageBox(
-        userMessage.empty() ? _("Error: A fatal internal error occurred, see debug.log for details") : userMessage,
-        "", CClientUIInterface::MSG_ERROR);
-    StartShutdown();
-    return false;
-}
-
-bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
-{
-    AbortNode(strMessage, userMessage);
-    return state.Error(strMessage);
-}
-
-} // anon namespace
-
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ApplyTxInUndo(const Coin& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    Coin coin = undo;
+    if (coin.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
+    }
+    view.AddCoin(out, std::move(coin), !fClean);
 
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CBlockUndo* pblockundo, CUTXOStats* pstats)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1723,31 +1965,25 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetHash();
-        auto& txhash = hash;
+
+        bool is_coinbase = tx.IsCoinBase();
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || is_coinbase != coin.IsCoinBase())
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                if (pstats && is_spent)
+                    pstats->SpendCoin(out, coin);
+            }
         }
 
         // restore inputs
@@ -1757,42 +1993,12 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
+                const Coin &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
-            }
-
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
-                if (fAddressIndex) {
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-                    CTxDestination address;
-                    if (ExtractDestination(prevout.scriptPubKey, address)) {
-                        if(address.type() == typeid(CKeyID)) {
-                            addressIndex.push_back(std::make_pair(CAddressIndexKey(1, boost::get<CKeyID>(address), pindex->nHeight, i, txhash, j, false), prevout.nValue));
-                        } else if(address.type() == typeid(CScriptID)) {
-                            addressIndex.push_back(std::make_pair(CAddressIndexKey(2, boost::get<CScriptID>(address), pindex->nHeight, i, txhash, j, false), prevout.nValue));
-                        } else {
-                            continue;
-                        }
-                    }
-               }
-            }
-        }
-
-        for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            if (fAddressIndex) {
-                const CTxOut &out = tx.vout[k];
-                CTxDestination address;
-                if (ExtractDestination(out.scriptPubKey, address)) {
-                    if(address.type() == typeid(CKeyID)) {
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, boost::get<CKeyID>(address), pindex->nHeight, i, txhash, k, false), out.nValue));
-                    } else if(address.type() == typeid(CScriptID)) {
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(2, boost::get<CScriptID>(address), pindex->nHeight, i, txhash, k, false), out.nValue));
-                    } else {
-                        continue;
-                    }
-                }
+                // As restored, with the height older undo data leaves out
+                if (pstats && view.HaveCoin(out))
+                    pstats->AddCoin(out, view.AccessCoin(out));
             }
         }
     }
@@ -1800,17 +2006,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    if (pblockundo)
+        pblockundo->vtxundo.swap(blockUndo.vtxundo);
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
     }
 
-    if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to delete address index");
-        }
-    }
-
     return fClean;
 }
 
@@ -1846,9 +2049,78 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CForgerCheck> forgercheckqueue(32);
+
+void ThreadForgerCheck() {
+    RenameThread("bitcoin-forgerch");
+    forgercheckqueue.Thread();
+}
+
+bool CForgerCheck::operator()() {
+    return DPoS::GetInstance().CheckCoinbase(*coinbase, nTime);
+}
+
+static CCheckQueue<CTxInputsCheck> txinputscheckqueue(16);
+
+void ThreadTxInputsCheck() {
+    RenameThread("bitcoin-inputch");
+    txinputscheckqueue.Thread();
+}
+
+bool CTxInputsCheck::operator()() {
+    return Consensus::CheckTxInputs(*ptx, *pstate, vSpent, nSpendHeight, *pnTxFee);
+}
+
+static CCheckQueue<CCoinFetch> coinfetchqueue(16);
+
+void ThreadCoinFetch() {
+    RenameThread("bitcoin-coinfetch");
+    coinfetchqueue.Thread();
+}
+
+bool CCoinFetch::operator()() {
+    *pfFound = pview->GetCoin(outpoint, *pcoin);
+    return true;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
+/** The script verification flags blocks on top of pindex->pprev are checked with. */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams)
+{
+    AssertLockHeld(cs_main);
+
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rule
+    if (pindex->nHeight >= consensusparams.BIP66Height) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
+    if (pindex->nHeight >= consensusparams.BIP65Height) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindex->pprev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindex->pprev, consensusparams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
 {
     LOCK(cs_main);
@@ -1886,26 +2158,111 @@ public:
                ((pindex->nVersion >> bit) & 1) != 0 &&
                ((ComputeBlockVersion(pindex->pprev, params) >> bit) & 1) == 0;
     }
+
+    uint256 GetParamsHash(const Consensus::Params& params) const
+    {
+        // The condition depends on the versions the deployments make
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << AbstractThresholdConditionChecker::GetParamsHash(params) << bit;
+        for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++)
+            ss << VersionBitsCacheRecord(NULL, params, (Consensus::DeploymentPos)i, versionbitscache).hashParams;
+        return ss.GetHash();
+    }
 };
 
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
-static int64_t nTimeCheck = 0;
-static int64_t nTimeForks = 0;
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
-static int64_t nTimeTotal = 0;
+/** Id of the first warning bit cache in the block tree database, those of the deployments come before */
+static const uint8_t THRESHOLD_CACHE_WARNING_BITS = 0x80;
+// The threshold cache records on disk, protected by cs_main
+static std::map<uint8_t, ThresholdCacheRecord> mapThresholdCacheWritten;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+/** Write the records of the threshold caches that changed since they were last written */
+static bool WriteThresholdCaches(const Consensus::Params& params)
 {
     AssertLockHeld(cs_main);
+    std::vector<std::pair<uint8_t, ThresholdCacheRecord> > vRecords;
+    for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++)
+        vRecords.push_back(std::make_pair(i, VersionBitsCacheRecord(chainActive.Tip(), params, (Consensus::DeploymentPos)i, versionbitscache)));
+    for (int bit = 0; bit < VERSIONBITS_NUM_BITS; bit++)
+        vRecords.push_back(std::make_pair(THRESHOLD_CACHE_WARNING_BITS + bit, WarningBitsConditionChecker(bit).GetCacheRecord(chainActive.Tip(), params, warningcache[bit])));
+
+    std::vector<std::pair<uint8_t, ThresholdCacheRecord> > vChanged;
+    for (const std::pair<uint8_t, ThresholdCacheRecord>& record : vRecords) {
+        std::map<uint8_t, ThresholdCacheRecord>::const_iterator it = mapThresholdCacheWritten.find(record.first);
+        if (it == mapThresholdCacheWritten.end() || it->second != record.second)
+            vChanged.push_back(record);
+    }
+    if (vChanged.empty())
+        return true;
+    if (!pblocktree->WriteThresholdCaches(vChanged))
+        return false;
+    for (const std::pair<uint8_t, ThresholdCacheRecord>& record : vChanged)
+        mapThresholdCacheWritten[record.first] = record.second;
+    return true;
+}
+
+/** Restore the threshold caches from the block tree database, once the block index is loaded */
+static void LoadThresholdCaches(const Consensus::Params& params)
+{
+    std::function<const CBlockIndex*(const uint256&)> lookup = [](const uint256& hash) -> const CBlockIndex* {
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        return it == mapBlockIndex.end() ? NULL : it->second;
+    };
+    ThresholdCacheRecord record;
+    for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++) {
+        if (pblocktree->ReadThresholdCache(i, record) && LoadVersionBitsCacheRecord(record, params, (Consensus::DeploymentPos)i, versionbitscache, lookup))
+            mapThresholdCacheWritten[i] = record;
+    }
+    for (int bit = 0; bit < VERSIONBITS_NUM_BITS; bit++) {
+        if (pblocktree->ReadThresholdCache(THRESHOLD_CACHE_WARNING_BITS + bit, record) &&
+            WarningBitsConditionChecker(bit).LoadCacheRecord(record, params, warningcache[bit], lookup))
+            mapThresholdCacheWritten[THRESHOLD_CACHE_WARNING_BITS + bit] = record;
+    }
+}
+
+static int64_t nTimeCheck = 0;
+static int64_t nTimeForks = 0;
+static int64_t nTimeVerify = 0;
+static int64_t nTimeConnect = 0;
+static int64_t nTimeIndex = 0;
+static int64_t nTimeCallbacks = 0;
+static int64_t nTimeTotal = 0;
+
+/** The highest block of the best header chain whose hash is in the DPoS block hash table, or NULL */
+static const CBlockIndex* GetCheckpointedHeader(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    static const CBlockIndex* pindexBestHeaderLast = NULL;
+    static const CBlockIndex* pindexCheckpoint = NULL;
+    if (pindexBestHeader == pindexBestHeaderLast)
+        return pindexCheckpoint;
+
+    pindexBestHeaderLast = pindexBestHeader;
+    pindexCheckpoint = NULL;
+    if (pindexBestHeader == NULL || chainparams.NetworkIDString() != "main")
+        return NULL;
+
+    for (int64_t nHeight = DPoS::GetBlockHashCheckpointHeight(pindexBestHeader->nHeight); nHeight >= 0;
+         nHeight = DPoS::GetBlockHashCheckpointHeight(nHeight - 1)) {
+        const CBlockIndex* pindex = pindexBestHeader->GetAncestor(nHeight);
+        if (DPoS::FastCheckBlockHash(pindex->GetBlockHash(), nHeight) == 1) {
+            pindexCheckpoint = pindex;
+            break;
+        }
+    }
+
+    return pindexCheckpoint;
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CDPoSBlockDelta* pdposdelta, CUTXOStats* pstats)
+{
+    AssertLockHeld(cs_main);
+
+    int64_t nTimeStart = GetTimeMicros();
 
-    int64_t nTimeStart = GetTimeMicros();
-
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
@@ -1948,6 +2305,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
+    if (fScriptChecks && fCheckpointSync) {
+        // Ancestors of a header with a hash from the DPoS block hash table are verified in the same way,
+        //  only the script checks are skipped, coins, undo data and the vote state are still updated.
+        const CBlockIndex* pcheckpoint = GetCheckpointedHeader(chainparams);
+        if (pcheckpoint && pcheckpoint->GetAncestor(pindex->nHeight) == pindex)
+            fScriptChecks = false;
+    }
+
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
 
@@ -1979,65 +2344,53 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rule
-    if (pindex->nHeight >= chainparams.GetConsensus().BIP66Height) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
-    if (pindex->nHeight >= chainparams.GetConsensus().BIP65Height) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) using versionbits logic.
     int nLockTimeFlags = 0;
     if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
-
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
     CBlockUndo blockundo;
 
+    // The input checks of each transaction only depend on the outputs it spends, which are
+    // resolved in order below and then checked in parallel with the other transactions.
+    std::vector<CValidationState> vInputsState(block.vtx.size());
+    std::vector<CAmount> vTxFee(block.vtx.size(), 0);
+    std::vector<CTxInputsCheck> vInputsChecks;
+    CCheckQueueControl<CTxInputsCheck> inputscontrol(nScriptCheckThreads ? &txinputscheckqueue : NULL);
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // Transactions whose scripts already passed under flags when they entered the mempool are
+    // not checked again, the others reuse the signature hash data computed for the mempool.
+    std::vector<std::shared_ptr<PrecomputedTransactionData>> txdata;
+    txdata.reserve(block.vtx.size());
+    if (pdposdelta) {
+        pdposdelta->vTxFee.assign(block.vtx.size(), 0);
+        pdposdelta->vSender.assign(block.vtx.size(), CKeyID());
+    }
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
-        const uint256 txhash = tx.GetHash();
 
         nInputs += tx.vin.size();
 
@@ -2051,8 +2404,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // BIP68 lock checks (as opposed to nLockTime checks) must
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
+            std::vector<Consensus::CSpentOutput> vSpent;
+            vSpent.reserve(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                const Coin& coin = view.AccessCoin(tx.vin[j].prevout);
+                prevheights[j] = coin.nHeight;
+                vSpent.push_back(Consensus::CSpentOutput(coin));
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -2061,20 +2418,25 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
 
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
-                if (fAddressIndex) {
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-                    CTxDestination address;
-                    if (ExtractDestination(prevout.scriptPubKey, address)) {
-                        if(address.type() == typeid(CKeyID)) {
-                            addressIndex.push_back(std::make_pair(CAddressIndexKey(1, boost::get<CKeyID>(address), pindex->nHeight, i, txhash, j, false), prevout.nValue));
-                        } else if(address.type() == typeid(CScriptID)) {
-                            addressIndex.push_back(std::make_pair(CAddressIndexKey(2, boost::get<CScriptID>(address), pindex->nHeight, i, txhash, j, false), prevout.nValue));
-                        } else {
-                            continue;
-                        }
-                    }
-               }
+                const Consensus::CSpentOutput& spent = vSpent[j];
+                if (pdposdelta) {
+                    AddDPoSSpend(*pdposdelta, tx, i, j, spent);
+                }
+            }
+
+            CTxInputsCheck check(tx, vSpent, pindex->nHeight, &vInputsState[i], &vTxFee[i]);
+            if (nScriptCheckThreads) {
+                vInputsChecks.push_back(CTxInputsCheck());
+                check.swap(vInputsChecks.back());
+                // Hand the checks over in runs, a single transaction's are too little work
+                if (vInputsChecks.size() >= 16) {
+                    inputscontrol.Add(vInputsChecks);
+                    vInputsChecks.clear();
+                }
+            } else if (!check()) {
+                state = vInputsState[i];
+                return error("ConnectBlock(): CheckTxInputs on %s failed with %s",
+                    tx.GetHash().ToString(), FormatStateMessage(state));
             }
         }
 
@@ -2087,44 +2449,62 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
 
-        txdata.emplace_back(tx);
+        std::shared_ptr<PrecomputedTransactionData> ptxdata;
+        bool fScriptsVerified = !tx.IsCoinBase() && fScriptChecks && mempool.GetScriptsVerified(tx, flags, ptxdata);
+        if (!ptxdata)
+            ptxdata = std::make_shared<PrecomputedTransactionData>(tx);
+        txdata.push_back(ptxdata);
         if (!tx.IsCoinBase())
         {
-            nFees += view.GetValueIn(tx)-tx.GetValueOut();
-
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks && !fScriptsVerified, flags, fCacheResults, fCacheResults, *txdata[i], nScriptCheckThreads ? &vChecks : NULL, false))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
         }
 
-        for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            if (fAddressIndex) {
-                const CTxOut &out = tx.vout[k];
-                CTxDestination address;
-                if (ExtractDestination(out.scriptPubKey, address)) {
-                    if(address.type() == typeid(CKeyID)) {
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, boost::get<CKeyID>(address), pindex->nHeight, i, txhash, k, false), out.nValue));
-                    } else if(address.type() == typeid(CScriptID)) {
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(2, boost::get<CScriptID>(address), pindex->nHeight, i, txhash, k, false), out.nValue));
-                    } else {
-                        continue;
-                    }
-                }
-            }
-        }
+        if (pdposdelta)
+            AddDPoSOutputs(*pdposdelta, tx, i);
 
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        if (pstats && tx.IsCoinBase()) {
+            // The two duplicate coinbases BIP30 exempts overwrite the outputs of the first ones
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                COutPoint out(tx.GetHash(), o);
+                if (!tx.vout[o].scriptPubKey.IsUnspendable() && view.HaveCoin(out))
+                    pstats->SpendCoin(out, view.AccessCoin(out));
+            }
+        }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        if (pstats) {
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo.back();
+                for (size_t j = 0; j < tx.vin.size(); j++)
+                    pstats->SpendCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                    pstats->AddCoin(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase()));
+            }
+        }
+    }
+    inputscontrol.Add(vInputsChecks);
+    if (!inputscontrol.Wait()) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            if (!vInputsState[i].IsValid()) {
+                state = vInputsState[i];
+                return error("ConnectBlock(): CheckTxInputs on %s failed with %s",
+                    block.vtx[i]->GetHash().ToString(), FormatStateMessage(state));
+            }
+        }
     }
+    for (const CAmount& nTxFee : vTxFee)
+        nFees += nTxFee;
+
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
 
@@ -2162,16 +2542,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-    }
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2186,10 +2556,48 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
+    TRACE10(validation, block_connected, pindex->phashBlock->begin(), pindex->nHeight, (uint64_t)block.vtx.size(), nInputs,
+            nTime1 - nTimeStart, nTime2 - nTime1, nTime3 - nTime2, nTime4 - nTime3, nTime5 - nTime4, nTime6 - nTime5);
 
     return true;
 }
 
+CMemoryUsageStats GetMemoryUsageStats()
+{
+    LOCK(cs_main);
+    CMemoryUsageStats stats;
+    stats.nCoinsCache = pcoinsTip ? pcoinsTip->DynamicMemoryUsage() : 0;
+    stats.nVoteCache = Vote::GetInstance().DynamicMemoryUsage();
+    stats.nMempool = mempool.DynamicMemoryUsage();
+    stats.nBlockIndex = memusage::DynamicUsage(mapBlockIndex) + mapBlockIndex.size() * memusage::MallocUsage(sizeof(CBlockIndex));
+    stats.nSigCache = GetSignatureCacheStats().nUsage;
+    stats.nRawBlockCache = rawBlockCache.Bytes();
+
+    size_t nMempoolMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    size_t nMempoolMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
+    SplitMemoryBudget(stats, nMaxMemoryUsage, nCoinCacheUsage, nMempoolMax, nMempoolMin);
+    return stats;
+}
+
+void SplitMemoryBudget(CMemoryUsageStats& stats, size_t nMaxMemory, size_t nCoinsMax, size_t nMempoolMax, size_t nMempoolMin)
+{
+    stats.nCoinsLimit = nCoinsMax;
+    stats.nMempoolLimit = nMempoolMax;
+    size_t nFixed = stats.nBlockIndex + stats.nSigCache + stats.nRawBlockCache;
+    size_t nSpace = nMaxMemory > nFixed ? nMaxMemory - nFixed : 0;
+    if (nMaxMemory > 0 && nSpace < nCoinsMax + nMempoolMax) {
+        double dShare = (double)nSpace / (nCoinsMax + nMempoolMax);
+        // The mempool keeps room for a full package of descendants, the coins cache what -dbcache allows at least
+        stats.nMempoolLimit = std::max<size_t>(nMempoolMax * dShare, std::min(nMempoolMin, nMempoolMax));
+        stats.nCoinsLimit = std::max<size_t>(nCoinsMax * dShare, nMinDbCache << 20);
+    }
+}
+
+size_t GetMempoolSizeLimit()
+{
+    return std::min<size_t>(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, nMempoolMemoryLimit);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2232,9 +2640,16 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-    int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() * DB_PEAK_USAGE_FACTOR;
-    int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+    CMemoryUsageStats usage = GetMemoryUsageStats();
+    nMempoolMemoryLimit = usage.nMempoolLimit;
+    if (usage.nMempool > usage.nMempoolLimit) {
+        LogPrint("mempool", "Trimming the memory pool to %u bytes of -maxmemory\n", usage.nMempoolLimit);
+        LimitMempoolSize(mempool, usage.nMempoolLimit, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        nMempoolUsage = mempool.DynamicMemoryUsage();
+    }
+    int64_t nMempoolSizeMax = usage.nMempoolLimit;
+    int64_t cacheSize = (usage.nCoinsCache + usage.nVoteCache) * DB_PEAK_USAGE_FACTOR;
+    int64_t nTotalSpace = usage.nCoinsLimit + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
     // The cache is large and we're within 10% and 200 MiB or 50% and 50MiB of the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::min(std::max(nTotalSpace / 2, nTotalSpace - MIN_BLOCK_COINSDB_USAGE * 1024 * 1024),
                                                                             std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024));
@@ -2246,6 +2661,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // Only a cache that has outgrown its memory has to be emptied. Otherwise write
+    // just its dirty entries and keep the rest, so the next blocks do not run cold.
+    // The periodic write of the block index does the same, which keeps the amount
+    // of dirty state (and with it the stall of a full flush) small.
+    bool fEvictCache = fCacheLarge || fCacheCritical;
+    bool fWriteChainState = fDoFullFlush || fPeriodicWrite;
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
@@ -2267,29 +2688,46 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
                 vBlocks.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks) || !WriteThresholdCaches(chainparams.GetConsensus())) {
                 return AbortNode(state, "Failed to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
-    if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+    if (fWriteChainState) {
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // The best block is written in the same batch as the coins, so the
+        // database is consistent whether the cache is emptied or not.
+        uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+        size_t nCoins = pcoinsTip->GetCacheSize();
+        size_t nCoinsUsage = pcoinsTip->DynamicMemoryUsage();
+        int64_t nFlushStart = GetTimeMicros();
+        if (fUTXOStatsTip)
+            pcoinsTip->SetStats(utxostatsTip);
+        if (!(fEvictCache ? pcoinsTip->Flush() : pcoinsTip->Sync()))
             return AbortNode(state, "Failed to write to coin database");
+        int64_t nCoinsFlushed = GetTimeMicros();
+        // Flush the vote state of the same block, so both are replayed from the same point after a crash.
+        // During a DPoS repair it is of another block, which the repair flushes itself when interrupted.
+        BlockMap::iterator itBest = mapBlockIndex.find(hashBestBlock);
+        if (!fDPoSRepairing && itBest != mapBlockIndex.end() && !Vote::GetInstance().Flush(itBest->second->nHeight, hashBestBlock, fEvictCache))
+            return AbortNode(state, "Failed to write to vote database");
         nLastFlush = nNow;
+        TRACE6(validation, state_flushed, (int)mode, fEvictCache, (uint64_t)nCoins, (uint64_t)nCoinsUsage,
+               nCoinsFlushed - nFlushStart, GetTimeMicros() - nCoinsFlushed);
     }
+    // Finally remove any pruned files, once the coins and the vote state no
+    // longer need their blocks to be replayed after a crash
+    if (fFlushForPrune)
+        UnlinkPrunedFiles(setFilesToPrune);
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -2312,12 +2750,77 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+void LoadUTXOStats()
+{
+    LOCK(cs_main);
+    fUTXOStatsTip = false;
+    // The cache may be ahead of the database
+    if (pcoinsTip->GetStats(utxostatsTip) && utxostatsTip.hashBlock == pcoinsTip->GetBestBlock()) {
+        fUTXOStatsTip = true;
+        return;
+    }
+
+    FlushStateToDisk();
+    LogPrintf("Computing the statistics of the unspent outputs...\n");
+    int64_t nStart = GetTimeMillis();
+    CUTXOStats stats;
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+    stats.hashBlock = pcursor->GetBestBlock();
+    for (; pcursor->Valid(); pcursor->Next()) {
+        if (ShutdownRequested())
+            return;
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            LogPrintf("%s: unable to read value, gettxoutsetinfo will scan the chainstate\n", __func__);
+            return;
+        }
+        stats.AddCoin(key, coin);
+    }
+    utxostatsTip = stats;
+    fUTXOStatsTip = true;
+    LogPrintf("Computed the statistics of %u unspent outputs in %dms\n", stats.nTransactionOutputs, GetTimeMillis() - nStart);
+}
+
+bool GetTipUTXOStats(CUTXOStats& stats)
+{
+    AssertLockHeld(cs_main);
+    if (!fUTXOStatsTip)
+        return false;
+    stats = utxostatsTip;
+    return true;
+}
+
 std::string strOldBlockHash;
 int64_t nOldBlockHeight = 0;
 
+//! Only accessed through std::atomic_load and std::atomic_store
+static std::shared_ptr<const CChainTipSnapshot> pChainTipSnapshot = std::make_shared<const CChainTipSnapshot>(CChainTipSnapshot{NULL, -1, uint256(), 0, 0});
+
+/** Publish the tip of chainActive to the readers without cs_main */
+static void PublishChainTip()
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindex = chainActive.Tip();
+    CChainTipSnapshot snapshot{pindex, -1, uint256(), 0, 0};
+    if (pindex) {
+        snapshot.nHeight = pindex->nHeight;
+        snapshot.hashTip = pindex->GetBlockHash();
+        snapshot.nTime = pindex->GetBlockTime();
+        snapshot.nMedianTimePast = pindex->GetMedianTimePast();
+    }
+    std::atomic_store(&pChainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(std::make_shared<const CChainTipSnapshot>(snapshot)));
+}
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&pChainTipSnapshot);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    PublishChainTip();
 
     // New best block
     mempool.AddTransactionsUpdated(1);
@@ -2394,14 +2897,20 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CBlockUndo blockundo;
+        CUTXOStats stats = utxostatsTip;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &blockundo, fUTXOStatsTip ? &stats : NULL))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
 
-        ProcessDPoSDisconnectBlock(block, pindexDelete->nHeight);
+        ProcessDPoSDisconnectBlock(block, blockundo, pindexDelete->nHeight);
         bool flushed = view.Flush();
         assert(flushed);
+        stats.hashBlock = pindexDelete->pprev->GetBlockHash();
+        utxostatsTip = stats;
     }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    int64_t nDisconnectTime = GetTimeMicros() - nStart;
+    LogPrint("bench", "- Disconnect block: %.2fms\n", nDisconnectTime * 0.001);
+    TRACE3(validation, block_disconnected, pindexDelete->phashBlock->begin(), pindexDelete->nHeight, nDisconnectTime);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
@@ -2442,6 +2951,11 @@ static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
+static int64_t nTimeDPoSCheck = 0;
+static int64_t nTimeDPoSBalance = 0;
+static int64_t nTimeDPoSVoting = 0;
+static int64_t nTimeDPoSNotify = 0;
+static uint64_t nBlocksConnected = 0;
 
 /**
  * Used to track blocks whose transactions were applied to the UTXO state as a
@@ -2459,7 +2973,105 @@ struct ConnectTrace {
  * pblock) - if that is not intended, care must be taken to remove the last entry in
  * blocksConnected in case of failure.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace)
+/**
+ * Read the blocks to connect and verify their forger signatures on the forger check queue.
+ * Returns whether all of them passed, the blocks read so far are handed back in vpblock.
+ */
+static bool CheckForgerSignatures(const std::vector<CBlockIndex*>& vpindex, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock,
+    std::vector<std::shared_ptr<const CBlock>>& vpblock, const CChainParams& chainparams)
+{
+    vpblock.assign(vpindex.size(), std::shared_ptr<const CBlock>());
+    if (nScriptCheckThreads == 0)
+        return false;
+
+    CCheckQueueControl<CForgerCheck> control(&forgercheckqueue);
+    std::vector<CForgerCheck> vChecks;
+    vChecks.reserve(vpindex.size());
+    for (size_t i = 0; i < vpindex.size(); i++) {
+        if (vpindex[i] == pindexMostWork && pblock) {
+            vpblock[i] = pblock;
+        } else {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockRead, vpindex[i], chainparams.GetConsensus()))
+                return false;
+            vpblock[i] = pblockRead;
+        }
+
+        // The genesis block has no forger, DPoS::CheckBlock does not verify it
+        if (vpblock[i]->vtx.empty() || vpblock[i]->hashPrevBlock.IsNull())
+            return false;
+        vChecks.push_back(CForgerCheck(vpblock[i]->vtx[0], vpblock[i]->nTime));
+    }
+
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+/** Fewer outputs to read than this are left to ConnectBlock's own cache misses */
+static const size_t MIN_PREFETCH_INPUTS = 16;
+
+/**
+ * Read the outputs the block spends that are not in the tip's cache from the
+ * database, in parallel, and cache them. ConnectBlock then resolves its inputs
+ * without waiting on one database read after the other, which is what bounds a
+ * cold cache during the initial download and reindexing.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    // Outputs created by the block itself are not in the database yet
+    std::set<uint256> setBlockTxids;
+    for (const CTransactionRef& tx : block.vtx)
+        setBlockTxids.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutpoints;
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash) && !cache.HaveEntryInCache(txin.prevout))
+                vOutpoints.push_back(txin.prevout);
+        }
+    }
+    std::sort(vOutpoints.begin(), vOutpoints.end());
+    vOutpoints.erase(std::unique(vOutpoints.begin(), vOutpoints.end()), vOutpoints.end());
+    if (vOutpoints.size() < MIN_PREFETCH_INPUTS)
+        return;
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::vector<char> vFound(vOutpoints.size(), 0);
+    std::vector<CCoinFetch> vFetches;
+    vFetches.reserve(vOutpoints.size());
+    for (size_t i = 0; i < vOutpoints.size(); i++)
+        vFetches.push_back(CCoinFetch(cache.GetBackend(), vOutpoints[i], &vCoins[i], &vFound[i]));
+    CCheckQueueControl<CCoinFetch> control(&coinfetchqueue);
+    control.Add(vFetches);
+    control.Wait();
+
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (vFound[i])
+            cache.CacheFetchedCoin(vOutpoints[i], std::move(vCoins[i]));
+    }
+    LogPrint("bench", "  - Prefetch %u inputs: %.2fms\n", vOutpoints.size(), (GetTimeMicros() - nStart) * 0.001);
+}
+
+/** The cache ConnectTip applies each block to, kept so its map is not regrown every block */
+static std::unique_ptr<CCoinsViewCache> pcoinsConnectTipView;
+
+/** The ConnectTip cache over pcoinsTip, emptied of what a failed block left in it */
+static CCoinsViewCache& GetConnectTipView()
+{
+    if (!pcoinsConnectTipView || pcoinsConnectTipView->GetBackend() != pcoinsTip)
+        pcoinsConnectTipView.reset(new CCoinsViewCache(pcoinsTip));
+    pcoinsConnectTipView->Reset();
+    return *pcoinsConnectTipView;
+}
+
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, bool fForgerChecked = false)
 {
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
@@ -2478,11 +3090,14 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     const CBlock& blockConnecting = *connectTrace.blocksConnected.back().second;
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
-    int64_t nTime3;
+    int64_t nTime3, nTimeDPoSChecks;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(blockConnecting, *pcoinsTip);
     {
-        CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        CCoinsViewCache& view = GetConnectTipView();
+        CDPoSBlockDelta dposdelta;
+        CUTXOStats stats = utxostatsTip;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, &dposdelta, fUTXOStatsTip ? &stats : NULL);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2490,19 +3105,24 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
 
-        if( !DPoS::GetInstance().CheckBlock(*pindexNew, true) ) {
+        int64_t nTimeDPoSStart = GetTimeMicros();
+        if( !DPoS::GetInstance().CheckBlock(*pindexNew, blockConnecting, true, !fForgerChecked) ) {
             state.DoS(50, false, REJECT_INVALID, "DPoS CheckBlock hash error");
             InvalidBlockFound(pindexNew, state);
             LogPrintf("ConnectTip(): DPoS CheckBlock hash: %s error\n", pindexNew->GetBlockHash().ToString().c_str());
             return error("ConnectTip(): DPoS CheckBlock hash: %s error\n", pindexNew->GetBlockHash().ToString());
         }
+        nTimeDPoSChecks = GetTimeMicros() - nTimeDPoSStart; nTimeDPoSCheck += nTimeDPoSChecks;
+        LogPrint("bench", "    - DPoS checks: %.2fms [%.2fs]\n", nTimeDPoSChecks * 0.001, nTimeDPoSCheck * 0.000001);
 
-        ProcessDPoSConnectBlock(blockConnecting, pindexNew->nHeight);
+        ProcessDPoSConnectBlock(blockConnecting, dposdelta, pindexNew->nHeight);
 
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
-        bool flushed = view.Flush();
+        bool flushed = view.Flush(false);
         assert(flushed);
+        stats.hashBlock = pindexNew->GetBlockHash();
+        utxostatsTip = stats;
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -2515,13 +3135,31 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
+    // Peers ask for a new block right away; blocks connected while catching up are not worth keeping.
+    if (!IsInitialBlockDownload())
+        rawBlockCache.Insert(blockConnecting);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    TRACE8(validation, tip_connected, pindexNew->phashBlock->begin(), pindexNew->nHeight, nTime2 - nTime1,
+           nTimeDPoSChecks, nTime3 - nTime2, nTime4 - nTime3, nTime5 - nTime4, nTime6 - nTime5);
+    nBlocksConnected++;
     return true;
 }
 
+/** Log the totals of the -debug=bench timings of ConnectTip, per phase */
+static void LogConnectBenchTotals()
+{
+    if (nBlocksConnected == 0)
+        return;
+    LogPrint("bench", "Connected %u blocks in %.2fs (%.2fms/block): load %.2fs, inputs %.2fs, scripts %.2fs, DPoS checks %.2fs, "
+        "DPoS balances %.2fs, voting %.2fs, DPoS notifications %.2fs, index writing %.2fs, flush %.2fs, chainstate %.2fs, postprocess %.2fs\n",
+        nBlocksConnected, nTimeTotal * 0.000001, nTimeTotal * 0.001 / nBlocksConnected, nTimeReadFromDisk * 0.000001, nTimeConnect * 0.000001,
+        (nTimeVerify - nTimeConnect) * 0.000001, nTimeDPoSCheck * 0.000001, nTimeDPoSBalance * 0.000001, nTimeDPoSVoting * 0.000001,
+        nTimeDPoSNotify * 0.000001, nTimeIndex * 0.000001, nTimeFlush * 0.000001, nTimeChainState * 0.000001, nTimePostConnect * 0.000001);
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2630,9 +3268,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         }
         nHeight = nTargetHeight;
 
+        // Verify the forger signatures of the batch in parallel, only the checks depending on the previous block stay serial
+        std::vector<std::shared_ptr<const CBlock>> vpblockToConnect;
+        bool fForgerChecked = CheckForgerSignatures(vpindexToConnect, pindexMostWork, pblock, vpblockToConnect, chainparams);
+
         // Connect new blocks.
-        BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-               if(!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
+        for (size_t i = vpindexToConnect.size(); i-- > 0; ) {
+               CBlockIndex *pindexConnect = vpindexToConnect[i];
+               if(!ConnectTip(state, chainparams, pindexConnect, vpblockToConnect[i], connectTrace, fForgerChecked)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2660,7 +3303,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
     if (fBlocksDisconnected) {
         mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        LimitMempoolSize(mempool, GetMempoolSizeLimit(), GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     }
     mempool.check(pcoinsTip);
 
@@ -2718,6 +3361,10 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         CBlockIndex *pindexOldTip;
         {
             LOCK(cs_main);
+            // The startup DPoS repair applies blocks of the active chain without holding
+            // cs_main throughout; ThreadImport activates the best chain after it
+            if (fDPoSRepairing)
+                return true;
             { // TODO: Tempoarily ensure that mempool removals are notified before
               // connected transactions.  This shouldn't matter, but the abandoned
               // state of transactions in our wallet is currently cleared when we
@@ -2754,12 +3401,14 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
             } // MemPoolConflictRemovalTracker destroyed and conflict evictions are notified
 
             // Transactions in the connnected block are notified
+            GetMainSignals().BeginBlockTransactions();
             for (const auto& pair : connectTrace.blocksConnected) {
                 assert(pair.second);
                 const CBlock& block = *(pair.second);
                 for (unsigned int i = 0; i < block.vtx.size(); i++)
                     GetMainSignals().SyncTransaction(*block.vtx[i], pair.first, i);
             }
+            GetMainSignals().EndBlockTransactions();
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
 
@@ -2772,6 +3421,13 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         if (pindexFork != pindexNewTip) {
             uiInterface.NotifyBlockTip(fInitialDownload, pindexNewTip);
         }
+
+        int nStopAtHeight = GetArg("-stopatheight", DEFAULT_STOPATHEIGHT);
+        if (nStopAtHeight && pindexNewTip && pindexNewTip->nHeight >= nStopAtHeight && !ShutdownRequested()) {
+            LogPrintf("Stopping at height %d\n", pindexNewTip->nHeight);
+            LogConnectBenchTotals();
+            StartShutdown();
+        }
     } while (pindexNewTip != pindexMostWork);
     CheckBlockIndex(chainparams.GetConsensus());
 
@@ -2816,6 +3472,8 @@ bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIn
 bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex)
 {
     AssertLockHeld(cs_main);
+    if (fDPoSRepairing)
+        return state.Error("the DPoS state is being repaired");
 
     // Mark the block itself as invalid.
     pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -2835,7 +3493,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         }
     }
 
-    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    LimitMempoolSize(mempool, GetMempoolSizeLimit(), GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
@@ -2895,8 +3553,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -2910,6 +3567,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
+    setBlockIndexLeaves.erase(pindexNew->pprev);
+    setBlockIndexLeaves.insert(pindexNew);
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -3007,16 +3666,16 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         vinfoBlockFile[nFile].nSize += nAddSize;
 
     if (!fKnown) {
-        unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
-        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
+        unsigned int nOldChunks = (pos.nPos + nBlockFileChunkSize - 1) / nBlockFileChunkSize;
+        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + nBlockFileChunkSize - 1) / nBlockFileChunkSize;
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            if (CheckDiskSpace(nNewChunks * nBlockFileChunkSize - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
+                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * nBlockFileChunkSize, pos.nFile);
+                    AllocateFileRange(file, pos.nPos, nNewChunks * nBlockFileChunkSize - pos.nPos);
                     fclose(file);
                 }
             }
@@ -3040,16 +3699,16 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
     setDirtyFileInfo.insert(nFile);
 
-    unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
-    unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
+    unsigned int nOldChunks = (pos.nPos + nUndoFileChunkSize - 1) / nUndoFileChunkSize;
+    unsigned int nNewChunks = (nNewSize + nUndoFileChunkSize - 1) / nUndoFileChunkSize;
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
+        if (CheckDiskSpace(nNewChunks * nUndoFileChunkSize - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
+                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * nUndoFileChunkSize, pos.nFile);
+                AllocateFileRange(file, pos.nPos, nNewChunks * nUndoFileChunkSize - pos.nPos);
                 fclose(file);
             }
         }
@@ -3554,8 +4213,31 @@ uint64_t CalculateCurrentUsage()
 }
 
 /* Prune a block file (modify associated database entries)*/
-void PruneOneBlockFile(const int fileNumber)
+/** Keep the coinbases of the round-start blocks of a block file that is about to be pruned */
+static bool WriteRoundCoinbases(const int fileNumber)
+{
+    DPoS& dpos = DPoS::GetInstance();
+    std::vector<std::pair<uint256, CTransactionRef> > vCoinbase;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile != fileNumber || !(pindex->nStatus & BLOCK_HAVE_DATA) || !dpos.IsRoundStart(pindex))
+            continue;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            return false;
+        vCoinbase.push_back(std::make_pair(pindex->GetBlockHash(), block.vtx[0]));
+    }
+    return vCoinbase.empty() || pblocktree->WriteRoundCoinbases(vCoinbase);
+}
+
+bool PruneOneBlockFile(const int fileNumber)
 {
+    // DPoS reads the delegates of a round from the coinbase of its first block
+    if (!WriteRoundCoinbases(fileNumber)) {
+        LogPrintf("Prune: %s failed to keep the round coinbases of blk%05u, keeping the file\n", __func__, fileNumber);
+        return false;
+    }
+
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
         CBlockIndex* pindex = it->second;
         if (pindex->nFile == fileNumber) {
@@ -3583,6 +4265,7 @@ void PruneOneBlockFile(const int fileNumber)
 
     vinfoBlockFile[fileNumber].SetNull();
     setDirtyFileInfo.insert(fileNumber);
+    return true;
 }
 
 
@@ -3590,12 +4273,31 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        // A map of a deleted file would keep its disk space in use.
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "blk"));
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "rev"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
 
+/**
+ * The last height whose blocks may be pruned: MIN_BLOCKS_TO_KEEP from the tip,
+ * and once DPoS runs no later than the last irreversible block, as the undo
+ * data of every block above it may still be needed to reorganize.
+ */
+static unsigned int GetLastBlockWeCanPrune()
+{
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    DPoS& dpos = DPoS::GetInstance();
+    if (chainActive.Tip()->nHeight > dpos.GetStartDPoSHeight()) {
+        uint64_t nIrreversibleHeight = std::max<uint64_t>(dpos.GetIrreversibleBlock().first, dpos.GetStartDPoSHeight());
+        nLastBlockWeCanPrune = std::min<uint64_t>(nLastBlockWeCanPrune, nIrreversibleHeight);
+    }
+    return nLastBlockWeCanPrune;
+}
+
 /* Calculate the block/rev files to delete based on height specified by user with RPC command pruneblockchain */
 void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
 {
@@ -3605,13 +4307,14 @@ void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeig
     if (chainActive.Tip() == NULL)
         return;
 
-    // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
-    unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
+    // last block to prune is the lesser of (user-specified height, the last one we can prune)
+    unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, GetLastBlockWeCanPrune());
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
         if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
             continue;
-        PruneOneBlockFile(fileNumber);
+        if (!PruneOneBlockFile(fileNumber))
+            continue;
         setFilesToPrune.insert(fileNumber);
         count++;
     }
@@ -3636,12 +4339,12 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
         return;
     }
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    unsigned int nLastBlockWeCanPrune = GetLastBlockWeCanPrune();
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
     // before the next pruning.
-    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBuffer = nBlockFileChunkSize + nUndoFileChunkSize;
     uint64_t nBytesToPrune;
     int count=0;
 
@@ -3659,7 +4362,8 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
-            PruneOneBlockFile(fileNumber);
+            if (!PruneOneBlockFile(fileNumber))
+                continue;
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
             nCurrentUsage -= nBytesToPrune;
@@ -3731,9 +4435,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3747,18 +4449,29 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork. The heights are dense, so the entries are counted
+    // into one bucket per height instead of sorting millions of them.
+    std::vector<size_t> vHeightStart;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        size_t nHeight = item.second->nHeight;
+        if (nHeight + 1 >= vHeightStart.size())
+            vHeightStart.resize(nHeight + 2, 0);
+        vHeightStart[nHeight + 1]++;
+    }
+    for (size_t i = 1; i < vHeightStart.size(); i++)
+        vHeightStart[i] += vHeightStart[i - 1];
+    std::vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    setBlockIndexLeaves.clear();
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
+        // A parent comes before its children, which take it out again
+        setBlockIndexLeaves.erase(pindex->pprev);
+        setBlockIndexLeaves.insert(pindex);
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
@@ -3830,15 +4543,14 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    LoadThresholdCaches(chainparams.GetConsensus());
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainTip();
 
     PruneBlockIndexCandidates();
 
@@ -3871,6 +4583,13 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         nCheckDepth = 1000000000; // suffices until the year 19000
     if (nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
+    // Blocks up to the irreversible one cannot be disconnected anymore, only the tail above it is verified
+    std::pair<uint64_t, uint256> irreversible = DPoS::GetInstance().GetIrreversibleBlock();
+    CBlockIndex* pindexIrreversible = irreversible.second.IsNull() ? NULL : chainActive[irreversible.first];
+    if (pindexIrreversible && pindexIrreversible->GetBlockHash() == irreversible.second && nCheckDepth > chainActive.Height() - pindexIrreversible->nHeight) {
+        nCheckDepth = std::max(1, chainActive.Height() - pindexIrreversible->nHeight);
+        LogPrintf("Irreversible block at height %d, verification limited to the last %i blocks\n", pindexIrreversible->nHeight, nCheckDepth);
+    }
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
     CCoinsViewCache coins(coinsview);
@@ -3953,6 +4672,19 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     return true;
 }
 
+bool BackgroundVerifyDB(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth)
+{
+    // pcoinsTip is at the tip under cs_main, unlike the coins database, which lags behind until a flush
+    if (CVerifyDB().VerifyDB(chainparams, pcoinsTip, nCheckLevel, nCheckDepth))
+        return true;
+
+    std::string strWarning = _("Warning: Corrupted block database detected, restart with -reindex to rebuild it");
+    SetMiscWarning(strWarning);
+    LogPrintf("*** %s\n", strWarning);
+    AlertNotify(strWarning);
+    return false;
+}
+
 bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
@@ -4045,6 +4777,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainTip();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -4055,14 +4788,14 @@ void UnloadBlockIndex()
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
+    mapThresholdCacheWritten.clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    setBlockIndexLeaves.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -4082,14 +4815,6 @@ bool InitBlockIndex(const CChainParams& chainparams)
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
-
-    // Use the provided setting for -addressindex in the new database
-    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
-    pblocktree->WriteFlag("addressindex", fAddressIndex);
-        
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4125,46 +4850,21 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // This takes over fileIn and closes it when done. The threads for
+        // script checks have nothing to do here, so as many hash blocks.
+        CBlockFileImporter importer(fileIn, chainparams.MessageStart(), nScriptCheckThreads);
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        uint64_t nBlockPos;
+        while (importer.Next(pblock, hash, nBlockPos)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
@@ -4579,10 +5279,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
 } instance_of_cmaincleanup;
 
@@ -4635,6 +5333,28 @@ bool IsVotingTxout(const CTxOut& txout, CScript& script)
     return true;
 };
 
+CAmount GetDPoSOpMinFee(uint8_t opcode)
+{
+    switch (opcode) {
+        case OP_REGISTE:
+            return OP_REGISTER_FORGER_FEE;
+        case OP_VOTE:
+            return OP_VOTE_FORGER_FEE;
+        case OP_REVOKE:
+            return OP_CANCEL_VOTE_FORGER_FEE;
+        case OP_REGISTE_COMMITTEE:
+            return OP_REGISTER_COMMITTEE_FEE;
+        case OP_VOTE_COMMITTEE:
+        case OP_REVOKE_COMMITTEE:
+            return OP_VOTE_COMMITTEE_FEE;
+        case OP_SUBMIT_BILL:
+            return OP_SUBMIT_BILL_FEE;
+        case OP_VOTE_BILL:
+            return OP_VOTE_BILL_FEE;
+    }
+    return 0;
+}
+
 bool ProcessRegiste(uint32_t nHeight, uint256 hash, const CKeyID& address, const CScript& script, bool fUndo)
 {
     CRegisterForgerData data;
@@ -4645,31 +5365,50 @@ bool ProcessRegiste(uint32_t nHeight, uint256 hash, const CKeyID& address, const
     return Vote::GetInstance().ProcessRegister(address, data.name, hash, nHeight, fUndo);
 }
 
-bool ProcessCancelVote(uint32_t nHeight, uint256 hash, const CKeyID& address, const CScript& script, bool fUndo)
+/** Record a vote or cancelvote that took effect for the listeners of DPoSVotes */
+static void AddVoteOp(CDPoSVoteEvent* pevent, uint256 hash, const CKeyID& address, bool fVote, const CDPoSKeys& delegates)
 {
-    CCancelVoteForgerData data;
-    if(DataToStruct(data, script) == false) {
-        LogPrintf("ProcessRegister: hash:%s Scripte Error", hash.ToString().c_str());
+    if(pevent == NULL)
+        return;
+    CDPoSVoteOp op;
+    op.txid = hash;
+    op.voter = address;
+    op.fVote = fVote;
+    op.vDelegates.assign(delegates.begin(), delegates.end());
+    pevent->vOps.push_back(op);
+}
+
+bool ProcessCancelVote(uint32_t nHeight, uint256 hash, const CKeyID& address, const unsigned char* pbegin, const unsigned char* pend, bool fUndo, CDPoSVoteEvent* pevent = NULL)
+{
+    CDPoSKeys delegates;
+    if(!ParseDPoSKeys(delegates, pbegin, pend)) {
+        LogPrintfThrottled(60, "ProcessCancelVote: hash:%s Scripte Error\n", hash.ToString().c_str());
         return false;
     }
-    return Vote::GetInstance().ProcessCancelVote(address, data.forgers, hash, nHeight, fUndo);
+    if(!Vote::GetInstance().ProcessCancelVote(address, delegates, hash, nHeight, fUndo))
+        return false;
+    AddVoteOp(pevent, hash, address, false, delegates);
+    return true;
 }
 
-bool ProcessVote(uint32_t nHeight, uint256 hash, const CKeyID& address, const CScript& script, bool fUndo)
+bool ProcessVote(uint32_t nHeight, uint256 hash, const CKeyID& address, const unsigned char* pbegin, const unsigned char* pend, bool fUndo, CDPoSVoteEvent* pevent = NULL)
 {
-    CVoteForgerData data;
-    if(DataToStruct(data, script) == false) {
-        LogPrintf("ProcessVote: hash:%s Scripte Error", hash.ToString().c_str());
+    CDPoSKeys delegates;
+    if(!ParseDPoSKeys(delegates, pbegin, pend)) {
+        LogPrintfThrottled(60, "ProcessVote: hash:%s Scripte Error\n", hash.ToString().c_str());
         return false;
     }
-    return Vote::GetInstance().ProcessVote(address, data.forgers, hash, nHeight, fUndo);
+    if(!Vote::GetInstance().ProcessVote(address, delegates, hash, nHeight, fUndo))
+        return false;
+    AddVoteOp(pevent, hash, address, true, delegates);
+    return true;
 }
 
 bool ProcessVoteBill(uint32_t nHeight, uint256 hash, const CKeyID& address, const CScript& script, bool fUndo)
 {
     CVoteBillData data;
     if(DataToStruct(data, script) == false) {
-        LogPrintf("VoteBill: hash:%s Scripte Error", hash.ToString().c_str());
+        LogPrintfThrottled(60, "VoteBill: hash:%s Scripte Error\n", hash.ToString().c_str());
         return false;
     }
     return Vote::GetInstance().GetBill().Vote(address, data.id, data.index, hash, nHeight, fUndo);
@@ -4679,7 +5418,7 @@ bool ProcessVoteCommittee(uint32_t nHeight, uint256 hash, const CKeyID& address,
 {
     CVoteCommitteeData data;
     if(DataToStruct(data, script) == false) {
-        LogPrintf("VoteCommittee: hash:%s Scripte Error", hash.ToString().c_str());
+        LogPrintfThrottled(60, "VoteCommittee: hash:%s Scripte Error\n", hash.ToString().c_str());
         return false;
     }
     if(fVote)
@@ -4718,12 +5457,13 @@ bool ProcessRegisterCommittee(uint32_t nHeight, uint256 hash, const CKeyID& addr
     return Vote::GetInstance().GetCommittee().Register(address, data, hash, nHeight, fUndo);
 }
 
-bool DoVoting(const CBlock& block, uint32_t nHeight, std::map<uint256, uint64_t>& mapTxFee, bool fUndo)
+bool DoVoting(const CBlock& block, uint32_t nHeight, const CDPoSBlockDelta& delta, bool fUndo, CDPoSVoteEvent* pevent)
 {
+    const std::vector<uint64_t>& vTxFee = delta.vTxFee;
     if(fUndo) {
-        LogPrintf("DPoS UndoVoting height:%u hash:%s\n", nHeight, block.GetHash().ToString().c_str());
+        LogPrint("DPoS", "DPoS UndoVoting height:%u hash:%s\n", nHeight, block.GetHash().ToString().c_str());
     } else {
-        LogPrintf("DPoS DoVoting height:%u hash:%s\n", nHeight, block.GetHash().ToString().c_str());
+        LogPrint("DPoS", "DPoS DoVoting height:%u hash:%s\n", nHeight, block.GetHash().ToString().c_str());
     }
 
     CPubKey pubkey;
@@ -4731,152 +5471,652 @@ bool DoVoting(const CBlock& block, uint32_t nHeight, std::map<uint256, uint64_t>
 
     Vote::GetInstance().GetBill().NewBlockHeight(nHeight, block.nTime, fUndo);
 
-    for(auto& t : block.vtx) {
-        auto& to = t->vout[0];
+    uint32_t nOps = 0;
+    for(size_t n = 0; n < block.vtx.size(); ++n) {
+        const CTransactionRef& t = block.vtx[n];
+        const unsigned char* pbegin;
+        const unsigned char* pend;
 
-        if (IsVotingTxout(to, script))
+        // Found once when the transaction was built, so most cost nothing here
+        if (t->GetDPoSPayload(pbegin, pend))
         {
-            if (script.size() < 1)
+            if (pbegin == pend)
                 return false;
+            ++nOps;
 
-            const CKeyID& address = t->address;
-            switch (script[0]) {
+            const CKeyID& address = delta.vSender[n];
+            // Votes are parsed in place, the rarer operations from a copy
+            if (*pbegin != OP_VOTE && *pbegin != OP_REVOKE)
+                script = CScript(pbegin, pend);
+            switch (*pbegin) {
                 case OP_REGISTE:
-                    if(mapTxFee[t->GetHash()] >= 100000000)
+                    if(vTxFee[n] >= 100000000)
                         ProcessRegiste(nHeight, (*t).GetHash(), address, script, fUndo);
                 break;
                  
                 case OP_VOTE:
-                    if(mapTxFee[t->GetHash()] >= 1000000)
-                        ProcessVote(nHeight, (*t).GetHash(), address, script, fUndo);
+                    if(vTxFee[n] >= 1000000)
+                        ProcessVote(nHeight, (*t).GetHash(), address, pbegin, pend, fUndo, pevent);
                 break;
                     
                 case OP_REVOKE:
-                    if(mapTxFee[t->GetHash()] >= 1000000)
-                        ProcessCancelVote(nHeight, (*t).GetHash(), address, script, fUndo);
+                    if(vTxFee[n] >= 1000000)
+                        ProcessCancelVote(nHeight, (*t).GetHash(), address, pbegin, pend, fUndo, pevent);
                 break;
 
                 case OP_REGISTE_COMMITTEE:
-                    if(mapTxFee[t->GetHash()] >= OP_REGISTER_COMMITTEE_FEE)
+                    if(vTxFee[n] >= OP_REGISTER_COMMITTEE_FEE)
                         ProcessRegisterCommittee(nHeight, (*t).GetHash(), address, script, fUndo);
                 break;
 
                 case OP_VOTE_COMMITTEE:
-                    if(mapTxFee[t->GetHash()] >= OP_VOTE_COMMITTEE_FEE)
+                    if(vTxFee[n] >= OP_VOTE_COMMITTEE_FEE)
                         ProcessVoteCommittee(nHeight, (*t).GetHash(), address, script, true, fUndo);
                 break;
 
                 case OP_REVOKE_COMMITTEE:
-                    if(mapTxFee[t->GetHash()] >= OP_VOTE_COMMITTEE_FEE)
+                    if(vTxFee[n] >= OP_VOTE_COMMITTEE_FEE)
                         ProcessVoteCommittee(nHeight, (*t).GetHash(), address, script, false, fUndo);
                 break;
 
                 case OP_SUBMIT_BILL:
-                    if(mapTxFee[t->GetHash()] >= OP_SUBMIT_BILL_FEE)
+                    if(vTxFee[n] >= OP_SUBMIT_BILL_FEE)
                         ProcessSubmitBill(nHeight, (*t).GetHash(), address, block.nTime, script, fUndo);
                 break;
 
                 case OP_VOTE_BILL:
-                    if(mapTxFee[t->GetHash()] >= OP_VOTE_BILL_FEE)
+                    if(vTxFee[n] >= OP_VOTE_BILL_FEE)
                         ProcessVoteBill(nHeight, (*t).GetHash(), address, script, fUndo);
                 break;
 
             }
         }
     }
+    TRACE3(dpos, voting_applied, nHeight, fUndo, nOps);
     return true;
 }
 
-void CalculateBalance(const CBlock& block, bool fIsAdd, std::map<uint256, uint64_t>* mapTxFee);
-void ProcessDPoSConnectBlock(const CBlock& block, uint64_t nBlockHeight)
+void GetDPoSBlockDelta(const CBlock& block, const CBlockUndo& blockundo, CDPoSBlockDelta& delta);
+void ApplyDPoSBlockDelta(const CBlock& block, const CDPoSBlockDelta& delta, bool fIsAdd);
+/** Tell the listeners of the DPoS signals what a block that was just applied or undone changed */
+static void NotifyDPoSBlock(const CBlock& block, const CDPoSBlockDelta& delta, uint64_t nBlockHeight, bool fUndo, CDPoSVoteEvent& votes)
 {
-    LogPrint("DPoS", "ProcessDPoSConnectBlock %s %lu %u\n", block.GetHash().ToString().c_str(), nBlockHeight, block.nTime);
+    CMainSignals& signals = GetMainSignals();
+    uint256 hash = block.GetHash();
 
-    std::map<uint256, uint64_t> mapTxFee;
-    CalculateBalance(block, true, &mapTxFee);
-    DoVoting(block, nBlockHeight, mapTxFee, false);
+    if(!votes.vOps.empty() && !signals.DPoSVotes.empty()) {
+        votes.hashBlock = hash;
+        votes.nHeight = nBlockHeight;
+        votes.fUndo = fUndo;
+        std::set<CKeyID> setDelegates;
+        for(const CDPoSVoteOp& op : votes.vOps)
+            setDelegates.insert(op.vDelegates.begin(), op.vDelegates.end());
+        for(const CKeyID& delegate : setDelegates)
+            votes.vTallies.push_back(std::make_pair(delegate, Vote::GetInstance().GetDelegateVotes(delegate)));
+        signals.DPoSVotes(votes);
+    }
+
+    if(!delta.vBalance.empty() && !signals.DPoSBalances.empty()) {
+        CDPoSBalanceEvent balances;
+        balances.hashBlock = hash;
+        balances.nHeight = nBlockHeight;
+        balances.fUndo = fUndo;
+        balances.vBalance = delta.vBalance;
+        // The changes as applied, which an undone block reverses
+        if(fUndo) {
+            for(auto& item : balances.vBalance)
+                item.second = -item.second;
+        }
+        signals.DPoSBalances(balances);
+    }
+
+    // The first block of a round carries the delegates of the round
+    DelegateInfo cDelegateInfo;
+    if(!fUndo && !signals.DPoSRound.empty() && DPoS::GetBlockDelegate(cDelegateInfo, block)) {
+        CDPoSRoundEvent round;
+        round.nLoopIndex = DPoS::GetInstance().GetLoopIndex(block.nTime);
+        round.nHeight = nBlockHeight;
+        round.hashBlock = hash;
+        for(const Delegate& delegate : cDelegateInfo.delegates)
+            round.vDelegates.push_back(std::make_pair(delegate.keyid, delegate.votes));
+        signals.DPoSRound(round);
+    }
 }
 
-void ProcessDPoSDisconnectBlock(const CBlock& block, uint64_t nBlockHeight)
+/** Record the balances and votes a connected block left in the DPoS history, if it comes right after the history's best block */
+static void WriteDPoSHistory(const CBlock& block, const CDPoSBlockDelta& delta, uint64_t nBlockHeight, const CDPoSVoteEvent& votes)
 {
-    LogPrint("DPoS", "ProcessDPoSDisconnectBlock %s %lu %u\n", block.GetHash().ToString().c_str(), nBlockHeight, block.nTime);
+    int nBestHeight = 0;
+    uint256 hashBest;
+    if(pdposhistory->ReadBestBlock(nBestHeight, hashBest)) {
+        if(nBestHeight + 1 != (int)nBlockHeight || hashBest != block.hashPrevBlock)
+            return;
+    } else if(nBlockHeight != 1) {
+        // InitDPoSHistory starts the history from the state of the tip
+        return;
+    } else if(!pdposhistory->WriteStart(0, block.hashPrevBlock)) {
+        LogPrintf("%s: failed to start the DPoS history\n", __func__);
+        return;
+    }
+
+    std::map<CMyAddress, uint64_t> mapBalance;
+    for(auto& item : delta.vBalance)
+        mapBalance[item.first] = 0;
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    vBalance.reserve(mapBalance.size());
+    for(auto& it : mapBalance)
+        vBalance.push_back(std::make_pair(it.first, Vote::GetInstance().GetAddressBalance(it.first)));
+
+    // The last operation of a block on a (delegate, voter) pair is the one that stays
+    std::map<std::pair<CKeyID, CKeyID>, bool> mapVote;
+    for(const CDPoSVoteOp& op : votes.vOps) {
+        for(const CKeyID& delegate : op.vDelegates)
+            mapVote[std::make_pair(delegate, op.voter)] = op.fVote;
+    }
+    std::vector<std::pair<std::pair<CKeyID, CKeyID>, bool>> vVote(mapVote.begin(), mapVote.end());
 
-    std::map<uint256, uint64_t> mapTxFee;
-    CalculateBalance(block, false, &mapTxFee);
-    DoVoting(block, nBlockHeight, mapTxFee, true);
+    if(!pdposhistory->WriteBlock(nBlockHeight, block.GetHash(), vBalance, vVote))
+        LogPrintf("%s: failed to write the DPoS history of height %d\n", __func__, nBlockHeight);
 }
 
-bool RepairDPoSData(int64_t nOldBlockHeight, const std::string& strOldBlockHash)
+/** Take a disconnected block back out of the DPoS history, if it is the history's best block */
+static void RevertDPoSHistory(const CBlock& block, uint64_t nBlockHeight)
 {
-    LOCK(cs_main);    
-    CBlockIndex* pblockindex = mapBlockIndex[uint256S(strOldBlockHash)];
-    if(pblockindex == false || pblockindex->nHeight != nOldBlockHeight) {
-        return false; 
+    int nBestHeight = 0, nStartHeight = 0;
+    uint256 hashBest;
+    if(!pdposhistory->ReadBestBlock(nBestHeight, hashBest) || nBestHeight != (int)nBlockHeight || hashBest != block.GetHash())
+        return;
+
+    if(pdposhistory->ReadStartHeight(nStartHeight) && nStartHeight >= nBestHeight) {
+        // The history has nothing before the start state, InitDPoSHistory starts it over
+        LogPrintf("%s: disconnected the start of the DPoS history at height %d, clearing it\n", __func__, nBlockHeight);
+        pdposhistory->Clear();
+        return;
     }
 
-    while(chainActive.Contains(pblockindex) == false) {
-        CBlock block;
-        if(ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()) == false) {
-            return false;
+    if(!pdposhistory->RevertBlock(nBlockHeight, block.hashPrevBlock))
+        LogPrintf("%s: failed to revert the DPoS history of height %d\n", __func__, nBlockHeight);
+}
+
+bool InitDPoSHistory()
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if(!pindexTip)
+        return true;
+
+    int nBestHeight = 0, nStartHeight = 0;
+    uint256 hashBest;
+    if(pdposhistory->ReadBestBlock(nBestHeight, hashBest) && pdposhistory->ReadStartHeight(nStartHeight)) {
+        // Take back the blocks the active chain no longer has, as when the vote state was older than the history after a crash
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        while(mi != mapBlockIndex.end() && nBestHeight > nStartHeight && !chainActive.Contains(mi->second)) {
+            const uint256 hashPrev = mi->second->pprev->GetBlockHash();
+            if(!pdposhistory->RevertBlock(nBestHeight, hashPrev))
+                return false;
+            --nBestHeight;
+            mi = mapBlockIndex.find(hashPrev);
         }
 
-        ProcessDPoSDisconnectBlock(block, pblockindex->nHeight);
-        pblockindex = pblockindex->pprev;
+        if(mi != mapBlockIndex.end() && mi->second == pindexTip) {
+            LogPrintf("%s: DPoS history from height %d to %d\n", __func__, nStartHeight, nBestHeight);
+            return true;
+        }
+        // Otherwise the node ran without -dposhistory for a while, and the history has a gap
     }
 
-    for(auto i = pblockindex->nHeight + 1; i <= chainActive.Height(); ++i) {
-        CBlock block;
-        if(ReadBlockFromDisk(block, chainActive[i], Params().GetConsensus()) == false) {
-            return false;
+    const int nHeight = pindexTip->nHeight;
+    LogPrintf("%s: starting the DPoS history at height %d\n", __func__, nHeight);
+    int64_t nStart = GetTimeMillis();
+    if(!pdposhistory->Clear())
+        return error("%s: failed to clear the DPoS history", __func__);
+
+    bool fOk = true;
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    Vote::GetInstance().ForEachAddressBalance([&](const CMyAddress& address, uint64_t nBalance) {
+        vBalance.push_back(std::make_pair(address, nBalance));
+        if(vBalance.size() >= DPOS_HISTORY_START_BATCH) {
+            fOk = fOk && pdposhistory->WriteStartBalances(nHeight, vBalance);
+            vBalance.clear();
         }
+    });
+    fOk = fOk && pdposhistory->WriteStartBalances(nHeight, vBalance);
 
-        ProcessDPoSConnectBlock(block, chainActive[i]->nHeight);
+    for(auto& it : Vote::GetInstance().ListDelegates()) {
+        std::set<CKeyID> setVoters = Vote::GetInstance().GetDelegateVoters(it.second);
+        fOk = fOk && pdposhistory->WriteStartVoters(nHeight, it.second, std::vector<CKeyID>(setVoters.begin(), setVoters.end()));
     }
 
+    if(!fOk || !pdposhistory->WriteStart(nHeight, pindexTip->GetBlockHash()))
+        return error("%s: failed to write the start of the DPoS history", __func__);
+
+    LogPrintf("%s: wrote the DPoS state at height %d in %dms\n", __func__, nHeight, GetTimeMillis() - nStart);
     return true;
 }
 
-void ProcessMultiSigTx(const CScript& script, uint256 txid, bool fIsAdd)
+bool GetDPoSHistoryRange(int& nStartHeight, int& nBestHeight)
 {
-    if(script[script.size()-1] != 0xae
-        || script[script.size()-2] != 0x52) {
-        return;
-    }
+    uint256 hashBest;
+    return pdposhistory && pdposhistory->ReadBestBlock(nBestHeight, hashBest) && pdposhistory->ReadStartHeight(nStartHeight);
+}
 
-    CScript::const_iterator pc = script.begin();
-    CScript::const_iterator pend = script.end();
-    opcodetype opcode;
-	
-    std::vector<unsigned char> vchPushValue;
-    script.GetOp(pc, opcode, vchPushValue);
-    script.GetOp(pc, opcode, vchPushValue);
-    script.GetOp(pc, opcode, vchPushValue);
-    script.GetOp(pc, opcode, vchPushValue);
-
-    if(pc == pend && vchPushValue[0] == 0x52) {
-        CScriptID scriptid(CScript(vchPushValue.begin(), vchPushValue.end()));
-        CBitcoinAddress multiAddress;
-        multiAddress.Set(scriptid);
-
-        CPubKey pubkey(&vchPushValue[2], &vchPushValue[2] + vchPushValue[1]);
-        CBitcoinAddress address;
-        address.Set(pubkey.GetID());
-
-        if(fIsAdd) {
-            if(Vote::GetInstance().AddDelegateMultiaddress(std::make_pair(pubkey.GetID(), CChainParams::PUBKEY_ADDRESS), std::make_pair(scriptid, CChainParams::SCRIPT_ADDRESS), txid)) {
-                LogPrintf("MultiSignTx Hash:%s Add address:%s mutiladdress:%s succes\n", txid.ToString().c_str(), address.ToString().c_str(), multiAddress.ToString().c_str());
-            } else {
-                //LogPrintf("MultiSignTx Hash:%s Add address:%s mutiladdress:%s failed\n", txid.ToString().c_str(), address.ToString().c_str(), multiAddress.ToString().c_str());
+void ProcessDPoSConnectBlock(const CBlock& block, const CDPoSBlockDelta& delta, uint64_t nBlockHeight, bool fNotify)
+{
+    LogPrint("DPoS", "ProcessDPoSConnectBlock %s %lu %u\n", block.GetHash().ToString().c_str(), nBlockHeight, block.nTime);
+
+    int64_t nTime1 = GetTimeMicros();
+    CDPoSVoteEvent votes;
+    ApplyDPoSBlockDelta(block, delta, true);
+    int64_t nTime2 = GetTimeMicros(); nTimeDPoSBalance += nTime2 - nTime1;
+    LogPrint("bench", "    - DPoS balances: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeDPoSBalance * 0.000001);
+    DoVoting(block, nBlockHeight, delta, false, fNotify || pdposhistory ? &votes : NULL);
+    if(pdposhistory)
+        WriteDPoSHistory(block, delta, nBlockHeight, votes);
+    int64_t nTime3 = GetTimeMicros(); nTimeDPoSVoting += nTime3 - nTime2;
+    LogPrint("bench", "    - Voting: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeDPoSVoting * 0.000001);
+    Vote::GetInstance().PublishView();
+    if(fNotify)
+        NotifyDPoSBlock(block, delta, nBlockHeight, false, votes);
+    int64_t nTime4 = GetTimeMicros(); nTimeDPoSNotify += nTime4 - nTime3;
+    LogPrint("bench", "    - DPoS notifications: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeDPoSNotify * 0.000001);
+    TRACE5(dpos, block_applied, nBlockHeight, (uint64_t)delta.vBalance.size(), nTime2 - nTime1, nTime3 - nTime2, nTime4 - nTime3);
+}
+
+void ProcessDPoSDisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, uint64_t nBlockHeight, bool fNotify)
+{
+    LogPrint("DPoS", "ProcessDPoSDisconnectBlock %s %lu %u\n", block.GetHash().ToString().c_str(), nBlockHeight, block.nTime);
+
+    CDPoSBlockDelta delta;
+    CDPoSVoteEvent votes;
+    GetDPoSBlockDelta(block, blockundo, delta);
+    ApplyDPoSBlockDelta(block, delta, false);
+    DoVoting(block, nBlockHeight, delta, true, fNotify ? &votes : NULL);
+    if(pdposhistory)
+        RevertDPoSHistory(block, nBlockHeight);
+    Vote::GetInstance().PublishView();
+    if(fNotify)
+        NotifyDPoSBlock(block, delta, nBlockHeight, true, votes);
+    TRACE2(dpos, block_undone, nBlockHeight, (uint64_t)delta.vBalance.size());
+}
+
+static bool ReadDPoSBlockFromDisk(CBlock& block, CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    if(ReadBlockFromDisk(block, pindex, Params().GetConsensus()) == false) {
+        return false;
+    }
+
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if(pos.IsNull() || UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash()) == false) {
+        return error("%s: no undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    if(blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: block %s and undo data inconsistent", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    return true;
+}
+
+/**
+ * Marks a startup DPoS repair or rebuild as running and reports its progress
+ * to the splash screen and getblockchaininfo. The mark is only cleared by
+ * Done(), a failed run leaving the DPoS state at none of the active chain
+ */
+class CDPoSRepairProgress
+{
+public:
+    explicit CDPoSRepairProgress(const std::string& strTitleIn) : strTitle(strTitleIn), nPercent(-1)
+    {
+        nDPoSRepairDone = 0;
+        nDPoSRepairTotal = 0;
+        fDPoSRepairing = true;
+    }
+
+    ~CDPoSRepairProgress()
+    {
+        if(nDPoSRepairTotal > 0) {
+            uiInterface.ShowProgress("", 100);
+        }
+    }
+
+    void SetTotal(int nTotal)
+    {
+        nDPoSRepairTotal = nTotal;
+        if(nTotal > 0) {
+            uiInterface.InitMessage(strTitle);
+            Step(0);
+        }
+    }
+
+    void Step(int nBlocks = 1)
+    {
+        int nDone = nDPoSRepairDone += nBlocks;
+        int nNewPercent = nDPoSRepairTotal > 0 ? (int)((int64_t)nDone * 100 / nDPoSRepairTotal) : 0;
+        if(nNewPercent != nPercent) {
+            nPercent = nNewPercent;
+            uiInterface.ShowProgress(strTitle, nPercent);
+        }
+    }
+
+    void Done()
+    {
+        fDPoSRepairing = false;
+    }
+
+private:
+    std::string strTitle;
+    int nPercent;
+};
+
+/** Flush the DPoS state of an interrupted repair or rebuild as that of the block it got to, for the next start to go on from */
+static void FlushInterruptedDPoSRepair(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    LogPrintf("%s: DPoS state left at height %d\n", __func__, pindex->nHeight);
+    if(Vote::GetInstance().Flush(pindex->nHeight, pindex->GetBlockHash()) == false) {
+        error("%s: failed to write the vote database", __func__);
+    }
+}
+
+/**
+ * Reads the blocks and undo data of a list of block indexes in order on a
+ * thread of its own, up to DPOS_REPAIR_PREFETCH ahead of the one taken
+ */
+class CDPoSBlockReader
+{
+public:
+    explicit CDPoSBlockReader(const std::vector<const CBlockIndex*>& vIndexIn) :
+        vIndex(vIndexIn), fStop(false), thread(boost::bind(&CDPoSBlockReader::Run, this))
+    {
+    }
+
+    ~CDPoSBlockReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        // Also when unwinding from an interrupted Next()
+        boost::this_thread::disable_interruption di;
+        thread.join();
+    }
+
+    /** The next block of the list, waiting for it to be read. False if it could not be */
+    bool Next(CBlock& block, CBlockUndo& blockundo)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while(queue.empty()) {
+            cond.wait(lock);
+        }
+        bool fValid = queue.front().fValid;
+        block = std::move(queue.front().block);
+        blockundo = std::move(queue.front().blockundo);
+        queue.pop_front();
+        cond.notify_all();
+        return fValid;
+    }
+
+private:
+    struct Item {
+        CBlock block;
+        CBlockUndo blockundo;
+        bool fValid;
+    };
+
+    const std::vector<const CBlockIndex*>& vIndex;
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<Item> queue;
+    bool fStop;
+    boost::thread thread;
+
+    void Run()
+    {
+        RenameThread("bitcoin-dposread");
+        for(const CBlockIndex* pindex : vIndex) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while(!fStop && queue.size() >= DPOS_REPAIR_PREFETCH) {
+                    cond.wait(lock);
+                }
+                if(fStop) {
+                    return;
+                }
             }
-        } else {
-            if(Vote::GetInstance().DelDelegateMultiaddress(std::make_pair(pubkey.GetID(), CChainParams::PUBKEY_ADDRESS), std::make_pair(scriptid, CChainParams::SCRIPT_ADDRESS), txid)) {
-                LogPrintf("MultiSignTx Hash:%s Del address:%s mutiladdress:%s succes\n", txid.ToString().c_str(), address.ToString().c_str(), multiAddress.ToString().c_str());
-            } else {
-            //LogPrintf("MultiSignTx Hash:%s Del address:%s mutiladdress:%s failed\n", txid.ToString().c_str(), address.ToString().c_str(), multiAddress.ToString().c_str());
+
+            Item item;
+            item.fValid = ReadDPoSBlockFromDisk(item.block, item.blockundo, pindex);
+            bool fValid = item.fValid;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                queue.push_back(std::move(item));
+            }
+            cond.notify_all();
+            if(!fValid) {
+                return;
+            }
+        }
+    }
+};
+
+bool RepairDPoSData(int64_t nOldBlockHeight, const std::string& strOldBlockHash)
+{
+    // Marked first, so the active chain stays where the lists below find it
+    CDPoSRepairProgress progress(_("Repairing DPoS data..."));
+
+    // The blocks to undo from the one the DPoS state is of back to the active chain, then the ones to apply up to the tip
+    std::vector<const CBlockIndex*> vDisconnect, vConnect;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(uint256S(strOldBlockHash));
+        if(mi == mapBlockIndex.end() || mi->second->nHeight != nOldBlockHeight) {
+            return false;
+        }
+
+        const CBlockIndex* pblockindex = mi->second;
+        while(chainActive.Contains(pblockindex) == false) {
+            vDisconnect.push_back(pblockindex);
+            pblockindex = pblockindex->pprev;
+        }
+        for(int i = pblockindex->nHeight + 1; i <= chainActive.Height(); ++i) {
+            vConnect.push_back(chainActive[i]);
+        }
+    }
+
+    if(vDisconnect.size() + vConnect.size() > 0) {
+        LogPrintf("%s: undoing %u blocks and applying %u\n", __func__, vDisconnect.size(), vConnect.size());
+    }
+    progress.SetTotal(vDisconnect.size() + vConnect.size());
+
+    {
+        CDPoSBlockReader reader(vDisconnect);
+        for(const CBlockIndex* pindex : vDisconnect) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if(reader.Next(block, blockundo) == false) {
+                return false;
+            }
+
+            LOCK(cs_main);
+            if(ShutdownRequested()) {
+                FlushInterruptedDPoSRepair(pindex);
+                return error("%s: interrupted at height %d", __func__, pindex->nHeight);
+            }
+            ProcessDPoSDisconnectBlock(block, blockundo, pindex->nHeight, false);
+            progress.Step();
+        }
+    }
+
+    {
+        CDPoSBlockReader reader(vConnect);
+        for(const CBlockIndex* pindex : vConnect) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if(reader.Next(block, blockundo) == false) {
+                return false;
+            }
+
+            CDPoSBlockDelta delta;
+            GetDPoSBlockDelta(block, blockundo, delta);
+            LOCK(cs_main);
+            if(ShutdownRequested()) {
+                FlushInterruptedDPoSRepair(pindex->pprev);
+                return error("%s: interrupted at height %d", __func__, pindex->nHeight);
+            }
+            ProcessDPoSConnectBlock(block, delta, pindex->nHeight, false);
+            progress.Step();
+        }
+    }
+
+    progress.Done();
+    return true;
+}
+
+struct CDPoSReindexBlock
+{
+    CBlock block;
+    CDPoSBlockDelta delta;
+    bool fValid;
+};
+
+static void ReadDPoSBlockRange(std::vector<CDPoSReindexBlock>& vBlock, const std::vector<const CBlockIndex*>& vIndex, size_t nStart, size_t nThread, size_t nThreads)
+{
+    for(size_t i = nThread; i < vBlock.size(); i += nThreads) {
+        CBlockUndo blockundo;
+        CDPoSReindexBlock& item = vBlock[i];
+        item.fValid = ReadDPoSBlockFromDisk(item.block, blockundo, vIndex[nStart + i]);
+        if(item.fValid) {
+            GetDPoSBlockDelta(item.block, blockundo, item.delta);
+        }
+    }
+}
+
+/**
+ * Rebuild the DPoS state of the active chain from an empty Vote. Worker
+ * threads read the blocks and their undo data and extract the balance deltas
+ * batch by batch without cs_main; the deltas are then applied under it in
+ * height order, since vote weights and bill results depend on the balances at
+ * every height. The state is written to the vote database as it goes, so an
+ * interrupted rebuild is finished by RepairDPoSData on the next start.
+ */
+bool ReindexDPoSData()
+{
+    CDPoSRepairProgress progress(_("Rebuilding DPoS data..."));
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        for(int i = 1; i <= chainActive.Height(); ++i) {
+            vIndex.push_back(chainActive[i]);
+        }
+    }
+
+    const size_t nThreads = std::max(1, std::min(GetNumCores(), DPOS_REINDEX_MAX_THREADS));
+    const size_t nBatchSize = nThreads * DPOS_REINDEX_BATCH_PER_THREAD;
+    LogPrintf("%s: rebuilding DPoS state of %u blocks with %u threads\n", __func__, vIndex.size(), nThreads);
+    progress.SetTotal(vIndex.size());
+
+    int64_t nStartTime = GetTimeMillis();
+    int64_t nLastFlush = GetTimeMicros();
+    for(size_t nStart = 0; nStart < vIndex.size(); nStart += nBatchSize) {
+        if(ShutdownRequested()) {
+            LOCK(cs_main);
+            if(nStart > 0) {
+                FlushInterruptedDPoSRepair(vIndex[nStart - 1]);
+            }
+            return error("%s: interrupted at height %d", __func__, vIndex[nStart]->nHeight);
+        }
+
+        std::vector<CDPoSReindexBlock> vBlock(std::min(nBatchSize, vIndex.size() - nStart));
+        boost::thread_group threadGroup;
+        for(size_t n = 0; n < nThreads; ++n) {
+            threadGroup.create_thread(boost::bind(&ReadDPoSBlockRange, boost::ref(vBlock), boost::cref(vIndex), nStart, n, nThreads));
+        }
+        threadGroup.join_all();
+
+        // cs_main is taken per block, as RepairDPoSData does, so RPC callers are not held up for a whole batch
+        for(size_t i = 0; i < vBlock.size(); ++i) {
+            if(vBlock[i].fValid == false) {
+                return false;
+            }
+            LOCK(cs_main);
+            ProcessDPoSConnectBlock(vBlock[i].block, vBlock[i].delta, vIndex[nStart + i]->nHeight, false);
+        }
+        progress.Step(vBlock.size());
+
+        const CBlockIndex* pindexDone = vIndex[nStart + vBlock.size() - 1];
+        LogPrintf("%s: height %d done\n", __func__, pindexDone->nHeight);
+
+        // Written out like the chainstate of a -reindex-chainstate: when the cache outgrows its share of
+        // -dbcache, or once per DATABASE_WRITE_INTERVAL. A restart then repairs on from the last write.
+        LOCK(cs_main);
+        CMemoryUsageStats usage = GetMemoryUsageStats();
+        bool fCacheLarge = (usage.nCoinsCache + usage.nVoteCache) * DB_PEAK_USAGE_FACTOR > usage.nCoinsLimit;
+        if(fCacheLarge || GetTimeMicros() > nLastFlush + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
+            if(Vote::GetInstance().Flush(pindexDone->nHeight, pindexDone->GetBlockHash(), fCacheLarge) == false) {
+                return error("%s: failed to write the vote database", __func__);
             }
+            nLastFlush = GetTimeMicros();
+        }
+    }
+
+    LOCK(cs_main);
+    if(chainActive.Tip() && Vote::GetInstance().Flush(chainActive.Height(), chainActive.Tip()->GetBlockHash()) == false) {
+        return error("%s: failed to write the vote database", __func__);
+    }
+
+    progress.Done();
+    LogPrintf("%s: done in %dms\n", __func__, GetTimeMillis() - nStartTime);
+    return true;
+}
+
+/**
+ * Whether scriptSig spends a 2-of-n multisig, the first key of which may be a
+ * delegate's. Only walks the bytes of the script, since most script address
+ * spends are nothing of the kind.
+ */
+static bool ParseDelegateMultiSig(const CScript& script, CDelegateMultiSigSpend& spend)
+{
+    // The redeem script ends with OP_2 OP_CHECKMULTISIG
+    if(script.size() < 2
+        || script[script.size()-1] != OP_CHECKMULTISIG
+        || script[script.size()-2] != OP_2) {
+        return false;
+    }
+
+    // OP_0 <sig> <sig> <redeem script>
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    for(int i = 0; i < 3; ++i) {
+        if(!script.GetOp(pc, opcode)) {
+            return false;
         }
+    }
+
+    CScript::const_iterator pushBegin = pc;
+    if(!script.GetOp(pc, opcode) || opcode > OP_PUSHDATA4 || pc != script.end()) {
+        return false;
+    }
+    size_t nHeader = opcode < OP_PUSHDATA1 ? 1 : opcode == OP_PUSHDATA1 ? 2 : opcode == OP_PUSHDATA2 ? 3 : 5;
 
+    // OP_2 <pubkey> ...
+    CScript::const_iterator redeem = pushBegin + nHeader;
+    if(script.end() - redeem < 2 || redeem[0] != OP_2) {
+        return false;
+    }
+    size_t nKeySize = redeem[1];
+    if((size_t)(script.end() - redeem) < 2 + nKeySize) {
+        return false;
+    }
+    CPubKey pubkey(redeem + 2, redeem + 2 + nKeySize);
+    if(!pubkey.IsValid()) {
+        return false;
     }
+
+    spend.delegate = pubkey.GetID();
+    spend.pScriptSig = &script;
+    spend.nRedeemBegin = redeem - script.begin();
+    return true;
 }
 
 bool ExtractAddress(const CScript& script, CMyAddress& address)
@@ -4896,47 +6136,361 @@ bool ExtractAddress(const CScript& script, CMyAddress& address)
     return ret;
 }
 
-void CalculateBalance(const CBlock& block, bool fIsAdd, std::map<uint256, uint64_t>* mapTxFee)
+void AddDPoSSpend(CDPoSBlockDelta& delta, const CTransaction& tx, uint32_t nTx, uint32_t nIn, const Consensus::CSpentOutput& spent)
+{
+    delta.vTxFee[nTx] += spent.txout.nValue;
+
+    if(spent.fAddress) {
+        delta.vBalance.push_back(std::make_pair(spent.address, 0 - static_cast<int64_t>(spent.txout.nValue)));
+
+        if(spent.address.second == CChainParams::SCRIPT_ADDRESS) {
+            delta.vMultiSigInput.push_back(std::make_pair(nTx, nIn));
+        } else {
+            // All inputs spend from the same address, see CheckTxInputs
+            delta.vSender[nTx] = spent.address.first;
+        }
+    }
+}
+
+void AddDPoSOutputs(CDPoSBlockDelta& delta, const CTransaction& tx, uint32_t nTx)
 {
     CMyAddress address;
-    std::vector<std::pair<CMyAddress, int64_t>> addressBalances;
+    for(auto& v : tx.vout)
+    {
+        delta.vTxFee[nTx] -= v.nValue;
+
+        if(ExtractAddress(v.scriptPubKey, address)) {
+            delta.vBalance.push_back(std::make_pair(address, static_cast<int64_t>(v.nValue)));
+        }
+    }
+}
+
+/** Rebuild the delta ConnectBlock gathers, taking the spent prevouts from the block's undo data */
+void GetDPoSBlockDelta(const CBlock& block, const CBlockUndo& blockundo, CDPoSBlockDelta& delta)
+{
+    delta.vTxFee.assign(block.vtx.size(), 0);
+    delta.vSender.assign(block.vtx.size(), CKeyID());
 
-    for (auto t : block.vtx)
+    for(size_t n = 0; n < block.vtx.size(); ++n)
     {
-        uint64_t fee = 0;
-        for(auto& i:t->vin)
+        const CTransaction& tx = *block.vtx[n];
+        for(size_t j = 0; n > 0 && j < tx.vin.size(); ++j)
         {
-            TxOutPtr txout;
-            if(i.prevout.hash.IsNull() == false && (txout = GetTxout(i.prevout.hash, i.prevout.n))) {
-                fee += txout->nValue;
-                int64_t value = static_cast<int64_t>(txout->nValue);
-
-                if(ExtractAddress(txout->scriptPubKey, address)) {
-                    addressBalances.push_back(std::make_pair(address, fIsAdd ? 0 - value : value));
-
-                    if(address.second == CChainParams::SCRIPT_ADDRESS) {
-                        ProcessMultiSigTx(i.scriptSig, t->GetHash(), fIsAdd);
-                    } else {
-                        auto& tx = const_cast<CTransaction&>(*t);
-                        tx.address = address.first;
-                    }
-                }
+            const Coin& undo = blockundo.vtxundo[n - 1].vprevout[j];
+            AddDPoSSpend(delta, tx, n, j, Consensus::CSpentOutput(undo));
+        }
+
+        AddDPoSOutputs(delta, tx, n);
+    }
+}
+
+void ApplyDPoSBlockDelta(const CBlock& block, const CDPoSBlockDelta& delta, bool fIsAdd)
+{
+    std::vector<CDelegateMultiSigSpend> vSpend;
+    for(auto& in : delta.vMultiSigInput)
+    {
+        const CTransaction& tx = *block.vtx[in.first];
+        CDelegateMultiSigSpend spend;
+        if(ParseDelegateMultiSig(tx.vin[in.second].scriptSig, spend)) {
+            spend.txid = tx.GetHash();
+            vSpend.push_back(spend);
+        }
+    }
+    Vote::GetInstance().UpdateDelegateMultiaddress(vSpend, fIsAdd);
+
+    if(fIsAdd) {
+        Vote::GetInstance().UpdateAddressBalance(delta.vBalance);
+    } else {
+        std::vector<std::pair<CMyAddress, int64_t>> addressBalances;
+        addressBalances.reserve(delta.vBalance.size());
+        for(auto& it : delta.vBalance) {
+            addressBalances.push_back(std::make_pair(it.first, 0 - it.second));
+        }
+        Vote::GetInstance().UpdateAddressBalance(addressBalances);
+    }
+}
+
+/** Blocks below the tip, or below the last irreversible block if that is further back, whose data goes into a state snapshot */
+static const int SNAPSHOT_RECENT_BLOCKS = MIN_BLOCKS_TO_KEEP;
+
+bool DumpStateSnapshot(const boost::filesystem::path& path, CStateSnapshotStats& stats, std::string& strError)
+{
+    LOCK(cs_main);
+    // The chain state and the vote state on disk are then those of the tip
+    FlushStateToDisk();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip == NULL) {
+        strError = "There is no chain to write";
+        return false;
+    }
+
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+    if (pcursor->GetBestBlock() != pindexTip->GetBlockHash()) {
+        strError = "The chain state is not that of the tip";
+        return false;
+    }
+
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (file == NULL) {
+        strError = strprintf("Cannot open %s", path.string());
+        return false;
+    }
+
+    stats = CStateSnapshotStats();
+    stats.nHeight = pindexTip->nHeight;
+    stats.hashBlock = pindexTip->GetBlockHash();
+    try {
+        CSnapshotWriter writer(file, SER_DISK, CLIENT_VERSION);
+        writer << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << stats.nHeight << stats.hashBlock;
+
+        std::map<int64_t, uint256> mapIrreversible = DPoS::GetInstance().GetIrreversibleBlockInfo().mapHeightHash;
+        writer << mapIrreversible;
+
+        // The blocks DPoS looks back at for the delegates of a round, and those a reorganization could disconnect
+        int nRecentStart = stats.nHeight - SNAPSHOT_RECENT_BLOCKS;
+        if (!mapIrreversible.empty())
+            nRecentStart = std::min<int64_t>(nRecentStart, mapIrreversible.rbegin()->first - SNAPSHOT_RECENT_BLOCKS);
+        nRecentStart = std::max(nRecentStart, 1);
+        writer << (uint32_t)(stats.nHeight - nRecentStart + 1);
+        for (int nHeight = nRecentStart; nHeight <= stats.nHeight; nHeight++) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (ReadDPoSBlockFromDisk(block, blockundo, chainActive[nHeight]) == false) {
+                strError = strprintf("Cannot read block %d, a pruned node cannot write a state snapshot", nHeight);
+                return false;
             }
+            writer << nHeight << block << blockundo;
+            stats.nBlocks++;
         }
 
-        for(auto& v:t->vout)
-        {
-            fee -= v.nValue;
+        // The block index of the active chain, without any block data
+        writer << (uint32_t)(stats.nHeight + 1);
+        for (int nHeight = 0; nHeight <= stats.nHeight; nHeight++) {
+            CDiskBlockIndex index(chainActive[nHeight]);
+            index.nStatus &= BLOCK_VALID_MASK | BLOCK_OPT_WITNESS;
+            index.nFile = 0;
+            index.nDataPos = 0;
+            index.nUndoPos = 0;
+            writer << index;
+        }
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                strError = "Cannot read the chain state";
+                return false;
+            }
+            writer << true << key << coin;
+            stats.nCoins++;
+            pcursor->Next();
+        }
+        writer << false;
+
+        if (Vote::GetInstance().DumpSnapshot(writer, stats.nHeight, stats.hashBlock, stats.nBalances, stats.hashVoteState) == false) {
+            strError = "Cannot read the vote state";
+            return false;
+        }
+
+        stats.hashSnapshot = writer.Finish();
+        stats.nFileSize = writer.GetFileSize();
+    } catch (const std::exception& e) {
+        strError = strprintf("Cannot write the state snapshot: %s", e.what());
+        return false;
+    }
+
+    LogPrintf("Wrote the state snapshot of block %s at height %d to %s: %u coins, %u balances, %u blocks, hash %s, vote state %s\n",
+        stats.hashBlock.ToString(), stats.nHeight, path.string(), stats.nCoins, stats.nBalances, stats.nBlocks, stats.hashSnapshot.ToString(), stats.hashVoteState.ToString());
+    return true;
+}
+
+/** Write the block files information of the blocks written since the last flush */
+static bool WriteDirtyFileInfo()
+{
+    LOCK(cs_LastBlockFile);
+    FlushBlockFile();
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
+        vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
+        setDirtyFileInfo.erase(it++);
+    }
+    return pblocktree->WriteBatchSync(vFiles, nLastBlockFile, std::vector<const CBlockIndex*>());
+}
+
+/**
+ * Read a state snapshot and check it against hashExpected, writing it to the
+ * block files, the block index, the chain state and the vote database only
+ * with fWrite.
+ */
+static bool ReadStateSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, bool fWrite, CStateSnapshotStats& stats, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (file == NULL) {
+        strError = strprintf("Cannot open %s", path.string());
+        return false;
+    }
+
+    stats = CStateSnapshotStats();
+    try {
+        CSnapshotReader reader(file, SER_DISK, CLIENT_VERSION);
+        uint32_t nMagic = 0;
+        int nVersion = 0;
+        reader >> nMagic >> nVersion;
+        if (nMagic != SNAPSHOT_MAGIC || nVersion != SNAPSHOT_VERSION) {
+            strError = strprintf("%s is not a state snapshot this version can read", path.string());
+            return false;
+        }
+        reader >> stats.nHeight >> stats.hashBlock;
+
+        std::map<int64_t, uint256> mapIrreversible;
+        reader >> mapIrreversible;
+
+        // The recent blocks go to the block files, where their index entries below will point
+        std::map<uint256, std::pair<CDiskBlockPos, CDiskBlockPos> > mapRecentPos;
+        uint32_t nBlocks = 0;
+        reader >> nBlocks;
+        for (uint32_t i = 0; i < nBlocks; i++) {
+            int nHeight = 0;
+            CBlock block;
+            CBlockUndo blockundo;
+            reader >> nHeight >> block >> blockundo;
+            CValidationState state;
+            if (!CheckBlock(block, state, chainparams.GetConsensus()) || blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+                strError = strprintf("Invalid block at height %d", nHeight);
+                return false;
+            }
+
+            CDiskBlockPos blockPos;
+            CDiskBlockPos undoPos;
+            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            if (fWrite && (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime())
+                || !WriteBlockToDisk(block, blockPos, chainparams.MessageStart())
+                || !FindUndoPos(state, blockPos.nFile, undoPos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40)
+                || !UndoWriteToDisk(blockundo, undoPos, block.hashPrevBlock, chainparams.MessageStart()))) {
+                strError = "Cannot write the block files";
+                return false;
+            }
+            mapRecentPos[block.GetHash()] = std::make_pair(blockPos, undoPos);
+            stats.nBlocks++;
+        }
 
-            if(ExtractAddress(v.scriptPubKey, address)) {
-                addressBalances.push_back(std::make_pair(address, fIsAdd ? v.nValue : 0 - v.nValue));
+        uint32_t nIndex = 0;
+        reader >> nIndex;
+        if (nIndex != (uint32_t)stats.nHeight + 1) {
+            strError = "The block index does not end at the snapshot block";
+            return false;
+        }
+        std::vector<CDiskBlockIndex> vIndex;
+        uint256 hashPrev;
+        size_t nRecentFound = 0;
+        for (uint32_t nHeight = 0; nHeight < nIndex; nHeight++) {
+            CDiskBlockIndex index;
+            reader >> index;
+            uint256 hash = index.GetBlockHash();
+            bool fLinked = nHeight == 0 ? hash == chainparams.GetConsensus().hashGenesisBlock : index.hashPrev == hashPrev;
+            CValidationState state;
+            if (!fLinked || index.nHeight != (int)nHeight || index.nTx == 0 || !index.IsValid(BLOCK_VALID_TRANSACTIONS)
+                || (index.nStatus & ~(BLOCK_VALID_MASK | BLOCK_OPT_WITNESS))
+                || !CheckBlockHeader(index.GetBlockHeader(), state, chainparams.GetConsensus())) {
+                strError = strprintf("Invalid block index entry at height %d", nHeight);
+                return false;
+            }
+
+            auto it = mapRecentPos.find(hash);
+            if (it != mapRecentPos.end()) {
+                index.nStatus |= BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+                index.nFile = it->second.first.nFile;
+                index.nDataPos = it->second.first.nPos;
+                index.nUndoPos = it->second.second.nPos;
+                nRecentFound++;
+            }
+            vIndex.push_back(index);
+            if (vIndex.size() >= 100000 || nHeight + 1 == nIndex) {
+                if (fWrite && !pblocktree->WriteDiskBlockIndex(vIndex)) {
+                    strError = "Cannot write the block index";
+                    return false;
+                }
+                vIndex.clear();
+            }
+            hashPrev = hash;
+        }
+        if (hashPrev != stats.hashBlock || nRecentFound != mapRecentPos.size()) {
+            strError = "The blocks do not match the block index";
+            return false;
+        }
+
+        // Written without a best block, which is set once the whole snapshot checked out
+        while (true) {
+            bool fMore = false;
+            reader >> fMore;
+            if (fMore) {
+                COutPoint key;
+                Coin coin;
+                reader >> key >> coin;
+                if (fWrite)
+                    pcoinsTip->AddCoin(key, std::move(coin), false);
+                stats.nCoins++;
+            }
+            if (fWrite && (!fMore || stats.nCoins % 100000 == 0) && !pcoinsTip->Flush()) {
+                strError = "Cannot write the chain state";
+                return false;
             }
+            if (!fMore)
+                break;
+        }
+
+        CVoteStateSnapshot votestate;
+        if (Vote::GetInstance().LoadSnapshot(reader, fWrite, votestate, stats.nBalances, stats.hashVoteState) == false) {
+            strError = "Cannot write the vote state, or it does not match the snapshot";
+            return false;
         }
 
-        if(mapTxFee) {
-            mapTxFee->insert(std::make_pair(t->GetHash(), fee));
+        stats.hashSnapshot = reader.Finish();
+        if (stats.hashSnapshot != hashExpected) {
+            strError = strprintf("The state snapshot has the hash %s, not %s", stats.hashSnapshot.ToString(), hashExpected.ToString());
+            return false;
+        }
+        if (!fWrite)
+            return true;
+
+        // The blocks below the recent ones are missing as in a pruned node
+        if (!WriteDirtyFileInfo() || !pblocktree->WriteFlag("prunedblockfiles", true)
+            || !DPoS::ImportIrreversibleBlocks(mapIrreversible)
+            || !Vote::GetInstance().CommitSnapshot(votestate, stats.nHeight, stats.hashBlock)) {
+            strError = "Cannot write the state of the snapshot";
+            return false;
         }
+        pcoinsTip->SetBestBlock(stats.hashBlock);
+        if (!pcoinsTip->Flush()) {
+            strError = "Cannot write the chain state";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Cannot read the state snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
 
+bool LoadStateSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, CStateSnapshotStats& stats, std::string& strError)
+{
+    if (hashExpected.IsNull()) {
+        strError = "The hash the state snapshot must have is missing";
+        return false;
     }
-    Vote::GetInstance().UpdateAddressBalance(addressBalances);
+
+    LOCK(cs_main);
+    // The whole file is read and checked before anything is written, then read
+    // again to write it. That pass checks it all once more, so should the file
+    // change in between, the load still fails, though with data already written.
+    if (!ReadStateSnapshot(chainparams, path, hashExpected, false, stats, strError))
+        return false;
+    if (!ReadStateSnapshot(chainparams, path, hashExpected, true, stats, strError))
+        return false;
+
+    LogPrintf("Loaded the state snapshot of block %s at height %d from %s: %u coins, %u balances, %u blocks, hash %s, vote state %s\n",
+        stats.hashBlock.ToString(), stats.nHeight, path.string(), stats.nCoins, stats.nBalances, stats.nBlocks, stats.hashSnapshot.ToString(), stats.hashVoteState.ToString());
+    return true;
 }
@@ -29,6 +29,7 @@
 #include <vector>
 
 #include <atomic>
+#include <memory>
 #include <boost/functional/hash.hpp>
 
 #include <boost/unordered_map.hpp>
@@ -38,13 +39,20 @@ extern std::string strOldBlockHash;
 extern int64_t nOldBlockHeight;
 
 class CBlockIndex;
+class CBlockUndo;
+struct CDPoSBlockDelta;
+struct CDPoSVoteEvent;
 class CBlockTreeDB;
+class CAddressIndexDB;
+class CBlockFilterDB;
+class CDPoSHistoryDB;
 class CWitnessDB;
 class CVoteDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
 class CConnman;
+class CPendingSignatures;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -84,19 +92,34 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
-/** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
+/** The pre-allocation chunk size for blk?????.dat files (since 0.8), the default of -blockfilechunksize */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
-/** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
+/** The pre-allocation chunk size for rev?????.dat files (since 0.8), the default of -undofilechunksize */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading blocks for -reindex-dpos */
+static const int DPOS_REINDEX_MAX_THREADS = 16;
+/** Blocks each -reindex-dpos thread reads before the batch is applied */
+static const int DPOS_REINDEX_BATCH_PER_THREAD = 64;
+/** Blocks the startup DPoS repair reads ahead of the one it applies */
+static const size_t DPOS_REPAIR_PREFETCH = 64;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Number of blocks that can be requested at any given time from a single peer once its round trip and
+ *  block rate are known and call for a larger window than MAX_BLOCKS_IN_TRANSIT_PER_PEER. */
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 256;
+/** Number of peers headers are requested from at the same time while far behind. */
+static const int MAX_HEADERS_SYNC_PEERS = 3;
+/** The block next to our tip is asked from another peer once the one it was asked from took this many times its usual latency. */
+static const int BLOCK_REREQUEST_LATENCY_FACTOR = 4;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -149,7 +172,19 @@ static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = false;
 static const bool DEFAULT_TXINDEX = true;
 static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_DPOSHISTORY = false;
+/** Balances written per batch when the DPoS history starts from the current state */
+static const size_t DPOS_HISTORY_START_BATCH = 100000;
 static const bool DEFAULT_USEIRREVERSIBLEBLOCK = true;
+/** Default for -irreversiblesyncwindow, milliseconds within which the irreversible block journal is synced once */
+static const int64_t DEFAULT_IRREVERSIBLE_SYNC_WINDOW = 0;
+/** Default for -checkpointsync */
+static const bool DEFAULT_CHECKPOINT_SYNC = true;
+/** Default for -maxscriptcachesize, in MiB */
+static const int64_t DEFAULT_MAX_SCRIPT_CACHE_SIZE = 32;
+/** Default for -stopatheight */
+static const int DEFAULT_STOPATHEIGHT = 0;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -mempoolreplacement */
@@ -164,6 +199,8 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+static const bool DEFAULT_PEERCOMPRESSEDHEADERS = true;
 
 struct BlockHasher
 {
@@ -175,6 +212,8 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+/** The entries of mapBlockIndex without a child, the tips of every branch of the block tree */
+extern std::set<const CBlockIndex*> setBlockIndexLeaves;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern uint64_t nLastBlockWeight;
@@ -182,16 +221,31 @@ extern const std::string strMessageMagic;
 extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
+/**
+ * Set while the DPoS state is brought to the active chain at startup, and left
+ * set when that fails: the active chain does not move and the vote state is not
+ * flushed meanwhile, since the DPoS state is of none of its blocks
+ */
+extern std::atomic_bool fDPoSRepairing;
+/** The blocks the startup DPoS repair or rebuild applied so far, and the number it applies */
+extern std::atomic<int> nDPoSRepairDone;
+extern std::atomic<int> nDPoSRepairTotal;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fAddressIndex;
+extern bool fBlockFilterIndex;
+extern bool fDPoSHistory;
 extern bool fUseIrreversibleBlock;
+extern int64_t nIrreversibleSyncWindow;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fCheckpointSync;
 extern size_t nCoinCacheUsage;
+/** -maxmemory in bytes, 0 for no bound, see GetMemoryUsageStats */
+extern size_t nMaxMemoryUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -216,11 +270,16 @@ extern bool fHavePruned;
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
+/** Bytes the blk?????.dat and rev?????.dat files are pre-allocated by at a time */
+extern unsigned int nBlockFileChunkSize;
+extern unsigned int nUndoFileChunkSize;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Verify the -checkblocks once the node runs instead of before it starts */
+static const bool DEFAULT_CHECKBLOCKS_BACKGROUND = true;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -232,7 +291,11 @@ static const unsigned int DEFAULT_CHECKLEVEL = 3;
 // Setting the target to > than 550MB will make it likely we can respect the target.
 static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 
-bool IsVotingTxout(const CTxOut& txout, CPubKey& pubkey, CScript& script);
+bool IsVotingTxout(const CTxOut& txout, CScript& script);
+/** Fee DoVoting requires for a DPoS operation to take effect, 0 if opcode is not one */
+CAmount GetDPoSOpMinFee(uint8_t opcode);
+/** Apply the DPoS operations of a block to the vote state, or take them back with fUndo. The delta gives the fee and the sender of each transaction */
+bool DoVoting(const CBlock& block, uint32_t nHeight, const CDPoSBlockDelta& delta, bool fUndo, CDPoSVoteEvent* pevent = NULL);
 
 /** 
  * Process an incoming block. This only returns after the best known valid
@@ -285,6 +348,12 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the forger signature verification thread */
+void ThreadForgerCheck();
+/** Run an instance of the transaction input checking thread */
+void ThreadTxInputsCheck();
+/** Run an instance of the coin fetching thread */
+void ThreadCoinFetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -322,9 +391,10 @@ double GuessVerificationProgress(const ChainTxData& data, CBlockIndex* pindex);
 void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 
 /**
- *  Mark one block file as pruned.
+ *  Mark one block file as pruned, after keeping the coinbases DPoS needs.
+ *  False if those could not be kept, and the file must stay.
  */
-void PruneOneBlockFile(const int fileNumber);
+bool PruneOneBlockFile(const int fileNumber);
 
 /**
  *  Actually unlink the specified files
@@ -335,6 +405,37 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+
+/** Memory the large structures of the node use, and what -maxmemory leaves the ones that can shrink */
+struct CMemoryUsageStats {
+    size_t nCoinsCache;
+    size_t nVoteCache;
+    size_t nMempool;
+    size_t nBlockIndex;
+    size_t nSigCache;
+    size_t nRawBlockCache;
+    //! Bound of the coins and vote caches together, which are flushed above it
+    size_t nCoinsLimit;
+    //! Bound of the mempool, which is trimmed above it
+    size_t nMempoolLimit;
+
+    size_t GetTotal() const { return nCoinsCache + nVoteCache + nMempool + nBlockIndex + nSigCache + nRawBlockCache; }
+};
+/**
+ * Measure the structures above. Under -maxmemory, the coins caches and the
+ * mempool share what the block index and the signature and raw block caches,
+ * which do not shrink, leave of the budget, in proportion to -dbcache and
+ * -maxmempool. FlushStateToDisk flushes and trims to the limits.
+ */
+CMemoryUsageStats GetMemoryUsageStats();
+/**
+ * Set the limits of stats, whose fixed structures are measured, from the
+ * budget nMaxMemory, 0 for no bound, and the -dbcache and -maxmempool bounds
+ * nCoinsMax and nMempoolMax. The mempool keeps nMempoolMin at least.
+ */
+void SplitMemoryBudget(CMemoryUsageStats& stats, size_t nMaxMemory, size_t nCoinsMax, size_t nMempoolMax, size_t nMempoolMin);
+/** The -maxmempool bound in bytes, lowered while -maxmemory takes a share of it */
+size_t GetMempoolSizeLimit();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 /** Prune block files up to a given height */
@@ -351,6 +452,17 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/**
+ * Run the checks of AcceptToMemoryPool on a batch of transactions ahead of it,
+ * without cs_main held, against one copy of the coins they spend: the
+ * context-free, policy and fee checks, and last the input scripts. The
+ * signatures of the transactions whose scripts pass go to vPending instead of
+ * the signature cache, and are taken as verified while AcceptToMemoryPool
+ * runs in their scope; the others are left empty. AcceptToMemoryPool still
+ * does all of its checks afterwards.
+ */
+void PreCheckTransactions(const std::vector<CTransactionRef>& vtx, std::vector<CPendingSignatures>& vPending);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -390,10 +502,17 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. If cacheFullScriptStore is set and all scripts were run
+ * inline and passed, the transaction is remembered as valid under flags in the script
+ * execution cache, which is consulted before running any script. fCheckTxInputs can be
+ * cleared by callers that run Consensus::CheckTxInputs themselves.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL,
+                 bool fCheckTxInputs = true);
+
+/** Initializes the script-execution cache */
+void InitScriptExecutionCache();
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -403,8 +522,27 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, bool fCheckDuplicateInputs=true);
 
+/** The address a script pays to, false if it does not pay to a key or script hash */
+bool ExtractAddress(const CScript& script, CMyAddress& address);
+
 namespace Consensus {
 
+/**
+ * An output spent by a transaction input, copied out of the UTXO view. The address
+ * its script pays to is extracted once here for the consensus and DPoS checks.
+ */
+struct CSpentOutput {
+    CTxOut txout;
+    int nHeight;
+    bool fCoinBase;
+    bool fAddress; // Whether the script pays to an address
+    CMyAddress address;
+
+    CSpentOutput() : nHeight(0), fCoinBase(false), fAddress(false) {}
+    CSpentOutput(const CTxOut& txoutIn, int nHeightIn, bool fCoinBaseIn);
+    CSpentOutput(const Coin& coin) : CSpentOutput(coin.out, coin.nHeight, coin.IsCoinBase()) {}
+};
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends and amounts)
  * This does not modify the UTXO set. This does not check scripts and sigs.
@@ -412,6 +550,12 @@ namespace Consensus {
  */
 bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight);
 
+/**
+ * The same checks on the outputs tx spends, one per input and already resolved, so
+ * they do not need the view. The fee paid by tx is returned in nTxFee.
+ */
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const std::vector<CSpentOutput>& vSpent, int nSpendHeight, CAmount& nTxFee);
+
 } // namespace Consensus
 
 /**
@@ -448,10 +592,12 @@ bool SequenceLocks(const CTransaction &tx, int flags, std::vector<int>* prevHeig
  * of the block needed for calculation or skips the calculation and uses the LockPoints
  * passed in for evaluation.
  * The LockPoints should not be considered valid if CheckSequenceLocks returns false.
+ * The coins spent are looked up in pcoinsView when given, which then needs no
+ * lock on the mempool, else in the mempool and pcoinsTip.
  *
  * See consensus/consensus.h for flag definitions.
  */
-bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL, bool useExistingLockPoints = false);
+bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL, bool useExistingLockPoints = false, const CCoinsView* pcoinsView = NULL);
 
 /**
  * Closure representing one script verification
@@ -471,8 +617,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -491,11 +637,107 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure running Consensus::CheckTxInputs on the resolved spent outputs of one
+ * transaction, so the transactions of a block are checked in parallel.
+ * Note that this stores references to the transaction, its state and fee.
+ */
+class CTxInputsCheck
+{
+private:
+    const CTransaction *ptx;
+    std::vector<Consensus::CSpentOutput> vSpent;
+    int nSpendHeight;
+    CValidationState *pstate;
+    CAmount *pnTxFee;
+
+public:
+    CTxInputsCheck(): ptx(0), nSpendHeight(0), pstate(0), pnTxFee(0) {}
+    CTxInputsCheck(const CTransaction& txIn, std::vector<Consensus::CSpentOutput>& vSpentIn, int nSpendHeightIn, CValidationState* pstateIn, CAmount* pnTxFeeIn) :
+        ptx(&txIn), nSpendHeight(nSpendHeightIn), pstate(pstateIn), pnTxFee(pnTxFeeIn) { vSpent.swap(vSpentIn); }
+
+    bool operator()();
+
+    void swap(CTxInputsCheck &check) {
+        std::swap(ptx, check.ptx);
+        vSpent.swap(check.vSpent);
+        std::swap(nSpendHeight, check.nSpendHeight);
+        std::swap(pstate, check.pstate);
+        std::swap(pnTxFee, check.pnTxFee);
+    }
+};
+
+/**
+ * Closure verifying the forger signature and address of a block coinbase,
+ * the part of DPoS::CheckBlock that does not depend on the previous blocks.
+ */
+class CForgerCheck
+{
+private:
+    CTransactionRef coinbase;
+    uint64_t nTime;
+
+public:
+    CForgerCheck(): nTime(0) {}
+    CForgerCheck(const CTransactionRef& coinbaseIn, uint64_t nTimeIn) : coinbase(coinbaseIn), nTime(nTimeIn) {}
+
+    bool operator()();
+
+    void swap(CForgerCheck &check) {
+        coinbase.swap(check.coinbase);
+        std::swap(nTime, check.nTime);
+    }
+};
+
+/**
+ * Closure reading one coin from a view, so the outputs a block spends are read
+ * from the database in parallel before it is connected. It never fails, an
+ * outpoint that is not found is left to ConnectBlock to reject.
+ * Note that this stores references to the view and to the results.
+ */
+class CCoinFetch
+{
+private:
+    const CCoinsView *pview;
+    COutPoint outpoint;
+    Coin *pcoin;
+    char *pfFound;
+
+public:
+    CCoinFetch(): pview(0), pcoin(0), pfFound(0) {}
+    CCoinFetch(const CCoinsView* pviewIn, const COutPoint& outpointIn, Coin* pcoinIn, char* pfFoundIn) :
+        pview(pviewIn), outpoint(outpointIn), pcoin(pcoinIn), pfFound(pfFoundIn) {}
+
+    bool operator()();
+
+    void swap(CCoinFetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(outpoint, check.outpoint);
+        std::swap(pcoin, check.pcoin);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/**
+ * Append the block, or the undo data without its checksum, stored at pos to
+ * strData as it is on disk, without deserializing it. Blocks are stored with
+ * their witness data. Consecutive records are read from the mapped block files.
+ */
+bool ReadRawRecordFromDisk(std::string& strData, const CDiskBlockPos& pos, bool fUndo);
+/**
+ * The blocks stored at vPos, as they are on disk, into vData in the same
+ * order. They are read in the order of their positions, so blocks stored one
+ * after another are read in one sequential pass, from the mapped block files
+ * or else a single open file. False if any could not be read, whose entry is
+ * left empty.
+ */
+bool ReadRawBlocksFromDisk(std::vector<std::vector<unsigned char> >& vData, const std::vector<CDiskBlockPos>& vPos);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -511,15 +753,18 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pdposdelta is provided, it receives the block's address balance changes and fees.
+ *  If pstats is provided, the outputs the block spends and creates are applied to it. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CDPoSBlockDelta* pdposdelta = NULL, CUTXOStats* pstats = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pblockundo is provided,
+ *  it receives the undo data that was applied, and if pstats is, the outputs removed and restored. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CBlockUndo* pblockundo = NULL, CUTXOStats* pstats = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -544,6 +789,9 @@ public:
     bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/** VerifyDB on top of pcoinsTip while the node runs, raising a warning and -alertnotify if it fails */
+bool BackgroundVerifyDB(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth);
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -559,12 +807,48 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * The tip of chainActive, published each time the tip moves so the read-only
+ * RPCs need not wait for cs_main. Block index entries and their ancestors are
+ * never changed once linked, so the tip may be walked with GetAncestor. During
+ * a reorganization it may show a tip between the old and the new one.
+ */
+struct CChainTipSnapshot
+{
+    const CBlockIndex* pindexTip;
+    int nHeight;
+    uint256 hashTip;
+    int64_t nTime;
+    int64_t nMedianTimePast;
+};
+
+/** The last published tip of chainActive, NULL tip before the chain is loaded */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/**
+ * Load the statistics of the unspent outputs of pcoinsTip, which blocks
+ * connected and disconnected from then on keep up to date. They are computed
+ * with a scan of the chainstate when none are stored for its best block.
+ */
+void LoadUTXOStats();
+/** The statistics of the unspent outputs at the tip, false before LoadUTXOStats. Requires cs_main */
+bool GetTipUTXOStats(CUTXOStats& stats);
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the address index, if -addressindex is on (protected by cs_main) */
+extern CAddressIndexDB *paddressindex;
+
+/** Global variable that points to the block filter index, if -blockfilterindex is on */
+extern CBlockFilterDB *pblockfilterdb;
+
+/** Global variable that points to the DPoS history, if -dposhistory is on */
+extern CDPoSHistoryDB *pdposhistory;
+
 extern CVoteDB* pvote;
 
 extern CWitnessDB* pwitness;
@@ -604,6 +888,52 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** What a state snapshot holds, as written or loaded */
+struct CStateSnapshotStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    //! Blocks written with their data and undo data
+    uint64_t nBlocks;
+    uint64_t nCoins;
+    uint64_t nBalances;
+    uint64_t nFileSize;
+    uint256 hashSnapshot;
+    //! The commitment to the vote state, as getvotestateinfo reports it at the snapshot block
+    uint256 hashVoteState;
+
+    CStateSnapshotStats() : nHeight(0), nBlocks(0), nCoins(0), nBalances(0), nFileSize(0) {}
+};
+
+/**
+ * Write the chain state, the vote state and the irreversible blocks of the tip
+ * to a state snapshot, with the block index of the active chain and the data
+ * of its last blocks, for a new node to start from with -loadsnapshot.
+ */
+bool DumpStateSnapshot(const boost::filesystem::path& path, CStateSnapshotStats& stats, std::string& strError);
+/**
+ * Fill an empty block index, chain state and vote database from a state
+ * snapshot, before the block index is loaded. The node then goes on as a
+ * pruned node that has the last blocks of the snapshot. The snapshot must
+ * have the hash hashExpected, and is checked whole before anything is written.
+ */
+bool LoadStateSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, CStateSnapshotStats& stats, std::string& strError);
+
+/**
+ * Bring the DPoS state from the block it was flushed at to the tip of the
+ * active chain. The blocks are read on a thread of their own and each one is
+ * applied under a short cs_main, so RPC answers meanwhile
+ */
 bool RepairDPoSData(int64_t nOldBlockHeight, const std::string& strOldBlockHash);
+/** Rebuild the DPoS state of the whole active chain, for -reindex-dpos */
+bool ReindexDPoSData();
+/**
+ * Bring the DPoS history in line with the active chain once the vote state is
+ * loaded, taking back the blocks it no longer has. When the history is empty
+ * or has a gap it starts over from the vote state of the tip.
+ */
+bool InitDPoSHistory();
+/** The heights the DPoS history answers for, false when it is off or empty */
+bool GetDPoSHistoryRange(int& nStartHeight, int& nBestHeight);
 
 #endif // BITCOIN_VALIDATION_H
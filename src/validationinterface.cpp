@@ -5,40 +5,255 @@
 
 #include "validationinterface.h"
 
+#include "miner.h"
+#include "scheduler.h"
+#include "txmempool.h"
+#include "vote.h"
+
+#include <map>
+#include <mutex>
+
 static CMainSignals g_signals;
 
+/**
+ * Stands in for a background listener on the signals, and queues copies of
+ * the updates for it on its own SingleThreadedSchedulerClient, which keeps
+ * them in order.
+ */
+class CBackgroundValidationInterface final : public CValidationInterface
+{
+public:
+    CBackgroundValidationInterface(CValidationInterface* pinterfaceIn, CScheduler* pscheduler) : pinterface(pinterfaceIn), queue(pscheduler) {}
+
+    void Flush() { queue.Flush(); }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, pindexNew, pindexFork, fInitialDownload]() { p->UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload); });
+    }
+    void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock) override
+    {
+        CValidationInterface* p = pinterface;
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        queue.AddToProcessQueue([p, ptx, pindex, posInBlock]() { p->SyncTransaction(*ptx, pindex, posInBlock); });
+    }
+    void BeginBlockTransactions() override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p]() { p->BeginBlockTransactions(); });
+    }
+    void EndBlockTransactions() override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p]() { p->EndBlockTransactions(); });
+    }
+    void SetBestChain(const CBlockLocator &locator) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, locator]() { p->SetBestChain(locator); });
+    }
+    void UpdatedTransaction(const uint256 &hash) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, hash]() { p->UpdatedTransaction(hash); });
+    }
+    void Inventory(const uint256 &hash) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, hash]() { p->Inventory(hash); });
+    }
+    void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override
+    {
+        pinterface->ResendWalletTransactions(nBestBlockTime, connman);
+    }
+    void BlockChecked(const CBlock& block, const CValidationState& state) override
+    {
+        pinterface->BlockChecked(block, state);
+    }
+    void GetScriptForMining(boost::shared_ptr<CReserveScript>& script) override
+    {
+        pinterface->GetScriptForMining(script);
+    }
+    void ResetRequestCount(const uint256 &hash) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, hash]() { p->ResetRequestCount(hash); });
+    }
+    void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, pindex, block]() { p->NewPoWValidBlock(pindex, block); });
+    }
+    void TransactionAddedToMempool(const CTransactionRef &ptx) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, ptx]() { p->TransactionAddedToMempool(ptx); });
+    }
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, ptx]() { p->TransactionRemovedFromMempool(ptx); });
+    }
+    void ForgingSlot(const CForgingSlotStats &slot) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, slot]() { p->ForgingSlot(slot); });
+    }
+    void DPoSRound(const CDPoSRoundEvent &round) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, round]() { p->DPoSRound(round); });
+    }
+    void IrreversibleBlock(int64_t nHeight, const uint256 &hash) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, nHeight, hash]() { p->IrreversibleBlock(nHeight, hash); });
+    }
+    void DPoSVotes(const CDPoSVoteEvent &votes) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, votes]() { p->DPoSVotes(votes); });
+    }
+    void DPoSBalances(const CDPoSBalanceEvent &balances) override
+    {
+        CValidationInterface* p = pinterface;
+        queue.AddToProcessQueue([p, balances]() { p->DPoSBalances(balances); });
+    }
+
+private:
+    CValidationInterface* pinterface;
+    SingleThreadedSchedulerClient queue;
+};
+
+//! Scheduler of the background listeners, NULL until there is one
+static CScheduler* pBackgroundScheduler = NULL;
+//! The stand-ins of the background listeners
+static std::map<CValidationInterface*, CBackgroundValidationInterface*> mapBackgroundInterfaces;
+static std::mutex cs_backgroundInterfaces;
+
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
-    g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
-    g_signals.NewPoWValidBlock.connect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+static void MempoolEntryAdded(CTransactionRef ptx)
+{
+    g_signals.TransactionAddedToMempool(ptx);
+}
+
+static void MempoolEntryRemoved(CTransactionRef ptx, MemPoolRemovalReason reason)
+{
+    g_signals.TransactionRemovedFromMempool(ptx);
+}
+
+void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler& scheduler)
+{
+    std::lock_guard<std::mutex> lock(cs_backgroundInterfaces);
+    pBackgroundScheduler = &scheduler;
+}
+
+void CMainSignals::RegisterWithMempoolSignals(CTxMemPool& pool)
+{
+    pool.NotifyEntryAdded.connect(&MempoolEntryAdded);
+    pool.NotifyEntryRemoved.connect(&MempoolEntryRemoved);
+}
+
+void CMainSignals::UnregisterWithMempoolSignals(CTxMemPool& pool)
+{
+    pool.NotifyEntryAdded.disconnect(&MempoolEntryAdded);
+    pool.NotifyEntryRemoved.disconnect(&MempoolEntryRemoved);
+}
+
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fBackground) {
+    CValidationInterface* pinterface = pwalletIn;
+    if (fBackground) {
+        std::lock_guard<std::mutex> lock(cs_backgroundInterfaces);
+        if (pBackgroundScheduler) {
+            CBackgroundValidationInterface*& pbackground = mapBackgroundInterfaces[pwalletIn];
+            if (pbackground)
+                return;
+            pbackground = new CBackgroundValidationInterface(pwalletIn, pBackgroundScheduler);
+            pinterface = pbackground;
+        }
+    }
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pinterface, _1, _2, _3));
+    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pinterface, _1, _2, _3));
+    g_signals.BeginBlockTransactions.connect(boost::bind(&CValidationInterface::BeginBlockTransactions, pinterface));
+    g_signals.EndBlockTransactions.connect(boost::bind(&CValidationInterface::EndBlockTransactions, pinterface));
+    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pinterface, _1));
+    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pinterface, _1));
+    g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pinterface, _1));
+    g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pinterface, _1, _2));
+    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pinterface, _1, _2));
+    g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pinterface, _1));
+    g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pinterface, _1));
+    g_signals.NewPoWValidBlock.connect(boost::bind(&CValidationInterface::NewPoWValidBlock, pinterface, _1, _2));
+    g_signals.TransactionAddedToMempool.connect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pinterface, _1));
+    g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pinterface, _1));
+    g_signals.ForgingSlot.connect(boost::bind(&CValidationInterface::ForgingSlot, pinterface, _1));
+    g_signals.DPoSRound.connect(boost::bind(&CValidationInterface::DPoSRound, pinterface, _1));
+    g_signals.IrreversibleBlock.connect(boost::bind(&CValidationInterface::IrreversibleBlock, pinterface, _1, _2));
+    g_signals.DPoSVotes.connect(boost::bind(&CValidationInterface::DPoSVotes, pinterface, _1));
+    g_signals.DPoSBalances.connect(boost::bind(&CValidationInterface::DPoSBalances, pinterface, _1));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
-    g_signals.ScriptForMining.disconnect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
-    g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.NewPoWValidBlock.disconnect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+    CBackgroundValidationInterface* pbackground = NULL;
+    {
+        std::lock_guard<std::mutex> lock(cs_backgroundInterfaces);
+        std::map<CValidationInterface*, CBackgroundValidationInterface*>::iterator it = mapBackgroundInterfaces.find(pwalletIn);
+        if (it != mapBackgroundInterfaces.end()) {
+            pbackground = it->second;
+            mapBackgroundInterfaces.erase(it);
+        }
+    }
+    CValidationInterface* pinterface = pbackground ? pbackground : pwalletIn;
+    g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pinterface, _1));
+    g_signals.ScriptForMining.disconnect(boost::bind(&CValidationInterface::GetScriptForMining, pinterface, _1));
+    g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pinterface, _1, _2));
+    g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pinterface, _1, _2));
+    g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pinterface, _1));
+    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pinterface, _1));
+    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pinterface, _1));
+    g_signals.EndBlockTransactions.disconnect(boost::bind(&CValidationInterface::EndBlockTransactions, pinterface));
+    g_signals.BeginBlockTransactions.disconnect(boost::bind(&CValidationInterface::BeginBlockTransactions, pinterface));
+    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pinterface, _1, _2, _3));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pinterface, _1, _2, _3));
+    g_signals.NewPoWValidBlock.disconnect(boost::bind(&CValidationInterface::NewPoWValidBlock, pinterface, _1, _2));
+    g_signals.TransactionAddedToMempool.disconnect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pinterface, _1));
+    g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pinterface, _1));
+    g_signals.ForgingSlot.disconnect(boost::bind(&CValidationInterface::ForgingSlot, pinterface, _1));
+    g_signals.DPoSRound.disconnect(boost::bind(&CValidationInterface::DPoSRound, pinterface, _1));
+    g_signals.IrreversibleBlock.disconnect(boost::bind(&CValidationInterface::IrreversibleBlock, pinterface, _1, _2));
+    g_signals.DPoSVotes.disconnect(boost::bind(&CValidationInterface::DPoSVotes, pinterface, _1));
+    g_signals.DPoSBalances.disconnect(boost::bind(&CValidationInterface::DPoSBalances, pinterface, _1));
+    if (pbackground) {
+        pbackground->Flush();
+        delete pbackground;
+    }
+}
+
+void SyncWithValidationInterfaceQueue() {
+    std::vector<CBackgroundValidationInterface*> vBackground;
+    {
+        std::lock_guard<std::mutex> lock(cs_backgroundInterfaces);
+        for (const auto& item : mapBackgroundInterfaces)
+            vBackground.push_back(item.second);
+    }
+    // Background listeners are only unregistered at shutdown, once the
+    // threads that would call this are gone
+    for (CBackgroundValidationInterface* pbackground : vBackground)
+        pbackground->Flush();
 }
 
 void UnregisterAllValidationInterfaces() {
+    std::map<CValidationInterface*, CBackgroundValidationInterface*> mapBackground;
+    {
+        std::lock_guard<std::mutex> lock(cs_backgroundInterfaces);
+        mapBackground.swap(mapBackgroundInterfaces);
+    }
     g_signals.BlockFound.disconnect_all_slots();
     g_signals.ScriptForMining.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
@@ -46,7 +261,21 @@ void UnregisterAllValidationInterfaces() {
     g_signals.Inventory.disconnect_all_slots();
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
+    g_signals.EndBlockTransactions.disconnect_all_slots();
+    g_signals.BeginBlockTransactions.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.NewPoWValidBlock.disconnect_all_slots();
+    g_signals.TransactionAddedToMempool.disconnect_all_slots();
+    g_signals.ForgingSlot.disconnect_all_slots();
+    g_signals.DPoSRound.disconnect_all_slots();
+    g_signals.IrreversibleBlock.disconnect_all_slots();
+    g_signals.DPoSVotes.disconnect_all_slots();
+    g_signals.DPoSBalances.disconnect_all_slots();
+    g_signals.TransactionRemovedFromMempool.disconnect_all_slots();
+
+    for (const auto& item : mapBackground) {
+        item.second->Flush();
+        delete item.second;
+    }
 }
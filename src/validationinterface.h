@@ -6,6 +6,8 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include "primitives/transaction.h"
+
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
 #include <memory>
@@ -16,24 +18,47 @@ struct CBlockLocator;
 class CBlockIndex;
 class CConnman;
 class CReserveScript;
+class CScheduler;
 class CTransaction;
+class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+struct CDPoSBalanceEvent;
+struct CDPoSRoundEvent;
+struct CDPoSVoteEvent;
+struct CForgingSlotStats;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
-/** Unregister a wallet from core */
+/**
+ * Register a wallet to receive updates from core. With fBackground the
+ * updates are queued, in order, for the background scheduler instead of
+ * being handled by the thread that sends them, so they never hold up block
+ * connection. Such a listener sees a later chain state than the one of the
+ * update and does not run with cs_main held. GetScriptForMining,
+ * ResendWalletTransactions and BlockChecked are still called right away,
+ * since their callers need the answer or their arguments do not outlive the
+ * call. Without a background scheduler all updates are handled right away.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fBackground = false);
+/** Unregister a wallet from core, after its queued updates have been handled */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/**
+ * Wait until the updates queued so far for background listeners have been
+ * handled, for callers that need to see their effects. Must not be called
+ * with cs_main held or from a listener.
+ */
+void SyncWithValidationInterfaceQueue();
 
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock) {}
+    virtual void BeginBlockTransactions() {}
+    virtual void EndBlockTransactions() {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -42,9 +67,17 @@ protected:
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {};
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    virtual void TransactionAddedToMempool(const CTransactionRef &ptx) {}
+    virtual void TransactionRemovedFromMempool(const CTransactionRef &ptx) {}
+    virtual void ForgingSlot(const CForgingSlotStats &slot) {}
+    virtual void DPoSRound(const CDPoSRoundEvent &round) {}
+    virtual void IrreversibleBlock(int64_t nHeight, const uint256 &hash) {}
+    virtual void DPoSVotes(const CDPoSVoteEvent &votes) {}
+    virtual void DPoSBalances(const CDPoSBalanceEvent &balances) {}
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
+    friend class CBackgroundValidationInterface;
 };
 
 struct CMainSignals {
@@ -61,6 +94,9 @@ struct CMainSignals {
      * removal was due to conflict from connected block), or appeared in a
      * disconnected block.*/
     boost::signals2::signal<void (const CTransaction &, const CBlockIndex *pindex, int posInBlock)> SyncTransaction;
+    /** Bracket the SyncTransaction calls for the transactions of connected blocks, with cs_main held throughout */
+    boost::signals2::signal<void ()> BeginBlockTransactions;
+    boost::signals2::signal<void ()> EndBlockTransactions;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */
@@ -79,6 +115,29 @@ struct CMainSignals {
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated yet */
     boost::signals2::signal<void (const CBlockIndex *, const std::shared_ptr<const CBlock>&)> NewPoWValidBlock;
+    /**
+     * Notifies listeners of a transaction added to the mempool, and of one
+     * removed from it for any reason. Called with the mempool lock held.
+     */
+    boost::signals2::signal<void (const CTransactionRef &)> TransactionAddedToMempool;
+    boost::signals2::signal<void (const CTransactionRef &)> TransactionRemovedFromMempool;
+    /** Notifies listeners of what became of a block slot of the delegate we forge for */
+    boost::signals2::signal<void (const CForgingSlotStats &)> ForgingSlot;
+    /** Notifies listeners of the delegates of a round, when its first block is connected */
+    boost::signals2::signal<void (const CDPoSRoundEvent &)> DPoSRound;
+    /** Notifies listeners of a block that became irreversible */
+    boost::signals2::signal<void (int64_t nHeight, const uint256 &)> IrreversibleBlock;
+    /** Notifies listeners of the votes of a block that was connected or disconnected, with cs_main held */
+    boost::signals2::signal<void (const CDPoSVoteEvent &)> DPoSVotes;
+    /** Notifies listeners of the address balance changes of a block that was connected or disconnected, with cs_main held */
+    boost::signals2::signal<void (const CDPoSBalanceEvent &)> DPoSBalances;
+
+    /** Queue the updates of background listeners registered from now on for scheduler */
+    void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+
+    /** Forward the additions to and removals from the mempool to the signals above */
+    void RegisterWithMempoolSignals(CTxMemPool& pool);
+    void UnregisterWithMempoolSignals(CTxMemPool& pool);
 };
 
 CMainSignals& GetMainSignals();
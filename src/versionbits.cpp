@@ -5,6 +5,7 @@
 #include "versionbits.h"
 
 #include "consensus/params.h"
+#include "hash.h"
 
 const struct BIP9DeploymentInfo VersionBitsDeploymentInfo[Consensus::MAX_VERSION_BITS_DEPLOYMENTS] = {
     {
@@ -33,26 +34,31 @@ ThresholdState AbstractThresholdConditionChecker::GetStateFor(const CBlockIndex*
         pindexPrev = pindexPrev->GetAncestor(pindexPrev->nHeight - ((pindexPrev->nHeight + 1) % nPeriod));
     }
 
+    // Nothing changes on top of a period in a final state
+    if (cache.pindexFinal && pindexPrev && pindexPrev->GetAncestor(cache.pindexFinal->nHeight) == cache.pindexFinal) {
+        return cache.stateFinal;
+    }
+
     // Walk backwards in steps of nPeriod to find a pindexPrev whose information is known
     std::vector<const CBlockIndex*> vToCompute;
-    while (cache.count(pindexPrev) == 0) {
+    while (cache.states.count(pindexPrev) == 0) {
         if (pindexPrev == NULL) {
             // The genesis block is by definition defined.
-            cache[pindexPrev] = THRESHOLD_DEFINED;
+            cache.states[pindexPrev] = THRESHOLD_DEFINED;
             break;
         }
         if (pindexPrev->GetMedianTimePast() < nTimeStart) {
             // Optimization: don't recompute down further, as we know every earlier block will be before the start time
-            cache[pindexPrev] = THRESHOLD_DEFINED;
+            cache.states[pindexPrev] = THRESHOLD_DEFINED;
             break;
         }
         vToCompute.push_back(pindexPrev);
         pindexPrev = pindexPrev->GetAncestor(pindexPrev->nHeight - nPeriod);
     }
 
-    // At this point, cache[pindexPrev] is known
-    assert(cache.count(pindexPrev));
-    ThresholdState state = cache[pindexPrev];
+    // At this point, cache.states[pindexPrev] is known
+    assert(cache.states.count(pindexPrev));
+    ThresholdState state = cache.states[pindexPrev];
 
     // Now walk forward and compute the state of descendants of pindexPrev
     while (!vToCompute.empty()) {
@@ -99,7 +105,11 @@ ThresholdState AbstractThresholdConditionChecker::GetStateFor(const CBlockIndex*
                 break;
             }
         }
-        cache[pindexPrev] = state = stateNext;
+        if (!cache.pindexFinal && state != stateNext && (stateNext == THRESHOLD_ACTIVE || stateNext == THRESHOLD_FAILED)) {
+            cache.pindexFinal = pindexPrev;
+            cache.stateFinal = stateNext;
+        }
+        cache.states[pindexPrev] = state = stateNext;
     }
 
     return state;
@@ -124,6 +134,11 @@ int AbstractThresholdConditionChecker::GetStateSinceHeightFor(const CBlockIndex*
     // The parent of the genesis block is represented by NULL.
     pindexPrev = pindexPrev->GetAncestor(pindexPrev->nHeight - ((pindexPrev->nHeight + 1) % nPeriod));
 
+    // A final state began with the period the cache knows
+    if (cache.pindexFinal && initialState == cache.stateFinal && pindexPrev->GetAncestor(cache.pindexFinal->nHeight) == cache.pindexFinal) {
+        return cache.pindexFinal->nHeight + 1;
+    }
+
     const CBlockIndex* previousPeriodParent = pindexPrev->GetAncestor(pindexPrev->nHeight - nPeriod);
 
     while (previousPeriodParent != NULL && GetStateFor(previousPeriodParent, params, cache) == initialState) {
@@ -135,6 +150,54 @@ int AbstractThresholdConditionChecker::GetStateSinceHeightFor(const CBlockIndex*
     return pindexPrev->nHeight + 1;
 }
 
+uint256 AbstractThresholdConditionChecker::GetParamsHash(const Consensus::Params& params) const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << BeginTime(params) << EndTime(params) << Period(params) << Threshold(params);
+    return ss.GetHash();
+}
+
+ThresholdCacheRecord AbstractThresholdConditionChecker::GetCacheRecord(const CBlockIndex* pindexTip, const Consensus::Params& params, const ThresholdConditionCache& cache) const
+{
+    ThresholdCacheRecord record;
+    record.hashParams = GetParamsHash(params);
+    if (cache.pindexFinal) {
+        record.hashFinal = cache.pindexFinal->GetBlockHash();
+        record.nStateFinal = cache.stateFinal;
+    }
+    if (pindexTip) {
+        int nPeriod = Period(params);
+        const CBlockIndex* pindexLast = pindexTip->GetAncestor(pindexTip->nHeight - ((pindexTip->nHeight + 1) % nPeriod));
+        std::map<const CBlockIndex*, ThresholdState>::const_iterator it = cache.states.find(pindexLast);
+        if (pindexLast && it != cache.states.end()) {
+            record.hashLast = pindexLast->GetBlockHash();
+            record.nStateLast = it->second;
+        }
+    }
+    return record;
+}
+
+bool AbstractThresholdConditionChecker::LoadCacheRecord(const ThresholdCacheRecord& record, const Consensus::Params& params, ThresholdConditionCache& cache,
+                                                        const std::function<const CBlockIndex*(const uint256&)>& lookup) const
+{
+    if (record.hashParams != GetParamsHash(params))
+        return false;
+    if (!record.hashFinal.IsNull() && (record.nStateFinal == THRESHOLD_ACTIVE || record.nStateFinal == THRESHOLD_FAILED)) {
+        const CBlockIndex* pindexFinal = lookup(record.hashFinal);
+        if (pindexFinal) {
+            cache.pindexFinal = pindexFinal;
+            cache.stateFinal = (ThresholdState)record.nStateFinal;
+            cache.states[pindexFinal] = cache.stateFinal;
+        }
+    }
+    if (!record.hashLast.IsNull() && record.nStateLast <= THRESHOLD_FAILED) {
+        const CBlockIndex* pindexLast = lookup(record.hashLast);
+        if (pindexLast)
+            cache.states[pindexLast] = (ThresholdState)record.nStateLast;
+    }
+    return true;
+}
+
 namespace
 {
 /**
@@ -155,6 +218,13 @@ protected:
         return (((pindex->nVersion & VERSIONBITS_TOP_MASK) == VERSIONBITS_TOP_BITS) && (pindex->nVersion & Mask(params)) != 0);
     }
 
+    uint256 GetParamsHash(const Consensus::Params& params) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << AbstractThresholdConditionChecker::GetParamsHash(params) << Mask(params);
+        return ss.GetHash();
+    }
+
 public:
     VersionBitsConditionChecker(Consensus::DeploymentPos id_) : id(id_) {}
     uint32_t Mask(const Consensus::Params& params) const { return ((uint32_t)1) << params.vDeployments[id].bit; }
@@ -177,6 +247,17 @@ uint32_t VersionBitsMask(const Consensus::Params& params, Consensus::DeploymentP
     return VersionBitsConditionChecker(pos).Mask(params);
 }
 
+ThresholdCacheRecord VersionBitsCacheRecord(const CBlockIndex* pindexTip, const Consensus::Params& params, Consensus::DeploymentPos pos, const VersionBitsCache& cache)
+{
+    return VersionBitsConditionChecker(pos).GetCacheRecord(pindexTip, params, cache.caches[pos]);
+}
+
+bool LoadVersionBitsCacheRecord(const ThresholdCacheRecord& record, const Consensus::Params& params, Consensus::DeploymentPos pos, VersionBitsCache& cache,
+                                const std::function<const CBlockIndex*(const uint256&)>& lookup)
+{
+    return VersionBitsConditionChecker(pos).LoadCacheRecord(record, params, cache.caches[pos], lookup);
+}
+
 void VersionBitsCache::Clear()
 {
     for (unsigned int d = 0; d < Consensus::MAX_VERSION_BITS_DEPLOYMENTS; d++) {
@@ -6,6 +6,10 @@
 #define BITCOIN_CONSENSUS_VERSIONBITS
 
 #include "chain.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <functional>
 #include <map>
 
 /** What block version to use for new blocks (pre versionbits) */
@@ -25,10 +29,63 @@ enum ThresholdState {
     THRESHOLD_FAILED,
 };
 
-// A map that gives the state for blocks whose height is a multiple of Period().
-// The map is indexed by the block's parent, however, so all keys in the map
-// will either be NULL or a block with (height + 1) % Period() == 0.
-typedef std::map<const CBlockIndex*, ThresholdState> ThresholdConditionCache;
+struct ThresholdConditionCache
+{
+    // A map that gives the state for blocks whose height is a multiple of Period().
+    // The map is indexed by the block's parent, however, so all keys in the map
+    // will either be NULL or a block with (height + 1) % Period() == 0.
+    std::map<const CBlockIndex*, ThresholdState> states;
+    // The parent of the first period whose state is ACTIVE or FAILED, which
+    // then holds for every block on top of it without walking the chain back.
+    // NULL until such a period is known.
+    const CBlockIndex* pindexFinal;
+    ThresholdState stateFinal;
+
+    ThresholdConditionCache() : pindexFinal(NULL), stateFinal(THRESHOLD_DEFINED) {}
+
+    void clear()
+    {
+        states.clear();
+        pindexFinal = NULL;
+        stateFinal = THRESHOLD_DEFINED;
+    }
+};
+
+/**
+ * What a threshold condition cache keeps across restarts, in the block tree
+ * database: the period from which on its state is final, and the period of
+ * the chain tip when it was written. Each is the parent of the first block of
+ * its period, null if not known.
+ */
+struct ThresholdCacheRecord
+{
+    //! Hash of the rules the states were computed under, a record for other rules is not used
+    uint256 hashParams;
+    uint256 hashFinal;
+    uint8_t nStateFinal;
+    uint256 hashLast;
+    uint8_t nStateLast;
+
+    ThresholdCacheRecord() : nStateFinal(THRESHOLD_DEFINED), nStateLast(THRESHOLD_DEFINED) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashParams);
+        READWRITE(hashFinal);
+        READWRITE(nStateFinal);
+        READWRITE(hashLast);
+        READWRITE(nStateLast);
+    }
+
+    friend bool operator==(const ThresholdCacheRecord& a, const ThresholdCacheRecord& b)
+    {
+        return a.hashParams == b.hashParams && a.hashFinal == b.hashFinal && a.nStateFinal == b.nStateFinal &&
+               a.hashLast == b.hashLast && a.nStateLast == b.nStateLast;
+    }
+    friend bool operator!=(const ThresholdCacheRecord& a, const ThresholdCacheRecord& b) { return !(a == b); }
+};
 
 struct BIP9DeploymentInfo {
     /** Deployment name */
@@ -49,11 +106,19 @@ protected:
     virtual int64_t EndTime(const Consensus::Params& params) const =0;
     virtual int Period(const Consensus::Params& params) const =0;
     virtual int Threshold(const Consensus::Params& params) const =0;
+    // Hash of everything the states depend on besides the blocks, which a subclass extends with what its Condition uses
+    virtual uint256 GetParamsHash(const Consensus::Params& params) const;
 
 public:
     // Note that the functions below take a pindexPrev as input: they compute information for block B based on its parent.
     ThresholdState GetStateFor(const CBlockIndex* pindexPrev, const Consensus::Params& params, ThresholdConditionCache& cache) const;
     int GetStateSinceHeightFor(const CBlockIndex* pindexPrev, const Consensus::Params& params, ThresholdConditionCache& cache) const;
+
+    // The record of a cache, with the state of the period of pindexTip if the cache has it
+    ThresholdCacheRecord GetCacheRecord(const CBlockIndex* pindexTip, const Consensus::Params& params, const ThresholdConditionCache& cache) const;
+    // Restore what a record has into a cache, looking up the blocks it names. Returns false when the record is for other rules.
+    bool LoadCacheRecord(const ThresholdCacheRecord& record, const Consensus::Params& params, ThresholdConditionCache& cache,
+                         const std::function<const CBlockIndex*(const uint256&)>& lookup) const;
 };
 
 struct VersionBitsCache
@@ -66,5 +131,8 @@ struct VersionBitsCache
 ThresholdState VersionBitsState(const CBlockIndex* pindexPrev, const Consensus::Params& params, Consensus::DeploymentPos pos, VersionBitsCache& cache);
 int VersionBitsStateSinceHeight(const CBlockIndex* pindexPrev, const Consensus::Params& params, Consensus::DeploymentPos pos, VersionBitsCache& cache);
 uint32_t VersionBitsMask(const Consensus::Params& params, Consensus::DeploymentPos pos);
+ThresholdCacheRecord VersionBitsCacheRecord(const CBlockIndex* pindexTip, const Consensus::Params& params, Consensus::DeploymentPos pos, const VersionBitsCache& cache);
+bool LoadVersionBitsCacheRecord(const ThresholdCacheRecord& record, const Consensus::Params& params, Consensus::DeploymentPos pos, VersionBitsCache& cache,
+                                const std::function<const CBlockIndex*(const uint256&)>& lookup);
 
 #endif
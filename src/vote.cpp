@@ -1,19 +1,230 @@
 
+#include <algorithm>
 #include <unordered_map>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 #include <stdlib.h>
 #include "util.h"
 #include "base58.h"
 #include "vote.h"
+#include "memusage.h"
 #include "myserialize.h"
+#include "snapshot.h"
+#include "txmempool.h"
 
-typedef boost::shared_lock<boost::shared_mutex> read_lock;
-typedef boost::unique_lock<boost::shared_mutex> write_lock;
 
 using namespace std;
 
-Vote::Vote()
-    : mapAddressBalance(100000000)
+CBalanceIndex::CBalanceIndex() : vBucketCount(BUCKET_COUNT, 0), vBucketSum(BUCKET_COUNT, 0), nCount(0)
+{
+}
+
+int CBalanceIndex::GetBucket(uint64_t nBalance)
+{
+    int nExp = 63;
+    while(nExp > 0 && (nBalance >> nExp) == 0) {
+        --nExp;
+    }
+
+    int nMantissa = nExp >= BUCKET_BITS ? (nBalance >> (nExp - BUCKET_BITS)) & ((1 << BUCKET_BITS) - 1) : 0;
+    return (nExp << BUCKET_BITS) + nMantissa;
+}
+
+uint64_t CBalanceIndex::GetBucketStart(int nBucket)
+{
+    int nExp = nBucket >> BUCKET_BITS;
+    uint64_t nMantissa = nBucket & ((1 << BUCKET_BITS) - 1);
+    if(nExp < BUCKET_BITS) {
+        return (uint64_t)1 << nExp;
+    }
+    return (((uint64_t)1 << BUCKET_BITS) + nMantissa) << (nExp - BUCKET_BITS);
+}
+
+void CBalanceIndex::Count(uint64_t nBalance, int nSign)
+{
+    if(nBalance == 0) {
+        return;
+    }
+
+    int nBucket = GetBucket(nBalance);
+    vBucketCount[nBucket] += nSign;
+    vBucketSum[nBucket] += nSign * nBalance;
+    nCount += nSign;
+}
+
+void CBalanceIndex::Update(const CMyAddress& address, uint64_t nOldBalance, uint64_t nNewBalance)
+{
+    if(nOldBalance == nNewBalance) {
+        return;
+    }
+
+    Count(nOldBalance, -1);
+    Count(nNewBalance, 1);
+
+    auto it = mapChanged.find(address);
+    if(it == mapChanged.end()) {
+        // The first change since the last flush starts from the balance the vote database has
+        it = mapChanged.insert(std::make_pair(address, std::make_pair(nOldBalance, nOldBalance))).first;
+    } else if(nOldBalance > 0) {
+        setChanged.erase(std::make_pair(nOldBalance, address));
+    }
+
+    if(nNewBalance == it->second.first) {
+        // Back to what the rank records hold
+        mapChanged.erase(it);
+        return;
+    }
+
+    it->second.second = nNewBalance;
+    if(nNewBalance > 0) {
+        setChanged.insert(std::make_pair(nNewBalance, address));
+    }
+}
+
+void CBalanceIndex::AddStored(uint64_t nBalance)
+{
+    Count(nBalance, 1);
+}
+
+void CBalanceIndex::Clear()
+{
+    mapChanged.clear();
+    setChanged.clear();
+    vBucketCount.assign(BUCKET_COUNT, 0);
+    vBucketSum.assign(BUCKET_COUNT, 0);
+    nCount = 0;
+}
+
+size_t CBalanceIndex::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(mapChanged) + memusage::DynamicUsage(setChanged) +
+        memusage::DynamicUsage(vBucketCount) + memusage::DynamicUsage(vBucketSum);
+}
+
+std::vector<CVoteRankChange> CBalanceIndex::GetChanges() const
+{
+    std::vector<CVoteRankChange> vRank;
+    vRank.reserve(mapChanged.size());
+    for(auto& it : mapChanged) {
+        vRank.push_back(CVoteRankChange(it.first, it.second.first, it.second.second));
+    }
+    return vRank;
+}
+
+void CBalanceIndex::ClearChanges()
+{
+    mapChanged.clear();
+    setChanged.clear();
+}
+
+std::multimap<uint64_t, CMyAddress> CBalanceIndex::GetTop(size_t num, CVoteDB* pdb) const
+{
+    std::multimap<uint64_t, CMyAddress> result;
+    if(num == 0) {
+        return result;
+    }
+
+    for(auto it = setChanged.rbegin(); it != setChanged.rend() && result.size() < num; ++it) {
+        result.insert(*it);
+    }
+
+    // The rank records of changed addresses are out of date, their balances came from setChanged
+    size_t nStored = 0;
+    if(pdb) {
+        pdb->ForEachRank(std::numeric_limits<uint64_t>::max(), [&](uint64_t nBalance, const CMyAddress& address) {
+            if(mapChanged.count(address)) {
+                return true;
+            }
+            result.insert(std::make_pair(nBalance, address));
+            return ++nStored < num;
+        });
+    }
+
+    while(result.size() > num) {
+        result.erase(result.begin());
+    }
+    return result;
+}
+
+std::pair<uint64_t, uint64_t> CBalanceIndex::GetCumulative(uint64_t nThreshold, CVoteDB* pdb) const
+{
+    std::pair<uint64_t, uint64_t> result(0, 0);
+    if(nThreshold == 0) {
+        return result;
+    }
+
+    int nBucket = GetBucket(nThreshold);
+    for(int i = 0; i < nBucket; ++i) {
+        result.first += vBucketCount[i];
+        result.second += vBucketSum[i];
+    }
+
+    uint64_t nBucketStart = GetBucketStart(nBucket);
+    for(auto it = setChanged.lower_bound(std::make_pair(nBucketStart, CMyAddress()));
+        it != setChanged.end() && it->first <= nThreshold; ++it) {
+        result.first++;
+        result.second += it->first;
+    }
+
+    if(pdb) {
+        pdb->ForEachRank(nThreshold, [&](uint64_t nBalance, const CMyAddress& address) {
+            if(nBalance < nBucketStart) {
+                return false;
+            }
+            if(mapChanged.count(address) == 0) {
+                result.first++;
+                result.second += nBalance;
+            }
+            return true;
+        });
+    }
+
+    return result;
+}
+
+/** The set hash element of a balance: the address, then the balance */
+static CDataStream BalanceHashElement(const CMyAddress& address, uint64_t nBalance)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << address << nBalance;
+    return ss;
+}
+
+/** Move the balance of address in the set hash from nOldBalance to nNewBalance, a zero balance being no element */
+static void UpdateBalanceHash(MuHash3072& muhash, const CMyAddress& address, uint64_t nOldBalance, uint64_t nNewBalance)
+{
+    if(nOldBalance > 0) {
+        CDataStream ss = BalanceHashElement(address, nOldBalance);
+        muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    }
+    if(nNewBalance > 0) {
+        CDataStream ss = BalanceHashElement(address, nNewBalance);
+        muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    }
+}
+
+uint256 CVoteStateSnapshot::GetBalanceHash() const
+{
+    uint256 hash;
+    muhashBalance.Finalize(hash.begin());
+    return hash;
+}
+
+uint256 CVoteStateSnapshot::GetHash() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << GetBalanceHash();
+    for(const CDataStream* pstream : {&delegates, &bills, &committees}) {
+        WriteCompactSize(ss, pstream->size());
+        ss.write(pstream->data(), pstream->size());
+    }
+    return ss.GetHash();
+}
+
+Vote::Vote() : nCacheHits(0), nCacheMisses(0), pView(std::make_shared<CVoteView>()),
+    fViewReset(true), fViewDelegatesDirty(false), fViewMultiaddressDirty(false), nStateGeneration(0),
+    nDelegateChanges(0), fFlushedState(false), nFlushedDelegateChanges(0), nFlushedBillChanges(0), nFlushedCommitteeChanges(0)
 {
 }
 
@@ -32,14 +243,19 @@ Vote::~Vote()
 #define COMMITTEE_FILE "committee.data"
 #define FORGER_FILE "forger.data"
 
+uint64_t CVoteBalanceSource::operator()(const CKeyID& id) const
+{
+    return Vote::GetBalance(id);
+}
+
 bool Vote::Init(int64_t nBlockHeight, const std::string& strBlockHash)
 { 
-    //write_lock w(lockVote);
+    //WRITE_LOCK(lockVote);
     if(Params().NetworkIDString() == "main") {
-        pbill = make_shared<CVoteDBK2<uint160, CSubmitBillData, CKeyID>>(100, 300000 * COIN, GetBalance);
+        pbill = make_shared<CVoteDBK2<uint160, CSubmitBillData, CKeyID, CVoteBalanceSource>>(100, 300000 * COIN);
         pcommittee = make_shared<CVoteDBK1<CKeyID, CRegisterCommitteeData, CKeyID>>(100);
     } else {
-        pbill = make_shared<CVoteDBK2<uint160, CSubmitBillData, CKeyID>>(0, 100 * COIN, GetBalance);
+        pbill = make_shared<CVoteDBK2<uint160, CSubmitBillData, CKeyID, CVoteBalanceSource>>(0, 100 * COIN);
         pcommittee = make_shared<CVoteDBK1<CKeyID, CRegisterCommitteeData, CKeyID>>(0);
     }
 
@@ -59,10 +275,12 @@ bool Vote::Init(int64_t nBlockHeight, const std::string& strBlockHash)
         if(!boost::filesystem::is_directory(strFilePath)) {
             boost::filesystem::create_directories(strFilePath);
         }
-        return true;
-    } else {
-        return Load(nBlockHeight, strBlockHash);
+    } else if(Load(nBlockHeight, strBlockHash) == false) {
+        return false;
     }
+
+    PublishView();
+    return true;
 }
 
 bool Vote::ReadControlFile(int64_t& nBlockHeight, std::string& strBlockHash, const std::string& strFileName)
@@ -88,21 +306,6 @@ bool Vote::ReadControlFile(int64_t& nBlockHeight, std::string& strBlockHash, con
     return ret;
 }
 
-bool Vote::WriteControlFile(int64_t nBlockHeight, const std::string& strBlockHash, const std::string& strFileName)
-{
-    bool ret = false;
-    FILE *file = fopen(strFileName.c_str(), "w");
-    if(file) {
-        fprintf(file, "%ld\n", nCurrentVersion);
-        fprintf(file, "%ld\n", nBlockHeight);
-        fprintf(file, "%s\n", strBlockHash.c_str());
-        fclose(file);
-        ret = true;
-    }
-
-    return ret;
-}
-
 bool Vote::RepairFile(int64_t nBlockHeight, const std::string& strBlockHash)
 {
     if(!boost::filesystem::is_directory(strFilePath)) {
@@ -164,7 +367,7 @@ Vote& Vote::GetInstance()
     return vote;
 }
 
-bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height, bool fUndo)
+bool Vote::ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height, bool fUndo)
 {
     if(fUndo) {
         return ProcessUndoVote(voter, delegates, hash, height);
@@ -173,7 +376,7 @@ bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, u
     }
 }
 
-bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height)
+bool Vote::ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height)
 {
     bool ret = ProcessVote(voter, delegates);
     if(ret == false) {
@@ -194,7 +397,7 @@ bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, u
     return ret;
 }
 
-bool Vote::ProcessUndoVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height)
+bool Vote::ProcessUndoVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height)
 {
     if(FindInvalidVote(hash)) {
         LogPrintf("ProcessUndoVote InvalidTx Hash:%s height:%lld\n", hash.ToString().c_str(), height);
@@ -216,9 +419,9 @@ bool Vote::ProcessUndoVote(const CKeyID& voter, const std::set<CKeyID>& delegate
     return ret;
 }
 
-bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates)
+bool Vote::ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates)
 {
-    write_lock w(lockVote);
+    WRITE_LOCK(lockVote);
     uint64_t votes = 0;
 
     {
@@ -246,9 +449,11 @@ bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates)
         }
     }
 
+    uint64_t balance = _GetAddressBalance(CMyAddress(voter, CChainParams::PUBKEY_ADDRESS));
     for(auto item : delegates)
     {
         mapDelegateVoters[item].insert(voter);
+        _AddDelegateVotes(item, balance);
     }
 
     auto& setVotedDelegates = mapVoterDelegates[voter];
@@ -257,10 +462,13 @@ bool Vote::ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates)
         setVotedDelegates.insert(item);
     }
 
+    setViewDirtyVoters.insert(voter);
+    setViewDirtyDelegates.insert(delegates.begin(), delegates.end());
+    ++nDelegateChanges;
     return true;
 }
 
-bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height, bool fUndo)
+bool Vote::ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height, bool fUndo)
 {
     if(fUndo) {
         return ProcessUndoCancelVote(voter, delegates, hash, height);
@@ -269,7 +477,7 @@ bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delega
     }
 }
 
-bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height)
+bool Vote::ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height)
 {
     bool ret = ProcessCancelVote(voter, delegates);
     if(ret == false) {
@@ -290,7 +498,7 @@ bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delega
     return ret;
 }
 
-bool Vote::ProcessUndoCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height)
+bool Vote::ProcessUndoCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height)
 {
     if(FindInvalidVote(hash)) {
         LogPrintf("ProcessUndoCancelVote InvalidTx Hash:%s height:%lld\n", hash.ToString().c_str(), height);
@@ -311,9 +519,9 @@ bool Vote::ProcessUndoCancelVote(const CKeyID& voter, const std::set<CKeyID>& de
     return ret;
 }
 
-bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates)
+bool Vote::ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates)
 {
-    write_lock w(lockVote);
+    WRITE_LOCK(lockVote);
     if(delegates.size() > Vote::MaxNumberOfVotes) {
         return false;
     }
@@ -330,13 +538,16 @@ bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delega
         }
     }
 
+    uint64_t balance = _GetAddressBalance(CMyAddress(voter, CChainParams::PUBKEY_ADDRESS));
     for(auto item : delegates)
     {
         auto& it = mapDelegateVoters[item];
         if(it.size() != 1) {
             mapDelegateVoters[item].erase(voter);
+            _AddDelegateVotes(item, 0 - static_cast<int64_t>(balance));
         } else {
             mapDelegateVoters.erase(item);    
+            _EraseDelegateVotes(item);
         }
     }
 
@@ -350,6 +561,9 @@ bool Vote::ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delega
         }
     }
 
+    setViewDirtyVoters.insert(voter);
+    setViewDirtyDelegates.insert(delegates.begin(), delegates.end());
+    ++nDelegateChanges;
     return true;
 }
 
@@ -399,7 +613,7 @@ bool Vote::ProcessUndoRegister(const CKeyID& delegate, const std::string& strDel
 
 bool Vote::ProcessRegister(const CKeyID& delegate, const std::string& strDelegateName)
 {
-    write_lock w(lockVote);
+    WRITE_LOCK(lockVote);
     if(mapDelegateName.find(delegate) != mapDelegateName.end())
         return false;
     
@@ -408,12 +622,14 @@ bool Vote::ProcessRegister(const CKeyID& delegate, const std::string& strDelegat
 
     mapDelegateName.insert(std::make_pair(delegate, strDelegateName));
     mapNameDelegate.insert(std::make_pair(strDelegateName, delegate));
+    fViewDelegatesDirty = true;
+    ++nDelegateChanges;
     return true;
 }
 
 bool Vote::ProcessUnregister(const CKeyID& delegate, const std::string& strDelegateName)
 {
-    write_lock w(lockVote);
+    WRITE_LOCK(lockVote);
     if(mapDelegateName.find(delegate) == mapDelegateName.end())
         return false;
     
@@ -422,35 +638,73 @@ bool Vote::ProcessUnregister(const CKeyID& delegate, const std::string& strDeleg
 
     mapDelegateName.erase(delegate);
     mapNameDelegate.erase(strDelegateName);
+    fViewDelegatesDirty = true;
+    ++nDelegateChanges;
     return true;
 }
 
 uint64_t Vote::GetDelegateVotes(const CKeyID& delegate)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     return _GetDelegateVotes(delegate);
 }
 
 uint64_t Vote::_GetDelegateVotes(const CKeyID& delegate)
+{
+    auto it = mapDelegateVotes.find(delegate);
+    if(it != mapDelegateVotes.end()) {
+        return it->second;
+    }
+
+    return 0;
+}
+
+void Vote::_AddDelegateVotes(const CKeyID& delegate, int64_t value)
 {
     uint64_t votes = 0;
-    auto it = mapDelegateVoters.find(delegate);
-    if(it != mapDelegateVoters.end()) {
-        for(auto item : it->second) {
-            votes += _GetAddressBalance(CMyAddress(item, CChainParams::PUBKEY_ADDRESS));
-        }
+    auto it = mapDelegateVotes.find(delegate);
+    if(it != mapDelegateVotes.end()) {
+        votes = it->second;
+        setDelegateRank.erase(std::make_pair(votes, delegate));
+    }
+
+    votes += value;
+    mapDelegateVotes[delegate] = votes;
+    setDelegateRank.insert(std::make_pair(votes, delegate));
+}
+
+void Vote::_EraseDelegateVotes(const CKeyID& delegate)
+{
+    auto it = mapDelegateVotes.find(delegate);
+    if(it != mapDelegateVotes.end()) {
+        setDelegateRank.erase(std::make_pair(it->second, delegate));
+        mapDelegateVotes.erase(it);
     }
+}
+
+void Vote::RebuildDelegateVotes()
+{
+    mapDelegateVotes.clear();
+    setDelegateRank.clear();
+
+    for(auto& it : mapDelegateVoters) {
+        uint64_t votes = 0;
+        for(auto& voter : it.second) {
+            votes += _GetAddressBalance(CMyAddress(voter, CChainParams::PUBKEY_ADDRESS));
+        }
 
-    return votes;
+        mapDelegateVotes[it.first] = votes;
+        setDelegateRank.insert(std::make_pair(votes, it.first));
+    }
 }
 
 std::set<CKeyID> Vote::GetDelegateVoters(const CKeyID& delegate)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     std::set<CKeyID> s;
     auto it = mapDelegateVoters.find(delegate);
     if(it != mapDelegateVoters.end()) {
-        s = it->second;
+        s.insert(it->second.begin(), it->second.end());
     }
 
     return s;
@@ -458,7 +712,7 @@ std::set<CKeyID> Vote::GetDelegateVoters(const CKeyID& delegate)
 
 CKeyID Vote::GetDelegate(const std::string& name)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     auto it = mapNameDelegate.find(name);
     if(it != mapNameDelegate.end())
         return it->second;
@@ -467,7 +721,7 @@ CKeyID Vote::GetDelegate(const std::string& name)
 
 std::string Vote::GetDelegate(const CKeyID& keyid)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     auto it = mapDelegateName.find(keyid);
     if(it != mapDelegateName.end())
         return it->second;
@@ -477,7 +731,7 @@ std::string Vote::GetDelegate(const CKeyID& keyid)
 bool Vote::HaveVote(const CKeyID& voter, const CKeyID& delegate)
 {
     bool ret = false;
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     auto it = mapDelegateVoters.find(delegate);
     if(it != mapDelegateVoters.end()) {
         if(it->second.find(voter) != it->second.end()) {
@@ -490,7 +744,7 @@ bool Vote::HaveVote(const CKeyID& voter, const CKeyID& delegate)
 
 bool Vote::HaveDelegate_Unlock(const std::string& name, const CKeyID& keyid)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     if(mapNameDelegate.find(name) != mapNameDelegate.end()) {
         return false;    
     }
@@ -504,7 +758,7 @@ bool Vote::HaveDelegate_Unlock(const std::string& name, const CKeyID& keyid)
 
 bool Vote::HaveDelegate(const std::string& name, const CKeyID& keyid)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     
     bool ret = false;
     auto it = mapDelegateName.find(keyid);
@@ -519,23 +773,23 @@ bool Vote::HaveDelegate(const std::string& name, const CKeyID& keyid)
 
 bool Vote::HaveDelegate(std::string name)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     return mapNameDelegate.find(name) != mapNameDelegate.end();
 }
 
 bool Vote::HaveDelegate(const CKeyID& keyID)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     return mapDelegateName.find(keyID) != mapDelegateName.end();
 }
 
 std::set<CKeyID> Vote::GetVotedDelegates(const CKeyID& delegate)
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     std::set<CKeyID> s;
     auto it = mapVoterDelegates.find(delegate);
     if(it != mapVoterDelegates.end()) {
-        s = it->second;
+        s.insert(it->second.begin(), it->second.end());
     }
 
     return s;
@@ -543,35 +797,88 @@ std::set<CKeyID> Vote::GetVotedDelegates(const CKeyID& delegate)
 
 uint64_t Vote::GetDelegateFunds(const CMyAddress& address)
 {
-    uint64_t ret = _GetAddressBalance(address);
+    READ_LOCK(lockVote);
+    return _GetDelegateFunds(address.first);
+}
+
+uint64_t Vote::_GetDelegateFunds(const CKeyID& delegate)
+{
+    LOCK(cs_mapAddressBalance);
+    auto it = mapDelegateFunds.find(delegate);
+    if(it != mapDelegateFunds.end()) {
+        return it->second;
+    }
+
+    CMyAddress address(delegate, CChainParams::PUBKEY_ADDRESS);
+    uint64_t ret = ReadAddressBalance(address);
 
-    auto&& i = GetDelegateMultiaddress(address);
-    for(auto& j : i) {
-        auto r = _GetAddressBalance(j.first);
-        if(r > ret) {
-            ret = r;
+    auto multi = mapDelegateMultiaddress.find(address);
+    if(multi != mapDelegateMultiaddress.end()) {
+        for(auto& j : multi->second) {
+            ret = std::max(ret, ReadAddressBalance(j.first));
         }
     }
 
+    mapDelegateFunds[delegate] = ret;
     return ret;
 }
 
+void Vote::_UpdateDelegateFunds(const CKeyID& delegate, uint64_t nOldBalance, uint64_t nNewBalance)
+{
+    AssertLockHeld(cs_mapAddressBalance);
+    auto it = mapDelegateFunds.find(delegate);
+    if(it == mapDelegateFunds.end()) {
+        return;
+    }
+
+    if(nNewBalance >= it->second) {
+        it->second = nNewBalance;
+    } else if(nOldBalance == it->second) {
+        // The largest balance went down, another address may hold the most now
+        mapDelegateFunds.erase(it);
+    }
+}
+
+void Vote::RebuildDelegateFunds()
+{
+    mapMultiaddressDelegates.clear();
+    for(auto& it : mapDelegateMultiaddress) {
+        for(auto& j : it.second) {
+            mapMultiaddressDelegates[j.first].insert(it.first.first);
+        }
+    }
+
+    LOCK(cs_mapAddressBalance);
+    mapDelegateFunds.clear();
+}
+
 std::vector<Delegate> Vote::GetTopDelegateInfo(uint64_t nMinHoldBalance, uint32_t nDelegateNum)
 {
-    read_lock r(lockVote);
-    std::set<std::pair<uint64_t, CKeyID>> delegates;
+    READ_LOCK(lockVote);
+    std::vector<Delegate> result;
 
-    for(auto item : mapDelegateVoters)
+    // Delegates with voters, best first, until enough of them hold the minimum balance
+    for(auto it = setDelegateRank.rbegin(); it != setDelegateRank.rend() && result.size() < nDelegateNum; ++it)
     {
-        uint64_t votes = _GetDelegateVotes(item.first);
-        if(GetDelegateFunds(CMyAddress(item.first, CChainParams::PUBKEY_ADDRESS)) >= nMinHoldBalance) {
-            delegates.insert(std::make_pair(votes, item.first));
+        if(_GetDelegateFunds(it->second) >= nMinHoldBalance) {
+            result.push_back(Delegate(it->second, it->first));
         }
     }
 
+    if(result.size() >= nDelegateNum) {
+        return result;
+    }
+
+    // Too few voted delegates, fill up with registered delegates that have no voters
+    std::set<std::pair<uint64_t, CKeyID>> delegates;
+    for(auto& item : result)
+    {
+        delegates.insert(std::make_pair(item.votes, item.keyid));
+    }
+
     for(auto it = mapDelegateName.rbegin(); it != mapDelegateName.rend(); ++it)
     {
-        if(GetDelegateFunds(CMyAddress(it->first, CChainParams::PUBKEY_ADDRESS)) < nMinHoldBalance) {
+        if(_GetDelegateFunds(it->first) < nMinHoldBalance) {
             continue;
         }
 
@@ -583,7 +890,7 @@ std::vector<Delegate> Vote::GetTopDelegateInfo(uint64_t nMinHoldBalance, uint32_
             delegates.insert(std::make_pair(0, it->first));
     }
 
-    std::vector<Delegate> result;
+    result.clear();
     for(auto it = delegates.rbegin(); it != delegates.rend(); ++it)
     {
         if(result.size() >= nDelegateNum) {
@@ -598,631 +905,1052 @@ std::vector<Delegate> Vote::GetTopDelegateInfo(uint64_t nMinHoldBalance, uint32_
 
 std::map<std::string, CKeyID> Vote::ListDelegates()
 {
-    read_lock r(lockVote);
+    READ_LOCK(lockVote);
     return mapNameDelegate;
 }
 
-void Vote::Delete(const std::string& strBlockHash)
+template<typename K, typename V>
+static std::shared_ptr<const std::map<K, V>> CopyViewMap(const std::map<K, V>& m)
 {
-    remove((strDelegateFileName + "-" + strBlockHash).c_str());
-    remove((strVoteFileName + "-" + strBlockHash) .c_str());
-    remove((strBalanceFileName + "-" + strBlockHash) .c_str());
+    return std::make_shared<const std::map<K, V>>(m);
 }
 
-bool Vote::Write(const std::string& strBlockHash)
+/** Copy the sets of the given keys into a view map, sharing the unchanged ones with the previous view */
+static std::shared_ptr<const CVoteView::CKeySetMap> PatchViewSets(const std::shared_ptr<const CVoteView::CKeySetMap>& prev,
+    const std::map<CKeyID, CKeyIDSet>& current, const std::set<CKeyID>& dirty)
 {
-    MySerialize(strForgerFileName + "-" + strBlockHash, mapDelegateVoters, mapVoterDelegates, mapDelegateName, mapNameDelegate, mapHashHeightInvalidVote, mapAddressBalance, mapDelegateMultiaddress);
-    pbill->Save(strBillFileName + "-" + strBlockHash);
-    pcommittee->Save(strCommitteeFileName + "-" + strBlockHash);
+    if(dirty.empty()) {
+        return prev;
+    }
 
-    return true;
+    auto result = std::make_shared<CVoteView::CKeySetMap>(*prev);
+    for(auto& key : dirty) {
+        auto it = current.find(key);
+        if(it != current.end()) {
+            (*result)[key] = std::make_shared<const CKeyIDSet>(it->second);
+        } else {
+            result->erase(key);
+        }
+    }
+
+    return result;
 }
 
-bool Vote::Store(int64_t nBlockHeight, const std::string& strBlockHash)
+static std::shared_ptr<const CVoteView::CKeySetMap> CopyViewSets(const std::map<CKeyID, CKeyIDSet>& current)
 {
-    if(nBlockHeight == 0) {
-        return true;    
+    auto result = std::make_shared<CVoteView::CKeySetMap>();
+    for(auto& it : current) {
+        result->emplace_hint(result->end(), it.first, std::make_shared<const CKeyIDSet>(it.second));
     }
 
-    if(Write(strBlockHash) == false) {
-        return false;
-    }
+    return result;
+}
 
-    if(WriteControlFile(nBlockHeight, strBlockHash, strControlFileName + "-temp") == false) {
-        Delete(strBlockHash);
-        return false;
+void Vote::PublishView()
+{
+    std::shared_ptr<const CVoteView> prev = std::atomic_load(&pView);
+    std::shared_ptr<CVoteView> view = std::make_shared<CVoteView>(*prev);
+
+    {
+        WRITE_LOCK(lockVote);
+        if(fViewReset || fViewDelegatesDirty) {
+            view->pDelegateName = CopyViewMap(mapDelegateName);
+            view->pNameDelegate = CopyViewMap(mapNameDelegate);
+        }
+
+        if(fViewReset || fViewMultiaddressDirty) {
+            view->pDelegateMultiaddress = CopyViewMap(mapDelegateMultiaddress);
+        }
+
+        if(fViewReset) {
+            view->pDelegateVoters = CopyViewSets(mapDelegateVoters);
+            view->pVoterDelegates = CopyViewSets(mapVoterDelegates);
+        } else {
+            view->pDelegateVoters = PatchViewSets(prev->pDelegateVoters, mapDelegateVoters, setViewDirtyDelegates);
+            view->pVoterDelegates = PatchViewSets(prev->pVoterDelegates, mapVoterDelegates, setViewDirtyVoters);
+        }
+
+        // Balance changes move the totals of any delegate, there are few enough to copy them all
+        view->mapDelegateVotes = mapDelegateVotes;
+
+        fViewReset = false;
+        fViewDelegatesDirty = false;
+        fViewMultiaddressDirty = false;
+        setViewDirtyDelegates.clear();
+        setViewDirtyVoters.clear();
+        nStateGeneration++;
     }
 
-    int64_t nBlockHeightTemp = 0;
-    std::string strBlockHashTemp;
-    if(ReadControlFile(nBlockHeightTemp, strBlockHashTemp, strControlFileName) == true) {
-        Delete(strBlockHashTemp);
+    // Bill tallies follow the balances of their voters, and there are few bills, so they are all copied.
+    // The bills have their own lock, which is never taken under lockVote.
+    if(pbill) {
+        auto bills = std::make_shared<CVoteView::CBillMap>();
+        pbill->ForEachState([&bills](const uint160& id, const CSubmitBillData& data, const CState& state, const std::vector<uint64_t>& vTally) {
+            CBillInfo& info = (*bills)[id];
+            info.data = data;
+            info.state = state;
+            info.vTally = vTally;
+        });
+        view->pBills = std::move(bills);
     }
 
-    rename(strControlFileName.c_str(), (strControlFileName + "-old").c_str());
-    rename((strControlFileName + "-temp").c_str(), strControlFileName.c_str());
-    remove((strControlFileName + "-old").c_str());
+    std::atomic_store(&pView, std::shared_ptr<const CVoteView>(std::move(view)));
+}
 
-    return true;
+uint64_t Vote::GetStateGeneration()
+{
+    READ_LOCK(lockVote);
+    return nStateGeneration;
 }
 
-bool Vote::Load(int64_t height, const std::string& strBlockHash)
+CVoteView::CVoteView()
+    : pDelegateName(std::make_shared<const std::map<CKeyID, std::string>>()),
+      pNameDelegate(std::make_shared<const std::map<std::string, CKeyID>>()),
+      pDelegateMultiaddress(std::make_shared<const std::map<CMyAddress, std::map<CMyAddress, uint256>>>()),
+      pDelegateVoters(std::make_shared<const CKeySetMap>()),
+      pVoterDelegates(std::make_shared<const CKeySetMap>()),
+      pBills(std::make_shared<const CBillMap>())
 {
-    if(RepairFile(height, strBlockHash) == false)
-        return false;
+}
 
-    return Read();
+CKeyID CVoteView::GetDelegate(const std::string& name) const
+{
+    auto it = pNameDelegate->find(name);
+    if(it != pNameDelegate->end())
+        return it->second;
+    return CKeyID();
 }
 
-bool Vote::Read()
+std::string CVoteView::GetDelegate(const CKeyID& keyid) const
 {
-    if(ReadControlFile(nOldBlockHeight, strOldBlockHash, strControlFileName) == false)
-        return false;
+    auto it = pDelegateName->find(keyid);
+    if(it != pDelegateName->end())
+        return it->second;
+    return std::string();
+}
 
-    MyUnserialize(strForgerFileName + "-" + strOldBlockHash, mapDelegateVoters, mapVoterDelegates, mapDelegateName, mapNameDelegate, mapHashHeightInvalidVote, mapAddressBalance, mapDelegateMultiaddress);
-    pbill->Load(strBillFileName + "-" + strOldBlockHash);
-    pcommittee->Load(strCommitteeFileName + "-" + strOldBlockHash);
+bool CVoteView::HaveDelegate(const std::string& name) const
+{
+    return pNameDelegate->find(name) != pNameDelegate->end();
+}
 
-    return true;
+bool CVoteView::HaveDelegate(const std::string& name, const CKeyID& keyid) const
+{
+    auto it = pDelegateName->find(keyid);
+    return it != pDelegateName->end() && it->second == name;
 }
 
-uint64_t Vote::GetAddressBalance(const CMyAddress& address)
+bool CVoteView::HaveVote(const CKeyID& voter, const CKeyID& delegate) const
 {
-    read_lock r(lockVote);
-    return _GetAddressBalance(address);
+    auto it = pDelegateVoters->find(delegate);
+    return it != pDelegateVoters->end() && it->second->count(voter) > 0;
 }
 
-uint64_t Vote::_GetAddressBalance(const CMyAddress& address)
+uint64_t CVoteView::GetDelegateVotes(const CKeyID& delegate) const
 {
-    auto it = mapAddressBalance.find(address);
-    if(it != mapAddressBalance.end()) {
+    auto it = mapDelegateVotes.find(delegate);
+    if(it != mapDelegateVotes.end()) {
         return it->second;
-    } else {
-        return 0;    
     }
+
+    return 0;
 }
 
-void Vote::UpdateAddressBalance(const std::vector<std::pair<CMyAddress, int64_t>>& vAddressBalance)
+std::set<CKeyID> CVoteView::GetDelegateVoters(const CKeyID& delegate) const
 {
-    write_lock w(lockVote);
-    std::map<CMyAddress, int64_t> mapBalance;
-    for(auto iter : vAddressBalance) {
-        if (iter.second == 0)
-            continue;
-
-        mapBalance[iter.first] += iter.second;
-    }
-
-    for(auto iter : mapBalance)
-    {
-        _UpdateAddressBalance(iter.first, iter.second);
+    auto it = pDelegateVoters->find(delegate);
+    if(it != pDelegateVoters->end()) {
+        return std::set<CKeyID>(it->second->begin(), it->second->end());
     }
 
-    return;
+    return std::set<CKeyID>();
 }
 
-uint64_t Vote::_UpdateAddressBalance(const CMyAddress& address, int64_t value)
+size_t CVoteView::GetDelegateVoterCount(const CKeyID& delegate) const
 {
-    int64_t balance = 0;
-
-    auto it = mapAddressBalance.find(address);
-    if(it != mapAddressBalance.end()) {
-        balance = it->second + value;
-        if(balance < 0) {
-            abort();
-        }
-
-        if(balance == 0) {
-            mapAddressBalance.erase(it);        
-        } else {
-            it->second = balance;
-        }
-        return balance;
-    } else {
-        if(value < 0) {
-            abort();
-        }
-
-        if(value == 0) {
-            return 0;    
-        } else {
-            mapAddressBalance[address] = value;
-        }
-
-        return value;
-    }
+    auto it = pDelegateVoters->find(delegate);
+    return it != pDelegateVoters->end() ? it->second->size() : 0;
 }
 
-void Vote::DeleteInvalidVote(uint64_t height)
+std::shared_ptr<const CKeyIDSet> CVoteView::GetDelegateVoterSet(const CKeyID& delegate) const
 {
-    write_lock r(lockMapHashHeightInvalidVote);
-    for(auto it =  mapHashHeightInvalidVote.begin(); it != mapHashHeightInvalidVote.end();) {
-        if(it->second <= height) {
-            LogPrintf("DeleteInvalidVote Hash:%s Height:%llu\n", it->first.ToString().c_str(), it->second);
-            it = mapHashHeightInvalidVote.erase(it);
-        } else {
-            ++it;
-        }
+    auto it = pDelegateVoters->find(delegate);
+    if(it != pDelegateVoters->end()) {
+        return it->second;
     }
+
+    return std::make_shared<const CKeyIDSet>();
 }
 
-void Vote::AddInvalidVote(uint256 hash, uint64_t height)
+std::set<CKeyID> CVoteView::GetVotedDelegates(const CKeyID& voter) const
 {
-    write_lock r(lockMapHashHeightInvalidVote);
-    mapHashHeightInvalidVote[hash] = height;
-    LogPrintf("AddInvalidVote Hash:%s Height:%llu\n", hash.ToString().c_str(), height);
+    auto it = pVoterDelegates->find(voter);
+    if(it != pVoterDelegates->end()) {
+        return std::set<CKeyID>(it->second->begin(), it->second->end());
+    }
+
+    return std::set<CKeyID>();
 }
 
-bool Vote::FindInvalidVote(uint256 hash)
+std::map<CMyAddress, uint256> CVoteView::GetDelegateMultiaddress(const CMyAddress& delegate) const
 {
-    read_lock r(lockMapHashHeightInvalidVote);
-    return mapHashHeightInvalidVote.find(hash) != mapHashHeightInvalidVote.end();
+    auto it = pDelegateMultiaddress->find(delegate);
+    if(it != pDelegateMultiaddress->end()) {
+        return it->second;
+    }
+
+    return std::map<CMyAddress, uint256>();
 }
 
-std::map<CMyAddress, uint256> Vote::GetDelegateMultiaddress(const CMyAddress& delegate)
+/** Add or remove one key of a set in a view map, copying the set instead of changing it */
+static void UpdateViewSet(CVoteView::CKeySetMap& m, const CKeyID& key, const CKeyID& value, bool fInsert)
 {
-    read_lock r(lockVote);
+    auto it = m.find(key);
+    auto s = it != m.end() ? std::make_shared<CKeyIDSet>(*it->second) : std::make_shared<CKeyIDSet>();
+    if(fInsert) {
+        s->insert(value);
+    } else {
+        s->erase(value);
+    }
 
-    auto it = mapDelegateMultiaddress.find(delegate);
-    if(it != mapDelegateMultiaddress.end()) {
-        return mapDelegateMultiaddress[delegate];
+    if(s->empty()) {
+        m.erase(key);
     } else {
-        return std::map<CMyAddress, uint256>();
+        m[key] = s;
     }
 }
 
-bool Vote::AddDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
+std::shared_ptr<const CVoteView> CVoteView::WithPending(const std::vector<CPendingDPoSOp>& vOps) const
 {
-    bool ret = false;
-    write_lock r(lockVote);
-
-    if(mapDelegateName.find(delegate.first) == mapDelegateName.end())
-        return false;
+    auto view = std::make_shared<CVoteView>(*this);
+    std::shared_ptr<std::map<CKeyID, std::string>> pName;
+    std::shared_ptr<std::map<std::string, CKeyID>> pNames;
+    std::shared_ptr<CKeySetMap> pVoters;
+    std::shared_ptr<CKeySetMap> pVoted;
 
+    for(auto& op : vOps) {
+        if(op.opcode == OP_REGISTE) {
+            if(!pName) {
+                pName = std::make_shared<std::map<CKeyID, std::string>>(*pDelegateName);
+                pNames = std::make_shared<std::map<std::string, CKeyID>>(*pNameDelegate);
+                view->pDelegateName = pName;
+                view->pNameDelegate = pNames;
+            }
 
-    auto it = mapDelegateMultiaddress.find(delegate);
-    if(it != mapDelegateMultiaddress.end()) {
-        auto i = it->second.find(multiAddress);
-        if(i == it->second.end()) {
-            it->second.insert(std::make_pair(multiAddress, txid));
-            ret = true;
+            if(pName->count(op.address) == 0 && pNames->count(op.name) == 0) {
+                pName->insert(std::make_pair(op.address, op.name));
+                pNames->insert(std::make_pair(op.name, op.address));
+            }
+            continue;
         }
-    } else {
-        auto& i = mapDelegateMultiaddress[delegate];
-        i[multiAddress] = txid;
-        ret = true;
-    }
 
-    return ret;
-}
+        if(!pVoters) {
+            pVoters = std::make_shared<CKeySetMap>(*pDelegateVoters);
+            pVoted = std::make_shared<CKeySetMap>(*pVoterDelegates);
+            view->pDelegateVoters = pVoters;
+            view->pVoterDelegates = pVoted;
+        }
 
-bool Vote::DelDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
-{
-    bool ret = false;
-    write_lock r(lockVote);
+        bool fVote = op.opcode == OP_VOTE;
+        size_t nVoted = view->GetVotedDelegates(op.address).size();
+        bool fValid = fVote ? nVoted + op.delegates.size() <= Vote::MaxNumberOfVotes : op.delegates.size() <= Vote::MaxNumberOfVotes;
+        for(auto& delegate : op.delegates) {
+            if(fVote && view->pDelegateName->count(delegate) == 0) {
+                fValid = false;
+            }
+            if(view->HaveVote(op.address, delegate) == fVote) {
+                fValid = false;
+            }
+        }
 
-    auto it = mapDelegateMultiaddress.find(delegate);
-    if(it != mapDelegateMultiaddress.end()) {
-        auto i = it->second.find(multiAddress);
-        if(i != it->second.end()) {
-            if(i->second == txid) {
-                it->second.erase(i);
+        if(fValid == false) {
+            continue;
+        }
 
-                if(it->second.empty()) {
-                    mapDelegateMultiaddress.erase(it);
-                }
-                ret = true;
+        uint64_t balance = Vote::GetInstance().GetAddressBalance(CMyAddress(op.address, CChainParams::PUBKEY_ADDRESS));
+        for(auto& delegate : op.delegates) {
+            UpdateViewSet(*pVoters, delegate, op.address, fVote);
+            UpdateViewSet(*pVoted, op.address, delegate, fVote);
+            if(fVote) {
+                view->mapDelegateVotes[delegate] += balance;
+            } else if(pVoters->count(delegate) == 0) {
+                view->mapDelegateVotes.erase(delegate);
+            } else {
+                view->mapDelegateVotes[delegate] -= balance;
             }
         }
     }
 
-    return ret;
+    return view;
 }
 
-std::multimap<uint64_t, CMyAddress> Vote::GetCoinRank(int num)
+void Vote::Delete(const std::string& strBlockHash)
 {
-    std::multimap<uint64_t, CMyAddress> result;
+    remove((strDelegateFileName + "-" + strBlockHash).c_str());
+    remove((strVoteFileName + "-" + strBlockHash) .c_str());
+    remove((strBalanceFileName + "-" + strBlockHash) .c_str());
+    remove((strForgerFileName + "-" + strBlockHash).c_str());
+    remove((strBillFileName + "-" + strBlockHash).c_str());
+    remove((strCommitteeFileName + "-" + strBlockHash).c_str());
+}
 
-    read_lock r(lockVote);
-    for(auto& item : mapAddressBalance) {
-        result.insert(make_pair(item.second, item.first));
-        if(result.size() > (uint32_t)num) {
-            result.erase(result.begin());
-        }
-    }
+void Vote::OpenDB(size_t nCacheSize, bool fWipe)
+{
+    pvotedb.reset();
+    pvotedb.reset(new CVoteDB(nCacheSize, false, fWipe));
+}
 
-    return result;
+void Vote::CloseDB()
+{
+    pvotedb.reset();
 }
 
-std::map<uint64_t, std::pair<uint64_t, uint64_t>> Vote::GetCoinDistribution(const std::set<uint64_t>& arg)
+bool Vote::Flush(int64_t nBlockHeight, const uint256& hashBlock, bool fErase)
 {
-    std::map<uint64_t, std::pair<uint64_t, uint64_t>> result;
+    if(!pvotedb || !pbill || !pcommittee) {
+        return true;
+    }
 
-    read_lock r(lockVote);
+    WRITE_LOCK(lockVote);
 
-    for(auto& it : arg) {
-        result[it] = std::make_pair(0, 0);
+    // Only the parts of the state that changed since the last flush are serialized and written.
+    // The counters are read first, so a change made while serializing is written again next time.
+    uint64_t nDelegateChangesNow = nDelegateChanges;
+    uint64_t nBillChangesNow = pbill->GetChanges();
+    uint64_t nCommitteeChangesNow = pcommittee->GetChanges();
+    bool fDelegates = !fFlushedState || nDelegateChangesNow != nFlushedDelegateChanges;
+    bool fBills = !fFlushedState || nBillChangesNow != nFlushedBillChanges;
+    bool fCommittees = !fFlushedState || nCommitteeChangesNow != nFlushedCommitteeChanges;
+
+    CVoteStateSnapshot snapshot;
+    GetState(snapshot, fDelegates, fBills, fCommittees);
+
+    LOCK(cs_mapAddressBalance);
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    for(auto& it : mapAddressBalance) {
+        if(it.flags & CBalanceCacheEntry::DIRTY) {
+            vBalance.push_back(std::make_pair(it.GetAddress(), it.nBalance));
+        }
     }
 
-    for(auto& item : mapAddressBalance) {
-        for(auto& it : result) {
-            if(item.second <= it.first) {
-                it.second.first++;
-                it.second.second+= item.second;
-                break;
-            }
+    if(pvotedb->WriteState(vBalance, balanceIndex.GetChanges(), fDelegates ? &snapshot.delegates : NULL, fBills ? &snapshot.bills : NULL,
+        fCommittees ? &snapshot.committees : NULL, snapshot.muhashBalance, nBlockHeight, hashBlock) == false) {
+        return false;
+    }
+    balanceIndex.ClearChanges();
+
+    fFlushedState = true;
+    nFlushedDelegateChanges = nDelegateChangesNow;
+    nFlushedBillChanges = nBillChangesNow;
+    nFlushedCommitteeChanges = nCommitteeChangesNow;
+
+    if(fErase) {
+        CBalanceMap().swap(mapAddressBalance);
+    } else {
+        for(auto& it : mapAddressBalance) {
+            it.flags = 0;
         }
     }
+    nOldBlockHeight = nBlockHeight;
+    strOldBlockHash = hashBlock.GetHex();
 
-    return result;
+    return true;
 }
 
-std::vector<unsigned char> StructToData(const CRegisterForgerData& data)
+void Vote::GetState(CVoteStateSnapshot& snapshot, bool fDelegates, bool fBills, bool fCommittees)
 {
-    CScript script(data.opcode);
-    script << ToByteVector(data.name);
-  
-    return ToByteVector(script);
+    if(fDelegates) {
+        READ_LOCK(lockMapHashHeightInvalidVote);
+        SerializeMany(snapshot.delegates, mapDelegateVoters, mapVoterDelegates, mapDelegateName, mapNameDelegate, mapHashHeightInvalidVote, mapDelegateMultiaddress);
+    }
+    if(pbill && fBills) {
+        pbill->Dump(snapshot.bills);
+    }
+    if(pcommittee && fCommittees) {
+        pcommittee->Dump(snapshot.committees);
+    }
+
+    LOCK(cs_mapAddressBalance);
+    snapshot.muhashBalance = muhashBalance;
 }
 
-std::vector<unsigned char> StructToData(const CVoteForgerData& data)
+uint256 Vote::GetStateHash(uint256& hashBalances)
 {
-    CScript script(data.opcode);
-    script << (uint8_t)data.forgers.size();
-    for(auto& i : data.forgers) {
-        script << ToByteVector(i);
+    CVoteStateSnapshot snapshot;
+    {
+        READ_LOCK(lockVote);
+        GetState(snapshot);
     }
-  
-    return ToByteVector(script);
+
+    hashBalances = snapshot.GetBalanceHash();
+    return snapshot.GetHash();
 }
 
-std::vector<unsigned char> StructToData(const CCancelVoteForgerData& data)
+size_t Vote::DynamicMemoryUsage()
 {
-    CScript script(data.opcode);
-    script << (uint8_t)data.forgers.size();
-    for(auto& i : data.forgers) {
-        script << ToByteVector(i);
-    }
-  
-    return ToByteVector(script);
+    LOCK(cs_mapAddressBalance);
+    return mapAddressBalance.DynamicMemoryUsage() + balanceIndex.DynamicMemoryUsage();
 }
 
-std::vector<unsigned char> StructToData(const CRegisterCommitteeData& data)
+CBalanceCacheStats Vote::GetCacheStats()
 {
-    CScript script(data.opcode);
-    script << ToByteVector(data.name) << ToByteVector(data.url);
-  
-    return ToByteVector(script);
+    LOCK(cs_mapAddressBalance);
+    CBalanceCacheStats stats;
+    stats.nUsage = mapAddressBalance.DynamicMemoryUsage() + balanceIndex.DynamicMemoryUsage();
+    stats.nEntries = mapAddressBalance.size();
+    stats.nHits = nCacheHits;
+    stats.nMisses = nCacheMisses;
+    return stats;
 }
 
-std::vector<unsigned char> StructToData(const CVoteCommitteeData& data)
+bool Vote::DumpSnapshot(CSnapshotWriter& writer, int64_t nHeight, const uint256& hashBlock, uint64_t& nBalances, uint256& hashState)
 {
-    CScript script(data.opcode);
-    script << ToByteVector(data.committee);
+    int64_t nHeightDB = 0;
+    uint256 hashBlockDB;
+    CVoteStateSnapshot snapshot;
+    if(!pvotedb || pvotedb->ReadBestBlock(nHeightDB, hashBlockDB) == false
+        || pvotedb->ReadState(snapshot.delegates, snapshot.bills, snapshot.committees) == false) {
+        return error("%s: failed to read the vote database", __func__);
+    }
+    if(nHeightDB != nHeight || hashBlockDB != hashBlock) {
+        return error("%s: the vote database is at block %s, not %s", __func__, hashBlockDB.ToString(), hashBlock.ToString());
+    }
 
-    return ToByteVector(script);
-}
+    writer << std::vector<char>(snapshot.delegates.begin(), snapshot.delegates.end());
+    writer << std::vector<char>(snapshot.bills.begin(), snapshot.bills.end());
+    writer << std::vector<char>(snapshot.committees.begin(), snapshot.committees.end());
 
-std::vector<unsigned char> StructToData(const CCancelVoteCommitteeData& data)
-{
-    CScript script(data.opcode);
-    script << ToByteVector(data.committee);
+    // The database has the set hash of the balances it holds, older ones get it from the balances written
+    bool fHaveBalanceHash = pvotedb->ReadBalanceHash(snapshot.muhashBalance);
+    nBalances = 0;
+    bool ret = pvotedb->ForEachBalance([&](const CMyAddress& address, uint64_t nBalance) {
+        writer << true << address << VARINT(nBalance);
+        nBalances++;
+        if(!fHaveBalanceHash) {
+            UpdateBalanceHash(snapshot.muhashBalance, address, 0, nBalance);
+        }
+    });
+    writer << false;
+
+    hashState = snapshot.GetHash();
+    writer << hashState;
 
-    return ToByteVector(script);
+    return ret;
 }
 
-std::vector<unsigned char> StructToData(const CSubmitBillData& data)
+bool Vote::LoadSnapshot(CSnapshotReader& reader, bool fWrite, CVoteStateSnapshot& snapshot, uint64_t& nBalances, uint256& hashState)
 {
-    CScript script(data.opcode);
-    script << ToByteVector(data.title) << ToByteVector(data.detail) << ToByteVector(data.url) << ToByteVector(std::to_string(data.endtime)) << (uint8_t)data.options.size();
-    for(auto& it : data.options) {
-        script << ToByteVector(it);
+    if(fWrite && !pvotedb) {
+        return false;
     }
 
-    return ToByteVector(script);
+    std::vector<char> delegates, bills, committees;
+    reader >> delegates >> bills >> committees;
+    snapshot.delegates.write(delegates.data(), delegates.size());
+    snapshot.bills.write(bills.data(), bills.size());
+    snapshot.committees.write(committees.data(), committees.size());
+
+    nBalances = 0;
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    while(true) {
+        bool fMore = false;
+        reader >> fMore;
+        if(fMore == false) {
+            break;
+        }
+
+        CMyAddress address;
+        uint64_t nBalance = 0;
+        reader >> address >> VARINT(nBalance);
+        vBalance.push_back(std::make_pair(address, nBalance));
+        UpdateBalanceHash(snapshot.muhashBalance, address, 0, nBalance);
+        nBalances++;
+        if(vBalance.size() >= 100000) {
+            if(fWrite && pvotedb->WriteNewBalances(vBalance) == false) {
+                return error("%s: failed to write the vote database", __func__);
+            }
+            vBalance.clear();
+        }
+    }
+
+    if(fWrite && pvotedb->WriteNewBalances(vBalance) == false) {
+        return error("%s: failed to write the vote database", __func__);
+    }
+
+    uint256 hashExpected;
+    reader >> hashExpected;
+    hashState = snapshot.GetHash();
+    if(hashState != hashExpected) {
+        return error("%s: the vote state has the hash %s, not %s", __func__, hashState.ToString(), hashExpected.ToString());
+    }
+
+    return true;
 }
 
-std::vector<unsigned char> StructToData(const CVoteBillData& data)
+bool Vote::CommitSnapshot(const CVoteStateSnapshot& snapshot, int64_t nHeight, const uint256& hashBlock)
 {
-    CScript script(data.opcode);
-    script << ToByteVector(data.id.GetHex()) << (uint8_t)data.index;
+    if(!pvotedb) {
+        return false;
+    }
 
-    return ToByteVector(script);
+    std::vector<std::pair<CMyAddress, uint64_t>> vBalance;
+    {
+        // The state in memory is not the one written, so the next flush writes all of it
+        WRITE_LOCK(lockVote);
+        fFlushedState = false;
+    }
+    return pvotedb->WriteState(vBalance, std::vector<CVoteRankChange>(), &snapshot.delegates, &snapshot.bills, &snapshot.committees,
+        snapshot.muhashBalance, nHeight, hashBlock);
 }
 
-string CheckStruct(const CRegisterForgerData& data)
+bool Vote::Load(int64_t height, const std::string& strBlockHash)
 {
-    string ret;
-    if(data.name.size() == 0) {
-        ret = "name is empty";
-    } else if(data.name.length() > 128) {
-        ret = "name length greater than 32 bytes";
+    int64_t nBlockHeightDB = 0;
+    uint256 hashBlockDB;
+    if(pvotedb && pvotedb->ReadBestBlock(nBlockHeightDB, hashBlockDB)) {
+        return ReadDB();
     }
-    return ret;
+
+    // Data directories from before the vote database keep the state in snapshot files
+    if(RepairFile(height, strBlockHash) == false)
+        return false;
+
+    if(Read() == false)
+        return false;
+
+    LogPrintf("Vote: migrating vote state of block %s to the vote database\n", strOldBlockHash);
+    if(Flush(nOldBlockHeight, uint256S(strOldBlockHash)) == false) {
+        return error("%s: failed to write the vote database", __func__);
+    }
+
+    Delete(strOldBlockHash);
+    remove(strControlFileName.c_str());
+
+    return true;
 }
 
-string CheckStruct(const CVoteForgerData& data)
+bool Vote::ReadDB()
 {
-    string ret;
-    if(data.forgers.empty()) {
-        ret = "forger is empty";
+    int64_t nBlockHeight = 0;
+    uint256 hashBlock;
+    CVoteStateSnapshot snapshot;
+    if(pvotedb->ReadBestBlock(nBlockHeight, hashBlock) == false
+        || pvotedb->ReadState(snapshot.delegates, snapshot.bills, snapshot.committees) == false) {
+        return error("%s: failed to read the vote database", __func__);
     }
 
-    return ret;
+    try {
+        {
+            WRITE_LOCK(lockVote);
+            WRITE_LOCK(lockMapHashHeightInvalidVote);
+            UnserializeMany(snapshot.delegates, mapDelegateVoters, mapVoterDelegates, mapDelegateName, mapNameDelegate, mapHashHeightInvalidVote, mapDelegateMultiaddress);
+            RebuildDelegateVotes();
+            RebuildDelegateFunds();
+            fViewReset = true;
+        }
+
+        pbill->Restore(snapshot.bills);
+        pcommittee->Restore(snapshot.committees);
+
+        // What was just read is what the database holds
+        WRITE_LOCK(lockVote);
+        fFlushedState = true;
+        nFlushedDelegateChanges = nDelegateChanges;
+        nFlushedBillChanges = pbill->GetChanges();
+        nFlushedCommitteeChanges = pcommittee->GetChanges();
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s", __func__, e.what());
+    }
+
+    {
+        LOCK(cs_mapAddressBalance);
+        if(pvotedb->ReadBalanceHash(muhashBalance) == false) {
+            // Kept from the next flush on, a database written before that has all its balances hashed once
+            int64_t nStart = GetTimeMillis();
+            muhashBalance = MuHash3072();
+            pvotedb->ForEachBalance([this](const CMyAddress& address, uint64_t nBalance) {
+                UpdateBalanceHash(muhashBalance, address, 0, nBalance);
+            });
+            LogPrintf("Vote: hashed the address balances in %dms\n", GetTimeMillis() - nStart);
+        }
+    }
+
+    RebuildBalanceIndex();
+
+    nOldBlockHeight = nBlockHeight;
+    strOldBlockHash = hashBlock.GetHex();
+
+    return true;
 }
 
-string CheckStruct(const CCancelVoteForgerData& data)
+static std::map<CKeyID, CKeyIDSet> ToFlatSets(const std::map<CKeyID, std::set<CKeyID>>& m)
 {
-    string ret;
-    if(data.forgers.empty()) {
-        ret = "forger is empty";
+    std::map<CKeyID, CKeyIDSet> result;
+    for(auto& it : m) {
+        result.emplace_hint(result.end(), it.first, CKeyIDSet(it.second.begin(), it.second.end()));
     }
 
-    return ret;
+    return result;
 }
 
-string CheckStruct(const CSubmitBillData& data)
-{
-    string ret;
-    if(data.title.empty()) {
-        ret = "bill title is empty";
-    } else if(data.title.length() > 128) {
-        ret = "bill title length greater than 128 bytes";
-    } else if(data.detail.length() > 256) {
-        ret = "bill detail length greater than 256 bytes";
-    } else if(data.url.empty()) {
-        ret = "bill url is empty";
-    } else if(data.url.length() > 256) {
-        ret = "bill url length greater than 256 bytes";
-    } else if(data.options.size() < 2) {
-        ret = "bill options number less than 2";
-    } else if(data.options.size() > 16) {
-        ret = "bill options number greater than 16";
-    } else {
-        for(auto& i : data.options) {
-            if(i.size() == 0) {
-                ret = "bill option content is empty";
-                break;
-            } else if(i.size() > 256) {
-                ret = "bill option content length greater than 256 bytes";
-                break;
+bool Vote::Read()
+{
+    if(ReadControlFile(nOldBlockHeight, strOldBlockHash, strControlFileName) == false)
+        return false;
+
+    {
+        std::unordered_map<CMyAddress, uint64_t, key_hash> mapBalance;
+        // The legacy text archive only knows std::set, the binary snapshot reads either way
+        std::map<CKeyID, std::set<CKeyID>> mapVoters, mapVoted;
+
+        WRITE_LOCK(lockVote);
+        WRITE_LOCK(lockMapHashHeightInvalidVote);
+        if(LoadVoteSnapshot(strForgerFileName + "-" + strOldBlockHash, mapVoters, mapVoted, mapDelegateName, mapNameDelegate, mapHashHeightInvalidVote, mapBalance, mapDelegateMultiaddress) == false) {
+            return false;
+        }
+        mapDelegateVoters = ToFlatSets(mapVoters);
+        mapVoterDelegates = ToFlatSets(mapVoted);
+
+        {
+            LOCK(cs_mapAddressBalance);
+            mapAddressBalance.reserve(mapBalance.size());
+            muhashBalance = MuHash3072();
+            for(auto& it : mapBalance) {
+                mapAddressBalance.insert(it.first, it.second, CBalanceCacheEntry::DIRTY | CBalanceCacheEntry::FRESH);
+                UpdateBalanceHash(muhashBalance, it.first, 0, it.second);
             }
         }
+
+        RebuildDelegateVotes();
+        RebuildDelegateFunds();
+        fViewReset = true;
     }
 
-    return ret;
+    if(pbill->Load(strBillFileName + "-" + strOldBlockHash) == false) {
+        return false;
+    }
+
+    if(pcommittee->Load(strCommitteeFileName + "-" + strOldBlockHash) == false) {
+        return false;
+    }
+
+    RebuildBalanceIndex();
+
+    return true;
 }
 
-string CheckStruct(const CVoteBillData& data)
+uint64_t Vote::GetAddressBalance(const CMyAddress& address)
 {
-    string ret;
-    return ret;
+    // Balances are guarded by cs_mapAddressBalance alone
+    return _GetAddressBalance(address);
 }
 
-string CheckStruct(const CRegisterCommitteeData& data)
+CBalanceMap::iterator Vote::FetchAddressBalance(const CMyAddress& address)
 {
-    string ret;
-    if(data.name.length() == 0) {
-        ret = "Register Committee name is empty";
-    } else if(data.name.length() > 32) {
-        ret = "Register Committee name length larger than 32 bytes";
-    } else if(data.url.length() > 256) {
-        ret = "Register Committee url length larger than 32 bytes";
+    auto it = mapAddressBalance.find(address);
+    if(it != mapAddressBalance.end()) {
+        ++nCacheHits;
+        return it;
     }
 
-    return ret;
+    ++nCacheMisses;
+    uint64_t nBalance = 0;
+    unsigned char flags = 0;
+    if(!pvotedb || pvotedb->ReadBalance(address, nBalance) == false) {
+        nBalance = 0;
+        flags = CBalanceCacheEntry::FRESH;
+    }
+
+    return mapAddressBalance.insert(address, nBalance, flags);
 }
 
-string CheckStruct(const CVoteCommitteeData& data)
+uint64_t Vote::ReadAddressBalance(const CMyAddress& address)
 {
-    string ret;
-    return ret;
+    AssertLockHeld(cs_mapAddressBalance);
+    auto it = mapAddressBalance.find(address);
+    if(it != mapAddressBalance.end()) {
+        ++nCacheHits;
+        return it->nBalance;
+    }
+
+    ++nCacheMisses;
+    uint64_t nBalance = 0;
+    if(!pvotedb || pvotedb->ReadBalance(address, nBalance) == false) {
+        // Not cached, so looking up unknown addresses does not grow the cache
+        return 0;
+    }
+
+    mapAddressBalance.insert(address, nBalance, 0);
+    return nBalance;
 }
 
-string CheckStruct(const CCancelVoteCommitteeData& data)
+uint64_t Vote::_GetAddressBalance(const CMyAddress& address)
 {
-    string ret;
-    return ret;
+    LOCK(cs_mapAddressBalance);
+    return ReadAddressBalance(address);
 }
 
-bool DataToStruct(CRegisterForgerData& data, const CScript& script)
+void Vote::ForEachAddressBalance(std::function<void(const CMyAddress&, uint64_t)> func)
 {
-    bool ret = false;
+    LOCK(cs_mapAddressBalance);
 
-    auto iter = script.begin();
-    data.opcode = *iter++;
+    if(pvotedb) {
+        pvotedb->ForEachBalance([&](const CMyAddress& address, uint64_t nBalance) {
+            auto it = mapAddressBalance.find(address);
+            if(it != mapAddressBalance.end()) {
+                nBalance = it->nBalance;
+            }
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+            if(nBalance > 0) {
+                func(address, nBalance);
+            }
+        });
     }
-    data.name = std::string(vchRet.begin(), vchRet.end());
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
+    for(auto& it : mapAddressBalance) {
+        if((it.flags & CBalanceCacheEntry::FRESH) && it.nBalance > 0) {
+            func(it.GetAddress(), it.nBalance);
+        }
     }
-    return ret;
 }
 
-bool DataToStruct(CVoteForgerData& data, const CScript& script)
+void Vote::RebuildBalanceIndex()
 {
-    bool ret = false;
-
-    auto iter = script.begin();
-    data.opcode = *iter++;
+    int64_t nStart = GetTimeMillis();
+    LOCK(cs_mapAddressBalance);
+    CBalanceIndex index;
 
-    uint8_t nNumForger = *iter++;
-
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    for(auto i = 0; i < nNumForger; ++i) {
-        if (!script.GetOp2(iter, opcode, &vchRet)) {
-            return false;
+    if(pvotedb) {
+        // Databases written before the rank records were kept get them once
+        bool fRanked = pvotedb->HaveRanks();
+        std::vector<CVoteRankChange> vRank;
+        pvotedb->ForEachBalance([&](const CMyAddress& address, uint64_t nBalance) {
+            index.AddStored(nBalance);
+            if(!fRanked) {
+                vRank.push_back(CVoteRankChange(address, 0, nBalance));
+                if(vRank.size() >= 100000) {
+                    pvotedb->WriteRanks(vRank, false);
+                    vRank.clear();
+                }
+            }
+        });
+        if(!fRanked && pvotedb->WriteRanks(vRank, true) == false) {
+            error("%s: failed to write the rank records of the vote database", __func__);
         }
+    }
 
-        if(vchRet.size() != 20) {
-            return false;
+    // Cached balances that differ from the database are held by the index until the next flush
+    for(auto& it : mapAddressBalance) {
+        if((it.flags & CBalanceCacheEntry::DIRTY) == 0) {
+            continue;
         }
-
-        auto&& r = data.forgers.insert(CKeyID(uint160(vchRet)));
-        if(r.second == false) {
-            return false;
+        uint64_t nStored = 0;
+        if(pvotedb && (it.flags & CBalanceCacheEntry::FRESH) == 0) {
+            pvotedb->ReadBalance(it.GetAddress(), nStored);
         }
+        index.Update(it.GetAddress(), nStored, it.nBalance);
     }
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
-    }
-    return ret;
+    std::swap(balanceIndex, index);
+    LogPrintf("Vote: indexed %u address balances in %dms\n", balanceIndex.size(), GetTimeMillis() - nStart);
 }
 
-bool DataToStruct(CCancelVoteForgerData& data, const CScript& script)
+void Vote::PrefetchAddressBalances(const std::vector<std::pair<CMyAddress, int64_t>>& vAddressBalance)
 {
-    bool ret = false;
+    AssertLockHeld(cs_mapAddressBalance);
+    if(!pvotedb) {
+        return;
+    }
 
-    auto iter = script.begin();
-    data.opcode = *iter++;
+    std::vector<CMyAddress> vMissing;
+    for(auto& it : vAddressBalance) {
+        if(mapAddressBalance.find(it.first) == mapAddressBalance.end()) {
+            vMissing.push_back(it.first);
+        }
+    }
 
-    uint8_t nNumForger = *iter++;
+    size_t nThreads = std::min<size_t>(std::min(GetNumCores(), MAX_BALANCE_PREFETCH_THREADS), vMissing.size() / BALANCE_PREFETCH_PER_THREAD);
+    if(nThreads < 2) {
+        return;
+    }
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    for(auto i = 0; i < nNumForger; ++i) {
-        if (!script.GetOp2(iter, opcode, &vchRet)) {
-            return false;
+    // The database takes concurrent reads, only the cache inserts are left to this thread
+    std::vector<std::pair<bool, uint64_t>> vRead(vMissing.size());
+    auto readRange = [&](size_t nBegin, size_t nEnd) {
+        for(size_t i = nBegin; i < nEnd; ++i) {
+            vRead[i].first = pvotedb->ReadBalance(vMissing[i], vRead[i].second);
         }
+    };
+    boost::thread_group threadGroup;
+    for(size_t i = 0; i < nThreads; ++i) {
+        threadGroup.create_thread(boost::bind<void>(readRange, vMissing.size() * i / nThreads, vMissing.size() * (i + 1) / nThreads));
+    }
+    threadGroup.join_all();
 
-        if(vchRet.size() != 20) {
-            return false;
+    nCacheMisses += vMissing.size();
+    for(size_t i = 0; i < vMissing.size(); ++i) {
+        if(vRead[i].first) {
+            mapAddressBalance.insert(vMissing[i], vRead[i].second, 0);
+        } else {
+            mapAddressBalance.insert(vMissing[i], 0, CBalanceCacheEntry::FRESH);
         }
+    }
+}
 
-        auto&& r = data.forgers.insert(CKeyID(uint160(vchRet)));
-        if(r.second == false) {
-            return false;
+void Vote::UpdateAddressBalance(const std::vector<std::pair<CMyAddress, int64_t>>& vAddressBalance)
+{
+    // Sorted and merged in place, the deltas of an address next to each other
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    vBalance.reserve(vAddressBalance.size());
+    for(auto& iter : vAddressBalance) {
+        if(iter.second != 0) {
+            vBalance.push_back(iter);
         }
     }
+    std::sort(vBalance.begin(), vBalance.end(), [](const std::pair<CMyAddress, int64_t>& a, const std::pair<CMyAddress, int64_t>& b) {
+        return a.first < b.first;
+    });
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
+    size_t nMerged = 0;
+    for(size_t i = 0; i < vBalance.size();) {
+        std::pair<CMyAddress, int64_t> merged = vBalance[i];
+        for(++i; i < vBalance.size() && vBalance[i].first == merged.first; ++i) {
+            merged.second += vBalance[i].second;
+        }
+        if(merged.second != 0) {
+            vBalance[nMerged++] = merged;
+        }
     }
-    return ret;
-}
+    vBalance.resize(nMerged);
 
-bool DataToStruct(CSubmitBillData& data, const CScript& script)
-{
-    bool ret = false;
+    {
+        WRITE_LOCK(lockVote);
+        {
+            LOCK(cs_mapAddressBalance);
+            PrefetchAddressBalances(vBalance);
+            for(auto& iter : vBalance) {
+                _UpdateAddressBalance(iter.first, iter.second);
+            }
+        }
 
-    auto iter = script.begin();
-    data.opcode = *iter++;
+        for(auto& iter : vBalance)
+        {
+            if(iter.first.second != CChainParams::PUBKEY_ADDRESS)
+                continue;
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+            auto it = mapVoterDelegates.find(iter.first.first);
+            if(it != mapVoterDelegates.end()) {
+                for(auto& delegate : it->second) {
+                    _AddDelegateVotes(delegate, iter.second);
+                }
+            }
+        }
     }
-    data.title = std::string(vchRet.begin(), vchRet.end());
 
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+    // CVoteDBK2 reads balances back through GetBalance under its own lock, so never enter it with lockVote held
+    if(!pbill) {
+        return;
     }
-    data.detail = std::string(vchRet.begin(), vchRet.end());
-
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+    for(auto& iter : vBalance) {
+        if(iter.first.second == CChainParams::PUBKEY_ADDRESS) {
+            pbill->UpdateVoterBalance(iter.first.first, iter.second);
+        }
     }
-    data.url = std::string(vchRet.begin(), vchRet.end());
+}
 
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+uint64_t Vote::_UpdateAddressBalance(const CMyAddress& address, int64_t value)
+{
+    LOCK(cs_mapAddressBalance);
+
+    auto it = FetchAddressBalance(address);
+    int64_t balance = it->nBalance + value;
+    if(balance < 0) {
+        abort();
     }
-    data.endtime = std::stoll(std::string(vchRet.begin(), vchRet.end()));
 
-    uint8_t num = *iter++;
-    for(int i =0; i < num; ++i) {
-        if (!script.GetOp2(iter, opcode, &vchRet)) {
-            return false;
+    balanceIndex.Update(address, it->nBalance, balance);
+    UpdateBalanceHash(muhashBalance, address, it->nBalance, balance);
+
+    if(address.second == CChainParams::PUBKEY_ADDRESS) {
+        _UpdateDelegateFunds(address.first, it->nBalance, balance);
+    } else {
+        auto delegates = mapMultiaddressDelegates.find(address);
+        if(delegates != mapMultiaddressDelegates.end()) {
+            for(auto& delegate : delegates->second) {
+                _UpdateDelegateFunds(delegate, it->nBalance, balance);
+            }
         }
+    }
 
-        data.options.push_back(std::string(vchRet.begin(), vchRet.end()));
+    if(balance == 0 && (it->flags & CBalanceCacheEntry::FRESH)) {
+        mapAddressBalance.erase(it);
+    } else {
+        it->nBalance = balance;
+        it->flags |= CBalanceCacheEntry::DIRTY;
     }
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
+    return balance;
+}
+
+void Vote::DeleteInvalidVote(uint64_t height)
+{
+    WRITE_LOCK(lockMapHashHeightInvalidVote);
+    size_t nCount = mapHashHeightInvalidVote.Prune(height + 1);
+    if(nCount > 0) {
+        ++nDelegateChanges;
+        LogPrintf("DeleteInvalidVote Height:%llu Count:%u\n", height, nCount);
     }
-    return ret;
 }
 
-bool DataToStruct(CVoteBillData& data, const CScript& script)
+void Vote::AddInvalidVote(uint256 hash, uint64_t height)
 {
-    bool ret = false;
+    WRITE_LOCK(lockMapHashHeightInvalidVote);
+    mapHashHeightInvalidVote.Add(hash, height);
+    ++nDelegateChanges;
+    LogPrintf("AddInvalidVote Hash:%s Height:%llu\n", hash.ToString().c_str(), height);
+}
 
-    auto iter = script.begin();
-    data.opcode = *iter++;
+bool Vote::FindInvalidVote(uint256 hash)
+{
+    READ_LOCK(lockMapHashHeightInvalidVote);
+    return mapHashHeightInvalidVote.Find(hash);
+}
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
-    }
+std::map<CMyAddress, uint256> Vote::GetDelegateMultiaddress(const CMyAddress& delegate)
+{
+    READ_LOCK(lockVote);
 
-    if(vchRet.size() != 40) {
-        return false;
+    auto it = mapDelegateMultiaddress.find(delegate);
+    if(it != mapDelegateMultiaddress.end()) {
+        return it->second;
+    } else {
+        return std::map<CMyAddress, uint256>();
     }
-    data.id.SetHex(std::string(vchRet.begin(), vchRet.end()));
-    data.index = *iter++;
+}
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
-    }
-    return ret;
+bool Vote::AddDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
+{
+    WRITE_LOCK(lockVote);
+    return _AddDelegateMultiaddress(delegate, multiAddress, txid);
 }
 
-bool DataToStruct(CRegisterCommitteeData& data, const CScript& script)
+bool Vote::DelDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
 {
-    auto iter = script.begin();
-    data.opcode = *iter++;
+    WRITE_LOCK(lockVote);
+    return _DelDelegateMultiaddress(delegate, multiAddress, txid);
+}
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+void Vote::UpdateDelegateMultiaddress(const std::vector<CDelegateMultiSigSpend>& vSpend, bool fIsAdd)
+{
+    if(vSpend.empty()) {
+        return;
     }
-    data.name = std::string(vchRet.begin(), vchRet.end());
 
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+    WRITE_LOCK(lockVote);
+    for(auto& spend : vSpend) {
+        CMyAddress delegate(spend.delegate, CChainParams::PUBKEY_ADDRESS);
+        // Most multisig spends are not a delegate's, so look the key up before hashing the script
+        if(fIsAdd ? mapDelegateName.count(spend.delegate) == 0 : mapDelegateMultiaddress.count(delegate) == 0) {
+            continue;
+        }
+
+        CScriptID scriptid(CScript(spend.pScriptSig->begin() + spend.nRedeemBegin, spend.pScriptSig->end()));
+        CMyAddress multiAddress(scriptid, CChainParams::SCRIPT_ADDRESS);
+        if(fIsAdd ? _AddDelegateMultiaddress(delegate, multiAddress, spend.txid) : _DelDelegateMultiaddress(delegate, multiAddress, spend.txid)) {
+            LogPrintf("MultiSignTx Hash:%s %s address:%s mutiladdress:%s succes\n", spend.txid.ToString().c_str(), fIsAdd ? "Add" : "Del",
+                CBitcoinAddress(spend.delegate).ToString().c_str(), CBitcoinAddress(scriptid).ToString().c_str());
+        }
     }
-    data.url = std::string(vchRet.begin(), vchRet.end());
+}
 
+bool Vote::_AddDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
+{
     bool ret = false;
-    if(CheckStruct(data).empty()) {
+
+    if(mapDelegateName.find(delegate.first) == mapDelegateName.end())
+        return false;
+
+
+    auto it = mapDelegateMultiaddress.find(delegate);
+    if(it != mapDelegateMultiaddress.end()) {
+        auto i = it->second.find(multiAddress);
+        if(i == it->second.end()) {
+            it->second.insert(std::make_pair(multiAddress, txid));
+            ret = true;
+        }
+    } else {
+        auto& i = mapDelegateMultiaddress[delegate];
+        i[multiAddress] = txid;
         ret = true;
     }
+
+    if(ret) {
+        mapMultiaddressDelegates[multiAddress].insert(delegate.first);
+        LOCK(cs_mapAddressBalance);
+        _UpdateDelegateFunds(delegate.first, 0, ReadAddressBalance(multiAddress));
+    }
+
+    fViewMultiaddressDirty |= ret;
+    nDelegateChanges += ret;
     return ret;
 }
 
-bool DataToStruct(CVoteCommitteeData& data, const CScript& script)
+bool Vote::_DelDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid)
 {
     bool ret = false;
 
-    auto iter = script.begin();
-    data.opcode = *iter++;
+    auto it = mapDelegateMultiaddress.find(delegate);
+    if(it != mapDelegateMultiaddress.end()) {
+        auto i = it->second.find(multiAddress);
+        if(i != it->second.end()) {
+            if(i->second == txid) {
+                it->second.erase(i);
 
-    opcodetype opcode;
-    std::vector<unsigned char> vchRet;
-    if (!script.GetOp2(iter, opcode, &vchRet)) {
-        return false;
+                if(it->second.empty()) {
+                    mapDelegateMultiaddress.erase(it);
+                }
+                ret = true;
+            }
+        }
     }
 
-    if(vchRet.size() != 20) {
-        return false;
+    if(ret) {
+        auto delegates = mapMultiaddressDelegates.find(multiAddress);
+        if(delegates != mapMultiaddressDelegates.end()) {
+            delegates->second.erase(delegate.first);
+            if(delegates->second.empty()) {
+                mapMultiaddressDelegates.erase(delegates);
+            }
+        }
+
+        LOCK(cs_mapAddressBalance);
+        mapDelegateFunds.erase(delegate.first);
     }
 
-    data.committee = CKeyID(uint160(vchRet));
+    fViewMultiaddressDirty |= ret;
+    nDelegateChanges += ret;
+    return ret;
+}
 
-    if(CheckStruct(data).empty()) {
-        ret = true;
+std::multimap<uint64_t, CMyAddress> Vote::GetCoinRank(int num)
+{
+    LOCK(cs_mapAddressBalance);
+    return balanceIndex.GetTop(num > 0 ? num : 0, pvotedb.get());
+}
+
+std::map<uint64_t, std::pair<uint64_t, uint64_t>> Vote::GetCoinDistribution(const std::set<uint64_t>& arg)
+{
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> result;
+
+    LOCK(cs_mapAddressBalance);
+
+    // Each threshold counts the balances above the previous one
+    std::pair<uint64_t, uint64_t> prev(0, 0);
+    for(auto& it : arg) {
+        std::pair<uint64_t, uint64_t> cur = balanceIndex.GetCumulative(it, pvotedb.get());
+        result[it] = std::make_pair(cur.first - prev.first, cur.second - prev.second);
+        prev = cur;
     }
-    return ret;
+
+    return result;
 }
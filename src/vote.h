@@ -4,153 +4,256 @@
 
 #include "miner.h"
 #include "pubkey.h"
+#include <atomic>
 #include <unordered_map>
 #include <map>
+#include <initializer_list>
+#include <memory>
 #include <set>
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/filesystem.hpp>
 
+#include "balancemap.h"
 #include "base58.h"
+#include "crypto/muhash.h"
+#include "dposdata.h"
+#include "flatset.h"
 #include "script/script.h"
+#include "sync.h"
+#include "txdb.h"
 #include "votedb.h"
 
-struct COpData{
-    uint8_t opcode;
+struct CPendingDPoSOp;
+class CSnapshotReader;
+class CSnapshotWriter;
+
+/** The balances the votes on bills count with, those of Vote::GetInstance() */
+struct CVoteBalanceSource
+{
+    uint64_t operator()(const CKeyID& id) const;
 };
 
-struct CRegisterForgerData : public COpData {
-    std::string name;
+/** Cache misses of a block's balance updates per thread reading them from the vote database */
+static const size_t BALANCE_PREFETCH_PER_THREAD = 256;
+static const int MAX_BALANCE_PREFETCH_THREADS = 8;
 
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & name;
+struct key_hash
+{
+    std::size_t operator()(CMyAddress const& k) const {
+        std::size_t hash = 0;
+        boost::hash_range( hash, k.first.begin(), k.first.end() );
+        boost::hash_combine( hash, k.second );
+        return hash;
     }
 };
 
-struct CVoteForgerData : public COpData {
-	std::set<CKeyID> forgers;
-
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & forgers;
-    }
+/** Serialized non-balance part of the vote state, written to the vote database in one batch */
+struct CVoteStateSnapshot {
+    CDataStream delegates;
+    CDataStream bills;
+    CDataStream committees;
+    //! Set hash of the balances, each nonzero balance with its address as an element
+    MuHash3072 muhashBalance;
+
+    CVoteStateSnapshot()
+        : delegates(SER_DISK, CLIENT_VERSION), bills(SER_DISK, CLIENT_VERSION), committees(SER_DISK, CLIENT_VERSION) {}
+
+    /**
+     * Commitment to the whole vote state: the balance set hash and the rest of
+     * the state as serialized. Nodes that agree on the state of a block agree
+     * on it, and a state snapshot carries it for the state to be checked against.
+     */
+    uint256 GetHash() const;
+    uint256 GetBalanceHash() const;
 };
 
-struct CCancelVoteForgerData : public COpData {
-	std::set<CKeyID> forgers;
+/** A spend of a 2-of-n multisig script whose first key may be a delegate's, tying the script address to that delegate */
+struct CDelegateMultiSigSpend {
+    CKeyID delegate;
+    const CScript* pScriptSig; // the scriptSig of the spending transaction, ending with the redeem script
+    size_t nRedeemBegin;
+    uint256 txid;
 
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & forgers;
-    }
+    CDelegateMultiSigSpend() : pScriptSig(NULL), nRedeemBegin(0) {}
 };
 
-struct CRegisterCommitteeData : public COpData {
-    std::string name;
-    std::string url;
+/** DPoS effects of a block as applied when it is connected, gathered while its spent outputs are at hand */
+struct CDPoSBlockDelta {
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+    std::vector<uint64_t> vTxFee; // indexed like block.vtx
+    std::vector<CKeyID> vSender; // indexed like block.vtx, the key pay-to-pubkey-hash inputs spend from, null otherwise
+    std::vector<std::pair<uint32_t, uint32_t>> vMultiSigInput; // (tx, input) spending script address outputs
+};
+
+/** A vote or cancelvote that took effect in a block */
+struct CDPoSVoteOp {
+    uint256 txid;
+    CKeyID voter;
+    bool fVote;
+    std::vector<CKeyID> vDelegates;
+
+    CDPoSVoteOp() : fVote(true) {}
 
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & name;
-        ar & url;
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(voter);
+        READWRITE(fVote);
+        READWRITE(vDelegates);
     }
 };
 
-struct CVoteCommitteeData : public COpData {
-    CKeyID committee;
-
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & committee;
+/** The votes of a connected or disconnected block and the tallies of their delegates after it, for the pubvote ZMQ topic */
+struct CDPoSVoteEvent {
+    uint256 hashBlock;
+    int nHeight;
+    bool fUndo;
+    std::vector<CDPoSVoteOp> vOps;
+    std::vector<std::pair<CKeyID, uint64_t>> vTallies;
+
+    CDPoSVoteEvent() : nHeight(-1), fUndo(false) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(fUndo);
+        READWRITE(vOps);
+        READWRITE(vTallies);
     }
 };
 
-struct CCancelVoteCommitteeData : public COpData {
-    CKeyID committee;
+/** The changes a connected or disconnected block made to the address balances votes count, for the pubbalance ZMQ topic */
+struct CDPoSBalanceEvent {
+    uint256 hashBlock;
+    int nHeight;
+    bool fUndo;
+    std::vector<std::pair<CMyAddress, int64_t>> vBalance;
+
+    CDPoSBalanceEvent() : nHeight(-1), fUndo(false) {}
 
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & committee;
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(fUndo);
+        READWRITE(vBalance);
     }
 };
 
-struct CSubmitBillData : public COpData {
-    CKeyID committee;
-    std::string title;
-    std::string detail;
-    std::string url;
-    std::vector<std::string> options;
-    uint64_t starttime;
-    uint64_t endtime;
-
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & committee;
-        ar & title;
-        ar & detail;
-        ar & url;
-        ar & starttime;
-        ar & endtime;
-        ar & options;
-    }
+/** Usage and lookup counters of the address balance cache, reported by getmemoryinfo */
+struct CBalanceCacheStats {
+    size_t nUsage;
+    size_t nEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
 };
 
-struct CVoteBillData : public COpData {
-    uint160 id;
-    uint8_t index;
+/**
+ * All positive address balances ordered by value, for the coin rank and
+ * distribution RPCs. The order is kept by the rank records of the vote
+ * database, and only the balances changed since the last flush are held
+ * here, so memory stays bounded by the cache they are dirty in. Balances
+ * are also counted in log-scale buckets (16 per power of two), so a
+ * distribution query only walks the addresses of the bucket each threshold
+ * falls in. Without a vote database every balance is held here.
+ */
+class CBalanceIndex {
+public:
+    CBalanceIndex();
 
-    template<class Archive>
-    void serialize(Archive& ar, const unsigned int version)
-    {
-        ar & id;
-        ar & index;
-    }
+    void Update(const CMyAddress& address, uint64_t nOldBalance, uint64_t nNewBalance);
+    /** Count a balance the rank records of the vote database already hold */
+    void AddStored(uint64_t nBalance);
+    void Clear();
+    size_t size() const { return nCount; }
+    size_t DynamicMemoryUsage() const;
+
+    /** The changes to write to the rank records along with the balances they follow */
+    std::vector<CVoteRankChange> GetChanges() const;
+    /** Forget the changes once they are written */
+    void ClearChanges();
+
+    std::multimap<uint64_t, CMyAddress> GetTop(size_t num, CVoteDB* pdb) const;
+    /** Count and sum of the balances in (0, nThreshold] */
+    std::pair<uint64_t, uint64_t> GetCumulative(uint64_t nThreshold, CVoteDB* pdb) const;
+
+private:
+    static const int BUCKET_BITS = 4;
+    static const int BUCKET_COUNT = 64 << BUCKET_BITS;
+
+    static int GetBucket(uint64_t nBalance);
+    static uint64_t GetBucketStart(int nBucket);
+
+    void Count(uint64_t nBalance, int nSign);
+
+    //! The balance the vote database has of each address changed since the last flush, and its balance now
+    std::map<CMyAddress, std::pair<uint64_t, uint64_t>> mapChanged;
+    //! The positive balances of those addresses now, in order
+    std::set<std::pair<uint64_t, CMyAddress>> setChanged;
+    std::vector<uint64_t> vBucketCount;
+    std::vector<uint64_t> vBucketSum;
+    size_t nCount;
 };
 
-std::vector<unsigned char> StructToData(const CRegisterForgerData& data);
-std::vector<unsigned char> StructToData(const CVoteForgerData& data);
-std::vector<unsigned char> StructToData(const CCancelVoteForgerData& data);
-std::vector<unsigned char> StructToData(const CRegisterCommitteeData& data);
-std::vector<unsigned char> StructToData(const CVoteCommitteeData& data);
-std::vector<unsigned char> StructToData(const CCancelVoteCommitteeData& data);
-std::vector<unsigned char> StructToData(const CSubmitBillData& data);
-std::vector<unsigned char> StructToData(const CVoteBillData& data);
-std::string CheckStruct(const CRegisterForgerData& data);
-std::string CheckStruct(const CVoteForgerData& data);
-std::string CheckStruct(const CCancelVoteForgerData& data);
-std::string CheckStruct(const CRegisterCommitteeData& data);
-std::string CheckStruct(const CVoteCommitteeData& data);
-std::string CheckStruct(const CCancelVoteCommitteeData& data);
-std::string CheckStruct(const CSubmitBillData& data);
-std::string CheckStruct(const CVoteBillData& data);
-
-
-bool DataToStruct(CRegisterForgerData& data, const CScript& script);
-bool DataToStruct(CVoteForgerData& data, const CScript& script);
-bool DataToStruct(CCancelVoteForgerData& data, const CScript& script);
-
-bool DataToStruct(CRegisterCommitteeData& data, const CScript& script);
-bool DataToStruct(CVoteCommitteeData& data, const CScript& script);
-bool DataToStruct(CCancelVoteCommitteeData& data, const CScript& script);
-bool DataToStruct(CSubmitBillData& data, const CScript& script);
-bool DataToStruct(CVoteBillData& data, const CScript& script);
-
-typedef std::pair<uint160, uint8_t> CMyAddress;
+/** The voters of a delegate, or the delegates of a voter */
+typedef CFlatSet<CKeyID> CKeyIDSet;
 
-struct key_hash
-{
-    std::size_t operator()(CMyAddress const& k) const {
-        std::size_t hash = 0;
-        boost::hash_range( hash, k.first.begin(), k.first.end() );
-        return hash;
-    }
+/** A bill as of a published view, with the running tallies of its options while it is open */
+struct CBillInfo {
+    CSubmitBillData data;
+    CState state;
+    std::vector<uint64_t> vTally;
+};
+
+/**
+ * Immutable copy of the delegate state, published by Vote after every
+ * connected or disconnected block so RPC readers never take lockVote. Maps
+ * and voter sets are shared with the previous view and only copied for the
+ * parts a block changed.
+ */
+class CVoteView {
+public:
+    typedef std::map<CKeyID, std::shared_ptr<const CKeyIDSet>> CKeySetMap;
+    typedef std::map<uint160, CBillInfo> CBillMap;
+
+    CVoteView();
+
+    CKeyID GetDelegate(const std::string& name) const;
+    std::string GetDelegate(const CKeyID& keyid) const;
+    bool HaveDelegate(const std::string& name) const;
+    bool HaveDelegate(const std::string& name, const CKeyID& keyid) const;
+    bool HaveVote(const CKeyID& voter, const CKeyID& delegate) const;
+
+    uint64_t GetDelegateVotes(const CKeyID& delegate) const;
+    std::set<CKeyID> GetDelegateVoters(const CKeyID& delegate) const;
+    size_t GetDelegateVoterCount(const CKeyID& delegate) const;
+    /** The voters of a delegate without copying them, kept alive as long as the pointer is */
+    std::shared_ptr<const CKeyIDSet> GetDelegateVoterSet(const CKeyID& delegate) const;
+    std::set<CKeyID> GetVotedDelegates(const CKeyID& voter) const;
+    std::map<CMyAddress, uint256> GetDelegateMultiaddress(const CMyAddress& delegate) const;
+    const std::map<std::string, CKeyID>& ListDelegates() const { return *pNameDelegate; }
+    const CBillMap& ListBills() const { return *pBills; }
+
+    /** A copy of this view with the pending operations applied under the rules of the Process methods of Vote */
+    std::shared_ptr<const CVoteView> WithPending(const std::vector<CPendingDPoSOp>& vOps) const;
+
+private:
+    friend class Vote;
+
+    std::shared_ptr<const std::map<CKeyID, std::string>> pDelegateName;
+    std::shared_ptr<const std::map<std::string, CKeyID>> pNameDelegate;
+    std::shared_ptr<const std::map<CMyAddress, std::map<CMyAddress, uint256>>> pDelegateMultiaddress;
+    std::shared_ptr<const CKeySetMap> pDelegateVoters;
+    std::shared_ptr<const CKeySetMap> pVoterDelegates;
+    std::shared_ptr<const CBillMap> pBills;
+    std::map<CKeyID, uint64_t> mapDelegateVotes;
 };
 
 class Vote{
@@ -161,8 +264,8 @@ public:
     static Vote& GetInstance();
     std::vector<Delegate> GetTopDelegateInfo(uint64_t nMinHoldBalance, uint32_t nDelegateNum);
 
-    bool ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height, bool fUndo);
-    bool ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height, bool fUndo);
+    bool ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height, bool fUndo);
+    bool ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height, bool fUndo);
     bool ProcessRegister(const CKeyID& delegate, const std::string& strDelegateName, uint256 hash, uint64_t height, bool fUndo);
 
     uint64_t GetDelegateVotes(const CKeyID& delegate);
@@ -170,12 +273,43 @@ public:
     std::set<CKeyID> GetVotedDelegates(const CKeyID& delegate);
     std::map<std::string, CKeyID> ListDelegates();
 
-    bool Store(int64_t height, const std::string& strBlockHash);
+    /** The delegate state as of the last PublishView, readable without any lock */
+    std::shared_ptr<const CVoteView> GetView() const { return std::atomic_load(&pView); }
+    /** Publish the current delegate state to GetView, call after every block */
+    void PublishView();
+    /** Changes with every PublishView, so results derived from the vote state can be kept until then */
+    uint64_t GetStateGeneration();
+
     bool Load(int64_t height, const std::string& strBlockHash);
 
+    /** Open the vote database, must be called before Init */
+    void OpenDB(size_t nCacheSize, bool fWipe);
+    void CloseDB();
+    /**
+     * Write the changed balances and the vote state of the given block to the vote database.
+     * With fErase the balance cache is emptied, otherwise its entries stay cached as clean.
+     */
+    bool Flush(int64_t height, const uint256& hashBlock, bool fErase = true);
+    size_t DynamicMemoryUsage();
+    CBalanceCacheStats GetCacheStats();
+
+    /** Write the vote database, which must hold the flushed state of the given block, to a state snapshot */
+    bool DumpSnapshot(CSnapshotWriter& writer, int64_t nHeight, const uint256& hashBlock, uint64_t& nBalances, uint256& hashState);
+    /**
+     * Read the vote state of a state snapshot, checking it against the commitment the snapshot carries,
+     * and with fWrite write its balances to the vote database. The rest of the state is left to CommitSnapshot
+     */
+    bool LoadSnapshot(CSnapshotReader& reader, bool fWrite, CVoteStateSnapshot& snapshot, uint64_t& nBalances, uint256& hashState);
+    /** Make the vote state read by LoadSnapshot that of the given block */
+    bool CommitSnapshot(const CVoteStateSnapshot& snapshot, int64_t nHeight, const uint256& hashBlock);
+    /** The commitment to the current vote state, see CVoteStateSnapshot::GetHash, and the hash of its balances */
+    uint256 GetStateHash(uint256& hashBalances);
+
     static uint64_t GetBalance(const CKeyID& id) {return Vote::GetInstance().GetAddressBalance(CMyAddress(id, CChainParams::PUBKEY_ADDRESS));}
 
     uint64_t GetAddressBalance(const CMyAddress& id);
+    /** Call func with every address that has a balance, from the vote database and the cache */
+    void ForEachAddressBalance(std::function<void(const CMyAddress&, uint64_t)> func);
     void UpdateAddressBalance(const std::vector<std::pair<CMyAddress, int64_t>>& addressBalances);
 
     CKeyID GetDelegate(const std::string& name);
@@ -195,17 +329,20 @@ public:
 
     bool AddDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid);
     bool DelDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid);
+    /** Add or remove the multiaddresses of the delegate multisig spends of a block, all under one lock */
+    void UpdateDelegateMultiaddress(const std::vector<CDelegateMultiSigSpend>& vSpend, bool fIsAdd);
     std::map<CMyAddress, uint256> GetDelegateMultiaddress(const CMyAddress& delegate);
 
     CVoteDBK1<CKeyID, CRegisterCommitteeData, CKeyID>& GetCommittee() {
         return *pcommittee;
     }
 
-    CVoteDBK2<uint160, CSubmitBillData, CKeyID>& GetBill() {
+    CVoteDBK2<uint160, CSubmitBillData, CKeyID, CVoteBalanceSource>& GetBill() {
         return *pbill;
     }
 
     static const int MaxNumberOfVotes = 51;
+    /** The largest balance of a delegate's own address and its multiaddresses, cached until one of them changes */
     uint64_t GetDelegateFunds(const CMyAddress& address);
 
     std::multimap<uint64_t, CMyAddress> GetCoinRank(int num);
@@ -215,26 +352,43 @@ private:
     uint64_t _GetAddressBalance(const CMyAddress& address);
     uint64_t _UpdateAddressBalance(const CMyAddress& id, int64_t value);
     uint64_t _GetDelegateVotes(const CKeyID& delegate);
+    void _AddDelegateVotes(const CKeyID& delegate, int64_t value);
+    void _EraseDelegateVotes(const CKeyID& delegate);
+    void RebuildDelegateVotes();
+    uint64_t _GetDelegateFunds(const CKeyID& delegate);
+    void _UpdateDelegateFunds(const CKeyID& delegate, uint64_t nOldBalance, uint64_t nNewBalance);
+    void RebuildDelegateFunds();
+    bool _AddDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid);
+    bool _DelDelegateMultiaddress(const CMyAddress& delegate, const CMyAddress& multiAddress, const uint256& txid);
 
     bool RepairFile(int64_t nBlockHeight, const std::string& strBlockHash);
     bool ReadControlFile(int64_t& nBlockHeight, std::string& strBlockHash, const std::string& strFileName);
-    bool WriteControlFile(int64_t nBlockHeight, const std::string& strBlockHash, const std::string& strFileName);
 
     bool Read();
-    bool Write(const std::string& strBlockHash);
+    bool ReadDB();
+    /** Serialize the non-balance state, or the parts of it asked for, into snapshot and copy the balance set hash. Requires lockVote */
+    void GetState(CVoteStateSnapshot& snapshot, bool fDelegates = true, bool fBills = true, bool fCommittees = true);
     void Delete(const std::string& strBlockHash);
 
-    bool ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height);
-    bool ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height);
+    /** The cache entry of an address, read from the vote database or added as a fresh zero balance, for updating it */
+    CBalanceMap::iterator FetchAddressBalance(const CMyAddress& address);
+    /** The balance of an address, cached only when the vote database has it. Requires cs_mapAddressBalance */
+    uint64_t ReadAddressBalance(const CMyAddress& address);
+    /** Read the balances of a block's addresses missing from the cache on a few threads, when there are many */
+    void PrefetchAddressBalances(const std::vector<std::pair<CMyAddress, int64_t>>& vAddressBalance);
+    void RebuildBalanceIndex();
+
+    bool ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height);
+    bool ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height);
     bool ProcessRegister(const CKeyID& delegate, const std::string& strDelegateName, uint256 hash, uint64_t height);
     bool ProcessUnregister(const CKeyID& delegate, const std::string& strDelegateName, uint256 hash, uint64_t height);
 
-    bool ProcessUndoVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height);
-    bool ProcessUndoCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates, uint256 hash, uint64_t height);
+    bool ProcessUndoVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height);
+    bool ProcessUndoCancelVote(const CKeyID& voter, const CDPoSKeys& delegates, uint256 hash, uint64_t height);
     bool ProcessUndoRegister(const CKeyID& delegate, const std::string& strDelegateName, uint256 hash, uint64_t height);
 
-    bool ProcessVote(const CKeyID& voter, const std::set<CKeyID>& delegates);
-    bool ProcessCancelVote(const CKeyID& voter, const std::set<CKeyID>& delegates);
+    bool ProcessVote(const CKeyID& voter, const CDPoSKeys& delegates);
+    bool ProcessCancelVote(const CKeyID& voter, const CDPoSKeys& delegates);
     bool ProcessRegister(const CKeyID& delegate, const std::string& strDelegateName);
     bool ProcessUnregister(const CKeyID& delegate, const std::string& strDelegateName);
 
@@ -246,16 +400,48 @@ private:
     const int64_t nCurrentVersion = -1;
     boost::shared_mutex lockVote;
 
-    std::map<CKeyID, std::set<CKeyID>> mapDelegateVoters;
-    std::map<CKeyID, std::set<CKeyID>> mapVoterDelegates;
+    std::map<CKeyID, CKeyIDSet> mapDelegateVoters;
+    std::map<CKeyID, CKeyIDSet> mapVoterDelegates;
+    // Vote totals of the delegates in mapDelegateVoters, kept up to date as votes and balances change
+    std::map<CKeyID, uint64_t> mapDelegateVotes;
+    std::set<std::pair<uint64_t, CKeyID>> setDelegateRank;
     std::map<CKeyID, std::string> mapDelegateName;
     std::map<std::string, CKeyID> mapNameDelegate;
-    std::map<uint256, uint64_t>  mapHashHeightInvalidVote;
+    CInvalidVoteIndex mapHashHeightInvalidVote;
     boost::shared_mutex lockMapHashHeightInvalidVote;
 
-    std::unordered_map<CMyAddress, uint64_t, key_hash> mapAddressBalance;
+    CCriticalSection cs_mapAddressBalance;
+    CBalanceMap mapAddressBalance;
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    // Set hash of all the balances, cached or not, as the vote database will have them when flushed
+    MuHash3072 muhashBalance;
+    CBalanceIndex balanceIndex;
+    std::unique_ptr<CVoteDB> pvotedb;
 
     std::map<CMyAddress, std::map<CMyAddress, uint256>> mapDelegateMultiaddress;
+    // The delegates of each multiaddress, the reverse of mapDelegateMultiaddress
+    std::map<CMyAddress, CKeyIDSet> mapMultiaddressDelegates;
+    // Funds of the delegates ranked so far, guarded by cs_mapAddressBalance like the balances they follow
+    std::map<CKeyID, uint64_t> mapDelegateFunds;
+
+    // Published by PublishView, only accessed through std::atomic_load and std::atomic_store
+    std::shared_ptr<const CVoteView> pView;
+    // What changed since the last PublishView, guarded by lockVote
+    bool fViewReset;
+    bool fViewDelegatesDirty;
+    bool fViewMultiaddressDirty;
+    std::set<CKeyID> setViewDirtyDelegates;
+    std::set<CKeyID> setViewDirtyVoters;
+    uint64_t nStateGeneration;
+
+    // Changes to the delegate state of the maps above, so Flush only rewrites the parts that changed
+    std::atomic<uint64_t> nDelegateChanges;
+    // Whether the vote database holds the state as of the change counts below, guarded by lockVote
+    bool fFlushedState;
+    uint64_t nFlushedDelegateChanges;
+    uint64_t nFlushedBillChanges;
+    uint64_t nFlushedCommitteeChanges;
 
     std::string strFilePath;
     std::string strDelegateFileName;
@@ -272,8 +458,9 @@ private:
     std::string strOldBlockHash;
     int64_t nOldBlockHeight;
 
+
     std::shared_ptr<CVoteDBK1<CKeyID, CRegisterCommitteeData, CKeyID>> pcommittee;
-    std::shared_ptr<CVoteDBK2<uint160, CSubmitBillData, CKeyID>> pbill;
+    std::shared_ptr<CVoteDBK2<uint160, CSubmitBillData, CKeyID, CVoteBalanceSource>> pbill;
 };
 
 #endif
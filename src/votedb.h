@@ -2,14 +2,23 @@
 #ifndef _VOTE_DB_H
 #define _VOTE_DB_H
 
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
 
 #include <boost/thread/shared_mutex.hpp>
-#include "uint256.h"
-#include "myserialize.h"
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
 #include "chainparams.h"
+#include "flatset.h"
+#include "hash.h"
+#include "myserialize.h"
+#include "random.h"
+#include "uint256.h"
 
 struct CState{
     bool bFinished;
@@ -40,24 +49,159 @@ struct CState{
         ar & nEndtime;
         ar & nFinishedHeight;
     }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(bFinished);
+        READWRITE(bPassed);
+        READWRITE(nOptionIndex);
+        READWRITE(nTotalVote);
+        READWRITE(nEndtime);
+        READWRITE(nFinishedHeight);
+    }
+};
+
+/**
+ * Hashes of the vote txs rejected at a height, so their undo can be skipped.
+ * The hashes are also bucketed by height: pruning at an irreversible block
+ * drops whole buckets instead of scanning every hash. Only the hash->height
+ * map is serialized, in the same format as the std::map it replaces.
+ */
+class CInvalidVoteIndex{
+public:
+    bool Find(const uint256& hash) const
+    {
+        return mapHashHeight.find(hash) != mapHashHeight.end();
+    }
+
+    void Add(const uint256& hash, uint64_t height)
+    {
+        Erase(hash);
+        mapHashHeight[hash] = height;
+        mapHeightHash[height].insert(hash);
+    }
+
+    void Erase(const uint256& hash)
+    {
+        auto it = mapHashHeight.find(hash);
+        if(it == mapHashHeight.end()) {
+            return;
+        }
+
+        auto itb = mapHeightHash.find(it->second);
+        if(itb != mapHeightHash.end()) {
+            itb->second.erase(hash);
+            if(itb->second.empty()) {
+                mapHeightHash.erase(itb);
+            }
+        }
+        mapHashHeight.erase(it);
+    }
+
+    /** Forget the hashes added below height, returns how many were dropped */
+    size_t Prune(uint64_t height)
+    {
+        size_t nCount = 0;
+        for(auto it = mapHeightHash.begin(); it != mapHeightHash.end() && it->first < height; ) {
+            for(auto& hash : it->second) {
+                mapHashHeight.erase(hash);
+            }
+            nCount += it->second.size();
+            it = mapHeightHash.erase(it);
+        }
+        return nCount;
+    }
+
+    size_t size() const
+    {
+        return mapHashHeight.size();
+    }
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & mapHashHeight;
+        if(Archive::is_loading::value) {
+            RebuildBuckets();
+        }
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ::Serialize(s, mapHashHeight);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        ::Unserialize(s, mapHashHeight);
+        RebuildBuckets();
+    }
+
+private:
+    void RebuildBuckets()
+    {
+        mapHeightHash.clear();
+        for(auto& it : mapHashHeight) {
+            mapHeightHash[it.second].insert(it.first);
+        }
+    }
+
+    std::map<uint256, uint64_t> mapHashHeight;
+    std::map<uint64_t, std::set<uint256>> mapHeightHash;
 };
 
+// Keep legacy text archives of the index identical to those of a bare std::map
+BOOST_CLASS_IMPLEMENTATION(CInvalidVoteIndex, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(CInvalidVoteIndex, boost::serialization::track_never)
+
 template<typename K, typename V, typename Voter>
 class CVoteDBK1{
 public:
     typedef boost::shared_lock<boost::shared_mutex> read_lock;
     typedef boost::unique_lock<boost::shared_mutex> write_lock;
 
-    CVoteDBK1(uint64_t height) : nVersion(1), nStartHeight(height) {}
+    CVoteDBK1(uint64_t height) : nVersion(1), nStartHeight(height), nChanges(0) {}
+
+    bool Save(const std::string& filename)
+    {
+        read_lock r(lock);
+        return WriteVoteSnapshot(filename, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
+    }
+
+    bool Load(const std::string& filename)
+    {
+        write_lock w(lock);
+        bool ret = LoadVoteSnapshot(filename, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
+        RebuildIndex();
+        ++nChanges;
+        return ret;
+    }
 
-    void Save(const std::string& filename)
+    template<typename Stream>
+    void Dump(Stream& s)
     {
-        MySerialize(filename, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
+        read_lock r(lock);
+        SerializeMany(s, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
     }
 
-    void Load(const std::string& filename)
+    template<typename Stream>
+    void Restore(Stream& s)
     {
-        MyUnserialize(filename, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
+        write_lock w(lock);
+        UnserializeMany(s, nVersion, mapKV, mapK1Voter, mapInvalid, setVoter);
+        RebuildIndex();
+        ++nChanges;
+    }
+
+    /** Counts the changes to the serialized state, so a writer can tell whether it has to write it again */
+    uint64_t GetChanges()
+    {
+        read_lock r(lock);
+        return nChanges;
     }
 
     bool Register(const K& k, const V& v, const uint256& hash, uint64_t height, bool fUndo)
@@ -79,33 +223,36 @@ public:
 
             auto it = mapKV.find(k);
             if(it != mapKV.end()) {
+                auto itn = mapNameK.find(it->second.name);
+                if(itn != mapNameK.end() && itn->second == k) {
+                    mapNameK.erase(itn);
+                }
+                for(auto& i : mapK1Voter[k]) {
+                    mapVoterK.erase(i.first);
+                }
                 mapKV.erase(it);
                 mapK1Voter.erase(k);
                 ret = true;
             }
         } else {
-            if(mapKV.find(k) == mapKV.end()) {
-                ret = true;
-                for(auto& i : mapKV) {
-                    if(i.second.name == v.name) {
-                        ret = false;
-                        break;
-                    }
-                }
-            }
+            ret = mapKV.find(k) == mapKV.end() && mapNameK.find(v.name) == mapNameK.end();
 
             if(ret) {
                 mapKV[k] = v;
                 mapK1Voter[k] = std::map<Voter, uint64_t>();
+                mapNameK[v.name] = k;
             } else {
                 AddInvalid(hash, height);
             }
         }
 
+        nChanges += ret;
         return ret;
     }
 
-    bool FindRegiste(std::function<bool(const K&, const V&)> f)
+    /** Call f(key, value) with every registration until it returns true, which is then returned */
+    template<typename F>
+    bool FindRegiste(F&& f)
     {
         bool ret = false;
         read_lock r(lock);
@@ -118,7 +265,9 @@ public:
         return ret;
     }
 
-    bool FindVote(std::function<bool(const K&, std::map<Voter, uint64_t>&)> f)
+    /** Call f(key, votes) with every registration until it returns true, which is then returned */
+    template<typename F>
+    bool FindVote(F&& f)
     {
         bool ret = false;
         read_lock r(lock);
@@ -133,18 +282,44 @@ public:
 
     bool GetRegiste(V* pv, const K& k)
     {
-        bool ret = false;
         read_lock r(lock);
-        for(auto& it : mapKV) {
-            if(it.first == k) {
-                if(pv) {
-                    *pv = it.second;
-                }
-                ret = true;
-                break;
-            }
+        auto it = mapKV.find(k);
+        if(it == mapKV.end()) {
+            return false;
         }
-        return ret;
+
+        if(pv) {
+            *pv = it->second;
+        }
+        return true;
+    }
+
+    bool GetRegisteByName(K* pk, const std::string& name)
+    {
+        read_lock r(lock);
+        auto it = mapNameK.find(name);
+        if(it == mapNameK.end()) {
+            return false;
+        }
+
+        if(pk) {
+            *pk = it->second;
+        }
+        return true;
+    }
+
+    bool GetVoterRegiste(K* pk, const Voter& voter)
+    {
+        read_lock r(lock);
+        auto it = mapVoterK.find(voter);
+        if(it == mapVoterK.end()) {
+            return false;
+        }
+
+        if(pk) {
+            *pk = it->second;
+        }
+        return true;
     }
 
     std::map<Voter, uint64_t> GetVote(const K& k)
@@ -185,6 +360,7 @@ public:
                 && it->second.find(vote) != it->second.end()) {
                 it->second.erase(vote);
                 setVoter.erase(vote);
+                mapVoterK.erase(vote);
                 ret = true;
             }
         } else {
@@ -195,12 +371,14 @@ public:
                 && it->second.find(vote) == it->second.end()) {
                 it->second[vote] = 0;
                 setVoter.insert(vote);
+                mapVoterK[vote] = k;
                 ret = true;
             } else {
                 AddInvalid(hash, height);
             }
         }
 
+        nChanges += ret;
         return ret;
     }
 
@@ -225,6 +403,7 @@ public:
                 && it->second.find(vote) != it->second.end()) {
                 it->second[vote] = 0;
                 setVoter.insert(vote);
+                mapVoterK[vote] = k;
                 ret = true;
             }
         } else {
@@ -235,43 +414,57 @@ public:
                 && it->second.find(vote) != it->second.end()) {
                 it->second.erase(vote);
                 setVoter.erase(vote);
+                mapVoterK.erase(vote);
                 ret = true;
             } else {
                 AddInvalid(hash, height);
             }
         }
 
+        nChanges += ret;
         return ret;
     }
 
     void NewIrreversibleBlock(uint64_t height)
     {
         write_lock w(lock);
-        for(auto it = mapInvalid.begin(); it != mapInvalid.end(); ) {
-            if(it->second < height) {
-                it = mapInvalid.erase(it);
-            } else {
-                ++it;
-            }
+        if(mapInvalid.Prune(height) > 0) {
+            ++nChanges;
         }
     }
 
 private:
     bool IsInvalid(const uint256& hash)
     {
-        return mapInvalid.find(hash) != mapInvalid.end();
+        return mapInvalid.Find(hash);
     }
 
     void AddInvalid(const uint256& hash, uint64_t height)
     {
-        mapInvalid[hash] = height;
+        mapInvalid.Add(hash, height);
+        ++nChanges;
     }
 
     void DelInvalid(const uint256& hash)
     {
-        mapInvalid.erase(hash);
+        mapInvalid.Erase(hash);
+        ++nChanges;
     }
 
+    // The indexes are derived from mapKV/mapK1Voter and never serialized.
+    void RebuildIndex()
+    {
+        mapNameK.clear();
+        mapVoterK.clear();
+        for(auto& it : mapKV) {
+            mapNameK[it.second.name] = it.first;
+        }
+        for(auto& it : mapK1Voter) {
+            for(auto& i : it.second) {
+                mapVoterK[i.first] = it.first;
+            }
+        }
+    }
 
 private:
     uint64_t nVersion;
@@ -280,29 +473,212 @@ private:
     std::map<K, V> mapKV;
     std::map<K, std::map<Voter, uint64_t>> mapK1Voter;
     std::set<Voter> setVoter;
-    std::map<uint256, uint64_t>  mapInvalid;
+    CInvalidVoteIndex mapInvalid;
+    uint64_t nChanges;
+
+    std::map<std::string, K> mapNameK;
+    std::map<Voter, K> mapVoterK;
 };
 
-template<typename K, typename V, typename Voter>
+/** A vote on a bill: the option voted for and the balance it counts with. The slot of CBillVoteMap */
+template<typename Voter>
+struct CBillVote {
+    uint64_t nBalance;
+    Voter voter;
+    uint8_t nOption;
+    bool fUsed; // The CBillVoteMap slot holds a vote.
+
+    CBillVote() : nBalance(0), nOption(0), fUsed(false) {}
+};
+
+/**
+ * The votes on one bill by voter, an open addressing hash table with linear
+ * probing like CBalanceMap. A vote takes a slot of one flat array, 32 bytes
+ * for a CKeyID voter, instead of a node of the map of its option, and its
+ * option is found without looking through those of the others. Inserting or
+ * erasing moves the votes, so pointers to them are only good until then.
+ */
+template<typename Voter>
+class CBillVoteMap
+{
+public:
+    typedef CBillVote<Voter> Slot;
+
+    CBillVoteMap() : nSize(0), k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    /** The vote of voter, or NULL */
+    const Slot* find(const Voter& voter) const
+    {
+        if (vSlot.empty())
+            return NULL;
+
+        for (size_t i = GetSlot(voter); vSlot[i].fUsed; i = (i + 1) & (vSlot.size() - 1)) {
+            if (vSlot[i].voter == voter)
+                return &vSlot[i];
+        }
+        return NULL;
+    }
+
+    Slot* find(const Voter& voter)
+    {
+        return const_cast<Slot*>(static_cast<const CBillVoteMap*>(this)->find(voter));
+    }
+
+    /** Add the vote of a voter that has none yet */
+    Slot& insert(const Voter& voter, uint8_t nOption, uint64_t nBalance)
+    {
+        if ((nSize + 1) * 4 > vSlot.size() * 3)
+            Rehash(std::max<size_t>(MIN_SLOTS, vSlot.size() * 2));
+
+        size_t i = GetSlot(voter);
+        while (vSlot[i].fUsed)
+            i = (i + 1) & (vSlot.size() - 1);
+
+        Slot& slot = vSlot[i];
+        slot.nBalance = nBalance;
+        slot.voter = voter;
+        slot.nOption = nOption;
+        slot.fUsed = true;
+        ++nSize;
+        return slot;
+    }
+
+    void erase(Slot* p)
+    {
+        // Backward shift deletion, as CBalanceMap::erase
+        size_t mask = vSlot.size() - 1;
+        size_t i = p - vSlot.data();
+        size_t j = i;
+        vSlot[i].fUsed = false;
+        --nSize;
+        while (true) {
+            j = (j + 1) & mask;
+            if (!vSlot[j].fUsed)
+                break;
+
+            size_t k = GetSlot(vSlot[j].voter);
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+                continue;
+
+            vSlot[i] = vSlot[j];
+            vSlot[j].fUsed = false;
+            i = j;
+        }
+    }
+
+    /** Call f with every vote, in no particular order */
+    template<typename F>
+    void ForEach(F&& f)
+    {
+        for (Slot& slot : vSlot) {
+            if (slot.fUsed)
+                f(slot);
+        }
+    }
+
+    template<typename F>
+    void ForEach(F&& f) const
+    {
+        for (const Slot& slot : vSlot) {
+            if (slot.fUsed)
+                f(slot);
+        }
+    }
+
+private:
+    static const size_t MIN_SLOTS = 8;
+
+    size_t GetSlot(const Voter& voter) const
+    {
+        return CSipHasher(k0, k1).Write(voter.begin(), voter.size()).Finalize() & (vSlot.size() - 1);
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<Slot> vOld(nSlots);
+        vOld.swap(vSlot);
+        for (const Slot& slot : vOld) {
+            if (!slot.fUsed)
+                continue;
+
+            size_t i = GetSlot(slot.voter);
+            while (vSlot[i].fUsed)
+                i = (i + 1) & (nSlots - 1);
+            vSlot[i] = slot;
+        }
+    }
+
+    std::vector<Slot> vSlot;
+    size_t nSize;
+    /** Salt */
+    uint64_t k0, k1;
+};
+
+/**
+ * Bills voted on with the balances of the voters, which BalanceSource gives:
+ * a functor of uint64_t(const CKeyID&), called for every vote counted. A
+ * functor type of its own lets the tallies call it directly instead of
+ * through a std::function, which remains the default for closures.
+ *
+ * The votes of a bill are one CBillVoteMap, with the running tallies of its
+ * options in mapKTally while it is open. They are written as the map of a
+ * voter to balance per option they used to be kept in, so that the vote
+ * state on disk stays the same.
+ */
+template<typename K, typename V, typename Voter, typename BalanceSource = std::function<uint64_t(const CKeyID&)>>
 class CVoteDBK2{
 public:
     typedef boost::shared_lock<boost::shared_mutex> read_lock;
     typedef boost::unique_lock<boost::shared_mutex> write_lock;
 
-    CVoteDBK2(uint64_t height, uint64_t votenum, std::function<uint64_t(const CKeyID&)> getAddressBalance)
-        : nVersion(1), nStartHeight(height), nMinVoteNum(votenum)
+    CVoteDBK2(uint64_t height, uint64_t votenum, BalanceSource getAddressBalance = BalanceSource())
+        : nVersion(1), nStartHeight(height), nMinVoteNum(votenum), funcGetAddressBalance(getAddressBalance), nChanges(0)
+    {
+    }
+
+    bool Save(const std::string& filename)
     {
-        this->funcGetAddressBalance = getAddressBalance;
+        read_lock r(lock);
+        return WriteVoteSnapshot(filename, nVersion, mapKV, CVotesByOption(*this), mapInvalid, mapKState);
     }
 
-    void Save(const std::string& filename)
+    bool Load(const std::string& filename)
     {
-        MySerialize(filename, nVersion, mapKV, mapK2Voter, mapInvalid, mapKState);
+        write_lock w(lock);
+        VotesByOption mapK2Voter;
+        bool ret = LoadVoteSnapshot(filename, nVersion, mapKV, mapK2Voter, mapInvalid, mapKState);
+        SetVotes(mapK2Voter);
+        RebuildIndex();
+        ++nChanges;
+        return ret;
     }
 
-    void Load(const std::string& filename)
+    template<typename Stream>
+    void Dump(Stream& s)
     {
-        MyUnserialize(filename, nVersion, mapKV, mapK2Voter, mapInvalid, mapKState);
+        read_lock r(lock);
+        SerializeMany(s, nVersion, mapKV, CVotesByOption(*this), mapInvalid, mapKState);
+    }
+
+    template<typename Stream>
+    void Restore(Stream& s)
+    {
+        write_lock w(lock);
+        VotesByOption mapK2Voter;
+        UnserializeMany(s, nVersion, mapKV, mapK2Voter, mapInvalid, mapKState);
+        SetVotes(mapK2Voter);
+        RebuildIndex();
+        ++nChanges;
+    }
+
+    /** Counts the changes to the serialized state, so a writer can tell whether it has to write it again */
+    uint64_t GetChanges()
+    {
+        read_lock r(lock);
+        return nChanges;
     }
 
     bool Register(const K& k, const V& v, const uint256& hash, uint64_t height, bool fUndo)
@@ -323,8 +699,22 @@ public:
 
             auto it = mapKV.find(k);
             if(it != mapKV.end()) {
+                auto itc = mapCommitteeK.find(it->second.committee);
+                if(itc != mapCommitteeK.end()) {
+                    itc->second.erase(k);
+                    if(itc->second.empty()) {
+                        mapCommitteeK.erase(itc);
+                    }
+                }
+                mapKVotes[k].ForEach([this, &k](const VoteSlot& vote) {
+                    EraseVoterIndex(vote.voter, k);
+                });
+                auto its = mapKState.find(k);
+                if(its != mapKState.end()) {
+                    EraseStateIndex(k, its->second);
+                }
                 mapKV.erase(it);
-                mapK2Voter.erase(k);
+                mapKVotes.erase(k);
                 mapKState.erase(k);
                 ret = true;
             }
@@ -332,25 +722,26 @@ public:
             auto it = mapKV.find(k);
             if(it == mapKV.end()) {
                 mapKV[k] = v;
-
-                auto& item = mapK2Voter[k];
-                for(uint8_t i=0; i < v.options.size(); ++i) {
-                    item.push_back(std::map<Voter, uint64_t>());
-                }
-
+                mapCommitteeK[v.committee].insert(k);
+                mapKVotes[k];
                 mapKState[k] = CState(v.endtime);
+                mapKTally[k] = std::vector<uint64_t>(v.options.size(), 0);
+                setEndtime.insert(std::make_pair(v.endtime, k));
                 ret = true;
             } else {
                 AddInvalid(hash, height);
             }
         }
 
+        nChanges += ret;
         return ret;
     }
 
-    bool FindRegiste(std::function<bool(const K&, const V&)> f)
+    /** Call f(key, value) with every registration, returning whether it returned true for any */
+    template<typename F>
+    bool FindRegiste(F&& f)
     {
-        int ret = false;
+        bool ret = false;
         read_lock r(lock);
         for(auto& it : mapKV) {
             if(f(it.first, it.second)) {
@@ -360,11 +751,26 @@ public:
         return ret;
     }
 
-    bool FindVote(std::function<bool(const K&, std::vector<std::map<Voter, uint64_t>>&)> f)
+    /** Call f with every registration, its state and the tallies of its options, which are empty once it is finished */
+    template<typename F>
+    void ForEachState(F&& f)
+    {
+        static const std::vector<uint64_t> vNoTally;
+        read_lock r(lock);
+        for(auto& it : mapKV) {
+            auto its = mapKState.find(it.first);
+            auto itt = mapKTally.find(it.first);
+            f(it.first, it.second, its != mapKState.end() ? its->second : CState(it.second.endtime), itt != mapKTally.end() ? itt->second : vNoTally);
+        }
+    }
+
+    /** Call f(key, votes) with every registration, the votes a CBillVoteMap, returning whether it returned true for any */
+    template<typename F>
+    bool FindVote(F&& f)
     {
         bool ret = false;
         read_lock r(lock);
-        for(auto& it : mapK2Voter) {
+        for(const auto& it : mapKVotes) {
             if(f(it.first, it.second)) {
                 ret = true;
             }
@@ -375,26 +781,54 @@ public:
 
     bool GetRegiste(V* pv, const K& k)
     {
-        bool ret = false;
         read_lock r(lock);
-        for(auto& it : mapKV) {
-            if(it.first == k) {
-                if(pv) {
-                    *pv = it.second;
+        auto it = mapKV.find(k);
+        if(it == mapKV.end()) {
+            return false;
+        }
+
+        if(pv) {
+            *pv = it->second;
+        }
+        return true;
+    }
+
+    std::set<K> GetCommitteeRegiste(const CKeyID& committee)
+    {
+        read_lock r(lock);
+        auto it = mapCommitteeK.find(committee);
+        if(it != mapCommitteeK.end()) {
+            return it->second;
+        } else {
+            return std::set<K>();
+        }
+    }
+
+    /** The bills voter voted on, with the option voted for */
+    std::map<K, uint8_t> GetVoterVote(const Voter& voter)
+    {
+        std::map<K, uint8_t> ret;
+        read_lock r(lock);
+        auto it = mapVoterK.find(voter);
+        if(it != mapVoterK.end()) {
+            for(const K& k : it->second) {
+                auto itv = mapKVotes.find(k);
+                const VoteSlot* pvote = itv != mapKVotes.end() ? itv->second.find(voter) : NULL;
+                if(pvote) {
+                    ret[k] = pvote->nOption;
                 }
-                ret = true;
-                break;
             }
         }
         return ret;
     }
 
+    /** The votes on k, a map of the voters to their balance per option */
     std::vector<std::map<Voter, uint64_t>> GetVote(const K& k)
     {
         read_lock r(lock);
-        auto it = mapK2Voter.find(k);
-        if(it != mapK2Voter.end()) {
-            return it->second;
+        auto it = mapKVotes.find(k);
+        if(it != mapKVotes.end()) {
+            return GetVotesByOption(it);
         } else {
             return std::vector<std::map<Voter, uint64_t>>();
         }
@@ -433,31 +867,28 @@ public:
                 return false;
             }
 
-            auto it = mapK2Voter.find(k);
-            if(it != mapK2Voter.end()
-                && k2 < it->second.size()
-                && it->second[k2].find(vote) != it->second[k2].end()) {
-                it->second[k2].erase(vote);
+            auto it = mapKVotes.find(k);
+            VoteSlot* pvote = it != mapKVotes.end() ? it->second.find(vote) : NULL;
+            if(pvote && pvote->nOption == k2) {
+                auto itt = mapKTally.find(k);
+                if(itt != mapKTally.end()) {
+                    itt->second[k2] -= pvote->nBalance;
+                }
+                it->second.erase(pvote);
+                EraseVoterIndex(vote, k);
                 ret = true;
             }
         } else {
-            auto it = mapK2Voter.find(k);
-            if(it != mapK2Voter.end()) {
-                ret = true;
-                for(auto& i : it->second) {
-                    if(i.find(vote) != i.end()) {
-                        ret = false;
-                        break;
-                    }
-                }
+            auto it = mapKVotes.find(k);
+            if(it != mapKVotes.end() && k2 < GetOptionCount(k)) {
+                ret = it->second.find(vote) == NULL;
             }
 
             if(ret) {
-                if(k2 < it->second.size()) {
-                    it->second[k2][vote] = 0;
-                } else {
-                    ret = false;
-                }
+                uint64_t balance = funcGetAddressBalance(vote);
+                it->second.insert(vote, k2, balance);
+                mapKTally[k][k2] += balance;
+                mapVoterK[vote].insert(k);
             }
 
            if (ret == false){
@@ -465,17 +896,40 @@ public:
             }
         }
 
+        nChanges += ret;
         return ret;
     }
 
     void NewIrreversibleBlock(uint64_t height)
     {
         write_lock w(lock);
-        for(auto it = mapInvalid.begin(); it != mapInvalid.end(); ) {
-            if(it->second < height) {
-                it = mapInvalid.erase(it);
-            } else {
-                ++it;
+        if(mapInvalid.Prune(height) > 0) {
+            ++nChanges;
+        }
+        // Only an undo of its height reopens a bill, which cannot happen below an irreversible block
+        mapFinishedHeight.erase(mapFinishedHeight.begin(), mapFinishedHeight.lower_bound(height));
+    }
+
+    /** Move the votes of a voter on open bills along with a change of its balance */
+    void UpdateVoterBalance(const Voter& voter, int64_t value)
+    {
+        write_lock w(lock);
+        auto it = mapVoterK.find(voter);
+        if(it == mapVoterK.end()) {
+            return;
+        }
+
+        for(const K& k : it->second) {
+            auto itt = mapKTally.find(k);
+            if(itt == mapKTally.end()) {
+                continue;
+            }
+
+            VoteSlot* pvote = mapKVotes[k].find(voter);
+            if(pvote) {
+                pvote->nBalance += value;
+                itt->second[pvote->nOption] += value;
+                ++nChanges;
             }
         }
     }
@@ -486,14 +940,9 @@ public:
         uint64_t nVoteOld = 0;
         uint8_t index = 0;
 
-        auto& votes = mapK2Voter[key];
-        for(uint32_t i=0; i < votes.size(); ++i) {
-            uint64_t nVote = 0;
-            for(auto& j : votes[i])     {
-                j.second = funcGetAddressBalance(j.first);
-                nVote += j.second;
-            }
-
+        auto& tally = mapKTally[key];
+        for(uint32_t i=0; i < tally.size(); ++i) {
+            uint64_t nVote = tally[i];
             nTotalVote += nVote;
             if(nVote > nVoteOld) {
                 index = (uint8_t)i;
@@ -507,11 +956,11 @@ public:
         state.nOptionIndex = index;
 
         if(nTotalVote > nMinVoteNum) {
-            if(votes.size() == 2) {
+            if(tally.size() == 2) {
                 if(nVoteOld * 100 > nTotalVote * 60) {
                     state.bPassed = true;
                 }
-            } else if(votes.size() == 3) {
+            } else if(tally.size() == 3) {
                 if(nVoteOld * 100 > nTotalVote * 40) {
                     state.bPassed = true;
                 }
@@ -521,27 +970,38 @@ public:
                 }
             }
         }
+
+        mapKTally.erase(key);
+        mapFinishedHeight[state.nFinishedHeight].insert(key);
     }
 
     void NewBlockHeight(uint64_t height, uint64_t time, bool fUndo)
     {
         write_lock w(lock);
         if(fUndo) {
-            for(auto& i : mapKState) {
-                auto& state = i.second;
+            auto it = mapFinishedHeight.find(height);
+            if(it == mapFinishedHeight.end()) {
+                return;
+            }
 
-                if(state.bFinished && state.nFinishedHeight == height) {
-                    state = CState(state.nEndtime);
-                }
+            for(auto& k : it->second) {
+                auto& state = mapKState[k];
+                state = CState(state.nEndtime);
+                OpenBill(k, state);
             }
+            mapFinishedHeight.erase(it);
+            ++nChanges;
         } else {
-            for(auto& i : mapKState) {
-                auto& state = i.second;
-                if(state.bFinished == false && time > state.nEndtime) {
-                    state.bFinished = true;
-                    state.nFinishedHeight = height;
-                    FinishVote(i.first);
-                }
+            // setEndtime only holds open bills, ordered by the time they expire
+            while(setEndtime.empty() == false && time > setEndtime.begin()->first) {
+                K k = setEndtime.begin()->second;
+                setEndtime.erase(setEndtime.begin());
+
+                auto& state = mapKState[k];
+                state.bFinished = true;
+                state.nFinishedHeight = height;
+                FinishVote(k);
+                ++nChanges;
             }
         }
     }
@@ -549,31 +1009,177 @@ public:
 private:
     bool IsInvalid(const uint256& hash)
     {
-        return mapInvalid.find(hash) != mapInvalid.end();
+        return mapInvalid.Find(hash);
     }
 
     void AddInvalid(const uint256& hash, uint64_t height)
     {
-        mapInvalid[hash] = height;
+        mapInvalid.Add(hash, height);
+        ++nChanges;
     }
 
     void DelInvalid(const uint256& hash)
     {
-        mapInvalid.erase(hash);
+        mapInvalid.Erase(hash);
+        ++nChanges;
+    }
+
+    typedef typename CBillVoteMap<Voter>::Slot VoteSlot;
+    typedef std::map<K, std::vector<std::map<Voter, uint64_t>>> VotesByOption;
+
+    /** Serializes the votes as the VotesByOption they were kept in, without making one */
+    class CVotesByOption
+    {
+    public:
+        explicit CVotesByOption(const CVoteDBK2& dbIn) : db(dbIn) {}
+
+        template<typename Stream>
+        void Serialize(Stream& s) const
+        {
+            std::vector<std::vector<std::pair<Voter, uint64_t>>> vOptions;
+            WriteCompactSize(s, db.mapKVotes.size());
+            for(const auto& it : db.mapKVotes) {
+                ::Serialize(s, it.first);
+                vOptions.assign(db.GetOptionCount(it.first), std::vector<std::pair<Voter, uint64_t>>());
+                it.second.ForEach([&vOptions](const VoteSlot& vote) {
+                    if(vote.nOption < vOptions.size()) {
+                        vOptions[vote.nOption].push_back(std::make_pair(vote.voter, vote.nBalance));
+                    }
+                });
+                WriteCompactSize(s, vOptions.size());
+                for(auto& option : vOptions) {
+                    std::sort(option.begin(), option.end());
+                    WriteCompactSize(s, option.size());
+                    for(const auto& vote : option) {
+                        ::Serialize(s, vote);
+                    }
+                }
+            }
+        }
+
+    private:
+        const CVoteDBK2& db;
+    };
+
+    /** The number of options of k, which its votes are per */
+    size_t GetOptionCount(const K& k) const
+    {
+        auto it = mapKV.find(k);
+        return it != mapKV.end() ? it->second.options.size() : 0;
+    }
+
+    std::vector<std::map<Voter, uint64_t>> GetVotesByOption(typename std::map<K, CBillVoteMap<Voter>>::const_iterator it) const
+    {
+        std::vector<std::map<Voter, uint64_t>> ret(GetOptionCount(it->first));
+        it->second.ForEach([&ret](const VoteSlot& vote) {
+            if(vote.nOption < ret.size()) {
+                ret[vote.nOption][vote.voter] = vote.nBalance;
+            }
+        });
+        return ret;
+    }
+
+    void SetVotes(const VotesByOption& mapK2Voter)
+    {
+        mapKVotes.clear();
+        for(const auto& it : mapK2Voter) {
+            auto& votes = mapKVotes[it.first];
+            for(size_t i = 0; i < it.second.size(); ++i) {
+                for(const auto& j : it.second[i]) {
+                    votes.insert(j.first, (uint8_t)i, j.second);
+                }
+            }
+        }
+    }
+
+    void EraseVoterIndex(const Voter& voter, const K& k)
+    {
+        auto it = mapVoterK.find(voter);
+        if(it != mapVoterK.end()) {
+            it->second.erase(k);
+            if(it->second.empty()) {
+                mapVoterK.erase(it);
+            }
+        }
+    }
+
+    void EraseStateIndex(const K& k, const CState& state)
+    {
+        if(state.bFinished) {
+            auto it = mapFinishedHeight.find(state.nFinishedHeight);
+            if(it != mapFinishedHeight.end()) {
+                it->second.erase(k);
+                if(it->second.empty()) {
+                    mapFinishedHeight.erase(it);
+                }
+            }
+        } else {
+            setEndtime.erase(std::make_pair(state.nEndtime, k));
+            mapKTally.erase(k);
+        }
+    }
+
+    // Recount an open bill from the current balances of its voters
+    void OpenBill(const K& k, const CState& state)
+    {
+        auto& tally = mapKTally[k];
+        tally.assign(GetOptionCount(k), 0);
+        mapKVotes[k].ForEach([this, &tally](VoteSlot& vote) {
+            vote.nBalance = funcGetAddressBalance(vote.voter);
+            if(vote.nOption < tally.size()) {
+                tally[vote.nOption] += vote.nBalance;
+            }
+        });
+        setEndtime.insert(std::make_pair(state.nEndtime, k));
+    }
+
+    // The indexes and tallies are derived from mapKV/mapKVotes/mapKState and never serialized.
+    void RebuildIndex()
+    {
+        mapCommitteeK.clear();
+        mapVoterK.clear();
+        mapKTally.clear();
+        setEndtime.clear();
+        mapFinishedHeight.clear();
+        for(auto& it : mapKV) {
+            mapCommitteeK[it.second.committee].insert(it.first);
+        }
+        for(const auto& it : mapKVotes) {
+            const K& k = it.first;
+            it.second.ForEach([this, &k](const VoteSlot& vote) {
+                mapVoterK[vote.voter].insert(k);
+            });
+        }
+        for(auto& it : mapKState) {
+            if(it.second.bFinished) {
+                mapFinishedHeight[it.second.nFinishedHeight].insert(it.first);
+            } else {
+                OpenBill(it.first, it.second);
+            }
+        }
     }
 
 private:
     uint64_t nVersion;
     uint64_t nStartHeight;
     uint64_t nMinVoteNum;
-    std::function<uint64_t(const CKeyID&)> funcGetAddressBalance;
+    BalanceSource funcGetAddressBalance;
 
     boost::shared_mutex lock;
     std::map<K, V> mapKV;
-    std::map<K, std::vector<std::map<Voter, uint64_t>>> mapK2Voter;
+    std::map<K, CBillVoteMap<Voter>> mapKVotes;
     std::map<K, CState> mapKState;
 
-    std::map<uint256, uint64_t>  mapInvalid;
+    CInvalidVoteIndex mapInvalid;
+    uint64_t nChanges;
+
+    std::map<CKeyID, std::set<K>> mapCommitteeK;
+    //! The bills of each voter, whose CBillVoteMap has its option
+    std::map<Voter, CFlatSet<K>> mapVoterK;
+
+    std::map<K, std::vector<uint64_t>> mapKTally;
+    std::set<std::pair<uint64_t, K>> setEndtime;
+    std::map<uint64_t, std::set<K>> mapFinishedHeight;
 };
 
 #endif
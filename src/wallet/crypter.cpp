@@ -10,9 +10,12 @@
 #include "script/standard.h"
 #include "util.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
 
 int CCrypter::BytesToKeySHA512AES(const std::vector<unsigned char>& chSalt, const SecureString& strKeyData, int count, unsigned char *key,unsigned char *iv) const
 {
@@ -168,6 +171,19 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+/** Keys of a wallet below which Unlock checks them on the calling thread, and the least each thread takes on */
+static const size_t UNLOCK_KEYS_PER_THREAD = 1000;
+
+static void DecryptKeys(const CKeyingMaterial& vMasterKey, const std::vector<const CryptedKeyMap::mapped_type*>& vKeys,
+                        size_t nBegin, size_t nEnd, std::atomic<bool>& fFail)
+{
+    for (size_t i = nBegin; i < nEnd && !fFail; i++) {
+        CKey key;
+        if (!DecryptKey(vMasterKey, vKeys[i]->second, vKeys[i]->first, key))
+            fFail = true;
+    }
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -175,22 +191,34 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
+        // A wrong master key already fails on the first key
         bool keyPass = false;
         bool keyFail = false;
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
+        if (mi != mapCryptedKeys.end()) {
             CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
+            if (DecryptKey(vMasterKeyIn, mi->second.second, mi->second.first, key))
+                keyPass = true;
+            else
                 keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+        }
+
+        // The first unlock checks the others too, split into contiguous ranges over several threads
+        if (keyPass && !fDecryptionThoroughlyChecked) {
+            std::vector<const CryptedKeyMap::mapped_type*> vKeys;
+            vKeys.reserve(mapCryptedKeys.size() - 1);
+            for (++mi; mi != mapCryptedKeys.end(); ++mi)
+                vKeys.push_back(&mi->second);
+
+            std::atomic<bool> fFail(false);
+            size_t nThreads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), vKeys.size() / UNLOCK_KEYS_PER_THREAD));
+            size_t nPerThread = (vKeys.size() + nThreads - 1) / nThreads;
+            boost::thread_group threadGroup;
+            for (size_t i = 1; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&DecryptKeys, boost::cref(vMasterKeyIn), boost::cref(vKeys), i * nPerThread, std::min(vKeys.size(), (i + 1) * nPerThread), boost::ref(fFail)));
+            DecryptKeys(vMasterKeyIn, vKeys, 0, std::min(vKeys.size(), nPerThread), fFail);
+            threadGroup.join_all();
+            keyFail = fFail;
         }
         if (keyPass && keyFail)
         {
@@ -134,6 +134,19 @@ protected:
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
+    //! whether Unlock has checked every key, which later unlocks then skip
+    bool IsDecryptionThoroughlyChecked() const
+    {
+        LOCK(cs_KeyStore);
+        return fDecryptionThoroughlyChecked;
+    }
+    //! mark the keys as checked in an earlier session
+    void SetDecryptionThoroughlyChecked()
+    {
+        LOCK(cs_KeyStore);
+        fDecryptionThoroughlyChecked = true;
+    }
+
 public:
     CCryptoKeyStore() : fUseCrypto(false), fDecryptionThoroughlyChecked(false)
     {
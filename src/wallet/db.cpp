@@ -49,6 +49,9 @@ void CDBEnv::Reset()
     dbenv = new DbEnv(DB_CXX_NO_EXCEPTIONS);
     fDbEnvInit = false;
     fMockDb = false;
+    nWriteBehindMs = 0;
+    nLastCheckpoint = 0;
+    fCheckpointPending = false;
 }
 
 CDBEnv::CDBEnv() : dbenv(NULL)
@@ -110,9 +113,82 @@ bool CDBEnv::Open(const boost::filesystem::path& pathIn)
 
     fDbEnvInit = true;
     fMockDb = false;
+    nWriteBehindMs = std::max<int64_t>(0, GetArg("-walletwritebehind", DEFAULT_WALLET_WRITE_BEHIND));
+    nLastCheckpoint = GetTimeMillis();
     return true;
 }
 
+bool CDBEnv::BeginBatch(const std::string& strFile)
+{
+    if (strFile.empty())
+        return false;
+    LOCK(cs_db);
+    if (!Open(GetDataDir()))
+        return false;
+    std::map<std::string, CBatch>::iterator it = mapBatch.find(strFile);
+    if (it != mapBatch.end()) {
+        if (it->second.owner != std::this_thread::get_id())
+            return false;
+        it->second.nDepth++;
+        return true;
+    }
+    DbTxn* ptxn = TxnBegin();
+    if (!ptxn)
+        return false;
+    CBatch& batch = mapBatch[strFile];
+    batch.ptxn = ptxn;
+    batch.owner = std::this_thread::get_id();
+    batch.nDepth = 1;
+    // The file counts as in use until the batch commits, so it is not flushed and closed under it
+    ++mapFileUseCount[strFile];
+    return true;
+}
+
+bool CDBEnv::EndBatch(const std::string& strFile)
+{
+    LOCK(cs_db);
+    std::map<std::string, CBatch>::iterator it = mapBatch.find(strFile);
+    if (it == mapBatch.end() || it->second.owner != std::this_thread::get_id())
+        return false;
+    if (--it->second.nDepth > 0)
+        return true;
+    int ret = it->second.ptxn->commit(0);
+    mapBatch.erase(it);
+    --mapFileUseCount[strFile];
+    if (ret != 0)
+        return error("CDBEnv::EndBatch: Error %d committing to %s: %s", ret, strFile, DbEnv::strerror(ret));
+    if (nWriteBehindMs > 0) {
+        CheckpointIfDue(true);
+    } else {
+        dbenv->txn_checkpoint(0, 0, 0);
+        nLastCheckpoint = GetTimeMillis();
+    }
+    return true;
+}
+
+DbTxn* CDBEnv::GetBatchTxn(const std::string& strFile)
+{
+    AssertLockHeld(cs_db);
+    std::map<std::string, CBatch>::iterator it = mapBatch.find(strFile);
+    if (it == mapBatch.end() || it->second.owner != std::this_thread::get_id())
+        return NULL;
+    return it->second.ptxn;
+}
+
+void CDBEnv::CheckpointIfDue(bool fCommitted)
+{
+    LOCK(cs_db);
+    if (!fDbEnvInit)
+        return;
+    if (fCommitted)
+        fCheckpointPending = true;
+    if (!fCheckpointPending || GetTimeMillis() - nLastCheckpoint < nWriteBehindMs)
+        return;
+    dbenv->txn_checkpoint(0, 0, 0);
+    nLastCheckpoint = GetTimeMillis();
+    fCheckpointPending = false;
+}
+
 void CDBEnv::MakeMock()
 {
     if (fDbEnvInit)
@@ -237,7 +313,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), batchTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -293,6 +369,8 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
             bitdb.mapDb[strFile] = pdb;
         }
+
+        activeTxn = batchTxn = bitdb.GetBatchTxn(strFile);
     }
 }
 
@@ -303,8 +381,13 @@ void CDB::Flush()
 
     // Flush database activity from memory pool to disk log
     unsigned int nMinutes = 0;
-    if (fReadOnly)
+    if (fReadOnly) {
         nMinutes = 1;
+    } else if (bitdb.nWriteBehindMs > 0) {
+        // Up to -walletwritebehind late, by a later close or the flush thread
+        bitdb.CheckpointIfDue(true);
+        return;
+    }
 
     bitdb.dbenv->txn_checkpoint(nMinutes ? GetArg("-dblogsize", DEFAULT_WALLET_DBLOGSIZE) * 1024 : 0, nMinutes, 0);
 }
@@ -313,12 +396,14 @@ void CDB::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    // A batch is committed and flushed by its owner, a transaction of this CDB nested in it is not
+    if (activeTxn != batchTxn)
         activeTxn->abort();
-    activeTxn = NULL;
+    bool fBatch = batchTxn != NULL;
+    activeTxn = batchTxn = NULL;
     pdb = NULL;
 
-    if (fFlushOnClose)
+    if (fFlushOnClose && !fBatch)
         Flush();
 
     {
@@ -14,6 +14,7 @@
 
 #include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
@@ -22,6 +23,8 @@
 
 static const unsigned int DEFAULT_WALLET_DBLOGSIZE = 100;
 static const bool DEFAULT_WALLET_PRIVDB = true;
+//! -walletwritebehind default, in milliseconds
+static const int64_t DEFAULT_WALLET_WRITE_BEHIND = 0;
 
 class CDBEnv
 {
@@ -32,6 +35,18 @@ private:
     // shutdown problems/crashes caused by a static initialized internal pointer.
     std::string strPath;
 
+    //! A transaction of one thread that the writes to a file go into, see BeginBatch
+    struct CBatch {
+        DbTxn* ptxn;
+        std::thread::id owner;
+        int nDepth;
+    };
+    std::map<std::string, CBatch> mapBatch;
+
+    //! Time of the last checkpoint, and whether commits came after it
+    int64_t nLastCheckpoint;
+    bool fCheckpointPending;
+
     void EnvShutdown();
 
 public:
@@ -39,6 +54,8 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! -walletwritebehind: how long a checkpoint may wait after a commit, 0 to take one on every close
+    int64_t nWriteBehindMs;
 
     CDBEnv();
     ~CDBEnv();
@@ -75,14 +92,30 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC, DbTxn* pparent = NULL)
     {
         DbTxn* ptxn = NULL;
-        int ret = dbenv->txn_begin(NULL, &ptxn, flags);
+        int ret = dbenv->txn_begin(pparent, &ptxn, flags);
         if (!ptxn || ret != 0)
             return NULL;
         return ptxn;
     }
+
+    /**
+     * Make the writes of the calling thread to strFile, through any CDB opened
+     * until the matching EndBatch, go into one transaction, and take a single
+     * checkpoint when it commits instead of one on every close. Batches of a
+     * thread nest; a thread that comes upon the batch of another one writes
+     * on its own. Returns false when no batch was started, and EndBatch must
+     * not be called then.
+     */
+    bool BeginBatch(const std::string& strFile);
+    bool EndBatch(const std::string& strFile);
+    //! The batch transaction of the calling thread on strFile, or NULL. Requires cs_db.
+    DbTxn* GetBatchTxn(const std::string& strFile);
+
+    /** Take the checkpoint of commits that waited -walletwritebehind, fCommitted telling one just came */
+    void CheckpointIfDue(bool fCommitted);
 };
 
 extern CDBEnv bitdb;
@@ -95,6 +128,8 @@ protected:
     Db* pdb;
     std::string strFile;
     DbTxn* activeTxn;
+    //! The batch of this thread on the file, which activeTxn falls back to
+    DbTxn* batchTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -221,7 +256,8 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        // Inside a batch, a cursor outside it would wait on the locks of its writes
+        int ret = pdb->cursor(batchTxn ? activeTxn : NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -263,11 +299,12 @@ protected:
     }
 
 public:
+    /** Begin a transaction, nested in the batch of this thread if there is one */
     bool TxnBegin()
     {
-        if (!pdb || activeTxn)
+        if (!pdb || activeTxn != batchTxn)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
+        DbTxn* ptxn = bitdb.TxnBegin(DB_TXN_WRITE_NOSYNC, batchTxn);
         if (!ptxn)
             return false;
         activeTxn = ptxn;
@@ -276,19 +313,19 @@ public:
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->commit(0);
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->abort();
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
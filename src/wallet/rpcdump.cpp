@@ -32,6 +32,17 @@ using namespace std;
 void EnsureWalletIsUnlocked();
 bool EnsureWalletIsAvailable(bool avoidException);
 
+/**
+ * Drops what an import call queued for a rescan and did not scan for, because
+ * it was not asked to or failed, so that a later call never scans for it.
+ * Construct with cs_wallet held.
+ */
+class CRescanQueueGuard
+{
+public:
+    ~CRescanQueueGuard() { pwalletMain->mapRescanQueue.clear(); }
+};
+
 std::string static EncodeDumpTime(int64_t nTime) {
     return DateTimeStrFormat("%Y-%m-%dT%H:%M:%SZ", nTime);
 }
@@ -87,7 +98,8 @@ UniValue importprivkey(const JSONRPCRequest& request)
             "\nArguments:\n"
             "1. \"bitcoinprivkey\"   (string, required) The private key (see dumpprivkey)\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
-            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions, of this import and of those\n"
+            "                        made without a rescan before it, at once\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nDump a private key\n"
@@ -104,6 +116,7 @@ UniValue importprivkey(const JSONRPCRequest& request)
 
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
+    CRescanQueueGuard rescanQueueGuard;
 
     EnsureWalletIsUnlocked();
 
@@ -146,9 +159,12 @@ UniValue importprivkey(const JSONRPCRequest& request)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->UpdateTimeFirstKey(1);
+        pwalletMain->QueueRescan(GetScriptForDestination(vchAddress), 1);
+        pwalletMain->QueueRescan(GetScriptForRawPubKey(pubkey), 1);
 
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+            CBlockIndex* pindexStart;
+            pwalletMain->RescanQueued(pindexStart);
         }
     }
 
@@ -165,6 +181,7 @@ void ImportScript(const CScript& script, const string& strLabel, bool isRedeemSc
 
     if (!pwalletMain->HaveWatchOnly(script) && !pwalletMain->AddWatchOnly(script, 0 /* nCreateTime */))
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+    pwalletMain->QueueRescan(script, 1);
 
     if (isRedeemScript) {
         if (!pwalletMain->HaveCScript(script) && !pwalletMain->AddCScript(script))
@@ -199,7 +216,8 @@ UniValue importaddress(const JSONRPCRequest& request)
             "\nArguments:\n"
             "1. \"script\"           (string, required) The hex-encoded script (or address)\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
-            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions, of this import and of those\n"
+            "                        made without a rescan before it, at once\n"
             "4. p2sh                 (boolean, optional, default=false) Add the P2SH version of the script as well\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "If you have the full public key, you should call importpubkey instead of this.\n"
@@ -233,6 +251,7 @@ UniValue importaddress(const JSONRPCRequest& request)
         fP2SH = request.params[3].get_bool();
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
+    CRescanQueueGuard rescanQueueGuard;
 
     CBitcoinAddress address(request.params[0].get_str());
     if (address.IsValid()) {
@@ -248,8 +267,8 @@ UniValue importaddress(const JSONRPCRequest& request)
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        pwalletMain->ReacceptWalletTransactions();
+        CBlockIndex* pindexStart;
+        pwalletMain->RescanQueued(pindexStart);
     }
 
     return NullUniValue;
@@ -362,7 +381,8 @@ UniValue importpubkey(const JSONRPCRequest& request)
             "\nArguments:\n"
             "1. \"pubkey\"           (string, required) The hex-encoded public key\n"
             "2. \"label\"            (string, optional, default=\"\") An optional label\n"
-            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions\n"
+            "3. rescan               (boolean, optional, default=true) Rescan the wallet for transactions, of this import and of those\n"
+            "                        made without a rescan before it, at once\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
             "\nExamples:\n"
             "\nImport a public key with rescan\n"
@@ -394,14 +414,15 @@ UniValue importpubkey(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey is not a valid public key");
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
+    CRescanQueueGuard rescanQueueGuard;
 
     ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
     ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
 
     if (fRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        pwalletMain->ReacceptWalletTransactions();
+        CBlockIndex* pindexStart;
+        pwalletMain->RescanQueued(pindexStart);
     }
 
     return NullUniValue;
@@ -727,6 +748,7 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
             if (!pwalletMain->HaveWatchOnly(redeemScript) && !pwalletMain->AddWatchOnly(redeemScript, timestamp)) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
             }
+            pwalletMain->QueueRescan(redeemScript, timestamp);
 
             if (!pwalletMain->HaveCScript(redeemScript) && !pwalletMain->AddCScript(redeemScript)) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding p2sh redeemScript to wallet");
@@ -744,6 +766,7 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
             if (!pwalletMain->HaveWatchOnly(redeemDestination) && !pwalletMain->AddWatchOnly(redeemDestination, timestamp)) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
             }
+            pwalletMain->QueueRescan(redeemDestination, timestamp);
 
             // add to address book or update label
             if (address.IsValid()) {
@@ -786,6 +809,8 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
                     }
 
                     pwalletMain->UpdateTimeFirstKey(timestamp);
+                    pwalletMain->QueueRescan(GetScriptForDestination(vchAddress), timestamp);
+                    pwalletMain->QueueRescan(GetScriptForRawPubKey(pubkey), timestamp);
                 }
             }
 
@@ -837,6 +862,7 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
                 if (!pwalletMain->HaveWatchOnly(pubKeyScript) && !pwalletMain->AddWatchOnly(pubKeyScript, timestamp)) {
                     throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
                 }
+                pwalletMain->QueueRescan(pubKeyScript, timestamp);
 
                 // add to address book or update label
                 if (pubKeyAddress.IsValid()) {
@@ -855,6 +881,7 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
                 if (!pwalletMain->HaveWatchOnly(scriptRawPubKey) && !pwalletMain->AddWatchOnly(scriptRawPubKey, timestamp)) {
                     throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
                 }
+                pwalletMain->QueueRescan(scriptRawPubKey, timestamp);
 
                 success = true;
             }
@@ -914,6 +941,8 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
                 }
 
                 pwalletMain->UpdateTimeFirstKey(timestamp);
+                pwalletMain->QueueRescan(GetScriptForDestination(vchAddress), timestamp);
+                pwalletMain->QueueRescan(GetScriptForRawPubKey(pubKey), timestamp);
 
                 success = true;
             }
@@ -929,6 +958,7 @@ UniValue ProcessImport(const UniValue& data, const int64_t timestamp)
                 if (!pwalletMain->HaveWatchOnly(script) && !pwalletMain->AddWatchOnly(script, timestamp)) {
                     throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
                 }
+                pwalletMain->QueueRescan(script, timestamp);
 
                 if (scriptPubKey.getType() == UniValue::VOBJ) {
                     // add to address book or update label
@@ -1031,6 +1061,7 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
     }
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
+    CRescanQueueGuard rescanQueueGuard;
     EnsureWalletIsUnlocked();
 
     // Verify all timestamps are present before importing any keys.
@@ -1041,11 +1072,8 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
 
     bool fRunScan = false;
     const int64_t minimumTimestamp = 1;
-    int64_t nLowestTimestamp = 0;
 
-    if (fRescan && chainActive.Tip()) {
-        nLowestTimestamp = chainActive.Tip()->GetBlockTime();
-    } else {
+    if (!chainActive.Tip()) {
         fRescan = false;
     }
 
@@ -1064,22 +1092,15 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
         if (result["success"].get_bool()) {
             fRunScan = true;
         }
-
-        // Get the lowest timestamp.
-        if (timestamp < nLowestTimestamp) {
-            nLowestTimestamp = timestamp;
-        }
     }
 
     if (fRescan && fRunScan && requests.size()) {
-        CBlockIndex* pindex = nLowestTimestamp > minimumTimestamp ? chainActive.FindEarliestAtLeast(std::max<int64_t>(nLowestTimestamp - 7200, 0)) : chainActive.Genesis();
-        CBlockIndex* scannedRange = nullptr;
-        if (pindex) {
-            scannedRange = pwalletMain->ScanForWalletTransactions(pindex, true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+        // One scan for the scripts of this call, from the lowest of their timestamps
+        CBlockIndex* pindex;
+        CBlockIndex* scannedRange = pwalletMain->RescanQueued(pindex);
+        const int64_t nScannedTime = scannedRange ? scannedRange->GetBlockTimeMax() : chainActive.Tip()->GetBlockTimeMax();
 
-        if (!scannedRange || scannedRange->nHeight > pindex->nHeight) {
+        if (pindex && (!scannedRange || scannedRange->nHeight > pindex->nHeight)) {
             std::vector<UniValue> results = response.getValues();
             response.clear();
             response.setArray();
@@ -1089,12 +1110,12 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
                 // range, or if the import result already has an error set, let
                 // the result stand unmodified. Otherwise replace the result
                 // with an error message.
-                if (GetImportTimestamp(request, now) - 7200 >= scannedRange->GetBlockTimeMax() || results.at(i).exists("error")) {
+                if (GetImportTimestamp(request, now) - 7200 >= nScannedTime || results.at(i).exists("error")) {
                     response.push_back(results.at(i));
                 } else {
                     UniValue result = UniValue(UniValue::VOBJ);
                     result.pushKV("success", UniValue(false));
-                    result.pushKV("error", JSONRPCError(RPC_MISC_ERROR, strprintf("Failed to rescan before time %d, transactions may be missing.", scannedRange->GetBlockTimeMax())));
+                    result.pushKV("error", JSONRPCError(RPC_MISC_ERROR, strprintf("Failed to rescan before time %d, transactions may be missing.", nScannedTime)));
                     response.push_back(std::move(result));
                 }
                 ++i;
@@ -1778,12 +1778,19 @@ UniValue listsinceblock(const JSONRPCRequest& request)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    if (!pindex)
     {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+            ListTransactions((*it).second, "*", 0, true, transactions, filter);
+    }
+    else
+    {
+        // Only the transactions above the block, and those off the active chain
+        for (const CWalletTx* pwtx : pwalletMain->GetTxsAfterHeight(pindex->nHeight))
+        {
+            if (pwtx->GetDepthInMainChain() < depth)
+                ListTransactions(*pwtx, "*", 0, true, transactions, filter);
+        }
     }
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -1960,8 +1967,6 @@ UniValue keypoolrefill(const JSONRPCRequest& request)
             + HelpExampleRpc("keypoolrefill", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     // 0 is interpreted by TopUpKeyPool() as the default keypool size given by -keypool
     unsigned int kpSize = 0;
     if (request.params.size() > 0) {
@@ -1970,9 +1975,14 @@ UniValue keypoolrefill(const JSONRPCRequest& request)
         kpSize = (unsigned int)request.params[0].get_int();
     }
 
-    EnsureWalletIsUnlocked();
+    {
+        LOCK(pwalletMain->cs_wallet);
+        EnsureWalletIsUnlocked();
+    }
+    // Not under cs_wallet, so the wallet stays usable while the keys are made
     pwalletMain->TopUpKeyPool(kpSize);
 
+    LOCK(pwalletMain->cs_wallet);
     if (pwalletMain->GetKeyPoolSize() < kpSize)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
 
@@ -2385,9 +2395,10 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
 
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("walletversion", pwalletMain->GetVersion()));
-    obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
-    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(pwalletMain->GetUnconfirmedBalance())));
-    obj.push_back(Pair("immature_balance",    ValueFromAmount(pwalletMain->GetImmatureBalance())));
+    CWalletBalances balances = pwalletMain->GetBalances();
+    obj.push_back(Pair("balance",       ValueFromAmount(balances.nBalance)));
+    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(balances.nUnconfirmed)));
+    obj.push_back(Pair("immature_balance",    ValueFromAmount(balances.nImmature)));
     obj.push_back(Pair("txcount",       (int)pwalletMain->mapWallet.size()));
     obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
     obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
@@ -2939,7 +2950,7 @@ UniValue bumpfee(const JSONRPCRequest& request)
     // This may occur if the user set TotalFee or paytxfee too low, if fallbackfee is too low, or, perhaps,
     // in a rare situation where the mempool minimum fee increased significantly since the fee estimation just a
     // moment earlier. In this case, we report an error to the user, who may use totalFee to make an adjustment.
-    CFeeRate minMempoolFeeRate = mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+    CFeeRate minMempoolFeeRate = mempool.GetMinFee(GetMempoolSizeLimit());
     if (nNewFeeRate.GetFeePerK() < minMempoolFeeRate.GetFeePerK()) {
         throw JSONRPCError(RPC_MISC_ERROR, strprintf("New fee rate (%s) is less than the minimum fee rate (%s) to get into the mempool. totalFee value should to be at least %s or settxfee value should be at least %s to add transaction.", FormatMoney(nNewFeeRate.GetFeePerK()), FormatMoney(minMempoolFeeRate.GetFeePerK()), FormatMoney(minMempoolFeeRate.GetFee(maxNewTxSize)), FormatMoney(minMempoolFeeRate.GetFeePerK())));
     }
@@ -3035,9 +3046,8 @@ extern UniValue importprunedfunds(const JSONRPCRequest& request);
 extern UniValue removeprunedfunds(const JSONRPCRequest& request);
 extern UniValue importmulti(const JSONRPCRequest& request);
 
-static void SendWithOpreturn(const CBitcoinAddress &address, CWalletTx& wtxNew, uint64_t fee, const vector<unsigned char>& opreturn)
+static void SendWithOpreturn(const CBitcoinAddress &address, CWalletTx& wtxNew, uint64_t fee, const vector<unsigned char>& opreturn, CAmount curBalance)
 {
-    CAmount curBalance = pwalletMain->GetAddressBalance(address.Get());
     std::string strError;
 
     CCoinControl coinControl;
@@ -3073,6 +3083,11 @@ static void SendWithOpreturn(const CBitcoinAddress &address, CWalletTx& wtxNew,
     }
 }
 
+static void SendWithOpreturn(const CBitcoinAddress &address, CWalletTx& wtxNew, uint64_t fee, const vector<unsigned char>& opreturn)
+{
+    SendWithOpreturn(address, wtxNew, fee, opreturn, pwalletMain->GetAddressBalance(address.Get()));
+}
+
 string JsonToStruct(CBitcoinAddress& address, CRegisterForgerData& data, const JSONRPCRequest& request)
 {
     data.opcode = OP_REGISTE;
@@ -3082,7 +3097,7 @@ string JsonToStruct(CBitcoinAddress& address, CRegisterForgerData& data, const J
 
     CKeyID delegate;
     address.GetKeyID(delegate);
-    if(Vote::GetInstance().HaveDelegate(request.params[1].get_str(), delegate)) {
+    if(Vote::GetInstance().GetView()->HaveDelegate(request.params[1].get_str(), delegate)) {
         return "Forger name has registe";
     }
 
@@ -3130,27 +3145,28 @@ UniValue registe(const JSONRPCRequest& request)
     return wtx.GetHash().GetHex();
 }
 
-string JsonToStruct(CBitcoinAddress& address, CVoteForgerData& data, const JSONRPCRequest& request)
+/** Votes of strAddress for the delegates named in vNames, checked against the vote state */
+static string VoteNamesToStruct(CBitcoinAddress& address, CVoteForgerData& data, const string& strAddress, const vector<string>& vNames)
 {
     data.opcode = OP_VOTE;
 
-    address = CBitcoinAddress(request.params[0].get_str());
+    address = CBitcoinAddress(strAddress);
     CKeyID address_id;
     address.GetKeyID(address_id);
     if (!address.IsValid()) {
         return "Invalid Bitcoin address";
     }
 
+    auto view = Vote::GetInstance().GetView();
     set<CBitcoinAddress> setAddress;
-    for (unsigned int idx = 1; idx < request.params.size(); idx++) {
-        auto name = request.params[idx].get_str();
-        auto keyID = Vote::GetInstance().GetDelegate(name);
+    for (const string& name : vNames) {
+        auto keyID = view->GetDelegate(name);
 
         if(keyID.IsNull())
-            return string("delegate name: ") + request.params[idx].get_str() + string(" not register");
+            return string("delegate name: ") + name + string(" not register");
 
-        if(Vote::GetInstance().HaveVote(address_id, keyID))
-            return string("delegate name: ") + request.params[idx].get_str() + string(" is voted");
+        if(view->HaveVote(address_id, keyID))
+            return string("delegate name: ") + name + string(" is voted");
 
         CBitcoinAddress address(keyID);
         if (setAddress.count(address))
@@ -3160,38 +3176,53 @@ string JsonToStruct(CBitcoinAddress& address, CVoteForgerData& data, const JSONR
         data.forgers.insert(keyID);
     }
 
-    if((setAddress.size() + Vote::GetInstance().GetVotedDelegates(address_id).size()) > Vote::MaxNumberOfVotes)
+    if((setAddress.size() + view->GetVotedDelegates(address_id).size()) > Vote::MaxNumberOfVotes)
         return "delegates number must not more than 51";
 
     string ret = CheckStruct(data);
     return ret;
 }
 
-string JsonToStruct(CBitcoinAddress& address, CCancelVoteForgerData& data, const JSONRPCRequest& request)
+/** The delegate names of the parameters of vote and cancelvote, from the second on */
+static vector<string> ParamsToNames(const JSONRPCRequest& request)
+{
+    vector<string> vNames;
+    for (unsigned int idx = 1; idx < request.params.size(); idx++)
+        vNames.push_back(request.params[idx].get_str());
+    return vNames;
+}
+
+string JsonToStruct(CBitcoinAddress& address, CVoteForgerData& data, const JSONRPCRequest& request)
+{
+    return VoteNamesToStruct(address, data, request.params[0].get_str(), ParamsToNames(request));
+}
+
+/** Revocations of the votes of strAddress for the delegates named in vNames, checked against the vote state */
+static string CancelVoteNamesToStruct(CBitcoinAddress& address, CCancelVoteForgerData& data, const string& strAddress, const vector<string>& vNames)
 {
     data.opcode = OP_REVOKE;
 
-    address = CBitcoinAddress(request.params[0].get_str());
+    address = CBitcoinAddress(strAddress);
     CKeyID address_id;
     address.GetKeyID(address_id);
     if (!address.IsValid())
         return "Invalid Bitcoin address";
 
+    auto view = Vote::GetInstance().GetView();
     set<CBitcoinAddress> setAddress;
-    for (unsigned int idx = 1; idx < request.params.size(); idx++) {
-        auto name = request.params[idx].get_str();
-        CKeyID keyID = Vote::GetInstance().GetDelegate(name);
+    for (const string& name : vNames) {
+        CKeyID keyID = view->GetDelegate(name);
 
         if(keyID.IsNull())
-            return string("delegate name: ") + request.params[idx].get_str() + string(" not register");
+            return string("delegate name: ") + name + string(" not register");
 
-        if(Vote::GetInstance().HaveVote(address_id, keyID) == false) {
-            return string("delegate name: ") + request.params[idx].get_str() + string(" is not voted");
+        if(view->HaveVote(address_id, keyID) == false) {
+            return string("delegate name: ") + name + string(" is not voted");
         }
 
         CBitcoinAddress address(keyID);
         if (setAddress.count(address))
-            return string("Invalid parameter, duplicated name: ")+ request.params[idx].get_str();
+            return string("Invalid parameter, duplicated name: ")+ name;
 
         if( setAddress.size() >= Vote::MaxNumberOfVotes)
             return string("delegates number must not more than 51");
@@ -3204,6 +3235,11 @@ string JsonToStruct(CBitcoinAddress& address, CCancelVoteForgerData& data, const
     return ret;
 }
 
+string JsonToStruct(CBitcoinAddress& address, CCancelVoteForgerData& data, const JSONRPCRequest& request)
+{
+    return CancelVoteNamesToStruct(address, data, request.params[0].get_str(), ParamsToNames(request));
+}
+
 string JsonToStruct(CBitcoinAddress& address, CRegisterCommitteeData& data, const JSONRPCRequest& request)
 {
     string ret;
@@ -3216,19 +3252,8 @@ string JsonToStruct(CBitcoinAddress& address, CRegisterCommitteeData& data, cons
     address.GetKeyID(id);
     if(Vote::GetInstance().GetCommittee().GetRegiste(NULL, id)) {
         ret = "The address has registerd";
-    } else {
-        auto& name = data.name;
-        auto f = [&name](const CKeyID& key, const CRegisterCommitteeData& value) -> bool {
-            bool ret = false;
-            if(value.name == name) {
-                ret = true;
-            }
-            return ret;
-        };
-
-        if(Vote::GetInstance().GetCommittee().FindRegiste(f)) {
-            ret = "The name has registerd";
-        }
+    } else if(Vote::GetInstance().GetCommittee().GetRegisteByName(NULL, data.name)) {
+        ret = "The name has registerd";
     }
 
     if(ret.empty()) {
@@ -3245,16 +3270,7 @@ string JsonToStruct(CBitcoinAddress& address, CVoteCommitteeData& data, const JS
 
     string name = request.params[1].get_str();
     CKeyID committee;
-    auto f = [&name, &committee](const CKeyID& key, const CRegisterCommitteeData& value) -> bool {
-        bool ret = false;
-        if(value.name == name) {
-            committee = key;
-            ret = true;
-        }
-        return ret;
-    };
-
-    if(Vote::GetInstance().GetCommittee().FindRegiste(f) == false) {
+    if(Vote::GetInstance().GetCommittee().GetRegisteByName(&committee, name) == false) {
         return "The name dosn't registed";
     }
 
@@ -3281,33 +3297,14 @@ string JsonToStruct(CBitcoinAddress& address, CCancelVoteCommitteeData& data, co
 
     string name = request.params[1].get_str();
     CKeyID committee;
-    auto f = [&name, &committee](const CKeyID& key, const CRegisterCommitteeData& value) -> bool {
-        bool ret = false;
-        if(value.name == name) {
-            committee = key;
-            ret = true;
-        }
-        return ret;
-    };
-
-    if(Vote::GetInstance().GetCommittee().FindRegiste(f) == false) {
+    if(Vote::GetInstance().GetCommittee().GetRegisteByName(&committee, name) == false) {
         return "The name dosn't registed";
     }
     data.committee = committee;
 
-    CKeyID committeeid;
     CKeyID voterid;
     address.GetKeyID(voterid);
-    auto f2 = [&committeeid, &voterid](const CKeyID& key, const std::map<CKeyID, uint64_t>& value) -> bool {
-        if(value.find(voterid) != value.end()) {
-            committeeid = key;
-            return true;
-        } else {
-            return false;
-        }
-    };
-
-    if(Vote::GetInstance().GetCommittee().FindVote(f2) == false) {
+    if(Vote::GetInstance().GetCommittee().GetVoterRegiste(NULL, voterid) == false) {
         ret = "The address don't voted committee";
     }
 
@@ -3361,11 +3358,9 @@ string JsonToStruct(CBitcoinAddress& address, CVoteBillData& data, const JSONRPC
 
     CKeyID id;
     address.GetKeyID(id);
-    std::vector<std::map<CKeyID, uint64_t>> voters = Vote::GetInstance().GetBill().GetVote(data.id);
-    for(auto& i : voters) {
-        if(i.find(id) != i.end()) {
-            return "This address has voted the bill";
-        }
+    std::map<uint160, uint8_t> votes = Vote::GetInstance().GetBill().GetVoterVote(id);
+    if(votes.find(data.id) != votes.end()) {
+        return "This address has voted the bill";
     }
 
     CSubmitBillData bill;
@@ -3569,16 +3564,7 @@ UniValue listcommitteevoters(const JSONRPCRequest& request)
 
     string name = request.params[0].get_str();
     CKeyID address;
-    auto f = [&name, &address](const CKeyID& key, const CRegisterCommitteeData& value) -> bool {
-        bool ret = false;
-        if(value.name == name) {
-            address = key;
-            ret = true;
-        }
-        return ret;
-    };
-
-    if(Vote::GetInstance().GetCommittee().FindRegiste(f) == false) {
+    if(Vote::GetInstance().GetCommittee().GetRegisteByName(&address, name) == false) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "committee not register");
     }
 
@@ -3619,30 +3605,11 @@ UniValue listcommitteebills(const JSONRPCRequest& request)
 
     string name = request.params[0].get_str();
     CKeyID address;
-    auto f = [&name, &address](const CKeyID& key, const CRegisterCommitteeData& value) -> bool {
-        bool ret = false;
-        if(value.name == name) {
-            address = key;
-            ret = true;
-        }
-        return ret;
-    };
-
-    if(Vote::GetInstance().GetCommittee().FindRegiste(f) == false) {
+    if(Vote::GetInstance().GetCommittee().GetRegisteByName(&address, name) == false) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "committee not register");
     }
 
-    vector<uint160> billids;
-    {
-    auto f = [&address, &billids](const uint160& key, const CSubmitBillData& value) -> bool {
-        if(value.committee == address) {
-            billids.push_back(key);
-        }
-        return false;
-    };
-
-    Vote::GetInstance().GetBill().FindRegiste(f);
-    }
+    std::set<uint160> billids = Vote::GetInstance().GetBill().GetCommitteeRegiste(address);
 
     UniValue results(UniValue::VARR);
     for(auto& i : billids) {
@@ -3727,14 +3694,10 @@ UniValue listvotercommittees(const JSONRPCRequest& request)
     address.GetKeyID(voterid);
 
     vector<CKeyID> committees;
-    auto f = [&voterid, &committees](const CKeyID& key, const std::map<CKeyID, uint64_t>& value) -> bool {
-        if(value.find(voterid) != value.end()) {
-            committees.push_back(key);
-        }
-        return false;
-    };
-
-    Vote::GetInstance().GetCommittee().FindVote(f);
+    CKeyID committeeid;
+    if(Vote::GetInstance().GetCommittee().GetVoterRegiste(&committeeid, voterid)) {
+        committees.push_back(committeeid);
+    }
 
     UniValue results(UniValue::VARR);
     for(auto& it : committees) {
@@ -3929,7 +3892,7 @@ UniValue listbillvoters(const JSONRPCRequest& request)
     bool bNeedFindBalance = !state.bFinished;
     std::vector<std::map<CKeyID, uint64_t>> voters = Vote::GetInstance().GetBill().GetVote(id);
 
-    UniValue results(UniValue::VARR);
+    CRPCArrayResult results(request);
     for(uint8_t i = 0; i < voters.size(); ++i) {
         UniValue first(UniValue::VOBJ);
         first.push_back(Pair("index",  i));
@@ -3949,7 +3912,7 @@ UniValue listbillvoters(const JSONRPCRequest& request)
         results.push_back(first);
     }
 
-    return results;
+    return results.get();
 }
 
 UniValue listvoterbills(const JSONRPCRequest& request)
@@ -3980,17 +3943,7 @@ UniValue listvoterbills(const JSONRPCRequest& request)
     CKeyID voterid;
     address.GetKeyID(voterid);
 
-    vector<pair<uint160, uint8_t>> bills;
-    auto f = [&voterid, &bills](const uint160& key, const std::vector<std::map<CKeyID, uint64_t>>& value) -> bool {
-        for(uint8_t i = 0; i < value.size(); ++i) {
-            if(value[i].find(voterid) != value[i].end()) {
-                bills.push_back(make_pair(key, i));
-            }
-        }
-        return false;
-    };
-
-    Vote::GetInstance().GetBill().FindVote(f);
+    std::map<uint160, uint8_t> bills = Vote::GetInstance().GetBill().GetVoterVote(voterid);
 
     UniValue results(UniValue::VARR);
     for(auto& it : bills) {
@@ -4162,38 +4115,219 @@ UniValue cancelvote(const JSONRPCRequest& request) {
     return wtx.GetHash().GetHex();
 }
 
-UniValue getaddressbalance(const JSONRPCRequest& request)
-{
+UniValue sendvotes(const JSONRPCRequest& request) {
     if (!EnsureWalletIsAvailable(request.fHelp))
         return NullUniValue;
 
     if (request.fHelp || request.params.size() != 1)
         throw runtime_error(
-            "getaddressbalance address\n"
-            "\nget available balance lbtc(Satoshi) on address.\n"
+            "sendvotes [{\"address\":\"address\",\"vote\":[\"name\",...],\"cancelvote\":[\"name\",...]},...]\n"
+            "\nSend the vote and cancelvote transactions of many addresses in one call.\n"
+            "Every entry is checked before any transaction is sent, an address gets one vote\n"
+            "transaction and one cancelvote transaction at most.\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
-            "1. \"address\"          (string, required) The lbtc address.\n"
+            "1. \"votes\"                (array, required) The votes to send\n"
+            "    [\n"
+            "      {\n"
+            "        \"address\":\"address\", (string, required) The address voting\n"
+            "        \"vote\":[\"name\",...],   (array, optional) The delegates to vote for\n"
+            "        \"cancelvote\":[\"name\",...] (array, optional) The delegates to cancelvote\n"
+            "      }\n"
+            "      ,...\n"
+            "    ]\n"
             "\nResult:\n"
-            "amount                  (numeric) The total amount lbtc.\n"
+            "[\n"
+            "  {\n"
+            "    \"address\":\"address\",   (string) The address voting\n"
+            "    \"op\":\"vote\",           (string) vote or cancelvote\n"
+            "    \"txid\":\"txid\",         (string) The transaction id, when it was sent\n"
+            "    \"error\":\"message\"      (string) Why it was not sent, otherwise\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
             "\nExamples:\n"
-            + HelpExampleCli("getaddressbalance", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
-            + HelpExampleRpc("getaddressbalance", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
-        );
+            + HelpExampleCli("sendvotes", "\"[{\\\"address\\\":\\\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\\\",\\\"vote\\\":[\\\"delegater1\\\"],\\\"cancelvote\\\":[\\\"delegater2\\\"]}]\"")
+            + HelpExampleRpc("sendvotes", "[{\"address\":\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\",\"vote\":[\"delegater1\"]}]")
+       );
 
-    CBitcoinAddress address(request.params[0].get_str());
+    RPCTypeCheck(request.params, {UniValue::VARR});
+
+    struct CVoteTxSpec {
+        CBitcoinAddress address;
+        std::string strOp;
+        uint64_t nFee;
+        vector<unsigned char> opreturn;
+    };
+
+    // Check every entry against the vote state before anything is sent
+    vector<CVoteTxSpec> vSpecs;
+    set<pair<string, string> > setSeen;
+    const UniValue& votes = request.params[0].get_array();
+    for (unsigned int idx = 0; idx < votes.size(); idx++) {
+        const UniValue& entry = votes[idx];
+        if (!entry.isObject())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, entries must be objects");
+        RPCTypeCheckObj(entry.get_obj(), {
+                {"address", UniValueType(UniValue::VSTR)},
+                {"vote", UniValueType(UniValue::VARR)},
+                {"cancelvote", UniValueType(UniValue::VARR)},
+            }, true, true);
+        if (!entry.exists("address"))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, missing address");
+        const string strAddress = find_value(entry, "address").get_str();
+
+        for (const string& strOp : {string("vote"), string("cancelvote")}) {
+            const UniValue& names = find_value(entry, strOp);
+            if (names.isNull())
+                continue;
+            if (names.empty())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, empty %s of %s", strOp, strAddress));
+            if (!setSeen.insert(make_pair(strAddress, strOp)).second)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, duplicated %s of %s", strOp, strAddress));
+
+            vector<string> vNames;
+            for (unsigned int i = 0; i < names.size(); i++)
+                vNames.push_back(names[i].get_str());
+
+            CVoteTxSpec spec;
+            spec.strOp = strOp;
+            string err;
+            if (strOp == "vote") {
+                CVoteForgerData data;
+                err = VoteNamesToStruct(spec.address, data, strAddress, vNames);
+                spec.nFee = OP_VOTE_FORGER_FEE;
+                spec.opreturn = StructToData(data);
+            } else {
+                CCancelVoteForgerData data;
+                err = CancelVoteNamesToStruct(spec.address, data, strAddress, vNames);
+                spec.nFee = OP_CANCEL_VOTE_FORGER_FEE;
+                spec.opreturn = StructToData(data);
+            }
+            if (!err.empty())
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, err);
+            vSpecs.push_back(spec);
+        }
+    }
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    EnsureWalletIsUnlocked();
+
+    // One walk of the wallet for the balances of all the addresses, and one database transaction for their writes
+    std::map<CTxDestination, CAmount> mapBalances = pwalletMain->GetAddressBalances();
+    CWalletDBBatch batch(pwalletMain->strWalletFile);
+
+    UniValue results(UniValue::VARR);
+    for (const CVoteTxSpec& spec : vSpecs) {
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("address", spec.address.ToString()));
+        result.push_back(Pair("op", spec.strOp));
+        try {
+            CWalletTx wtx;
+            CAmount& nBalance = mapBalances[spec.address.Get()];
+            SendWithOpreturn(spec.address, wtx, spec.nFee, spec.opreturn, nBalance);
+            // The inputs are all ours and the change goes back, so the address is down by the fee
+            nBalance -= wtx.GetDebit(ISMINE_ALL) - wtx.tx->GetValueOut();
+            result.push_back(Pair("txid", wtx.GetHash().GetHex()));
+        } catch (const UniValue& objError) {
+            result.push_back(Pair("error", find_value(objError, "message").get_str()));
+        }
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+/** The height argument of a DPoS query, checked against the heights -dposhistory kept; -1 when it is absent */
+static int ParseDPoSHistoryHeight(const JSONRPCRequest& request, size_t nParam)
+{
+    if(request.params.size() <= nParam || request.params[nParam].isNull())
+        return -1;
+
+    const UniValue& param = request.params[nParam];
+    int nHeight = param.isNum() ? param.get_int() : atoi(param.get_str());
+    int nStartHeight = 0, nBestHeight = 0;
+    if(!GetDPoSHistoryRange(nStartHeight, nBestHeight))
+        throw JSONRPCError(RPC_MISC_ERROR, "A height needs the DPoS history, start the node with -dposhistory");
+    if(nHeight < nStartHeight || nHeight > nBestHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("The DPoS history covers the heights %d to %d", nStartHeight, nBestHeight));
+
+    return nHeight;
+}
+
+/** The balance votes count of an address, as of a height of the DPoS history unless nHeight is -1 */
+static uint64_t GetAddressBalance(const CMyAddress& address, int nHeight)
+{
+    if(nHeight < 0)
+        return Vote::GetInstance().GetAddressBalance(address);
+
+    uint64_t nBalance = 0;
+    if(!pdposhistory->ReadBalance(address, nHeight, nBalance))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the DPoS history");
+    return nBalance;
+}
+
+static uint64_t GetAddressBalance(const std::string& strAddress, int nHeight)
+{
+    CBitcoinAddress address(strAddress);
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
 
-    uint64_t balance = 0;
     CTxDestination key = address.Get();
     if(address.IsScript()) {
-        balance = Vote::GetInstance().GetAddressBalance(CMyAddress(boost::get<CScriptID>(key), CChainParams::SCRIPT_ADDRESS));
+        return GetAddressBalance(CMyAddress(boost::get<CScriptID>(key), CChainParams::SCRIPT_ADDRESS), nHeight);
     } else {
-        balance = Vote::GetInstance().GetAddressBalance(CMyAddress(boost::get<CKeyID>(key), CChainParams::PUBKEY_ADDRESS));
+        return GetAddressBalance(CMyAddress(boost::get<CKeyID>(key), CChainParams::PUBKEY_ADDRESS), nHeight);
     }
+}
+
+/** The voters of a delegate as of a height of the DPoS history */
+static std::vector<CKeyID> GetHistoryDelegateVoters(const CKeyID& delegate, int nHeight)
+{
+    std::vector<CKeyID> vVoter;
+    if(!pdposhistory->ReadVoters(delegate, nHeight, vVoter))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the DPoS history");
+    return vVoter;
+}
+
+UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (!EnsureWalletIsAvailable(request.fHelp))
+        return NullUniValue;
+
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "getaddressbalance address ( height )\n"
+            "\nget available balance lbtc(Satoshi) on address.\n"
+            + HelpRequiringPassphrase() +
+            "\nArguments:\n"
+            "1. \"address\"          (string, required) The lbtc address, or an array of addresses.\n"
+            "2. \"height\"           (string, optional) The balance as of the block at this height, which needs -dposhistory. Default the tip.\n"
+            "\nResult:\n"
+            "amount                  (numeric) The total amount lbtc.\n"
+            "\nResult for an array of addresses:\n"
+            "{\n"
+            "  \"address\": amount,   (numeric) The amount of each address\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
+            + HelpExampleRpc("getaddressbalance", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\"")
+            + HelpExampleRpc("getaddressbalance", "[\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\", \"15meUQSFQMUS6vUkw8D2htgkpxiNnSXBaT\"]")
+            + HelpExampleCli("getaddressbalance", "\"1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\" \"100000\"")
+        );
+
+    int nHeight = ParseDPoSHistoryHeight(request, 1);
+    if (!request.params[0].isArray())
+        return UniValue(GetAddressBalance(request.params[0].get_str(), nHeight));
 
-    return UniValue(balance);
+    const UniValue& addresses = request.params[0].get_array();
+    UniValue result(UniValue::VOBJ);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        const std::string& strAddress = addresses[i].get_str();
+        result.push_back(Pair(strAddress, GetAddressBalance(strAddress, nHeight)));
+    }
+    return result;
 }
 
 UniValue getcoinrank(const JSONRPCRequest& request)
@@ -4232,7 +4366,7 @@ UniValue getcoinrank(const JSONRPCRequest& request)
 
     std::multimap<uint64_t, CMyAddress> result = Vote::GetInstance().GetCoinRank(number);
 
-    UniValue jsonResult(UniValue::VARR);
+    CRPCArrayResult jsonResult(request);
     for(auto it = result.rbegin(); it != result.rend(); ++it) {
         UniValue obj(UniValue::VOBJ);
 
@@ -4250,7 +4384,7 @@ UniValue getcoinrank(const JSONRPCRequest& request)
         jsonResult.push_back(obj);
     }
 
-    return jsonResult;
+    return jsonResult.get();
 }
 
 UniValue getcoindistribution(const JSONRPCRequest& request)
@@ -4303,34 +4437,70 @@ UniValue getcoindistribution(const JSONRPCRequest& request)
     return jsonResult;
 }
 
+/** Whether the includepending argument params[nParam] is given and true */
+static bool IsIncludePending(const JSONRPCRequest& request, size_t nParam)
+{
+    if(request.params.size() <= nParam) {
+        return false;
+    }
+
+    const UniValue& param = request.params[nParam];
+    return param.isBool() ? param.get_bool() : param.get_str() == "true";
+}
+
+/** The published vote view, with the forger operations of mempool transactions applied when params[nParam] is true */
+static std::shared_ptr<const CVoteView> GetRPCVoteView(const JSONRPCRequest& request, size_t nParam)
+{
+    auto view = Vote::GetInstance().GetView();
+    if(IsIncludePending(request, nParam)) {
+        view = view->WithPending(mempool.GetPendingDPoSOps());
+    }
+
+    return view;
+}
+
 UniValue getdelegatevotes(const JSONRPCRequest& request)
 {
     if (!EnsureWalletIsAvailable(request.fHelp))
         return NullUniValue;
 
-    if (request.fHelp || request.params.size() != 1)
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
         throw runtime_error(
-            "getdelegatevotes delegateName\n"
+            "getdelegatevotes delegateName ( includepending height )\n"
             "\nget the number of votes the delegate received.\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
             "1. \"delegateName\"      (string, required) The delegate name.\n"
+            "2. \"includepending\"    (string, optional) \"true\" to count the votes of mempool transactions too. Default \"false\".\n"
+            "3. \"height\"            (string, optional) The votes as of the block at this height, which needs -dposhistory. Default the tip.\n"
             "\nResult:\n"
             "\"number\"               (numeric) The number of votes the delegate received.\n"
             "\nExamples:\n"
             + HelpExampleCli("getdelegatevotes", "\"delegateName\"")
+            + HelpExampleCli("getdelegatevotes", "\"delegateName\" \"true\"")
             + HelpExampleRpc("getdelegatevotes", "\"delegateName\"")
+            + HelpExampleCli("getdelegatevotes", "\"delegateName\" \"false\" \"100000\"")
         );
 
-    Vote &vote = Vote::GetInstance();
+    int nHeight = ParseDPoSHistoryHeight(request, 2);
+    if(nHeight >= 0 && IsIncludePending(request, 1)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "includepending and height cannot be used together");
+    }
+    auto view = GetRPCVoteView(request, 1);
 
-    if(!vote.HaveDelegate(request.params[0].get_str())) {
+    if(!view->HaveDelegate(request.params[0].get_str())) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("delegate name: ") + request.params[0].get_str() + string(" not registe"));
     }
 
     uint64_t nShare{0};
-    CKeyID key = vote.GetDelegate(request.params[0].get_str());
-    nShare = Vote::GetInstance().GetDelegateVotes(key);
+    CKeyID key = view->GetDelegate(request.params[0].get_str());
+    if(nHeight < 0) {
+        nShare = view->GetDelegateVotes(key);
+    } else {
+        for(const CKeyID& voter : GetHistoryDelegateVoters(key, nHeight)) {
+            nShare += GetAddressBalance(CMyAddress(voter, CChainParams::PUBKEY_ADDRESS), nHeight);
+        }
+    }
 
     UniValue entry(nShare);
     return entry;
@@ -4385,15 +4555,15 @@ UniValue getdelegatefunds(const JSONRPCRequest& request)
             + HelpExampleRpc("getdelegatefunds", "\"delegateName\"")
         );
 
-    Vote &vote = Vote::GetInstance();
+    auto view = Vote::GetInstance().GetView();
 
-    if(!vote.HaveDelegate(request.params[0].get_str())) {
+    if(!view->HaveDelegate(request.params[0].get_str())) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("delegate name: ") + request.params[0].get_str() + string(" not registe"));
     }
 
     uint64_t nShare{0};
-    CKeyID key = vote.GetDelegate(request.params[0].get_str());
-    nShare = Vote::GetInstance().GetDelegateFunds(std::make_pair(key, CChainParams::PUBKEY_ADDRESS));
+    CMyAddress key(view->GetDelegate(request.params[0].get_str()), CChainParams::PUBKEY_ADDRESS);
+    nShare = Vote::GetInstance().GetDelegateFunds(key);
 
     UniValue entry(nShare);
     return entry;
@@ -4404,13 +4574,14 @@ UniValue listvoteddelegates(const JSONRPCRequest& request)
     if (!EnsureWalletIsAvailable(request.fHelp))
         return NullUniValue;
 
-    if (request.fHelp || request.params.size() != 1)
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
         throw runtime_error(
-            "listvoteddelegates address\n"
+            "listvoteddelegates address ( includepending )\n"
             "\nlist all the delegates voted by this address.\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
             "1. \"address\"             (string, required) The lbtc address.\n"
+            "2. \"includepending\"      (string, optional) \"true\" to apply the votes of mempool transactions. Default \"false\".\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -4431,11 +4602,12 @@ UniValue listvoteddelegates(const JSONRPCRequest& request)
     CKeyID keyID;
     address.GetKeyID(keyID);
 
-    auto result = Vote::GetInstance().GetVotedDelegates(keyID);
+    auto view = GetRPCVoteView(request, 1);
+    auto result = view->GetVotedDelegates(keyID);
     for(auto& i : result)
     {
         UniValue entry(UniValue::VOBJ);
-        entry.push_back(Pair("name", Vote::GetInstance().GetDelegate(i)));
+        entry.push_back(Pair("name", view->GetDelegate(i)));
         entry.push_back(Pair("delegate", CBitcoinAddress(i).ToString() ));
         results.push_back(entry);
     }
@@ -4448,16 +4620,19 @@ UniValue listdelegates(const JSONRPCRequest& request)
     if (!EnsureWalletIsAvailable(request.fHelp))
         return NullUniValue;
 
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw runtime_error(
-            "listdelegates\n"
+            "listdelegates ( includepending )\n"
             "\nlist all delegates.\n"
             + HelpRequiringPassphrase() +
+            "\nArguments:\n"
+            "1. \"includepending\"      (string, optional) \"true\" to apply the registrations and votes of mempool transactions. Default \"false\".\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
             "      \"name\"           (string) The delegate name.\n"
             "      \"address\"        (string) The delegate address.\n"
+            "      \"votes\"          (numeric) The number of votes the delegate received.\n"
             "  }\n"
             "]\n"
             "\nExamples:\n"
@@ -4466,11 +4641,12 @@ UniValue listdelegates(const JSONRPCRequest& request)
         );
     UniValue results(UniValue::VARR);
 
-    auto result = Vote::GetInstance().ListDelegates();
-    for(auto w : result){
+    auto view = GetRPCVoteView(request, 0);
+    for(auto& w : view->ListDelegates()){
         UniValue entry(UniValue::VOBJ);
         entry.push_back(Pair("name", std::string(w.first) ));
         entry.push_back(Pair("address", CBitcoinAddress(w.second).ToString() ));
+        entry.push_back(Pair("votes", view->GetDelegateVotes(w.second)));
         results.push_back(entry);
     }
 
@@ -4482,13 +4658,15 @@ UniValue listreceivedvotes(const JSONRPCRequest& request)
     if (!EnsureWalletIsAvailable(request.fHelp))
         return NullUniValue;
 
-    if (request.fHelp || request.params.size() != 1)
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
         throw runtime_error(
-            "listreceivedvotes delegateName\n"
+            "listreceivedvotes delegateName ( includepending height )\n"
             "\nlist the all the addresses which vote the delegate.\n"
             + HelpRequiringPassphrase() +
             "\nArguments:\n"
             "1. \"delegateName\"      (string, required) The delegate name.\n"
+            "2. \"includepending\"    (string, optional) \"true\" to apply the votes of mempool transactions. Default \"false\".\n"
+            "3. \"height\"            (string, optional) The voters as of the block at this height, which needs -dposhistory. Default the tip.\n"
             "\nResult:\n"
             "[\n"
             "   \"address\"           (string) The addresses which vote the delegate.\n"
@@ -4496,9 +4674,14 @@ UniValue listreceivedvotes(const JSONRPCRequest& request)
             "\nExamples:\n"
             + HelpExampleCli("listreceivedvotes", "\"test-delegate-name\"")
             + HelpExampleRpc("listreceivedvotes", "\"test-delegate-name\"")
+            + HelpExampleCli("listreceivedvotes", "\"test-delegate-name\" \"false\" \"100000\"")
         );
-    Vote& vote = Vote::GetInstance();
-    CKeyID keyID = vote.GetDelegate(request.params[0].get_str());
+    int nHeight = ParseDPoSHistoryHeight(request, 2);
+    if(nHeight >= 0 && IsIncludePending(request, 1)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "includepending and height cannot be used together");
+    }
+    auto view = GetRPCVoteView(request, 1);
+    CKeyID keyID = view->GetDelegate(request.params[0].get_str());
     if(keyID.IsNull()) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("delegate name: ") + request.params[0].get_str() + string(" not registe"));
     }
@@ -4507,13 +4690,267 @@ UniValue listreceivedvotes(const JSONRPCRequest& request)
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
 
-    std::set<CKeyID> voters = vote.GetDelegateVoters(keyID);
-    UniValue results(UniValue::VARR);
+    std::set<CKeyID> voters;
+    if(nHeight < 0) {
+        voters = view->GetDelegateVoters(keyID);
+    } else {
+        std::vector<CKeyID> vVoter = GetHistoryDelegateVoters(keyID, nHeight);
+        voters.insert(vVoter.begin(), vVoter.end());
+    }
+    CRPCArrayResult results(request);
     for (auto& v:voters)
     {
         results.push_back(CBitcoinAddress(v).ToString());
     }
-    return results;
+    return results.get();
+}
+
+
+/** What a voter of a delegate adds up to over the blocks getvotershares splits */
+struct CVoterShare
+{
+    bool fVoting;
+    uint64_t nBalance;
+    int nBlocks;
+    arith_uint256 nBalanceSum;
+    double dShare;
+
+    CVoterShare() : fVoting(false), nBalance(0), nBlocks(0), dShare(0) {}
+};
+
+UniValue getvotershares(const JSONRPCRequest& request)
+{
+    if (!EnsureWalletIsAvailable(request.fHelp))
+        return NullUniValue;
+
+    if (request.fHelp || request.params.size() != 3)
+        throw runtime_error(
+            "getvotershares delegateName startheight endheight\n"
+            "\nsplit the blocks the delegate forged from startheight to endheight among its voters, each block in proportion to their balances as of the block before it.\n"
+            + HelpRequiringPassphrase() +
+            "\nArguments:\n"
+            "1. \"delegateName\"      (string, required) The delegate name.\n"
+            "2. \"startheight\"       (string, required) The first height, above the first one the DPoS history has, see -dposhistory.\n"
+            "3. \"endheight\"         (string, required) The last height.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"           (string) The address of the voter.\n"
+            "    \"blocks\"            (numeric) The number of forged blocks the voter voted for the delegate before.\n"
+            "    \"balance\"           (numeric) The balance (Satoshi) of the voter averaged over all the forged blocks.\n"
+            "    \"share\"             (numeric) The part of the forged blocks that is the voter's.\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvotershares", "\"test-delegate-name\" \"100000\" \"110000\"")
+            + HelpExampleRpc("getvotershares", "\"test-delegate-name\", \"100000\", \"110000\"")
+        );
+
+    // The history is written under cs_main, which keeps it at the active chain for the whole pass
+    LOCK(cs_main);
+    int nStartHeight = ParseDPoSHistoryHeight(request, 1);
+    int nEndHeight = ParseDPoSHistoryHeight(request, 2);
+    int nHistoryStart = 0, nHistoryBest = 0;
+    GetDPoSHistoryRange(nHistoryStart, nHistoryBest);
+    if(nStartHeight < 0 || nEndHeight < 0 || nStartHeight <= nHistoryStart || nStartHeight > nEndHeight) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("The heights must be in order and from %d to %d", nHistoryStart + 1, nHistoryBest));
+    }
+
+    CKeyID keyID = Vote::GetInstance().GetDelegate(request.params[0].get_str());
+    if(keyID.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("delegate name: ") + request.params[0].get_str() + string(" not registe"));
+    }
+
+    std::vector<int> vForged = DPoS::GetInstance().GetForgedHeights(keyID, nStartHeight, nEndHeight);
+
+    // The voters and their balances as of the block before the next forged one,
+    // moved forward by the records each block left in the history
+    std::map<CKeyID, CVoterShare> mapShare;
+    uint64_t nTotal = 0;
+    for(const CKeyID& voter : GetHistoryDelegateVoters(keyID, nStartHeight - 1)) {
+        CVoterShare& share = mapShare[voter];
+        share.fVoting = true;
+        share.nBalance = GetAddressBalance(CMyAddress(voter, CChainParams::PUBKEY_ADDRESS), nStartHeight - 1);
+        nTotal += share.nBalance;
+    }
+
+    std::vector<int>::const_iterator itForged = vForged.begin();
+    for(int nHeight = nStartHeight; itForged != vForged.end(); ++nHeight) {
+        if(nHeight == *itForged) {
+            for(std::pair<const CKeyID, CVoterShare>& item : mapShare) {
+                CVoterShare& share = item.second;
+                if(share.fVoting && nTotal > 0) {
+                    share.nBlocks++;
+                    share.nBalanceSum += share.nBalance;
+                    share.dShare += (double)share.nBalance / nTotal;
+                }
+            }
+            if(++itForged == vForged.end()) {
+                break;
+            }
+        }
+
+        CDPoSHistoryBlock block;
+        if(!pdposhistory->ReadBlock(nHeight, block)) {
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the DPoS history");
+        }
+        for(const std::pair<CKeyID, CKeyID>& vote : block.vVote) {
+            if(vote.first != keyID) {
+                continue;
+            }
+            bool fVoted = false;
+            if(!pdposhistory->ReadVote(keyID, vote.second, nHeight, fVoted)) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the DPoS history");
+            }
+            CVoterShare& share = mapShare[vote.second];
+            if(fVoted && !share.fVoting) {
+                share.nBalance = GetAddressBalance(CMyAddress(vote.second, CChainParams::PUBKEY_ADDRESS), nHeight);
+                nTotal += share.nBalance;
+            } else if(!fVoted && share.fVoting) {
+                nTotal -= share.nBalance;
+            }
+            share.fVoting = fVoted;
+        }
+        for(const CMyAddress& address : block.vAddress) {
+            if(address.second != CChainParams::PUBKEY_ADDRESS) {
+                continue;
+            }
+            std::map<CKeyID, CVoterShare>::iterator it = mapShare.find(CKeyID(address.first));
+            if(it != mapShare.end() && it->second.fVoting) {
+                uint64_t nBalance = GetAddressBalance(address, nHeight);
+                nTotal = nTotal - it->second.nBalance + nBalance;
+                it->second.nBalance = nBalance;
+            }
+        }
+    }
+
+    CRPCArrayResult results(request);
+    for(const std::pair<const CKeyID, CVoterShare>& item : mapShare) {
+        const CVoterShare& share = item.second;
+        if(share.nBlocks == 0) {
+            continue;
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", CBitcoinAddress(item.first).ToString()));
+        entry.push_back(Pair("blocks", share.nBlocks));
+        entry.push_back(Pair("balance", (uint64_t)(share.nBalanceSum / vForged.size()).GetLow64()));
+        entry.push_back(Pair("share", share.dShare / vForged.size()));
+        results.push_back(entry);
+    }
+    return results.get();
+}
+
+
+UniValue getdelegatesinfo(const JSONRPCRequest& request)
+{
+    if (!EnsureWalletIsAvailable(request.fHelp))
+        return NullUniValue;
+
+    if (request.fHelp || request.params.size() > 3)
+        throw runtime_error(
+            "getdelegatesinfo ( \"sortby\" \"offset\" \"count\" )\n"
+            "\nget the votes, funds, voters and multisig addresses of all delegates at once.\n"
+            + HelpRequiringPassphrase() +
+            "\nArguments:\n"
+            "1. \"sortby\"            (string, optional) \"votes\", \"funds\", \"voters\" or \"name\". Default \"votes\".\n"
+            "2. \"offset\"            (string, optional) The number of delegates to skip. Default 0.\n"
+            "3. \"count\"             (string, optional) The number of delegates to return, 0 for all. Default 0.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"total\": n,                 (numeric) The number of registered delegates.\n"
+            "  \"delegates\": [\n"
+            "    {\n"
+            "      \"name\"           (string) The delegate name.\n"
+            "      \"address\"        (string) The delegate address.\n"
+            "      \"votes\"          (numeric) The number of votes the delegate received.\n"
+            "      \"funds\"          (numeric) The number of funds of the delegate.\n"
+            "      \"voters\"         (numeric) The number of addresses which vote the delegate.\n"
+            "      \"multiaddress\"   (array) The multisig addresses bound to the delegate.\n"
+            "    }\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdelegatesinfo", "")
+            + HelpExampleCli("getdelegatesinfo", "\"funds\" \"0\" \"101\"")
+            + HelpExampleRpc("getdelegatesinfo", "\"votes\", \"0\", \"101\"")
+        );
+
+    std::string strSort = "votes";
+    if(request.params.size() > 0) {
+        strSort = request.params[0].get_str();
+        if(strSort != "votes" && strSort != "funds" && strSort != "voters" && strSort != "name") {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid sortby: ") + strSort);
+        }
+    }
+
+    int64_t nOffset = 0, nCount = 0;
+    if(request.params.size() > 1) {
+        nOffset = atoi64(request.params[1].get_str());
+    }
+    if(request.params.size() > 2) {
+        nCount = atoi64(request.params[2].get_str());
+    }
+    if(nOffset < 0 || nCount < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "offset and count must not be negative");
+    }
+
+    struct DelegateInfo {
+        const std::string* name;
+        CKeyID keyid;
+        uint64_t votes;
+        uint64_t funds;
+        uint64_t voters;
+        std::map<CMyAddress, uint256> multiaddress;
+    };
+
+    // Every field but the funds comes from one view, funds are read from the live balances
+    auto view = Vote::GetInstance().GetView();
+    std::vector<DelegateInfo> vInfo;
+    vInfo.reserve(view->ListDelegates().size());
+    for(auto& it : view->ListDelegates()) {
+        DelegateInfo info;
+        info.name = &it.first;
+        info.keyid = it.second;
+        info.votes = view->GetDelegateVotes(it.second);
+        info.multiaddress = view->GetDelegateMultiaddress(CMyAddress(it.second, CChainParams::PUBKEY_ADDRESS));
+        info.funds = Vote::GetInstance().GetDelegateFunds(CMyAddress(it.second, CChainParams::PUBKEY_ADDRESS));
+        info.voters = view->GetDelegateVoterCount(it.second);
+        vInfo.push_back(std::move(info));
+    }
+
+    // ListDelegates is ordered by name, a stable sort keeps that order among equal keys
+    if(strSort == "votes") {
+        std::stable_sort(vInfo.begin(), vInfo.end(), [](const DelegateInfo& a, const DelegateInfo& b) { return a.votes > b.votes; });
+    } else if(strSort == "funds") {
+        std::stable_sort(vInfo.begin(), vInfo.end(), [](const DelegateInfo& a, const DelegateInfo& b) { return a.funds > b.funds; });
+    } else if(strSort == "voters") {
+        std::stable_sort(vInfo.begin(), vInfo.end(), [](const DelegateInfo& a, const DelegateInfo& b) { return a.voters > b.voters; });
+    }
+
+    UniValue delegates(UniValue::VARR);
+    size_t nBegin = std::min<uint64_t>(nOffset, vInfo.size());
+    size_t nEnd = nCount == 0 ? vInfo.size() : std::min<uint64_t>(nBegin + nCount, vInfo.size());
+    for(size_t i = nBegin; i < nEnd; ++i) {
+        const DelegateInfo& info = vInfo[i];
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("name", *info.name));
+        entry.push_back(Pair("address", CBitcoinAddress(info.keyid).ToString()));
+        entry.push_back(Pair("votes", info.votes));
+        entry.push_back(Pair("funds", info.funds));
+        entry.push_back(Pair("voters", info.voters));
+
+        UniValue multiaddress(UniValue::VARR);
+        for(auto& it : info.multiaddress) {
+            multiaddress.push_back(CBitcoinAddress(CScriptID(it.first.first)).ToString());
+        }
+        entry.push_back(Pair("multiaddress", multiaddress));
+        delegates.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("total", (uint64_t)vInfo.size()));
+    result.push_back(Pair("delegates", delegates));
+    return result;
 }
 
 
@@ -4571,17 +5008,20 @@ static const CRPCCommand commands[] =
     { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,   {"oldpassphrase","newpassphrase"} },
     { "wallet",             "walletpassphrase",         &walletpassphrase,         true,   {"passphrase","timeout"} },
     { "wallet",             "removeprunedfunds",        &removeprunedfunds,        true,   {"txid"} },
-    { "wallet",             "getaddressbalance",        &getaddressbalance,        true,   {"getaddressbalance", "address"} },
+    { "wallet",             "getaddressbalance",        &getaddressbalance,        true,   {"getaddressbalance", "address", "height"} },
     { "wallet",             "getcoinrank",              &getcoinrank,              true,   {"getcoinrank"} },
     { "wallet",             "getcoindistribution",      &getcoindistribution,      true,   {"getcoindistribution", "threshold"} },
     { "dpos",               "register",                 &registe,                  true,   {"register", "address"} },
     { "dpos",               "vote",                     &vote,                     true,   {"vote", "fromaddress", "addresses"} },
     { "dpos",               "cancelvote",               &cancelvote,               true,   {"cancelvote", "fromaddress", "delegatename"} },
-    { "dpos",               "listdelegates",            &listdelegates,            true,   {"listdelegates"} },
-    { "dpos",               "getdelegatevotes",         &getdelegatevotes,         true,   {"getdelegatevotes", "delegatename"} },
+    { "dpos",               "sendvotes",                &sendvotes,                true,   {"votes"} },
+    { "dpos",               "listdelegates",            &listdelegates,            true,   {"listdelegates", "includepending"} },
+    { "dpos",               "getdelegatevotes",         &getdelegatevotes,         true,   {"getdelegatevotes", "delegatename", "includepending", "height"} },
     { "dpos",               "getdelegatefunds",         &getdelegatefunds,         true,   {"getdelegatefunds", "delegatename"} },
-    { "dpos",               "listvoteddelegates",       &listvoteddelegates,       true,   {"listvoteddelegates", "address"} },
-    { "dpos",               "listreceivedvotes",        &listreceivedvotes,        true,   {"listreceivedvotes", "delegatename"} },
+    { "dpos",               "listvoteddelegates",       &listvoteddelegates,       true,   {"listvoteddelegates", "address", "includepending"} },
+    { "dpos",               "listreceivedvotes",        &listreceivedvotes,        true,   {"listreceivedvotes", "delegatename", "includepending", "height"} },
+    { "dpos",               "getvotershares",           &getvotershares,           true,   {"getvotershares", "delegatename", "startheight", "endheight"} },
+    { "dpos",               "getdelegatesinfo",         &getdelegatesinfo,         true,   {"getdelegatesinfo", "sortby", "offset", "count"} },
     { "dpos",               "getirreversibleblock",     &getirreversibleblock,     true,   {"getirreversibleblock"} },
     { "govern",             "submitbill",               &submitbill,               true,   {"submitbill"} },
     { "govern",             "votebill",                 &votebill,                 true,   {"votebill"} },
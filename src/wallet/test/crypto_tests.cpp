@@ -235,4 +235,44 @@ BOOST_AUTO_TEST_CASE(decrypt) {
     }
 }
 
+class TestCryptoKeyStore : public CCryptoKeyStore
+{
+public:
+    using CCryptoKeyStore::EncryptKeys;
+    using CCryptoKeyStore::Unlock;
+    using CCryptoKeyStore::IsDecryptionThoroughlyChecked;
+};
+
+BOOST_AUTO_TEST_CASE(unlock_checks_every_key) {
+    // Enough keys for Unlock to check them on more than one thread
+    TestCryptoKeyStore keystore;
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 2500; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        BOOST_CHECK(keystore.AddKeyPubKey(key, key.GetPubKey()));
+        vPubKeys.push_back(key.GetPubKey());
+    }
+    uint256 hashMasterKey = GetRandHash();
+    CKeyingMaterial vMasterKey(hashMasterKey.begin(), hashMasterKey.end());
+    BOOST_CHECK(keystore.EncryptKeys(vMasterKey));
+    BOOST_CHECK(keystore.IsLocked());
+
+    uint256 hashWrongKey = GetRandHash();
+    BOOST_CHECK(!keystore.Unlock(CKeyingMaterial(hashWrongKey.begin(), hashWrongKey.end())));
+    BOOST_CHECK(!keystore.IsDecryptionThoroughlyChecked());
+    BOOST_CHECK(keystore.IsLocked());
+
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+    BOOST_CHECK(keystore.IsDecryptionThoroughlyChecked());
+    for (const CPubKey& pubkey : vPubKeys) {
+        CKey key;
+        BOOST_CHECK(keystore.GetKey(pubkey.GetID(), key));
+        BOOST_CHECK(key.GetPubKey() == pubkey);
+    }
+
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -363,6 +363,127 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(changeless_selection)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(3 * COIN);
+    add_coin(5 * COIN);
+    add_coin(7 * COIN);
+    add_coin(30 * COIN);
+
+    // 5 + 7 exceeds the target by less than a dust change output, so it is taken without change
+    BOOST_CHECK(wallet.SelectCoinsMinConf(12 * COIN - 100, 1, 6, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 12 * COIN);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // Many coins of the same value do not make the search give up
+    empty_wallet();
+    for (int i = 0; i < 2000; i++)
+        add_coin(1 * COIN);
+    add_coin(1 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(3 * COIN + 1 * CENT, 1, 6, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * COIN + 1 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 4U);
+
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(keypool_topup)
+{
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(200));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 201U);
+
+    // HD keys made in parallel take the child indexes in order, as one by one
+    BOOST_CHECK(pwalletMain->SetHDMasterKey(pwalletMain->GenerateNewHDMasterKey()));
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(400));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 401U);
+
+    std::set<std::string> setKeypaths;
+    for (const std::pair<CTxDestination, CKeyMetadata>& item : pwalletMain->mapKeyMetadata) {
+        if (item.second.hdKeypath.size() > 1)
+            setKeypaths.insert(item.second.hdKeypath);
+    }
+    BOOST_CHECK_EQUAL(setKeypaths.size(), 200U);
+    BOOST_CHECK(setKeypaths.count("m/0'/0'/0'"));
+    BOOST_CHECK(setKeypaths.count("m/0'/0'/199'"));
+
+    CKeyMetadata metadata;
+    CKey secret;
+    pwalletMain->DeriveNewChildKey(metadata, secret);
+    BOOST_CHECK_EQUAL(metadata.hdKeypath, "m/0'/0'/200'");
+}
+
+BOOST_AUTO_TEST_CASE(ismine_owned_scripts)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    CKey key, other, watched;
+    key.MakeNewKey(true);
+    other.MakeNewKey(true);
+    watched.MakeNewKey(true);
+    CScript multisig = GetScriptForMultisig(1, {key.GetPubKey(), other.GetPubKey()});
+    std::vector<CTxOut> vOut = {
+        CTxOut(COIN, GetScriptForDestination(key.GetPubKey().GetID())),
+        CTxOut(COIN, GetScriptForDestination(other.GetPubKey().GetID())),
+        CTxOut(COIN, GetScriptForDestination(watched.GetPubKey().GetID())),
+        CTxOut(COIN, GetScriptForDestination(CScriptID(multisig))),
+        CTxOut(COIN, GetScriptForRawPubKey(key.GetPubKey())),
+        CTxOut(COIN, multisig),
+    };
+
+    // The lookups give what solving each script gives, whatever the keystore went through
+    auto checkIsMine = [&]() {
+        for (const CTxOut& txout : vOut)
+            BOOST_CHECK_EQUAL(wallet.IsMine(txout), ::IsMine(wallet, txout.scriptPubKey));
+    };
+    checkIsMine();
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK_EQUAL(wallet.IsMine(vOut[0]), ISMINE_SPENDABLE);
+    checkIsMine();
+    BOOST_CHECK(wallet.AddCScript(multisig));
+    BOOST_CHECK_EQUAL(wallet.IsMine(vOut[3]), ISMINE_NO);
+    checkIsMine();
+    BOOST_CHECK(wallet.AddKeyPubKey(other, other.GetPubKey()));
+    BOOST_CHECK_EQUAL(wallet.IsMine(vOut[3]), ISMINE_SPENDABLE);
+    checkIsMine();
+    BOOST_CHECK(wallet.AddWatchOnly(vOut[2].scriptPubKey, 0));
+    BOOST_CHECK(wallet.IsMine(vOut[2]) & ISMINE_WATCH_ONLY);
+    checkIsMine();
+    BOOST_CHECK(wallet.RemoveWatchOnly(vOut[2].scriptPubKey));
+    BOOST_CHECK_EQUAL(wallet.IsMine(vOut[2]), ISMINE_NO);
+    checkIsMine();
+}
+
+BOOST_AUTO_TEST_CASE(walletdb_batch)
+{
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CBlockLocator locator(std::vector<uint256>(1, GetRandHash()));
+    CBlockLocator locatorAborted(std::vector<uint256>(1, GetRandHash()));
+    CBlockLocator locatorRead;
+    {
+        CWalletDBBatch batch(strFile);
+        BOOST_CHECK(CWalletDB(strFile).WriteRescanProgress(locator));
+
+        // The writes of the batch are seen by the thread, and a transaction
+        // nested in it rolls back alone
+        CWalletDB walletdb(strFile);
+        BOOST_CHECK(walletdb.ReadRescanProgress(locatorRead));
+        BOOST_CHECK(locatorRead.vHave == locator.vHave);
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WriteRescanProgress(locatorAborted));
+        BOOST_CHECK(walletdb.TxnAbort());
+    }
+    BOOST_CHECK(CWalletDB(strFile).ReadRescanProgress(locatorRead));
+    BOOST_CHECK(locatorRead.vHave == locator.vHave);
+    BOOST_CHECK(CWalletDB(strFile).EraseRescanProgress());
+}
+
 BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
 {
     LOCK(cs_main);
@@ -430,6 +551,33 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
     }
 }
 
+// Verify the cached totals follow the transactions added after they were read
+BOOST_FIXTURE_TEST_CASE(balances_cache, TestChain100Setup)
+{
+    LOCK(cs_main);
+
+    CBlockIndex* oldTip = chainActive.Tip();
+    CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    CBlockIndex* newTip = chainActive.Tip();
+
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 0);
+
+    wallet.ScanForWalletTransactions(newTip);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 50 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetBalances().nImmature, 50 * COIN);
+
+    wallet.ScanForWalletTransactions(oldTip);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 100 * COIN);
+
+    // A new tip starts a new generation without touching any transaction
+    wallet.UpdatedBlockTip(newTip, oldTip, false);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 100 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+}
+
 // Verify importwallet RPC starts rescan at earliest block with timestamp
 // greater or equal than key birthday. Previously there was a bug where
 // importwallet RPC would start the scan at the latest block with timestamp less
@@ -10,22 +10,30 @@
 #include "wallet/coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "indexer.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
+#include "miner.h"
 #include "validation.h"
 #include "net.h"
+#include "notifier.h"
 #include "policy/policy.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "ui_interface.h"
 #include "utilmoneystr.h"
 
 #include <assert.h>
+#include <limits>
+#include <tuple>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -119,14 +127,12 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+void CWallet::DeriveExternalChainKey(CExtKey& externalChainKey) const
 {
     // for now we use a fixed keypath scheme of m/0'/0'/k
     CKey key;                      //master key seed (256bit)
     CExtKey masterKey;             //hd master key
     CExtKey accountKey;            //key at m/0'
-    CExtKey externalChainChildKey; //key at m/0'/0'
-    CExtKey childKey;              //key at m/0'/0'/<n>'
 
     // try to get the master key
     if (!GetKey(hdChain.masterKeyID, key))
@@ -139,7 +145,14 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
     masterKey.Derive(accountKey, BIP32_HARDENED_KEY_LIMIT);
 
     // derive m/0'/0'
-    accountKey.Derive(externalChainChildKey, BIP32_HARDENED_KEY_LIMIT);
+    accountKey.Derive(externalChainKey, BIP32_HARDENED_KEY_LIMIT);
+}
+
+void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+{
+    CExtKey externalChainChildKey; //key at m/0'/0'
+    CExtKey childKey;              //key at m/0'/0'/<n>'
+    DeriveExternalChainKey(externalChainChildKey);
 
     // derive child key at next index, skip keys already known to the wallet
     do {
@@ -159,11 +172,65 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
         throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
 }
 
+SaltedScriptHasher::SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+void CWallet::AddOwnedKey(const CKeyID& keyID)
+{
+    LOCK(cs_KeyStore);
+    if (fOwnedScriptsDirty)
+        return;
+    // The key may make a script or a watch-only output solvable
+    if (!mapScripts.empty() || !setWatchOnly.empty()) {
+        fOwnedScriptsDirty = true;
+        return;
+    }
+    mapOwnedScripts[GetScriptForDestination(keyID)] = ISMINE_SPENDABLE;
+}
+
+void CWallet::MarkOwnedScriptsDirty()
+{
+    LOCK(cs_KeyStore);
+    fOwnedScriptsDirty = true;
+}
+
+void CWallet::BuildOwnedScripts() const
+{
+    AssertLockHeld(cs_KeyStore);
+    // Any pay to key hash or script hash output that is not ISMINE_NO pays
+    // to one of the keys, to one of the scripts or to a watch-only script
+    std::vector<CScript> vCandidates;
+    std::set<CKeyID> setKeyIDs;
+    GetKeys(setKeyIDs);
+    for (const CKeyID& keyID : setKeyIDs)
+        vCandidates.push_back(GetScriptForDestination(keyID));
+    for (const std::pair<const CScriptID, CScript>& item : mapScripts)
+        vCandidates.push_back(GetScriptForDestination(item.first));
+    for (const CScript& script : setWatchOnly)
+        vCandidates.push_back(script);
+
+    mapOwnedScripts.clear();
+    for (const CScript& script : vCandidates) {
+        isminetype mine = ::IsMine(*this, script);
+        if (mine != ISMINE_NO)
+            mapOwnedScripts[script] = mine;
+    }
+    fOwnedScriptsDirty = false;
+}
+
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddOwnedKey(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddOwnedKey(pubkey.GetID());
 
     // check if we need to remove from watch-only
     CScript script;
@@ -189,6 +256,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddOwnedKey(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
@@ -215,7 +283,10 @@ bool CWallet::LoadKeyMetadata(const CTxDestination& keyID, const CKeyMetadata &m
 
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddOwnedKey(vchPubKey.GetID());
+    return true;
 }
 
 void CWallet::UpdateTimeFirstKey(int64_t nCreateTime)
@@ -234,6 +305,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    MarkOwnedScriptsDirty();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -252,6 +324,7 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
+    MarkOwnedScriptsDirty();
     return CCryptoKeyStore::AddCScript(redeemScript);
 }
 
@@ -259,6 +332,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    MarkOwnedScriptsDirty();
     const CKeyMetadata& meta = mapKeyMetadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
@@ -278,6 +352,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkOwnedScriptsDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -289,6 +364,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
+    MarkOwnedScriptsDirty();
     return CCryptoKeyStore::AddWatchOnly(dest);
 }
 
@@ -305,8 +381,13 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 continue; // try another master key
-            if (CCryptoKeyStore::Unlock(vMasterKey))
+            bool fWasChecked = IsDecryptionThoroughlyChecked();
+            if (CCryptoKeyStore::Unlock(vMasterKey)) {
+                // Keys added from now on are encrypted with this master key, the check holds for them too
+                if (!fWasChecked && fFileBacked)
+                    CWalletDB(strWalletFile).WriteKeysChecked();
                 return true;
+            }
         }
     }
     return false;
@@ -578,6 +659,71 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::AddToDestinations(const uint256& wtxid)
+{
+    assert(mapWallet.count(wtxid));
+    const CWalletTx& thisTx = mapWallet[wtxid];
+    BOOST_FOREACH(const CTxOut& txout, thisTx.tx->vout) {
+        CTxDestination dest;
+        if (ExtractDestination(txout.scriptPubKey, dest))
+            mapDestinationTxs[dest].insert(wtxid);
+        else
+            setNoDestinationTxs.insert(wtxid);
+    }
+}
+
+void CWallet::IndexTxHeight(CWalletTx& wtx)
+{
+    int nHeight = -1;
+    if (wtx.nIndex != -1 && !wtx.hashUnset()) {
+        BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            nHeight = mi->second->nHeight;
+    }
+    if (nHeight == wtx.nHeightIndexed)
+        return;
+    if (wtx.nHeightIndexed != CWalletTx::HEIGHT_UNINDEXED)
+        setTxsByHeight.erase(std::make_pair(wtx.nHeightIndexed, wtx.GetHash()));
+    setTxsByHeight.insert(std::make_pair(nHeight, wtx.GetHash()));
+    wtx.nHeightIndexed = nHeight;
+}
+
+std::vector<const CWalletTx*> CWallet::GetTxsAfterHeight(int nHeight) const
+{
+    std::vector<const CWalletTx*> vTxs;
+    std::set<std::pair<int, uint256> >::const_iterator it = setTxsByHeight.begin();
+    for (; it != setTxsByHeight.end() && it->first < 0; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+        if (mi != mapWallet.end() && mi->second.nHeightIndexed == it->first)
+            vTxs.push_back(&mi->second);
+    }
+    for (it = setTxsByHeight.lower_bound(std::make_pair(nHeight + 1, uint256())); it != setTxsByHeight.end(); ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+        if (mi != mapWallet.end() && mi->second.nHeightIndexed == it->first)
+            vTxs.push_back(&mi->second);
+    }
+    return vTxs;
+}
+
+bool CWallet::IsSpentAtDepth(const CWalletTx& wtx, const CTxDestination& dest, int nMinDepth) const
+{
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        CTxDestination txOutAddr;
+        if (!ExtractDestination(wtx.tx->vout[i].scriptPubKey, txOutAddr) || txOutAddr != dest)
+            continue;
+
+        bool fSpent = false;
+        std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(wtx.GetHash(), i));
+        for (TxSpends::const_iterator it = range.first; it != range.second && !fSpent; ++it) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            fSpent = mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= nMinDepth;
+        }
+        if (!fSpent)
+            return false;
+    }
+    return true;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -941,6 +1087,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
                          wtxIn.hashBlock.ToString());
         }
         AddToSpends(hash);
+        AddToDestinations(hash);
     }
 
     bool fUpdated = false;
@@ -980,6 +1127,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    IndexTxHeight(wtx);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -987,11 +1135,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     // notify an external script when a wallet transaction comes in or is updated
     std::string strCmd = GetArg("-walletnotify", "");
 
-    if ( !strCmd.empty())
-    {
-        boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
-        boost::thread t(runCommand, strCmd); // thread runs free
-    }
+    if (!strCmd.empty() || (pnotifier && pnotifier->IsPiped()))
+        QueueNotify("wallet", strCmd, wtxIn.GetHash().GetHex(), false);
 
     return true;
 }
@@ -1005,6 +1150,7 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
+    AddToDestinations(hash);
     BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1098,6 +1244,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            IndexTxHeight(wtx);
             walletdb.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -1160,6 +1307,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
+            IndexTxHeight(wtx);
             walletdb.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1197,6 +1345,36 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
     }
 }
 
+void CWallet::BeginBlockTransactions()
+{
+    // Another thread writing to the batch's pages while holding cs_wallet
+    // would wait for its commit, which waits for cs_wallet
+    ENTER_CRITICAL_SECTION(cs_wallet);
+    fBlockBatch = bitdb.BeginBatch(strWalletFile);
+}
+
+void CWallet::EndBlockTransactions()
+{
+    if (fBlockBatch)
+        bitdb.EndBatch(strWalletFile);
+    fBlockBatch = false;
+    LEAVE_CRITICAL_SECTION(cs_wallet);
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    // Depths, maturity and trust of every transaction move with the tip
+    MarkBalancesDirty();
+}
+
+void CWallet::TransactionRemovedFromMempool(const CTransactionRef &ptx)
+{
+    // Unconfirmed transactions only count while they are in the mempool. The
+    // wallet lock is not taken here, under the mempool lock, so any removal
+    // starts a new generation.
+    MarkBalancesDirty();
+}
+
 
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
@@ -1233,7 +1411,15 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
-    return ::IsMine(*this, txout.scriptPubKey);
+    const CScript& script = txout.scriptPubKey;
+    if (!script.IsPayToPubKeyHash() && !script.IsPayToScriptHash())
+        return ::IsMine(*this, script);
+
+    LOCK(cs_KeyStore);
+    if (fOwnedScriptsDirty)
+        BuildOwnedScripts();
+    OwnedScripts::const_iterator it = mapOwnedScripts.find(script);
+    return it != mapOwnedScripts.end() ? it->second : ISMINE_NO;
 }
 
 CAmount CWallet::GetCredit(const CTxOut& txout, const isminefilter& filter) const
@@ -1404,6 +1590,21 @@ bool CWallet::IsHDEnabled()
     return !hdChain.masterKeyID.IsNull();
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalancesDirty();
+}
+
 int64_t CWalletTx::GetTxTime() const
 {
     int64_t n = nTimeSmart;
@@ -1549,10 +1750,95 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
  * successfully scanned.
  *
  */
-CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+/** A block read by a rescan thread, with the transactions paying to the wallet flagged */
+struct CRescanBlock
+{
+    CBlock block;
+    std::vector<bool> vfMine;
+    bool fValid;
+};
+
+static void ReadRescanBlocks(const CWallet* pwallet, std::vector<CRescanBlock>& vBlock, const std::vector<CBlockIndex*>& vIndex, size_t nStart, size_t nThread, size_t nThreads)
+{
+    for (size_t i = nThread; i < vBlock.size(); i += nThreads) {
+        CRescanBlock& item = vBlock[i];
+        item.fValid = ReadBlockFromDisk(item.block, vIndex[nStart + i], Params().GetConsensus());
+        if (!item.fValid)
+            continue;
+        // Only the key store is used here, the thread applying the batch holds cs_wallet
+        item.vfMine.resize(item.block.vtx.size());
+        for (size_t n = 0; n < item.block.vtx.size(); n++)
+            item.vfMine[n] = pwallet->IsMine(*item.block.vtx[n]);
+    }
+}
+
+bool CWallet::GetRescanHeights(int nStartHeight, std::set<int>& setHeights, int& nIndexHeight, const std::set<CScript>* psetScripts) const
+{
+    AssertLockHeld(cs_main);
+
+    if (!fAddressIndex || !paddressindex || !paddressindexer || !paddressindexer->IsSynced())
+        return false;
+    const CBlockIndex* pindexIndex = paddressindexer->GetBestBlockIndex();
+    if (!pindexIndex || !chainActive.Contains(pindexIndex))
+        return false;
+    nIndexHeight = pindexIndex->nHeight;
+
+    std::vector<CMyAddress> vAddress;
+    if (psetScripts) {
+        for (const CScript& script : *psetScripts) {
+            CMyAddress address;
+            if (!ExtractAddress(script, address))
+                return false;
+            vAddress.push_back(address);
+        }
+    } else {
+        LOCK(cs_KeyStore);
+        std::set<CKeyID> setKeyIds;
+        GetKeys(setKeyIds);
+        for (const CKeyID& keyid : setKeyIds)
+            vAddress.push_back(CMyAddress(keyid, CChainParams::PUBKEY_ADDRESS));
+        for (const std::pair<CScriptID, CScript>& item : mapScripts)
+            vAddress.push_back(CMyAddress(item.first, CChainParams::SCRIPT_ADDRESS));
+        for (const CScript& script : setWatchOnly) {
+            CMyAddress address;
+            // Scripts without an address are not in the index
+            if (!ExtractAddress(script, address))
+                return false;
+            vAddress.push_back(address);
+        }
+    }
+
+    for (const CMyAddress& address : vAddress) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+        unsigned int type = address.second == CChainParams::SCRIPT_ADDRESS ? 2 : 1;
+        if (!paddressindex->ReadAddressIndex(address.first, type, vHistory, std::max(nStartHeight, 1), nIndexHeight + 1))
+            return false;
+        for (const std::pair<CAddressIndexKey, CAmount>& item : vHistory)
+            setHeights.insert(item.first.blockHeight);
+    }
+    return true;
+}
+
+/**
+ * Scan the active chain from pindexStart to the tip for wallet transactions.
+ * Worker threads read the blocks in batches and flag the transactions paying
+ * to the wallet; the batch is then applied in chain order, where a
+ * transaction then spending from the wallet, or conflicting with one of its
+ * transactions, is found with a lookup before it goes through
+ * AddToWalletIfInvolvingMe. The block reached is written to the wallet now
+ * and then, so a rescan cut short by a shutdown resumes from there on the
+ * next start. With -rescanaddressindex, only the blocks the address index
+ * lists for the keys and scripts of the wallet, or for psetScripts when
+ * given, are read.
+ *
+ * Returns the first block scanned after the last one that could not be read,
+ * null if the last one could not be read.
+ */
+CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, const std::set<CScript>* psetScripts)
 {
     CBlockIndex* ret = nullptr;
     int64_t nNow = GetTime();
+    int64_t nLastCheckpoint = nNow;
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
@@ -1564,36 +1850,143 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        std::vector<CBlockIndex*> vIndex;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan))
+            vIndex.push_back(pindexScan);
+
+        // Leave out the blocks the address index has nothing of the wallet in
+        std::set<int> setHeights;
+        int nIndexHeight = -1;
+        if (pindex && GetBoolArg("-rescanaddressindex", DEFAULT_RESCAN_ADDRESS_INDEX)) {
+            if (GetRescanHeights(pindex->nHeight, setHeights, nIndexHeight, psetScripts)) {
+                std::vector<CBlockIndex*> vIndexed;
+                for (CBlockIndex* pindexScan : vIndex) {
+                    if (pindexScan->nHeight > nIndexHeight || setHeights.count(pindexScan->nHeight)) {
+                        vIndexed.push_back(pindexScan);
+                    } else if (!(pindexScan->nStatus & BLOCK_HAVE_DATA)) {
+                        // A pruned block counts as unreadable, as in a full scan
+                        vIndexed.push_back(pindexScan);
+                    }
+                }
+                LogPrintf("%s: address index leaves %u of %u blocks to scan\n", __func__, vIndexed.size(), vIndex.size());
+                vIndex.swap(vIndexed);
+            } else {
+                LogPrintf("%s: address index not usable for the wallet, scanning every block\n", __func__);
+            }
+        }
+        if (pindex && (vIndex.empty() || vIndex.front() != pindex))
+            ret = pindex;
+
+        // A rescan that was cut short further back stays on record until one covers it
+        bool fCheckpoint = fFileBacked;
+        if (fCheckpoint) {
+            CBlockLocator locator;
+            if (CWalletDB(strWalletFile).ReadRescanProgress(locator))
+                fCheckpoint = pindex && FindForkInGlobalIndex(chainActive, locator)->nHeight >= pindex->nHeight;
+        }
+
+        const size_t nThreads = std::max(1, std::min(GetNumCores(), WALLET_RESCAN_MAX_THREADS));
+        const size_t nBatchSize = nThreads * WALLET_RESCAN_BATCH_PER_THREAD;
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
         double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex)
+        bool fInterrupted = false;
+        for (size_t nStart = 0; nStart < vIndex.size(); nStart += nBatchSize)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            if (ShutdownRequested()) {
+                LogPrintf("Rescan interrupted at block %d, it resumes there on the next start\n", vIndex[nStart]->nHeight);
+                fInterrupted = true;
+                break;
+            }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
-                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+            std::vector<CRescanBlock> vBlock(std::min(nBatchSize, vIndex.size() - nStart));
+            boost::thread_group threadGroup;
+            for (size_t n = 0; n < nThreads; ++n)
+                threadGroup.create_thread(boost::bind(&ReadRescanBlocks, this, boost::ref(vBlock), boost::cref(vIndex), nStart, n, nThreads));
+            threadGroup.join_all();
+
+            CWalletDBBatch batch(strWalletFile);
+            for (size_t i = 0; i < vBlock.size(); ++i) {
+                CBlockIndex* pindexBlock = vIndex[nStart + i];
+                const CRescanBlock& item = vBlock[i];
+                if (!item.fValid) {
+                    ret = nullptr;
+                    continue;
                 }
-                if (!ret) {
-                    ret = pindex;
+                for (size_t posInBlock = 0; posInBlock < item.block.vtx.size(); ++posInBlock) {
+                    const CTransaction& tx = *item.block.vtx[posInBlock];
+                    bool fRelevant = item.vfMine[posInBlock] || mapWallet.count(tx.GetHash());
+                    for (size_t n = 0; !fRelevant && !tx.IsCoinBase() && n < tx.vin.size(); n++)
+                        fRelevant = mapWallet.count(tx.vin[n].prevout.hash) || mapTxSpends.count(tx.vin[n].prevout);
+                    if (fRelevant)
+                        AddToWalletIfInvolvingMe(tx, pindexBlock, posInBlock, fUpdate);
                 }
-            } else {
-                ret = nullptr;
+                if (!ret)
+                    ret = pindexBlock;
             }
-            pindex = chainActive.Next(pindex);
+
+            pindex = vIndex[nStart + vBlock.size() - 1];
+            if (dProgressTip - dProgressStart > 0.0)
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
             }
+            if (fCheckpoint && GetTime() >= nLastCheckpoint + WALLET_RESCAN_CHECKPOINT_INTERVAL) {
+                nLastCheckpoint = GetTime();
+                CWalletDB(strWalletFile).WriteRescanProgress(chainActive.GetLocator(pindex));
+            }
+        }
+        if (fCheckpoint) {
+            CWalletDB walletdb(strWalletFile);
+            if (!fInterrupted)
+                walletdb.EraseRescanProgress();
+            else if (pindex)
+                walletdb.WriteRescanProgress(chainActive.GetLocator(pindex));
         }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
 }
 
+void CWallet::QueueRescan(const CScript& script, int64_t nTime)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<CScript, int64_t>::iterator it = mapRescanQueue.find(script);
+    if (it == mapRescanQueue.end())
+        mapRescanQueue.insert(std::make_pair(script, nTime));
+    else
+        it->second = std::min(it->second, nTime);
+}
+
+CBlockIndex* CWallet::RescanQueued(CBlockIndex*& pindexStart)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    std::set<CScript> setScripts;
+    int64_t nTime = std::numeric_limits<int64_t>::max();
+    for (const std::pair<const CScript, int64_t>& item : mapRescanQueue) {
+        setScripts.insert(item.first);
+        nTime = std::min(nTime, item.second);
+    }
+    if (setScripts.empty()) {
+        pindexStart = nullptr;
+        return nullptr;
+    }
+
+    // Block times can be 2h off
+    pindexStart = nTime > 1 ? chainActive.FindEarliestAtLeast(std::max<int64_t>(nTime - 7200, 0)) : chainActive.Genesis();
+    CBlockIndex* ret = nullptr;
+    if (pindexStart) {
+        ret = ScanForWalletTransactions(pindexStart, true, &setScripts);
+        ReacceptWalletTransactions();
+    }
+    mapRescanQueue.clear();
+    return ret;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -1928,20 +2321,47 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    uint64_t nGeneration = nBalancesGeneration;
+    std::shared_ptr<const CBalancesCache> pCache = std::atomic_load(&pBalancesCache);
+    if (pCache && pCache->nGeneration == nGeneration)
+        return pCache->balances;
+
+    std::shared_ptr<CBalancesCache> pNew = std::make_shared<CBalancesCache>();
     {
         LOCK2(cs_main, cs_wallet);
+        // Read again under the locks, the events that start a generation
+        // come after the changes of the wallet or chain they stand for
+        pNew->nGeneration = nBalancesGeneration;
+        CWalletBalances& balances = pNew->balances;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            bool fTrusted = pcoin->IsTrusted();
+            if (fTrusted) {
+                balances.nBalance += pcoin->GetAvailableCredit();
+                balances.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+            } else if (pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool()) {
+                balances.nUnconfirmed += pcoin->GetAvailableCredit();
+                balances.nUnconfirmedWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+            }
+            balances.nImmature += pcoin->GetImmatureCredit();
+            balances.nImmatureWatchOnly += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
+    std::atomic_store(&pBalancesCache, std::shared_ptr<const CBalancesCache>(pNew));
+    return pNew->balances;
+}
+
+void CWallet::MarkBalancesDirty() const
+{
+    ++nBalancesGeneration;
+}
 
-    return nTotal;
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nBalance;
 }
 
 CAmount CWallet::GetAddressBalance(const CTxDestination& address)
@@ -1980,155 +2400,127 @@ bool CWallet::SelectAddress(CTxDestination& address, CAmount& addressBalance, co
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmatureWatchOnly;
 }
 
-void CWallet::AvailableCoins(vector<COutput>& vCoins, CTxDestination* paddress, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const
+void CWallet::AvailableCoinsOfTx(vector<COutput>& vCoins, const uint256& wtxid, const CWalletTx* pcoin, CTxDestination* paddress, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const
 {
-    vCoins.clear();
+    if (!CheckFinalTx(*pcoin))
+        return;
 
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+    if (fOnlyConfirmed && !pcoin->IsTrusted())
+        return;
 
-            if (!CheckFinalTx(*pcoin))
-                continue;
+    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+        return;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+    int nDepth = pcoin->GetDepthInMainChain();
+    if (nDepth < 0)
+        return;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+    // We should not consider coins which aren't at least in our mempool
+    // It's possible for these to be conflicted via ancestors which we may never be able to detect
+    if (nDepth == 0 && !pcoin->InMempool())
+        return;
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+    // We should not consider coins from transactions that are replacing
+    // other transactions.
+    //
+    // Example: There is a transaction A which is replaced by bumpfee
+    // transaction B. In this case, we want to prevent creation of
+    // a transaction B' which spends an output of B.
+    //
+    // Reason: If transaction A were initially confirmed, transactions B
+    // and B' would no longer be valid, so the user would have to create
+    // a new transaction C to replace B'. However, in the case of a
+    // one-block reorg, transactions B' and C might BOTH be accepted,
+    // when the user only wanted one of them. Specifically, there could
+    // be a 1-block reorg away from the chain where transactions A and C
+    // were accepted to another chain where B, B', and C were all
+    // accepted.
+    if (nDepth == 0 && fOnlyConfirmed && pcoin->mapValue.count("replaces_txid")) {
+        return;
+    }
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
-                continue;
+    // Similarly, we should not consider coins from transactions that
+    // have been replaced. In the example above, we would want to prevent
+    // creation of a transaction A' spending an output of A, because if
+    // transaction B were initially confirmed, conflicting with A and
+    // A', we wouldn't want to the user to create a transaction D
+    // intending to replace A', but potentially resulting in a scenario
+    // where A, A', and D could all be accepted (instead of just B and
+    // D, or just A and A' like the user would want).
+    if (nDepth == 0 && fOnlyConfirmed && pcoin->mapValue.count("replaced_by_txid")) {
+        return;
+    }
 
-            // We should not consider coins from transactions that are replacing
-            // other transactions.
-            //
-            // Example: There is a transaction A which is replaced by bumpfee
-            // transaction B. In this case, we want to prevent creation of
-            // a transaction B' which spends an output of B.
-            //
-            // Reason: If transaction A were initially confirmed, transactions B
-            // and B' would no longer be valid, so the user would have to create
-            // a new transaction C to replace B'. However, in the case of a
-            // one-block reorg, transactions B' and C might BOTH be accepted,
-            // when the user only wanted one of them. Specifically, there could
-            // be a 1-block reorg away from the chain where transactions A and C
-            // were accepted to another chain where B, B', and C were all
-            // accepted.
-            if (nDepth == 0 && fOnlyConfirmed && pcoin->mapValue.count("replaces_txid")) {
+    for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+        CTxDestination txOutAddr;
+        if (paddress && ExtractDestination(pcoin->tx->vout[i].scriptPubKey, txOutAddr)) {
+            if(txOutAddr != *paddress) {
                 continue;
             }
+        }
 
-            // Similarly, we should not consider coins from transactions that
-            // have been replaced. In the example above, we would want to prevent
-            // creation of a transaction A' spending an output of A, because if
-            // transaction B were initially confirmed, conflicting with A and
-            // A', we wouldn't want to the user to create a transaction D
-            // intending to replace A', but potentially resulting in a scenario
-            // where A, A', and D could all be accepted (instead of just B and
-            // D, or just A and A' like the user would want).
-            if (nDepth == 0 && fOnlyConfirmed && pcoin->mapValue.count("replaced_by_txid")) {
-                continue;
-            }
+        isminetype mine = IsMine(pcoin->tx->vout[i]);
+        if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
+            !IsLockedCoin(wtxid, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
+            (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
+                vCoins.push_back(COutput(pcoin, i, nDepth,
+                                         ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                                          (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
+                                         (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
+    }
+}
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
-                CTxDestination txOutAddr;
-                if (paddress && ExtractDestination(pcoin->tx->vout[i].scriptPubKey, txOutAddr)) {
-                    if(txOutAddr != *paddress) {
-                        continue;
-                    }
-                }
+void CWallet::AvailableCoins(vector<COutput>& vCoins, CTxDestination* paddress, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const
+{
+    vCoins.clear();
 
-                isminetype mine = IsMine(pcoin->tx->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
-                        vCoins.push_back(COutput(pcoin, i, nDepth,
-                                                 ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                                                  (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
-                                                 (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
-            }
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (!paddress) {
+            for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+                AvailableCoinsOfTx(vCoins, it->first, &it->second, paddress, fOnlyConfirmed, coinControl, fIncludeZeroValue);
+            return;
+        }
+
+        std::set<uint256> setTxids(setNoDestinationTxs);
+        TxDestinations::iterator itDest = mapDestinationTxs.find(*paddress);
+        if (itDest != mapDestinationTxs.end())
+            setTxids.insert(itDest->second.begin(), itDest->second.end());
+
+        // Spends at or below the irreversible block cannot be undone
+        std::pair<uint64_t, uint256> irreversible = DPoS::GetInstance().GetIrreversibleBlock();
+        int nFinalDepth = irreversible.second.IsNull() ? 0 : chainActive.Height() - (int)irreversible.first + 1;
+
+        for (const uint256& wtxid : setTxids) {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
+            AvailableCoinsOfTx(vCoins, wtxid, &it->second, paddress, fOnlyConfirmed, coinControl, fIncludeZeroValue);
+            if (nFinalDepth > 0 && itDest != mapDestinationTxs.end() && IsSpentAtDepth(it->second, *paddress, nFinalDepth))
+                itDest->second.erase(wtxid);
         }
     }
 }
@@ -2165,6 +2557,60 @@ static void ApproximateBestSubsetPreferUseLargInput(vector<pair<CAmount, pair<co
     }
 }
 
+/**
+ * Depth first search for the subset of vValue, sorted by decreasing value, worth
+ * at least nTargetValue and at most nTargetValue + nMaxExcess, with the least
+ * excess. The search is given up after COIN_SELECTION_BNB_TRIES steps.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, const CAmount& nMaxExcess,
+                           vector<char>& vfBest, CAmount& nBest)
+{
+    // The value of the coins from each position on, to drop branches that cannot reach the target
+    vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (size_t i = vValue.size(); i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+
+    vector<char> vfIncluded(vValue.size(), false);
+    CAmount nTotal = 0;
+    size_t i = 0;
+    bool fFound = false;
+
+    for (int nTries = 0; nTries < COIN_SELECTION_BNB_TRIES; nTries++)
+    {
+        bool fBacktrack = nTotal + vRemaining[i] < nTargetValue || nTotal > nTargetValue + nMaxExcess;
+        if (!fBacktrack && nTotal >= nTargetValue) {
+            if (!fFound || nTotal < nBest) {
+                fFound = true;
+                nBest = nTotal;
+                vfBest = vfIncluded;
+                if (nBest == nTargetValue)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (!fBacktrack) {
+            vfIncluded[i] = true;
+            nTotal += vValue[i].first;
+            i++;
+            continue;
+        }
+
+        // Go back to the last coin included and try without it
+        while (i > 0 && !vfIncluded[i - 1])
+            i--;
+        if (i == 0)
+            break;
+        vfIncluded[i - 1] = false;
+        nTotal -= vValue[i - 1].first;
+        // Leaving out the next coins of the same value would reach the same totals again
+        while (i < vValue.size() && vValue[i].first == vValue[i - 1].first)
+            i++;
+    }
+
+    return fFound;
+}
+
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, int& nCountvfBest, CAmount& nBest, int iterations = 1000)
 {
@@ -2293,16 +2739,31 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
     std::reverse(vValue.begin(), vValue.end());
     vector<char> vfBest;
     int nCountvfBest = 0;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nCountvfBest, nBest);
+    // A selection exceeding the target by less than a dust change output pays the excess as fee and needs no change
+    CAmount nMaxExcess = CTxOut(0, GetScriptForDestination(CKeyID())).GetDustThreshold(dustRelayFee) - 1;
+    if (SelectCoinsBnB(vValue, nTargetValue, std::max(nMaxExcess, (CAmount)0), vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        LogPrint("selectcoins", "SelectCoins() branch and bound: %d coins, total %s\n", setCoinsRet.size(), FormatMoney(nBest));
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation, in bounded time
+    int nIterations = std::max(1, std::min(1000, COIN_SELECTION_MAX_STEPS / (int)vValue.size()));
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nCountvfBest, nBest, nIterations);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nCountvfBest, nBest);
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nCountvfBest, nBest, nIterations);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2330,6 +2791,42 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
+/**
+ * Split vCoins by the address they pay to, keeping only the address of the
+ * preset inputs if there are some. A coin without an address cannot be spent
+ * with any other, so it makes a group of its own. Returns false if the preset
+ * inputs do not share an address.
+ */
+static bool GroupCoinsByAddress(const vector<COutput>& vCoins, const set<pair<const CWalletTx*, uint32_t> >& setPresetCoins, vector<vector<COutput> >& vGroups)
+{
+    CTxDestination destPreset;
+    for (const auto& preset : setPresetCoins) {
+        CTxDestination dest;
+        if (!ExtractDestination(preset.first->tx->vout[preset.second].scriptPubKey, dest))
+            return setPresetCoins.size() == 1;
+        if (preset != *setPresetCoins.begin() && dest != destPreset)
+            return false;
+        destPreset = dest;
+    }
+
+    std::map<CTxDestination, size_t> mapGroups;
+    for (const COutput& output : vCoins) {
+        CTxDestination dest;
+        if (!ExtractDestination(output.tx->tx->vout[output.i].scriptPubKey, dest)) {
+            if (setPresetCoins.empty())
+                vGroups.push_back(vector<COutput>(1, output));
+            continue;
+        }
+        if (!setPresetCoins.empty() && dest != destPreset)
+            continue;
+        std::map<CTxDestination, size_t>::iterator it = mapGroups.insert(std::make_pair(dest, vGroups.size())).first;
+        if (it->second == vGroups.size())
+            vGroups.push_back(vector<COutput>());
+        vGroups[it->second].push_back(output);
+    }
+    return true;
+}
+
 bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
 {
     vector<COutput> vCoins(vAvailableCoins);
@@ -2381,14 +2878,37 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
     size_t nMaxChainLength = std::min(GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT), GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
     bool fRejectLongChains = GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
-    bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+    // The confirmations and ancestors allowed, from the most to the least restrictive
+    std::vector<std::tuple<int, int, uint64_t> > vFilters = {std::make_tuple(1, 6, 0), std::make_tuple(1, 1, 0)};
+    if (bSpendZeroConfChange) {
+        vFilters.push_back(std::make_tuple(0, 1, 2));
+        vFilters.push_back(std::make_tuple(0, 1, std::min((size_t)4, nMaxChainLength/3)));
+        vFilters.push_back(std::make_tuple(0, 1, nMaxChainLength/2));
+        vFilters.push_back(std::make_tuple(0, 1, nMaxChainLength));
+        if (!fRejectLongChains)
+            vFilters.push_back(std::make_tuple(0, 1, std::numeric_limits<uint64_t>::max()));
+    }
+
+    // All the inputs of a transaction must come from one address, so the coins of
+    // each address are selected on their own and the least excess wins
+    std::vector<std::vector<COutput> > vGroups;
+    if (!GroupCoinsByAddress(vCoins, setPresetCoins, vGroups))
+        return false;
+
+    bool res = nTargetValue <= nValueFromPresetInputs;
+    for (size_t i = 0; i < vFilters.size() && !res; i++) {
+        for (const std::vector<COutput>& vGroup : vGroups) {
+            set<pair<const CWalletTx*,unsigned int> > setGroupCoins;
+            CAmount nGroupValue;
+            if (!SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, std::get<0>(vFilters[i]), std::get<1>(vFilters[i]), std::get<2>(vFilters[i]), vGroup, setGroupCoins, nGroupValue))
+                continue;
+            if (!res || nGroupValue < nValueRet) {
+                setCoinsRet.swap(setGroupCoins);
+                nValueRet = nGroupValue;
+                res = true;
+            }
+        }
+    }
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2697,7 +3217,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                             return false;
                         }
 
-                        vector<CTxOut>::iterator position = txNew.vout.begin()+nChangePosInOut;
+                        CTxOutVector::iterator position = txNew.vout.begin()+nChangePosInOut;
                         txNew.vout.insert(position, newTxOut);
                     }
                 } else {
@@ -2779,7 +3299,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     // to be addressed so we avoid creating too small an output.
                     if (nFeeRet > nFeeNeeded && nChangePosInOut != -1 && nSubtractFeeFromAmount == 0) {
                         CAmount extraFeePaid = nFeeRet - nFeeNeeded;
-                        vector<CTxOut>::iterator change_position = txNew.vout.begin()+nChangePosInOut;
+                        CTxOutVector::iterator change_position = txNew.vout.begin()+nChangePosInOut;
                         change_position->nValue += extraFeePaid;
                         nFeeRet -= extraFeePaid;
                     }
@@ -2789,7 +3309,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Try to reduce change to include necessary fee
                 if (nChangePosInOut != -1 && nSubtractFeeFromAmount == 0) {
                     CAmount additionalFeeNeeded = nFeeNeeded - nFeeRet;
-                    vector<CTxOut>::iterator change_position = txNew.vout.begin()+nChangePosInOut;
+                    CTxOutVector::iterator change_position = txNew.vout.begin()+nChangePosInOut;
                     // Only reduce change if remaining amount is still a large enough output.
                     if (change_position->nValue >= MIN_FINAL_CHANGE + additionalFeeNeeded) {
                         change_position->nValue -= additionalFeeNeeded;
@@ -2812,21 +3332,24 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         if (sign)
         {
             CTransaction txNewConst(txNew);
-            int nIn = 0;
+            std::vector<const CScript*> vScriptPubKey;
+            std::vector<CAmount> vAmount;
             for (const auto& coin : setCoins)
             {
-                const CScript& scriptPubKey = coin.first->tx->vout[coin.second].scriptPubKey;
-                SignatureData sigdata;
+                vScriptPubKey.push_back(&coin.first->tx->vout[coin.second].scriptPubKey);
+                vAmount.push_back(coin.first->tx->vout[coin.second].nValue);
+            }
 
-                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata))
+            std::vector<SignatureData> vSigData;
+            std::vector<bool> vSigned = ProduceSignatures(this, txNewConst, vScriptPubKey, vAmount, SIGHASH_ALL, vSigData);
+            for (unsigned int nIn = 0; nIn < vSigned.size(); nIn++)
+            {
+                if (!vSigned[nIn])
                 {
                     strFailReason = _("Signing transaction failed");
                     return false;
-                } else {
-                    UpdateTransaction(txNew, nIn, sigdata);
                 }
-
-                nIn++;
+                UpdateTransaction(txNew, nIn, vSigData[nIn]);
             }
         }
 
@@ -3077,7 +3600,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                             return false;
                         }
 
-                        vector<CTxOut>::iterator position = txNew.vout.begin()+nChangePosInOut;
+                        CTxOutVector::iterator position = txNew.vout.begin()+nChangePosInOut;
                         txNew.vout.insert(position, newTxOut);
                     }
                 }
@@ -3158,7 +3681,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     // to be addressed so we avoid creating too small an output.
                     if (nFeeRet > nFeeNeeded && nChangePosInOut != -1 && nSubtractFeeFromAmount == 0) {
                         CAmount extraFeePaid = nFeeRet - nFeeNeeded;
-                        vector<CTxOut>::iterator change_position = txNew.vout.begin()+nChangePosInOut;
+                        CTxOutVector::iterator change_position = txNew.vout.begin()+nChangePosInOut;
                         change_position->nValue += extraFeePaid;
                         nFeeRet -= extraFeePaid;
                     }
@@ -3168,7 +3691,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Try to reduce change to include necessary fee
                 if (nChangePosInOut != -1 && nSubtractFeeFromAmount == 0) {
                     CAmount additionalFeeNeeded = nFeeNeeded - nFeeRet;
-                    vector<CTxOut>::iterator change_position = txNew.vout.begin()+nChangePosInOut;
+                    CTxOutVector::iterator change_position = txNew.vout.begin()+nChangePosInOut;
                     // Only reduce change if remaining amount is still a large enough output.
                     if (change_position->nValue >= MIN_FINAL_CHANGE + additionalFeeNeeded) {
                         change_position->nValue -= additionalFeeNeeded;
@@ -3186,21 +3709,24 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         if (sign)
         {
             CTransaction txNewConst(txNew);
-            int nIn = 0;
+            std::vector<const CScript*> vScriptPubKey;
+            std::vector<CAmount> vAmount;
             for (const auto& coin : setCoins)
             {
-                const CScript& scriptPubKey = coin.first->tx->vout[coin.second].scriptPubKey;
-                SignatureData sigdata;
+                vScriptPubKey.push_back(&coin.first->tx->vout[coin.second].scriptPubKey);
+                vAmount.push_back(coin.first->tx->vout[coin.second].nValue);
+            }
 
-                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata))
+            std::vector<SignatureData> vSigData;
+            std::vector<bool> vSigned = ProduceSignatures(this, txNewConst, vScriptPubKey, vAmount, SIGHASH_ALL, vSigData);
+            for (unsigned int nIn = 0; nIn < vSigned.size(); nIn++)
+            {
+                if (!vSigned[nIn])
                 {
                     strFailReason = _("Signing transaction failed");
                     return false;
-                } else {
-                    UpdateTransaction(txNew, nIn, sigdata);
                 }
-
-                nIn++;
+                UpdateTransaction(txNew, nIn, vSigData[nIn]);
             }
         }
 
@@ -3271,6 +3797,8 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
         LOCK2(cs_main, cs_wallet);
         LogPrintf("CommitTransaction:\n%s", wtxNew.tx->ToString());
         {
+            CWalletDBBatch batch(strWalletFile);
+
             // Take key pair from key pool so it won't be used again
             reservekey.KeepKey();
 
@@ -3384,6 +3912,13 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        // The blocks of the transactions are on disk, their heights are found again
+        LOCK2(cs_main, cs_wallet);
+        for (std::pair<const uint256, CWalletTx>& item : mapWallet)
+            IndexTxHeight(item.second);
+    }
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -3523,32 +4058,131 @@ bool CWallet::NewKeyPool()
     return true;
 }
 
+/** A key pool key made by a TopUpKeyPool thread */
+struct CNewPoolKey
+{
+    CKey secret;
+    CPubKey pubkey;
+    std::string hdKeypath;
+};
+
+static void MakePoolKeys(std::vector<CNewPoolKey>& vKeys, const CExtKey* pchainKey, uint32_t nFirstIndex, bool fCompressed, size_t nThread, size_t nThreads)
+{
+    for (size_t i = nThread; i < vKeys.size(); i += nThreads) {
+        CNewPoolKey& key = vKeys[i];
+        if (pchainKey) {
+            CExtKey childKey;
+            pchainKey->Derive(childKey, (nFirstIndex + i) | BIP32_HARDENED_KEY_LIMIT);
+            key.secret = childKey.key;
+            key.hdKeypath = "m/0'/0'/" + std::to_string(nFirstIndex + i) + "'";
+        } else {
+            key.secret.MakeNewKey(fCompressed);
+        }
+        key.pubkey = key.secret.GetPubKey();
+        assert(key.secret.VerifyPubKey(key.pubkey));
+    }
+}
+
+/**
+ * Fill the key pool up to kpSize keys, or -keypool. The keys are made in
+ * chunks: the HD child indexes of a chunk are taken under cs_wallet, the
+ * keys derived or generated by worker threads without it, and then added
+ * and written under cs_wallet in one database batch. A caller that does not
+ * hold cs_wallet leaves the wallet usable while the keys are made.
+ */
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
+    // Top up key pool
+    unsigned int nTargetSize;
+    if (kpSize > 0)
+        nTargetSize = kpSize;
+    else
+        nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+
+    while (true)
     {
-        LOCK(cs_wallet);
+        std::vector<CNewPoolKey> vKeys;
+        CExtKey chainKey;
+        bool fHD;
+        uint32_t nFirstIndex = 0;
+        bool fCompressed;
+        CKeyMetadata metadata;
+        {
+            LOCK(cs_wallet);
 
-        if (IsLocked())
-            return false;
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() >= nTargetSize + 1)
+                break;
 
-        CWalletDB walletdb(strWalletFile);
+            vKeys.resize(std::min<size_t>(nTargetSize + 1 - setKeyPool.size(), KEYPOOL_TOPUP_CHUNK));
+            fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+            metadata = CKeyMetadata(GetTime());
+            fHD = IsHDEnabled();
+            if (fHD) {
+                DeriveExternalChainKey(chainKey);
+                metadata.hdMasterKeyID = hdChain.masterKeyID;
+                // Keys made meanwhile by GenerateNewKey go after this chunk
+                nFirstIndex = hdChain.nExternalChainCounter;
+                hdChain.nExternalChainCounter += vKeys.size();
+            }
+        }
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (kpSize > 0)
-            nTargetSize = kpSize;
-        else
-            nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+        const size_t nThreads = vKeys.size() < KEYPOOL_TOPUP_KEYS_PER_THREAD ? 1 : std::max(1, std::min(GetNumCores(), KEYPOOL_TOPUP_MAX_THREADS));
+        if (nThreads == 1) {
+            MakePoolKeys(vKeys, fHD ? &chainKey : NULL, nFirstIndex, fCompressed, 0, 1);
+        } else {
+            boost::thread_group threadGroup;
+            for (size_t n = 0; n < nThreads; ++n)
+                threadGroup.create_thread(boost::bind(&MakePoolKeys, boost::ref(vKeys), fHD ? &chainKey : NULL, nFirstIndex, fCompressed, n, nThreads));
+            threadGroup.join_all();
+        }
+
+        // The key IDs of the whole chunk, hashed several at a time before taking the lock
+        std::vector<CPubKey> vPubKeys;
+        vPubKeys.reserve(vKeys.size());
+        for (const CNewPoolKey& key : vKeys)
+            vPubKeys.push_back(key.pubkey);
+        const std::vector<CKeyID> vKeyIDs = GetPubKeyIDs(vPubKeys);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error(std::string(__func__) + ": writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            LOCK(cs_wallet);
+
+            if (IsLocked()) {
+                // Give the indexes back if no key was derived after them
+                if (fHD && hdChain.nExternalChainCounter == nFirstIndex + vKeys.size())
+                    hdChain.nExternalChainCounter = nFirstIndex;
+                return false;
+            }
+
+            // The keys and their pool entries are written in one transaction
+            CWalletDBBatch batch(strWalletFile);
+            CWalletDB walletdb(strWalletFile);
+
+            if (fCompressed)
+                SetMinVersion(FEATURE_COMPRPUBKEY);
+            if (fHD && !walletdb.WriteHDChain(hdChain))
+                throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+
+            UpdateTimeFirstKey(metadata.nCreateTime);
+            for (size_t i = 0; i < vKeys.size(); i++) {
+                const CNewPoolKey& key = vKeys[i];
+                // skip keys already known to the wallet, as DeriveNewChildKey does
+                if (HaveKey(vKeyIDs[i]))
+                    continue;
+                mapKeyMetadata[vKeyIDs[i]] = metadata;
+                mapKeyMetadata[vKeyIDs[i]].hdKeypath = key.hdKeypath;
+                if (!AddKeyPubKey(key.secret, key.pubkey))
+                    throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+
+                int64_t nEnd = 1;
+                if (!setKeyPool.empty())
+                    nEnd = *(--setKeyPool.end()) + 1;
+                if (!walletdb.WritePool(nEnd, CKeyPool(key.pubkey)))
+                    throw runtime_error(std::string(__func__) + ": writing generated key failed");
+                setKeyPool.insert(nEnd);
+            }
+            LogPrintf("keypool added %u keys, size=%u\n", vKeys.size(), setKeyPool.size());
         }
     }
     return true;
@@ -4072,6 +4706,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
+    strUsage += HelpMessageOpt("-rescanaddressindex", strprintf(_("Rescan only the blocks the address index lists for the wallet, when -addressindex is on and covers its scripts (default: %u)"), DEFAULT_RESCAN_ADDRESS_INDEX));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     if (showDebug)
         strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
@@ -4082,6 +4717,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletwritebehind=<n>", strprintf(_("Let the wallet database reach the disk up to <n> milliseconds after a write instead of on every one; a crash can lose the writes of that time (default: %u)"), DEFAULT_WALLET_WRITE_BEHIND));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -4217,6 +4853,15 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
             pindexRescan = FindForkInGlobalIndex(chainActive, locator);
         else
             pindexRescan = chainActive.Genesis();
+
+        // Go on with a rescan that a shutdown cut short
+        if (pindexRescan && walletdb.ReadRescanProgress(locator)) {
+            CBlockIndex* pindexResume = FindForkInGlobalIndex(chainActive, locator);
+            if (pindexResume && pindexResume->nHeight < pindexRescan->nHeight) {
+                LogPrintf("Resuming the rescan stopped at block %d\n", pindexResume->nHeight);
+                pindexRescan = pindexResume;
+            }
+        }
     }
     if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
     {
@@ -7,6 +7,7 @@
 #define BITCOIN_WALLET_WALLET_H
 
 #include "amount.h"
+#include "hash.h"
 #include "streams.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
@@ -22,10 +23,12 @@
 #include <algorithm>
 #include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -56,6 +59,24 @@ static const CAmount WALLET_INCREMENTAL_RELAY_FEE = 5000;
 static const CAmount MIN_CHANGE = CENT;
 //! final minimum change amount after paying for fees
 static const CAmount MIN_FINAL_CHANGE = MIN_CHANGE/2;
+//! steps the branch and bound coin selection may take looking for a selection without change
+static const int COIN_SELECTION_BNB_TRIES = 100000;
+//! coins the stochastic coin selection may visit, over all its iterations
+static const int COIN_SELECTION_MAX_STEPS = 1000 * 1000;
+//! Keys TopUpKeyPool makes at a time, between taking cs_wallet to add them
+static const size_t KEYPOOL_TOPUP_CHUNK = 1000;
+//! Maximum number of threads making key pool keys
+static const int KEYPOOL_TOPUP_MAX_THREADS = 8;
+//! Fewer keys than this are made by the calling thread alone
+static const size_t KEYPOOL_TOPUP_KEYS_PER_THREAD = 16;
+//! Maximum number of threads reading blocks for a rescan
+static const int WALLET_RESCAN_MAX_THREADS = 8;
+//! Blocks each rescan thread reads before the batch is applied
+static const int WALLET_RESCAN_BATCH_PER_THREAD = 16;
+//! Seconds between the records of how far a rescan got
+static const int64_t WALLET_RESCAN_CHECKPOINT_INTERVAL = 60;
+//! Default for -rescanaddressindex
+static const bool DEFAULT_RESCAN_ADDRESS_INDEX = false;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfreetransactions
@@ -95,6 +116,19 @@ enum WalletFeature
     FEATURE_LATEST = FEATURE_COMPRPUBKEY // HD is optional, use FEATURE_COMPRPUBKEY as latest version
 };
 
+class SaltedScriptHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedScriptHasher();
+
+    size_t operator()(const CScript& script) const {
+        return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+    }
+};
 
 /** A key pool entry */
 class CKeyPool
@@ -290,6 +324,9 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    //! memory only, the height the transaction is at in CWallet::setTxsByHeight
+    int nHeightIndexed;
+    static const int HEIGHT_UNINDEXED = -2;
 
     CWalletTx()
     {
@@ -330,6 +367,7 @@ public:
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        nHeightIndexed = HEIGHT_UNINDEXED;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -376,19 +414,8 @@ public:
         mapValue.erase("timesmart");
     }
 
-    //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    //! make sure balances are recalculated, the wallet totals included
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -567,11 +594,41 @@ private:
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
+/** The totals of a wallet, all computed in the same walk over its transactions */
+struct CWalletBalances
+{
+    CAmount nBalance;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnly;
+    CAmount nUnconfirmedWatchOnly;
+    CAmount nImmatureWatchOnly;
+
+    CWalletBalances() : nBalance(0), nUnconfirmed(0), nImmature(0), nWatchOnly(0), nUnconfirmedWatchOnly(0), nImmatureWatchOnly(0) {}
+};
+
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
     static std::atomic<bool> fFlushThreadRunning;
 
+    /**
+     * The totals as of a generation of the wallet. Every event that may change
+     * a balance (a wallet transaction marked dirty, a new tip, a transaction
+     * leaving the mempool) starts a new generation, and the totals
+     * are walked again on the first read after it. Readers of a current cache
+     * take no lock at all.
+     */
+    struct CBalancesCache
+    {
+        uint64_t nGeneration;
+        CWalletBalances balances;
+    };
+    //! Whether BeginBlockTransactions started a database batch
+    bool fBlockBatch;
+    mutable std::shared_ptr<const CBalancesCache> pBalancesCache;
+    mutable std::atomic<uint64_t> nBalancesGeneration;
+
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
@@ -601,6 +658,58 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The wallet transactions paying to each destination, so that the coins of
+     * one address are found without going through the whole wallet. Erased
+     * transactions are skipped on lookup, and a transaction is dropped from
+     * the list of an address once its outputs to it are spent below the
+     * irreversible block. Outputs without a destination are available to any
+     * address, as in the full scan.
+     */
+    typedef std::map<CTxDestination, std::set<uint256> > TxDestinations;
+    mutable TxDestinations mapDestinationTxs;
+    std::set<uint256> setNoDestinationTxs;
+    void AddToDestinations(const uint256& wtxid);
+
+    /**
+     * The wallet transactions by the height of the active chain block they are
+     * in, and at -1 the ones not confirmed on the active chain: unconfirmed,
+     * conflicted, abandoned or in a disconnected block. A transaction moves
+     * whenever its block changes, so listsinceblock goes through the blocks
+     * since the one asked for instead of the whole wallet. Erased transactions
+     * are skipped on lookup.
+     */
+    std::set<std::pair<int, uint256> > setTxsByHeight;
+    void IndexTxHeight(CWalletTx& wtx);
+
+    /**
+     * The pay to key hash and pay to script hash scripts that are the
+     * wallet's, by far the most common ones, with their isminetype, so that
+     * IsMine of such an output is one lookup instead of solving it against the
+     * keystore. A new key is added as it comes, from the keypool or an import;
+     * a script or watch-only change, or a key that could complete a script,
+     * has it built again on the next lookup. Guarded by cs_KeyStore.
+     */
+    typedef std::unordered_map<CScript, isminetype, SaltedScriptHasher> OwnedScripts;
+    mutable OwnedScripts mapOwnedScripts;
+    mutable bool fOwnedScriptsDirty;
+    void AddOwnedKey(const CKeyID& keyID);
+    void MarkOwnedScriptsDirty();
+    void BuildOwnedScripts() const;
+
+    /** Whether the outputs of wtx to dest are all spent by transactions at least nMinDepth deep */
+    bool IsSpentAtDepth(const CWalletTx& wtx, const CTxDestination& dest, int nMinDepth) const;
+    void AvailableCoinsOfTx(std::vector<COutput>& vCoins, const uint256& wtxid, const CWalletTx* pcoin, CTxDestination* paddress, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const;
+
+    /**
+     * Heights from nStartHeight on where the address index has a history
+     * entry of a key or script of the wallet, up to nIndexHeight, the height
+     * the index is at. False if the index is off, behind a reorganization or
+     * does not cover every script of the wallet. With psetScripts, only the
+     * entries of those scripts are looked up.
+     */
+    bool GetRescanHeights(int nStartHeight, std::set<int>& setHeights, int& nIndexHeight, const std::set<CScript>* psetScripts = nullptr) const;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -680,6 +789,7 @@ public:
         nWalletVersion = FEATURE_BASE;
         nWalletMaxVersion = FEATURE_BASE;
         fFileBacked = false;
+        fOwnedScriptsDirty = true;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
@@ -687,6 +797,8 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        nBalancesGeneration = 0;
+        fBlockBatch = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -696,6 +808,12 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
 
+    /**
+     * The transactions not confirmed on the active chain, then those in its blocks
+     * above nHeight by height. Requires cs_main and cs_wallet
+     */
+    std::vector<const CWalletTx*> GetTxsAfterHeight(int nHeight) const;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -717,9 +835,10 @@ public:
 
     /**
      * Shuffle and select coins until nTargetValue is reached while avoiding
-     * small change; This method is stochastic for some inputs and upon
-     * completion the coin set and corresponding actual target value is
-     * assembled
+     * small change; A selection whose excess is dust, which saves the change
+     * output, is searched first, then this method is stochastic for some
+     * inputs and upon completion the coin set and corresponding actual target
+     * value is assembled
      */
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
@@ -737,10 +856,12 @@ public:
      */
     CPubKey GenerateNewKey();
     void DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret);
+    //! The HD key at m/0'/0', which the key pool keys are derived from
+    void DeriveExternalChainKey(CExtKey& externalChainKey) const;
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CTxDestination& pubKey, const CKeyMetadata &metadata);
 
@@ -751,6 +872,8 @@ public:
     bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret) override;
     //! Adds an encrypted key to the store, without saving it to disk (used by LoadWallet)
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
+    //! Skip the check of every key on the first unlock, done in an earlier session (used by LoadWallet)
+    void LoadKeysChecked() { SetDecryptionThoroughlyChecked(); }
     bool AddCScript(const CScript& redeemScript) override;
     bool LoadCScript(const CScript& redeemScript);
 
@@ -788,8 +911,28 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     bool LoadToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
+    /** Write the wallet transactions of connected blocks in one database transaction, holding cs_wallet over it */
+    void BeginBlockTransactions() override;
+    void EndBlockTransactions() override;
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
-    CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, const std::set<CScript>* psetScripts = nullptr);
+
+    /**
+     * Scripts of the import call in progress, with the earliest time each may
+     * have been paid at, 1 when unknown. A call asked to rescan scans once for
+     * all of them, from the earliest time, looking up only those scripts in
+     * the address index; a call without a rescan drops them.
+     */
+    std::map<CScript, int64_t> mapRescanQueue;
+    void QueueRescan(const CScript& script, int64_t nTime);
+    /**
+     * Rescan for the queued scripts and empty the queue. pindexStart is set to
+     * the block the scan started at, null when the times are all after the
+     * tip; the return is that of ScanForWalletTransactions.
+     */
+    CBlockIndex* RescanQueued(CBlockIndex*& pindexStart);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
@@ -801,6 +944,10 @@ public:
     CAmount GetWatchOnlyBalance() const;
     CAmount GetUnconfirmedWatchOnlyBalance() const;
     CAmount GetImmatureWatchOnlyBalance() const;
+    /** All the totals above, from the cache unless something changed since they were last walked */
+    CWalletBalances GetBalances() const;
+    /** Have the next GetBalances walk the wallet again */
+    void MarkBalancesDirty() const;
 
     /**
      * Insert additional inputs into the transaction by
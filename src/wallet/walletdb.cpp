@@ -18,6 +18,7 @@
 #include <atomic>
 
 #include <boost/version.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
@@ -149,6 +150,23 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
     return Read(std::string("bestblock_nomerkle"), locator);
 }
 
+bool CWalletDB::WriteRescanProgress(const CBlockLocator& locator)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::ReadRescanProgress(CBlockLocator& locator)
+{
+    return Read(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::EraseRescanProgress()
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::string("rescanprogress"));
+}
+
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     nWalletDBUpdateCounter++;
@@ -183,6 +201,11 @@ bool CWalletDB::WriteMinVersion(int nVersion)
     return Write(std::string("minversion"), nVersion);
 }
 
+bool CWalletDB::WriteKeysChecked()
+{
+    return Write(std::string("keyschecked"), '1');
+}
+
 bool CWalletDB::ReadAccount(const string& strAccount, CAccount& account)
 {
     account.SetNull();
@@ -278,15 +301,32 @@ public:
     }
 };
 
+/** Read the transaction of a "tx" record past its type, false if it is corrupt */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    return CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid();
+}
+
+/**
+ * With pwtxDecoded, ssKey and ssValue are of a "tx" record whose transaction
+ * ReadWalletTx read into it, which is loaded as it is.
+ */
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
-             CWalletScanState &wss, string& strType, string& strErr)
+             CWalletScanState &wss, string& strType, string& strErr, CWalletTx* pwtxDecoded = NULL)
 {
     try {
         // Unserialize
         // Taking advantage of the fact that pair serialization
         // is just the two items serialized one after the other
-        ssKey >> strType;
+        if (pwtxDecoded)
+            strType = "tx";
+        else
+            ssKey >> strType;
         if (strType == "name")
         {
             string strAddress;
@@ -301,13 +341,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
-            CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            CWalletTx wtxRead;
+            if (!pwtxDecoded && !ReadWalletTx(ssKey, ssValue, wtxRead))
                 return false;
+            CWalletTx& wtx = pwtxDecoded ? *pwtxDecoded : wtxRead;
+            uint256 hash = wtx.GetHash();
 
             // Undo serialize changes in 31600
             if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
@@ -539,6 +577,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "keyschecked")
+        {
+            pwallet->LoadKeysChecked();
+        }
     } catch (...)
     {
         return false;
@@ -546,6 +588,43 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+/** A record of the wallet database, with the transaction of a "tx" record decoded ahead of ReadKeyValue */
+struct CWalletRecord {
+    CDataStream ssKey;
+    CDataStream ssValue;
+    //! Whether ReadWalletTx read the record, leaving the streams past the transaction
+    bool fTxDecoded;
+    bool fTxValid;
+    CWalletTx wtx;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), fTxDecoded(false), fTxValid(false) {}
+};
+
+/** Records LoadWallet reads from the cursor before decoding their transactions */
+static const size_t WALLET_LOAD_BATCH_SIZE = 10000;
+/** Records of a batch below which their transactions are decoded on the calling thread, and the least each thread takes on */
+static const size_t WALLET_LOAD_RECORDS_PER_THREAD = 1000;
+
+static void DecodeWalletRecords(std::vector<CWalletRecord>& vRecords, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CWalletRecord& record = vRecords[i];
+        try {
+            CDataStream ssType(record.ssKey);
+            string strType;
+            ssType >> strType;
+            if (strType != "tx")
+                continue;
+            record.ssKey >> strType;
+            record.fTxDecoded = true;
+            record.fTxValid = ReadWalletTx(record.ssKey, record.ssValue, record.wtx);
+        } catch (...) {
+            // A record whose type does not read is left to ReadKeyValue, a transaction that does not is corrupt
+            record.fTxValid = false;
+        }
+    }
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
@@ -577,39 +656,71 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
-        while (true)
+        // The records are read in batches. The transactions of a batch, most of the cost of a large
+        // wallet, are decoded and checked on several threads, then every record is loaded in the
+        // order of the database
+        std::vector<CWalletRecord> vRecords;
+        vRecords.reserve(WALLET_LOAD_BATCH_SIZE);
+        bool fDone = false;
+        while (!fDone)
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            vRecords.clear();
+            while (vRecords.size() < WALLET_LOAD_BATCH_SIZE)
             {
-                LogPrintf("Error reading next record from wallet database\n");
-                return DB_CORRUPT;
+                // Read next record
+                vRecords.emplace_back();
+                int ret = ReadAtCursor(pcursor, vRecords.back().ssKey, vRecords.back().ssValue);
+                if (ret == DB_NOTFOUND)
+                {
+                    vRecords.pop_back();
+                    fDone = true;
+                    break;
+                }
+                else if (ret != 0)
+                {
+                    LogPrintf("Error reading next record from wallet database\n");
+                    return DB_CORRUPT;
+                }
             }
 
-            // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            size_t nThreads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), vRecords.size() / WALLET_LOAD_RECORDS_PER_THREAD));
+            size_t nPerThread = (vRecords.size() + nThreads - 1) / nThreads;
+            boost::thread_group threadGroup;
+            for (size_t i = 1; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&DecodeWalletRecords, boost::ref(vRecords), i * nPerThread, std::min(vRecords.size(), (i + 1) * nPerThread)));
+            DecodeWalletRecords(vRecords, 0, std::min(vRecords.size(), nPerThread));
+            threadGroup.join_all();
+
+            for (CWalletRecord& record : vRecords)
             {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType))
-                    result = DB_CORRUPT;
+                // Try to be tolerant of single corrupt records:
+                string strType, strErr;
+                bool fReadOK;
+                if (record.fTxDecoded)
+                {
+                    strType = "tx";
+                    fReadOK = record.fTxValid && ReadKeyValue(pwallet, record.ssKey, record.ssValue, wss, strType, strErr, &record.wtx);
+                }
                 else
+                    fReadOK = ReadKeyValue(pwallet, record.ssKey, record.ssValue, wss, strType, strErr);
+                if (!fReadOK)
                 {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
+                    // losing keys is considered a catastrophic error, anything else
+                    // we assume the user can live with:
+                    if (IsKeyType(strType))
+                        result = DB_CORRUPT;
+                    else
+                    {
+                        // Leave other errors alone, if we try to fix them we might make things worse.
+                        fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                        if (strType == "tx")
+                            // Rescan if there is a bad transaction record:
+                            SoftSetBoolArg("-rescan", true);
+                    }
                 }
+                if (!strErr.empty())
+                    LogPrintf("%s\n", strErr);
             }
-            if (!strErr.empty())
-                LogPrintf("%s\n", strErr);
         }
         pcursor->close();
     }
@@ -800,6 +911,10 @@ void ThreadFlushWalletDB()
     {
         MilliSleep(500);
 
+        // Bound how late the commits of -walletwritebehind reach the disk
+        if (bitdb.nWriteBehindMs > 0)
+            bitdb.CheckpointIfDue(false);
+
         if (nLastSeen != CWalletDB::GetUpdateCounter())
         {
             nLastSeen = CWalletDB::GetUpdateCounter();
@@ -141,6 +141,11 @@ public:
     bool WriteBestBlock(const CBlockLocator& locator);
     bool ReadBestBlock(CBlockLocator& locator);
 
+    //! The block an unfinished rescan got to
+    bool WriteRescanProgress(const CBlockLocator& locator);
+    bool ReadRescanProgress(CBlockLocator& locator);
+    bool EraseRescanProgress();
+
     bool WriteOrderPosNext(int64_t nOrderPosNext);
 
     bool WriteDefaultKey(const CPubKey& vchPubKey);
@@ -150,6 +155,8 @@ public:
     bool ErasePool(int64_t nPool);
 
     bool WriteMinVersion(int nVersion);
+    //! Record that an unlock decrypted and verified every encrypted key
+    bool WriteKeysChecked();
 
     /// This writes directly to the database, and will not update the CWallet's cached accounting entries!
     /// Use wallet.AddAccountingEntry instead, to write *and* update its caches.
@@ -183,6 +190,29 @@ private:
     void operator=(const CWalletDB&);
 };
 
+/**
+ * Scope in which the writes of the calling thread to a wallet file, through
+ * any CWalletDB, go into one database transaction with one checkpoint at the
+ * end. See CDBEnv::BeginBatch.
+ */
+class CWalletDBBatch
+{
+public:
+    explicit CWalletDBBatch(const std::string& strFileIn) : strFile(strFileIn), fActive(bitdb.BeginBatch(strFileIn)) {}
+    ~CWalletDBBatch()
+    {
+        if (fActive)
+            bitdb.EndBatch(strFile);
+    }
+
+private:
+    CWalletDBBatch(const CWalletDBBatch&);
+    void operator=(const CWalletDBBatch&);
+
+    const std::string strFile;
+    const bool fActive;
+};
+
 void ThreadFlushWalletDB();
 
 #endif // BITCOIN_WALLET_WALLETDB_H
@@ -20,3 +20,28 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyForgingSlot(const CForgingSlotStats &/*slot*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyDPoSRound(const CDPoSRoundEvent &/*round*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyIrreversibleBlock(int64_t /*nHeight*/, const uint256 &/*hash*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyDPoSVotes(const CDPoSVoteEvent &/*votes*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyDPoSBalances(const CDPoSBalanceEvent &/*balances*/)
+{
+    return true;
+}
@@ -9,6 +9,11 @@
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+struct CDPoSBalanceEvent;
+struct CDPoSRoundEvent;
+struct CDPoSVoteEvent;
+struct CForgingSlotStats;
+class uint256;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
@@ -34,6 +39,11 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyForgingSlot(const CForgingSlotStats &slot);
+    virtual bool NotifyDPoSRound(const CDPoSRoundEvent &round);
+    virtual bool NotifyIrreversibleBlock(int64_t nHeight, const uint256 &hash);
+    virtual bool NotifyDPoSVotes(const CDPoSVoteEvent &votes);
+    virtual bool NotifyDPoSBalances(const CDPoSBalanceEvent &balances);
 
 protected:
     void *psocket;
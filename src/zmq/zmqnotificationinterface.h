@@ -12,6 +12,9 @@
 class CBlockIndex;
 class CZMQAbstractNotifier;
 
+//! Messages a subscriber may fall behind by before its topics drop more, the ZMQ default
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+
 class CZMQNotificationInterface : public CValidationInterface
 {
 public:
@@ -26,6 +29,11 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    void ForgingSlot(const CForgingSlotStats &slot);
+    void DPoSRound(const CDPoSRoundEvent &round);
+    void IrreversibleBlock(int64_t nHeight, const uint256 &hash);
+    void DPoSVotes(const CDPoSVoteEvent &votes);
+    void DPoSBalances(const CDPoSBalanceEvent &balances);
 
 private:
     CZMQNotificationInterface();
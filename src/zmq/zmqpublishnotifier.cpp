@@ -3,7 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "miner.h"
+#include "rawblockcache.h"
 #include "streams.h"
+#include "vote.h"
+#include "zmqnotificationinterface.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
 #include "util.h"
@@ -15,6 +19,11 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_FORGINGSLOT = "forgingslot";
+static const char *MSG_DPOSROUND = "dposround";
+static const char *MSG_IRREVERSIBLE = "irreversible";
+static const char *MSG_VOTE = "vote";
+static const char *MSG_BALANCE = "balance";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -56,6 +65,47 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+typedef std::shared_ptr<const std::vector<unsigned char> > SharedData;
+
+static void zmq_free_shared(void *data, void *hint)
+{
+    delete static_cast<SharedData*>(hint);
+}
+
+// Internal function to send command, shared data and sequence number as a
+// multipart message, the data by reference
+static int zmq_send_shared(void *sock, const char *command, const SharedData& data, const void* msgseq, size_t seqsize)
+{
+    if (zmq_send(sock, command, strlen(command), ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return -1;
+    }
+
+    zmq_msg_t msg;
+    SharedData* pref = new SharedData(data);
+    if (zmq_msg_init_data(&msg, const_cast<unsigned char*>(data->data()), data->size(), zmq_free_shared, pref) != 0)
+    {
+        delete pref;
+        zmqError("Unable to initialize ZMQ msg");
+        return -1;
+    }
+    if (zmq_msg_send(&msg, sock, ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return -1;
+    }
+    zmq_msg_close(&msg);
+
+    if (zmq_send(sock, msgseq, seqsize, 0) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return -1;
+    }
+    return 0;
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -72,6 +122,14 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
+        int hwm = GetArg("-zmqpubhwm", DEFAULT_ZMQ_SNDHWM);
+        if (zmq_setsockopt(psocket, ZMQ_SNDHWM, &hwm, sizeof(hwm)) != 0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
         int rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
@@ -142,6 +200,21 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const SharedData& data)
+{
+    assert(psocket);
+
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSequence);
+    int rc = zmq_send_shared(psocket, command, data, msgseq, sizeof(uint32_t));
+    if (rc == -1)
+        return false;
+
+    nSequence++;
+
+    return true;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -166,28 +239,75 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    // A block just connected is in the raw block cache, serialized already
+    SharedData pdata = rawBlockCache.Get(pindex->GetBlockHash(), !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS));
+    if (!pdata)
     {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        std::shared_ptr<std::vector<unsigned char> > pblockData = std::make_shared<std::vector<unsigned char> >();
         {
-            zmqError("Can't read block from disk");
-            return false;
+            LOCK(cs_main);
+            CBlock block;
+            if(!ReadBlockFromDisk(block, pindex, consensusParams))
+            {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags(), *pblockData, 0, block);
         }
-
-        ss << block;
+        pdata = pblockData;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, pdata);
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    std::shared_ptr<std::vector<unsigned char> > ptxData = std::make_shared<std::vector<unsigned char> >();
+    ptxData->reserve(::GetSerializeSize(transaction, SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags()));
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags(), *ptxData, 0, transaction);
+    return SendMessage(MSG_RAWTX, SharedData(ptxData));
+}
+
+bool CZMQPublishForgingSlotNotifier::NotifyForgingSlot(const CForgingSlotStats &slot)
+{
+    LogPrint("zmq", "zmq: Publish forgingslot %d\n", slot.nSlotTime);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << slot;
+    return SendMessage(MSG_FORGINGSLOT, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishDPoSRoundNotifier::NotifyDPoSRound(const CDPoSRoundEvent &round)
+{
+    LogPrint("zmq", "zmq: Publish dposround %d\n", round.nLoopIndex);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << round;
+    return SendMessage(MSG_DPOSROUND, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishIrreversibleBlockNotifier::NotifyIrreversibleBlock(int64_t nHeight, const uint256 &hash)
+{
+    LogPrint("zmq", "zmq: Publish irreversible %s\n", hash.GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nHeight << hash;
+    return SendMessage(MSG_IRREVERSIBLE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishDPoSVotesNotifier::NotifyDPoSVotes(const CDPoSVoteEvent &votes)
+{
+    LogPrint("zmq", "zmq: Publish vote %s\n", votes.hashBlock.GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << votes;
+    return SendMessage(MSG_VOTE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishDPoSBalancesNotifier::NotifyDPoSBalances(const CDPoSBalanceEvent &balances)
+{
+    LogPrint("zmq", "zmq: Publish balance %s\n", balances.hashBlock.GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << balances;
+    return SendMessage(MSG_BALANCE, &(*ss.begin()), ss.size());
 }
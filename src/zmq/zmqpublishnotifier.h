@@ -7,6 +7,9 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <memory>
+#include <vector>
+
 class CBlockIndex;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
@@ -23,6 +26,9 @@ public:
           * message sequence number
     */
     bool SendMessage(const char *command, const void* data, size_t size);
+    /* the same, handing the data to zmq without a copy; it keeps a
+       reference to the bytes until its I/O thread has sent them */
+    bool SendMessage(const char *command, const std::shared_ptr<const std::vector<unsigned char> >& data);
 
     bool Initialize(void *pcontext);
     void Shutdown();
@@ -52,4 +58,34 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+class CZMQPublishForgingSlotNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyForgingSlot(const CForgingSlotStats &slot);
+};
+
+class CZMQPublishDPoSRoundNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyDPoSRound(const CDPoSRoundEvent &round);
+};
+
+class CZMQPublishIrreversibleBlockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyIrreversibleBlock(int64_t nHeight, const uint256 &hash);
+};
+
+class CZMQPublishDPoSVotesNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyDPoSVotes(const CDPoSVoteEvent &votes);
+};
+
+class CZMQPublishDPoSBalancesNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyDPoSBalances(const CDPoSBalanceEvent &balances);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H